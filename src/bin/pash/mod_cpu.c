@@ -27,10 +27,38 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <sys/pix.h>
+#include <machine/sysarch.h>
 #include "pash.h"
 
+#define SWITCH_BENCH_PAGES      64
+#define SWITCH_BENCH_ITERS      10000
+#define PAGESIZE                4096
+
 unsigned long long syscall(int, ...);
 
+/*
+ * Parse a decimal number
+ */
+static int
+_parse_number(const char *s, long long *val)
+{
+    long long v;
+
+    if ( NULL == s || '\0' == *s ) {
+        return -1;
+    }
+    v = 0;
+    for ( ; '\0' != *s; s++ ) {
+        if ( *s < '0' || *s > '9' ) {
+            return -1;
+        }
+        v = v * 10 + (*s - '0');
+    }
+    *val = v;
+
+    return 0;
+}
+
 /*
  * Display the help message of the CPU module
  */
@@ -39,7 +67,44 @@ pash_module_cpu_help(struct pash *pash, char *args[])
 {
     printf("Module: CPU\n"
            "help cpu\n"
-           "get cpu\n");
+           "get cpu\n"
+           "get cpu locks\n"
+           "clear cpu locks\n"
+           "request cpu switch-bench [<pages> [<iterations>]]\n");
+    return 0;
+}
+
+/*
+ * Display the lock contention statistics
+ */
+static int
+_get_locks(void)
+{
+    struct sysarch_lock_stats *stats;
+    struct sysarch_lock_stat *st;
+    char buf[512];
+    int i;
+
+    stats = malloc(sizeof(struct sysarch_lock_stats));
+    if ( NULL == stats ) {
+        return -1;
+    }
+    if ( sysarch(SYSARCH_LOCKSTAT, stats) < 0 ) {
+        fputs("Could not get the lock statistics.\n", stderr);
+        free(stats);
+        return -1;
+    }
+
+    for ( i = 0; i < stats->nr; i++ ) {
+        st = &stats->locks[i];
+        snprintf(buf, sizeof(buf), "Lock %s: %lld acquisitions, %lld "
+                 "contended, %lld spins, max wait %lld cycles\n", st->name,
+                 (long long)st->acquisitions, (long long)st->contentions,
+                 (long long)st->spins, (long long)st->max_wait);
+        fputs(buf, stdout);
+    }
+    free(stats);
+
     return 0;
 }
 
@@ -54,6 +119,10 @@ pash_module_cpu_get(struct pash *pash, char *args[])
     ssize_t i;
     char buf[512];
 
+    if ( NULL != args[2] && 0 == strcmp("locks", args[2]) ) {
+        return _get_locks();
+    }
+
     n = syscall(SYS_pix_cpu_table, SYSPIX_LDCTBL, &cputable);
     if ( n < 0 ) {
         fputs("Could not get processor list.\n", stderr);
@@ -83,11 +152,101 @@ pash_module_cpu_get(struct pash *pash, char *args[])
     return 0;
 }
 
+/*
+ * Measure the cost of a round trip between the address spaces of this process
+ * and the kernel, with and without flushing the TLB
+ */
+static int
+_request_switch_bench(char *args[])
+{
+    struct sysarch_switch_bench bench;
+    long long npages;
+    long long iters;
+    char buf[512];
+    int ret;
+
+    npages = SWITCH_BENCH_PAGES;
+    iters = SWITCH_BENCH_ITERS;
+    if ( NULL != args[3] ) {
+        if ( _parse_number(args[3], &npages) < 0 || npages <= 0 ) {
+            return -1;
+        }
+        if ( NULL != args[4] ) {
+            if ( _parse_number(args[4], &iters) < 0 || iters <= 0 ) {
+                return -1;
+            }
+        }
+    }
+
+    bench.buf = malloc(npages * PAGESIZE);
+    if ( NULL == bench.buf ) {
+        fputs("Could not allocate the buffer.\n", stderr);
+        return -1;
+    }
+    /* Touch the buffer in advance */
+    memset(bench.buf, 0, npages * PAGESIZE);
+    bench.npages = npages;
+    bench.iters = iters;
+
+    ret = sysarch(SYSARCH_SWITCHBENCH, &bench);
+    free(bench.buf);
+    if ( ret < 0 ) {
+        fputs("Could not run the context-switch benchmark.\n", stderr);
+        return -1;
+    }
+
+    snprintf(buf, sizeof(buf), "Context switch with %lld pages touched "
+             "(%lld iterations, PCID %d):\n", npages, iters, bench.pcid);
+    fputs(buf, stdout);
+    snprintf(buf, sizeof(buf), "  TLB flush: %lld cycles/round trip\n",
+             (long long)bench.flush_cycles);
+    fputs(buf, stdout);
+    snprintf(buf, sizeof(buf), "  No flush:  %lld cycles/round trip\n",
+             (long long)bench.noflush_cycles);
+    fputs(buf, stdout);
+
+    return 0;
+}
+
+/*
+ * Run a request to the CPU module
+ */
+int
+pash_module_cpu_request(struct pash *pash, char *args[])
+{
+    if ( NULL != args[2] && 0 == strcmp("switch-bench", args[2]) ) {
+        if ( _request_switch_bench(args) < 0 ) {
+            pash_module_cpu_help(pash, args);
+            return -1;
+        }
+        return 0;
+    }
+
+    pash_module_cpu_help(pash, args);
+
+    return -1;
+}
+
+/*
+ * Reset the lock contention statistics
+ */
+int
+pash_module_cpu_clear(struct pash *pash, char *args[])
+{
+    if ( NULL != args[2] && 0 == strcmp("locks", args[2]) ) {
+        return sysarch(SYSARCH_LOCKSTAT_CLR, NULL);
+    }
+
+    pash_module_cpu_help(pash, args);
+
+    return -1;
+}
+
 static char *pash_module_cpu_name = "cpu";
 static struct pash_module_api pash_module_cpu_api = {
-    .clear = NULL,
+    .clear = &pash_module_cpu_clear,
     .help = &pash_module_cpu_help,
-    .request = NULL,
+    .request = &pash_module_cpu_request,
     .get = &pash_module_cpu_get,
 };
 
@@ -0,0 +1,2224 @@
+/*_
+ * Copyright (c) 2017 Hirochika Asai <asai@jar.jp>
+ * All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/pix.h>
+#include "pash.h"
+
+/* Statistics of the forwarding engine (attached once) */
+static struct pix_fe_stats *pash_module_fe_stats = NULL;
+/* Capture configuration of the forwarding engine (attached once) */
+static struct pix_fe_capture_conf *pash_module_fe_capture = NULL;
+/* Packet generator configuration of the forwarding engine (attached once) */
+static struct pix_fe_pktgen_conf *pash_module_fe_pktgen = NULL;
+/* Polling configuration of the forwarding engine (attached once) */
+static struct pix_fe_poll_conf *pash_module_fe_poll = NULL;
+/* Names of the cache placements (indexed by PIX_FE_POLL_PLACE_*) */
+static const char *pash_module_fe_poll_places[PIX_FE_POLL_NPLACES] = {
+    "plain", "dca", "hsplit", "dca+hsplit"
+};
+/* Pipeline configuration */
+static struct pix_fe_pipeline_conf *pash_module_fe_pipeline = NULL;
+/* Names of the chains (indexed by PIX_FE_CHAIN_*) */
+static const char *pash_module_fe_chains[PIX_FE_NCHAINS] = {
+    "bridge", "static", "hub", "filter", "nat", "tunnel"
+};
+/* Packet filter configuration */
+static struct pix_fe_filter_conf *pash_module_fe_filter = NULL;
+/* QoS configuration */
+static struct pix_fe_qos_conf *pash_module_fe_qos = NULL;
+/* Link aggregation configuration */
+static struct pix_fe_lag_conf *pash_module_fe_lag = NULL;
+/* Names of the hash modes (indexed by PIX_FE_LAG_HASH_*) */
+static const char *pash_module_fe_lag_hashes[3] = { "l2", "l3", "l4" };
+/* Storm control configuration */
+static struct pix_fe_storm_conf *pash_module_fe_storm = NULL;
+/* Names of the storm control classes (indexed by PIX_FE_STORM_*) */
+static const char *pash_module_fe_storm_classes[PIX_FE_STORM_NCLASSES] = {
+    "bcast", "mcast", "unknown"
+};
+/* IGMP snooping configuration */
+static struct pix_fe_mcast_conf *pash_module_fe_mcast = NULL;
+/* NAT44 configuration */
+static struct pix_fe_nat_conf *pash_module_fe_nat = NULL;
+/* Names of the timeouts (indexed by PIX_FE_NAT_TO_*) */
+static const char *pash_module_fe_nat_timeouts[PIX_FE_NAT_NTIMEOUTS] = {
+    "tcp", "trans", "udp"
+};
+/* Tunnel endpoint configuration */
+static struct pix_fe_tunnel_conf *pash_module_fe_tunnel = NULL;
+/* Names of the tunnel types (indexed by PIX_FE_TUNNEL_*) */
+static const char *pash_module_fe_tunnel_types[3] = { "none", "vxlan", "gre" };
+
+static struct pix_fe_fdir_conf *pash_module_fe_fdir = NULL;
+/* Names of the Flow Director modes (indexed by PIX_FE_FDIR_*) */
+static const char *pash_module_fe_fdir_modes[3] = {
+    "none", "perfect", "signature"
+};
+
+/*
+ * Attach the shared statistics of the forwarding engine
+ */
+static struct pix_fe_stats *
+_attach_stats(void)
+{
+    if ( NULL == pash_module_fe_stats ) {
+        pash_module_fe_stats = pix_shm_attach(PIX_FE_STATS_SHM, NULL);
+    }
+
+    return pash_module_fe_stats;
+}
+
+/*
+ * Parse a decimal or hexadecimal (0x-prefixed) number
+ */
+static int
+_parse_number(const char *s, uint64_t *val)
+{
+    uint64_t v;
+    int base;
+    int d;
+
+    if ( NULL == s || '\0' == *s ) {
+        return -1;
+    }
+    base = 10;
+    if ( '0' == s[0] && ('x' == s[1] || 'X' == s[1]) ) {
+        base = 16;
+        s += 2;
+        if ( '\0' == *s ) {
+            return -1;
+        }
+    }
+
+    v = 0;
+    for ( ; '\0' != *s; s++ ) {
+        if ( *s >= '0' && *s <= '9' ) {
+            d = *s - '0';
+        } else if ( 16 == base && *s >= 'a' && *s <= 'f' ) {
+            d = *s - 'a' + 10;
+        } else if ( 16 == base && *s >= 'A' && *s <= 'F' ) {
+            d = *s - 'A' + 10;
+        } else {
+            return -1;
+        }
+        v = v * base + d;
+    }
+    *val = v;
+
+    return 0;
+}
+
+/*
+ * Parse the list of ports (e.g., "0,2,3" or "all") into a bitmap
+ */
+static int
+_parse_ports(char *s, uint64_t *bitmap)
+{
+    char *tok;
+    uint64_t port;
+
+    if ( 0 == strcmp("all", s) ) {
+        *bitmap = (uint64_t)-1;
+        return 0;
+    }
+
+    *bitmap = 0;
+    while ( NULL != (tok = strsep(&s, ",")) ) {
+        if ( _parse_number(tok, &port) < 0 || port >= 64 ) {
+            return -1;
+        }
+        *bitmap |= (1ULL << port);
+    }
+
+    return 0;
+}
+
+/*
+ * Parse an IPv4 address (e.g., "10.0.0.1") in host byte order
+ */
+static int
+_parse_ipv4(char *s, uint32_t *addr)
+{
+    char *tok;
+    uint64_t v;
+    uint32_t a;
+    int n;
+
+    a = 0;
+    n = 0;
+    while ( NULL != (tok = strsep(&s, ".")) ) {
+        if ( n >= 4 || _parse_number(tok, &v) < 0 || v > 255 ) {
+            return -1;
+        }
+        a = (a << 8) | v;
+        n++;
+    }
+    if ( 4 != n ) {
+        return -1;
+    }
+    *addr = a;
+
+    return 0;
+}
+
+/*
+ * Parse a MAC address (e.g., "02:00:00:00:00:01")
+ */
+static int
+_parse_mac(char *s, uint8_t *mac)
+{
+    char *tok;
+    char buf[8];
+    uint64_t v;
+    int n;
+
+    n = 0;
+    while ( NULL != (tok = strsep(&s, ":")) ) {
+        if ( n >= 6 || strlen(tok) > 2 ) {
+            return -1;
+        }
+        snprintf(buf, sizeof(buf), "0x%s", tok);
+        if ( _parse_number(buf, &v) < 0 ) {
+            return -1;
+        }
+        mac[n] = v;
+        n++;
+    }
+    if ( 6 != n ) {
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * Display the help message of the forwarding engine module
+ */
+int
+pash_module_fe_help(struct pash *pash, char *args[])
+{
+    printf("Module: fe\n"
+           "help fe\n"
+           "get fe\n"
+           "request fe capture start <port>[,<port>...]|all [snaplen <n>] "
+           "[sampling <n>] [ethertype <n>] [dev <path>]\n"
+           "request fe capture stop\n"
+           "request fe pktgen start <port>[,<port>...]|all [rx <ports>] "
+           "[size <n>] [rate <pps>] [smac <mac>] [dmac <mac>] [sip <ip>] "
+           "[dip <ip>] [smac-range <n>] [dmac-range <n>] [sip-range <n>] "
+           "[dip-range <n>]\n"
+           "request fe pktgen stop\n"
+           "request fe poll busy|adaptive [idle <n>]\n"
+           "request fe poll prefetch <n>\n"
+           "request fe poll dca|hsplit <port>[,<port>...]|all on|off\n"
+           "request fe poll wthresh <port>[,<port>...]|all <n>\n"
+           "request fe pipeline <port>[,<port>...]|all "
+           "bridge|static|hub|filter|nat|tunnel\n"
+           "request fe filter [jit|interp] <code>:<jt>:<jf>:<k> ...\n"
+           "request fe filter clear\n"
+           "request fe qos enable <port>[,<port>...]|all [rate <bps>] "
+           "[burst <bytes>]\n"
+           "request fe qos disable <port>[,<port>...]|all\n"
+           "request fe qos class <class> strict|drr [weight <n>] "
+           "[rate <bps>] [burst <bytes>]\n"
+           "request fe qos map pcp|dscp <value> <class>\n"
+           "request fe lag <group> <port>[,<port>...] [lacp|static]\n"
+           "request fe lag <group> clear\n"
+           "request fe lag hash l2|l3|l4\n"
+           "request fe lag system <mac> [prio <n>]\n"
+           "request fe storm enable <port>[,<port>...]|all [bcast <bps>] "
+           "[mcast <bps>] [unknown <bps>] [burst <bytes>]\n"
+           "request fe storm disable <port>[,<port>...]|all\n"
+           "request fe mcast enable [timeout <sec>]\n"
+           "request fe mcast disable\n"
+           "request fe nat enable inside <ports> outside <ports> "
+           "pool <ip> [<n>] [block <n>] [blocks <n>]\n"
+           "request fe nat timeout tcp|trans|udp <sec>\n"
+           "request fe nat disable\n"
+           "request fe tunnel enable vxlan|gre uplink <port> local <ip> "
+           "mac <mac> gw <mac> [dport <n>]\n"
+           "request fe tunnel vni <vni> <port> [vlan <id>] "
+           "[vteps <ip>[,<ip>...]]\n"
+           "request fe tunnel vni <vni> clear\n"
+           "request fe tunnel disable\n"
+           "request fe fdir mode <port>[,<port>...]|all "
+           "none|perfect|signature\n"
+           "request fe fdir add <port> tcp|udp|sctp|ip <sip> <sport> <dip> "
+           "<dport> task <n>\n"
+           "request fe fdir del <port> tcp|udp|sctp|ip <sip> <sport> <dip> "
+           "<dport>\n"
+           "request fe fdir clear\n");
+    return 0;
+}
+
+/*
+ * Start or stop the packet capture
+ */
+static int
+_request_capture(char *args[])
+{
+    struct pix_fe_capture_conf *conf;
+    uint64_t ports;
+    uint64_t val;
+    ssize_t i;
+
+    if ( NULL == pash_module_fe_capture ) {
+        pash_module_fe_capture = pix_shm_attach(PIX_FE_CAPTURE_SHM, NULL);
+        if ( NULL == pash_module_fe_capture ) {
+            fputs("Could not get the capture configuration of the "
+                  "forwarding engine.\n", stderr);
+            return -1;
+        }
+    }
+    conf = pash_module_fe_capture;
+
+    if ( NULL == args[3] ) {
+        return -1;
+    }
+    if ( 0 == strcmp("stop", args[3]) ) {
+        conf->enabled = 0;
+        __sync_synchronize();
+        conf->gen++;
+        return 0;
+    }
+    if ( 0 != strcmp("start", args[3]) || NULL == args[4] ) {
+        return -1;
+    }
+
+    /* Ports */
+    if ( _parse_ports(args[4], &ports) < 0 ) {
+        fputs("Invalid port list.\n", stderr);
+        return -1;
+    }
+    conf->ethertype = 0;
+
+    /* Options */
+    for ( i = 5; NULL != args[i]; i += 2 ) {
+        if ( NULL == args[i + 1] ) {
+            return -1;
+        }
+        if ( 0 == strcmp("dev", args[i]) ) {
+            if ( strlen(args[i + 1]) >= PIX_FE_CAPTURE_DEVLEN ) {
+                return -1;
+            }
+            strcpy(conf->dev, args[i + 1]);
+            continue;
+        }
+        if ( _parse_number(args[i + 1], &val) < 0 ) {
+            return -1;
+        }
+        if ( 0 == strcmp("snaplen", args[i]) && val > 0 && val <= 65535 ) {
+            conf->snaplen = val;
+        } else if ( 0 == strcmp("sampling", args[i]) && val > 0 ) {
+            conf->sampling = val;
+        } else if ( 0 == strcmp("ethertype", args[i]) && val <= 0xffff ) {
+            conf->ethertype = val;
+        } else {
+            return -1;
+        }
+    }
+    conf->ports = ports;
+    conf->enabled = 1;
+    __sync_synchronize();
+    conf->gen++;
+
+    return 0;
+}
+
+/*
+ * Start or stop the packet generator
+ */
+static int
+_request_pktgen(char *args[])
+{
+    struct pix_fe_pktgen_conf *conf;
+    uint64_t txports;
+    uint64_t rxports;
+    uint64_t val;
+    uint32_t addr;
+    ssize_t i;
+
+    if ( NULL == pash_module_fe_pktgen ) {
+        pash_module_fe_pktgen = pix_shm_attach(PIX_FE_PKTGEN_SHM, NULL);
+        if ( NULL == pash_module_fe_pktgen ) {
+            fputs("Could not get the packet generator configuration of the "
+                  "forwarding engine.\n", stderr);
+            return -1;
+        }
+    }
+    conf = pash_module_fe_pktgen;
+
+    if ( NULL == args[3] ) {
+        return -1;
+    }
+    if ( 0 == strcmp("stop", args[3]) ) {
+        conf->enabled = 0;
+        __sync_synchronize();
+        conf->gen++;
+        return 0;
+    }
+    if ( 0 != strcmp("start", args[3]) || NULL == args[4] ) {
+        return -1;
+    }
+
+    /* Ports */
+    if ( _parse_ports(args[4], &txports) < 0 ) {
+        fputs("Invalid port list.\n", stderr);
+        return -1;
+    }
+    rxports = 0;
+
+    /* Options */
+    for ( i = 5; NULL != args[i]; i += 2 ) {
+        if ( NULL == args[i + 1] ) {
+            return -1;
+        }
+        if ( 0 == strcmp("rx", args[i]) ) {
+            if ( _parse_ports(args[i + 1], &rxports) < 0 ) {
+                return -1;
+            }
+        } else if ( 0 == strcmp("smac", args[i]) ) {
+            if ( _parse_mac(args[i + 1], conf->smac) < 0 ) {
+                return -1;
+            }
+        } else if ( 0 == strcmp("dmac", args[i]) ) {
+            if ( _parse_mac(args[i + 1], conf->dmac) < 0 ) {
+                return -1;
+            }
+        } else if ( 0 == strcmp("sip", args[i]) ) {
+            if ( _parse_ipv4(args[i + 1], &addr) < 0 ) {
+                return -1;
+            }
+            conf->sip = addr;
+        } else if ( 0 == strcmp("dip", args[i]) ) {
+            if ( _parse_ipv4(args[i + 1], &addr) < 0 ) {
+                return -1;
+            }
+            conf->dip = addr;
+        } else {
+            if ( _parse_number(args[i + 1], &val) < 0 ) {
+                return -1;
+            }
+            if ( 0 == strcmp("size", args[i]) ) {
+                conf->size = val;
+            } else if ( 0 == strcmp("rate", args[i]) ) {
+                conf->rate = val;
+            } else if ( 0 == strcmp("smac-range", args[i]) ) {
+                conf->smac_range = val;
+            } else if ( 0 == strcmp("dmac-range", args[i]) ) {
+                conf->dmac_range = val;
+            } else if ( 0 == strcmp("sip-range", args[i]) ) {
+                conf->sip_range = val;
+            } else if ( 0 == strcmp("dip-range", args[i]) ) {
+                conf->dip_range = val;
+            } else {
+                return -1;
+            }
+        }
+    }
+    conf->txports = txports;
+    conf->rxports = rxports;
+    conf->enabled = 1;
+    __sync_synchronize();
+    conf->gen++;
+
+    return 0;
+}
+
+/*
+ * Change the polling mode
+ */
+static int
+_request_poll(char *args[])
+{
+    struct pix_fe_poll_conf *conf;
+    uint64_t ports;
+    uint64_t val;
+    int i;
+
+    if ( NULL == pash_module_fe_poll ) {
+        pash_module_fe_poll = pix_shm_attach(PIX_FE_POLL_SHM, NULL);
+        if ( NULL == pash_module_fe_poll ) {
+            fputs("Could not get the polling configuration of the "
+                  "forwarding engine.\n", stderr);
+            return -1;
+        }
+    }
+    conf = pash_module_fe_poll;
+
+    if ( NULL == args[3] ) {
+        return -1;
+    }
+    if ( 0 == strcmp("busy", args[3]) ) {
+        conf->mode = PIX_FE_POLL_BUSY;
+    } else if ( 0 == strcmp("adaptive", args[3]) ) {
+        if ( NULL != args[4] ) {
+            if ( 0 != strcmp("idle", args[4])
+                 || _parse_number(args[5], &val) < 0 || 0 == val
+                 || val > 0x7fffffff ) {
+                return -1;
+            }
+            conf->idle_polls = val;
+        }
+        conf->mode = PIX_FE_POLL_ADAPTIVE;
+    } else if ( 0 == strcmp("prefetch", args[3]) ) {
+        if ( _parse_number(args[4], &val) < 0 || val > 0xff ) {
+            return -1;
+        }
+        conf->prefetch = val;
+    } else if ( 0 == strcmp("dca", args[3])
+                || 0 == strcmp("hsplit", args[3]) ) {
+        /* Direct Cache Access or header split per port */
+        if ( NULL == args[4] || NULL == args[5]
+             || _parse_ports(args[4], &ports) < 0 ) {
+            return -1;
+        }
+        if ( 0 == strcmp("on", args[5]) ) {
+            val = ports;
+        } else if ( 0 == strcmp("off", args[5]) ) {
+            val = 0;
+        } else {
+            return -1;
+        }
+        if ( 0 == strcmp("dca", args[3]) ) {
+            conf->dca = (conf->dca & ~ports) | val;
+        } else {
+            conf->hsplit = (conf->hsplit & ~ports) | val;
+        }
+    } else if ( 0 == strcmp("wthresh", args[3]) ) {
+        if ( NULL == args[4] || _parse_ports(args[4], &ports) < 0
+             || _parse_number(args[5], &val) < 0
+             || val > PIX_FE_POLL_MAX_WTHRESH ) {
+            return -1;
+        }
+        for ( i = 0; i < PIX_FE_STATS_MAX_PORTS; i++ ) {
+            if ( (ports >> i) & 1 ) {
+                conf->wthresh[i] = val;
+            }
+        }
+    } else {
+        return -1;
+    }
+    __sync_synchronize();
+    conf->gen++;
+
+    return 0;
+}
+
+/*
+ * Change the chain of the pipeline per ingress port
+ */
+static int
+_request_pipeline(char *args[])
+{
+    struct pix_fe_pipeline_conf *conf;
+    uint64_t ports;
+    int chain;
+    int cur;
+    int next;
+    int i;
+
+    if ( NULL == pash_module_fe_pipeline ) {
+        pash_module_fe_pipeline = pix_shm_attach(PIX_FE_PIPELINE_SHM, NULL);
+        if ( NULL == pash_module_fe_pipeline ) {
+            fputs("Could not get the pipeline configuration of the "
+                  "forwarding engine.\n", stderr);
+            return -1;
+        }
+    }
+    conf = pash_module_fe_pipeline;
+
+    if ( NULL == args[3] || NULL == args[4] ) {
+        return -1;
+    }
+    if ( _parse_ports(args[3], &ports) < 0 ) {
+        return -1;
+    }
+    for ( chain = 0; chain < PIX_FE_NCHAINS; chain++ ) {
+        if ( 0 == strcmp(pash_module_fe_chains[chain], args[4]) ) {
+            break;
+        }
+    }
+    if ( chain >= PIX_FE_NCHAINS ) {
+        return -1;
+    }
+
+    /* Fill the inactive bank, then flip it */
+    cur = conf->active & 1;
+    next = cur ^ 1;
+    for ( i = 0; i < PIX_FE_STATS_MAX_PORTS; i++ ) {
+        if ( ports & (1ULL << i) ) {
+            conf->chains[next][i] = chain;
+        } else {
+            conf->chains[next][i] = conf->chains[cur][i];
+        }
+    }
+    __sync_synchronize();
+    conf->active = next;
+    __sync_synchronize();
+    conf->gen++;
+
+    return 0;
+}
+
+/*
+ * Attach the packet filter configuration of the forwarding engine
+ */
+static struct pix_fe_filter_conf *
+_attach_filter(void)
+{
+    if ( NULL == pash_module_fe_filter ) {
+        pash_module_fe_filter = pix_shm_attach(PIX_FE_FILTER_SHM, NULL);
+    }
+
+    return pash_module_fe_filter;
+}
+
+/*
+ * Load a packet filter program given as instructions of
+ * <code>:<jt>:<jf>:<k> (e.g., converted from the output of tcpdump -dd), or
+ * unload it.  The forwarding engine verifies the program.
+ */
+static int
+_request_filter(char *args[])
+{
+    struct pix_fe_filter_conf *conf;
+    uint64_t val[4];
+    char *s;
+    char *f;
+    int jit;
+    int n;
+    int i;
+    int j;
+
+    conf = _attach_filter();
+    if ( NULL == conf ) {
+        fputs("Could not get the packet filter configuration of the "
+              "forwarding engine.\n", stderr);
+        return -1;
+    }
+
+    if ( NULL == args[3] ) {
+        return -1;
+    }
+    if ( 0 == strcmp("clear", args[3]) ) {
+        conf->ninsns = 0;
+        __sync_synchronize();
+        conf->gen++;
+        return 0;
+    }
+    i = 3;
+    jit = 1;
+    if ( 0 == strcmp("jit", args[i]) ) {
+        i++;
+    } else if ( 0 == strcmp("interp", args[i]) ) {
+        jit = 0;
+        i++;
+    }
+    if ( NULL == args[i] ) {
+        return -1;
+    }
+
+    for ( n = 0; NULL != args[i + n]; n++ ) {
+        if ( n >= PIX_FE_FILTER_MAX_INSNS ) {
+            return -1;
+        }
+        s = args[i + n];
+        for ( j = 0; j < 4; j++ ) {
+            f = strsep(&s, ":");
+            if ( NULL == f || _parse_number(f, &val[j]) < 0 ) {
+                return -1;
+            }
+        }
+        if ( NULL != s || val[0] > 0xffff || val[1] > 0xff || val[2] > 0xff
+             || val[3] > 0xffffffffULL ) {
+            return -1;
+        }
+        conf->insns[n].code = val[0];
+        conf->insns[n].jt = val[1];
+        conf->insns[n].jf = val[2];
+        conf->insns[n].k = val[3];
+    }
+    conf->jit = jit;
+    conf->ninsns = n;
+    __sync_synchronize();
+    conf->gen++;
+
+    return 0;
+}
+
+/*
+ * Configure the QoS schedulers
+ */
+static int
+_request_qos(char *args[])
+{
+    struct pix_fe_qos_conf *conf;
+    struct pix_fe_qos_class_conf *c;
+    uint64_t ports;
+    uint64_t rate;
+    uint64_t burst;
+    uint64_t weight;
+    uint64_t val;
+    uint64_t cls;
+    int strict;
+    int i;
+
+    if ( NULL == pash_module_fe_qos ) {
+        pash_module_fe_qos = pix_shm_attach(PIX_FE_QOS_SHM, NULL);
+        if ( NULL == pash_module_fe_qos ) {
+            fputs("Could not get the QoS configuration of the forwarding "
+                  "engine.\n", stderr);
+            return -1;
+        }
+    }
+    conf = pash_module_fe_qos;
+
+    if ( NULL == args[3] ) {
+        return -1;
+    }
+    if ( 0 == strcmp("enable", args[3]) ) {
+        if ( _parse_ports(args[4], &ports) < 0 ) {
+            return -1;
+        }
+        rate = 0;
+        burst = conf->burst;
+        for ( i = 5; NULL != args[i]; i += 2 ) {
+            if ( _parse_number(args[i + 1], &val) < 0 ) {
+                return -1;
+            }
+            if ( 0 == strcmp("rate", args[i]) ) {
+                rate = val;
+            } else if ( 0 == strcmp("burst", args[i]) ) {
+                burst = val;
+            } else {
+                return -1;
+            }
+        }
+        for ( i = 0; i < PIX_FE_STATS_MAX_PORTS; i++ ) {
+            if ( ports & (1ULL << i) ) {
+                conf->rates[i] = rate;
+            }
+        }
+        conf->burst = burst;
+        conf->ports |= ports;
+    } else if ( 0 == strcmp("disable", args[3]) ) {
+        if ( _parse_ports(args[4], &ports) < 0 ) {
+            return -1;
+        }
+        conf->ports &= ~ports;
+    } else if ( 0 == strcmp("class", args[3]) ) {
+        if ( _parse_number(args[4], &cls) < 0 || cls >= PIX_FE_QOS_NCLASSES
+             || NULL == args[5] ) {
+            return -1;
+        }
+        if ( 0 == strcmp("strict", args[5]) ) {
+            strict = 1;
+        } else if ( 0 == strcmp("drr", args[5]) ) {
+            strict = 0;
+        } else {
+            return -1;
+        }
+        c = &conf->classes[cls];
+        weight = c->weight;
+        rate = 0;
+        burst = c->burst;
+        for ( i = 6; NULL != args[i]; i += 2 ) {
+            if ( _parse_number(args[i + 1], &val) < 0 ) {
+                return -1;
+            }
+            if ( 0 == strcmp("weight", args[i]) && val > 0 && val <= 64 ) {
+                weight = val;
+            } else if ( 0 == strcmp("rate", args[i]) ) {
+                rate = val;
+            } else if ( 0 == strcmp("burst", args[i]) ) {
+                burst = val;
+            } else {
+                return -1;
+            }
+        }
+        c->strict = strict;
+        c->weight = weight;
+        c->rate = rate;
+        c->burst = burst;
+    } else if ( 0 == strcmp("map", args[3]) ) {
+        if ( NULL == args[4] || _parse_number(args[5], &val) < 0
+             || _parse_number(args[6], &cls) < 0
+             || cls >= PIX_FE_QOS_NCLASSES ) {
+            return -1;
+        }
+        if ( 0 == strcmp("pcp", args[4]) && val < 8 ) {
+            conf->pcp[val] = cls;
+        } else if ( 0 == strcmp("dscp", args[4]) && val < 64 ) {
+            conf->dscp[val] = cls;
+        } else {
+            return -1;
+        }
+    } else {
+        return -1;
+    }
+    __sync_synchronize();
+    conf->gen++;
+
+    return 0;
+}
+
+/*
+ * Attach the link aggregation configuration of the forwarding engine
+ */
+static struct pix_fe_lag_conf *
+_attach_lag(void)
+{
+    if ( NULL == pash_module_fe_lag ) {
+        pash_module_fe_lag = pix_shm_attach(PIX_FE_LAG_SHM, NULL);
+    }
+
+    return pash_module_fe_lag;
+}
+
+/*
+ * Configure the link aggregation groups
+ */
+static int
+_request_lag(char *args[])
+{
+    struct pix_fe_lag_conf *conf;
+    uint8_t mac[6];
+    uint64_t ports;
+    uint64_t group;
+    uint64_t prio;
+    int i;
+
+    conf = _attach_lag();
+    if ( NULL == conf ) {
+        fputs("Could not get the link aggregation configuration of the "
+              "forwarding engine.\n", stderr);
+        return -1;
+    }
+
+    if ( NULL == args[3] || NULL == args[4] ) {
+        return -1;
+    }
+    if ( 0 == strcmp("hash", args[3]) ) {
+        for ( i = 0; i < 3; i++ ) {
+            if ( 0 == strcmp(pash_module_fe_lag_hashes[i], args[4]) ) {
+                break;
+            }
+        }
+        if ( i >= 3 ) {
+            return -1;
+        }
+        conf->hash = i;
+    } else if ( 0 == strcmp("system", args[3]) ) {
+        if ( _parse_mac(args[4], mac) < 0 ) {
+            return -1;
+        }
+        prio = conf->prio;
+        if ( NULL != args[5] ) {
+            if ( 0 != strcmp("prio", args[5])
+                 || _parse_number(args[6], &prio) < 0 || prio > 0xffff ) {
+                return -1;
+            }
+        }
+        for ( i = 0; i < 6; i++ ) {
+            conf->system[i] = mac[i];
+        }
+        conf->prio = prio;
+    } else {
+        if ( _parse_number(args[3], &group) < 0 || group >= PIX_FE_LAG_MAX ) {
+            return -1;
+        }
+        if ( 0 == strcmp("clear", args[4]) ) {
+            conf->groups[group].members = 0;
+        } else {
+            if ( _parse_ports(args[4], &ports) < 0 ) {
+                return -1;
+            }
+            if ( NULL == args[5] || 0 == strcmp("lacp", args[5]) ) {
+                conf->groups[group].lacp = 1;
+            } else if ( 0 == strcmp("static", args[5]) ) {
+                conf->groups[group].lacp = 0;
+            } else {
+                return -1;
+            }
+            conf->groups[group].members = ports;
+        }
+    }
+    __sync_synchronize();
+    conf->gen++;
+
+    return 0;
+}
+
+/*
+ * Display the members and the LACP state of the link aggregation groups
+ */
+static void
+_show_lag(struct pix_fe_stats *st)
+{
+    struct pix_fe_lag_conf *conf;
+    struct pix_fe_lag_stats sum;
+    struct pix_fe_task_stats *ts;
+    uint64_t members;
+    ssize_t g;
+    ssize_t i;
+    char buf[256];
+
+    conf = _attach_lag();
+    if ( NULL == conf ) {
+        return;
+    }
+    members = 0;
+    for ( g = 0; g < PIX_FE_LAG_MAX; g++ ) {
+        members |= conf->groups[g].members;
+    }
+    if ( 0 == members ) {
+        return;
+    }
+
+    memset(&sum, 0, sizeof(struct pix_fe_lag_stats));
+    for ( i = 0; i < st->ntasks; i++ ) {
+        ts = &st->tasks[i];
+        sum.punts += ts->lag.punts;
+        sum.lacp_rx += ts->lag.lacp_rx;
+        sum.lacp_tx += ts->lag.lacp_tx;
+        sum.lacp_errors += ts->lag.lacp_errors;
+        sum.changes += ts->lag.changes;
+        sum.drops += ts->lag.drops;
+    }
+    snprintf(buf, sizeof(buf),
+             "lag (hash %s): lacp punted %lld rx %lld tx %lld errors %lld, "
+             "%lld changes %lld drops\n",
+             conf->hash >= 0 && conf->hash < 3
+             ? pash_module_fe_lag_hashes[conf->hash] : "?",
+             (long long)sum.punts, (long long)sum.lacp_rx,
+             (long long)sum.lacp_tx,
+             (long long)sum.lacp_errors, (long long)sum.changes,
+             (long long)sum.drops);
+    fputs(buf, stdout);
+    for ( g = 0; g < PIX_FE_LAG_MAX; g++ ) {
+        if ( 0 == conf->groups[g].members ) {
+            continue;
+        }
+        snprintf(buf, sizeof(buf), "  group %ld (port #%ld, %s):", g,
+                 PIX_FE_STATS_MAX_PORTS + g,
+                 conf->groups[g].lacp ? "lacp" : "static");
+        fputs(buf, stdout);
+        for ( i = 0; i < st->nports; i++ ) {
+            if ( !(conf->groups[g].members & (1ULL << i)) ) {
+                continue;
+            }
+            /* Member, whether distributing, and the LACP states */
+            snprintf(buf, sizeof(buf), " %ld%s", i,
+                     conf->groups[g].active & (1ULL << i) ? "(up)" : "(down)");
+            fputs(buf, stdout);
+            if ( conf->groups[g].lacp ) {
+                snprintf(buf, sizeof(buf), "[%02x/%02x]", conf->actor[i],
+                         conf->partner[i]);
+                fputs(buf, stdout);
+            }
+        }
+        fputs("\n", stdout);
+    }
+}
+
+/*
+ * Configure the storm control
+ */
+static int
+_request_storm(char *args[])
+{
+    struct pix_fe_storm_conf *conf;
+    uint64_t rates[PIX_FE_STORM_NCLASSES];
+    uint64_t ports;
+    uint64_t burst;
+    uint64_t val;
+    int c;
+    int i;
+
+    if ( NULL == pash_module_fe_storm ) {
+        pash_module_fe_storm = pix_shm_attach(PIX_FE_STORM_SHM, NULL);
+        if ( NULL == pash_module_fe_storm ) {
+            fputs("Could not get the storm control configuration of the "
+                  "forwarding engine.\n", stderr);
+            return -1;
+        }
+    }
+    conf = pash_module_fe_storm;
+
+    if ( NULL == args[3] || NULL == args[4] ) {
+        return -1;
+    }
+    if ( _parse_ports(args[4], &ports) < 0 ) {
+        return -1;
+    }
+    if ( 0 == strcmp("enable", args[3]) ) {
+        memset(rates, 0, sizeof(rates));
+        burst = conf->burst;
+        for ( i = 5; NULL != args[i]; i += 2 ) {
+            if ( _parse_number(args[i + 1], &val) < 0 ) {
+                return -1;
+            }
+            if ( 0 == strcmp("burst", args[i]) ) {
+                burst = val;
+                continue;
+            }
+            for ( c = 0; c < PIX_FE_STORM_NCLASSES; c++ ) {
+                if ( 0 == strcmp(pash_module_fe_storm_classes[c], args[i]) ) {
+                    break;
+                }
+            }
+            if ( c >= PIX_FE_STORM_NCLASSES ) {
+                return -1;
+            }
+            rates[c] = val;
+        }
+        for ( i = 0; i < PIX_FE_STATS_MAX_PORTS; i++ ) {
+            if ( ports & (1ULL << i) ) {
+                for ( c = 0; c < PIX_FE_STORM_NCLASSES; c++ ) {
+                    conf->rates[i][c] = rates[c];
+                }
+            }
+        }
+        conf->burst = burst;
+        conf->ports |= ports;
+    } else if ( 0 == strcmp("disable", args[3]) ) {
+        conf->ports &= ~ports;
+    } else {
+        return -1;
+    }
+    __sync_synchronize();
+    conf->gen++;
+
+    return 0;
+}
+
+/*
+ * Attach the IGMP snooping configuration of the forwarding engine
+ */
+static struct pix_fe_mcast_conf *
+_attach_mcast(void)
+{
+    if ( NULL == pash_module_fe_mcast ) {
+        pash_module_fe_mcast = pix_shm_attach(PIX_FE_MCAST_SHM, NULL);
+    }
+
+    return pash_module_fe_mcast;
+}
+
+/*
+ * Enable or disable IGMP snooping
+ */
+static int
+_request_mcast(char *args[])
+{
+    struct pix_fe_mcast_conf *conf;
+    uint64_t val;
+
+    conf = _attach_mcast();
+    if ( NULL == conf ) {
+        fputs("Could not get the IGMP snooping configuration of the "
+              "forwarding engine.\n", stderr);
+        return -1;
+    }
+
+    if ( NULL == args[3] ) {
+        return -1;
+    }
+    if ( 0 == strcmp("enable", args[3]) ) {
+        if ( NULL != args[4] ) {
+            if ( 0 != strcmp("timeout", args[4])
+                 || _parse_number(args[5], &val) < 0 || 0 == val ) {
+                return -1;
+            }
+            conf->timeout = val;
+        }
+        conf->enabled = 1;
+    } else if ( 0 == strcmp("disable", args[3]) ) {
+        conf->enabled = 0;
+    } else {
+        return -1;
+    }
+    __sync_synchronize();
+    conf->gen++;
+
+    return 0;
+}
+
+/*
+ * Attach the NAT44 configuration of the forwarding engine
+ */
+static struct pix_fe_nat_conf *
+_attach_nat(void)
+{
+    if ( NULL == pash_module_fe_nat ) {
+        pash_module_fe_nat = pix_shm_attach(PIX_FE_NAT_SHM, NULL);
+    }
+
+    return pash_module_fe_nat;
+}
+
+/*
+ * Configure NAT44
+ */
+static int
+_request_nat(char *args[])
+{
+    struct pix_fe_nat_conf *conf;
+    uint64_t inside;
+    uint64_t outside;
+    uint64_t naddrs;
+    uint64_t block;
+    uint64_t blocks;
+    uint64_t val;
+    uint32_t addr;
+    int i;
+
+    conf = _attach_nat();
+    if ( NULL == conf ) {
+        fputs("Could not get the NAT44 configuration of the forwarding "
+              "engine.\n", stderr);
+        return -1;
+    }
+
+    if ( NULL == args[3] ) {
+        return -1;
+    }
+    if ( 0 == strcmp("enable", args[3]) ) {
+        inside = 0;
+        outside = 0;
+        addr = 0;
+        naddrs = 1;
+        block = conf->block;
+        blocks = conf->blocks;
+        for ( i = 4; NULL != args[i]; i += 2 ) {
+            if ( NULL == args[i + 1] ) {
+                return -1;
+            }
+            if ( 0 == strcmp("inside", args[i]) ) {
+                if ( _parse_ports(args[i + 1], &inside) < 0 ) {
+                    return -1;
+                }
+            } else if ( 0 == strcmp("outside", args[i]) ) {
+                if ( _parse_ports(args[i + 1], &outside) < 0 ) {
+                    return -1;
+                }
+            } else if ( 0 == strcmp("pool", args[i]) ) {
+                if ( _parse_ipv4(args[i + 1], &addr) < 0 ) {
+                    return -1;
+                }
+                if ( NULL != args[i + 2]
+                     && _parse_number(args[i + 2], &naddrs) >= 0 ) {
+                    i++;
+                }
+            } else if ( 0 == strcmp("block", args[i]) ) {
+                if ( _parse_number(args[i + 1], &block) < 0 ) {
+                    return -1;
+                }
+            } else if ( 0 == strcmp("blocks", args[i]) ) {
+                if ( _parse_number(args[i + 1], &blocks) < 0 ) {
+                    return -1;
+                }
+            } else {
+                return -1;
+            }
+        }
+        if ( 0 == inside || 0 == outside || (inside & outside) || 0 == addr
+             || 0 == naddrs || naddrs > PIX_FE_NAT_MAX_ADDRS
+             || block < 64 || block > 4096 || (block & (block - 1))
+             || 0 == blocks || blocks > 8 ) {
+            return -1;
+        }
+        conf->addr = addr;
+        conf->naddrs = naddrs;
+        conf->block = block;
+        conf->blocks = blocks;
+        conf->inside = inside;
+        conf->outside = outside;
+    } else if ( 0 == strcmp("timeout", args[3]) ) {
+        if ( NULL == args[4] || _parse_number(args[5], &val) < 0
+             || 0 == val ) {
+            return -1;
+        }
+        for ( i = 0; i < PIX_FE_NAT_NTIMEOUTS; i++ ) {
+            if ( 0 == strcmp(pash_module_fe_nat_timeouts[i], args[4]) ) {
+                break;
+            }
+        }
+        if ( i >= PIX_FE_NAT_NTIMEOUTS ) {
+            return -1;
+        }
+        conf->timeouts[i] = val;
+    } else if ( 0 == strcmp("disable", args[3]) ) {
+        conf->inside = 0;
+        conf->outside = 0;
+    } else {
+        return -1;
+    }
+    __sync_synchronize();
+    conf->gen++;
+
+    return 0;
+}
+
+/*
+ * Attach the tunnel endpoint configuration of the forwarding engine
+ */
+static struct pix_fe_tunnel_conf *
+_attach_tunnel(void)
+{
+    if ( NULL == pash_module_fe_tunnel ) {
+        pash_module_fe_tunnel = pix_shm_attach(PIX_FE_TUNNEL_SHM, NULL);
+    }
+
+    return pash_module_fe_tunnel;
+}
+
+/*
+ * Parse the list of remote VTEPs into a bitmap of the indices, adding the
+ * new ones to the configuration
+ */
+static int
+_parse_vteps(struct pix_fe_tunnel_conf *conf, char *s, uint64_t *bitmap)
+{
+    char *tok;
+    uint32_t addr;
+    int i;
+
+    *bitmap = 0;
+    while ( NULL != (tok = strsep(&s, ",")) ) {
+        if ( _parse_ipv4(tok, &addr) < 0 || 0 == addr ) {
+            return -1;
+        }
+        for ( i = 0; i < conf->nvteps; i++ ) {
+            if ( conf->vteps[i] == addr ) {
+                break;
+            }
+        }
+        if ( i >= conf->nvteps ) {
+            if ( conf->nvteps >= PIX_FE_TUNNEL_MAX_VTEPS ) {
+                return -1;
+            }
+            conf->vteps[i] = addr;
+            conf->nvteps++;
+        }
+        *bitmap |= 1ULL << i;
+    }
+
+    return 0;
+}
+
+/*
+ * Configure the tunnel endpoint
+ */
+static int
+_request_tunnel(char *args[])
+{
+    struct pix_fe_tunnel_conf *conf;
+    uint64_t uplink;
+    uint64_t dport;
+    uint64_t vteps;
+    uint64_t vni;
+    uint64_t port;
+    uint64_t vlan;
+    uint32_t addr;
+    uint8_t mac[6];
+    uint8_t gw[6];
+    int type;
+    int set;
+    int i;
+    int j;
+
+    conf = _attach_tunnel();
+    if ( NULL == conf ) {
+        fputs("Could not get the tunnel endpoint configuration of the "
+              "forwarding engine.\n", stderr);
+        return -1;
+    }
+
+    if ( NULL == args[3] ) {
+        return -1;
+    }
+    if ( 0 == strcmp("enable", args[3]) ) {
+        if ( NULL == args[4] ) {
+            return -1;
+        }
+        for ( type = PIX_FE_TUNNEL_VXLAN; type <= PIX_FE_TUNNEL_GRE;
+              type++ ) {
+            if ( 0 == strcmp(pash_module_fe_tunnel_types[type], args[4]) ) {
+                break;
+            }
+        }
+        if ( type > PIX_FE_TUNNEL_GRE ) {
+            return -1;
+        }
+        uplink = 0;
+        addr = 0;
+        dport = conf->dport;
+        set = 0;
+        for ( i = 5; NULL != args[i]; i += 2 ) {
+            if ( NULL == args[i + 1] ) {
+                return -1;
+            }
+            if ( 0 == strcmp("uplink", args[i]) ) {
+                if ( _parse_number(args[i + 1], &uplink) < 0
+                     || uplink >= 64 ) {
+                    return -1;
+                }
+                set |= 1;
+            } else if ( 0 == strcmp("local", args[i]) ) {
+                if ( _parse_ipv4(args[i + 1], &addr) < 0 || 0 == addr ) {
+                    return -1;
+                }
+                set |= 2;
+            } else if ( 0 == strcmp("mac", args[i]) ) {
+                if ( _parse_mac(args[i + 1], mac) < 0 ) {
+                    return -1;
+                }
+                set |= 4;
+            } else if ( 0 == strcmp("gw", args[i]) ) {
+                if ( _parse_mac(args[i + 1], gw) < 0 ) {
+                    return -1;
+                }
+                set |= 8;
+            } else if ( 0 == strcmp("dport", args[i]) ) {
+                if ( _parse_number(args[i + 1], &dport) < 0 || 0 == dport
+                     || dport > 65535 ) {
+                    return -1;
+                }
+            } else {
+                return -1;
+            }
+        }
+        if ( 0xf != set ) {
+            return -1;
+        }
+        for ( i = 0; i < conf->nvnis; i++ ) {
+            if ( conf->vnis[i].port == (int)uplink ) {
+                /* Bridged to the uplink */
+                return -1;
+            }
+        }
+        conf->uplink = uplink;
+        conf->addr = addr;
+        for ( i = 0; i < 6; i++ ) {
+            conf->mac[i] = mac[i];
+            conf->gw[i] = gw[i];
+        }
+        conf->dport = dport;
+        conf->type = type;
+    } else if ( 0 == strcmp("vni", args[3]) ) {
+        if ( _parse_number(args[4], &vni) < 0 || vni > 0xffffff
+             || NULL == args[5] ) {
+            return -1;
+        }
+        for ( i = 0; i < conf->nvnis; i++ ) {
+            if ( conf->vnis[i].vni == vni ) {
+                break;
+            }
+        }
+        if ( 0 == strcmp("clear", args[5]) ) {
+            if ( i >= conf->nvnis ) {
+                return -1;
+            }
+            for ( ; i + 1 < conf->nvnis; i++ ) {
+                conf->vnis[i].vni = conf->vnis[i + 1].vni;
+                conf->vnis[i].port = conf->vnis[i + 1].port;
+                conf->vnis[i].vlan = conf->vnis[i + 1].vlan;
+                conf->vnis[i].vteps = conf->vnis[i + 1].vteps;
+            }
+            conf->nvnis--;
+        } else {
+            if ( _parse_number(args[5], &port) < 0 || port >= 64
+                 || (PIX_FE_TUNNEL_NONE != conf->type
+                     && (int)port == conf->uplink) ) {
+                return -1;
+            }
+            vlan = 0;
+            vteps = 0;
+            for ( j = 6; NULL != args[j]; j += 2 ) {
+                if ( NULL == args[j + 1] ) {
+                    return -1;
+                }
+                if ( 0 == strcmp("vlan", args[j]) ) {
+                    if ( _parse_number(args[j + 1], &vlan) < 0 || 0 == vlan
+                         || vlan > 4094 ) {
+                        return -1;
+                    }
+                } else if ( 0 == strcmp("vteps", args[j]) ) {
+                    if ( _parse_vteps(conf, args[j + 1], &vteps) < 0 ) {
+                        return -1;
+                    }
+                } else {
+                    return -1;
+                }
+            }
+            if ( i >= conf->nvnis ) {
+                if ( conf->nvnis >= PIX_FE_TUNNEL_MAX_VNIS ) {
+                    return -1;
+                }
+                conf->nvnis++;
+            }
+            conf->vnis[i].vni = vni;
+            conf->vnis[i].port = port;
+            conf->vnis[i].vlan = vlan;
+            conf->vnis[i].vteps = vteps;
+        }
+    } else if ( 0 == strcmp("disable", args[3]) ) {
+        conf->type = PIX_FE_TUNNEL_NONE;
+        conf->nvnis = 0;
+        conf->nvteps = 0;
+    } else {
+        return -1;
+    }
+    __sync_synchronize();
+    conf->gen++;
+
+    return 0;
+}
+
+/*
+ * Attach the Flow Director configuration of the forwarding engine
+ */
+static struct pix_fe_fdir_conf *
+_attach_fdir(void)
+{
+    if ( NULL == pash_module_fe_fdir ) {
+        pash_module_fe_fdir = pix_shm_attach(PIX_FE_FDIR_SHM, NULL);
+    }
+
+    return pash_module_fe_fdir;
+}
+
+/*
+ * Parse a flow of a Flow Director rule: <port> <proto> <sip> <sport> <dip>
+ * <dport>
+ */
+static int
+_parse_fdir_rule(char *args[], struct pix_fe_fdir_rule *r)
+{
+    uint64_t port;
+    uint64_t sport;
+    uint64_t dport;
+    uint32_t sip;
+    uint32_t dip;
+    int i;
+
+    for ( i = 0; i < 6; i++ ) {
+        if ( NULL == args[i] ) {
+            return -1;
+        }
+    }
+    if ( _parse_number(args[0], &port) < 0
+         || port >= PIX_FE_STATS_MAX_PORTS ) {
+        return -1;
+    }
+    if ( 0 == strcmp("tcp", args[1]) ) {
+        r->proto = 6;
+    } else if ( 0 == strcmp("udp", args[1]) ) {
+        r->proto = 17;
+    } else if ( 0 == strcmp("sctp", args[1]) ) {
+        r->proto = 132;
+    } else if ( 0 == strcmp("ip", args[1]) ) {
+        r->proto = 0;
+    } else {
+        return -1;
+    }
+    if ( _parse_ipv4(args[2], &sip) < 0 || _parse_number(args[3], &sport) < 0
+         || _parse_ipv4(args[4], &dip) < 0 || _parse_number(args[5], &dport) < 0
+         || sport > 0xffff || dport > 0xffff ) {
+        return -1;
+    }
+    r->port = port;
+    r->sip = sip;
+    r->dip = dip;
+    r->sport = sport;
+    r->dport = dport;
+
+    return 0;
+}
+
+/*
+ * Configure the Flow Director filters
+ */
+static int
+_request_fdir(char *args[])
+{
+    struct pix_fe_fdir_conf *conf;
+    struct pix_fe_fdir_rule r;
+    struct pix_fe_fdir_rule *e;
+    uint64_t ports;
+    uint64_t task;
+    int mode;
+    int i;
+
+    conf = _attach_fdir();
+    if ( NULL == conf ) {
+        fputs("Could not get the Flow Director configuration of the "
+              "forwarding engine.\n", stderr);
+        return -1;
+    }
+
+    if ( NULL == args[3] ) {
+        return -1;
+    }
+    if ( 0 == strcmp("mode", args[3]) ) {
+        if ( NULL == args[4] || NULL == args[5]
+             || _parse_ports(args[4], &ports) < 0 ) {
+            return -1;
+        }
+        for ( mode = 0; mode < 3; mode++ ) {
+            if ( 0 == strcmp(pash_module_fe_fdir_modes[mode], args[5]) ) {
+                break;
+            }
+        }
+        if ( mode >= 3 ) {
+            return -1;
+        }
+        for ( i = 0; i < PIX_FE_STATS_MAX_PORTS; i++ ) {
+            if ( (ports >> i) & 1 ) {
+                conf->modes[i] = mode;
+            }
+        }
+    } else if ( 0 == strcmp("add", args[3]) ) {
+        memset(&r, 0, sizeof(struct pix_fe_fdir_rule));
+        if ( _parse_fdir_rule(&args[4], &r) < 0 || NULL == args[10]
+             || 0 != strcmp("task", args[10])
+             || _parse_number(args[11], &task) < 0 ) {
+            return -1;
+        }
+        r.task = task;
+        r.status = PIX_FE_FDIR_PENDING;
+        /* Replace the rule of the same flow if any */
+        for ( i = 0; i < conf->nrules; i++ ) {
+            e = &conf->rules[i];
+            if ( e->port == r.port && e->proto == r.proto && e->sip == r.sip
+                 && e->dip == r.dip && e->sport == r.sport
+                 && e->dport == r.dport ) {
+                break;
+            }
+        }
+        if ( i >= PIX_FE_FDIR_MAX_RULES ) {
+            fputs("Too many Flow Director rules.\n", stderr);
+            return -1;
+        }
+        memcpy((void *)&conf->rules[i], &r, sizeof(struct pix_fe_fdir_rule));
+        if ( i == conf->nrules ) {
+            conf->nrules++;
+        }
+    } else if ( 0 == strcmp("del", args[3]) ) {
+        memset(&r, 0, sizeof(struct pix_fe_fdir_rule));
+        if ( _parse_fdir_rule(&args[4], &r) < 0 ) {
+            return -1;
+        }
+        for ( i = 0; i < conf->nrules; i++ ) {
+            e = &conf->rules[i];
+            if ( e->port == r.port && e->proto == r.proto && e->sip == r.sip
+                 && e->dip == r.dip && e->sport == r.sport
+                 && e->dport == r.dport ) {
+                break;
+            }
+        }
+        if ( i >= conf->nrules ) {
+            return -1;
+        }
+        /* Fill the hole with the last one */
+        conf->nrules--;
+        memcpy((void *)&conf->rules[i], (void *)&conf->rules[conf->nrules],
+               sizeof(struct pix_fe_fdir_rule));
+    } else if ( 0 == strcmp("clear", args[3]) ) {
+        conf->nrules = 0;
+    } else {
+        return -1;
+    }
+    __sync_synchronize();
+    conf->gen++;
+
+    return 0;
+}
+
+/*
+ * Display the Flow Director rules and the filter table occupancy per port
+ */
+static void
+_show_fdir(struct pix_fe_stats *st)
+{
+    struct pix_fe_fdir_conf *conf;
+    struct pix_fe_fdir_rule *r;
+    const char *status;
+    ssize_t i;
+    char buf[512];
+
+    conf = _attach_fdir();
+    if ( NULL == conf ) {
+        return;
+    }
+    for ( i = 0; i < st->nports && i < PIX_FE_STATS_MAX_PORTS; i++ ) {
+        if ( PIX_FE_FDIR_NONE == conf->modes[i]
+             || conf->modes[i] > PIX_FE_FDIR_SIGNATURE ) {
+            continue;
+        }
+        snprintf(buf, sizeof(buf),
+                 "fdir: port %ld %s, %lld filters %lld free %lld collisions, "
+                 "%lld matches %lld misses, fails %lld add %lld remove\n", i,
+                 pash_module_fe_fdir_modes[conf->modes[i]],
+                 (long long)st->hw[i].fdir_filters,
+                 (long long)st->hw[i].fdir_free,
+                 (long long)st->hw[i].fdir_colls,
+                 (long long)st->hw[i].fdir_matches,
+                 (long long)st->hw[i].fdir_misses,
+                 (long long)st->hw[i].fdir_add_fails,
+                 (long long)st->hw[i].fdir_remove_fails);
+        fputs(buf, stdout);
+    }
+    for ( i = 0; i < conf->nrules && i < PIX_FE_FDIR_MAX_RULES; i++ ) {
+        r = &conf->rules[i];
+        if ( PIX_FE_FDIR_INSTALLED == r->status ) {
+            status = "installed";
+        } else if ( PIX_FE_FDIR_REJECTED == r->status ) {
+            status = "rejected";
+        } else {
+            status = "pending";
+        }
+        snprintf(buf, sizeof(buf),
+                 "  port %d proto %d %d.%d.%d.%d:%d -> %d.%d.%d.%d:%d "
+                 "task %d: %s\n", r->port, r->proto, (int)(r->sip >> 24),
+                 (int)((r->sip >> 16) & 0xff), (int)((r->sip >> 8) & 0xff),
+                 (int)(r->sip & 0xff), r->sport, (int)(r->dip >> 24),
+                 (int)((r->dip >> 16) & 0xff), (int)((r->dip >> 8) & 0xff),
+                 (int)(r->dip & 0xff), r->dport, r->task, status);
+        fputs(buf, stdout);
+    }
+}
+
+/*
+ * Display the tunnel endpoint counters and the VNIs
+ */
+static void
+_show_tunnel(struct pix_fe_stats *st)
+{
+    struct pix_fe_tunnel_conf *conf;
+    struct pix_fe_tunnel_stats sum;
+    struct pix_fe_tunnel_stats *ts;
+    uint32_t addr;
+    ssize_t i;
+    ssize_t j;
+    int n;
+    char buf[1024];
+
+    conf = _attach_tunnel();
+    if ( NULL == conf || PIX_FE_TUNNEL_NONE == conf->type
+         || conf->type > PIX_FE_TUNNEL_GRE ) {
+        return;
+    }
+    memset(&sum, 0, sizeof(struct pix_fe_tunnel_stats));
+    for ( i = 0; i < st->ntasks; i++ ) {
+        ts = &st->tasks[i].tunnel;
+        sum.encap_pkts += ts->encap_pkts;
+        sum.decap_pkts += ts->decap_pkts;
+        sum.replicas += ts->replicas;
+        sum.learns += ts->learns;
+        sum.learn_drops += ts->learn_drops;
+        sum.arps += ts->arps;
+        sum.bad += ts->bad;
+        sum.no_vteps += ts->no_vteps;
+    }
+    addr = conf->addr;
+    snprintf(buf, sizeof(buf),
+             "tunnel: %s local %d.%d.%d.%d uplink %d dport %d, %lld encap "
+             "%lld decap %lld replicas, %lld learns (%lld drops), %lld arps, "
+             "drops %lld bad %lld no-vtep\n",
+             pash_module_fe_tunnel_types[conf->type], (int)(addr >> 24),
+             (int)((addr >> 16) & 0xff), (int)((addr >> 8) & 0xff),
+             (int)(addr & 0xff), conf->uplink, conf->dport,
+             (long long)sum.encap_pkts, (long long)sum.decap_pkts,
+             (long long)sum.replicas, (long long)sum.learns,
+             (long long)sum.learn_drops, (long long)sum.arps,
+             (long long)sum.bad, (long long)sum.no_vteps);
+    fputs(buf, stdout);
+    for ( i = 0; i < conf->nvnis && i < PIX_FE_TUNNEL_MAX_VNIS; i++ ) {
+        n = snprintf(buf, sizeof(buf), "  vni %d: port %d vlan %d vteps",
+                     (int)conf->vnis[i].vni, conf->vnis[i].port,
+                     conf->vnis[i].vlan);
+        for ( j = 0; j < conf->nvteps && j < PIX_FE_TUNNEL_MAX_VTEPS
+                  && n < (int)sizeof(buf) - 20; j++ ) {
+            if ( !((conf->vnis[i].vteps >> j) & 1) ) {
+                continue;
+            }
+            addr = conf->vteps[j];
+            n += snprintf(buf + n, sizeof(buf) - n, " %d.%d.%d.%d",
+                          (int)(addr >> 24), (int)((addr >> 16) & 0xff),
+                          (int)((addr >> 8) & 0xff), (int)(addr & 0xff));
+        }
+        snprintf(buf + n, sizeof(buf) - n, "\n");
+        fputs(buf, stdout);
+    }
+}
+
+/*
+ * Display the NAT44 counters per task
+ */
+static void
+_show_nat(struct pix_fe_stats *st)
+{
+    struct pix_fe_nat_conf *conf;
+    struct pix_fe_nat_stats *ns;
+    uint32_t addr;
+    ssize_t i;
+    char buf[512];
+
+    conf = _attach_nat();
+    if ( NULL == conf || 0 == conf->inside ) {
+        return;
+    }
+    addr = conf->addr;
+    snprintf(buf, sizeof(buf),
+             "nat: inside 0x%llx outside 0x%llx pool %d.%d.%d.%d/%d, "
+             "block %d x %d, timeouts tcp %d trans %d udp %d\n",
+             (long long)conf->inside, (long long)conf->outside,
+             (int)(addr >> 24), (int)((addr >> 16) & 0xff),
+             (int)((addr >> 8) & 0xff), (int)(addr & 0xff), conf->naddrs,
+             conf->block, conf->blocks,
+             conf->timeouts[PIX_FE_NAT_TO_TCP_EST],
+             conf->timeouts[PIX_FE_NAT_TO_TCP_TRANS],
+             conf->timeouts[PIX_FE_NAT_TO_UDP]);
+    fputs(buf, stdout);
+    for ( i = 0; i < st->ntasks; i++ ) {
+        ns = &st->tasks[i].nat;
+        if ( 0 == ns->created && 0 == ns->misses && 0 == ns->unsupported
+             && 0 == ns->bad_csum ) {
+            continue;
+        }
+        snprintf(buf, sizeof(buf),
+                 "  Task #%ld: %lld conns (%lld created %lld expired), "
+                 "%lld out %lld in pkts, drops %lld misses %lld "
+                 "unsupported %lld no-port %lld full %lld bad-csum\n", i,
+                 (long long)ns->conns, (long long)ns->created,
+                 (long long)ns->expired, (long long)ns->out_pkts,
+                 (long long)ns->in_pkts, (long long)ns->misses,
+                 (long long)ns->unsupported, (long long)ns->no_ports,
+                 (long long)ns->full, (long long)ns->bad_csum);
+        fputs(buf, stdout);
+    }
+}
+
+/*
+ * Display the storm control counters and the multicast groups snooped
+ */
+static void
+_show_storm(struct pix_fe_stats *st)
+{
+    struct pix_fe_mcast_conf *conf;
+    struct pix_fe_storm_stats sum;
+    struct pix_fe_task_stats *ts;
+    uint32_t addr;
+    ssize_t c;
+    ssize_t i;
+    char buf[256];
+
+    memset(&sum, 0, sizeof(struct pix_fe_storm_stats));
+    for ( i = 0; i < st->ntasks; i++ ) {
+        ts = &st->tasks[i];
+        for ( c = 0; c < PIX_FE_STORM_NCLASSES; c++ ) {
+            sum.drops[c] += ts->storm.drops[c];
+        }
+        sum.joins += ts->storm.joins;
+        sum.leaves += ts->storm.leaves;
+        sum.queries += ts->storm.queries;
+        sum.igmp_drops += ts->storm.igmp_drops;
+        sum.mcast_pkts += ts->storm.mcast_pkts;
+        sum.groups_full += ts->storm.groups_full;
+    }
+    for ( c = 0; c < PIX_FE_STORM_NCLASSES; c++ ) {
+        if ( sum.drops[c] > 0 ) {
+            snprintf(buf, sizeof(buf), "storm %s: %lld drops\n",
+                     pash_module_fe_storm_classes[c], (long long)sum.drops[c]);
+            fputs(buf, stdout);
+        }
+    }
+
+    conf = _attach_mcast();
+    if ( NULL == conf || !conf->enabled ) {
+        return;
+    }
+    snprintf(buf, sizeof(buf),
+             "igmp: %lld joins %lld leaves %lld queries %lld drops, "
+             "%lld pkts replicated, %d groups (%lld full), mrouters "
+             "0x%llx\n",
+             (long long)sum.joins, (long long)sum.leaves,
+             (long long)sum.queries, (long long)sum.igmp_drops,
+             (long long)sum.mcast_pkts, conf->ngroups,
+             (long long)sum.groups_full, (long long)conf->mrouters);
+    fputs(buf, stdout);
+    for ( i = 0; i < conf->ngroups && i < PIX_FE_MCAST_MAX; i++ ) {
+        addr = conf->groups[i].addr;
+        snprintf(buf, sizeof(buf), "  %d.%d.%d.%d: ports 0x%llx\n",
+                 (int)(addr >> 24), (int)((addr >> 16) & 0xff),
+                 (int)((addr >> 8) & 0xff), (int)(addr & 0xff),
+                 (long long)conf->groups[i].ports);
+        fputs(buf, stdout);
+    }
+}
+
+/*
+ * Display the counters and the queueing delay of the QoS classes
+ */
+static void
+_show_qos(struct pix_fe_stats *st)
+{
+    struct pix_fe_task_stats *ts;
+    struct pix_fe_qos_stats sum;
+    uint64_t hz;
+    uint64_t cnt;
+    ssize_t c;
+    ssize_t i;
+    ssize_t j;
+    char buf[256];
+
+    hz = st->tsc_hz > 0 ? st->tsc_hz : 1;
+    memset(&sum, 0, sizeof(struct pix_fe_qos_stats));
+    for ( j = 0; j < st->ntasks; j++ ) {
+        ts = &st->tasks[j];
+        for ( c = 0; c < PIX_FE_QOS_NCLASSES; c++ ) {
+            sum.tx_pkts[c] += ts->qos.tx_pkts[c];
+            sum.tx_bytes[c] += ts->qos.tx_bytes[c];
+            sum.drops[c] += ts->qos.drops[c];
+            if ( ts->qos.delay_max[c] > sum.delay_max[c] ) {
+                sum.delay_max[c] = ts->qos.delay_max[c];
+            }
+            for ( i = 0; i < PIX_FE_QOS_HIST; i++ ) {
+                sum.hist[c][i] += ts->qos.hist[c][i];
+            }
+        }
+    }
+
+    for ( c = 0; c < PIX_FE_QOS_NCLASSES; c++ ) {
+        if ( 0 == sum.tx_pkts[c] && 0 == sum.drops[c] ) {
+            continue;
+        }
+        /* 99th percentile (the upper bound of the bin) */
+        cnt = 0;
+        for ( i = 0; i < PIX_FE_QOS_HIST - 1; i++ ) {
+            cnt += sum.hist[c][i];
+            if ( cnt * 100 >= sum.tx_pkts[c] * 99 ) {
+                break;
+            }
+        }
+        snprintf(buf, sizeof(buf),
+                 "qos class %ld: tx %lld pkts %lld bytes %lld drops, "
+                 "delay p99 < %lld ns max %lld ns\n", c,
+                 (long long)sum.tx_pkts[c], (long long)sum.tx_bytes[c],
+                 (long long)sum.drops[c],
+                 (long long)((2ULL << i) * 1000000000 / hz),
+                 (long long)(sum.delay_max[c] * 1000000000 / hz));
+        fputs(buf, stdout);
+    }
+}
+
+/*
+ * Display the status and the counters of the packet filter
+ */
+static void
+_show_filter(struct pix_fe_stats *st)
+{
+    struct pix_fe_filter_conf *conf;
+    struct pix_fe_filter_stats sum;
+    struct pix_fe_task_stats *ts;
+    const char *status;
+    ssize_t i;
+    ssize_t j;
+    char buf[256];
+
+    conf = _attach_filter();
+    if ( NULL == conf ) {
+        return;
+    }
+    switch ( conf->status ) {
+    case PIX_FE_FILTER_INTERP:
+        status = "interpreted";
+        break;
+    case PIX_FE_FILTER_JIT:
+        status = "JIT-compiled";
+        break;
+    case PIX_FE_FILTER_INVALID:
+        status = "rejected";
+        break;
+    default:
+        return;
+    }
+
+    memset(&sum, 0, sizeof(struct pix_fe_filter_stats));
+    for ( j = 0; j < st->ntasks; j++ ) {
+        ts = &st->tasks[j];
+        sum.pass += ts->filter.pass;
+        sum.drops += ts->filter.drops;
+        sum.redirects += ts->filter.redirects;
+        for ( i = 0; i < PIX_FE_FILTER_COUNTERS; i++ ) {
+            sum.counters[i] += ts->filter.counters[i];
+        }
+    }
+    snprintf(buf, sizeof(buf),
+             "filter (%s, %d insns): pass %lld drops %lld redirects %lld\n",
+             status, conf->ninsns, (long long)sum.pass, (long long)sum.drops,
+             (long long)sum.redirects);
+    fputs(buf, stdout);
+    for ( i = 0; i < PIX_FE_FILTER_COUNTERS; i++ ) {
+        if ( sum.counters[i] > 0 ) {
+            snprintf(buf, sizeof(buf), "  counter #%ld: %lld\n", i,
+                     (long long)sum.counters[i]);
+            fputs(buf, stdout);
+        }
+    }
+}
+
+/*
+ * Display the results of the packet generator
+ */
+static void
+_show_pktgen(struct pix_fe_stats *st)
+{
+    struct pix_fe_task_stats *ts;
+    struct pix_fe_pktgen_stats sum;
+    uint64_t pps;
+    uint64_t hz;
+    ssize_t i;
+    ssize_t j;
+    char buf[256];
+
+    hz = st->tsc_hz > 0 ? st->tsc_hz : 1;
+    memset(&sum, 0, sizeof(struct pix_fe_pktgen_stats));
+    sum.latency_min = (uint64_t)-1;
+    pps = 0;
+    for ( j = 0; j < st->ntasks; j++ ) {
+        ts = &st->tasks[j];
+        sum.tx_pkts += ts->pktgen.tx_pkts;
+        sum.tx_bytes += ts->pktgen.tx_bytes;
+        sum.rx_pkts += ts->pktgen.rx_pkts;
+        sum.rx_bytes += ts->pktgen.rx_bytes;
+        sum.latency_sum += ts->pktgen.latency_sum;
+        if ( ts->pktgen.rx_pkts > 0 ) {
+            if ( ts->pktgen.latency_min < sum.latency_min ) {
+                sum.latency_min = ts->pktgen.latency_min;
+            }
+            if ( ts->pktgen.latency_max > sum.latency_max ) {
+                sum.latency_max = ts->pktgen.latency_max;
+            }
+            if ( ts->pktgen.last_tsc > ts->pktgen.start_tsc ) {
+                /* Receive rate of this task */
+                pps += ts->pktgen.rx_pkts * hz
+                    / (ts->pktgen.last_tsc - ts->pktgen.start_tsc);
+            }
+        }
+        for ( i = 0; i < PIX_FE_PKTGEN_HIST; i++ ) {
+            sum.hist[i] += ts->pktgen.hist[i];
+        }
+    }
+    if ( 0 == sum.tx_pkts && 0 == sum.rx_pkts ) {
+        return;
+    }
+
+    snprintf(buf, sizeof(buf),
+             "pktgen: tx %lld pkts %lld bytes, rx %lld pkts %lld bytes, "
+             "lost %lld pkts, rx %lld pps\n",
+             (long long)sum.tx_pkts, (long long)sum.tx_bytes,
+             (long long)sum.rx_pkts, (long long)sum.rx_bytes,
+             (long long)(sum.tx_pkts > sum.rx_pkts
+                         ? sum.tx_pkts - sum.rx_pkts : 0), (long long)pps);
+    fputs(buf, stdout);
+    if ( 0 == sum.rx_pkts ) {
+        return;
+    }
+
+    /* Latency in nanoseconds */
+    snprintf(buf, sizeof(buf),
+             "  latency: min %lld ns avg %lld ns max %lld ns\n",
+             (long long)(sum.latency_min * 1000000000 / hz),
+             (long long)(sum.latency_sum / sum.rx_pkts * 1000000000 / hz),
+             (long long)(sum.latency_max * 1000000000 / hz));
+    fputs(buf, stdout);
+    for ( i = 0; i < PIX_FE_PKTGEN_HIST; i++ ) {
+        if ( 0 == sum.hist[i] ) {
+            continue;
+        }
+        snprintf(buf, sizeof(buf), "  [%lld, %lld) ns: %lld\n",
+                 (long long)((1ULL << i) * 1000000000 / hz),
+                 (long long)((2ULL << i) * 1000000000 / hz),
+                 (long long)sum.hist[i]);
+        fputs(buf, stdout);
+    }
+}
+
+/*
+ * Request to the forwarding engine
+ */
+int
+pash_module_fe_request(struct pash *pash, char *args[])
+{
+    if ( NULL != args[2] && 0 == strcmp("capture", args[2]) ) {
+        if ( _request_capture(args) < 0 ) {
+            pash_module_fe_help(pash, args);
+            return -1;
+        }
+        return 0;
+    }
+    if ( NULL != args[2] && 0 == strcmp("poll", args[2]) ) {
+        if ( _request_poll(args) < 0 ) {
+            pash_module_fe_help(pash, args);
+            return -1;
+        }
+        return 0;
+    }
+    if ( NULL != args[2] && 0 == strcmp("pipeline", args[2]) ) {
+        if ( _request_pipeline(args) < 0 ) {
+            pash_module_fe_help(pash, args);
+            return -1;
+        }
+        return 0;
+    }
+    if ( NULL != args[2] && 0 == strcmp("filter", args[2]) ) {
+        if ( _request_filter(args) < 0 ) {
+            pash_module_fe_help(pash, args);
+            return -1;
+        }
+        return 0;
+    }
+    if ( NULL != args[2] && 0 == strcmp("qos", args[2]) ) {
+        if ( _request_qos(args) < 0 ) {
+            pash_module_fe_help(pash, args);
+            return -1;
+        }
+        return 0;
+    }
+    if ( NULL != args[2] && 0 == strcmp("lag", args[2]) ) {
+        if ( _request_lag(args) < 0 ) {
+            pash_module_fe_help(pash, args);
+            return -1;
+        }
+        return 0;
+    }
+    if ( NULL != args[2] && 0 == strcmp("storm", args[2]) ) {
+        if ( _request_storm(args) < 0 ) {
+            pash_module_fe_help(pash, args);
+            return -1;
+        }
+        return 0;
+    }
+    if ( NULL != args[2] && 0 == strcmp("mcast", args[2]) ) {
+        if ( _request_mcast(args) < 0 ) {
+            pash_module_fe_help(pash, args);
+            return -1;
+        }
+        return 0;
+    }
+    if ( NULL != args[2] && 0 == strcmp("nat", args[2]) ) {
+        if ( _request_nat(args) < 0 ) {
+            pash_module_fe_help(pash, args);
+            return -1;
+        }
+        return 0;
+    }
+    if ( NULL != args[2] && 0 == strcmp("tunnel", args[2]) ) {
+        if ( _request_tunnel(args) < 0 ) {
+            pash_module_fe_help(pash, args);
+            return -1;
+        }
+        return 0;
+    }
+    if ( NULL != args[2] && 0 == strcmp("fdir", args[2]) ) {
+        if ( _request_fdir(args) < 0 ) {
+            pash_module_fe_help(pash, args);
+            return -1;
+        }
+        return 0;
+    }
+    if ( NULL != args[2] && 0 == strcmp("pktgen", args[2]) ) {
+        if ( _request_pktgen(args) < 0 ) {
+            pash_module_fe_help(pash, args);
+            return -1;
+        }
+        return 0;
+    }
+    pash_module_fe_help(pash, args);
+
+    return -1;
+}
+
+/*
+ * Display the statistics of the forwarding engine
+ */
+int
+pash_module_fe_get(struct pash *pash, char *args[])
+{
+    struct pix_fe_stats *st;
+    struct pix_fe_task_stats *ts;
+    struct pix_fe_port_stats port;
+    uint64_t hz;
+    ssize_t i;
+    ssize_t j;
+    char buf[512];
+
+    st = _attach_stats();
+    if ( NULL == st ) {
+        fputs("Could not get statistics of the forwarding engine.\n", stderr);
+        return -1;
+    }
+    /* TSC frequency to convert cycles to time */
+    hz = st->tsc_hz > 1000 ? st->tsc_hz : 1000;
+
+    /* Aggregate the counters of all tasks for each port */
+    for ( i = 0; i < st->nports; i++ ) {
+        memset(&port, 0, sizeof(struct pix_fe_port_stats));
+        for ( j = 0; j < st->ntasks; j++ ) {
+            ts = &st->tasks[j];
+            port.rx_pkts += ts->ports[i].rx_pkts;
+            port.rx_bytes += ts->ports[i].rx_bytes;
+            port.rx_drops += ts->ports[i].rx_drops;
+            port.tx_pkts += ts->ports[i].tx_pkts;
+            port.tx_bytes += ts->ports[i].tx_bytes;
+            port.tx_drops += ts->ports[i].tx_drops;
+        }
+        snprintf(buf, sizeof(buf),
+                 "Port #%ld: rx %lld pkts %lld bytes %lld drops, "
+                 "tx %lld pkts %lld bytes %lld drops\n", i,
+                 (long long)port.rx_pkts, (long long)port.rx_bytes,
+                 (long long)port.rx_drops, (long long)port.tx_pkts,
+                 (long long)port.tx_bytes, (long long)port.tx_drops);
+        fputs(buf, stdout);
+        snprintf(buf, sizeof(buf),
+                 "  MAC: rx %lld pkts %lld bytes %lld missed %lld crcerrs, "
+                 "tx %lld pkts %lld bytes\n",
+                 (long long)st->hw[i].rx_pkts, (long long)st->hw[i].rx_bytes,
+                 (long long)st->hw[i].rx_missed,
+                 (long long)st->hw[i].rx_crcerrs,
+                 (long long)st->hw[i].tx_pkts, (long long)st->hw[i].tx_bytes);
+        fputs(buf, stdout);
+    }
+
+    /* Drops and capture per task */
+    for ( j = 0; j < st->ntasks; j++ ) {
+        ts = &st->tasks[j];
+        snprintf(buf, sizeof(buf),
+                 "Task #%ld (CPU %d): drops %lld no-buffer %lld ring-full "
+                 "%lld fdb-full\n", j, ts->cpuid,
+                 (long long)ts->drops.no_buffer,
+                 (long long)ts->drops.ring_full,
+                 (long long)ts->drops.fdb_full);
+        fputs(buf, stdout);
+        snprintf(buf, sizeof(buf), "  learn: %lld requests %lld drops\n",
+                 (long long)ts->fdb.learns, (long long)ts->fdb.learn_drops);
+        fputs(buf, stdout);
+        if ( ts->capture.pkts > 0 || ts->capture.drops > 0 ) {
+            /* Overhead of the capture on the fast path in cycles/packet */
+            snprintf(buf, sizeof(buf),
+                     "  capture: %lld pkts %lld drops %lld cycles/pkt\n",
+                     (long long)ts->capture.pkts,
+                     (long long)ts->capture.drops,
+                     (long long)(ts->capture.cycles
+                                 / (ts->capture.pkts + ts->capture.drops)));
+            fputs(buf, stdout);
+        }
+        if ( ts->poll.sleeps > 0 ) {
+            /* Adaptive polling */
+            snprintf(buf, sizeof(buf),
+                     "  poll: %lld sleeps %lld ms slept, %lld wake-ups "
+                     "(avg %lld ns max %lld ns)\n",
+                     (long long)ts->poll.sleeps,
+                     (long long)(ts->poll.sleep_cycles / (hz / 1000)),
+                     (long long)ts->poll.wakeups,
+                     (long long)(ts->poll.wakeups > 0
+                                 ? ts->poll.wakeup_cycles / ts->poll.wakeups
+                                 * 1000000000 / hz : 0),
+                     (long long)(ts->poll.wakeup_max * 1000000000 / hz));
+            fputs(buf, stdout);
+        }
+        /* Cycles/packet of the Rx bursts to compare the cache placements */
+        for ( i = 0; i < PIX_FE_POLL_NPLACES; i++ ) {
+            if ( 0 == ts->poll.rx_pkts[i] ) {
+                continue;
+            }
+            snprintf(buf, sizeof(buf), "  rx %s: %lld pkts %lld cycles/pkt\n",
+                     pash_module_fe_poll_places[i],
+                     (long long)ts->poll.rx_pkts[i],
+                     (long long)(ts->poll.rx_cycles[i]
+                                 / ts->poll.rx_pkts[i]));
+            fputs(buf, stdout);
+        }
+    }
+
+    /* Packet filter */
+    _show_filter(st);
+
+    /* QoS */
+    _show_qos(st);
+
+    /* Link aggregation */
+    _show_lag(st);
+
+    /* Storm control and IGMP snooping */
+    _show_storm(st);
+
+    /* NAT44 */
+    _show_nat(st);
+
+    /* Tunnel endpoint */
+    _show_tunnel(st);
+
+    /* Flow Director */
+    _show_fdir(st);
+
+    /* Packet generator */
+    _show_pktgen(st);
+
+    return 0;
+}
+
+static char *pash_module_fe_name = "fe";
+static struct pash_module_api pash_module_fe_api = {
+    .clear = NULL,
+    .help = &pash_module_fe_help,
+    .request = &pash_module_fe_request,
+    .get = &pash_module_fe_get,
+};
+
+/*
+ * Initialize
+ */
+int
+pash_module_fe_init(struct pash *pash)
+{
+    return pash_register_module(pash, pash_module_fe_name,
+                                &pash_module_fe_api);
+}
+
+/*
+ * Local variables:
+ * tab-width: 4
+ * c-basic-offset: 4
+ * End:
+ * vim600: sw=4 ts=4 fdm=marker
+ * vim<600: sw=4 ts=4
+ */
@@ -366,6 +366,7 @@ pash_execute(struct pash *pash, const char *cmd)
 /* Modules */
 int pash_module_clock_init(struct pash *);
 int pash_module_cpu_init(struct pash *);
+int pash_module_fe_init(struct pash *);
 int pash_module_system_init(struct pash *);
 
 /*
@@ -396,6 +397,7 @@ main(int argc, char *argv[])
     /* Load modules (but currently not loadable...) */
     pash_module_clock_init(pash);
     pash_module_cpu_init(pash);
+    pash_module_fe_init(pash);
     pash_module_system_init(pash);
 
     putchar('>');
@@ -26,6 +26,7 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <machine/sysarch.h>
+#include <mki/driver.h>
 #include <time.h>
 #include "pci.h"
 
@@ -121,6 +122,41 @@ pci_get_header_type(uint16_t bus, uint16_t slot, uint16_t func)
     return pci_read_config(bus, slot, func, 0x0e) & 0xff;
 }
 
+/*
+ * Find the capability of the specified ID in the capability list.  The search
+ * starts from the head of the list if ptr is zero, or from the next of the
+ * capability at ptr otherwise.  Returns the offset of the capability, or zero
+ * if not found.
+ */
+uint8_t
+pci_find_capability(uint16_t bus, uint16_t slot, uint16_t func, uint8_t id,
+                    uint8_t ptr)
+{
+    uint16_t m16;
+    int ttl;
+
+    if ( 0 == ptr ) {
+        /* Capabilities list bit in the status register */
+        if ( !(pci_read_config(bus, slot, func, 0x06) & (1 << 4)) ) {
+            return 0;
+        }
+        ptr = pci_read_config(bus, slot, func, 0x34) & 0xfc;
+    } else {
+        ptr = (pci_read_config(bus, slot, func, ptr) >> 8) & 0xfc;
+    }
+
+    /* Bounded to avoid looping on a broken list */
+    for ( ttl = 48; ptr >= 0x40 && ttl > 0; ttl-- ) {
+        m16 = pci_read_config(bus, slot, func, ptr);
+        if ( (m16 & 0xff) == id ) {
+            return ptr;
+        }
+        ptr = (m16 >> 8) & 0xfc;
+    }
+
+    return 0;
+}
+
 /*
  * Check function
  */
@@ -171,6 +207,16 @@ pci_check_function(uint8_t bus, uint8_t slot, uint8_t func)
     conf->subclass = (uint8_t)(class & 0xff);
     conf->progif = (uint8_t)(prog >> 8);
     conf->revision = (uint8_t)(prog & 0xff);
+
+    /* Message signaled interrupts */
+    conf->msi_cap = pci_find_capability(bus, slot, func, PCI_CAP_ID_MSI, 0);
+    conf->msix_cap = pci_find_capability(bus, slot, func, PCI_CAP_ID_MSIX, 0);
+    if ( 0 != conf->msix_cap ) {
+        conf->msix_nvec = (pci_read_config(bus, slot, func,
+                                           conf->msix_cap + 2) & 0x7ff) + 1;
+    } else {
+        conf->msix_nvec = 0;
+    }
     dev->device = conf;
     dev->next = NULL;
 }
@@ -258,6 +304,9 @@ pci_init(void)
     pci_check_all_buses();
 }
 
+/* PCI device table enumerated by the kernel at boot */
+static struct sysdriver_pci_table pci_table;
+
 /*
  * Entry point for the PCI driver
  */
@@ -274,7 +323,16 @@ main(int argc, char *argv[])
     fd[2] = open(path, O_WRONLY);
     (void)fd[0];
 
-    pci_check_all_buses();
+    if ( driver_pci_table(&pci_table) >= 0 && pci_table.ndevs > 0 ) {
+        /* The kernel has already enumerated all the functions at boot */
+        printf("PCI: %d functions enumerated through %s in %lld us "
+               "(%lld cycles)\n", pci_table.ndevs,
+               pci_table.ecam ? "ECAM" : "I/O ports",
+               (long long)pci_table.enum_usec,
+               (long long)pci_table.enum_cycles);
+    } else {
+        pci_check_all_buses();
+    }
 
     tm.tv_sec = 1;
     tm.tv_nsec = 0;
@@ -26,6 +26,10 @@
 
 #include <stdint.h>
 
+/* Capability IDs */
+#define PCI_CAP_ID_MSI          0x05    /* Message signaled interrupts */
+#define PCI_CAP_ID_MSIX         0x11    /* MSI-X */
+
 /*
  * PCI configuration space
  */
@@ -41,6 +45,11 @@ struct pci_dev_conf {
     uint8_t subclass;
     uint8_t progif;
     uint8_t revision;
+    /* Offsets of the MSI and MSI-X capabilities (0 if not supported) */
+    uint8_t msi_cap;
+    uint8_t msix_cap;
+    /* Number of the MSI-X vectors */
+    uint16_t msix_nvec;
 };
 
 /*
@@ -55,6 +64,7 @@ uint16_t pci_read_config(uint16_t, uint16_t, uint16_t, uint16_t);
 uint64_t pci_read_mmio(uint8_t, uint8_t, uint8_t);
 uint32_t pci_read_rom_bar(uint8_t, uint8_t, uint8_t);
 uint8_t pci_get_header_type(uint16_t, uint16_t, uint16_t);
+uint8_t pci_find_capability(uint16_t, uint16_t, uint16_t, uint8_t, uint8_t);
 
 #endif
 
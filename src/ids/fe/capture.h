@@ -0,0 +1,171 @@
+/*_
+ * Copyright (c) 2017 Hirochika Asai <asai@jar.jp>
+ * All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef _CAPTURE_H
+#define _CAPTURE_H
+
+#include <stdint.h>
+
+#define FE_CAPTURE_QLEN         1024
+#define FE_CAPTURE_SNAPLEN      1518
+
+/* pcap file format */
+#define PCAP_MAGIC              0xa1b2c3d4
+#define PCAP_VERSION_MAJOR      2
+#define PCAP_VERSION_MINOR      4
+#define PCAP_LINKTYPE_ETHERNET  1
+
+/*
+ * pcap global header
+ */
+struct pcap_hdr {
+    uint32_t magic;
+    uint16_t version_major;
+    uint16_t version_minor;
+    int32_t thiszone;
+    uint32_t sigfigs;
+    uint32_t snaplen;
+    uint32_t linktype;
+} __attribute__ ((packed));
+
+/*
+ * pcap record header
+ */
+struct pcap_rec_hdr {
+    uint32_t ts_sec;
+    uint32_t ts_usec;
+    uint32_t caplen;
+    uint32_t len;
+} __attribute__ ((packed));
+
+/*
+ * Descriptor of a captured packet.  The packet buffer itself is not copied but
+ * referenced until the consumer writes it out.
+ */
+struct fe_capture_desc {
+    void *hdr;
+    void *pkt;
+    uint64_t tsc;
+    uint16_t caplen;
+    uint16_t len;
+    uint16_t port;
+    uint16_t rsvd[1];
+};
+
+/*
+ * Capture ring buffer from an exclusive task (producer) to the tickful task
+ * (consumer)
+ */
+struct fe_capture_ring {
+    /* Descriptors */
+    struct fe_capture_desc *descs;
+    /* Head/tail */
+    volatile uint16_t head;     /* Operated from the consumer */
+    volatile uint16_t tail;     /* Operated from the producer */
+    uint16_t tx_head;           /* Managed by the producer for collection */
+    /* Length */
+    uint16_t len;
+};
+
+/*
+ * Enqueue a packet to the capture ring
+ */
+static __inline__ int
+fe_capture_enqueue(struct fe_capture_ring *ring, void *hdr, void *pkt,
+                   uint16_t caplen, uint16_t len, uint16_t port, uint64_t tsc)
+{
+    struct fe_capture_desc *desc;
+    uint16_t tail;
+
+    tail = ring->tail + 1 < ring->len ? ring->tail + 1 : 0;
+    if ( tail == ring->tx_head ) {
+        /* Buffer is full */
+        return 0;
+    }
+    desc = &ring->descs[ring->tail];
+    desc->hdr = hdr;
+    desc->pkt = pkt;
+    desc->tsc = tsc;
+    desc->caplen = caplen;
+    desc->len = len;
+    desc->port = port;
+
+    __sync_synchronize();
+
+    ring->tail = tail;
+
+    return 1;
+}
+
+/*
+ * Get the descriptor at the head of the capture ring (consumer)
+ */
+static __inline__ struct fe_capture_desc *
+fe_capture_peek(struct fe_capture_ring *ring)
+{
+    if ( ring->head == ring->tail ) {
+        /* Empty */
+        return NULL;
+    }
+    __sync_synchronize();
+
+    return &ring->descs[ring->head];
+}
+
+/*
+ * Release the descriptor at the head of the capture ring (consumer)
+ */
+static __inline__ void
+fe_capture_release(struct fe_capture_ring *ring)
+{
+    __sync_synchronize();
+    ring->head = ring->head + 1 < ring->len ? ring->head + 1 : 0;
+}
+
+/*
+ * Collect a packet buffer released by the consumer (producer)
+ */
+static __inline__ int
+fe_capture_collect(struct fe_capture_ring *ring, void **hdr)
+{
+    if ( ring->tx_head == ring->head ) {
+        /* Already collected */
+        return 0;
+    }
+
+    *hdr = ring->descs[ring->tx_head].hdr;
+    ring->tx_head = ring->tx_head + 1 < ring->len ? ring->tx_head + 1 : 0;
+
+    return 1;
+}
+
+#endif /* _CAPTURE_H */
+
+/*
+ * Local variables:
+ * tab-width: 4
+ * c-basic-offset: 4
+ * End:
+ * vim600: sw=4 ts=4 fdm=marker
+ * vim<600: sw=4 ts=4
+ */
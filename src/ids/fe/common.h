@@ -73,6 +73,44 @@ wr32(void *mmio, uint64_t reg, volatile uint32_t val)
     *(volatile uint32_t *)(mmio + reg) = val;
 }
 
+/*
+ * Read data from a 16-bit register via MMIO
+ */
+static __inline__ uint16_t
+rd16(void *mmio, uint64_t reg)
+{
+    return *(volatile uint16_t *)(mmio + reg);
+}
+
+/*
+ * Write data to a 16-bit register via MMIO
+ */
+static __inline__ void
+wr16(void *mmio, uint64_t reg, volatile uint16_t val)
+{
+    __sync_synchronize();
+    *(volatile uint16_t *)(mmio + reg) = val;
+}
+
+/*
+ * Read data from an 8-bit register via MMIO
+ */
+static __inline__ uint8_t
+rd8(void *mmio, uint64_t reg)
+{
+    return *(volatile uint8_t *)(mmio + reg);
+}
+
+/*
+ * Write data to an 8-bit register via MMIO
+ */
+static __inline__ void
+wr8(void *mmio, uint64_t reg, volatile uint8_t val)
+{
+    __sync_synchronize();
+    *(volatile uint8_t *)(mmio + reg) = val;
+}
+
 #endif /* _COMMON_H */
 
 /*
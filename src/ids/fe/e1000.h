@@ -27,6 +27,7 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <time.h>
+#include <sys/pix.h>
 #include <mki/driver.h>
 #include "pci.h"
 #include "common.h"
@@ -65,6 +66,14 @@
 #define E1000_REG_TXDCTL        0x03828
 #define E1000_REG_RAL           0x5400
 #define E1000_REG_RAH           0x5404
+#define E1000_REG_CRCERRS       0x4000
+#define E1000_REG_MPC           0x4010
+#define E1000_REG_GPRC          0x4074
+#define E1000_REG_GPTC          0x4080
+#define E1000_REG_GORCL         0x4088
+#define E1000_REG_GORCH         0x408c
+#define E1000_REG_GOTCL         0x4090
+#define E1000_REG_GOTCH         0x4094
 
 #define E1000_CTRL_FD           1       /* Full duplex */
 #define E1000_CTRL_LRST         (1<<3)  /* Link reset */
@@ -524,6 +533,50 @@ e1000_rx_dequeue(struct e1000_rx_ring *rxring, void **hdr)
     return len;
 }
 
+/*
+ * Prefetch the descriptor k ahead of the head, and return its packet buffer if
+ * it has already been received
+ */
+static __inline__ void *
+e1000_rx_prefetch(struct e1000_rx_ring *rxring, int k)
+{
+    int avail;
+    int idx;
+
+    /* # of received descriptors not dequeued yet */
+    avail = (int)rxring->head - (int)rxring->soft_head;
+    if ( avail < 0 ) {
+        avail += rxring->len;
+    }
+    if ( k >= avail ) {
+        return NULL;
+    }
+    idx = rxring->soft_head + k;
+    if ( idx >= rxring->len ) {
+        idx -= rxring->len;
+    }
+    __builtin_prefetch(&rxring->descs[idx]);
+
+    return rxring->bufs[idx];
+}
+
+/*
+ * Check if the next Rx descriptor has been written back (without MMIO)
+ */
+static __inline__ int
+e1000_rx_ready(struct e1000_rx_ring *rxring)
+{
+    volatile struct e1000_rx_desc *rxdesc;
+
+    if ( rxring->head != rxring->soft_head ) {
+        return 1;
+    }
+    rxdesc = &rxring->descs[rxring->soft_head];
+
+    /* DD bit */
+    return rxdesc->status & 1;
+}
+
 /*
  * Setup Tx port
  */
@@ -636,20 +689,52 @@ e1000_calc_tx_ring_memsize(struct e1000_tx_ring *tx, uint16_t qlen)
 }
 
 
+/*
+ * Collect up to n transmitted buffers by scanning the DD bits written back to
+ * the descriptors (every descriptor is enqueued with RS) instead of reading
+ * the head register through MMIO
+ */
 static __inline__ int
-e1000_collect_buffer(struct e1000_tx_ring *txring, void **hdr)
+e1000_collect_buffers(struct e1000_tx_ring *txring, void **hdrs, int n)
 {
-    txring->head = rd32(txring->mmio, E1000_REG_TDH);
-    if ( txring->soft_head == txring->head ) {
-        return 0;
+    int i;
+
+    for ( i = 0; i < n; i++ ) {
+        if ( txring->soft_head == txring->tail ) {
+            /* No descriptor in flight */
+            break;
+        }
+        if ( !(txring->descs[txring->soft_head].sta & 1) ) {
+            /* Not yet transmitted */
+            break;
+        }
+        hdrs[i] = txring->bufs[txring->soft_head];
+        txring->soft_head
+            = txring->soft_head + 1 < txring->len ? txring->soft_head + 1 : 0;
     }
+    txring->head = txring->soft_head;
 
-    *hdr = txring->bufs[txring->soft_head];
+    return i;
+}
 
-    txring->soft_head
-        = txring->soft_head + 1 < txring->len ? txring->soft_head + 1 : 0;
+/*
+ * Accumulate the hardware statistics counters (clear on read)
+ */
+static __inline__ void
+e1000_read_hw_stats(struct e1000_device *dev, struct pix_fe_hw_stats *st)
+{
+    uint64_t m64;
 
-    return 1;
+    st->rx_pkts += rd32(dev->mmio, E1000_REG_GPRC);
+    m64 = rd32(dev->mmio, E1000_REG_GORCL);
+    m64 |= (uint64_t)rd32(dev->mmio, E1000_REG_GORCH) << 32;
+    st->rx_bytes += m64;
+    st->rx_missed += rd32(dev->mmio, E1000_REG_MPC);
+    st->rx_crcerrs += rd32(dev->mmio, E1000_REG_CRCERRS);
+    st->tx_pkts += rd32(dev->mmio, E1000_REG_GPTC);
+    m64 = rd32(dev->mmio, E1000_REG_GOTCL);
+    m64 |= (uint64_t)rd32(dev->mmio, E1000_REG_GOTCH) << 32;
+    st->tx_bytes += m64;
 }
 
 #endif /* _E1000_H */
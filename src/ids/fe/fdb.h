@@ -43,6 +43,8 @@ struct fdb_entry {
     int port;
     /* Aging (accessed time in TSC) */
     uint64_t aging;
+    /* Hit bit set by fast-path tasks and cleared by fdb_gc() */
+    volatile int hit;
     /* Linked-list */
     struct fdb_entry *next;
     struct fdb_entry *prev;     /* for fdb.entries */
@@ -128,6 +130,7 @@ fdb_gc(struct fdb *fdb)
 {
     struct hopscotch_hash_table *h;
     struct fdb_entry *e;
+    struct fdb_entry *next;
     struct fdb_entry *rem;
     uint64_t curtsc;
 
@@ -135,7 +138,12 @@ fdb_gc(struct fdb *fdb)
     e = fdb->entries;
     rem = NULL;
     while ( NULL != e ) {
-        if ( curtsc - e->aging > FDB_AGING_TSC ) {
+        next = e->next;
+        if ( e->hit ) {
+            /* Accessed since the last sweep */
+            e->hit = 0;
+            e->aging = curtsc;
+        } else if ( curtsc - e->aging > FDB_AGING_TSC ) {
             /* Remove from the hash table */
             hopscotch_remove(fdb->update, e->key);
             /* Remove from the list of entries */
@@ -144,11 +152,14 @@ fdb_gc(struct fdb *fdb)
             } else {
                 e->prev->next = e->next;
             }
+            if ( NULL != e->next ) {
+                e->next->prev = e->prev;
+            }
             /* Add this entry to the list of entries to be removed */
             e->next = rem;
             rem = e;
         }
-        e = e->next;
+        e = next;
     }
 
     h = fdb->cur;
@@ -189,6 +200,28 @@ fdb_lookup(struct fdb *fdb, uint8_t *key)
     return hopscotch_lookup(fdb->cur, key);
 }
 
+/*
+ * Check if the source address needs to be learned (i.e., unknown or moved).
+ * Otherwise, mark the entry as hit for aging.  This is called from fast-path
+ * tasks instead of sending a learning request for every packet.
+ */
+static __inline__ int
+fdb_learn_required(struct fdb *fdb, uint8_t *key, int port)
+{
+    struct fdb_entry *e;
+
+    e = hopscotch_lookup(fdb->cur, key);
+    if ( NULL == e || e->port != port ) {
+        return 1;
+    }
+    if ( !e->hit ) {
+        /* Write only once per sweep not to bounce the cache line */
+        e->hit = 1;
+    }
+
+    return 0;
+}
+
 static __inline__ int
 fdb_update(struct fdb *fdb, uint8_t *key, int port)
 {
@@ -201,6 +234,7 @@ fdb_update(struct fdb *fdb, uint8_t *key, int port)
         /* Update the entry */
         found->port = port;
         found->aging = fdb_rdtsc();
+        found->hit = 0;
     } else {
         /* New entry */
         found = fdb->pool;
@@ -214,6 +248,7 @@ fdb_update(struct fdb *fdb, uint8_t *key, int port)
         memcpy(found->key, key, FDB_KEY_SIZE);
         found->port = port;
         found->aging = fdb_rdtsc();
+        found->hit = 0;
         found->prev = NULL;
         found->next = fdb->entries;
         if ( NULL != fdb->entries ) {
@@ -222,7 +257,7 @@ fdb_update(struct fdb *fdb, uint8_t *key, int port)
         fdb->entries = found;
 
         /* Insert this to the hash table */
-        hopscotch_insert(fdb->update, key, found);
+        hopscotch_insert(fdb->update, found->key, found);
 
         /* Replace the current hash table with the updated one */
         h = fdb->cur;
@@ -232,7 +267,7 @@ fdb_update(struct fdb *fdb, uint8_t *key, int port)
         __sync_synchronize();
 
         /* Insert this to the hash table */
-        hopscotch_insert(fdb->update, key, found);
+        hopscotch_insert(fdb->update, found->key, found);
     }
 
     return 0;
@@ -0,0 +1,294 @@
+/*_
+ * Copyright (c) 2017 Hirochika Asai <asai@jar.jp>
+ * All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#ifndef _FDIR_H
+#define _FDIR_H
+
+/*
+ * Flow Director (82599) filters.  A filter steers an IPv4 flow to an Rx
+ * queue, i.e., to the exclusive task owning the queue on a port spread over
+ * the tasks.  The port runs in either mode: perfect-match filters compare the
+ * whole tuple (the VLAN and the flexible bytes are masked), and signature
+ * filters compare a hash of it (untagged IPv4 frames only).  The hashes below
+ * are the ones the NIC computes with FE_FDIR_BUCKET_KEY and FE_FDIR_SIG_KEY.
+ * The tickful task keeps a table of the filters installed per port; the slot
+ * of a filter is its software index in the NIC so that it can be removed.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+/* Same as PIX_FE_FDIR_* */
+#define FE_FDIR_NONE            0
+#define FE_FDIR_PERFECT         1
+#define FE_FDIR_SIGNATURE       2
+
+/* Maximum number of filters per port */
+#define FE_FDIR_MAX             256
+
+/* Hash keys (FDIRHKEY and FDIRSKEY) */
+#define FE_FDIR_BUCKET_KEY      0x3dad14e2
+#define FE_FDIR_SIG_KEY         0x174d3614
+#define FE_FDIR_COMMON_KEY      (FE_FDIR_BUCKET_KEY & FE_FDIR_SIG_KEY)
+
+/* Flow types (L4TYPE of FDIRCMD) */
+#define FE_FDIR_TYPE_IPV4       0
+#define FE_FDIR_TYPE_UDPV4      1
+#define FE_FDIR_TYPE_TCPV4      2
+#define FE_FDIR_TYPE_SCTPV4     3
+
+/* Flexible bytes of an untagged IPv4 frame (the EtherType) */
+#define FE_FDIR_FLEX_IPV4       0x0800
+
+/*
+ * IPv4 flow (host byte order)
+ */
+struct fe_fdir_flow {
+    uint32_t sip;
+    uint32_t dip;
+    uint16_t sport;
+    uint16_t dport;
+    uint8_t proto;
+};
+
+/*
+ * Filter installed
+ */
+struct fe_fdir_filter {
+    struct fe_fdir_flow flow;
+    int valid;
+    int queue;
+    /* FDIRHASH without the software index */
+    uint32_t hash;
+};
+
+/*
+ * Filters installed on a port
+ */
+struct fe_fdir_table {
+    int mode;
+    int n;
+    struct fe_fdir_filter filters[FE_FDIR_MAX];
+};
+
+/*
+ * Flow type of an IP protocol
+ */
+static __inline__ int
+fe_fdir_flow_type(uint8_t proto)
+{
+    switch ( proto ) {
+    case 6:
+        return FE_FDIR_TYPE_TCPV4;
+    case 17:
+        return FE_FDIR_TYPE_UDPV4;
+    case 132:
+        return FE_FDIR_TYPE_SCTPV4;
+    default:
+        ;
+    }
+
+    return FE_FDIR_TYPE_IPV4;
+}
+
+/*
+ * Bucket hash of a perfect-match filter (13 bits)
+ */
+static __inline__ uint32_t
+fe_fdir_perfect_hash(const struct fe_fdir_flow *f)
+{
+    uint32_t hi;
+    uint32_t lo;
+    uint32_t fvv;
+    uint32_t h;
+    int n;
+
+    /* The VM pool, the VLAN, and the flexible bytes are masked */
+    fvv = (uint32_t)fe_fdir_flow_type(f->proto) << 16;
+    hi = f->dip ^ f->sip ^ (((uint32_t)f->sport << 16) | f->dport);
+    lo = (hi >> 16) | (hi << 16);
+    hi ^= fvv ^ (fvv >> 16);
+
+    h = 0;
+    for ( n = 0; n < 16; n++ ) {
+        if ( 1 == n ) {
+            /* Not on bit 0 of the stream */
+            lo ^= fvv ^ (fvv << 16);
+        }
+        if ( FE_FDIR_BUCKET_KEY & (1U << n) ) {
+            h ^= lo >> n;
+        }
+        if ( FE_FDIR_BUCKET_KEY & (1U << (n + 16)) ) {
+            h ^= hi >> n;
+        }
+    }
+
+    return h & 0x1fff;
+}
+
+/*
+ * Signature (bits 31:16) and bucket hash (bits 14:0) of a signature filter
+ */
+static __inline__ uint32_t
+fe_fdir_signature_hash(const struct fe_fdir_flow *f)
+{
+    uint32_t hi;
+    uint32_t lo;
+    uint32_t fvv;
+    uint32_t common;
+    uint32_t bucket;
+    uint32_t sig;
+    int n;
+
+    fvv = (uint32_t)fe_fdir_flow_type(f->proto) << 16;
+    hi = f->sip ^ f->dip
+        ^ ((((uint32_t)f->sport ^ FE_FDIR_FLEX_IPV4) << 16) | f->dport);
+    lo = (hi >> 16) | (hi << 16);
+    hi ^= fvv ^ (fvv >> 16);
+
+    common = 0;
+    bucket = 0;
+    sig = 0;
+    for ( n = 0; n < 16; n++ ) {
+        if ( 1 == n ) {
+            lo ^= fvv ^ (fvv << 16);
+        }
+        if ( FE_FDIR_COMMON_KEY & (1U << n) ) {
+            common ^= lo >> n;
+        } else if ( FE_FDIR_BUCKET_KEY & (1U << n) ) {
+            bucket ^= lo >> n;
+        } else if ( FE_FDIR_SIG_KEY & (1U << n) ) {
+            sig ^= lo << (16 - n);
+        }
+        if ( FE_FDIR_COMMON_KEY & (1U << (n + 16)) ) {
+            common ^= hi >> n;
+        } else if ( FE_FDIR_BUCKET_KEY & (1U << (n + 16)) ) {
+            bucket ^= hi >> n;
+        } else if ( FE_FDIR_SIG_KEY & (1U << (n + 16)) ) {
+            sig ^= hi << (16 - n);
+        }
+    }
+    bucket = (bucket ^ common) & 0x7fff;
+    sig = (sig ^ (common << 16)) & (0x7fffU << 16);
+
+    return sig | bucket;
+}
+
+/*
+ * Check if two flows are the same
+ */
+static __inline__ int
+fe_fdir_flow_equal(const struct fe_fdir_flow *a, const struct fe_fdir_flow *b)
+{
+    return a->sip == b->sip && a->dip == b->dip && a->sport == b->sport
+        && a->dport == b->dport && a->proto == b->proto;
+}
+
+/*
+ * Clear the table for a mode
+ */
+static __inline__ void
+fe_fdir_table_reset(struct fe_fdir_table *tbl, int mode)
+{
+    memset(tbl, 0, sizeof(struct fe_fdir_table));
+    tbl->mode = mode;
+}
+
+/*
+ * Find the slot of a flow, or -1 if not installed
+ */
+static __inline__ int
+fe_fdir_table_find(const struct fe_fdir_table *tbl,
+                   const struct fe_fdir_flow *f)
+{
+    int i;
+
+    for ( i = 0; i < FE_FDIR_MAX; i++ ) {
+        if ( tbl->filters[i].valid
+             && fe_fdir_flow_equal(&tbl->filters[i].flow, f) ) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+/*
+ * Add a filter to a free slot with its hash in the mode of the table, and
+ * return the slot, or -1 if the table is full or the port is disabled
+ */
+static __inline__ int
+fe_fdir_table_add(struct fe_fdir_table *tbl, const struct fe_fdir_flow *f,
+                  int queue)
+{
+    struct fe_fdir_filter *e;
+    int i;
+
+    if ( FE_FDIR_NONE == tbl->mode ) {
+        return -1;
+    }
+    for ( i = 0; i < FE_FDIR_MAX; i++ ) {
+        if ( !tbl->filters[i].valid ) {
+            break;
+        }
+    }
+    if ( i >= FE_FDIR_MAX ) {
+        return -1;
+    }
+    e = &tbl->filters[i];
+    memcpy(&e->flow, f, sizeof(struct fe_fdir_flow));
+    e->queue = queue;
+    if ( FE_FDIR_PERFECT == tbl->mode ) {
+        e->hash = fe_fdir_perfect_hash(f);
+    } else {
+        e->hash = fe_fdir_signature_hash(f);
+    }
+    e->valid = 1;
+    tbl->n++;
+
+    return i;
+}
+
+/*
+ * Release the slot of a filter
+ */
+static __inline__ void
+fe_fdir_table_del(struct fe_fdir_table *tbl, int i)
+{
+    if ( tbl->filters[i].valid ) {
+        tbl->filters[i].valid = 0;
+        tbl->n--;
+    }
+}
+
+#endif /* _FDIR_H */
+
+/*
+ * Local variables:
+ * tab-width: 4
+ * c-basic-offset: 4
+ * End:
+ * vim600: sw=4 ts=4 fdm=marker
+ * vim<600: sw=4 ts=4
+ */
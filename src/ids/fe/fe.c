@@ -30,6 +30,8 @@
 #include <sys/mman.h>
 #include <sys/pix.h>
 #include <time.h>
+#include <sys/time.h>
+#include <sys/endian.h>
 #include <sys/net/ethernet.h>
 #include "pci.h"
 #include "fe.h"
@@ -53,318 +55,2582 @@ popcnt(uint64_t x)
 }
 
 /*
- * Forwarding (Fast-path)
+ * Pipeline stage: run the packet filter.  The verdict of the program drops a
+ * packet, redirects it to a port, or passes it to the following stages.
  */
-static int
-fe_fpp_forwarding(struct fe_task *t, int port, struct fe_pkt_buf_hdr *hdr,
-                  void *pkt, int len)
+static __inline__ void
+fe_stage_filter(struct fe_task *t, struct fe_pipeline_vec *v)
 {
-    struct ether_header *eth;
-    uint8_t key[FDB_KEY_SIZE];
-    struct fdb_entry *e;
-    ssize_t i;
-    uint64_t mac;
-
-    eth = (struct ether_header *)pkt;
+    struct fe_filter_prog *prog;
+    uint32_t r;
+    int port;
+    int i;
 
-    memcpy(key, eth->ether_dhost, 6);
-    memset(key + 6, 0, 2);
-    e = fdb_lookup(t->fe->fdb, key);
-    if ( NULL == e ) {
-        /* No entry found, then flooding */
-        for ( i = 0; i < (ssize_t)t->fe->nports; i++ ) {
-            if ( port != i ) {
-                fe_driver_tx_enqueue(t, &t->tx.rings[i], i, pkt, hdr, len);
+    prog = t->filter.prog;
+    if ( NULL == prog ) {
+        return;
+    }
+    t->filter.ctx.port = v->port;
+    for ( i = 0; i < v->n; i++ ) {
+        r = fe_filter_exec(prog, &t->filter.ctx, v->pkts[i], v->lens[i]);
+        if ( FE_FILTER_DROP == r ) {
+            v->out[i] = FE_PIPELINE_DROP;
+            t->stats->filter.drops++;
+        } else if ( FE_FILTER_IS_FWD(r) ) {
+            port = r & ~FE_FILTER_FWD_MASK;
+            if ( port < (int)t->fe->nports ) {
+                v->out[i] = port;
+                t->stats->filter.redirects++;
+            } else {
+                v->out[i] = FE_PIPELINE_DROP;
+                t->stats->filter.drops++;
             }
-            fe_driver_tx_commit(&t->tx.rings[i]);
-            fe_collect_buffer(t, &t->tx.rings[i]);
-        }
-    } else {
-        /* Unicast */
-        if ( e->port == port ) {
-            /* Discard */
-            fe_release_buffer(t, hdr);
         } else {
-            fe_driver_tx_enqueue(t, &t->tx.rings[e->port], e->port, pkt, hdr,
-                                 len);
-            fe_driver_tx_commit(&t->tx.rings[e->port]);
-            fe_collect_buffer(t, &t->tx.rings[e->port]);
+            t->stats->filter.pass++;
         }
     }
-
-    /* Check the source address to update FDB */
-    if ( !ETHER_IS_MULTICAST(eth->ether_shost) ) {
-        /* Unicast, then update the corresonding fdb entry */
-        mac = 0;
-        memcpy(&mac, eth->ether_shost, 6);
-        fe_kernel_cmd_enqueue(t->ktx, mac, port);
-    }
-
-    return 0;
 }
 
 /*
- * Forwarding (Slow-path)
+ * Pipeline stage: translate the packets received on the inside ports to the
+ * external addresses, and the packets to the external addresses received on
+ * the outside ports back.  The packets not translated are dropped.
  */
-static int
-fe_spp_forwarding(struct fe_task *t, struct fe_driver_rx *rx,
-                  struct fe_pkt_buf_hdr *hdr, void *pkt, int len)
+static __inline__ void
+fe_stage_nat(struct fe_task *t, struct fe_pipeline_vec *v)
 {
-    struct fe_pkt_buf_hdr *myhdr;
-    void *mypkt;
+    struct fe_nat_shard *s;
+    uint32_t nconns;
+    uint32_t now;
+    int inside;
+    int ret;
+    int i;
 
-    myhdr = fe_get_buffer(t);
-    if ( NULL == myhdr ) {
-        /* No buffer available */
-        printf("Buffer empty\n");
-        return -1;
+    inside = (t->nat.inside >> v->port) & 1;
+    if ( !inside && !((t->nat.outside >> v->port) & 1) ) {
+        return;
+    }
+    s = t->nat.shard;
+    nconns = s->nconns;
+    now = fdb_rdtsc() / t->fe->tsc_hz;
+    for ( i = 0; i < v->n; i++ ) {
+        if ( FE_PIPELINE_DROP == v->out[i] ) {
+            /* Discarded by a former stage */
+            continue;
+        }
+        if ( fe_offload_rx_bad(&v->hdrs[i]->ol) ) {
+            /* Checksum error found by the NIC; no connection for it */
+            t->stats->nat.bad_csum++;
+            v->out[i] = FE_PIPELINE_DROP;
+            continue;
+        }
+        if ( inside ) {
+            ret = fe_nat_outbound(s, v->pkts[i], v->lens[i], now);
+        } else {
+            ret = fe_nat_inbound(s, v->pkts[i], v->lens[i], now);
+        }
+        switch ( ret ) {
+        case FE_NAT_PASS:
+            continue;
+        case FE_NAT_XLATE:
+            if ( inside ) {
+                t->stats->nat.out_pkts++;
+            } else {
+                t->stats->nat.in_pkts++;
+            }
+            continue;
+        case FE_NAT_MISS:
+            t->stats->nat.misses++;
+            break;
+        case FE_NAT_UNSUPPORTED:
+            t->stats->nat.unsupported++;
+            break;
+        case FE_NAT_NOPORT:
+            t->stats->nat.no_ports++;
+            break;
+        default:
+            t->stats->nat.full++;
+        }
+        v->out[i] = FE_PIPELINE_DROP;
+    }
+    if ( s->nconns != nconns ) {
+        t->stats->nat.created += s->nconns - nconns;
+        t->stats->nat.conns = s->nconns;
     }
-    /* Copy */
-    memcpy(myhdr, hdr, FE_PKTSZ);
-    mypkt = pkt - (void *)hdr + (void *)myhdr;
-    /* Release */
-    hdr->refs--;
-    rx->u.kernel->head = rx->u.kernel->head + 1 < rx->u.kernel->len
-        ? rx->u.kernel->head + 1 : 0;
-
-    fe_driver_tx_enqueue(t, &t->tx.rings[myhdr->port], myhdr->port, mypkt, hdr,
-                         len);
-    fe_driver_tx_commit(&t->tx.rings[myhdr->port]);
-    fe_collect_buffer(t, &t->tx.rings[myhdr->port]);
-
-    return 0;
 }
 
-
-
-
-
 /*
- * Fast-path process
+ * Pipeline stage: send learning requests for the unknown or moved source
+ * addresses to the tickful task.  The addresses are learned on the logical
+ * port so that the members of a group share the entries.
  */
-void *
-fe_fpp_task(void *args)
+static __inline__ void
+fe_stage_learn(struct fe_task *t, struct fe_pipeline_vec *v)
 {
-    struct fe_task *t;
-    int ret;
-    struct fe_pkt_buf_hdr *hdr;
-    void *pkt;
-    int n;
+    struct ether_header *eth;
+    uint8_t key[FDB_KEY_SIZE];
+    uint64_t mac;
     int i;
 
-    /* Get the task data structure from the argument */
-    t = (struct fe_task *)args;
-
-    /* Count the number of ports managed by this task */
-    n = popcnt(t->rx.bitmap);
-
-    printf("Launch an exclusive task for fast-path processing at CPU %d, "
-           "managing %d ports.\n", t->cpuid, n);
-
-    /* Idle if no handling queues */
-    if ( n <= 0 ) {
-        for ( ;; ) {
-            __asm__ __volatile__ ("syscall" :: "a"(SYS_xpsleep));
+    for ( i = 0; i < v->n; i++ ) {
+        if ( FE_PIPELINE_DROP == v->out[i] ) {
+            /* Discarded by a former stage */
+            continue;
+        }
+        eth = (struct ether_header *)v->pkts[i];
+        if ( ETHER_IS_MULTICAST(eth->ether_shost) ) {
+            continue;
+        }
+        memcpy(key, eth->ether_shost, 6);
+        memset(key + 6, 0, 2);
+        if ( fdb_learn_required(t->fe->fdb, key, v->lport) ) {
+            mac = 0;
+            memcpy(&mac, eth->ether_shost, 6);
+            if ( fe_kernel_cmd_enqueue(t->ktx, FE_KERNEL_CMD_LEARN, mac,
+                                       v->lport) > 0 ) {
+                t->stats->fdb.learns++;
+            } else {
+                t->stats->fdb.learn_drops++;
+            }
         }
-        return NULL;
     }
+}
 
-    for ( ;; ) {
-        for ( i = 0; i < n; i++ ) {
-            ret = fe_driver_rx_dequeue(&t->rx.rings[i], &hdr, &pkt);
-            if ( ret <= 0 ) {
-                continue;
-            }
-            fe_driver_rx_refill(t, &t->rx.rings[i]);
-            fe_fpp_forwarding(t, t->rx.rings[i].port, hdr, pkt, ret);
+/*
+ * Pass the IGMP messages of a packet to the tickful task.  Returns the # of
+ * messages.
+ */
+static __inline__ int
+fe_mcast_snoop(struct fe_task *t, int port, const uint8_t *pkt, int len)
+{
+    uint64_t cmds[FE_MCAST_MAX_CMDS];
+    int n;
+    int i;
 
-            fe_driver_rx_commit(&t->rx.rings[i]);
+    n = fe_igmp_parse(pkt, len, cmds);
+    for ( i = 0; i < n; i++ ) {
+        switch ( FE_MCAST_CMD_TYPE(cmds[i]) ) {
+        case FE_MCAST_JOIN:
+            t->stats->storm.joins++;
+            break;
+        case FE_MCAST_LEAVE:
+            t->stats->storm.leaves++;
+            break;
+        default:
+            t->stats->storm.queries++;
         }
-        for ( i = 0; i < (ssize_t)t->fe->nports; i++ ) {
-            fe_collect_buffer(t, &t->tx.rings[i]);
+        if ( fe_kernel_cmd_enqueue(t->ktx, FE_KERNEL_CMD_MCAST, cmds[i], port)
+             <= 0 ) {
+            t->stats->storm.igmp_drops++;
         }
     }
+
+    return n;
 }
 
 /*
- * Slow-path process
+ * Pipeline stage: lookup the destination address in FDB.  Unknown addresses
+ * are flooded, and the packets destined to the ingress port are discarded.
+ * With IGMP snooping, IPv4 multicast is sent to the ports of the group if
+ * joined; IGMP messages, link-local and unregistered groups are flooded.
  */
-int
-fe_process(struct fe *fe)
+static __inline__ void
+fe_stage_l2(struct fe_task *t, struct fe_pipeline_vec *v)
 {
+    const struct fe_mcast_table *mcast;
+    struct ether_header *eth;
+    uint8_t key[FDB_KEY_SIZE];
+    struct fdb_entry *e;
+    int slot;
     int i;
-    int ret;
-    struct fe_pkt_buf_hdr *hdr;
-    void *pkt;
-    uint64_t tsc;
-    uint64_t last_tsc;
 
-    last_tsc = 0;
-    for ( ;; ) {
-        /* For all exclusive processors */
-        for ( i = 0; i < fe->nxcpu; i++ ) {
-            ret = fe_driver_rx_dequeue(&fe->tftask->rx.rings[i], &hdr, &pkt);
-            if ( ret < 0 ) {
+    mcast = t->mcast.tbl;
+    for ( i = 0; i < v->n; i++ ) {
+        if ( FE_PIPELINE_FLOOD != v->out[i] ) {
+            /* Already decided by a former stage */
+            continue;
+        }
+        eth = (struct ether_header *)v->pkts[i];
+        if ( NULL != mcast && fe_mcast_is_ipv4(eth->ether_dhost) ) {
+            if ( fe_mcast_snoop(t, v->port, v->pkts[i], v->lens[i]) > 0
+                 || fe_mcast_is_local(eth->ether_dhost) ) {
                 continue;
             }
-            if ( 0 == ret ) {
-                /* Command (non-packet) */
-                fdb_update(fe->fdb, (uint8_t *)&pkt, (int)(uint64_t)hdr);
-                fe->tftask->rx.rings[i].u.kernel->head
-                    = fe->tftask->rx.rings[i].u.kernel->head + 1
-                    < fe->tftask->rx.rings[i].u.kernel->len
-                    ? fe->tftask->rx.rings[i].u.kernel->head + 1 : 0;
-            } else {
-                fe_driver_rx_refill(fe->tftask, &fe->tftask->rx.rings[i]);
-                fe_spp_forwarding(fe->tftask, &fe->tftask->rx.rings[i], hdr,
-                                  pkt, ret);
-                fe_driver_rx_commit(&fe->tftask->rx.rings[i]);
+            slot = fe_mcast_lookup(mcast, eth->ether_dhost);
+            if ( slot >= 0 ) {
+                v->out[i] = FE_PIPELINE_MCAST(slot);
             }
+            continue;
         }
-
-        /* Garbage collection */
-        tsc = fdb_rdtsc();
-        if ( tsc - last_tsc > 10000000000ULL ) {
-            fdb_gc(fe->fdb);
-            /* Print out FDB */
-#if 0
-            fdb_debug(fe->fdb);
-#endif
-            last_tsc = tsc;
+        memcpy(key, eth->ether_dhost, 6);
+        memset(key + 6, 0, 2);
+        e = fdb_lookup(t->fe->fdb, key);
+        if ( NULL != e ) {
+            v->out[i] = e->port == v->lport ? FE_PIPELINE_DROP : e->port;
         }
     }
-
-    return 0;
 }
 
 /*
- * Create a job at the specified exclusive processor
+ * Enqueue a packet to the QoS scheduler of a port.  The scheduler holds a
+ * reference to the buffer until the packet is moved to the Tx ring.
  */
-void
-syspix_create_job(int cpuid, void *args)
+static __inline__ int
+fe_qos_enqueue_pkt(struct fe_task *t, int port, struct fe_pkt_buf_hdr *hdr,
+                   void *pkt, int len, int cls, uint32_t hash, uint64_t now)
 {
-    syscall(SYS_pix_create_job, cpuid, fe_fpp_task, args);
+    if ( fe_qos_enqueue(&t->qos.scheds[port], cls, hash, hdr, pkt, len, now)
+         < 0 ) {
+        /* Queue full */
+        t->stats->qos.drops[cls]++;
+        t->stats->ports[port].tx_drops++;
+        return 0;
+    }
+    hdr->refs++;
+    t->qos.backlog++;
+
+    return 1;
 }
 
 /*
- * Initialize device
+ * Move the packets selected by the QoS scheduler of a port to the Tx ring
+ * while the shapers allow and the ring has room.  The packets left are
+ * retried on the next call.
  */
-static struct fe_device *
-_init_device(struct pci_dev_conf *conf)
+static int
+fe_qos_tx(struct fe_task *t, int port)
 {
-    struct fe_device dev;
-    struct fe_device *devp;
-
-    /* Check the driver type and initialize the hardware */
-    dev.driver = FE_DRIVER_INVALID;
-    if ( e1000_is_e1000(conf->vendor_id, conf->device_id) ) {
-        /* e1000 */
-        dev.driver = FE_DRIVER_E1000;
-        dev.u.e1000
-            = e1000_init(conf->device_id, conf->bus, conf->slot, conf->func);
-        dev.u.e1000->pirq = (((conf->intr_pin -1) + conf->slot) % 4) + 0x10;
-        e1000_init_hw(dev.u.e1000);
-        e1000_setup_rx(dev.u.e1000);
-        e1000_setup_tx(dev.u.e1000);
-        dev.domain = 0;
-        dev.rxq_last = -1;
-        dev.txq_last = -1;
-        dev.fastpath = 0;
-    } else if ( igb_is_igb(conf->vendor_id, conf->device_id) ) {
-        /* igb */
-        dev.driver = FE_DRIVER_IGB;
-        dev.u.igb
-            = igb_init(conf->device_id, conf->bus, conf->slot, conf->func);
-        igb_init_hw(dev.u.igb);
-        igb_setup_rx(dev.u.igb);
-        igb_setup_tx(dev.u.igb);
-        igb_enable_rx(dev.u.igb);
-        igb_enable_tx(dev.u.igb);
-        dev.domain = 0;
-        dev.rxq_last = -1;
-        dev.txq_last = -1;
-        dev.fastpath = 0;
-    } else if ( ixgbe_is_ixgbe(conf->vendor_id, conf->device_id) ) {
-        /* ixgbe */
-        dev.driver = FE_DRIVER_IXGBE;
-        dev.u.ixgbe
-            = ixgbe_init(conf->device_id, conf->bus, conf->slot, conf->func);
-        ixgbe_init_hw(dev.u.ixgbe);
-        ixgbe_setup_rx(dev.u.ixgbe);
-        ixgbe_setup_tx(dev.u.ixgbe);
-        ixgbe_enable_rx(dev.u.ixgbe);
-        ixgbe_enable_tx(dev.u.ixgbe);
-        dev.domain = 0;
-        dev.rxq_last = -1;
-        dev.txq_last = -1;
-        dev.fastpath = 0;
-    }
+    struct fe_qos_sched *s;
+    struct fe_qos_pkt *p;
+    struct pix_fe_qos_stats *st;
+    uint64_t now;
+    uint64_t delay;
+    int cls;
+    int n;
 
-    if ( FE_DRIVER_INVALID != dev.driver ) {
-        devp = malloc(sizeof(struct fe_device));
-        if ( NULL == devp ) {
-            return NULL;
+    s = &t->qos.scheds[port];
+    st = &t->stats->qos;
+    now = fdb_rdtsc();
+    fe_qos_refill(s, now);
+    for ( n = 0; n < FE_QOS_TX_BATCH; n++ ) {
+        p = fe_qos_peek(s, &cls);
+        if ( NULL == p ) {
+            break;
         }
-        memcpy(devp, &dev, sizeof(struct fe_device));
-        return devp;
+        if ( fe_driver_tx_try(t, &t->tx.rings[port], port, p->pkt, p->hdr,
+                              p->len) <= 0 ) {
+            break;
+        }
+        /* Hand over the reference to the ring */
+        p->hdr->refs--;
+        delay = now - p->tsc;
+        st->tx_pkts[cls]++;
+        st->tx_bytes[cls] += p->len;
+        if ( delay > st->delay_max[cls] ) {
+            st->delay_max[cls] = delay;
+        }
+        st->hist[cls][fe_pktgen_hist_bin(delay, PIX_FE_QOS_HIST)]++;
+        fe_qos_commit(s, cls);
+        t->qos.backlog--;
     }
 
-    return NULL;
+    return n;
 }
 
 /*
- * Initialize network devices
+ * Drain the QoS schedulers of all the ports
  */
-int
-fe_init_devices(struct fe *fe, struct pci_dev *pci)
+static void
+fe_qos_drain(struct fe_task *t)
 {
-    struct fe_device *dev;
+    int i;
 
-    fe->nports = 0;
-    while ( NULL != pci ) {
-        dev = _init_device(pci->device);
-        if ( NULL != dev ) {
-            /* Device found */
-            dev->port = fe->nports;
-            fe->ports[fe->nports] = dev;
-            fe->nports++;
+    for ( i = 0; i < (int)t->fe->nports; i++ ) {
+        if ( t->qos.scheds[i].backlog > 0 && fe_qos_tx(t, i) > 0 ) {
+            fe_driver_tx_commit(&t->tx.rings[i]);
         }
-        pci = pci->next;
     }
-
-    return 0;
 }
 
 /*
- * Initialize processors
+ * Flow hash of a packet for the link aggregation and the tunnel entropy.  The
+ * RSS hash of the NIC, computed on the addresses and the TCP/UDP ports, is
+ * taken for the L4 hash when present.
  */
-int
-fe_init_cpu(struct fe *fe)
+static __inline__ uint32_t
+fe_flow_hash(struct fe_pkt_buf_hdr *hdr, const uint8_t *pkt, int len, int mode)
 {
-    struct syspix_cpu_table cputable;
-    int n;
-    int nex;
-    ssize_t i;
-    struct fe_task *t;
-    struct fe_task **tp;
-
-    /* Load the CPU table through system call */
-    n = pix_ldcpuconf(&cputable);
-    if ( n < 0 ) {
-        return -1;
+    if ( FE_LAG_HASH_L4 == mode && (hdr->ol.flags & FE_OFFLOAD_RX_HASH) ) {
+        return hdr->ol.hash;
     }
-    /* # of available CPUs */
-    fe->ncpus = n;
 
-    /* Tickful task */
-    t = malloc(sizeof(struct fe_task));
-    if ( NULL == t ) {
-        return -1;
+    return fe_lag_hash(pkt, len, mode);
+}
+
+/*
+ * Send a packet of a vector to a port, through the QoS scheduler if enabled
+ * on the port.  The packet is classified once for all the ports.
+ */
+static __inline__ int
+fe_stage_tx_port(struct fe_task *t, struct fe_pipeline_vec *v, int i,
+                 int port, int *cls, uint32_t *hash, uint64_t now)
+{
+    if ( t->qos.ports & (1ULL << port) ) {
+        if ( *cls < 0 ) {
+            *cls = fe_qos_classify(&t->qos.map, v->pkts[i], v->lens[i], hash);
+        }
+        return fe_qos_enqueue_pkt(t, port, v->hdrs[i], v->pkts[i], v->lens[i],
+                                  *cls, *hash, now);
     }
-    t->fe = fe;
+
+    return fe_driver_tx_enqueue(t, &t->tx.rings[port], port, v->pkts[i],
+                                v->hdrs[i], v->lens[i]);
+}
+
+/*
+ * Storm control: check if a packet to be flooded or replicated conforms to
+ * the rate of its class on the ingress port
+ */
+static __inline__ int
+fe_storm_admit(struct fe_task *t, int port, const uint8_t *pkt, int len,
+               uint64_t *now)
+{
+    struct fe_qos_tb *tb;
+    int cls;
+
+    if ( !(pkt[0] & 1) ) {
+        cls = PIX_FE_STORM_UNKNOWN;
+    } else if ( 0xff == pkt[0] && 0xff == pkt[1] && 0xff == pkt[2]
+                && 0xff == pkt[3] && 0xff == pkt[4] && 0xff == pkt[5] ) {
+        cls = PIX_FE_STORM_BCAST;
+    } else {
+        cls = PIX_FE_STORM_MCAST;
+    }
+    tb = &t->storm.tbs[port * PIX_FE_STORM_NCLASSES + cls];
+    if ( 0 == *now ) {
+        *now = fdb_rdtsc();
+    }
+    fe_qos_tb_refill(tb, *now);
+    if ( !fe_qos_tb_conform(tb, len) ) {
+        t->stats->storm.drops[cls]++;
+        return 0;
+    }
+    fe_qos_tb_consume(tb, len);
+
+    return 1;
+}
+
+/*
+ * Pipeline stage: enqueue the packets to the Tx rings (or the QoS schedulers)
+ * of the egress ports, and write the tail pointer of each ring once per
+ * vector.  A packet to a link aggregation group is sent to the member selected
+ * by its flow hash; a flooded packet is sent once to each group other than
+ * the ingress one.  Flooded and multicast packets are rate-limited per
+ * ingress port by storm control before they are replicated.
+ */
+static __inline__ void
+fe_stage_tx(struct fe_task *t, struct fe_pipeline_vec *v)
+{
+    const struct fe_lag_table *lag;
+    struct fe_pkt_buf_hdr *hdr;
+    uint64_t ports;
+    uint64_t mask;
+    uint64_t now;
+    uint32_t hash;
+    uint32_t lhash;
+    ssize_t j;
+    int hashed;
+    int sent;
+    int out;
+    int cls;
+    int lp;
+    int i;
+
+    lag = t->lag.tbl;
+    ports = 0;
+    now = t->qos.ports ? fdb_rdtsc() : 0;
+    hash = 0;
+    for ( i = 0; i < v->n; i++ ) {
+        hdr = v->hdrs[i];
+        out = v->out[i];
+        sent = 0;
+        cls = -1;
+        lhash = 0;
+        hashed = 0;
+        if ( FE_LAG_IS_PORT(out) ) {
+            lhash = fe_flow_hash(hdr, v->pkts[i], v->lens[i], lag->hash);
+            hashed = 1;
+            out = fe_lag_select(lag, out, lhash);
+            if ( out < 0 ) {
+                /* No member distributing */
+                out = FE_PIPELINE_DROP;
+                t->stats->lag.drops++;
+            }
+        }
+        if ( (FE_PIPELINE_FLOOD == out || FE_PIPELINE_IS_MCAST(out))
+             && (t->storm.ports & (1ULL << v->port))
+             && !fe_storm_admit(t, v->port, v->pkts[i], v->lens[i], &now) ) {
+            out = FE_PIPELINE_DROP;
+        }
+        if ( FE_PIPELINE_FLOOD == out || FE_PIPELINE_IS_MCAST(out) ) {
+            if ( FE_PIPELINE_FLOOD == out ) {
+                mask = ~0ULL;
+            } else {
+                /* Members of the group and the multicast routers */
+                mask = t->mcast.tbl->ports[FE_PIPELINE_MCAST_SLOT(out)]
+                    | t->mcast.tbl->mrouters;
+                t->stats->storm.mcast_pkts++;
+            }
+            for ( j = 0; j < (ssize_t)t->fe->nports; j++ ) {
+                if ( !(mask & (1ULL << j)) ) {
+                    continue;
+                }
+                lp = lag->lports[j];
+                if ( lp == v->lport ) {
+                    /* Ingress port or a member of the ingress group */
+                    continue;
+                }
+                if ( lp != j ) {
+                    /* Only the member selected in the group */
+                    if ( !hashed ) {
+                        lhash = fe_flow_hash(hdr, v->pkts[i], v->lens[i],
+                                             lag->hash);
+                        hashed = 1;
+                    }
+                    if ( fe_lag_select(lag, lp, lhash) != j ) {
+                        continue;
+                    }
+                }
+                if ( fe_stage_tx_port(t, v, i, j, &cls, &hash, now) > 0 ) {
+                    sent++;
+                }
+            }
+            ports |= mask;
+        } else if ( out >= 0 ) {
+            if ( fe_stage_tx_port(t, v, i, out, &cls, &hash, now) > 0 ) {
+                sent++;
+            }
+            ports |= 1ULL << out;
+        }
+        if ( 0 == sent && hdr->refs <= 0 ) {
+            /* Not enqueued to any port nor captured */
+            fe_release_buffer(t, hdr);
+        }
+    }
+
+    for ( j = 0; j < (ssize_t)t->fe->nports; j++ ) {
+        if ( ports & (1ULL << j) ) {
+            if ( t->qos.scheds[j].backlog > 0 ) {
+                fe_qos_tx(t, j);
+            }
+            fe_driver_tx_commit(&t->tx.rings[j]);
+            fe_collect_buffer(t, &t->tx.rings[j]);
+        }
+    }
+}
+
+/*
+ * Decapsulate the packets received on the uplink, and send learning requests
+ * for the remote VTEPs of the unknown or moved inner source addresses.  ARP
+ * requests for the local VTEP are answered from the ingress port.
+ */
+static __inline__ void
+fe_tunnel_rx(struct fe_task *t, struct fe_pipeline_vec *v)
+{
+    const struct fe_tunnel *tun;
+    uint8_t key[FDB_KEY_SIZE];
+    uint64_t val;
+    uint8_t *pkt;
+    int vtep;
+    int len;
+    int k;
+    int i;
+
+    tun = t->tunnel.tun;
+    for ( i = 0; i < v->n; i++ ) {
+        if ( FE_PIPELINE_DROP == v->out[i] ) {
+            /* Discarded by a former stage */
+            continue;
+        }
+        pkt = v->pkts[i];
+        len = v->lens[i];
+        switch ( fe_tunnel_decap(tun, &pkt, &len, &k, &vtep) ) {
+        case FE_TUNNEL_PASS:
+            continue;
+        case FE_TUNNEL_ARP:
+            v->out[i] = v->port;
+            t->stats->tunnel.arps++;
+            continue;
+        case FE_TUNNEL_DECAP:
+            break;
+        default:
+            v->out[i] = FE_PIPELINE_DROP;
+            t->stats->tunnel.bad++;
+            continue;
+        }
+        v->pkts[i] = pkt;
+        v->lens[i] = len;
+        v->out[i] = tun->vnis[k].port;
+        /* The Rx metadata was of the outer frame */
+        v->hdrs[i]->ol.flags = 0;
+        t->stats->tunnel.decap_pkts++;
+        if ( pkt[6] & 1 ) {
+            continue;
+        }
+        fe_tunnel_fdb_key(key, pkt + 6, k);
+        if ( fdb_learn_required(t->fe->tunnel.fdb, key, vtep) ) {
+            memcpy(&val, key, sizeof(val));
+            if ( fe_kernel_cmd_enqueue(t->ktx, FE_KERNEL_CMD_VTEP, val, vtep)
+                 > 0 ) {
+                t->stats->tunnel.learns++;
+            } else {
+                t->stats->tunnel.learn_drops++;
+            }
+        }
+    }
+}
+
+/*
+ * Encapsulate a copy of a frame to a remote VTEP.  The copies are sent by
+ * the Tx stage after the vector.
+ */
+static __inline__ void
+fe_tunnel_replicate(struct fe_task *t, const uint8_t *pkt, int len, int k,
+                    int vtep, uint32_t hash)
+{
+    struct fe_pipeline_vec *r;
+    struct fe_pkt_buf_hdr *hdr;
+    uint8_t *p;
+
+    r = &t->tunnel.reps;
+    if ( r->n >= FE_PIPELINE_VECSZ ) {
+        fe_stage_tx(t, r);
+        r->n = 0;
+    }
+    hdr = fe_get_buffer(t);
+    if ( NULL == hdr ) {
+        t->stats->drops.no_buffer++;
+        return;
+    }
+    p = (uint8_t *)hdr + FE_PKT_HDROFF;
+    memcpy(p, pkt, len);
+    fe_tunnel_encap(t->tunnel.tun, k, vtep, &p, &len, hash);
+    fe_pipeline_vec_add(r, hdr, p, len);
+    r->out[r->n - 1] = t->tunnel.tun->uplink;
+    t->stats->tunnel.replicas++;
+}
+
+/*
+ * Encapsulate the frames received on an access port to the remote VTEP of
+ * the destination address.  Unknown, broadcast, and multicast destinations
+ * are replicated to all the remote VTEPs of the VNI (head-end replication)
+ * after storm control; the last VTEP takes the original buffer.
+ */
+static __inline__ void
+fe_tunnel_tx(struct fe_task *t, struct fe_pipeline_vec *v)
+{
+    const struct fe_tunnel *tun;
+    uint8_t key[FDB_KEY_SIZE];
+    struct fdb_entry *e;
+    uint64_t vteps;
+    uint64_t now;
+    uint32_t hash;
+    uint8_t *pkt;
+    int vtep;
+    int len;
+    int k;
+    int i;
+
+    tun = t->tunnel.tun;
+    t->tunnel.reps.port = v->port;
+    t->tunnel.reps.lport = v->lport;
+    now = 0;
+    for ( i = 0; i < v->n; i++ ) {
+        if ( FE_PIPELINE_FLOOD != v->out[i] ) {
+            /* Already decided by a former stage */
+            continue;
+        }
+        pkt = v->pkts[i];
+        len = v->lens[i];
+        k = fe_tunnel_access(tun, v->lport, &pkt, &len);
+        if ( k < 0 ) {
+            /* Not bridged to a VNI */
+            continue;
+        }
+        v->pkts[i] = pkt;
+        v->lens[i] = len;
+        vteps = 0;
+        if ( !(pkt[0] & 1) ) {
+            fe_tunnel_fdb_key(key, pkt, k);
+            e = fdb_lookup(t->fe->tunnel.fdb, key);
+            if ( NULL != e && ((tun->vnis[k].vteps >> e->port) & 1) ) {
+                vteps = 1ULL << e->port;
+            }
+        }
+        if ( 0 == vteps ) {
+            vteps = tun->vnis[k].vteps;
+            if ( 0 == vteps ) {
+                t->stats->tunnel.no_vteps++;
+            } else if ( (t->storm.ports & (1ULL << v->port))
+                        && !fe_storm_admit(t, v->port, pkt, len, &now) ) {
+                vteps = 0;
+            }
+        }
+        if ( 0 == vteps ) {
+            v->out[i] = FE_PIPELINE_DROP;
+            continue;
+        }
+        hash = fe_flow_hash(v->hdrs[i], pkt, len, FE_LAG_HASH_L4);
+        while ( vteps & (vteps - 1) ) {
+            vtep = __builtin_ctzll(vteps);
+            vteps &= vteps - 1;
+            fe_tunnel_replicate(t, pkt, len, k, vtep, hash);
+        }
+        fe_tunnel_encap(tun, k, __builtin_ctzll(vteps), &pkt, &len, hash);
+        v->pkts[i] = pkt;
+        v->lens[i] = len;
+        v->out[i] = tun->uplink;
+        t->stats->tunnel.encap_pkts++;
+    }
+}
+
+/*
+ * Pipeline stage: terminate the tunnels on the uplink, and encapsulate the
+ * frames of the access ports bridged to a VNI.  The other packets are passed
+ * to the lookup stage.
+ */
+static __inline__ void
+fe_stage_tunnel(struct fe_task *t, struct fe_pipeline_vec *v)
+{
+    if ( FE_TUNNEL_NONE == t->tunnel.tun->type ) {
+        return;
+    }
+    if ( v->lport == t->tunnel.tun->uplink ) {
+        fe_tunnel_rx(t, v);
+    } else {
+        fe_tunnel_tx(t, v);
+    }
+}
+
+/*
+ * Run the stages of a chain over a vector.  Called with a constant set of
+ * stages so that each chain is compiled into straight-line code.
+ */
+static __inline__ void __attribute__ ((always_inline))
+fe_pipeline_run(struct fe_task *t, struct fe_pipeline_vec *v, const int stages)
+{
+    if ( stages & FE_STAGE_FILTER ) {
+        fe_stage_filter(t, v);
+    }
+    if ( stages & FE_STAGE_NAT ) {
+        fe_stage_nat(t, v);
+    }
+    if ( stages & FE_STAGE_LEARN ) {
+        fe_stage_learn(t, v);
+    }
+    if ( stages & FE_STAGE_TUNNEL ) {
+        fe_stage_tunnel(t, v);
+    }
+    if ( stages & FE_STAGE_L2 ) {
+        fe_stage_l2(t, v);
+    }
+    fe_stage_tx(t, v);
+    if ( (stages & FE_STAGE_TUNNEL) && t->tunnel.reps.n > 0 ) {
+        /* Replicas to the remote VTEPs */
+        fe_stage_tx(t, &t->tunnel.reps);
+        t->tunnel.reps.n = 0;
+    }
+}
+
+/*
+ * Forwarding (Fast-path): process a vector with the chain of its ingress port
+ */
+static void
+fe_fpp_forwarding(struct fe_task *t, struct fe_pipeline_vec *v)
+{
+    switch ( t->pipeline.chains[v->port] ) {
+#define FE_PIPELINE_CHAIN(id, stages)           \
+    case id:                                    \
+        fe_pipeline_run(t, v, stages);          \
+        break;
+    FE_PIPELINE_CHAINS
+#undef FE_PIPELINE_CHAIN
+    default:
+        fe_pipeline_run(t, v, FE_STAGE_LEARN | FE_STAGE_L2);
+    }
+}
+
+/*
+ * Reload the pipeline configuration updated through the shared memory.  The
+ * chains are swapped between two vectors, so that a vector is never processed
+ * by two different chains.
+ */
+static void
+fe_pipeline_reload(struct fe_task *t)
+{
+    struct pix_fe_pipeline_conf *conf;
+    int bank;
+    int chain;
+    int i;
+
+    conf = t->fe->pipeline;
+    t->pipeline.gen = conf->gen;
+    __sync_synchronize();
+
+    bank = conf->active & 1;
+    for ( i = 0; i < PIX_FE_STATS_MAX_PORTS; i++ ) {
+        chain = conf->chains[bank][i];
+        if ( chain >= 0 && chain < PIX_FE_NCHAINS ) {
+            t->pipeline.chains[i] = chain;
+        }
+    }
+}
+
+/*
+ * Switch to the packet filter program published by the tickful task.  The
+ * acknowledged generation tells the tickful task that the previous program is
+ * no longer used by this task.
+ */
+static void
+fe_filter_reload(struct fe_task *t)
+{
+    t->filter.ctx.fdb = t->fe->fdb;
+    t->filter.ctx.counters = t->stats->filter.counters;
+    t->filter.gen = t->fe->filter.gen;
+    __sync_synchronize();
+    t->filter.prog = t->fe->filter.prog;
+}
+
+/*
+ * Apply the QoS configuration updated through the shared memory.  The packets
+ * queued are kept, and drained even if the scheduler is disabled.
+ */
+static void
+fe_qos_reload(struct fe_task *t)
+{
+    struct pix_fe_qos_conf *conf;
+    struct fe_qos_sched *s;
+    struct fe_qos_class *c;
+    uint64_t now;
+    uint64_t hz;
+    int weight;
+    int i;
+    int j;
+
+    conf = t->fe->qos;
+    t->qos.gen = conf->gen;
+    __sync_synchronize();
+
+    hz = t->fe->tsc_hz;
+    now = fdb_rdtsc();
+    for ( i = 0; i < (int)t->fe->nports; i++ ) {
+        s = &t->qos.scheds[i];
+        fe_qos_tb_set(&s->tb, conf->rates[i], conf->burst, hz, now);
+        for ( j = 0; j < FE_QOS_NCLASSES; j++ ) {
+            c = &s->classes[j];
+            c->strict = conf->classes[j].strict;
+            weight = conf->classes[j].weight;
+            if ( weight < 1 ) {
+                weight = 1;
+            } else if ( weight > 64 ) {
+                weight = 64;
+            }
+            c->quantum = weight * FE_QOS_QUANTUM;
+            fe_qos_tb_set(&c->tb, conf->classes[j].rate,
+                          conf->classes[j].burst, hz, now);
+        }
+    }
+    for ( i = 0; i < 8; i++ ) {
+        t->qos.map.pcp[i] = conf->pcp[i] & (FE_QOS_NCLASSES - 1);
+    }
+    for ( i = 0; i < 64; i++ ) {
+        t->qos.map.dscp[i] = conf->dscp[i] & (FE_QOS_NCLASSES - 1);
+    }
+    t->qos.ports = conf->ports;
+}
+
+/*
+ * Switch to the link aggregation table published by the tickful task.  The
+ * acknowledged generation tells the tickful task that the previous table is
+ * no longer used by this task.
+ */
+static void
+fe_lag_reload(struct fe_task *t)
+{
+    t->lag.gen = t->fe->lag.gen;
+    __sync_synchronize();
+    t->lag.tbl = t->fe->lag.tbl;
+}
+
+/*
+ * Apply the storm control configuration updated through the shared memory
+ */
+static void
+fe_storm_reload(struct fe_task *t)
+{
+    struct pix_fe_storm_conf *conf;
+    uint64_t now;
+    int i;
+    int c;
+
+    conf = t->fe->storm;
+    t->storm.gen = conf->gen;
+    __sync_synchronize();
+
+    now = fdb_rdtsc();
+    for ( i = 0; i < (int)t->fe->nports; i++ ) {
+        for ( c = 0; c < PIX_FE_STORM_NCLASSES; c++ ) {
+            fe_qos_tb_set(&t->storm.tbs[i * PIX_FE_STORM_NCLASSES + c],
+                          conf->rates[i][c], conf->burst, t->fe->tsc_hz, now);
+        }
+    }
+    t->storm.ports = conf->ports;
+}
+
+/*
+ * Switch to the multicast replication table published by the tickful task
+ */
+static void
+fe_mcast_reload(struct fe_task *t)
+{
+    t->mcast.gen = t->fe->mcast.gen;
+    __sync_synchronize();
+    t->mcast.tbl = t->fe->mcast.tbl;
+}
+
+/*
+ * Apply the NAT44 configuration updated through the shared memory.  The
+ * connections are flushed if the external addresses, the blocks, or the
+ * outside ports are changed; the inbound packets are steered by the RSS of
+ * the first outside port spread over the exclusive tasks.
+ */
+static void
+fe_nat_reload(struct fe_task *t)
+{
+    struct pix_fe_nat_conf *conf;
+    struct fe_nat_shard *s;
+    struct fe_nat_params p;
+    uint8_t key[FE_NAT_RSS_KEY_SIZE];
+    uint64_t inside;
+    uint64_t outside;
+    int lutsz;
+    int nq;
+    int i;
+
+    conf = t->fe->nat;
+    t->nat.gen = conf->gen;
+    __sync_synchronize();
+
+    s = t->nat.shard;
+    p.addr = conf->addr;
+    p.naddrs = conf->naddrs;
+    p.block = conf->block;
+    p.blocks = conf->blocks;
+    for ( i = 0; i < FE_NAT_NTIMEOUTS; i++ ) {
+        p.timeouts[i] = conf->timeouts[i];
+    }
+    inside = conf->inside;
+    outside = conf->outside;
+    if ( !fe_nat_params_valid(&p) || 0 == inside || 0 == outside ) {
+        /* Disabled */
+        memcpy(&p, &s->params, sizeof(struct fe_nat_params));
+        p.naddrs = 0;
+        inside = 0;
+        outside = 0;
+    }
+
+    if ( outside != t->nat.outside || p.addr != s->params.addr
+         || p.naddrs != s->params.naddrs || p.block != s->params.block ) {
+        fe_nat_shard_reset(s, &p);
+        nq = 1;
+        lutsz = 0;
+        for ( i = 0; i < (int)t->fe->nports; i++ ) {
+            if ( (outside & (1ULL << i)) && t->fe->ports[i]->spread
+                 && fe_driver_rss_key(t->fe->ports[i], key, sizeof(key),
+                                      &lutsz) >= 0 ) {
+                nq = t->fe->nxcpu;
+                break;
+            }
+        }
+        fe_nat_steer_set(s, nq, t->nat.qid, lutsz, key);
+    } else {
+        s->params.blocks = p.blocks;
+        memcpy(s->params.timeouts, p.timeouts, sizeof(p.timeouts));
+    }
+    t->nat.inside = inside;
+    t->nat.outside = outside;
+    t->stats->nat.conns = s->nconns;
+}
+
+/*
+ * Expire the NAT44 connections
+ */
+static __inline__ void
+fe_nat_tick(struct fe_task *t)
+{
+    int n;
+
+    n = fe_nat_expire(t->nat.shard, fdb_rdtsc() / t->fe->tsc_hz,
+                      FE_NAT_EXPIRE_BUDGET);
+    if ( n > 0 ) {
+        t->stats->nat.expired += n;
+        t->stats->nat.conns = t->nat.shard->nconns;
+    }
+}
+
+/*
+ * Reload the tunnel endpoint configuration updated through the shared memory
+ */
+static void
+fe_tunnel_reload(struct fe_task *t)
+{
+    struct pix_fe_tunnel_conf *conf;
+    struct fe_tunnel *tun;
+    uint8_t mac[6];
+    uint8_t gw[6];
+    int i;
+
+    conf = t->fe->tunnel.conf;
+    t->tunnel.gen = conf->gen;
+    __sync_synchronize();
+
+    tun = t->tunnel.tun;
+    for ( i = 0; i < 6; i++ ) {
+        mac[i] = conf->mac[i];
+        gw[i] = conf->gw[i];
+    }
+    fe_tunnel_init(tun, conf->type, conf->uplink, conf->addr, mac,
+                   conf->dport);
+    for ( i = 0; i < conf->nvteps && i < FE_TUNNEL_MAX_VTEPS; i++ ) {
+        fe_tunnel_add_vtep(tun, conf->vteps[i], gw);
+    }
+    for ( i = 0; i < conf->nvnis && i < FE_TUNNEL_MAX_VNIS; i++ ) {
+        fe_tunnel_add_vni(tun, conf->vnis[i].vni, conf->vnis[i].port,
+                          conf->vnis[i].vlan, conf->vnis[i].vteps);
+    }
+}
+
+/*
+ * Pass a LACPDU to the tickful task.  The buffer is returned when the task
+ * collects it from the kernel ring.
+ */
+static __inline__ void
+fe_lag_punt(struct fe_task *t, int port, struct fe_pkt_buf_hdr *hdr,
+            void *pkt, int len)
+{
+    if ( fe_kernel_tx_enqueue(t->ktx, FE_KERNEL_PUNT | port, pkt, hdr, len)
+         > 0 ) {
+        hdr->refs++;
+        t->stats->lag.punts++;
+    } else {
+        t->stats->ports[port].rx_drops++;
+        if ( hdr->refs <= 0 ) {
+            fe_release_buffer(t, hdr);
+        }
+    }
+}
+
+/*
+ * Forwarding (Slow-path)
+ */
+static int
+fe_spp_forwarding(struct fe_task *t, struct fe_driver_rx *rx,
+                  struct fe_pkt_buf_hdr *hdr, void *pkt, int len)
+{
+    struct fe_pkt_buf_hdr *myhdr;
+    void *mypkt;
+
+    myhdr = fe_get_buffer(t);
+    if ( NULL == myhdr ) {
+        /* No buffer available */
+        t->stats->drops.no_buffer++;
+        t->stats->ports[hdr->port].rx_drops++;
+        return -1;
+    }
+    /* Copy */
+    memcpy(myhdr, hdr, FE_PKTSZ);
+    mypkt = pkt - (void *)hdr + (void *)myhdr;
+    myhdr->refs = 0;
+    /* Release */
+    hdr->refs--;
+    rx->u.kernel->head = rx->u.kernel->head + 1 < rx->u.kernel->len
+        ? rx->u.kernel->head + 1 : 0;
+
+    if ( fe_driver_tx_enqueue(t, &t->tx.rings[myhdr->port], myhdr->port, mypkt,
+                              myhdr, len) <= 0 ) {
+        fe_release_buffer(t, myhdr);
+    }
+    fe_driver_tx_commit(&t->tx.rings[myhdr->port]);
+    fe_collect_buffer(t, &t->tx.rings[myhdr->port]);
+
+    return 0;
+}
+
+/*
+ * Reload the capture configuration updated through the shared memory
+ */
+static void
+fe_capture_reload(struct fe_task *t)
+{
+    struct pix_fe_capture_conf *conf;
+
+    conf = t->fe->capture.conf;
+    t->capture.gen = conf->gen;
+    __sync_synchronize();
+
+    if ( conf->enabled && NULL != t->capture.ring ) {
+        /* Keep the EtherType in network byte order */
+        t->capture.ethertype = htons(conf->ethertype);
+        t->capture.snaplen = conf->snaplen;
+        t->capture.sampling = conf->sampling;
+        t->capture.count = 0;
+        t->capture.ports = conf->ports;
+    } else {
+        t->capture.ports = 0;
+    }
+}
+
+/*
+ * Capture a packet received at the fast path (without copying it)
+ */
+static __inline__ void
+fe_capture_packet(struct fe_task *t, int port, struct fe_pkt_buf_hdr *hdr,
+                  void *pkt, int len)
+{
+    struct ether_header *eth;
+    uint64_t tsc;
+    int caplen;
+
+    tsc = fdb_rdtsc();
+
+    /* Filter */
+    eth = (struct ether_header *)pkt;
+    if ( 0 != t->capture.ethertype
+         && eth->ether_type != t->capture.ethertype ) {
+        return;
+    }
+
+    /* Sampling */
+    t->capture.count++;
+    if ( t->capture.count < t->capture.sampling ) {
+        return;
+    }
+    t->capture.count = 0;
+
+    caplen = len < t->capture.snaplen ? len : t->capture.snaplen;
+    if ( fe_capture_enqueue(t->capture.ring, hdr, pkt, caplen, len, port, tsc)
+         > 0 ) {
+        /* The consumer holds a reference until it writes the packet out */
+        hdr->refs++;
+        t->stats->capture.pkts++;
+    } else {
+        /* Capture ring is full */
+        t->stats->capture.drops++;
+    }
+
+    t->stats->capture.cycles += fdb_rdtsc() - tsc;
+}
+
+/*
+ * Reload the packet generator configuration updated through the shared memory
+ */
+static void
+fe_pktgen_reload(struct fe_task *t)
+{
+    struct pix_fe_pktgen_conf *conf;
+    struct fe_pktgen *pg;
+    ssize_t i;
+
+    conf = t->fe->pktgen;
+    pg = &t->pktgen;
+    pg->gen = conf->gen;
+    __sync_synchronize();
+
+    if ( !conf->enabled ) {
+        pg->txports = 0;
+        pg->rxports = 0;
+        return;
+    }
+
+    pg->size = conf->size;
+    if ( pg->size < FE_PKTGEN_MINLEN ) {
+        pg->size = FE_PKTGEN_MINLEN;
+    } else if ( pg->size > FE_PKTGEN_MAXLEN ) {
+        pg->size = FE_PKTGEN_MAXLEN;
+    }
+    if ( conf->rate > 0 ) {
+        pg->interval = t->fe->tsc_hz / conf->rate;
+    } else {
+        pg->interval = 0;
+    }
+    pg->smac = 0;
+    pg->dmac = 0;
+    for ( i = 0; i < ETHER_ADDR_LEN; i++ ) {
+        pg->smac = (pg->smac << 8) | conf->smac[i];
+        pg->dmac = (pg->dmac << 8) | conf->dmac[i];
+    }
+    pg->smac_range = conf->smac_range > 0 ? conf->smac_range : 1;
+    pg->dmac_range = conf->dmac_range > 0 ? conf->dmac_range : 1;
+    pg->sip = conf->sip;
+    pg->dip = conf->dip;
+    pg->sip_range = conf->sip_range > 0 ? conf->sip_range : 1;
+    pg->dip_range = conf->dip_range > 0 ? conf->dip_range : 1;
+    pg->seq = 0;
+    pg->next_port = 0;
+
+    /* Reset the counters of this task */
+    memset(&t->stats->pktgen, 0, sizeof(struct pix_fe_pktgen_stats));
+    t->stats->pktgen.latency_min = (uint64_t)-1;
+    pg->next_tsc = fdb_rdtsc();
+    t->stats->pktgen.start_tsc = pg->next_tsc;
+
+    /* Transmit only to the existing ports */
+    pg->txports = conf->txports;
+    if ( t->fe->nports < 64 ) {
+        pg->txports &= (1ULL << t->fe->nports) - 1;
+    }
+    pg->rxports = conf->rxports;
+}
+
+/*
+ * Generate frames to the Tx ports in round robin
+ */
+static __inline__ void
+fe_pktgen_tx(struct fe_task *t)
+{
+    struct fe_pktgen *pg;
+    struct fe_pkt_buf_hdr *hdr;
+    uint64_t committed;
+    uint64_t tsc;
+    void *pkt;
+    int port;
+    int i;
+
+    pg = &t->pktgen;
+    tsc = fdb_rdtsc();
+    if ( pg->interval > 0 ) {
+        if ( tsc < pg->next_tsc ) {
+            return;
+        }
+        if ( tsc - pg->next_tsc > pg->interval * FE_PKTGEN_BURST ) {
+            /* Too late; do not try to catch up */
+            pg->next_tsc = tsc;
+        }
+    }
+
+    committed = 0;
+    for ( i = 0; i < FE_PKTGEN_BURST; i++ ) {
+        if ( pg->interval > 0 && tsc < pg->next_tsc ) {
+            break;
+        }
+
+        /* Next Tx port */
+        port = pg->next_port;
+        while ( !(pg->txports & (1ULL << port)) ) {
+            port = port + 1 < (int)t->fe->nports ? port + 1 : 0;
+        }
+        pg->next_port = port + 1 < (int)t->fe->nports ? port + 1 : 0;
+
+        hdr = fe_get_buffer(t);
+        if ( NULL == hdr ) {
+            t->stats->drops.no_buffer++;
+            break;
+        }
+        pkt = (void *)hdr + FE_PKT_HDROFF;
+        fe_pktgen_build(pg, pkt, tsc, &hdr->ol);
+        if ( fe_driver_tx_enqueue(t, &t->tx.rings[port], port, pkt, hdr,
+                                  pg->size) > 0 ) {
+            t->stats->pktgen.tx_pkts++;
+            t->stats->pktgen.tx_bytes += pg->size;
+            committed |= (1ULL << port);
+        } else {
+            fe_release_buffer(t, hdr);
+        }
+        pg->seq++;
+        pg->next_tsc += pg->interval;
+    }
+
+    /* Write the tail pointers */
+    for ( port = 0; committed; port++, committed >>= 1 ) {
+        if ( committed & 1 ) {
+            fe_driver_tx_commit(&t->tx.rings[port]);
+        }
+    }
+}
+
+/*
+ * Terminate a generated frame and measure its latency
+ */
+static __inline__ int
+fe_pktgen_rx(struct fe_task *t, struct fe_pkt_buf_hdr *hdr, void *pkt, int len)
+{
+    struct pix_fe_pktgen_stats *st;
+    uint64_t stamp;
+    uint64_t tsc;
+    uint64_t lat;
+
+    if ( !fe_pktgen_parse(pkt, len, &stamp) ) {
+        /* Not a generated frame */
+        return 0;
+    }
+    tsc = fdb_rdtsc();
+    lat = tsc > stamp ? tsc - stamp : 0;
+
+    st = &t->stats->pktgen;
+    st->rx_pkts++;
+    st->rx_bytes += len;
+    st->last_tsc = tsc;
+    st->latency_sum += lat;
+    if ( lat < st->latency_min ) {
+        st->latency_min = lat;
+    }
+    if ( lat > st->latency_max ) {
+        st->latency_max = lat;
+    }
+    st->hist[fe_pktgen_hist_bin(lat, PIX_FE_PKTGEN_HIST)]++;
+
+    if ( hdr->refs <= 0 ) {
+        fe_release_buffer(t, hdr);
+    }
+
+    return 1;
+}
+
+/*
+ * Reload the polling configuration updated through the shared memory
+ */
+static void
+fe_poll_reload(struct fe_task *t)
+{
+    struct pix_fe_poll_conf *conf;
+    struct fe_driver_rx *rxr;
+    int wthresh;
+    int port;
+    int cpu;
+    int n;
+    int i;
+
+    conf = t->fe->poll;
+    t->poll.gen = conf->gen;
+    __sync_synchronize();
+
+    if ( PIX_FE_POLL_ADAPTIVE == conf->mode && conf->idle_polls > 0 ) {
+        t->poll.threshold = conf->idle_polls;
+    } else {
+        t->poll.threshold = 0;
+    }
+    t->poll.idle = 0;
+    if ( conf->prefetch >= 0 && conf->prefetch < FE_QLEN ) {
+        t->poll.prefetch = conf->prefetch;
+    }
+
+    /* Cache placement of the rings; the CPU # is the local APIC ID used as
+       the DCA tag */
+    n = popcnt(t->rx.bitmap);
+    for ( i = 0; i < n; i++ ) {
+        rxr = &t->rx.rings[i];
+        port = rxr->port;
+        rxr->place = 0;
+        if ( fe_driver_rx_hsplit(t, rxr, (conf->hsplit >> port) & 1) > 0 ) {
+            rxr->place |= PIX_FE_POLL_PLACE_HSPLIT;
+        }
+        cpu = ((conf->dca >> port) & 1) ? t->cpuid : -1;
+        wthresh = conf->wthresh[port] <= PIX_FE_POLL_MAX_WTHRESH
+            ? conf->wthresh[port] : 0;
+        if ( fe_driver_rx_tune(rxr, cpu, wthresh) >= 0 && cpu >= 0 ) {
+            rxr->place |= PIX_FE_POLL_PLACE_DCA;
+        }
+    }
+    for ( i = 0; i < (int)t->fe->nports; i++ ) {
+        cpu = ((conf->dca >> i) & 1) ? t->cpuid : -1;
+        fe_driver_tx_dca(&t->tx.rings[i], cpu);
+    }
+}
+
+/*
+ * Sleep until the tickful task rings the doorbell
+ */
+static void
+fe_poll_sleep(struct fe_task *t, int n)
+{
+    struct fe_doorbell *db;
+    uint64_t val;
+    uint64_t tsc;
+    uint64_t now;
+    uint64_t lat;
+    int i;
+
+    db = t->poll.doorbell;
+    val = db->tsc;
+    db->sleeping = 1;
+    __sync_synchronize();
+
+    /* Check the rings again not to miss packets arrived in the meantime */
+    for ( i = 0; i < n; i++ ) {
+        if ( fe_driver_rx_ready(&t->rx.rings[i]) ) {
+            db->sleeping = 0;
+            t->poll.idle = 0;
+            return;
+        }
+    }
+
+    tsc = fdb_rdtsc();
+    if ( (int)syscall(SYS_xpwait, &db->tsc, val) < 0 ) {
+        /* monitor/mwait is not supported, then keep busy polling */
+        db->sleeping = 0;
+        t->poll.threshold = 0;
+        return;
+    }
+    db->sleeping = 0;
+    now = fdb_rdtsc();
+
+    t->stats->poll.sleeps++;
+    t->stats->poll.sleep_cycles += now - tsc;
+    if ( db->tsc != val ) {
+        /* Woken up by the doorbell */
+        lat = now > db->tsc ? now - db->tsc : 0;
+        t->stats->poll.wakeups++;
+        t->stats->poll.wakeup_cycles += lat;
+        if ( lat > t->stats->poll.wakeup_max ) {
+            t->stats->poll.wakeup_max = lat;
+        }
+        t->poll.idle = 0;
+    }
+}
+
+/*
+ * Fast-path process
+ */
+void *
+fe_fpp_task(void *args)
+{
+    struct fe_task *t;
+    int ret;
+    struct fe_pkt_buf_hdr *hdr;
+    void *pkt;
+    struct fe_driver_rx *rxr;
+    struct fe_driver_tx ktx;
+    struct fe_pipeline_vec vec;
+    uint64_t tsc;
+    int port;
+    int n;
+    int i;
+    int j;
+    int rx;
+
+    /* Get the task data structure from the argument */
+    t = (struct fe_task *)args;
+
+    /* Count the number of ports managed by this task */
+    n = popcnt(t->rx.bitmap);
+
+    printf("Launch an exclusive task for fast-path processing at CPU %d, "
+           "managing %d ports.\n", t->cpuid, n);
+
+    /* Kernel ring as a Tx ring to collect the buffers */
+    ktx.driver = FE_DRIVER_KERNEL;
+    ktx.u.kernel = t->ktx;
+    ktx.pending = 0;
+
+    /* Idle if no handling queues */
+    if ( n <= 0 ) {
+        for ( ;; ) {
+            __asm__ __volatile__ ("syscall" :: "a"(SYS_xpsleep));
+        }
+        return NULL;
+    }
+
+    for ( ;; ) {
+        if ( t->fe->capture.conf->gen != t->capture.gen ) {
+            /* Capture configuration updated */
+            fe_capture_reload(t);
+        }
+        if ( t->fe->pktgen->gen != t->pktgen.gen ) {
+            /* Packet generator configuration updated */
+            fe_pktgen_reload(t);
+        }
+        if ( t->fe->poll->gen != t->poll.gen ) {
+            /* Polling configuration updated */
+            fe_poll_reload(t);
+        }
+        if ( t->fe->pipeline->gen != t->pipeline.gen ) {
+            /* Pipeline configuration updated */
+            fe_pipeline_reload(t);
+        }
+        if ( t->fe->filter.gen != t->filter.gen ) {
+            /* Packet filter updated */
+            fe_filter_reload(t);
+        }
+        if ( t->fe->qos->gen != t->qos.gen ) {
+            /* QoS configuration updated */
+            fe_qos_reload(t);
+        }
+        if ( t->fe->lag.gen != t->lag.gen ) {
+            /* Link aggregation table updated */
+            fe_lag_reload(t);
+        }
+        if ( t->fe->storm->gen != t->storm.gen ) {
+            /* Storm control configuration updated */
+            fe_storm_reload(t);
+        }
+        if ( t->fe->mcast.gen != t->mcast.gen ) {
+            /* Multicast replication table updated */
+            fe_mcast_reload(t);
+        }
+        if ( t->fe->nat->gen != t->nat.gen ) {
+            /* NAT44 configuration updated */
+            fe_nat_reload(t);
+        }
+        if ( t->nat.inside ) {
+            /* Expire the connections */
+            fe_nat_tick(t);
+        }
+        if ( t->fe->tunnel.conf->gen != t->tunnel.gen ) {
+            /* Tunnel endpoint configuration updated */
+            fe_tunnel_reload(t);
+        }
+        if ( t->pktgen.txports ) {
+            fe_pktgen_tx(t);
+        }
+        rx = 0;
+        for ( i = 0; i < n; i++ ) {
+            rxr = &t->rx.rings[i];
+            port = rxr->port;
+            vec.port = port;
+            vec.lport = t->lag.tbl->lports[port];
+            vec.n = 0;
+            tsc = fdb_rdtsc();
+            /* Process a burst of packets from this ring */
+            for ( j = 0; j < FE_RX_BURST; j++ ) {
+                ret = fe_driver_rx_dequeue(rxr, &hdr, &pkt);
+                if ( ret <= 0 ) {
+                    break;
+                }
+                /* Prefetch the descriptor and the packet k ahead */
+                if ( t->poll.prefetch > 0 ) {
+                    fe_driver_rx_prefetch(rxr, t->poll.prefetch);
+                }
+                t->stats->ports[port].rx_pkts++;
+                t->stats->ports[port].rx_bytes += ret;
+                fe_driver_rx_refill(t, rxr);
+                if ( t->capture.ports & (1ULL << port) ) {
+                    fe_capture_packet(t, port, hdr, pkt, ret);
+                }
+                if ( (t->lag.tbl->lacp & (1ULL << port))
+                     && fe_lacp_is_pdu(pkt, ret) ) {
+                    /* Control plane */
+                    fe_lag_punt(t, port, hdr, pkt, ret);
+                    continue;
+                }
+                if ( !(t->pktgen.rxports & (1ULL << port))
+                     || !fe_pktgen_rx(t, hdr, pkt, ret) ) {
+                    fe_pipeline_vec_add(&vec, hdr, pkt, ret);
+                }
+            }
+            if ( vec.n > 0 ) {
+                /* Process the burst as a vector */
+                fe_fpp_forwarding(t, &vec);
+            }
+            if ( j > 0 ) {
+                /* Write the tail pointer once per burst */
+                fe_driver_rx_commit(rxr);
+                rx += j;
+                /* Cycles/packet per cache placement */
+                t->stats->poll.rx_cycles[rxr->place] += fdb_rdtsc() - tsc;
+                t->stats->poll.rx_pkts[rxr->place] += j;
+            }
+        }
+        for ( i = 0; i < (ssize_t)t->fe->nports; i++ ) {
+            if ( rx > 0 ) {
+                fe_collect_buffer(t, &t->tx.rings[i]);
+            } else {
+                /* Drain the buffers in flight while idle */
+                fe_reclaim_buffer(t, &t->tx.rings[i]);
+            }
+        }
+        /* LACPDUs and commands consumed by the tickful task */
+        fe_reclaim_buffer(t, &ktx);
+        fe_collect_capture_buffer(t);
+        if ( t->qos.backlog > 0 ) {
+            /* Packets held back by the shapers or full rings */
+            fe_qos_drain(t);
+        }
+
+        /* Adaptive polling */
+        if ( rx > 0 ) {
+            t->poll.idle = 0;
+        } else if ( t->poll.threshold > 0 && !t->pktgen.txports
+                    && 0 == t->qos.backlog ) {
+            t->poll.idle++;
+            if ( t->poll.idle >= t->poll.threshold ) {
+                fe_poll_sleep(t, n);
+            }
+        }
+    }
+}
+
+/*
+ * Check if a sleeping exclusive task has something to do
+ */
+static int
+fe_poll_has_work(struct fe *fe, struct fe_task *t)
+{
+    int n;
+    int i;
+
+    if ( fe->capture.conf->gen != t->capture.gen
+         || fe->pktgen->gen != t->pktgen.gen || fe->poll->gen != t->poll.gen
+         || fe->pipeline->gen != t->pipeline.gen
+         || fe->filter.gen != t->filter.gen || fe->qos->gen != t->qos.gen
+         || fe->lag.gen != t->lag.gen || fe->storm->gen != t->storm.gen
+         || fe->mcast.gen != t->mcast.gen || fe->nat->gen != t->nat.gen
+         || fe->tunnel.conf->gen != t->tunnel.gen ) {
+        /* Configuration updated */
+        return 1;
+    }
+    n = popcnt(t->rx.bitmap);
+    for ( i = 0; i < n; i++ ) {
+        if ( fe_driver_rx_ready(&t->rx.rings[i]) ) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Ring the doorbells of sleeping exclusive tasks that have work to do
+ */
+static void
+fe_poll_wakeup(struct fe *fe)
+{
+    struct fe_task *t;
+
+    t = fe->extasks;
+    while ( NULL != t ) {
+        if ( t->poll.doorbell->sleeping && fe_poll_has_work(fe, t) ) {
+            t->poll.doorbell->tsc = fdb_rdtsc();
+        }
+        t = t->next;
+    }
+}
+
+/*
+ * Open the pcap output according to the capture configuration
+ */
+static void
+fe_capture_open(struct fe *fe)
+{
+    struct pix_fe_capture_conf *conf;
+    struct pcap_hdr phdr;
+    char dev[PIX_FE_CAPTURE_DEVLEN];
+
+    conf = fe->capture.conf;
+    fe->capture.gen = conf->gen;
+    __sync_synchronize();
+
+    /* Close the current output */
+    if ( fe->capture.fd >= 0 ) {
+        close(fe->capture.fd);
+        fe->capture.fd = -1;
+    }
+    if ( !conf->enabled ) {
+        return;
+    }
+
+    memcpy(dev, conf->dev, PIX_FE_CAPTURE_DEVLEN);
+    dev[PIX_FE_CAPTURE_DEVLEN - 1] = '\0';
+    fe->capture.fd = open(dev, O_WRONLY);
+    if ( fe->capture.fd < 0 ) {
+        return;
+    }
+
+    /* Global header */
+    phdr.magic = PCAP_MAGIC;
+    phdr.version_major = PCAP_VERSION_MAJOR;
+    phdr.version_minor = PCAP_VERSION_MINOR;
+    phdr.thiszone = 0;
+    phdr.sigfigs = 0;
+    phdr.snaplen = conf->snaplen;
+    phdr.linktype = PCAP_LINKTYPE_ETHERNET;
+    write(fe->capture.fd, &phdr, sizeof(struct pcap_hdr));
+
+    /* Base time for time stamps */
+    gettimeofday(&fe->capture.base_tv, NULL);
+    fe->capture.base_tsc = fdb_rdtsc();
+}
+
+/*
+ * Write a captured packet in the pcap format
+ */
+static void
+fe_capture_write(struct fe *fe, struct fe_capture_desc *desc)
+{
+    struct pcap_rec_hdr rec;
+    uint64_t d;
+    uint64_t sec;
+    uint64_t usec;
+
+    /* Convert the time stamp counter to the time of day */
+    if ( desc->tsc > fe->capture.base_tsc ) {
+        d = desc->tsc - fe->capture.base_tsc;
+    } else {
+        d = 0;
+    }
+    sec = d / fe->tsc_hz;
+    usec = (d % fe->tsc_hz) * 1000000 / fe->tsc_hz
+        + fe->capture.base_tv.tv_usec;
+    sec += fe->capture.base_tv.tv_sec + usec / 1000000;
+    usec = usec % 1000000;
+
+    rec.ts_sec = sec;
+    rec.ts_usec = usec;
+    rec.caplen = desc->caplen;
+    rec.len = desc->len;
+    write(fe->capture.fd, &rec, sizeof(struct pcap_rec_hdr));
+    write(fe->capture.fd, desc->pkt, desc->caplen);
+}
+
+/*
+ * Drain the capture rings of the exclusive tasks
+ */
+static void
+fe_capture_process(struct fe *fe)
+{
+    struct fe_task *t;
+    struct fe_capture_desc *desc;
+    int i;
+
+    if ( fe->capture.conf->gen != fe->capture.gen ) {
+        /* Capture configuration updated */
+        fe_capture_open(fe);
+    }
+
+    t = fe->extasks;
+    while ( NULL != t ) {
+        /* Bounded not to starve the slow path */
+        for ( i = 0; i < FE_CAPTURE_BATCH; i++ ) {
+            desc = fe_capture_peek(t->capture.ring);
+            if ( NULL == desc ) {
+                break;
+            }
+            if ( fe->capture.fd >= 0 ) {
+                fe_capture_write(fe, desc);
+                fe->tftask->stats->capture.pkts++;
+            }
+            /* Return the reference to the producer */
+            fe_capture_release(t->capture.ring);
+        }
+        t = t->next;
+    }
+}
+
+/*
+ * Verify (and JIT-compile) the packet filter program updated through the
+ * shared memory, and publish it to the exclusive tasks.  The new program is
+ * built in the slot not in use; the update is deferred until all the tasks
+ * have switched to the current program so that the other slot is free.
+ */
+static void
+fe_filter_update(struct fe *fe)
+{
+    struct pix_fe_filter_conf *conf;
+    struct fe_filter_prog *prog;
+    struct fe_task *t;
+    void *code;
+    int status;
+    int next;
+    int n;
+    int i;
+
+    conf = fe->filter.conf;
+    if ( conf->gen == fe->filter.cgen ) {
+        return;
+    }
+    t = fe->extasks;
+    while ( NULL != t ) {
+        if ( t->rx.bitmap && t->filter.gen != fe->filter.gen ) {
+            /* Still using the previous program */
+            return;
+        }
+        t = t->next;
+    }
+    fe->filter.cgen = conf->gen;
+    __sync_synchronize();
+
+    n = conf->ninsns;
+    if ( n <= 0 ) {
+        /* Unload */
+        prog = NULL;
+        status = PIX_FE_FILTER_NONE;
+    } else {
+        if ( n > FE_FILTER_MAX_INSNS ) {
+            conf->status = PIX_FE_FILTER_INVALID;
+            return;
+        }
+        next = fe->filter.cur ^ 1;
+        prog = fe->filter.progs[next];
+        prog->ninsns = n;
+        for ( i = 0; i < n; i++ ) {
+            prog->insns[i].code = conf->insns[i].code;
+            prog->insns[i].jt = conf->insns[i].jt;
+            prog->insns[i].jf = conf->insns[i].jf;
+            prog->insns[i].k = conf->insns[i].k;
+        }
+        if ( fe_filter_verify(prog->insns, n) < 0 ) {
+            /* Keep the current program */
+            conf->status = PIX_FE_FILTER_INVALID;
+            return;
+        }
+        prog->func = NULL;
+        status = PIX_FE_FILTER_INTERP;
+        if ( conf->jit && NULL != fe->filter.code ) {
+            code = (uint8_t *)fe->filter.code + next * FE_FILTER_JIT_SIZE;
+            if ( fe_filter_jit_compile(prog->insns, n, code,
+                                       FE_FILTER_JIT_SIZE) > 0 ) {
+                prog->func = (fe_filter_func_t)code;
+                status = PIX_FE_FILTER_JIT;
+            }
+        }
+        fe->filter.cur = next;
+    }
+
+    /* Publish */
+    fe->filter.prog = prog;
+    __sync_synchronize();
+    fe->filter.gen++;
+    conf->status = status;
+}
+
+/*
+ * Load the link aggregation groups updated through the shared memory.  The
+ * LACP state of a port newly added to a group is reset.
+ */
+static void
+fe_lag_load(struct fe *fe)
+{
+    struct pix_fe_lag_conf *conf;
+    uint64_t assigned;
+    uint64_t members;
+    uint64_t mask;
+    int g;
+    int p;
+
+    conf = fe->lag.conf;
+    fe->lag.cgen = conf->gen;
+    __sync_synchronize();
+
+    mask = fe->nports >= 64 ? ~0ULL : (1ULL << fe->nports) - 1;
+    assigned = 0;
+    fe->lag.lacp = 0;
+    for ( g = 0; g < FE_LAG_MAX; g++ ) {
+        /* A port belongs to the first group including it */
+        members = conf->groups[g].members & mask & ~assigned;
+        assigned |= members;
+        for ( p = 0; p < (int)fe->nports; p++ ) {
+            if ( (members & ~fe->lag.members[g]) & (1ULL << p) ) {
+                memset(&fe->lag.ports[p], 0, sizeof(struct fe_lacp_port));
+                fe->lag.ports[p].key = g + 1;
+            }
+        }
+        fe->lag.members[g] = members;
+        if ( conf->groups[g].lacp ) {
+            fe->lag.lacp |= members;
+        }
+    }
+    for ( p = 0; p < (int)fe->nports; p++ ) {
+        if ( !(fe->lag.lacp & (1ULL << p)) ) {
+            conf->actor[p] = 0;
+            conf->partner[p] = 0;
+        }
+    }
+    fe->lag.dirty = 1;
+}
+
+/*
+ * Select the members distributing in a group.  All the members of a static
+ * group are used.  In a group negotiated by LACP, the members connected to the
+ * same partner as the first one found are aggregated, and each of them
+ * distributes once the partner is in sync and collecting.
+ */
+static uint64_t
+fe_lag_select_members(struct fe *fe, int g)
+{
+    struct fe_lacp_port *lp;
+    struct fe_lacp_port *ref;
+    uint64_t members;
+    uint64_t active;
+    uint8_t state;
+    int p;
+
+    members = fe->lag.members[g];
+    if ( !(members & fe->lag.lacp) ) {
+        /* Static */
+        return members;
+    }
+    ref = NULL;
+    active = 0;
+    for ( p = 0; p < (int)fe->nports; p++ ) {
+        if ( !(members & (1ULL << p)) ) {
+            continue;
+        }
+        lp = &fe->lag.ports[p];
+        lp->selected = 0;
+        if ( lp->valid && (lp->pstate & FE_LACP_AGGREGATION) ) {
+            if ( NULL == ref ) {
+                ref = lp;
+            }
+            if ( 0 == memcmp(lp->psys, ref->psys, 6)
+                 && lp->pkey == ref->pkey ) {
+                lp->selected = 1;
+            }
+        }
+        state = lp->state;
+        if ( fe_lacp_update(lp) ) {
+            active |= 1ULL << p;
+        }
+        if ( state != lp->state ) {
+            /* Tell the partner now */
+            lp->last_tx = 0;
+        }
+        fe->lag.conf->actor[p] = lp->state;
+        fe->lag.conf->partner[p] = lp->pstate;
+    }
+
+    return active;
+}
+
+/*
+ * Send a LACPDU from a member port
+ */
+static void
+fe_lag_send(struct fe *fe, int port)
+{
+    struct pix_fe_lag_conf *conf;
+    struct fe_pkt_buf_hdr *hdr;
+    struct fe_task *t;
+    uint8_t sys[6];
+    void *pkt;
+    int len;
+    int i;
+
+    t = fe->tftask;
+    conf = fe->lag.conf;
+    hdr = fe_get_buffer(t);
+    if ( NULL == hdr ) {
+        t->stats->drops.no_buffer++;
+        return;
+    }
+    hdr->refs = 0;
+    pkt = (void *)hdr + FE_PKT_HDROFF;
+    for ( i = 0; i < 6; i++ ) {
+        sys[i] = conf->system[i];
+    }
+    len = fe_lacp_build(pkt, conf->prio, sys, port, &fe->lag.ports[port]);
+    if ( fe_driver_tx_enqueue(t, &t->tx.rings[port], port, pkt, hdr, len)
+         <= 0 ) {
+        fe_release_buffer(t, hdr);
+        return;
+    }
+    fe_driver_tx_commit(&t->tx.rings[port]);
+    t->stats->lag.lacp_tx++;
+}
+
+/*
+ * Process a LACPDU passed by an exclusive task
+ */
+static void
+fe_lag_input(struct fe *fe, int port, void *pkt, int len)
+{
+    struct fe_task *t;
+    int ret;
+
+    t = fe->tftask;
+    if ( port >= (int)fe->nports || !(fe->lag.lacp & (1ULL << port)) ) {
+        /* Not negotiated */
+        return;
+    }
+    ret = fe_lacp_input(&fe->lag.ports[port], pkt, len, fdb_rdtsc());
+    if ( ret < 0 ) {
+        t->stats->lag.lacp_errors++;
+        return;
+    }
+    t->stats->lag.lacp_rx++;
+    if ( ret > 0 ) {
+        /* Partner changed */
+        fe->lag.dirty = 1;
+    }
+}
+
+/*
+ * Run the LACP timers, and publish the distribution table to the exclusive
+ * tasks when the members distributing change.  The new table is built in the
+ * slot not in use from the current one, so that the buckets of the members
+ * still up are kept; the update is deferred until all the tasks have switched
+ * to the current table.  The fast path never waits for the update.
+ */
+static void
+fe_lag_update(struct fe *fe)
+{
+    struct pix_fe_lag_conf *conf;
+    struct fe_lag_table *tbl;
+    struct fe_task *t;
+    uint64_t timeout;
+    uint64_t period;
+    uint64_t active;
+    uint64_t tsc;
+    int next;
+    int g;
+    int p;
+
+    conf = fe->lag.conf;
+    if ( conf->gen != fe->lag.cgen ) {
+        fe_lag_load(fe);
+    }
+
+    tsc = fdb_rdtsc();
+    if ( 0 == fe->lag.lacp || tsc - fe->lag.last_tsc < FE_LAG_TICK_TSC ) {
+        /* Timers not running */
+        timeout = 0;
+    } else {
+        fe->lag.last_tsc = tsc;
+        timeout = fe->tsc_hz / 1000 * FE_LACP_TIMEOUT_MS;
+        for ( p = 0; p < (int)fe->nports; p++ ) {
+            if ( (fe->lag.lacp & (1ULL << p))
+                 && fe_lacp_expire(&fe->lag.ports[p], tsc, timeout) ) {
+                /* Partner lost */
+                fe->lag.dirty = 1;
+            }
+        }
+    }
+
+    if ( fe->lag.dirty ) {
+        for ( g = 0; g < FE_LAG_MAX; g++ ) {
+            active = fe_lag_select_members(fe, g);
+            if ( active != fe->lag.active[g] ) {
+                fe->lag.active[g] = active;
+                fe->tftask->stats->lag.changes++;
+            }
+        }
+    }
+
+    if ( timeout > 0 ) {
+        /* Periodic transmission at the fast rate */
+        period = fe->tsc_hz / 1000 * FE_LACP_PERIOD_MS;
+        for ( p = 0; p < (int)fe->nports; p++ ) {
+            if ( (fe->lag.lacp & (1ULL << p))
+                 && tsc - fe->lag.ports[p].last_tx >= period ) {
+                fe->lag.ports[p].last_tx = tsc;
+                fe_lag_send(fe, p);
+            }
+        }
+    }
+
+    if ( !fe->lag.dirty ) {
+        return;
+    }
+    t = fe->extasks;
+    while ( NULL != t ) {
+        if ( t->rx.bitmap && t->lag.gen != fe->lag.gen ) {
+            /* Still using the previous table */
+            return;
+        }
+        t = t->next;
+    }
+    fe->lag.dirty = 0;
+
+    next = fe->lag.cur ^ 1;
+    tbl = fe->lag.tbls[next];
+    memcpy(tbl, fe->lag.tbl, sizeof(struct fe_lag_table));
+    for ( p = 0; p < FE_LAG_NPORTS; p++ ) {
+        tbl->lports[p] = p;
+    }
+    for ( g = 0; g < FE_LAG_MAX; g++ ) {
+        for ( p = 0; p < (int)fe->nports; p++ ) {
+            if ( fe->lag.members[g] & (1ULL << p) ) {
+                tbl->lports[p] = FE_LAG_PORT(g);
+            }
+        }
+        fe_lag_rebalance(tbl->buckets[g], fe->lag.active[g]);
+        conf->groups[g].active = fe->lag.active[g];
+    }
+    tbl->lacp = fe->lag.lacp;
+    tbl->hash = conf->hash >= PIX_FE_LAG_HASH_L2
+        && conf->hash <= PIX_FE_LAG_HASH_L4 ? conf->hash : FE_LAG_HASH_L2;
+    fe->lag.cur = next;
+
+    /* Publish */
+    fe->lag.tbl = tbl;
+    __sync_synchronize();
+    fe->lag.gen++;
+}
+
+/*
+ * Apply an IGMP message received on a port.  The members of a link
+ * aggregation group join together.
+ */
+static void
+fe_mcast_input(struct fe *fe, uint64_t cmd, int port)
+{
+    uint64_t ports;
+    int ret;
+    int g;
+
+    if ( !fe->mcast.enabled || port >= (int)fe->nports ) {
+        /* Disabled */
+        return;
+    }
+    ports = 1ULL << port;
+    for ( g = 0; g < FE_LAG_MAX; g++ ) {
+        if ( fe->lag.members[g] & ports ) {
+            ports = fe->lag.members[g];
+            break;
+        }
+    }
+    ret = fe_mcast_db_input(fe->mcast.db, cmd, ports, fdb_rdtsc());
+    if ( ret < 0 ) {
+        fe->tftask->stats->storm.groups_full++;
+    } else if ( ret > 0 ) {
+        fe->mcast.dirty = 1;
+    }
+}
+
+/*
+ * Age the groups, and publish the replication table to the exclusive tasks
+ * when it changes, the same way as the link aggregation table.  Disabling
+ * IGMP snooping publishes no table, so that multicast is flooded again.
+ */
+static void
+fe_mcast_update(struct fe *fe)
+{
+    struct pix_fe_mcast_conf *conf;
+    struct fe_mcast_table *tbl;
+    struct fe_mcast_db *db;
+    struct fe_task *t;
+    uint64_t timeout;
+    uint64_t tsc;
+    int next;
+    int i;
+
+    conf = fe->mcast.conf;
+    db = fe->mcast.db;
+    if ( conf->gen != fe->mcast.cgen ) {
+        fe->mcast.cgen = conf->gen;
+        __sync_synchronize();
+        if ( fe->mcast.enabled != !!conf->enabled ) {
+            fe->mcast.enabled = !!conf->enabled;
+            memset(db, 0, sizeof(struct fe_mcast_db));
+            fe->mcast.dirty = 1;
+        }
+    }
+
+    tsc = fdb_rdtsc();
+    if ( fe->mcast.enabled && tsc - fe->mcast.last_tsc >= FE_MCAST_AGE_TSC ) {
+        fe->mcast.last_tsc = tsc;
+        timeout = fe->tsc_hz * (conf->timeout > 0 ? conf->timeout
+                                : FE_MCAST_TIMEOUT);
+        if ( fe_mcast_db_age(db, tsc, timeout) ) {
+            fe->mcast.dirty = 1;
+        }
+    }
+
+    if ( !fe->mcast.dirty ) {
+        return;
+    }
+    t = fe->extasks;
+    while ( NULL != t ) {
+        if ( t->rx.bitmap && t->mcast.gen != fe->mcast.gen ) {
+            /* Still using the previous table */
+            return;
+        }
+        t = t->next;
+    }
+    fe->mcast.dirty = 0;
+
+    if ( fe->mcast.enabled ) {
+        next = fe->mcast.cur ^ 1;
+        tbl = fe->mcast.tbls[next];
+        fe_mcast_db_build(db, tbl);
+        fe->mcast.cur = next;
+    } else {
+        tbl = NULL;
+    }
+
+    /* Export the groups */
+    for ( i = 0; i < db->n; i++ ) {
+        conf->groups[i].addr = db->groups[i].addr;
+        conf->groups[i].ports = db->groups[i].ports;
+    }
+    conf->ngroups = db->n;
+    conf->mrouters = db->mrouters;
+
+    /* Publish */
+    fe->mcast.tbl = tbl;
+    __sync_synchronize();
+    fe->mcast.gen++;
+}
+
+/*
+ * Flush the remote VTEPs learned when the tunnel endpoint configuration
+ * changes, since the indices of the VNIs and the VTEPs may be reused.  The
+ * entries are aged out at once and removed in the same way as the garbage
+ * collection.
+ */
+static void
+fe_tunnel_update(struct fe *fe)
+{
+    struct fdb_entry *e;
+
+    if ( fe->tunnel.conf->gen == fe->tunnel.cgen ) {
+        return;
+    }
+    fe->tunnel.cgen = fe->tunnel.conf->gen;
+    for ( e = fe->tunnel.fdb->entries; NULL != e; e = e->next ) {
+        e->hit = 0;
+        e->aging = 0;
+    }
+    fdb_gc(fe->tunnel.fdb);
+}
+
+/*
+ * Remove the Flow Director filter in a slot of a port
+ */
+static void
+fe_fdir_uninstall(struct fe *fe, int port, int slot)
+{
+    struct fe_fdir_table *tbl;
+
+    tbl = fe->fdir.tbls[port];
+    ixgbe_fdir_remove(fe->ports[port]->u.ixgbe, tbl->mode,
+                      &tbl->filters[slot], slot);
+    fe_fdir_table_del(tbl, slot);
+    fe->stats->hw[port].fdir_filters = tbl->n;
+}
+
+/*
+ * Install a Flow Director filter steering a flow received on a port to the Rx
+ * queue of the i-th exclusive task; the queues of a port spread over the
+ * tasks are allocated to them in turn.  Returns the slot of the filter, or -1
+ * if the port does not support it or the table is full.
+ */
+static int
+fe_fdir_install(struct fe *fe, int port, const struct fe_fdir_flow *f,
+                int task)
+{
+    struct fe_fdir_table *tbl;
+    int i;
+
+    if ( port < 0 || port >= (int)fe->nports || NULL == fe->fdir.tbls[port]
+         || !fe->ports[port]->spread || task < 0 || task >= fe->nxcpu ) {
+        return -1;
+    }
+    tbl = fe->fdir.tbls[port];
+    i = fe_fdir_table_find(tbl, f);
+    if ( i >= 0 ) {
+        if ( tbl->filters[i].queue == task ) {
+            return i;
+        }
+        /* Moved to another task */
+        fe_fdir_uninstall(fe, port, i);
+    }
+    i = fe_fdir_table_add(tbl, f, task);
+    if ( i < 0 ) {
+        return -1;
+    }
+    if ( ixgbe_fdir_add(fe->ports[port]->u.ixgbe, tbl->mode,
+                        &tbl->filters[i], i) < 0 ) {
+        fe_fdir_table_del(tbl, i);
+        return -1;
+    }
+    fe->stats->hw[port].fdir_filters = tbl->n;
+
+    return i;
+}
+
+/*
+ * Synchronize the Flow Director filters with the configuration: a mode change
+ * reinitializes the table of the port, the filters no longer configured are
+ * removed, and the status of each rule is written back.
+ */
+static void
+fe_fdir_update(struct fe *fe)
+{
+    struct pix_fe_fdir_conf *conf;
+    struct pix_fe_fdir_rule *r;
+    struct fe_fdir_table *tbl;
+    struct fe_fdir_flow f;
+    int nrules;
+    int mode;
+    int found;
+    int i;
+    int j;
+    int k;
+
+    conf = fe->fdir.conf;
+    if ( conf->gen == fe->fdir.cgen ) {
+        return;
+    }
+    fe->fdir.cgen = conf->gen;
+    __sync_synchronize();
+    nrules = conf->nrules < PIX_FE_FDIR_MAX_RULES
+        ? conf->nrules : PIX_FE_FDIR_MAX_RULES;
+
+    for ( i = 0; i < (int)fe->nports; i++ ) {
+        tbl = fe->fdir.tbls[i];
+        if ( NULL == tbl ) {
+            continue;
+        }
+        mode = conf->modes[i];
+        if ( FE_FDIR_PERFECT != mode && FE_FDIR_SIGNATURE != mode ) {
+            mode = FE_FDIR_NONE;
+        }
+        if ( mode != tbl->mode ) {
+            fe_fdir_table_reset(tbl, mode);
+            if ( ixgbe_fdir_init(fe->ports[i]->u.ixgbe, mode) < 0 ) {
+                fe_fdir_table_reset(tbl, FE_FDIR_NONE);
+            }
+            fe->stats->hw[i].fdir_filters = 0;
+            continue;
+        }
+        for ( j = 0; j < FE_FDIR_MAX; j++ ) {
+            if ( !tbl->filters[j].valid ) {
+                continue;
+            }
+            found = 0;
+            for ( k = 0; k < nrules && !found; k++ ) {
+                r = &conf->rules[k];
+                found = r->port == i && r->proto == tbl->filters[j].flow.proto
+                    && r->sip == tbl->filters[j].flow.sip
+                    && r->dip == tbl->filters[j].flow.dip
+                    && r->sport == tbl->filters[j].flow.sport
+                    && r->dport == tbl->filters[j].flow.dport;
+            }
+            if ( !found ) {
+                fe_fdir_uninstall(fe, i, j);
+            }
+        }
+    }
+
+    for ( k = 0; k < nrules; k++ ) {
+        r = &conf->rules[k];
+        f.sip = r->sip;
+        f.dip = r->dip;
+        f.sport = r->sport;
+        f.dport = r->dport;
+        f.proto = r->proto;
+        if ( fe_fdir_install(fe, r->port, &f, r->task) >= 0 ) {
+            r->status = PIX_FE_FDIR_INSTALLED;
+        } else {
+            r->status = PIX_FE_FDIR_REJECTED;
+        }
+    }
+}
+
+/*
+ * Slow-path process
+ */
+int
+fe_process(struct fe *fe)
+{
+    int i;
+    int ret;
+    struct fe_pkt_buf_hdr *hdr;
+    void *pkt;
+    uint64_t cmd;
+    uint64_t tsc;
+    uint64_t last_tsc;
+    uint64_t last_hw_tsc;
+
+    last_tsc = 0;
+    last_hw_tsc = 0;
+    for ( ;; ) {
+        /* For all exclusive processors */
+        for ( i = 0; i < fe->nxcpu; i++ ) {
+            ret = fe_driver_rx_dequeue(&fe->tftask->rx.rings[i], &hdr, &pkt);
+            if ( ret < 0 ) {
+                continue;
+            }
+            if ( 0 == ret ) {
+                /* Command (non-packet) */
+                cmd = (uint64_t)hdr;
+                switch ( FE_KERNEL_CMD_MODE(cmd) ) {
+                case FE_KERNEL_CMD_LEARN:
+                    if ( fdb_update(fe->fdb, (uint8_t *)&pkt,
+                                    FE_KERNEL_CMD_PORT(cmd)) < 0 ) {
+                        fe->tftask->stats->drops.fdb_full++;
+                    }
+                    break;
+                case FE_KERNEL_CMD_MCAST:
+                    fe_mcast_input(fe, (uint64_t)pkt, FE_KERNEL_CMD_PORT(cmd));
+                    break;
+                case FE_KERNEL_CMD_VTEP:
+                    if ( fdb_update(fe->tunnel.fdb, (uint8_t *)&pkt,
+                                    FE_KERNEL_CMD_PORT(cmd)) < 0 ) {
+                        fe->tftask->stats->drops.fdb_full++;
+                    }
+                    break;
+                default:
+                    ;
+                }
+                fe->tftask->rx.rings[i].u.kernel->head
+                    = fe->tftask->rx.rings[i].u.kernel->head + 1
+                    < fe->tftask->rx.rings[i].u.kernel->len
+                    ? fe->tftask->rx.rings[i].u.kernel->head + 1 : 0;
+            } else if ( hdr->port & FE_KERNEL_PUNT ) {
+                /* LACPDU; the buffer is collected by the exclusive task */
+                fe_lag_input(fe, hdr->port & ~FE_KERNEL_PUNT, pkt, ret);
+                fe->tftask->rx.rings[i].u.kernel->head
+                    = fe->tftask->rx.rings[i].u.kernel->head + 1
+                    < fe->tftask->rx.rings[i].u.kernel->len
+                    ? fe->tftask->rx.rings[i].u.kernel->head + 1 : 0;
+            } else {
+                fe_driver_rx_refill(fe->tftask, &fe->tftask->rx.rings[i]);
+                fe_spp_forwarding(fe->tftask, &fe->tftask->rx.rings[i], hdr,
+                                  pkt, ret);
+                fe_driver_rx_commit(&fe->tftask->rx.rings[i]);
+            }
+        }
+
+        /* Reclaim the transmitted buffers */
+        for ( i = 0; i < (int)fe->nports; i++ ) {
+            fe_reclaim_buffer(fe->tftask, &fe->tftask->tx.rings[i]);
+        }
+
+        /* Wake up sleeping exclusive tasks */
+        fe_poll_wakeup(fe);
+
+        /* Packet capture */
+        fe_capture_process(fe);
+
+        /* Packet filter */
+        fe_filter_update(fe);
+
+        /* Link aggregation */
+        fe_lag_update(fe);
+
+        /* IGMP snooping */
+        fe_mcast_update(fe);
+
+        /* Tunnel endpoint */
+        fe_tunnel_update(fe);
+
+        /* Flow Director */
+        fe_fdir_update(fe);
+
+        /* Hardware statistics counters */
+        tsc = fdb_rdtsc();
+        if ( tsc - last_hw_tsc > FE_HW_STATS_TSC ) {
+            for ( i = 0; i < (int)fe->nports; i++ ) {
+                fe_driver_read_hw_stats(fe->ports[i], &fe->stats->hw[i]);
+            }
+            fe->stats->hw_tsc = tsc;
+            last_hw_tsc = tsc;
+        }
+
+        /* Garbage collection */
+        if ( tsc - last_tsc > 10000000000ULL ) {
+            fdb_gc(fe->fdb);
+            fdb_gc(fe->tunnel.fdb);
+            /* Print out FDB */
+#if 0
+            fdb_debug(fe->fdb);
+#endif
+            last_tsc = tsc;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Create a job at the specified exclusive processor
+ */
+void
+syspix_create_job(int cpuid, void *args)
+{
+    syscall(SYS_pix_create_job, cpuid, fe_fpp_task, args);
+}
+
+/*
+ * Initialize device
+ */
+static struct fe_device *
+_init_device(struct pci_dev_conf *conf)
+{
+    struct fe_device dev;
+    struct fe_device *devp;
+
+    /* Check the driver type and initialize the hardware */
+    dev.driver = FE_DRIVER_INVALID;
+    if ( e1000_is_e1000(conf->vendor_id, conf->device_id) ) {
+        /* e1000 */
+        dev.driver = FE_DRIVER_E1000;
+        dev.u.e1000
+            = e1000_init(conf->device_id, conf->bus, conf->slot, conf->func);
+        dev.u.e1000->pirq = (((conf->intr_pin -1) + conf->slot) % 4) + 0x10;
+        e1000_init_hw(dev.u.e1000);
+        e1000_setup_rx(dev.u.e1000);
+        e1000_setup_tx(dev.u.e1000);
+        dev.domain = 0;
+        dev.rxq_last = -1;
+        dev.txq_last = -1;
+        dev.fastpath = 0;
+    } else if ( igb_is_igb(conf->vendor_id, conf->device_id) ) {
+        /* igb */
+        dev.driver = FE_DRIVER_IGB;
+        dev.u.igb
+            = igb_init(conf->device_id, conf->bus, conf->slot, conf->func);
+        igb_init_hw(dev.u.igb);
+        igb_setup_rx(dev.u.igb);
+        igb_setup_tx(dev.u.igb);
+        igb_enable_rx(dev.u.igb);
+        igb_enable_tx(dev.u.igb);
+        dev.domain = 0;
+        dev.rxq_last = -1;
+        dev.txq_last = -1;
+        dev.fastpath = 0;
+    } else if ( ixgbe_is_ixgbe(conf->vendor_id, conf->device_id) ) {
+        /* ixgbe */
+        dev.driver = FE_DRIVER_IXGBE;
+        dev.u.ixgbe
+            = ixgbe_init(conf->device_id, conf->bus, conf->slot, conf->func);
+        ixgbe_init_hw(dev.u.ixgbe);
+        ixgbe_setup_rx(dev.u.ixgbe);
+        ixgbe_setup_tx(dev.u.ixgbe);
+        ixgbe_enable_rx(dev.u.ixgbe);
+        ixgbe_enable_tx(dev.u.ixgbe);
+        dev.domain = 0;
+        dev.rxq_last = -1;
+        dev.txq_last = -1;
+        dev.fastpath = 0;
+    } else if ( i40e_is_i40e(conf->vendor_id, conf->device_id) ) {
+        /* i40e */
+        dev.driver = FE_DRIVER_I40E;
+        dev.u.i40e
+            = i40e_init(conf->device_id, conf->bus, conf->slot, conf->func);
+        if ( NULL == dev.u.i40e || i40e_init_hw(dev.u.i40e) < 0 ) {
+            printf("Failed to initialize an i40e device.\n");
+            dev.driver = FE_DRIVER_INVALID;
+        }
+        dev.domain = 0;
+        dev.rxq_last = -1;
+        dev.txq_last = -1;
+        dev.fastpath = 0;
+    } else if ( virtio_is_virtio(conf->vendor_id, conf->device_id) ) {
+        /* virtio-net */
+        dev.driver = FE_DRIVER_VIRTIO;
+        dev.u.virtio
+            = virtio_init(conf->device_id, conf->bus, conf->slot, conf->func);
+        if ( NULL == dev.u.virtio || virtio_init_hw(dev.u.virtio) < 0 ) {
+            printf("Failed to initialize a virtio-net device.\n");
+            dev.driver = FE_DRIVER_INVALID;
+        }
+        dev.domain = 0;
+        dev.rxq_last = -1;
+        dev.txq_last = -1;
+        dev.fastpath = 0;
+    }
+
+    if ( FE_DRIVER_INVALID != dev.driver ) {
+        devp = malloc(sizeof(struct fe_device));
+        if ( NULL == devp ) {
+            return NULL;
+        }
+        memcpy(devp, &dev, sizeof(struct fe_device));
+        return devp;
+    }
+
+    return NULL;
+}
+
+/*
+ * Initialize network devices
+ */
+int
+fe_init_devices(struct fe *fe, struct pci_dev *pci)
+{
+    struct fe_device *dev;
+
+    fe->nports = 0;
+    while ( NULL != pci ) {
+        dev = _init_device(pci->device);
+        if ( NULL != dev ) {
+            /* Device found */
+            dev->port = fe->nports;
+            fe->ports[fe->nports] = dev;
+            fe->nports++;
+        }
+        pci = pci->next;
+    }
+
+    return 0;
+}
+
+/*
+ * Initialize processors
+ */
+int
+fe_init_cpu(struct fe *fe)
+{
+    struct syspix_cpu_table cputable;
+    int n;
+    int nex;
+    ssize_t i;
+    struct fe_task *t;
+    struct fe_task **tp;
+
+    /* Load the CPU table through system call */
+    n = pix_ldcpuconf(&cputable);
+    if ( n < 0 ) {
+        return -1;
+    }
+    /* # of available CPUs */
+    fe->ncpus = n;
+
+    /* Tickful task */
+    t = malloc(sizeof(struct fe_task));
+    if ( NULL == t ) {
+        return -1;
+    }
+    t->fe = fe;
     t->cpuid = -1;
     t->pool.head = NULL;
     t->pool.v2poff = 0;
+    t->stats = NULL;
+    t->capture.ring = NULL;
+    t->capture.gen = 0;
+    t->capture.ports = 0;
+    t->pktgen.gen = 0;
+    t->pktgen.txports = 0;
+    t->pktgen.rxports = 0;
+    t->poll.gen = 0;
+    t->poll.threshold = 0;
+    t->poll.idle = 0;
+    t->poll.prefetch = FE_RX_PREFETCH;
+    t->poll.doorbell = NULL;
+    memset(&t->pipeline, 0, sizeof(struct fe_pipeline));
+    t->filter.gen = 0;
+    t->filter.prog = NULL;
+    memset(&t->filter.ctx, 0, sizeof(struct fe_filter_ctx));
+    t->qos.gen = 0;
+    t->qos.ports = 0;
+    t->qos.backlog = 0;
+    t->qos.scheds = NULL;
+    t->lag.gen = 0;
+    t->lag.tbl = NULL;
+    t->storm.gen = 0;
+    t->storm.ports = 0;
+    t->storm.tbs = NULL;
+    t->mcast.gen = 0;
+    t->mcast.tbl = NULL;
+    t->nat.gen = 0;
+    t->nat.inside = 0;
+    t->nat.outside = 0;
+    t->nat.qid = 0;
+    t->nat.shard = NULL;
+    t->tunnel.gen = 0;
+    t->tunnel.tun = NULL;
+    t->tunnel.reps.n = 0;
     t->rx.bitmap = 0;
     t->rx.rings = NULL;
     t->tx.rings = NULL;
@@ -394,321 +2660,965 @@ fe_init_cpu(struct fe *fe)
                 t->cpuid = i;
                 t->pool.head = NULL;
                 t->pool.v2poff = 0;
+                t->stats = NULL;
+                t->capture.ring = NULL;
+                t->capture.gen = 0;
+                t->capture.ports = 0;
+                t->pktgen.gen = 0;
+                t->pktgen.txports = 0;
+                t->pktgen.rxports = 0;
+                t->poll.gen = 0;
+                t->poll.threshold = 0;
+                t->poll.idle = 0;
+                t->poll.prefetch = FE_RX_PREFETCH;
+                t->poll.doorbell = NULL;
+                memset(&t->pipeline, 0, sizeof(struct fe_pipeline));
+                t->filter.gen = 0;
+                t->filter.prog = NULL;
+                memset(&t->filter.ctx, 0, sizeof(struct fe_filter_ctx));
+                t->qos.gen = 0;
+                t->qos.ports = 0;
+                t->qos.backlog = 0;
+                t->qos.scheds = NULL;
+                t->lag.gen = 0;
+                t->lag.tbl = NULL;
+                t->storm.gen = 0;
+                t->storm.ports = 0;
+                t->storm.tbs = NULL;
+                t->mcast.gen = 0;
+                t->mcast.tbl = NULL;
+                t->nat.gen = 0;
+                t->nat.inside = 0;
+                t->nat.outside = 0;
+                t->nat.qid = 0;
+                t->nat.shard = NULL;
+                t->tunnel.gen = 0;
+                t->tunnel.tun = NULL;
+                t->tunnel.reps.n = 0;
                 t->rx.bitmap = 0;
                 t->rx.rings = NULL;
                 t->tx.rings = NULL;
                 t->ktx = NULL;
                 t->next = NULL;
 
-                /* Append it to the tail */
-                tp = &fe->extasks;
-                while ( NULL != *tp ) {
-                    tp = &(*tp)->next;
-                }
-                *tp = t;
+                /* Append it to the tail */
+                tp = &fe->extasks;
+                while ( NULL != *tp ) {
+                    tp = &(*tp)->next;
+                }
+                *tp = t;
+
+                nex++;
+                break;
+            default:
+                ;
+            }
+        }
+    }
+
+    /* # of exlusive CPUs */
+    fe->nxcpu = nex;
+
+    return 0;
+}
+
+/*
+ * Initialize the buffer pool
+ */
+int
+fe_init_buffer_pool(struct fe *fe)
+{
+    size_t len;
+    void *pa;
+    void *va;
+    int ret;
+    struct fe_task *t;
+    uint64_t voff;
+    void *pkt;
+    ssize_t i;
+    struct fe_pkt_buf_hdr *hdr;
+    struct fe_pkt_buf_hdr *prev;
+
+    /* Allocate packet buffer */
+    len = (size_t)FE_PKTSZ * FE_BUFFER_POOL_SIZE * (fe->nxcpu + 1);
+    ret = syscall(SYS_pix_malloc, len, &pa, &va);
+    if ( ret < 0 ) {
+        return -1;
+    }
+    voff = pa - va;
+
+    /* Start from here */
+    pkt = va;
+
+    /* Tickful task */
+    t = fe->tftask;
+    /* Create a buffer pool for the tickful task */
+    prev = NULL;
+    for ( i = 0; i < FE_BUFFER_POOL_SIZE; i++ ) {
+        hdr = (struct fe_pkt_buf_hdr *)pkt;
+        hdr->next = prev;
+        hdr->refs = 0;
+        prev = hdr;
+        pkt += FE_PKTSZ;
+    }
+    t->pool.head = hdr;
+    t->pool.v2poff = voff;
+
+    /* Exclusive CPUs */
+    t = fe->extasks;
+    while ( NULL != t ) {
+        /* Create a buffer pool for each task */
+        prev = NULL;
+        for ( i = 0; i < FE_BUFFER_POOL_SIZE; i++ ) {
+            hdr = (struct fe_pkt_buf_hdr *)pkt;
+            hdr->next = prev;
+            hdr->refs = 0;
+            prev = hdr;
+            pkt += FE_PKTSZ;
+        }
+        t->pool.head = hdr;
+        t->pool.v2poff = voff;
+        /* Next task */
+        t = t->next;
+    }
+
+    return 0;
+}
+
+/*
+ * Initialize the device type (fast-path or slow-path)
+ */
+int
+fe_init_device_type(struct fe *fe)
+{
+    ssize_t i;
+    int ntxq;
+
+    for ( i = 0; i < (ssize_t)fe->nports; i++ ) {
+        /* Get the maximum number of Tx queues */
+        ntxq = fe_driver_max_tx_queues(fe->ports[i]);
+
+        if ( fe->nxcpu + 1 > ntxq ) {
+            /* Slow-path if the number of exclusive CPUs plus 1 (for kernel) is
+               greater than the number of Tx queues */
+            fe->ports[i]->fastpath = 0;
+        } else {
+            /* Fast-path */
+            fe->ports[i]->fastpath = 1;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Allocate
+ */
+static void *
+_fe_alloc(struct fe *fe, size_t len)
+{
+    void *a;
+
+    /* 64 byte alignment */
+    len = (len + 128 - 1) / 128 * 128;
+
+    a = fe->mem.free;
+    if ( fe->mem.free + len > fe->mem.vaddr + fe->mem.len ) {
+        return NULL;
+    }
+    fe->mem.free += len;
+
+    return a;
+}
+
+/*
+ * Initialize an Rx ring of a port handled by an exclusive task
+ */
+static int
+_init_extask_rx_ring(struct fe *fe, struct fe_task *t, struct fe_driver_rx *rx,
+                     int port)
+{
+    int sz;
+    void *m;
+    int ret;
+
+    t->rx.bitmap |= (1ULL << port);
+    /* Set driver */
+    rx->driver = fe->ports[port]->driver;
+    /* Set port # */
+    rx->port = port;
+    rx->place = 0;
+    /* Calculate the required memory space */
+    sz = fe_driver_calc_rx_ring_memsize(rx, FE_QLEN);
+    if ( sz < 0 ) {
+        return -1;
+    }
+    /* Allocate memory space for the ring */
+    m = _fe_alloc(fe, sz);
+    if ( NULL == m ) {
+        return -1;
+    }
+    /* Setup an Rx queue */
+    ret = fe_driver_setup_rx_ring(fe->ports[port], rx, m, fe->mem.v2poff,
+                                  FE_QLEN);
+    if ( ret < 0 ) {
+        return -1;
+    }
+
+    /* Fill the Rx queue */
+    fe_driver_rx_fill_all(t, rx);
+    fe_driver_rx_commit(rx);
+
+    return 0;
+}
+
+/*
+ * Initialize the ring buffers of am exclusive task
+ */
+static int
+_init_extask_ring(struct fe *fe, struct fe_task *t, int n, int *port)
+{
+    ssize_t i;
+    struct fe_kernel_ring *ring;
+    int sz;
+    void *m;
+    int ret;
+    int nspread;
+    int j;
+
+    /* Kernel Tx */
+    t->ktx = _fe_alloc(fe, sizeof(struct fe_kernel_ring));
+    if ( NULL == t->ktx ) {
+        return -1;
+    }
+    ring = t->ktx;
+    ring->len = FE_QLEN;
+    ring->head = 0;
+    ring->tail = 0;
+    ring->rx_head = 0;
+    ring->tx_head = 0;
+    ring->descs = _fe_alloc(fe, sizeof(struct fe_kernel_desc) * ring->len);
+    if ( NULL == ring->descs ) {
+        return -1;
+    }
+    ring->bufs = _fe_alloc(fe, sizeof(struct fe_pkt_buf_hdr *) * ring->len);
+    if ( NULL == ring->bufs ) {
+        return -1;
+    }
+
+    /* Doorbell */
+    t->poll.doorbell = _fe_alloc(fe, sizeof(struct fe_doorbell));
+    if ( NULL == t->poll.doorbell ) {
+        return -1;
+    }
+    t->poll.doorbell->tsc = 0;
+    t->poll.doorbell->sleeping = 0;
+
+    /* Capture */
+    t->capture.ring = _fe_alloc(fe, sizeof(struct fe_capture_ring));
+    if ( NULL == t->capture.ring ) {
+        return -1;
+    }
+    t->capture.ring->len = FE_CAPTURE_QLEN;
+    t->capture.ring->head = 0;
+    t->capture.ring->tail = 0;
+    t->capture.ring->tx_head = 0;
+    t->capture.ring->descs
+        = _fe_alloc(fe, sizeof(struct fe_capture_desc)
+                    * t->capture.ring->len);
+    if ( NULL == t->capture.ring->descs ) {
+        return -1;
+    }
+
+    /* Rx queues handled by this task; n ports assigned to this task, and a
+       queue of each port spread over all the exclusive tasks */
+    nspread = 0;
+    for ( i = 0; i < (ssize_t)fe->nports; i++ ) {
+        if ( fe->ports[i]->spread ) {
+            nspread++;
+        }
+    }
+    t->rx.rings = _fe_alloc(fe, sizeof(struct fe_driver_rx) * (n + nspread));
+    if ( NULL == t->rx.rings ) {
+        return -1;
+    }
+    t->rx.bitmap = 0;
+    j = 0;
+    while ( j < n && *port < (int)fe->nports ) {
+        if ( !fe->ports[*port]->spread ) {
+            ret = _init_extask_rx_ring(fe, t, &t->rx.rings[j], *port);
+            if ( ret < 0 ) {
+                return -1;
+            }
+            j++;
+        }
+        /* Next port */
+        (*port)++;
+    }
+    for ( i = 0; i < (ssize_t)fe->nports; i++ ) {
+        if ( fe->ports[i]->spread ) {
+            ret = _init_extask_rx_ring(fe, t, &t->rx.rings[j], i);
+            if ( ret < 0 ) {
+                return -1;
+            }
+            j++;
+        }
+    }
+
+    /* Tx */
+    t->tx.rings = _fe_alloc(fe, sizeof(struct fe_driver_tx) * fe->nports);
+    if ( NULL == t->tx.rings ) {
+        return -1;
+    }
 
-                nex++;
-                break;
-            default:
-                ;
+    /* Physical ports */
+    for ( i = 0; i < (ssize_t)fe->nports; i++ ) {
+        if ( fe->ports[i]->fastpath ) {
+            /* Fast-path */
+            t->tx.rings[i].driver = fe->ports[i]->driver;
+
+            sz = fe_driver_calc_tx_ring_memsize(&t->tx.rings[i], FE_QLEN);
+            if ( sz < 0 ) {
+                return -1;
+            }
+            m = _fe_alloc(fe, sz);
+            if ( NULL == m ) {
+                return -1;
             }
+            ret = fe_driver_setup_tx_ring(fe->ports[i], &t->tx.rings[i], m,
+                                          fe->mem.v2poff, FE_QLEN);
+            if ( ret < 0 ) {
+                return -1;
+            }
+        } else {
+            /* Slow-path */
+            t->tx.rings[i].driver = FE_DRIVER_KERNEL;
+            t->tx.rings[i].u.kernel = t->ktx;
         }
     }
 
-    /* # of exlusive CPUs */
-    fe->nxcpu = nex;
-
     return 0;
 }
 
+
 /*
- * Initialize the buffer pool
+ * Assign each device to a task
  */
 int
-fe_init_buffer_pool(struct fe *fe)
+fe_assign_task(struct fe *fe)
 {
-    size_t len;
-    void *pa;
-    void *va;
-    int ret;
     struct fe_task *t;
-    uint64_t voff;
-    void *pkt;
+    int n;
+    int ret;
+    int port;
     ssize_t i;
-    struct fe_pkt_buf_hdr *hdr;
-    struct fe_pkt_buf_hdr *prev;
+    int sz;
+    void *m;
+    int nsingle;
 
-    /* Allocate packet buffer */
-    len = (size_t)FE_PKTSZ * FE_BUFFER_POOL_SIZE * (fe->nxcpu + 1);
-    ret = syscall(SYS_pix_malloc, len, &pa, &va);
-    if ( ret < 0 ) {
-        return -1;
+    /* Spread the Rx of multi-queue ports over all the exclusive tasks */
+    nsingle = 0;
+    for ( i = 0; i < (ssize_t)fe->nports; i++ ) {
+        if ( fe->nxcpu > 1
+             && fe_driver_max_rx_queues(fe->ports[i]) >= fe->nxcpu ) {
+            fe->ports[i]->spread = 1;
+        } else {
+            fe->ports[i]->spread = 0;
+            nsingle++;
+        }
     }
-    voff = pa - va;
 
-    /* Start from here */
-    pkt = va;
+    /* # of ports (Rx queues) per task of an exclusive processor */
+    n = nsingle > 0 ? ((nsingle - 1) / fe->nxcpu) + 1 : 0;
+    port = 0;
 
-    /* Tickful task */
-    t = fe->tftask;
-    /* Create a buffer pool for the tickful task */
-    prev = NULL;
-    for ( i = 0; i < FE_BUFFER_POOL_SIZE; i++ ) {
-        hdr = (struct fe_pkt_buf_hdr *)pkt;
-        hdr->next = prev;
-        hdr->refs = 0;
-        prev = hdr;
-        pkt += FE_PKTSZ;
+    /* Assign ports to each exclusive task */
+    t = fe->extasks;
+    while ( NULL != t ) {
+        ret = _init_extask_ring(fe, t, n, &port);
+        if ( ret < 0 ) {
+            return -1;
+        }
+
+        /* Next task */
+        t = t->next;
     }
-    t->pool.head = hdr;
-    t->pool.v2poff = voff;
 
-    /* Exclusive CPUs */
+    /* Tickful task */
+    /* Rx from exclusive processors */
+    fe->tftask->rx.bitmap = (1ULL << fe->nxcpu) - 1;
+    fe->tftask->rx.rings
+        = _fe_alloc(fe, sizeof(struct fe_driver_rx) * fe->nxcpu);
+    if ( NULL == fe->tftask->rx.rings ) {
+        return -1;
+    }
     t = fe->extasks;
+    i = 0;
     while ( NULL != t ) {
-        /* Create a buffer pool for each task */
-        prev = NULL;
-        for ( i = 0; i < FE_BUFFER_POOL_SIZE; i++ ) {
-            hdr = (struct fe_pkt_buf_hdr *)pkt;
-            hdr->next = prev;
-            hdr->refs = 0;
-            prev = hdr;
-            pkt += FE_PKTSZ;
-        }
-        t->pool.head = hdr;
-        t->pool.v2poff = voff;
+        fe->tftask->rx.rings[i].driver = FE_DRIVER_KERNEL;
+        fe->tftask->rx.rings[i].u.kernel = t->ktx;
         /* Next task */
         t = t->next;
+        i++;
+    }
+
+    /* Tx */
+    fe->tftask->tx.rings
+        = _fe_alloc(fe, sizeof(struct fe_driver_tx) * fe->nports);
+    if ( NULL == fe->tftask->tx.rings ) {
+        return -1;
+    }
+    /* Physical ports */
+    for ( i = 0; i < (ssize_t)fe->nports; i++ ) {
+        fe->tftask->tx.rings[i].driver = fe->ports[i]->driver;
+
+        sz = fe_driver_calc_tx_ring_memsize(&fe->tftask->tx.rings[i], FE_QLEN);
+        if ( sz < 0 ) {
+            return -1;
+        }
+        m = _fe_alloc(fe, sz);
+        if ( NULL == m ) {
+            return -1;
+        }
+        ret = fe_driver_setup_tx_ring(fe->ports[i], &fe->tftask->tx.rings[i], m,
+                                      fe->mem.v2poff, FE_QLEN);
+        if ( ret < 0 ) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Initialize the statistics exported through the shared memory
+ */
+int
+fe_init_stats(struct fe *fe)
+{
+    size_t len;
+    struct fe_task *t;
+    int ntasks;
+
+    ntasks = fe->nxcpu + 1;
+    len = sizeof(struct pix_fe_stats)
+        + sizeof(struct pix_fe_task_stats) * ntasks;
+
+    /* Export the counters to other processes (e.g., pash) if possible */
+    fe->stats = pix_shm_create(PIX_FE_STATS_SHM, len);
+    if ( NULL == fe->stats ) {
+        /* Keep them private */
+        fe->stats = malloc(len);
+        if ( NULL == fe->stats ) {
+            return -1;
+        }
+    }
+    memset(fe->stats, 0, len);
+    fe->stats->nports = fe->nports;
+    fe->stats->tsc_hz = fe->tsc_hz;
+
+    /* Tickful task */
+    fe->tftask->stats = &fe->stats->tasks[0];
+    fe->tftask->stats->cpuid = fe->tftask->cpuid;
+    fe->stats->ntasks = 1;
+
+    /* Exclusive CPU tasks */
+    t = fe->extasks;
+    while ( NULL != t ) {
+        t->stats = &fe->stats->tasks[fe->stats->ntasks];
+        t->stats->cpuid = t->cpuid;
+        fe->stats->ntasks++;
+        t = t->next;
     }
 
     return 0;
 }
 
 /*
- * Initialize the device type (fast-path or slow-path)
+ * Initialize the packet capture
  */
 int
-fe_init_device_type(struct fe *fe)
+fe_init_capture(struct fe *fe)
 {
-    ssize_t i;
-    int ntxq;
+    /* Configured from other processes (e.g., pash) if possible */
+    fe->capture.conf = pix_shm_create(PIX_FE_CAPTURE_SHM,
+                                      sizeof(struct pix_fe_capture_conf));
+    if ( NULL == fe->capture.conf ) {
+        fe->capture.conf = malloc(sizeof(struct pix_fe_capture_conf));
+        if ( NULL == fe->capture.conf ) {
+            return -1;
+        }
+    }
+    memset(fe->capture.conf, 0, sizeof(struct pix_fe_capture_conf));
+    fe->capture.conf->snaplen = FE_CAPTURE_SNAPLEN;
+    fe->capture.conf->sampling = 1;
+    strncpy(fe->capture.conf->dev, FE_CAPTURE_DEV, PIX_FE_CAPTURE_DEVLEN - 1);
+    fe->capture.gen = 0;
+    fe->capture.fd = -1;
 
-    for ( i = 0; i < (ssize_t)fe->nports; i++ ) {
-        /* Get the maximum number of Tx queues */
-        ntxq = fe_driver_max_tx_queues(fe->ports[i]);
+    return 0;
+}
 
-        if ( fe->nxcpu + 1 > ntxq ) {
-            /* Slow-path if the number of exclusive CPUs plus 1 (for kernel) is
-               greater than the number of Tx queues */
-            fe->ports[i]->fastpath = 0;
-        } else {
-            /* Fast-path */
-            fe->ports[i]->fastpath = 1;
+/*
+ * Initialize the packet generator
+ */
+int
+fe_init_pktgen(struct fe *fe)
+{
+    struct pix_fe_pktgen_conf *conf;
+
+    /* Configured from other processes (e.g., pash) if possible */
+    conf = pix_shm_create(PIX_FE_PKTGEN_SHM, sizeof(struct pix_fe_pktgen_conf));
+    if ( NULL == conf ) {
+        conf = malloc(sizeof(struct pix_fe_pktgen_conf));
+        if ( NULL == conf ) {
+            return -1;
+        }
+    }
+    memset(conf, 0, sizeof(struct pix_fe_pktgen_conf));
+    conf->size = FE_PKTGEN_MINLEN;
+    /* 02:00:00:00:00:01 to 02:00:00:00:00:02 (locally administered) */
+    conf->smac[0] = 0x02;
+    conf->smac[5] = 0x01;
+    conf->dmac[0] = 0x02;
+    conf->dmac[5] = 0x02;
+    /* 10.0.0.1 to 10.0.0.2 */
+    conf->sip = 0x0a000001;
+    conf->dip = 0x0a000002;
+    fe->pktgen = conf;
+
+    return 0;
+}
+
+/*
+ * Initialize the polling configuration
+ */
+int
+fe_init_poll(struct fe *fe)
+{
+    struct pix_fe_poll_conf *conf;
+
+    /* Configured from other processes (e.g., pash) if possible */
+    conf = pix_shm_create(PIX_FE_POLL_SHM, sizeof(struct pix_fe_poll_conf));
+    if ( NULL == conf ) {
+        conf = malloc(sizeof(struct pix_fe_poll_conf));
+        if ( NULL == conf ) {
+            return -1;
+        }
+    }
+    memset(conf, 0, sizeof(struct pix_fe_poll_conf));
+    conf->mode = PIX_FE_POLL_BUSY;
+    conf->idle_polls = FE_POLL_IDLE_POLLS;
+    conf->prefetch = FE_RX_PREFETCH;
+    fe->poll = conf;
+
+    return 0;
+}
+
+/*
+ * Initialize the pipeline configuration
+ */
+int
+fe_init_pipeline(struct fe *fe)
+{
+    struct pix_fe_pipeline_conf *conf;
+
+    /* Configured from other processes (e.g., pash) if possible */
+    conf = pix_shm_create(PIX_FE_PIPELINE_SHM,
+                          sizeof(struct pix_fe_pipeline_conf));
+    if ( NULL == conf ) {
+        conf = malloc(sizeof(struct pix_fe_pipeline_conf));
+        if ( NULL == conf ) {
+            return -1;
+        }
+    }
+    /* Learning bridge on all the ports */
+    memset(conf, 0, sizeof(struct pix_fe_pipeline_conf));
+    fe->pipeline = conf;
+
+    return 0;
+}
+
+/*
+ * Initialize the packet filter
+ */
+int
+fe_init_filter(struct fe *fe)
+{
+    struct pix_fe_filter_conf *conf;
+    int i;
+
+    /* Configured from other processes (e.g., pash) if possible */
+    conf = pix_shm_create(PIX_FE_FILTER_SHM, sizeof(struct pix_fe_filter_conf));
+    if ( NULL == conf ) {
+        conf = malloc(sizeof(struct pix_fe_filter_conf));
+        if ( NULL == conf ) {
+            return -1;
+        }
+    }
+    memset(conf, 0, sizeof(struct pix_fe_filter_conf));
+    fe->filter.conf = conf;
+    fe->filter.cgen = 0;
+    fe->filter.gen = 0;
+    fe->filter.prog = NULL;
+    fe->filter.cur = 0;
+    for ( i = 0; i < 2; i++ ) {
+        fe->filter.progs[i] = malloc(sizeof(struct fe_filter_prog));
+        if ( NULL == fe->filter.progs[i] ) {
+            return -1;
+        }
+    }
+
+    /* Programs are interpreted if executable memory is not available */
+    fe->filter.code = fe_filter_jit_alloc(FE_FILTER_JIT_SIZE * 2);
+    if ( NULL == fe->filter.code ) {
+        printf("JIT compiler of the packet filter is not available.\n");
+    }
+
+    return 0;
+}
+
+/*
+ * Initialize the QoS configuration and the schedulers of the exclusive tasks
+ */
+int
+fe_init_qos(struct fe *fe)
+{
+    struct pix_fe_qos_conf *conf;
+    struct fe_qos_map map;
+    struct fe_task *t;
+    int i;
+
+    /* Configured from other processes (e.g., pash) if possible */
+    conf = pix_shm_create(PIX_FE_QOS_SHM, sizeof(struct pix_fe_qos_conf));
+    if ( NULL == conf ) {
+        conf = malloc(sizeof(struct pix_fe_qos_conf));
+        if ( NULL == conf ) {
+            return -1;
+        }
+    }
+    /* Class 0 by strict priority, and the others by DRR of weights 4:2:1 */
+    memset(conf, 0, sizeof(struct pix_fe_qos_conf));
+    conf->burst = FE_QOS_DEFAULT_BURST;
+    for ( i = 0; i < FE_QOS_NCLASSES; i++ ) {
+        conf->classes[i].strict = 0 == i;
+        conf->classes[i].weight = 8 >> i;
+        conf->classes[i].burst = FE_QOS_DEFAULT_BURST;
+    }
+    fe_qos_map_default(&map);
+    for ( i = 0; i < 8; i++ ) {
+        conf->pcp[i] = map.pcp[i];
+    }
+    for ( i = 0; i < 64; i++ ) {
+        conf->dscp[i] = map.dscp[i];
+    }
+    fe->qos = conf;
+
+    /* Schedulers of all the ports per task */
+    t = fe->extasks;
+    while ( NULL != t ) {
+        if ( fe->nports > 0 ) {
+            t->qos.scheds = malloc(sizeof(struct fe_qos_sched) * fe->nports);
+            if ( NULL == t->qos.scheds ) {
+                return -1;
+            }
+            memset(t->qos.scheds, 0, sizeof(struct fe_qos_sched) * fe->nports);
         }
+        memcpy(&t->qos.map, &map, sizeof(struct fe_qos_map));
+        t = t->next;
     }
 
     return 0;
 }
 
 /*
- * Allocate
+ * Initialize link aggregation; no group is configured
  */
-static void *
-_fe_alloc(struct fe *fe, size_t len)
+int
+fe_init_lag(struct fe *fe)
 {
-    void *a;
+    struct pix_fe_lag_conf *conf;
+    struct fe_lag_table *tbl;
+    int i;
 
-    /* 64 byte alignment */
-    len = (len + 128 - 1) / 128 * 128;
+    /* Configured from other processes (e.g., pash) if possible */
+    conf = pix_shm_create(PIX_FE_LAG_SHM, sizeof(struct pix_fe_lag_conf));
+    if ( NULL == conf ) {
+        conf = malloc(sizeof(struct pix_fe_lag_conf));
+        if ( NULL == conf ) {
+            return -1;
+        }
+    }
+    /* Default system priority, and a locally administered system ID */
+    memset(conf, 0, sizeof(struct pix_fe_lag_conf));
+    conf->hash = PIX_FE_LAG_HASH_L3;
+    conf->prio = 0x8000;
+    conf->system[0] = 0x02;
+    fe->lag.conf = conf;
+    fe->lag.cgen = 0;
+    fe->lag.cur = 0;
+    fe->lag.lacp = 0;
+    fe->lag.dirty = 0;
+    fe->lag.last_tsc = 0;
+    memset(fe->lag.members, 0, sizeof(fe->lag.members));
+    memset(fe->lag.active, 0, sizeof(fe->lag.active));
+    memset(fe->lag.ports, 0, sizeof(fe->lag.ports));
+    for ( i = 0; i < 2; i++ ) {
+        fe->lag.tbls[i] = malloc(sizeof(struct fe_lag_table));
+        if ( NULL == fe->lag.tbls[i] ) {
+            return -1;
+        }
+    }
 
-    a = fe->mem.free;
-    if ( fe->mem.free + len > fe->mem.vaddr + fe->mem.len ) {
-        return NULL;
+    /* Every port is its own logical port */
+    tbl = fe->lag.tbls[0];
+    for ( i = 0; i < FE_LAG_NPORTS; i++ ) {
+        tbl->lports[i] = i;
     }
-    fe->mem.free += len;
+    tbl->lacp = 0;
+    tbl->hash = FE_LAG_HASH_L3;
+    memset(tbl->buckets, -1, sizeof(tbl->buckets));
+    fe->lag.tbl = tbl;
+    /* Loaded by the tasks before the first packet */
+    fe->lag.gen = 1;
 
-    return a;
+    return 0;
 }
 
 /*
- * Initialize the ring buffers of am exclusive task
+ * Initialize the storm control configuration and the token buckets of the
+ * exclusive tasks; no port is controlled
  */
-static int
-_init_extask_ring(struct fe *fe, struct fe_task *t, int n, int *port)
+int
+fe_init_storm(struct fe *fe)
 {
-    ssize_t i;
-    struct fe_kernel_ring *ring;
-    int sz;
-    void *m;
-    int ret;
+    struct pix_fe_storm_conf *conf;
+    struct fe_task *t;
+    size_t len;
 
-    /* Kernel Tx */
-    t->ktx = _fe_alloc(fe, sizeof(struct fe_kernel_ring));
-    if ( NULL == t->ktx ) {
-        return -1;
-    }
-    ring = t->ktx;
-    ring->len = FE_QLEN;
-    ring->head = 0;
-    ring->tail = 0;
-    ring->rx_head = 0;
-    ring->tx_head = 0;
-    ring->descs = _fe_alloc(fe, sizeof(struct fe_kernel_desc) * ring->len);
-    if ( NULL == ring->descs ) {
-        return -1;
-    }
-    ring->bufs = _fe_alloc(fe, sizeof(struct fe_pkt_buf_hdr *) * ring->len);
-    if ( NULL == ring->bufs ) {
-        return -1;
+    /* Configured from other processes (e.g., pash) if possible */
+    conf = pix_shm_create(PIX_FE_STORM_SHM, sizeof(struct pix_fe_storm_conf));
+    if ( NULL == conf ) {
+        conf = malloc(sizeof(struct pix_fe_storm_conf));
+        if ( NULL == conf ) {
+            return -1;
+        }
     }
+    memset(conf, 0, sizeof(struct pix_fe_storm_conf));
+    conf->burst = FE_QOS_DEFAULT_BURST;
+    fe->storm = conf;
 
-    /* Rx queues handled by this task */
-    if ( (size_t)*port + n >= fe->nports ) {
-        n = fe->nports - *port;
-    }
-    t->rx.rings = _fe_alloc(fe, sizeof(struct fe_driver_rx) * n);
-    if ( NULL == t->rx.rings ) {
-        return -1;
-    }
-    t->rx.bitmap = 0;
-    for ( i = 0; i < n; i++ ) {
-        t->rx.bitmap |= (1ULL << *port);
-        /* Set driver */
-        t->rx.rings[i].driver = fe->ports[*port]->driver;
-        /* Set port # */
-        t->rx.rings[i].port = *port;
-        /* Calculate the required memory space */
-        sz = fe_driver_calc_rx_ring_memsize(&t->rx.rings[i], FE_QLEN);
-        if ( sz < 0 ) {
-            return -1;
+    /* Token buckets of all the ports and classes per task */
+    len = sizeof(struct fe_qos_tb) * PIX_FE_STORM_NCLASSES * fe->nports;
+    t = fe->extasks;
+    while ( NULL != t ) {
+        if ( len > 0 ) {
+            t->storm.tbs = malloc(len);
+            if ( NULL == t->storm.tbs ) {
+                return -1;
+            }
+            memset(t->storm.tbs, 0, len);
         }
-        /* Allocate memory space for the ring */
-        m = _fe_alloc(fe, sz);
-        if ( NULL == m ) {
+        t = t->next;
+    }
+
+    return 0;
+}
+
+/*
+ * Initialize IGMP snooping; disabled
+ */
+int
+fe_init_mcast(struct fe *fe)
+{
+    struct pix_fe_mcast_conf *conf;
+    int i;
+
+    /* Configured from other processes (e.g., pash) if possible */
+    conf = pix_shm_create(PIX_FE_MCAST_SHM, sizeof(struct pix_fe_mcast_conf));
+    if ( NULL == conf ) {
+        conf = malloc(sizeof(struct pix_fe_mcast_conf));
+        if ( NULL == conf ) {
             return -1;
         }
-        /* Setup an Rx queue */
-        ret = fe_driver_setup_rx_ring(fe->ports[*port], &t->rx.rings[i], m,
-                                      fe->mem.v2poff, FE_QLEN);
-        if ( ret < 0 ) {
+    }
+    memset(conf, 0, sizeof(struct pix_fe_mcast_conf));
+    conf->timeout = FE_MCAST_TIMEOUT;
+    fe->mcast.conf = conf;
+    fe->mcast.cgen = 0;
+    fe->mcast.gen = 0;
+    fe->mcast.tbl = NULL;
+    fe->mcast.cur = 0;
+    fe->mcast.enabled = 0;
+    fe->mcast.dirty = 0;
+    fe->mcast.last_tsc = 0;
+    for ( i = 0; i < 2; i++ ) {
+        fe->mcast.tbls[i] = malloc(sizeof(struct fe_mcast_table));
+        if ( NULL == fe->mcast.tbls[i] ) {
             return -1;
         }
-
-        /* Fill the Rx queue */
-        fe_driver_rx_fill_all(t, &t->rx.rings[i]);
-        fe_driver_rx_commit(&t->rx.rings[i]);
-
-        /* Next port */
-        (*port)++;
     }
-
-    /* Tx */
-    t->tx.rings = _fe_alloc(fe, sizeof(struct fe_driver_tx) * fe->nports);
-    if ( NULL == t->tx.rings ) {
+    fe->mcast.db = malloc(sizeof(struct fe_mcast_db));
+    if ( NULL == fe->mcast.db ) {
         return -1;
     }
-
-    /* Physical ports */
-    for ( i = 0; i < (ssize_t)fe->nports; i++ ) {
-        if ( fe->ports[i]->fastpath ) {
-            /* Fast-path */
-            t->tx.rings[i].driver = fe->ports[i]->driver;
-
-            sz = fe_driver_calc_tx_ring_memsize(&t->tx.rings[i], FE_QLEN);
-            if ( sz < 0 ) {
-                return -1;
-            }
-            m = _fe_alloc(fe, sz);
-            if ( NULL == m ) {
-                return -1;
-            }
-            ret = fe_driver_setup_tx_ring(fe->ports[i], &t->tx.rings[i], m,
-                                          fe->mem.v2poff, FE_QLEN);
-            if ( ret < 0 ) {
-                return -1;
-            }
-        } else {
-            /* Slow-path */
-            t->tx.rings[i].driver = FE_DRIVER_KERNEL;
-            t->tx.rings[i].u.kernel = t->ktx;
-        }
-    }
+    memset(fe->mcast.db, 0, sizeof(struct fe_mcast_db));
 
     return 0;
 }
 
-
 /*
- * Assign each device to a task
+ * Initialize NAT44 and a shard of the connection tracking table per exclusive
+ * task; no port is translated
  */
 int
-fe_assign_task(struct fe *fe)
+fe_init_nat(struct fe *fe)
 {
+    struct pix_fe_nat_conf *conf;
     struct fe_task *t;
-    int n;
-    int ret;
-    int port;
-    ssize_t i;
-    int sz;
-    void *m;
-
-    /* # of ports (Rx queues) per task of an exclusive processor */
-    n = ((fe->nports - 1) / fe->nxcpu) + 1;
-    port = 0;
-
-    /* Assign ports to each exclusive task */
+    uint32_t now;
+    int qid;
+
+    /* Configured from other processes (e.g., pash) if possible */
+    conf = pix_shm_create(PIX_FE_NAT_SHM, sizeof(struct pix_fe_nat_conf));
+    if ( NULL == conf ) {
+        conf = malloc(sizeof(struct pix_fe_nat_conf));
+        if ( NULL == conf ) {
+            return -1;
+        }
+    }
+    memset(conf, 0, sizeof(struct pix_fe_nat_conf));
+    conf->block = FE_NAT_BLOCK_DEFAULT;
+    conf->blocks = FE_NAT_BLOCKS_DEFAULT;
+    conf->timeouts[PIX_FE_NAT_TO_TCP_EST] = FE_NAT_TCP_EST_TIMEOUT;
+    conf->timeouts[PIX_FE_NAT_TO_TCP_TRANS] = FE_NAT_TCP_TRANS_TIMEOUT;
+    conf->timeouts[PIX_FE_NAT_TO_UDP] = FE_NAT_UDP_TIMEOUT;
+    fe->nat = conf;
+
+    /* The queues of the ports spread are allocated to the tasks in turn */
+    now = fdb_rdtsc() / fe->tsc_hz;
+    qid = 0;
     t = fe->extasks;
     while ( NULL != t ) {
-        ret = _init_extask_ring(fe, t, n, &port);
-        if ( ret < 0 ) {
+        t->nat.qid = qid;
+        t->nat.shard = fe_nat_shard_init(qid, fe->nxcpu, now);
+        if ( NULL == t->nat.shard ) {
             return -1;
         }
-
-        /* Next task */
+        qid++;
         t = t->next;
     }
 
-    /* Tickful task */
-    /* Rx from exclusive processors */
-    fe->tftask->rx.bitmap = (1ULL << fe->nxcpu) - 1;
-    fe->tftask->rx.rings
-        = _fe_alloc(fe, sizeof(struct fe_driver_rx) * fe->nxcpu);
-    if ( NULL == fe->tftask->rx.rings ) {
+    return 0;
+}
+
+/*
+ * Initialize the tunnel endpoint and a copy of the configuration per
+ * exclusive task; disabled
+ */
+int
+fe_init_tunnel(struct fe *fe)
+{
+    struct pix_fe_tunnel_conf *conf;
+    struct fe_task *t;
+    uint8_t zero[6];
+
+    /* Configured from other processes (e.g., pash) if possible */
+    conf = pix_shm_create(PIX_FE_TUNNEL_SHM,
+                          sizeof(struct pix_fe_tunnel_conf));
+    if ( NULL == conf ) {
+        conf = malloc(sizeof(struct pix_fe_tunnel_conf));
+        if ( NULL == conf ) {
+            return -1;
+        }
+    }
+    memset(conf, 0, sizeof(struct pix_fe_tunnel_conf));
+    conf->dport = FE_TUNNEL_VXLAN_PORT;
+    fe->tunnel.conf = conf;
+    fe->tunnel.cgen = 0;
+    fe->tunnel.fdb = fdb_init();
+    if ( NULL == fe->tunnel.fdb ) {
         return -1;
     }
+
+    memset(zero, 0, sizeof(zero));
     t = fe->extasks;
-    i = 0;
     while ( NULL != t ) {
-        fe->tftask->rx.rings[i].driver = FE_DRIVER_KERNEL;
-        fe->tftask->rx.rings[i].u.kernel = t->ktx;
-        /* Next task */
+        t->tunnel.tun = malloc(sizeof(struct fe_tunnel));
+        if ( NULL == t->tunnel.tun ) {
+            return -1;
+        }
+        fe_tunnel_init(t->tunnel.tun, FE_TUNNEL_NONE, -1, 0, zero, 0);
         t = t->next;
-        i++;
     }
 
-    /* Tx */
-    fe->tftask->tx.rings
-        = _fe_alloc(fe, sizeof(struct fe_driver_tx) * fe->nports);
-    if ( NULL == fe->tftask->tx.rings ) {
-        return -1;
-    }
-    /* Physical ports */
-    for ( i = 0; i < (ssize_t)fe->nports; i++ ) {
-        fe->tftask->tx.rings[i].driver = fe->ports[i]->driver;
+    return 0;
+}
 
-        sz = fe_driver_calc_tx_ring_memsize(&fe->tftask->tx.rings[i], FE_QLEN);
-        if ( sz < 0 ) {
+/*
+ * Initialize the Flow Director filter table of each ixgbe port; disabled
+ */
+int
+fe_init_fdir(struct fe *fe)
+{
+    struct pix_fe_fdir_conf *conf;
+    ssize_t i;
+
+    /* Configured from other processes (e.g., pash) if possible */
+    conf = pix_shm_create(PIX_FE_FDIR_SHM, sizeof(struct pix_fe_fdir_conf));
+    if ( NULL == conf ) {
+        conf = malloc(sizeof(struct pix_fe_fdir_conf));
+        if ( NULL == conf ) {
             return -1;
         }
-        m = _fe_alloc(fe, sz);
-        if ( NULL == m ) {
-            return -1;
+    }
+    memset(conf, 0, sizeof(struct pix_fe_fdir_conf));
+    fe->fdir.conf = conf;
+    fe->fdir.cgen = 0;
+
+    for ( i = 0; i < FE_MAX_PORTS; i++ ) {
+        fe->fdir.tbls[i] = NULL;
+    }
+    for ( i = 0; i < (ssize_t)fe->nports && i < PIX_FE_STATS_MAX_PORTS; i++ ) {
+        if ( FE_DRIVER_IXGBE != fe->ports[i]->driver ) {
+            continue;
         }
-        ret = fe_driver_setup_tx_ring(fe->ports[i], &fe->tftask->tx.rings[i], m,
-                                      fe->mem.v2poff, FE_QLEN);
-        if ( ret < 0 ) {
+        fe->fdir.tbls[i] = malloc(sizeof(struct fe_fdir_table));
+        if ( NULL == fe->fdir.tbls[i] ) {
             return -1;
         }
+        fe_fdir_table_reset(fe->fdir.tbls[i], FE_FDIR_NONE);
+    }
+
+    return 0;
+}
+
+/*
+ * Estimate the frequency of the time stamp counter
+ */
+int
+fe_init_tsc(struct fe *fe)
+{
+    struct timeval tv0;
+    struct timeval tv1;
+    struct timespec tm;
+    uint64_t tsc0;
+    uint64_t tsc1;
+    int64_t usec;
+
+    tm.tv_sec = 0;
+    tm.tv_nsec = 100000000;
+    gettimeofday(&tv0, NULL);
+    tsc0 = fdb_rdtsc();
+    nanosleep(&tm, NULL);
+    gettimeofday(&tv1, NULL);
+    tsc1 = fdb_rdtsc();
+    usec = (int64_t)(tv1.tv_sec - tv0.tv_sec) * 1000000
+        + (tv1.tv_usec - tv0.tv_usec);
+    if ( usec > 0 ) {
+        fe->tsc_hz = (tsc1 - tsc0) / usec * 1000000;
+    } else {
+        fe->tsc_hz = FE_DEFAULT_TSC_HZ;
     }
 
     return 0;
@@ -740,6 +3650,24 @@ fe_init(struct fe *fe)
     memset(fe->ports, 0, sizeof(struct fe_device *) * FE_MAX_PORTS);
     fe->tftask = NULL;
     fe->extasks = NULL;
+    fe->stats = NULL;
+    fe->capture.conf = NULL;
+    fe->capture.fd = -1;
+    fe->pktgen = NULL;
+    fe->poll = NULL;
+    fe->pipeline = NULL;
+    fe->filter.conf = NULL;
+    fe->filter.prog = NULL;
+    fe->filter.code = NULL;
+    fe->qos = NULL;
+    fe->lag.conf = NULL;
+    fe->lag.tbl = NULL;
+    fe->storm = NULL;
+    fe->mcast.conf = NULL;
+    fe->mcast.tbl = NULL;
+    fe->nat = NULL;
+    fe->tunnel.conf = NULL;
+    fe->tunnel.fdb = NULL;
 
     /* Initialize the forwarding database */
     fe->fdb = fdb_init();
@@ -785,6 +3713,103 @@ fe_init(struct fe *fe)
     /* Release PCI memory */
     pci_release(pci);
 
+    /* Estimate the TSC frequency */
+    ret = fe_init_tsc(fe);
+    if ( ret < 0 ) {
+        return -1;
+    }
+
+    /* Initialize statistics */
+    ret = fe_init_stats(fe);
+    if ( ret < 0 ) {
+        printf("Failed to initialize statistics.\n");
+        return -1;
+    }
+
+    /* Initialize packet capture */
+    ret = fe_init_capture(fe);
+    if ( ret < 0 ) {
+        printf("Failed to initialize packet capture.\n");
+        return -1;
+    }
+
+    /* Initialize packet generator */
+    ret = fe_init_pktgen(fe);
+    if ( ret < 0 ) {
+        printf("Failed to initialize packet generator.\n");
+        return -1;
+    }
+
+    /* Initialize polling mode */
+    ret = fe_init_poll(fe);
+    if ( ret < 0 ) {
+        printf("Failed to initialize polling mode.\n");
+        return -1;
+    }
+
+    /* Initialize the processing pipeline */
+    ret = fe_init_pipeline(fe);
+    if ( ret < 0 ) {
+        printf("Failed to initialize the pipeline.\n");
+        return -1;
+    }
+
+    /* Initialize the packet filter */
+    ret = fe_init_filter(fe);
+    if ( ret < 0 ) {
+        printf("Failed to initialize the packet filter.\n");
+        return -1;
+    }
+
+    /* Initialize the QoS schedulers */
+    ret = fe_init_qos(fe);
+    if ( ret < 0 ) {
+        printf("Failed to initialize QoS.\n");
+        return -1;
+    }
+
+    /* Initialize link aggregation */
+    ret = fe_init_lag(fe);
+    if ( ret < 0 ) {
+        printf("Failed to initialize link aggregation.\n");
+        return -1;
+    }
+
+    /* Initialize storm control */
+    ret = fe_init_storm(fe);
+    if ( ret < 0 ) {
+        printf("Failed to initialize storm control.\n");
+        return -1;
+    }
+
+    /* Initialize IGMP snooping */
+    ret = fe_init_mcast(fe);
+    if ( ret < 0 ) {
+        printf("Failed to initialize IGMP snooping.\n");
+        return -1;
+    }
+
+    /* Initialize NAT44 */
+    ret = fe_init_nat(fe);
+    if ( ret < 0 ) {
+        printf("Failed to initialize NAT44.\n");
+        return -1;
+    }
+
+    /* Initialize the tunnel endpoint */
+    ret = fe_init_tunnel(fe);
+    if ( ret < 0 ) {
+        printf("Failed to initialize the tunnel endpoint.\n");
+        return -1;
+    }
+
+    /* Initialize the Flow Director filters */
+    ret = fe_init_fdir(fe);
+    if ( ret < 0 ) {
+        printf("Failed to initialize the Flow Director filters.\n");
+        return -1;
+    }
+
     /* Check the number of exclusive CPUs and the number of ports whether each
        port supports fast-path */
     ret = fe_init_device_type(fe);
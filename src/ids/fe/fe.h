@@ -25,12 +25,25 @@
 #define _FE_H
 
 #include <sys/pix.h>
+#include <sys/time.h>
 #include "e1000.h"
 #include "e1000e.h"
 #include "igb.h"
 #include "ixgbe.h"
 #include "i40e.h"
+#include "virtio.h"
 #include "fdb.h"
+#include "capture.h"
+#include "pktgen.h"
+#include "pipeline.h"
+#include "filter.h"
+#include "qos.h"
+#include "lag.h"
+#include "mcast.h"
+#include "nat.h"
+#include "tunnel.h"
+#include "offload.h"
+#include "fdir.h"
 
 #define FE_MAX_PORTS            64
 
@@ -40,8 +53,44 @@
 
 #define FE_QLEN                 512
 
+/* Max # of packets dequeued from an Rx ring at once (one pipeline vector) */
+#define FE_RX_BURST             FE_PIPELINE_VECSZ
+/* Default prefetch distance (in descriptors) in the Rx path */
+#define FE_RX_PREFETCH          4
+/* Max # of buffers reclaimed from a Tx ring at once */
+#define FE_TX_COLLECT_BATCH     32
+/* Max # of packets moved from a QoS scheduler to a Tx ring at once */
+#define FE_QOS_TX_BATCH         64
+/* # of descriptors in flight to start reclaiming from a hardware Tx ring */
+#define FE_TX_COLLECT_THRESH    64
+
 #define FE_MEMSIZE_FOR_DESCS    (1ULL << 24)
 
+/* Interval to run the LACP timers of the tickful task */
+#define FE_LAG_TICK_TSC         (1ULL * 10000000)
+
+/* Interval to age the multicast groups snooped */
+#define FE_MCAST_AGE_TSC        (1ULL * 1000000000)
+/* Default membership timeout (group membership interval) in seconds */
+#define FE_MCAST_TIMEOUT        260
+
+/* Max # of connections visited per loop of an exclusive task to expire */
+#define FE_NAT_EXPIRE_BUDGET    64
+
+/* Interval to read the hardware statistics counters */
+#define FE_HW_STATS_TSC         (1ULL * 1000000000)
+
+/* Default output of the packet capture */
+#define FE_CAPTURE_DEV          "/dev/ttys0"
+/* Max # of captured packets written out at once */
+#define FE_CAPTURE_BATCH        32
+
+/* Default # of consecutive empty polls before sleeping in the adaptive mode */
+#define FE_POLL_IDLE_POLLS      4096
+
+/* TSC frequency assumed if it cannot be estimated */
+#define FE_DEFAULT_TSC_HZ       1000000000ULL
+
 
 /*
  * Driver type
@@ -53,6 +102,7 @@ enum fe_driver_type {
     FE_DRIVER_IGB,
     FE_DRIVER_IXGBE,
     FE_DRIVER_I40E,
+    FE_DRIVER_VIRTIO,
 };
 
 /*
@@ -63,6 +113,8 @@ struct fe_pkt_buf_hdr {
     int refs;
     /* Inheritted from fpp */
     int port;
+    /* Rx metadata from the NIC, and the Tx offloads requested */
+    struct fe_offload ol;
 };
 
 /*
@@ -82,10 +134,23 @@ struct fe_kernel_desc {
     void *pkt;
     uint16_t length;
     uint16_t port;              /* Outgoing port */
-    uint16_t mode;              /* 0: pkt forwarding, 1: control */
+    uint16_t mode;              /* FE_KERNEL_PKT or FE_KERNEL_CMD_* */
     uint16_t rsvd[1];
 } __attribute__ ((packed));
 
+/* Modes of the descriptors */
+#define FE_KERNEL_PKT           0       /* Packet forwarding */
+#define FE_KERNEL_CMD_LEARN     1       /* Learn a MAC address */
+#define FE_KERNEL_CMD_MCAST     2       /* IGMP snooping */
+#define FE_KERNEL_CMD_VTEP      3       /* Learn a remote VTEP */
+/* Command dequeued: the mode and the port in place of the header */
+#define FE_KERNEL_CMD(mode, port)       (((uint64_t)(mode) << 16) | (port))
+#define FE_KERNEL_CMD_MODE(cmd)         ((int)((cmd) >> 16))
+#define FE_KERNEL_CMD_PORT(cmd)         ((int)((cmd) & 0xffff))
+
+/* Port of a packet passed to the tickful task (ORed with the ingress port) */
+#define FE_KERNEL_PUNT          0x8000
+
 /*
  * Kernel ring buffer
  */
@@ -103,6 +168,17 @@ struct fe_kernel_ring {
     uint16_t len;
 };
 
+/*
+ * Doorbell to wake up a sleeping exclusive task (in its own cache line to be
+ * monitored)
+ */
+struct fe_doorbell {
+    /* Time stamp counter when the doorbell was rung */
+    volatile uint64_t tsc;
+    /* Whether the task is sleeping */
+    volatile int sleeping;
+} __attribute__ ((aligned(128)));
+
 /*
  * Driver
  */
@@ -111,11 +187,15 @@ struct fe_driver_rx {
     enum fe_driver_type driver;
     /* Port # */
     int port;
+    /* Cache placement applied (PIX_FE_POLL_PLACE_*) */
+    int place;
     union {
         struct fe_kernel_ring *kernel;
         struct e1000_rx_ring e1000;
         struct igb_rx_ring igb;
         struct ixgbe_rx_ring ixgbe;
+        struct i40e_rx_ring i40e;
+        struct virtio_rx_ring virtio;
     } u;
 };
 struct fe_driver_tx {
@@ -126,7 +206,11 @@ struct fe_driver_tx {
         struct e1000_tx_ring e1000;
         struct igb_tx_ring igb;
         struct ixgbe_tx_ring ixgbe;
+        struct i40e_tx_ring i40e;
+        struct virtio_tx_ring virtio;
     } u;
+    /* # of buffers in flight (hardware rings only) */
+    int pending;
 };
 
 /*
@@ -142,9 +226,100 @@ struct fe_task {
     /* Buffer pool */
     struct fe_buffer_pool pool;
 
+    /* Statistics (written only by this task) */
+    struct pix_fe_task_stats *stats;
+
     /* Kernel Tx */
     struct fe_kernel_ring *ktx;
 
+    /* Packet capture (copy of the configuration for the fast path) */
+    struct {
+        struct fe_capture_ring *ring;
+        uint64_t gen;
+        uint64_t ports;
+        uint16_t ethertype;
+        int snaplen;
+        int sampling;
+        int count;
+    } capture;
+
+    /* Packet generator */
+    struct fe_pktgen pktgen;
+
+    /* Processing pipeline */
+    struct fe_pipeline pipeline;
+
+    /* Packet filter (the program published by the tickful task) */
+    struct {
+        /* Generation acknowledged (read by the tickful task) */
+        volatile uint64_t gen;
+        struct fe_filter_prog *prog;
+        struct fe_filter_ctx ctx;
+    } filter;
+
+    /* QoS scheduler per Tx port (the configuration applied) */
+    struct {
+        uint64_t gen;
+        /* Bitmap of the ports scheduled */
+        uint64_t ports;
+        struct fe_qos_map map;
+        /* # of packets queued in all the ports */
+        int backlog;
+        struct fe_qos_sched *scheds;
+    } qos;
+
+    /* Link aggregation (the table published by the tickful task) */
+    struct {
+        /* Generation acknowledged (read by the tickful task) */
+        volatile uint64_t gen;
+        const struct fe_lag_table *tbl;
+    } lag;
+
+    /* Storm control per Rx port and class (the configuration applied) */
+    struct {
+        uint64_t gen;
+        /* Bitmap of the ports controlled */
+        uint64_t ports;
+        struct fe_qos_tb *tbs;
+    } storm;
+
+    /* IGMP snooping (the table published by the tickful task, or NULL) */
+    struct {
+        /* Generation acknowledged (read by the tickful task) */
+        volatile uint64_t gen;
+        const struct fe_mcast_table *tbl;
+    } mcast;
+
+    /* NAT44 (the shard of the connection tracking table of this task) */
+    struct {
+        uint64_t gen;
+        /* Bitmaps of the inside and the outside ports */
+        uint64_t inside;
+        uint64_t outside;
+        /* Rx queue of this task on the ports spread */
+        int qid;
+        struct fe_nat_shard *shard;
+    } nat;
+
+    /* Tunnel endpoint (the configuration applied) */
+    struct {
+        uint64_t gen;
+        struct fe_tunnel *tun;
+        /* Copies of the flooded frames to the remote VTEPs */
+        struct fe_pipeline_vec reps;
+    } tunnel;
+
+    /* Adaptive polling */
+    struct {
+        uint64_t gen;
+        /* # of consecutive empty polls before sleeping, or 0 for busy poll */
+        int threshold;
+        int idle;
+        /* Prefetch distance in the Rx path (0 to disable) */
+        int prefetch;
+        struct fe_doorbell *doorbell;
+    } poll;
+
     /* Handling Rx queues */
     struct {
         uint64_t bitmap;
@@ -179,9 +354,13 @@ struct fe_device {
         struct e1000_device *e1000;
         struct igb_device *igb;
         struct ixgbe_device *ixgbe;
+        struct i40e_device *i40e;
+        struct virtio_device *virtio;
     } u;
     /* Type; exclusive or kernel */
     int fastpath;
+    /* Rx spread over all the exclusive tasks (multi-queue) */
+    int spread;
 };
 
 /*
@@ -206,6 +385,121 @@ struct fe {
     /* Exclusive CPU tasks (linked list) */
     struct fe_task *extasks;
 
+    /* Frequency of the time stamp counter */
+    uint64_t tsc_hz;
+
+    /* Statistics (shared memory) */
+    struct pix_fe_stats *stats;
+
+    /* Packet capture (configuration in shared memory and pcap output) */
+    struct {
+        struct pix_fe_capture_conf *conf;
+        uint64_t gen;
+        int fd;
+        /* Base time to calculate time stamps */
+        uint64_t base_tsc;
+        struct timeval base_tv;
+    } capture;
+
+    /* Packet generator configuration (shared memory) */
+    struct pix_fe_pktgen_conf *pktgen;
+
+    /* Polling configuration (shared memory) */
+    struct pix_fe_poll_conf *poll;
+
+    /* Pipeline configuration (shared memory) */
+    struct pix_fe_pipeline_conf *pipeline;
+
+    /* Packet filter */
+    struct {
+        /* Configuration (shared memory) */
+        struct pix_fe_filter_conf *conf;
+        /* Generation of the configuration loaded */
+        uint64_t cgen;
+        /* Generation of the program published to the tasks */
+        volatile uint64_t gen;
+        /* Program in use, or NULL */
+        struct fe_filter_prog *volatile prog;
+        /* Two slots swapped on update, and the one in use */
+        struct fe_filter_prog *progs[2];
+        int cur;
+        /* Executable memory for the JIT-compiled code of the two slots */
+        void *code;
+    } filter;
+
+    /* QoS configuration (shared memory) */
+    struct pix_fe_qos_conf *qos;
+
+    /* Link aggregation */
+    struct {
+        /* Configuration (shared memory) */
+        struct pix_fe_lag_conf *conf;
+        /* Generation of the configuration loaded */
+        uint64_t cgen;
+        /* Generation of the table published to the tasks */
+        volatile uint64_t gen;
+        /* Table in use, and two slots swapped on update */
+        struct fe_lag_table *volatile tbl;
+        struct fe_lag_table *tbls[2];
+        int cur;
+        /* Members of each group, and the members distributing */
+        uint64_t members[FE_LAG_MAX];
+        uint64_t active[FE_LAG_MAX];
+        /* Bitmap of the members of the groups negotiated by LACP */
+        uint64_t lacp;
+        /* Table to be rebuilt */
+        int dirty;
+        /* LACP state per port */
+        struct fe_lacp_port ports[FE_MAX_PORTS];
+        uint64_t last_tsc;
+    } lag;
+
+    /* Storm control configuration (shared memory) */
+    struct pix_fe_storm_conf *storm;
+
+    /* IGMP snooping */
+    struct {
+        /* Configuration (shared memory) */
+        struct pix_fe_mcast_conf *conf;
+        /* Generation of the configuration loaded */
+        uint64_t cgen;
+        /* Generation of the table published to the tasks */
+        volatile uint64_t gen;
+        /* Table in use (NULL if disabled), and two slots swapped on update */
+        struct fe_mcast_table *volatile tbl;
+        struct fe_mcast_table *tbls[2];
+        int cur;
+        /* Enabled by the configuration, and the membership */
+        int enabled;
+        struct fe_mcast_db *db;
+        /* Table to be rebuilt */
+        int dirty;
+        uint64_t last_tsc;
+    } mcast;
+
+    /* NAT44 configuration (shared memory) */
+    struct pix_fe_nat_conf *nat;
+
+    /* Tunnel endpoint */
+    struct {
+        /* Configuration (shared memory) */
+        struct pix_fe_tunnel_conf *conf;
+        /* Generation of the configuration loaded */
+        uint64_t cgen;
+        /* Remote VTEP of each MAC address per VNI (learned) */
+        struct fdb *fdb;
+    } tunnel;
+
+    /* Flow Director */
+    struct {
+        /* Configuration (shared memory) */
+        struct pix_fe_fdir_conf *conf;
+        /* Generation of the configuration loaded */
+        uint64_t cgen;
+        /* Filters installed per port */
+        struct fe_fdir_table *tbls[FE_MAX_PORTS];
+    } fdir;
+
     /* Memory space for descriptors */
     struct {
         void *vaddr;
@@ -226,6 +520,7 @@ fe_get_buffer(struct fe_task *fet)
     pkt = fet->pool.head;
     if ( NULL != fet->pool.head ) {
         fet->pool.head = fet->pool.head->next;
+        pkt->ol.flags = 0;
     }
 
     return pkt;
@@ -272,62 +567,114 @@ fe_kernel_collect_buffer(struct fe_kernel_ring *ring, void **hdr)
 }
 
 /*
- * Collect buffer from Tx
+ * Reclaim up to FE_TX_COLLECT_BATCH transmitted buffers from a Tx ring
  */
 static __inline__ int
-fe_collect_buffer(struct fe_task *t, struct fe_driver_tx *tx)
+fe_reclaim_buffer(struct fe_task *t, struct fe_driver_tx *tx)
 {
-    int ret;
+    void *hdrs[FE_TX_COLLECT_BATCH];
     struct fe_pkt_buf_hdr *hdr;
+    int n;
+    int i;
 
     switch ( tx->driver ) {
     case FE_DRIVER_KERNEL:
-        ret = fe_kernel_collect_buffer(tx->u.kernel, (void **)&hdr);
-        if ( ret > 0 ) {
-            if ( NULL != hdr ) {
-                hdr->refs--;
-                if ( hdr->refs <= 0 ) {
-                    fe_release_buffer(t, hdr);
-                }
+        for ( n = 0; n < FE_TX_COLLECT_BATCH; n++ ) {
+            if ( fe_kernel_collect_buffer(tx->u.kernel, &hdrs[n]) <= 0 ) {
+                break;
             }
         }
-        return 0;
+        break;
 
     case FE_DRIVER_E1000:
-        ret = e1000_collect_buffer(&tx->u.e1000, (void **)&hdr);
-        if ( ret > 0 ) {
-            hdr->refs--;
-            if ( hdr->refs <= 0 ) {
-                fe_release_buffer(t, hdr);
-            }
+        if ( tx->pending <= 0 ) {
+            return 0;
         }
-        return 0;
+        n = e1000_collect_buffers(&tx->u.e1000, hdrs, FE_TX_COLLECT_BATCH);
+        tx->pending -= n;
+        break;
 
     case FE_DRIVER_IGB:
-        ret = igb_collect_buffer(&tx->u.igb, (void **)&hdr);
-        if ( ret > 0 ) {
-            hdr->refs--;
-            if ( hdr->refs <= 0 ) {
-                fe_release_buffer(t, hdr);
-            }
+        if ( tx->pending <= 0 ) {
+            return 0;
         }
-        return 0;
+        n = igb_collect_buffers(&tx->u.igb, hdrs, FE_TX_COLLECT_BATCH);
+        tx->pending -= n;
+        break;
 
     case FE_DRIVER_IXGBE:
-        ret = ixgbe_collect_buffer(&tx->u.ixgbe, (void **)&hdr);
-        if ( ret > 0 ) {
-            hdr->refs--;
-            if ( hdr->refs <= 0 ) {
-                fe_release_buffer(t, hdr);
-            }
+        if ( tx->pending <= 0 ) {
+            return 0;
         }
-        return 0;
+        n = ixgbe_collect_buffers(&tx->u.ixgbe, hdrs, FE_TX_COLLECT_BATCH);
+        tx->pending -= n;
+        break;
+
+    case FE_DRIVER_I40E:
+        if ( tx->pending <= 0 ) {
+            return 0;
+        }
+        n = i40e_collect_buffers(&tx->u.i40e, hdrs, FE_TX_COLLECT_BATCH);
+        tx->pending -= n;
+        break;
+
+    case FE_DRIVER_VIRTIO:
+        if ( tx->pending <= 0 ) {
+            return 0;
+        }
+        n = virtio_collect_buffers(&tx->u.virtio, hdrs, FE_TX_COLLECT_BATCH);
+        tx->pending -= n;
+        break;
 
     default:
-        ;
+        return -1;
     }
 
-    return -1;
+    for ( i = 0; i < n; i++ ) {
+        hdr = hdrs[i];
+        if ( NULL == hdr ) {
+            /* Command */
+            continue;
+        }
+        hdr->refs--;
+        if ( hdr->refs <= 0 ) {
+            fe_release_buffer(t, hdr);
+        }
+    }
+
+    return n;
+}
+
+/*
+ * Collect buffers from Tx.  Hardware rings are reclaimed only once
+ * FE_TX_COLLECT_THRESH descriptors are in flight so that the write-back is
+ * checked once per batch instead of once per packet.
+ */
+static __inline__ int
+fe_collect_buffer(struct fe_task *t, struct fe_driver_tx *tx)
+{
+    if ( FE_DRIVER_KERNEL != tx->driver
+         && tx->pending < FE_TX_COLLECT_THRESH ) {
+        return 0;
+    }
+
+    return fe_reclaim_buffer(t, tx);
+}
+
+/*
+ * Collect buffers written out by the capture consumer
+ */
+static __inline__ void
+fe_collect_capture_buffer(struct fe_task *t)
+{
+    struct fe_pkt_buf_hdr *hdr;
+
+    while ( fe_capture_collect(t->capture.ring, (void **)&hdr) > 0 ) {
+        hdr->refs--;
+        if ( hdr->refs <= 0 ) {
+            fe_release_buffer(t, hdr);
+        }
+    }
 }
 
 /*
@@ -343,6 +690,10 @@ fe_driver_max_tx_queues(struct fe_device *dev)
         return igb_max_tx_queues(dev->u.igb);
     case FE_DRIVER_IXGBE:
         return ixgbe_max_tx_queues(dev->u.ixgbe);
+    case FE_DRIVER_I40E:
+        return i40e_max_tx_queues(dev->u.i40e);
+    case FE_DRIVER_VIRTIO:
+        return virtio_max_tx_queues(dev->u.virtio);
     default:
         ;
     }
@@ -350,6 +701,47 @@ fe_driver_max_tx_queues(struct fe_device *dev)
     return 0;
 }
 
+/*
+ * The number of Rx queues that a port can be spread over (by RSS)
+ */
+static __inline__ int
+fe_driver_max_rx_queues(struct fe_device *dev)
+{
+    switch ( dev->driver ) {
+    case FE_DRIVER_IXGBE:
+        return ixgbe_max_rx_queues(dev->u.ixgbe);
+    case FE_DRIVER_I40E:
+        return i40e_max_rx_queues(dev->u.i40e);
+    case FE_DRIVER_VIRTIO:
+        return virtio_max_rx_queues(dev->u.virtio);
+    default:
+        ;
+    }
+
+    return 1;
+}
+
+/*
+ * The RSS hash key and the size of the lookup table (filled with the Rx
+ * queues in turn) of a port, or -1 if the port does not spread the Rx by RSS
+ */
+static __inline__ int
+fe_driver_rss_key(struct fe_device *dev, uint8_t *key, int len, int *lutsz)
+{
+    switch ( dev->driver ) {
+    case FE_DRIVER_IXGBE:
+        return ixgbe_rss_key(dev->u.ixgbe, key, len, lutsz);
+    case FE_DRIVER_I40E:
+        return i40e_rss_key(dev->u.i40e, key, len, lutsz);
+    case FE_DRIVER_VIRTIO:
+        return virtio_rss_key(dev->u.virtio, key, len, lutsz);
+    default:
+        ;
+    }
+
+    return -1;
+}
+
 /*
  * Setup an Rx ring
  */
@@ -382,6 +774,18 @@ fe_driver_setup_rx_ring(struct fe_device *dev, struct fe_driver_rx *rx, void *m,
         ret = ixgbe_setup_rx_ring(dev->u.ixgbe, &rx->u.ixgbe, dev->rxq_last, m,
                                   v2poff, qlen);
         break;
+
+    case FE_DRIVER_I40E:
+        dev->rxq_last++;
+        ret = i40e_setup_rx_ring(dev->u.i40e, &rx->u.i40e, dev->rxq_last, m,
+                                 v2poff, qlen);
+        break;
+
+    case FE_DRIVER_VIRTIO:
+        dev->rxq_last++;
+        ret = virtio_setup_rx_ring(dev->u.virtio, &rx->u.virtio, dev->rxq_last,
+                                   m, v2poff, qlen);
+        break;
     default:
         ret = -1;
     }
@@ -398,6 +802,8 @@ fe_driver_setup_tx_ring(struct fe_device *dev, struct fe_driver_tx *tx, void *m,
 {
     int ret;
 
+    tx->pending = 0;
+
     ret = -1;
     switch ( tx->driver ) {
     case FE_DRIVER_KERNEL:
@@ -422,6 +828,18 @@ fe_driver_setup_tx_ring(struct fe_device *dev, struct fe_driver_tx *tx, void *m,
                                   v2poff, qlen);
         break;
 
+    case FE_DRIVER_I40E:
+        dev->txq_last++;
+        ret = i40e_setup_tx_ring(dev->u.i40e, &tx->u.i40e, dev->txq_last, m,
+                                 v2poff, qlen);
+        break;
+
+    case FE_DRIVER_VIRTIO:
+        dev->txq_last++;
+        ret = virtio_setup_tx_ring(dev->u.virtio, &tx->u.virtio, dev->txq_last,
+                                   m, v2poff, qlen);
+        break;
+
     default:
         ret = -1;
     }
@@ -455,6 +873,14 @@ fe_driver_calc_rx_ring_memsize(struct fe_driver_rx *rx, uint16_t qlen)
         ret = ixgbe_calc_rx_ring_memsize(&rx->u.ixgbe, qlen);
         break;
 
+    case FE_DRIVER_I40E:
+        ret = i40e_calc_rx_ring_memsize(&rx->u.i40e, qlen);
+        break;
+
+    case FE_DRIVER_VIRTIO:
+        ret = virtio_calc_rx_ring_memsize(&rx->u.virtio, qlen);
+        break;
+
     default:
         ret = -1;
     }
@@ -488,6 +914,14 @@ fe_driver_calc_tx_ring_memsize(struct fe_driver_tx *tx, uint16_t qlen)
         ret = ixgbe_calc_tx_ring_memsize(&tx->u.ixgbe, qlen);
         break;
 
+    case FE_DRIVER_I40E:
+        ret = i40e_calc_tx_ring_memsize(&tx->u.i40e, qlen);
+        break;
+
+    case FE_DRIVER_VIRTIO:
+        ret = virtio_calc_tx_ring_memsize(&tx->u.virtio, qlen);
+        break;
+
     default:
         ret = -1;
     }
@@ -503,10 +937,12 @@ fe_driver_rx_refill(struct fe_task *t, struct fe_driver_rx *rx)
 {
     struct fe_pkt_buf_hdr *pkt;
     void *pa;
+    int ret;
 
     /* Try to get a packet buffer */
     pkt = fe_get_buffer(t);
     if ( NULL == pkt ) {
+        t->stats->drops.no_buffer++;
         return -1;
     }
     /* Resolve physical address */
@@ -514,22 +950,38 @@ fe_driver_rx_refill(struct fe_task *t, struct fe_driver_rx *rx)
 
     switch ( rx->driver ) {
     case FE_DRIVER_KERNEL:
+        ret = 0;
         break;
 
     case FE_DRIVER_E1000:
-        return e1000_rx_refill(&rx->u.e1000, pa + FE_PKT_HDROFF, pkt);
+        ret = e1000_rx_refill(&rx->u.e1000, pa + FE_PKT_HDROFF, pkt);
+        break;
 
     case FE_DRIVER_IGB:
-        return igb_rx_refill(&rx->u.igb, pa + FE_PKT_HDROFF, pkt);
+        ret = igb_rx_refill(&rx->u.igb, pa + FE_PKT_HDROFF, pkt);
+        break;
 
     case FE_DRIVER_IXGBE:
-        return ixgbe_rx_refill(&rx->u.ixgbe, pa + FE_PKT_HDROFF, pkt);
+        ret = ixgbe_rx_refill(&rx->u.ixgbe, pa + FE_PKT_HDROFF, pkt);
+        break;
+
+    case FE_DRIVER_I40E:
+        ret = i40e_rx_refill(&rx->u.i40e, pa + FE_PKT_HDROFF, pkt);
+        break;
+
+    case FE_DRIVER_VIRTIO:
+        ret = virtio_rx_refill(&rx->u.virtio, pa + FE_PKT_HDROFF, pkt);
+        break;
 
     default:
-        ;
+        ret = 0;
+    }
+    if ( ret <= 0 ) {
+        /* Not consumed by the ring, then return it to the pool */
+        fe_release_buffer(t, pkt);
     }
 
-    return 0;
+    return ret;
 }
 
 /*
@@ -573,6 +1025,14 @@ fe_driver_rx_commit(struct fe_driver_rx *rx)
         ixgbe_rx_commit(&rx->u.ixgbe);
         break;
 
+    case FE_DRIVER_I40E:
+        i40e_rx_commit(&rx->u.i40e);
+        break;
+
+    case FE_DRIVER_VIRTIO:
+        virtio_rx_commit(&rx->u.virtio);
+        break;
+
     default:
         ;
     }
@@ -599,8 +1059,8 @@ fe_kernel_rx_dequeue(struct fe_kernel_ring *ring, struct fe_pkt_buf_hdr **hdr,
     *pkt = ring->descs[ring->head].pkt;
     len = ring->descs[ring->head].length;
     port = ring->descs[ring->head].port;
-    if ( 1 == ring->descs[ring->head].mode ) {
-        *hdr = (void *)(uint64_t)port;
+    if ( FE_KERNEL_PKT != ring->descs[ring->head].mode ) {
+        *hdr = (void *)FE_KERNEL_CMD(ring->descs[ring->head].mode, port);
         len = 0;
     }
     __sync_synchronize();
@@ -608,6 +1068,7 @@ fe_kernel_rx_dequeue(struct fe_kernel_ring *ring, struct fe_pkt_buf_hdr **hdr,
 
     if ( len > 0 ) {
         (*hdr)->port = port;
+        (*hdr)->ol.flags = 0;
     }
 
     return len;
@@ -620,6 +1081,9 @@ static __inline__ int
 fe_driver_rx_dequeue(struct fe_driver_rx *rx, struct fe_pkt_buf_hdr **hdr,
                      void **pkt)
 {
+    struct fe_offload ol;
+    void *split;
+    int slen;
     int ret;
 
     switch ( rx->driver ) {
@@ -630,23 +1094,121 @@ fe_driver_rx_dequeue(struct fe_driver_rx *rx, struct fe_pkt_buf_hdr **hdr,
         ret = e1000_rx_dequeue(&rx->u.e1000, (void **)hdr);
         if ( ret > 0 ) {
             *pkt = (void *)*hdr + FE_PKT_HDROFF;
+            (*hdr)->ol.flags = 0;
         }
         return ret;
 
     case FE_DRIVER_IGB:
-        ret = igb_rx_dequeue(&rx->u.igb, (void **)hdr);
+        ret = igb_rx_dequeue(&rx->u.igb, (void **)hdr, &ol);
         if ( ret > 0 ) {
             *pkt = (void *)*hdr + FE_PKT_HDROFF;
+            (*hdr)->ol = ol;
         }
         return ret;
 
     case FE_DRIVER_IXGBE:
-        ret = ixgbe_rx_dequeue(&rx->u.ixgbe, (void **)hdr);
+        ret = ixgbe_rx_dequeue(&rx->u.ixgbe, (void **)hdr, &ol, &split,
+                               &slen);
+        if ( ret > 0 ) {
+            *pkt = (void *)*hdr + FE_PKT_HDROFF;
+            if ( slen > 0 ) {
+                /* Prepend the header split to the payload in the headroom */
+                *pkt -= slen;
+                memcpy(*pkt, split, slen);
+            }
+            (*hdr)->ol = ol;
+        }
+        return ret;
+
+    case FE_DRIVER_I40E:
+        ret = i40e_rx_dequeue(&rx->u.i40e, (void **)hdr);
         if ( ret > 0 ) {
             *pkt = (void *)*hdr + FE_PKT_HDROFF;
+            (*hdr)->ol.flags = 0;
         }
         return ret;
 
+    case FE_DRIVER_VIRTIO:
+        ret = virtio_rx_dequeue(&rx->u.virtio, (void **)hdr);
+        if ( ret > 0 ) {
+            *pkt = (void *)*hdr + FE_PKT_HDROFF;
+            (*hdr)->ol.flags = 0;
+        }
+        return ret;
+
+    default:
+        ;
+    }
+
+    return -1;
+}
+
+/*
+ * Switch the header split of an Rx ring, and return whether it is split.  The
+ * ring is restarted, and the packets received but not processed yet are
+ * dropped.  Only ixgbe supports it.
+ */
+static __inline__ int
+fe_driver_rx_hsplit(struct fe_task *t, struct fe_driver_rx *rx, int hsplit)
+{
+    void *hdr;
+
+    switch ( rx->driver ) {
+    case FE_DRIVER_IXGBE:
+        if ( !hsplit == !rx->u.ixgbe.hsplit ) {
+            return rx->u.ixgbe.hsplit;
+        }
+        if ( ixgbe_rx_stop(&rx->u.ixgbe) < 0 ) {
+            return -1;
+        }
+        while ( NULL != (hdr = ixgbe_rx_drain(&rx->u.ixgbe)) ) {
+            fe_release_buffer(t, hdr);
+        }
+        ixgbe_rx_start(&rx->u.ixgbe, hsplit);
+        fe_driver_rx_fill_all(t, rx);
+        fe_driver_rx_commit(rx);
+        return rx->u.ixgbe.hsplit;
+
+    default:
+        ;
+    }
+
+    return -1;
+}
+
+/*
+ * Tag the descriptors of an Rx ring (and the headers split, or the packets)
+ * for Direct Cache Access to a CPU, or untag them if cpu is negative, and set
+ * the descriptor write-back threshold.  Only ixgbe supports them.
+ */
+static __inline__ int
+fe_driver_rx_tune(struct fe_driver_rx *rx, int cpu, int wthresh)
+{
+    switch ( rx->driver ) {
+    case FE_DRIVER_IXGBE:
+        ixgbe_rx_dca(&rx->u.ixgbe, cpu);
+        ixgbe_rx_wthresh(&rx->u.ixgbe, wthresh);
+        return 0;
+
+    default:
+        ;
+    }
+
+    return -1;
+}
+
+/*
+ * Tag the descriptors of a Tx ring for Direct Cache Access to a CPU, or untag
+ * them if cpu is negative
+ */
+static __inline__ int
+fe_driver_tx_dca(struct fe_driver_tx *tx, int cpu)
+{
+    switch ( tx->driver ) {
+    case FE_DRIVER_IXGBE:
+        ixgbe_tx_dca(&tx->u.ixgbe, cpu);
+        return 0;
+
     default:
         ;
     }
@@ -654,6 +1216,77 @@ fe_driver_rx_dequeue(struct fe_driver_rx *rx, struct fe_pkt_buf_hdr **hdr,
     return -1;
 }
 
+/*
+ * Prefetch the descriptor and the packet k ahead of the head of an Rx ring
+ */
+static __inline__ void
+fe_driver_rx_prefetch(struct fe_driver_rx *rx, int k)
+{
+    void *hdr;
+
+    switch ( rx->driver ) {
+    case FE_DRIVER_E1000:
+        hdr = e1000_rx_prefetch(&rx->u.e1000, k);
+        break;
+
+    case FE_DRIVER_IGB:
+        hdr = igb_rx_prefetch(&rx->u.igb, k);
+        break;
+
+    case FE_DRIVER_IXGBE:
+        hdr = ixgbe_rx_prefetch(&rx->u.ixgbe, k);
+        break;
+
+    case FE_DRIVER_I40E:
+        hdr = i40e_rx_prefetch(&rx->u.i40e, k);
+        break;
+
+    case FE_DRIVER_VIRTIO:
+        hdr = virtio_rx_prefetch(&rx->u.virtio, k);
+        break;
+
+    default:
+        hdr = NULL;
+    }
+    if ( NULL != hdr ) {
+        /* Buffer header and Ethernet header */
+        __builtin_prefetch(hdr);
+        __builtin_prefetch(hdr + FE_PKT_HDROFF);
+    }
+}
+
+/*
+ * Check if a packet is ready in an Rx ring buffer without MMIO
+ */
+static __inline__ int
+fe_driver_rx_ready(struct fe_driver_rx *rx)
+{
+    switch ( rx->driver ) {
+    case FE_DRIVER_KERNEL:
+        return rx->u.kernel->rx_head != rx->u.kernel->tail;
+
+    case FE_DRIVER_E1000:
+        return e1000_rx_ready(&rx->u.e1000);
+
+    case FE_DRIVER_IGB:
+        return igb_rx_ready(&rx->u.igb);
+
+    case FE_DRIVER_IXGBE:
+        return ixgbe_rx_ready(&rx->u.ixgbe);
+
+    case FE_DRIVER_I40E:
+        return i40e_rx_ready(&rx->u.i40e);
+
+    case FE_DRIVER_VIRTIO:
+        return virtio_rx_ready(&rx->u.virtio);
+
+    default:
+        ;
+    }
+
+    return 0;
+}
+
 /*
  * Enqueue a data packet to a kernel Tx ring buffer
  */
@@ -684,7 +1317,8 @@ fe_kernel_tx_enqueue(struct fe_kernel_ring *ring, int port, void *pkt,
  * Enqueue a command packet to a kernel Tx ring buffer
  */
 static __inline__ int
-fe_kernel_cmd_enqueue(struct fe_kernel_ring *ring, uint64_t mac, int port)
+fe_kernel_cmd_enqueue(struct fe_kernel_ring *ring, int mode, uint64_t val,
+                      int port)
 {
     struct fe_kernel_desc *desc;
     uint16_t tail;
@@ -695,10 +1329,10 @@ fe_kernel_cmd_enqueue(struct fe_kernel_ring *ring, uint64_t mac, int port)
         return 0;
     }
     desc = &ring->descs[ring->tail];
-    desc->pkt = (void *)mac;
+    desc->pkt = (void *)val;
     desc->length = 0;
     desc->port = port;
-    desc->mode = 1;
+    desc->mode = mode;
     ring->bufs[ring->tail] = NULL;
 
     __sync_synchronize();
@@ -709,55 +1343,86 @@ fe_kernel_cmd_enqueue(struct fe_kernel_ring *ring, uint64_t mac, int port)
 }
 
 /*
- * Enqueue a packet to a Tx ring buffer
+ * Try to enqueue a packet to a Tx ring buffer; a full ring is not counted as
+ * a drop, so that the caller can retry later.  The checksums requested are
+ * inserted by igb and ixgbe, and in software for the others.
  */
 static __inline__ int
-fe_driver_tx_enqueue(struct fe_task *t, struct fe_driver_tx *tx, int port,
-                     void *pkt, struct fe_pkt_buf_hdr *hdr, size_t length)
+fe_driver_tx_try(struct fe_task *t, struct fe_driver_tx *tx, int port,
+                 void *pkt, struct fe_pkt_buf_hdr *hdr, size_t length)
 {
     int ret;
 
+    if ( (hdr->ol.flags & FE_OFFLOAD_TX_MASK)
+         && FE_DRIVER_IGB != tx->driver && FE_DRIVER_IXGBE != tx->driver ) {
+        fe_offload_tx_sw(&hdr->ol, pkt, length);
+    }
+
     switch ( tx->driver ) {
     case FE_DRIVER_KERNEL:
         ret = fe_kernel_tx_enqueue(tx->u.kernel, port, pkt, hdr, length);
-        if ( ret > 0 ) {
-            /* Increment the reference counter */
-            hdr->refs++;
-        }
-        return ret;
+        break;
 
     case FE_DRIVER_E1000:
         pkt = fe_v2p(t, pkt);
         ret = e1000_tx_enqueue(&tx->u.e1000, pkt, hdr, length);
-        if ( ret > 0 ) {
-            /* Increment the reference counter */
-            hdr->refs++;
-        }
-        return ret;
+        break;
 
     case FE_DRIVER_IGB:
         pkt = fe_v2p(t, pkt);
-        ret = igb_tx_enqueue(&tx->u.igb, pkt, hdr, length);
-        if ( ret > 0 ) {
-            /* Increment the reference counter */
-            hdr->refs++;
-        }
-        return ret;
+        ret = igb_tx_enqueue(&tx->u.igb, pkt, hdr, length, &hdr->ol);
+        break;
 
     case FE_DRIVER_IXGBE:
         pkt = fe_v2p(t, pkt);
-        ret = ixgbe_tx_enqueue(&tx->u.ixgbe, pkt, hdr, length);
-        if ( ret > 0 ) {
-            /* Increment the reference counter */
-            hdr->refs++;
-        }
-        return ret;
+        ret = ixgbe_tx_enqueue(&tx->u.ixgbe, pkt, hdr, length, &hdr->ol);
+        break;
+
+    case FE_DRIVER_I40E:
+        pkt = fe_v2p(t, pkt);
+        ret = i40e_tx_enqueue(&tx->u.i40e, pkt, hdr, length);
+        break;
+
+    case FE_DRIVER_VIRTIO:
+        /* The virtio-net header is written in the headroom */
+        ret = virtio_tx_enqueue(&tx->u.virtio, fe_v2p(t, pkt), pkt, hdr,
+                                length);
+        break;
 
     default:
-        ;
+        return -1;
     }
 
-    return -1;
+    if ( ret > 0 ) {
+        /* Increment the reference counter */
+        hdr->refs++;
+        if ( FE_DRIVER_KERNEL != tx->driver ) {
+            tx->pending++;
+        }
+        t->stats->ports[port].tx_pkts++;
+        t->stats->ports[port].tx_bytes += length;
+    }
+
+    return ret;
+}
+
+/*
+ * Enqueue a packet to a Tx ring buffer
+ */
+static __inline__ int
+fe_driver_tx_enqueue(struct fe_task *t, struct fe_driver_tx *tx, int port,
+                     void *pkt, struct fe_pkt_buf_hdr *hdr, size_t length)
+{
+    int ret;
+
+    ret = fe_driver_tx_try(t, tx, port, pkt, hdr, length);
+    if ( 0 == ret ) {
+        /* Ring is full */
+        t->stats->ports[port].tx_drops++;
+        t->stats->drops.ring_full++;
+    }
+
+    return ret;
 }
 
 /*
@@ -779,6 +1444,36 @@ fe_driver_tx_commit(struct fe_driver_tx *tx)
     case FE_DRIVER_IXGBE:
         ixgbe_tx_commit(&tx->u.ixgbe);
         break;
+    case FE_DRIVER_I40E:
+        i40e_tx_commit(&tx->u.i40e);
+        break;
+    case FE_DRIVER_VIRTIO:
+        virtio_tx_commit(&tx->u.virtio);
+        break;
+    default:
+        ;
+    }
+}
+
+/*
+ * Accumulate the hardware statistics counters of a device
+ */
+static __inline__ void
+fe_driver_read_hw_stats(struct fe_device *dev, struct pix_fe_hw_stats *st)
+{
+    switch ( dev->driver ) {
+    case FE_DRIVER_E1000:
+        e1000_read_hw_stats(dev->u.e1000, st);
+        break;
+    case FE_DRIVER_IGB:
+        igb_read_hw_stats(dev->u.igb, st);
+        break;
+    case FE_DRIVER_IXGBE:
+        ixgbe_read_hw_stats(dev->u.ixgbe, st);
+        break;
+    case FE_DRIVER_I40E:
+        i40e_read_hw_stats(dev->u.i40e, st);
+        break;
     default:
         ;
     }
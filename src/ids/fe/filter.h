@@ -0,0 +1,1049 @@
+/*_
+ * Copyright (c) 2017 Hirochika Asai <asai@jar.jp>
+ * All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef _FILTER_H
+#define _FILTER_H
+
+/*
+ * Packet filter: a classic BPF compatible bytecode (e.g., the output of
+ * `tcpdump -dd') extended with calls to helpers, its verifier, interpreter,
+ * and x86-64 JIT compiler.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include "fdb.h"
+
+/* Limits */
+#define FE_FILTER_MAX_INSNS     256
+#define FE_FILTER_MEMWORDS      16
+#define FE_FILTER_NCOUNTERS     16
+/* Max offset of a packet load */
+#define FE_FILTER_MAX_OFF       0xffff
+
+/* Instruction classes */
+#define FE_FILTER_LD            0x00
+#define FE_FILTER_LDX           0x01
+#define FE_FILTER_ST            0x02
+#define FE_FILTER_STX           0x03
+#define FE_FILTER_ALU           0x04
+#define FE_FILTER_JMP           0x05
+#define FE_FILTER_RET           0x06
+#define FE_FILTER_MISC          0x07
+#define FE_FILTER_CLASS(code)   ((code) & 0x07)
+/* Load sizes */
+#define FE_FILTER_W             0x00
+#define FE_FILTER_H             0x08
+#define FE_FILTER_B             0x10
+/* Load modes */
+#define FE_FILTER_IMM           0x00
+#define FE_FILTER_ABS           0x20
+#define FE_FILTER_IND           0x40
+#define FE_FILTER_MEM           0x60
+#define FE_FILTER_LEN           0x80
+#define FE_FILTER_MSH           0xa0
+/* ALU operations */
+#define FE_FILTER_ADD           0x00
+#define FE_FILTER_SUB           0x10
+#define FE_FILTER_MUL           0x20
+#define FE_FILTER_DIV           0x30
+#define FE_FILTER_OR            0x40
+#define FE_FILTER_AND           0x50
+#define FE_FILTER_LSH           0x60
+#define FE_FILTER_RSH           0x70
+#define FE_FILTER_NEG           0x80
+#define FE_FILTER_MOD           0x90
+#define FE_FILTER_XOR           0xa0
+/* Jumps */
+#define FE_FILTER_JA            0x00
+#define FE_FILTER_JEQ           0x10
+#define FE_FILTER_JGT           0x20
+#define FE_FILTER_JGE           0x30
+#define FE_FILTER_JSET          0x40
+/* Sources */
+#define FE_FILTER_K             0x00
+#define FE_FILTER_X             0x08
+/* Return value */
+#define FE_FILTER_A             0x10
+/* Miscellaneous */
+#define FE_FILTER_TAX           0x00
+#define FE_FILTER_TXA           0x80
+#define FE_FILTER_CALL          0x40    /* Extension: A = helper k (A, X) */
+
+/* Helpers */
+#define FE_FILTER_FN_PORT       0       /* Ingress port */
+#define FE_FILTER_FN_FDB_DST    1       /* FDB port of the destination */
+#define FE_FILTER_FN_FDB_SRC    2       /* FDB port of the source */
+#define FE_FILTER_FN_COUNT      3       /* Increment counter X, and keep A */
+#define FE_FILTER_NFN           4
+/* Returned by the FDB helpers if not found */
+#define FE_FILTER_NOTFOUND      0xffffffffUL
+
+/* Verdicts: 0 to drop, FE_FILTER_FWD(port) to forward, others to pass */
+#define FE_FILTER_DROP          0
+#define FE_FILTER_FWD_MASK      0xffff0000UL
+#define FE_FILTER_FWD(port)     (0x80000000UL | (port))
+#define FE_FILTER_IS_FWD(r)                                             \
+    (((r) & FE_FILTER_FWD_MASK) == (FE_FILTER_FWD(0) & FE_FILTER_FWD_MASK))
+
+/* Executable memory per JIT-compiled program */
+#define FE_FILTER_JIT_SIZE      (64 * 1024)
+
+/*
+ * Instruction (same layout as struct sock_filter)
+ */
+struct fe_filter_insn {
+    uint16_t code;
+    uint8_t jt;
+    uint8_t jf;
+    uint32_t k;
+};
+
+/*
+ * Context given to the helpers
+ */
+struct fe_filter_ctx {
+    struct fdb *fdb;
+    uint32_t port;
+    uint64_t *counters;
+};
+
+typedef uint32_t (*fe_filter_func_t)(struct fe_filter_ctx *, const uint8_t *,
+                                     uint32_t);
+typedef uint32_t (*fe_filter_helper_t)(struct fe_filter_ctx *,
+                                       const uint8_t *, uint32_t, uint32_t,
+                                       uint32_t);
+
+/*
+ * Program
+ */
+struct fe_filter_prog {
+    int ninsns;
+    struct fe_filter_insn insns[FE_FILTER_MAX_INSNS];
+    /* JIT-compiled code, or NULL to interpret */
+    fe_filter_func_t func;
+};
+
+/*
+ * JIT compiler state
+ */
+struct fe_filter_jit {
+    /* Output buffer, or NULL to measure the size */
+    uint8_t *buf;
+    size_t size;
+    size_t off;
+};
+
+/*
+ * Helper: ingress port
+ */
+static __inline__ uint32_t
+fe_filter_fn_port(struct fe_filter_ctx *ctx, const uint8_t *pkt, uint32_t len,
+                  uint32_t a, uint32_t x)
+{
+    return ctx->port;
+}
+
+/*
+ * Lookup an address at the specified offset in FDB
+ */
+static __inline__ uint32_t
+fe_filter_fdb_lookup(struct fe_filter_ctx *ctx, const uint8_t *pkt,
+                     uint32_t len, uint32_t off)
+{
+    uint8_t key[FDB_KEY_SIZE];
+    struct fdb_entry *e;
+
+    if ( NULL == ctx->fdb || off + 6 > len ) {
+        return FE_FILTER_NOTFOUND;
+    }
+    memcpy(key, pkt + off, 6);
+    memset(key + 6, 0, 2);
+    e = fdb_lookup(ctx->fdb, key);
+    if ( NULL == e ) {
+        return FE_FILTER_NOTFOUND;
+    }
+
+    return e->port;
+}
+
+/*
+ * Helper: FDB port of the destination address
+ */
+static __inline__ uint32_t
+fe_filter_fn_fdb_dst(struct fe_filter_ctx *ctx, const uint8_t *pkt,
+                     uint32_t len, uint32_t a, uint32_t x)
+{
+    return fe_filter_fdb_lookup(ctx, pkt, len, 0);
+}
+
+/*
+ * Helper: FDB port of the source address
+ */
+static __inline__ uint32_t
+fe_filter_fn_fdb_src(struct fe_filter_ctx *ctx, const uint8_t *pkt,
+                     uint32_t len, uint32_t a, uint32_t x)
+{
+    return fe_filter_fdb_lookup(ctx, pkt, len, 6);
+}
+
+/*
+ * Helper: increment the counter X
+ */
+static __inline__ uint32_t
+fe_filter_fn_count(struct fe_filter_ctx *ctx, const uint8_t *pkt,
+                   uint32_t len, uint32_t a, uint32_t x)
+{
+    if ( NULL != ctx->counters ) {
+        ctx->counters[x & (FE_FILTER_NCOUNTERS - 1)]++;
+    }
+
+    return a;
+}
+
+/*
+ * Get a helper
+ */
+static __inline__ fe_filter_helper_t
+fe_filter_helper(uint32_t fn)
+{
+    switch ( fn ) {
+    case FE_FILTER_FN_PORT:
+        return fe_filter_fn_port;
+    case FE_FILTER_FN_FDB_DST:
+        return fe_filter_fn_fdb_dst;
+    case FE_FILTER_FN_FDB_SRC:
+        return fe_filter_fn_fdb_src;
+    case FE_FILTER_FN_COUNT:
+        return fe_filter_fn_count;
+    default:
+        return NULL;
+    }
+}
+
+/*
+ * Verify a program: all the instructions are known, the jumps are forward
+ * within the program (so that it always terminates), the scratch memory and
+ * the helpers are valid, and the last instruction returns.  Returns 0 if
+ * valid, or -1 otherwise.
+ */
+static __inline__ int
+fe_filter_verify(const struct fe_filter_insn *insns, int n)
+{
+    const struct fe_filter_insn *insn;
+    int i;
+
+    if ( n <= 0 || n > FE_FILTER_MAX_INSNS ) {
+        return -1;
+    }
+    for ( i = 0; i < n; i++ ) {
+        insn = &insns[i];
+        switch ( insn->code ) {
+        case FE_FILTER_LD | FE_FILTER_W | FE_FILTER_ABS:
+        case FE_FILTER_LD | FE_FILTER_H | FE_FILTER_ABS:
+        case FE_FILTER_LD | FE_FILTER_B | FE_FILTER_ABS:
+        case FE_FILTER_LD | FE_FILTER_W | FE_FILTER_IND:
+        case FE_FILTER_LD | FE_FILTER_H | FE_FILTER_IND:
+        case FE_FILTER_LD | FE_FILTER_B | FE_FILTER_IND:
+        case FE_FILTER_LDX | FE_FILTER_B | FE_FILTER_MSH:
+            if ( insn->k > FE_FILTER_MAX_OFF ) {
+                return -1;
+            }
+            break;
+        case FE_FILTER_LD | FE_FILTER_W | FE_FILTER_IMM:
+        case FE_FILTER_LD | FE_FILTER_W | FE_FILTER_LEN:
+        case FE_FILTER_LDX | FE_FILTER_W | FE_FILTER_IMM:
+        case FE_FILTER_LDX | FE_FILTER_W | FE_FILTER_LEN:
+        case FE_FILTER_RET | FE_FILTER_K:
+        case FE_FILTER_RET | FE_FILTER_A:
+        case FE_FILTER_MISC | FE_FILTER_TAX:
+        case FE_FILTER_MISC | FE_FILTER_TXA:
+            break;
+        case FE_FILTER_LD | FE_FILTER_W | FE_FILTER_MEM:
+        case FE_FILTER_LDX | FE_FILTER_W | FE_FILTER_MEM:
+        case FE_FILTER_ST:
+        case FE_FILTER_STX:
+            if ( insn->k >= FE_FILTER_MEMWORDS ) {
+                return -1;
+            }
+            break;
+        case FE_FILTER_ALU | FE_FILTER_ADD | FE_FILTER_K:
+        case FE_FILTER_ALU | FE_FILTER_SUB | FE_FILTER_K:
+        case FE_FILTER_ALU | FE_FILTER_MUL | FE_FILTER_K:
+        case FE_FILTER_ALU | FE_FILTER_OR | FE_FILTER_K:
+        case FE_FILTER_ALU | FE_FILTER_AND | FE_FILTER_K:
+        case FE_FILTER_ALU | FE_FILTER_XOR | FE_FILTER_K:
+        case FE_FILTER_ALU | FE_FILTER_NEG:
+        case FE_FILTER_ALU | FE_FILTER_ADD | FE_FILTER_X:
+        case FE_FILTER_ALU | FE_FILTER_SUB | FE_FILTER_X:
+        case FE_FILTER_ALU | FE_FILTER_MUL | FE_FILTER_X:
+        case FE_FILTER_ALU | FE_FILTER_DIV | FE_FILTER_X:
+        case FE_FILTER_ALU | FE_FILTER_MOD | FE_FILTER_X:
+        case FE_FILTER_ALU | FE_FILTER_OR | FE_FILTER_X:
+        case FE_FILTER_ALU | FE_FILTER_AND | FE_FILTER_X:
+        case FE_FILTER_ALU | FE_FILTER_XOR | FE_FILTER_X:
+        case FE_FILTER_ALU | FE_FILTER_LSH | FE_FILTER_X:
+        case FE_FILTER_ALU | FE_FILTER_RSH | FE_FILTER_X:
+            break;
+        case FE_FILTER_ALU | FE_FILTER_DIV | FE_FILTER_K:
+        case FE_FILTER_ALU | FE_FILTER_MOD | FE_FILTER_K:
+            /* Division by constant zero */
+            if ( 0 == insn->k ) {
+                return -1;
+            }
+            break;
+        case FE_FILTER_ALU | FE_FILTER_LSH | FE_FILTER_K:
+        case FE_FILTER_ALU | FE_FILTER_RSH | FE_FILTER_K:
+            if ( insn->k >= 32 ) {
+                return -1;
+            }
+            break;
+        case FE_FILTER_JMP | FE_FILTER_JA:
+            if ( insn->k >= (uint32_t)(n - i - 1) ) {
+                return -1;
+            }
+            break;
+        case FE_FILTER_JMP | FE_FILTER_JEQ | FE_FILTER_K:
+        case FE_FILTER_JMP | FE_FILTER_JGT | FE_FILTER_K:
+        case FE_FILTER_JMP | FE_FILTER_JGE | FE_FILTER_K:
+        case FE_FILTER_JMP | FE_FILTER_JSET | FE_FILTER_K:
+        case FE_FILTER_JMP | FE_FILTER_JEQ | FE_FILTER_X:
+        case FE_FILTER_JMP | FE_FILTER_JGT | FE_FILTER_X:
+        case FE_FILTER_JMP | FE_FILTER_JGE | FE_FILTER_X:
+        case FE_FILTER_JMP | FE_FILTER_JSET | FE_FILTER_X:
+            if ( insn->jt >= n - i - 1 || insn->jf >= n - i - 1 ) {
+                return -1;
+            }
+            break;
+        case FE_FILTER_MISC | FE_FILTER_CALL:
+            if ( insn->k >= FE_FILTER_NFN ) {
+                return -1;
+            }
+            break;
+        default:
+            /* Unknown instruction */
+            return -1;
+        }
+    }
+
+    /* Must not fall off the end */
+    if ( FE_FILTER_RET != FE_FILTER_CLASS(insns[n - 1].code) ) {
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * Load a big-endian value from a packet if it is within the packet
+ */
+#define FE_FILTER_LOAD(v, pkt, len, off, sz)                            \
+    do {                                                                \
+        if ( (uint64_t)(off) + (sz) > (len) ) {                         \
+            return 0;                                                   \
+        }                                                               \
+        if ( 4 == (sz) ) {                                              \
+            (v) = ((uint32_t)(pkt)[(off)] << 24)                        \
+                | ((uint32_t)(pkt)[(off) + 1] << 16)                    \
+                | ((uint32_t)(pkt)[(off) + 2] << 8)                     \
+                | (uint32_t)(pkt)[(off) + 3];                           \
+        } else if ( 2 == (sz) ) {                                       \
+            (v) = ((uint32_t)(pkt)[(off)] << 8)                         \
+                | (uint32_t)(pkt)[(off) + 1];                           \
+        } else {                                                        \
+            (v) = (pkt)[(off)];                                         \
+        }                                                               \
+    } while ( 0 )
+
+/*
+ * Interpret a verified program.  Returns the verdict; an out-of-packet load
+ * and a division by zero return 0 (drop).
+ */
+static __inline__ uint32_t
+fe_filter_run(const struct fe_filter_insn *insns, struct fe_filter_ctx *ctx,
+              const uint8_t *pkt, uint32_t len)
+{
+    const struct fe_filter_insn *insn;
+    uint32_t mem[FE_FILTER_MEMWORDS];
+    uint32_t a;
+    uint32_t x;
+    uint32_t off;
+
+    memset(mem, 0, sizeof(mem));
+    a = 0;
+    x = 0;
+    for ( insn = insns; ; insn++ ) {
+        switch ( insn->code ) {
+        case FE_FILTER_LD | FE_FILTER_W | FE_FILTER_ABS:
+            FE_FILTER_LOAD(a, pkt, len, insn->k, 4);
+            break;
+        case FE_FILTER_LD | FE_FILTER_H | FE_FILTER_ABS:
+            FE_FILTER_LOAD(a, pkt, len, insn->k, 2);
+            break;
+        case FE_FILTER_LD | FE_FILTER_B | FE_FILTER_ABS:
+            FE_FILTER_LOAD(a, pkt, len, insn->k, 1);
+            break;
+        case FE_FILTER_LD | FE_FILTER_W | FE_FILTER_IND:
+            off = x + insn->k;
+            if ( off < x ) {
+                return 0;
+            }
+            FE_FILTER_LOAD(a, pkt, len, off, 4);
+            break;
+        case FE_FILTER_LD | FE_FILTER_H | FE_FILTER_IND:
+            off = x + insn->k;
+            if ( off < x ) {
+                return 0;
+            }
+            FE_FILTER_LOAD(a, pkt, len, off, 2);
+            break;
+        case FE_FILTER_LD | FE_FILTER_B | FE_FILTER_IND:
+            off = x + insn->k;
+            if ( off < x ) {
+                return 0;
+            }
+            FE_FILTER_LOAD(a, pkt, len, off, 1);
+            break;
+        case FE_FILTER_LD | FE_FILTER_W | FE_FILTER_IMM:
+            a = insn->k;
+            break;
+        case FE_FILTER_LD | FE_FILTER_W | FE_FILTER_LEN:
+            a = len;
+            break;
+        case FE_FILTER_LD | FE_FILTER_W | FE_FILTER_MEM:
+            a = mem[insn->k];
+            break;
+        case FE_FILTER_LDX | FE_FILTER_W | FE_FILTER_IMM:
+            x = insn->k;
+            break;
+        case FE_FILTER_LDX | FE_FILTER_W | FE_FILTER_LEN:
+            x = len;
+            break;
+        case FE_FILTER_LDX | FE_FILTER_W | FE_FILTER_MEM:
+            x = mem[insn->k];
+            break;
+        case FE_FILTER_LDX | FE_FILTER_B | FE_FILTER_MSH:
+            FE_FILTER_LOAD(x, pkt, len, insn->k, 1);
+            x = (x & 0xf) << 2;
+            break;
+        case FE_FILTER_ST:
+            mem[insn->k] = a;
+            break;
+        case FE_FILTER_STX:
+            mem[insn->k] = x;
+            break;
+        case FE_FILTER_ALU | FE_FILTER_ADD | FE_FILTER_K:
+            a += insn->k;
+            break;
+        case FE_FILTER_ALU | FE_FILTER_SUB | FE_FILTER_K:
+            a -= insn->k;
+            break;
+        case FE_FILTER_ALU | FE_FILTER_MUL | FE_FILTER_K:
+            a *= insn->k;
+            break;
+        case FE_FILTER_ALU | FE_FILTER_DIV | FE_FILTER_K:
+            a /= insn->k;
+            break;
+        case FE_FILTER_ALU | FE_FILTER_MOD | FE_FILTER_K:
+            a %= insn->k;
+            break;
+        case FE_FILTER_ALU | FE_FILTER_OR | FE_FILTER_K:
+            a |= insn->k;
+            break;
+        case FE_FILTER_ALU | FE_FILTER_AND | FE_FILTER_K:
+            a &= insn->k;
+            break;
+        case FE_FILTER_ALU | FE_FILTER_XOR | FE_FILTER_K:
+            a ^= insn->k;
+            break;
+        case FE_FILTER_ALU | FE_FILTER_LSH | FE_FILTER_K:
+            a <<= insn->k;
+            break;
+        case FE_FILTER_ALU | FE_FILTER_RSH | FE_FILTER_K:
+            a >>= insn->k;
+            break;
+        case FE_FILTER_ALU | FE_FILTER_NEG:
+            a = -a;
+            break;
+        case FE_FILTER_ALU | FE_FILTER_ADD | FE_FILTER_X:
+            a += x;
+            break;
+        case FE_FILTER_ALU | FE_FILTER_SUB | FE_FILTER_X:
+            a -= x;
+            break;
+        case FE_FILTER_ALU | FE_FILTER_MUL | FE_FILTER_X:
+            a *= x;
+            break;
+        case FE_FILTER_ALU | FE_FILTER_DIV | FE_FILTER_X:
+            if ( 0 == x ) {
+                return 0;
+            }
+            a /= x;
+            break;
+        case FE_FILTER_ALU | FE_FILTER_MOD | FE_FILTER_X:
+            if ( 0 == x ) {
+                return 0;
+            }
+            a %= x;
+            break;
+        case FE_FILTER_ALU | FE_FILTER_OR | FE_FILTER_X:
+            a |= x;
+            break;
+        case FE_FILTER_ALU | FE_FILTER_AND | FE_FILTER_X:
+            a &= x;
+            break;
+        case FE_FILTER_ALU | FE_FILTER_XOR | FE_FILTER_X:
+            a ^= x;
+            break;
+        case FE_FILTER_ALU | FE_FILTER_LSH | FE_FILTER_X:
+            /* Count masked as the x86 shift instructions */
+            a <<= (x & 31);
+            break;
+        case FE_FILTER_ALU | FE_FILTER_RSH | FE_FILTER_X:
+            a >>= (x & 31);
+            break;
+        case FE_FILTER_JMP | FE_FILTER_JA:
+            insn += insn->k;
+            break;
+        case FE_FILTER_JMP | FE_FILTER_JEQ | FE_FILTER_K:
+            insn += (a == insn->k) ? insn->jt : insn->jf;
+            break;
+        case FE_FILTER_JMP | FE_FILTER_JGT | FE_FILTER_K:
+            insn += (a > insn->k) ? insn->jt : insn->jf;
+            break;
+        case FE_FILTER_JMP | FE_FILTER_JGE | FE_FILTER_K:
+            insn += (a >= insn->k) ? insn->jt : insn->jf;
+            break;
+        case FE_FILTER_JMP | FE_FILTER_JSET | FE_FILTER_K:
+            insn += (a & insn->k) ? insn->jt : insn->jf;
+            break;
+        case FE_FILTER_JMP | FE_FILTER_JEQ | FE_FILTER_X:
+            insn += (a == x) ? insn->jt : insn->jf;
+            break;
+        case FE_FILTER_JMP | FE_FILTER_JGT | FE_FILTER_X:
+            insn += (a > x) ? insn->jt : insn->jf;
+            break;
+        case FE_FILTER_JMP | FE_FILTER_JGE | FE_FILTER_X:
+            insn += (a >= x) ? insn->jt : insn->jf;
+            break;
+        case FE_FILTER_JMP | FE_FILTER_JSET | FE_FILTER_X:
+            insn += (a & x) ? insn->jt : insn->jf;
+            break;
+        case FE_FILTER_RET | FE_FILTER_K:
+            return insn->k;
+        case FE_FILTER_RET | FE_FILTER_A:
+            return a;
+        case FE_FILTER_MISC | FE_FILTER_TAX:
+            x = a;
+            break;
+        case FE_FILTER_MISC | FE_FILTER_TXA:
+            a = x;
+            break;
+        case FE_FILTER_MISC | FE_FILTER_CALL:
+            a = fe_filter_helper(insn->k)(ctx, pkt, len, a, x);
+            break;
+        default:
+            /* Not verified */
+            return 0;
+        }
+    }
+}
+
+/*
+ * Emit bytes of machine code
+ */
+static __inline__ void
+fe_filter_emit(struct fe_filter_jit *j, const uint8_t *code, size_t len)
+{
+    if ( NULL != j->buf && j->off + len <= j->size ) {
+        memcpy(j->buf + j->off, code, len);
+    }
+    j->off += len;
+}
+static __inline__ void
+fe_filter_emit32(struct fe_filter_jit *j, uint32_t v)
+{
+    uint8_t b[4];
+
+    b[0] = v & 0xff;
+    b[1] = (v >> 8) & 0xff;
+    b[2] = (v >> 16) & 0xff;
+    b[3] = (v >> 24) & 0xff;
+    fe_filter_emit(j, b, 4);
+}
+#define FE_FILTER_EMIT(j, ...)                                          \
+    do {                                                                \
+        const uint8_t _code[] = { __VA_ARGS__ };                        \
+        fe_filter_emit((j), _code, sizeof(_code));                      \
+    } while ( 0 )
+
+/*
+ * Emit a (conditional) jump with a 32-bit displacement to the offset target
+ */
+static __inline__ void
+fe_filter_emit_jmp(struct fe_filter_jit *j, size_t target)
+{
+    FE_FILTER_EMIT(j, 0xe9);
+    fe_filter_emit32(j, (uint32_t)(target - (j->off + 4)));
+}
+static __inline__ void
+fe_filter_emit_jcc(struct fe_filter_jit *j, uint8_t cc, size_t target)
+{
+    FE_FILTER_EMIT(j, 0x0f, cc);
+    fe_filter_emit32(j, (uint32_t)(target - (j->off + 4)));
+}
+
+/* Condition codes of jcc (the second byte) */
+#define FE_FILTER_JCC_B         0x82
+#define FE_FILTER_JCC_AE        0x83
+#define FE_FILTER_JCC_E         0x84
+#define FE_FILTER_JCC_NE        0x85
+#define FE_FILTER_JCC_BE        0x86
+#define FE_FILTER_JCC_A         0x87
+
+/*
+ * Emit a bound check of [ecx, ecx + sz) against the packet length (r15d)
+ */
+static __inline__ void
+fe_filter_emit_ind_check(struct fe_filter_jit *j, uint32_t k, int sz,
+                         size_t fail)
+{
+    /* mov ecx, r13d; add ecx, k; jc fail */
+    FE_FILTER_EMIT(j, 0x44, 0x89, 0xe9, 0x81, 0xc1);
+    fe_filter_emit32(j, k);
+    fe_filter_emit_jcc(j, FE_FILTER_JCC_B, fail);
+    /* mov esi, ecx; add esi, sz; jc fail; cmp esi, r15d; ja fail */
+    FE_FILTER_EMIT(j, 0x89, 0xce, 0x83, 0xc6, sz);
+    fe_filter_emit_jcc(j, FE_FILTER_JCC_B, fail);
+    FE_FILTER_EMIT(j, 0x44, 0x39, 0xfe);
+    fe_filter_emit_jcc(j, FE_FILTER_JCC_A, fail);
+}
+
+/*
+ * Emit the conditional branches of a jump instruction following a cmp/test
+ */
+static __inline__ void
+fe_filter_emit_cond(struct fe_filter_jit *j, const struct fe_filter_insn *insn,
+                    uint8_t cc, uint8_t ncc, size_t *addrs, int i)
+{
+    if ( 0 == insn->jt && 0 == insn->jf ) {
+        return;
+    }
+    if ( 0 == insn->jt ) {
+        fe_filter_emit_jcc(j, ncc, addrs[i + 1 + insn->jf]);
+    } else {
+        fe_filter_emit_jcc(j, cc, addrs[i + 1 + insn->jt]);
+        if ( 0 != insn->jf ) {
+            fe_filter_emit_jmp(j, addrs[i + 1 + insn->jf]);
+        }
+    }
+}
+
+/*
+ * Emit the code of a verified program.  A is held in eax, X in r13d, the
+ * context in rbx, the packet in r14, and its length in r15d; the scratch
+ * memory is on the stack.  The size of each instruction does not depend on
+ * the jump targets, so that the addresses of the first pass are used for the
+ * second pass.
+ */
+static __inline__ void
+fe_filter_jit_emit(struct fe_filter_jit *j, const struct fe_filter_insn *insns,
+                   int n, size_t *addrs)
+{
+    const struct fe_filter_insn *insn;
+    fe_filter_helper_t fn;
+    uint64_t fa;
+    size_t fail;
+    size_t epilogue;
+    uint32_t used;
+    int i;
+    int b;
+
+    fail = addrs[n];
+    epilogue = fail + 2;
+
+    /* Prologue: push rbx, r12-r15; sub rsp, 64 */
+    FE_FILTER_EMIT(j, 0x53, 0x41, 0x54, 0x41, 0x55, 0x41, 0x56, 0x41, 0x57,
+                   0x48, 0x83, 0xec, 0x40);
+    /* mov rbx, rdi; mov r14, rsi; mov r15d, edx; xor eax, eax;
+       xor r13d, r13d */
+    FE_FILTER_EMIT(j, 0x48, 0x89, 0xfb, 0x49, 0x89, 0xf6, 0x41, 0x89, 0xd7,
+                   0x31, 0xc0, 0x45, 0x31, 0xed);
+    /* Clear the scratch memory used */
+    used = 0;
+    for ( i = 0; i < n; i++ ) {
+        switch ( insns[i].code ) {
+        case FE_FILTER_LD | FE_FILTER_W | FE_FILTER_MEM:
+        case FE_FILTER_LDX | FE_FILTER_W | FE_FILTER_MEM:
+            used |= 1UL << insns[i].k;
+            break;
+        default:
+            ;
+        }
+    }
+    for ( i = 0; i < FE_FILTER_MEMWORDS; i++ ) {
+        if ( used & (1UL << i) ) {
+            /* mov dword [rsp + 4i], 0 */
+            FE_FILTER_EMIT(j, 0xc7, 0x44, 0x24, i * 4, 0, 0, 0, 0);
+        }
+    }
+
+    for ( i = 0; i < n; i++ ) {
+        insn = &insns[i];
+        addrs[i] = j->off;
+        switch ( insn->code ) {
+        case FE_FILTER_LD | FE_FILTER_W | FE_FILTER_ABS:
+        case FE_FILTER_LD | FE_FILTER_H | FE_FILTER_ABS:
+        case FE_FILTER_LD | FE_FILTER_B | FE_FILTER_ABS:
+            b = (insn->code & 0x18) == FE_FILTER_W ? 4
+                : (insn->code & 0x18) == FE_FILTER_H ? 2 : 1;
+            /* cmp r15d, k + b; jb fail */
+            FE_FILTER_EMIT(j, 0x41, 0x81, 0xff);
+            fe_filter_emit32(j, insn->k + b);
+            fe_filter_emit_jcc(j, FE_FILTER_JCC_B, fail);
+            if ( 4 == b ) {
+                /* mov eax, [r14 + k]; bswap eax */
+                FE_FILTER_EMIT(j, 0x41, 0x8b, 0x86);
+                fe_filter_emit32(j, insn->k);
+                FE_FILTER_EMIT(j, 0x0f, 0xc8);
+            } else if ( 2 == b ) {
+                /* movzx eax, word [r14 + k]; rol ax, 8 */
+                FE_FILTER_EMIT(j, 0x41, 0x0f, 0xb7, 0x86);
+                fe_filter_emit32(j, insn->k);
+                FE_FILTER_EMIT(j, 0x66, 0xc1, 0xc0, 0x08);
+            } else {
+                /* movzx eax, byte [r14 + k] */
+                FE_FILTER_EMIT(j, 0x41, 0x0f, 0xb6, 0x86);
+                fe_filter_emit32(j, insn->k);
+            }
+            break;
+        case FE_FILTER_LD | FE_FILTER_W | FE_FILTER_IND:
+            fe_filter_emit_ind_check(j, insn->k, 4, fail);
+            /* mov eax, [r14 + rcx]; bswap eax */
+            FE_FILTER_EMIT(j, 0x41, 0x8b, 0x04, 0x0e, 0x0f, 0xc8);
+            break;
+        case FE_FILTER_LD | FE_FILTER_H | FE_FILTER_IND:
+            fe_filter_emit_ind_check(j, insn->k, 2, fail);
+            /* movzx eax, word [r14 + rcx]; rol ax, 8 */
+            FE_FILTER_EMIT(j, 0x41, 0x0f, 0xb7, 0x04, 0x0e,
+                           0x66, 0xc1, 0xc0, 0x08);
+            break;
+        case FE_FILTER_LD | FE_FILTER_B | FE_FILTER_IND:
+            fe_filter_emit_ind_check(j, insn->k, 1, fail);
+            /* movzx eax, byte [r14 + rcx] */
+            FE_FILTER_EMIT(j, 0x41, 0x0f, 0xb6, 0x04, 0x0e);
+            break;
+        case FE_FILTER_LD | FE_FILTER_W | FE_FILTER_IMM:
+            /* mov eax, k */
+            FE_FILTER_EMIT(j, 0xb8);
+            fe_filter_emit32(j, insn->k);
+            break;
+        case FE_FILTER_LD | FE_FILTER_W | FE_FILTER_LEN:
+            /* mov eax, r15d */
+            FE_FILTER_EMIT(j, 0x44, 0x89, 0xf8);
+            break;
+        case FE_FILTER_LD | FE_FILTER_W | FE_FILTER_MEM:
+            /* mov eax, [rsp + 4k] */
+            FE_FILTER_EMIT(j, 0x8b, 0x44, 0x24, insn->k * 4);
+            break;
+        case FE_FILTER_LDX | FE_FILTER_W | FE_FILTER_IMM:
+            /* mov r13d, k */
+            FE_FILTER_EMIT(j, 0x41, 0xbd);
+            fe_filter_emit32(j, insn->k);
+            break;
+        case FE_FILTER_LDX | FE_FILTER_W | FE_FILTER_LEN:
+            /* mov r13d, r15d */
+            FE_FILTER_EMIT(j, 0x45, 0x89, 0xfd);
+            break;
+        case FE_FILTER_LDX | FE_FILTER_W | FE_FILTER_MEM:
+            /* mov r13d, [rsp + 4k] */
+            FE_FILTER_EMIT(j, 0x44, 0x8b, 0x6c, 0x24, insn->k * 4);
+            break;
+        case FE_FILTER_LDX | FE_FILTER_B | FE_FILTER_MSH:
+            /* cmp r15d, k + 1; jb fail */
+            FE_FILTER_EMIT(j, 0x41, 0x81, 0xff);
+            fe_filter_emit32(j, insn->k + 1);
+            fe_filter_emit_jcc(j, FE_FILTER_JCC_B, fail);
+            /* movzx ecx, byte [r14 + k]; and ecx, 0xf; shl ecx, 2;
+               mov r13d, ecx */
+            FE_FILTER_EMIT(j, 0x41, 0x0f, 0xb6, 0x8e);
+            fe_filter_emit32(j, insn->k);
+            FE_FILTER_EMIT(j, 0x83, 0xe1, 0x0f, 0xc1, 0xe1, 0x02,
+                           0x41, 0x89, 0xcd);
+            break;
+        case FE_FILTER_ST:
+            /* mov [rsp + 4k], eax */
+            FE_FILTER_EMIT(j, 0x89, 0x44, 0x24, insn->k * 4);
+            break;
+        case FE_FILTER_STX:
+            /* mov [rsp + 4k], r13d */
+            FE_FILTER_EMIT(j, 0x44, 0x89, 0x6c, 0x24, insn->k * 4);
+            break;
+        case FE_FILTER_ALU | FE_FILTER_ADD | FE_FILTER_K:
+            FE_FILTER_EMIT(j, 0x05);
+            fe_filter_emit32(j, insn->k);
+            break;
+        case FE_FILTER_ALU | FE_FILTER_SUB | FE_FILTER_K:
+            FE_FILTER_EMIT(j, 0x2d);
+            fe_filter_emit32(j, insn->k);
+            break;
+        case FE_FILTER_ALU | FE_FILTER_MUL | FE_FILTER_K:
+            /* imul eax, eax, k */
+            FE_FILTER_EMIT(j, 0x69, 0xc0);
+            fe_filter_emit32(j, insn->k);
+            break;
+        case FE_FILTER_ALU | FE_FILTER_DIV | FE_FILTER_K:
+        case FE_FILTER_ALU | FE_FILTER_MOD | FE_FILTER_K:
+            /* xor edx, edx; mov ecx, k; div ecx */
+            FE_FILTER_EMIT(j, 0x31, 0xd2, 0xb9);
+            fe_filter_emit32(j, insn->k);
+            FE_FILTER_EMIT(j, 0xf7, 0xf1);
+            if ( (insn->code & 0xf0) == FE_FILTER_MOD ) {
+                /* mov eax, edx */
+                FE_FILTER_EMIT(j, 0x89, 0xd0);
+            }
+            break;
+        case FE_FILTER_ALU | FE_FILTER_OR | FE_FILTER_K:
+            FE_FILTER_EMIT(j, 0x0d);
+            fe_filter_emit32(j, insn->k);
+            break;
+        case FE_FILTER_ALU | FE_FILTER_AND | FE_FILTER_K:
+            FE_FILTER_EMIT(j, 0x25);
+            fe_filter_emit32(j, insn->k);
+            break;
+        case FE_FILTER_ALU | FE_FILTER_XOR | FE_FILTER_K:
+            FE_FILTER_EMIT(j, 0x35);
+            fe_filter_emit32(j, insn->k);
+            break;
+        case FE_FILTER_ALU | FE_FILTER_LSH | FE_FILTER_K:
+            FE_FILTER_EMIT(j, 0xc1, 0xe0, insn->k);
+            break;
+        case FE_FILTER_ALU | FE_FILTER_RSH | FE_FILTER_K:
+            FE_FILTER_EMIT(j, 0xc1, 0xe8, insn->k);
+            break;
+        case FE_FILTER_ALU | FE_FILTER_NEG:
+            FE_FILTER_EMIT(j, 0xf7, 0xd8);
+            break;
+        case FE_FILTER_ALU | FE_FILTER_ADD | FE_FILTER_X:
+            FE_FILTER_EMIT(j, 0x44, 0x01, 0xe8);
+            break;
+        case FE_FILTER_ALU | FE_FILTER_SUB | FE_FILTER_X:
+            FE_FILTER_EMIT(j, 0x44, 0x29, 0xe8);
+            break;
+        case FE_FILTER_ALU | FE_FILTER_MUL | FE_FILTER_X:
+            /* imul eax, r13d */
+            FE_FILTER_EMIT(j, 0x41, 0x0f, 0xaf, 0xc5);
+            break;
+        case FE_FILTER_ALU | FE_FILTER_DIV | FE_FILTER_X:
+        case FE_FILTER_ALU | FE_FILTER_MOD | FE_FILTER_X:
+            /* test r13d, r13d; je fail; xor edx, edx; div r13d */
+            FE_FILTER_EMIT(j, 0x45, 0x85, 0xed);
+            fe_filter_emit_jcc(j, FE_FILTER_JCC_E, fail);
+            FE_FILTER_EMIT(j, 0x31, 0xd2, 0x41, 0xf7, 0xf5);
+            if ( (insn->code & 0xf0) == FE_FILTER_MOD ) {
+                FE_FILTER_EMIT(j, 0x89, 0xd0);
+            }
+            break;
+        case FE_FILTER_ALU | FE_FILTER_OR | FE_FILTER_X:
+            FE_FILTER_EMIT(j, 0x44, 0x09, 0xe8);
+            break;
+        case FE_FILTER_ALU | FE_FILTER_AND | FE_FILTER_X:
+            FE_FILTER_EMIT(j, 0x44, 0x21, 0xe8);
+            break;
+        case FE_FILTER_ALU | FE_FILTER_XOR | FE_FILTER_X:
+            FE_FILTER_EMIT(j, 0x44, 0x31, 0xe8);
+            break;
+        case FE_FILTER_ALU | FE_FILTER_LSH | FE_FILTER_X:
+            /* mov ecx, r13d; shl eax, cl */
+            FE_FILTER_EMIT(j, 0x44, 0x89, 0xe9, 0xd3, 0xe0);
+            break;
+        case FE_FILTER_ALU | FE_FILTER_RSH | FE_FILTER_X:
+            /* mov ecx, r13d; shr eax, cl */
+            FE_FILTER_EMIT(j, 0x44, 0x89, 0xe9, 0xd3, 0xe8);
+            break;
+        case FE_FILTER_JMP | FE_FILTER_JA:
+            fe_filter_emit_jmp(j, addrs[i + 1 + insn->k]);
+            break;
+        case FE_FILTER_JMP | FE_FILTER_JEQ | FE_FILTER_K:
+            /* cmp eax, k */
+            FE_FILTER_EMIT(j, 0x3d);
+            fe_filter_emit32(j, insn->k);
+            fe_filter_emit_cond(j, insn, FE_FILTER_JCC_E, FE_FILTER_JCC_NE,
+                                addrs, i);
+            break;
+        case FE_FILTER_JMP | FE_FILTER_JGT | FE_FILTER_K:
+            FE_FILTER_EMIT(j, 0x3d);
+            fe_filter_emit32(j, insn->k);
+            fe_filter_emit_cond(j, insn, FE_FILTER_JCC_A, FE_FILTER_JCC_BE,
+                                addrs, i);
+            break;
+        case FE_FILTER_JMP | FE_FILTER_JGE | FE_FILTER_K:
+            FE_FILTER_EMIT(j, 0x3d);
+            fe_filter_emit32(j, insn->k);
+            fe_filter_emit_cond(j, insn, FE_FILTER_JCC_AE, FE_FILTER_JCC_B,
+                                addrs, i);
+            break;
+        case FE_FILTER_JMP | FE_FILTER_JSET | FE_FILTER_K:
+            /* test eax, k */
+            FE_FILTER_EMIT(j, 0xa9);
+            fe_filter_emit32(j, insn->k);
+            fe_filter_emit_cond(j, insn, FE_FILTER_JCC_NE, FE_FILTER_JCC_E,
+                                addrs, i);
+            break;
+        case FE_FILTER_JMP | FE_FILTER_JEQ | FE_FILTER_X:
+            /* cmp eax, r13d */
+            FE_FILTER_EMIT(j, 0x44, 0x39, 0xe8);
+            fe_filter_emit_cond(j, insn, FE_FILTER_JCC_E, FE_FILTER_JCC_NE,
+                                addrs, i);
+            break;
+        case FE_FILTER_JMP | FE_FILTER_JGT | FE_FILTER_X:
+            FE_FILTER_EMIT(j, 0x44, 0x39, 0xe8);
+            fe_filter_emit_cond(j, insn, FE_FILTER_JCC_A, FE_FILTER_JCC_BE,
+                                addrs, i);
+            break;
+        case FE_FILTER_JMP | FE_FILTER_JGE | FE_FILTER_X:
+            FE_FILTER_EMIT(j, 0x44, 0x39, 0xe8);
+            fe_filter_emit_cond(j, insn, FE_FILTER_JCC_AE, FE_FILTER_JCC_B,
+                                addrs, i);
+            break;
+        case FE_FILTER_JMP | FE_FILTER_JSET | FE_FILTER_X:
+            /* test eax, r13d */
+            FE_FILTER_EMIT(j, 0x44, 0x85, 0xe8);
+            fe_filter_emit_cond(j, insn, FE_FILTER_JCC_NE, FE_FILTER_JCC_E,
+                                addrs, i);
+            break;
+        case FE_FILTER_RET | FE_FILTER_K:
+            /* mov eax, k; jmp epilogue */
+            FE_FILTER_EMIT(j, 0xb8);
+            fe_filter_emit32(j, insn->k);
+            fe_filter_emit_jmp(j, epilogue);
+            break;
+        case FE_FILTER_RET | FE_FILTER_A:
+            fe_filter_emit_jmp(j, epilogue);
+            break;
+        case FE_FILTER_MISC | FE_FILTER_TAX:
+            /* mov r13d, eax */
+            FE_FILTER_EMIT(j, 0x41, 0x89, 0xc5);
+            break;
+        case FE_FILTER_MISC | FE_FILTER_TXA:
+            /* mov eax, r13d */
+            FE_FILTER_EMIT(j, 0x44, 0x89, 0xe8);
+            break;
+        case FE_FILTER_MISC | FE_FILTER_CALL:
+            /* mov rdi, rbx; mov rsi, r14; mov edx, r15d; mov ecx, eax;
+               mov r8d, r13d */
+            FE_FILTER_EMIT(j, 0x48, 0x89, 0xdf, 0x4c, 0x89, 0xf6, 0x44, 0x89,
+                           0xfa, 0x89, 0xc1, 0x45, 0x89, 0xe8);
+            /* mov rax, fn; call rax */
+            fn = fe_filter_helper(insn->k);
+            fa = (uint64_t)fn;
+            FE_FILTER_EMIT(j, 0x48, 0xb8);
+            fe_filter_emit32(j, fa & 0xffffffffULL);
+            fe_filter_emit32(j, fa >> 32);
+            FE_FILTER_EMIT(j, 0xff, 0xd0);
+            break;
+        default:
+            ;
+        }
+    }
+
+    /* fail: xor eax, eax */
+    addrs[n] = j->off;
+    FE_FILTER_EMIT(j, 0x31, 0xc0);
+    /* Epilogue: add rsp, 64; pop r15-r12, rbx; ret */
+    FE_FILTER_EMIT(j, 0x48, 0x83, 0xc4, 0x40, 0x41, 0x5f, 0x41, 0x5e, 0x41,
+                   0x5d, 0x41, 0x5c, 0x5b, 0xc3);
+}
+
+/*
+ * Compile a verified program into the executable memory code of size bytes.
+ * Returns the size of the code, or -1 if it does not fit.
+ */
+static __inline__ int
+fe_filter_jit_compile(const struct fe_filter_insn *insns, int n, void *code,
+                      size_t size)
+{
+    struct fe_filter_jit j;
+    size_t addrs[FE_FILTER_MAX_INSNS + 1];
+
+    /* First pass to resolve the addresses */
+    memset(addrs, 0, sizeof(addrs));
+    j.buf = NULL;
+    j.size = 0;
+    j.off = 0;
+    fe_filter_jit_emit(&j, insns, n, addrs);
+    if ( j.off > size ) {
+        return -1;
+    }
+
+    /* Second pass */
+    j.buf = code;
+    j.size = size;
+    j.off = 0;
+    fe_filter_jit_emit(&j, insns, n, addrs);
+
+    return j.off;
+}
+
+/*
+ * Allocate executable memory for JIT-compiled programs
+ */
+static __inline__ void *
+fe_filter_jit_alloc(size_t size)
+{
+    void *code;
+
+    code = mmap(NULL, size, PROT_READ | PROT_WRITE | PROT_EXEC,
+                MAP_PRIVATE | MAP_ANON, -1, 0);
+    if ( NULL == code || (void *)-1 == code ) {
+        return NULL;
+    }
+
+    return code;
+}
+
+/*
+ * Execute a program
+ */
+static __inline__ uint32_t
+fe_filter_exec(struct fe_filter_prog *prog, struct fe_filter_ctx *ctx,
+               const uint8_t *pkt, uint32_t len)
+{
+    if ( NULL != prog->func ) {
+        return prog->func(ctx, pkt, len);
+    }
+
+    return fe_filter_run(prog->insns, ctx, pkt, len);
+}
+
+#endif /* _FILTER_H */
+
+/*
+ * Local variables:
+ * tab-width: 4
+ * c-basic-offset: 4
+ * End:
+ * vim600: sw=4 ts=4 fdm=marker
+ * vim<600: sw=4 ts=4
+ */
@@ -21,11 +21,22 @@
  * SOFTWARE.
  */
 
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/syscall.h>
 #include <mki/driver.h>
 #include "i40e.h"
 
 /* Prototype declarations */
+unsigned long long syscall(int, ...);
 static int _setup_admin_queue(struct i40e_device *);
+static int _setup_hmc(struct i40e_device *);
+static void _setup_rss(struct i40e_device *);
+static void _setup_rss_lut(struct i40e_device *);
+static int _ac_get_vsi(struct i40e_device *, uint16_t);
+static int _ac_update_vsi_queues(struct i40e_device *, uint16_t, int);
 
 /*
  * Initialize an i40e device
@@ -44,13 +55,10 @@ i40e_init(uint16_t device_id, uint16_t bus, uint16_t slot, uint16_t func)
         return NULL;
     }
     dev->device_id = device_id;
-
-    /* Allocate HMC */
-    dev->hmc = malloc(I40E_HMC_SIZE);
-    if ( NULL == dev->hmc ) {
-        free(dev);
-        return NULL;
-    }
+    dev->hmc = NULL;
+    dev->nqueues = 0;
+    dev->nrxq = 0;
+    memset(&dev->last, 0, sizeof(struct pix_fe_hw_stats));
 
     /* Read MMIO */
     pmmio = pci_read_mmio(bus, slot, func);
@@ -71,7 +79,6 @@ i40e_init(uint16_t device_id, uint16_t bus, uint16_t slot, uint16_t func)
     /* Setup an admin queue */
     ret = _setup_admin_queue(dev);
     if ( ret < 0 ) {
-        free(dev->hmc);
         free(dev);
         return NULL;
     }
@@ -79,6 +86,79 @@ i40e_init(uint16_t device_id, uint16_t bus, uint16_t slot, uint16_t func)
     return dev;
 }
 
+/*
+ * Initialize the hardware: the admin configuration, the HMC for the LAN queue
+ * contexts, the queue mapping of the main VSI, and RSS
+ */
+int
+i40e_init_hw(struct i40e_device *dev)
+{
+    uint32_t m32;
+    int first;
+    int last;
+    int n;
+    int ret;
+
+    /* Get the firmware version */
+    ret = i40e_ac_get_ver(dev, &dev->major, &dev->minor, &dev->build,
+                          &dev->subbuild);
+    if ( 0 != ret ) {
+        return -1;
+    }
+
+    /* Admin configuration (LLDP may be already disabled) */
+    i40e_ac_clear_pxe(dev);
+    i40e_ac_disable_lldp(dev);
+    i40e_set_mac_config(dev, I40E_MAX_FRAME);
+
+    /* Physical function and port */
+    dev->pf = rd32(dev->mmio, I40E_PF_FUNC_RID) & 0x7;
+    dev->port = rd32(dev->mmio, I40E_PFGEN_PORTNUM) & 0x3;
+
+    /* Queues assigned to this PF */
+    m32 = rd32(dev->mmio, I40E_PFLAN_QALLOC);
+    if ( !(m32 & (1UL << 31)) ) {
+        return -1;
+    }
+    first = m32 & 0x7ff;
+    last = (m32 >> 16) & 0x7ff;
+    dev->base_queue = first;
+    n = last - first + 1;
+    if ( n > I40E_MAX_QUEUES ) {
+        n = I40E_MAX_QUEUES;
+    }
+    /* Power of two for the queue mapping of the traffic class */
+    dev->nqueues = 1;
+    while ( dev->nqueues * 2 <= n ) {
+        dev->nqueues *= 2;
+    }
+
+    /* Host memory cache for the queue contexts */
+    ret = _setup_hmc(dev);
+    if ( ret < 0 ) {
+        return -1;
+    }
+
+    /* Set promiscuous mode, and resolve the main VSI */
+    ret = i40e_ac_set_promisc(dev);
+    if ( 0 != ret ) {
+        return -1;
+    }
+    ret = _ac_get_vsi(dev, dev->seid);
+    if ( 0 != ret ) {
+        return -1;
+    }
+    ret = _ac_update_vsi_queues(dev, dev->seid, dev->nqueues);
+    if ( 0 != ret ) {
+        return -1;
+    }
+
+    /* Spread the flows over the Rx queues */
+    _setup_rss(dev);
+
+    return 0;
+}
+
 /*
  * Get the device MAC address
  */
@@ -108,41 +188,38 @@ _setup_admin_queue(struct i40e_device *dev)
 {
     int i;
     uint64_t m64;
+    void *pa;
+    void *va;
+    uint64_t v2poff;
+    int ret;
 
-    /* Allocate the descriptors of an admin queue and their buffers */
-    dev->atq.len = I40E_AQ_LEN;
-    dev->atq.descs = malloc(sizeof(struct i40e_aq_desc) * dev->atq.len);
-    if ( NULL == dev->atq.descs ) {
+    /* Allocate physically contiguous memory for the admin queues */
+    ret = syscall(SYS_pix_malloc, I40E_AQ_MEMSIZE, &pa, &va);
+    if ( ret < 0 ) {
         return -1;
     }
+    v2poff = pa - va;
+    memset(va, 0, I40E_AQ_MEMSIZE);
+
+    /* Allocate the descriptors of an admin queue and their buffers */
+    dev->atq.len = I40E_AQ_LEN;
+    dev->atq.descs = va;
+    va += sizeof(struct i40e_aq_desc) * dev->atq.len;
     dev->atq.tail = 0;
-    dev->atq.bufset = malloc(I40E_AQ_BUF * dev->atq.len);
-    if ( NULL == dev->atq.bufset ) {
-        free(dev->atq.descs);
-        return -1;
-    }
+    dev->atq.bufset = va;
+    va += I40E_AQ_BUF * dev->atq.len;
     /* Resolve the physical address */
-    dev->atq.base = NULL;       /* FIXME */
-    dev->atq.pbufset = NULL;    /* FIXME */
+    dev->atq.base = (void *)dev->atq.descs + v2poff;
+    dev->atq.pbufset = (void *)dev->atq.bufset + v2poff;
 
     dev->arq.len = I40E_AQ_LEN;
-    dev->arq.descs = malloc(sizeof(struct i40e_aq_desc) * dev->arq.len);
-    if ( NULL == dev->arq.descs ) {
-        free(dev->atq.descs);
-        free(dev->atq.bufset);
-        return -1;
-    }
+    dev->arq.descs = va;
+    va += sizeof(struct i40e_aq_desc) * dev->arq.len;
     dev->arq.tail = 0;
-    dev->arq.bufset = malloc(I40E_AQ_BUF * dev->arq.len);
-    if ( NULL == dev->arq.bufset ) {
-        free(dev->atq.descs);
-        free(dev->atq.bufset);
-        free(dev->arq.descs);
-        return -1;
-    }
+    dev->arq.bufset = va;
     /* Resolve the physical address */
-    dev->arq.base = NULL;       /* FIXME */
-    dev->arq.pbufset = NULL;    /* FIXME */
+    dev->arq.base = (void *)dev->arq.descs + v2poff;
+    dev->arq.pbufset = (void *)dev->arq.bufset + v2poff;
 
     /* Set up the Rx descriptors */
     for ( i = 0; i < dev->arq.len; i++ ) {
@@ -154,7 +231,7 @@ _setup_admin_queue(struct i40e_device *dev)
         dev->arq.descs[i].cookiel = 0;
         dev->arq.descs[i].param0 = 0;
         dev->arq.descs[i].param1 = 0;
-        m64 = (uint64_t)dev->arq.pbufset + (i + I40E_AQ_BUF);
+        m64 = (uint64_t)dev->arq.pbufset + (i * I40E_AQ_BUF);
         dev->arq.descs[i].addrh = m64 >> 32;
         dev->arq.descs[i].addrl = m64;
     }
@@ -174,10 +251,113 @@ _setup_admin_queue(struct i40e_device *dev)
     wr32(dev->mmio, I40E_PF_ARQBAL, (uint32_t)m64);
     wr32(dev->mmio, I40E_PF_ARQBAH, m64 >> 32);
     wr32(dev->mmio, I40E_PF_ARQLEN, dev->arq.len | (1ULL << 31));
+    /* Post all the buffers */
+    wr32(dev->mmio, I40E_PF_ARQT, dev->arq.len - 1);
+
+    return 0;
+}
+
+/*
+ * Setup the HMC with a direct segment descriptor to hold the LAN Tx/Rx queue
+ * contexts
+ */
+static int
+_setup_hmc(struct i40e_device *dev)
+{
+    void *pa;
+    void *va;
+    uint64_t off;
+    uint64_t m64;
+    int ret;
+
+    /* Allocate a 2 MiB aligned backing page */
+    ret = syscall(SYS_pix_malloc, I40E_HMC_SIZE, &pa, &va);
+    if ( ret < 0 ) {
+        return -1;
+    }
+    memset(va, 0, I40E_HMC_SIZE);
+    dev->hmc = va;
+
+    /* Object sizes (in log2) */
+    dev->hmc_txobjsz = 1 << (rd32(dev->mmio, I40E_GLHMC_LANTXOBJSZ) & 0xf);
+    dev->hmc_rxobjsz = 1 << (rd32(dev->mmio, I40E_GLHMC_LANRXOBJSZ) & 0xf);
+
+    /* Lay out the LAN Tx queue contexts, and then the Rx queue contexts */
+    off = 0;
+    dev->hmc_txbase = off;
+    off += dev->hmc_txobjsz * dev->nqueues;
+    off = (off + I40E_HMC_BASE_UNIT - 1) / I40E_HMC_BASE_UNIT
+        * I40E_HMC_BASE_UNIT;
+    dev->hmc_rxbase = off;
+    off += dev->hmc_rxobjsz * dev->nqueues;
+    off = (off + I40E_HMC_BASE_UNIT - 1) / I40E_HMC_BASE_UNIT
+        * I40E_HMC_BASE_UNIT;
+    if ( off > I40E_HMC_SIZE ) {
+        return -1;
+    }
+    wr32(dev->mmio, I40E_GLHMC_LANTXBASE(dev->pf),
+         dev->hmc_txbase / I40E_HMC_BASE_UNIT);
+    wr32(dev->mmio, I40E_GLHMC_LANTXCNT(dev->pf), dev->nqueues);
+    wr32(dev->mmio, I40E_GLHMC_LANRXBASE(dev->pf),
+         dev->hmc_rxbase / I40E_HMC_BASE_UNIT);
+    wr32(dev->mmio, I40E_GLHMC_LANRXCNT(dev->pf), dev->nqueues);
+    /* No FCoE object */
+    wr32(dev->mmio, I40E_GLHMC_FCOEDDPBASE(dev->pf), off / I40E_HMC_BASE_UNIT);
+    wr32(dev->mmio, I40E_GLHMC_FCOEDDPCNT(dev->pf), 0);
+    wr32(dev->mmio, I40E_GLHMC_FCOEFBASE(dev->pf), off / I40E_HMC_BASE_UNIT);
+    wr32(dev->mmio, I40E_GLHMC_FCOEFCNT(dev->pf), 0);
+
+    /* Segment descriptor #0 */
+    m64 = (uint64_t)pa;
+    wr32(dev->mmio, I40E_PFHMC_SDDATAHIGH, m64 >> 32);
+    wr32(dev->mmio, I40E_PFHMC_SDDATALOW, (m64 & 0xffffffff)
+         | (I40E_HMC_BP_COUNT << I40E_PFHMC_SDDATALOW_BPCOUNT_SHIFT)
+         | I40E_PFHMC_SDDATALOW_DIRECT | I40E_PFHMC_SDDATALOW_VALID);
+    wr32(dev->mmio, I40E_PFHMC_SDCMD, 0 | I40E_PFHMC_SDCMD_WR);
 
     return 0;
 }
 
+/*
+ * Setup RSS with a symmetric key so that both directions of a flow are
+ * received at the same queue
+ */
+static void
+_setup_rss(struct i40e_device *dev)
+{
+    int i;
+
+    for ( i = 0; i < I40E_PFQF_HKEY_SIZE; i++ ) {
+        wr32(dev->mmio, I40E_PFQF_HKEY(i), I40E_RSS_KEY);
+    }
+    wr32(dev->mmio, I40E_PFQF_HENA(0), (uint32_t)I40E_RSS_HENA);
+    wr32(dev->mmio, I40E_PFQF_HENA(1), (uint32_t)(I40E_RSS_HENA >> 32));
+
+    _setup_rss_lut(dev);
+}
+
+/*
+ * Fill the RSS lookup table with the enabled Rx queues
+ */
+static void
+_setup_rss_lut(struct i40e_device *dev)
+{
+    uint32_t m32;
+    int n;
+    int i;
+    int j;
+
+    n = dev->nrxq > 0 ? dev->nrxq : 1;
+    for ( i = 0; i < I40E_PFQF_HLUT_SIZE; i++ ) {
+        /* Four entries per register */
+        m32 = 0;
+        for ( j = 0; j < 4; j++ ) {
+            m32 |= (uint32_t)((i * 4 + j) % n) << (j * 8);
+        }
+        wr32(dev->mmio, I40E_PFQF_HLUT(i), m32);
+    }
+}
+
 /*
  * Get version by admin command
  */
@@ -206,7 +386,7 @@ i40e_ac_get_ver(struct i40e_device *dev, int *major, int *minor, int *build,
     desc->addrl = 0x00010001;
 
     /* Advance the tail pointer */
-    dev->atq.tail = dev->atq.tail < dev->atq.len ? dev->atq.tail + 1 : 0;
+    dev->atq.tail = dev->atq.tail + 1 < dev->atq.len ? dev->atq.tail + 1 : 0;
 
     /* Write the tail pointer to the NIC */
     wr32(dev->mmio, I40E_PF_ATQT, dev->atq.tail);
@@ -254,7 +434,7 @@ i40e_ac_clear_pxe(struct i40e_device *dev)
     desc->addrl = 0;
 
     /* Advance the tail pointer */
-    dev->atq.tail = dev->atq.tail < dev->atq.len ? dev->atq.tail + 1 : 0;
+    dev->atq.tail = dev->atq.tail + 1 < dev->atq.len ? dev->atq.tail + 1 : 0;
 
     /* Write the tail pointer to the NIC */
     wr32(dev->mmio, I40E_PF_ATQT, dev->atq.tail);
@@ -296,7 +476,7 @@ i40e_ac_disable_lldp(struct i40e_device *dev)
     desc->addrl = 0;
 
     /* Advance the tail pointer */
-    dev->atq.tail = dev->atq.tail < dev->atq.len ? dev->atq.tail + 1 : 0;
+    dev->atq.tail = dev->atq.tail + 1 < dev->atq.len ? dev->atq.tail + 1 : 0;
 
     /* Write the tail pointer to the NIC */
     wr32(dev->mmio, I40E_PF_ATQT, dev->atq.tail);
@@ -338,7 +518,7 @@ i40e_set_mac_config(struct i40e_device *dev, int mtu)
     desc->addrl = 0;
 
     /* Advance the tail pointer */
-    dev->atq.tail = dev->atq.tail < dev->atq.len ? dev->atq.tail + 1 : 0;
+    dev->atq.tail = dev->atq.tail + 1 < dev->atq.len ? dev->atq.tail + 1 : 0;
 
     /* Write the tail pointer to the NIC */
     wr32(dev->mmio, I40E_PF_ATQT, dev->atq.tail);
@@ -381,7 +561,7 @@ i40e_ac_set_promisc_vsi(struct i40e_device *dev, uint16_t seid)
     desc->addrl = 0;
 
     /* Advance the tail pointer */
-    dev->atq.tail = dev->atq.tail < dev->atq.len ? dev->atq.tail + 1 : 0;
+    dev->atq.tail = dev->atq.tail + 1 < dev->atq.len ? dev->atq.tail + 1 : 0;
 
     /* Write the tail pointer to the NIC */
     wr32(dev->mmio, I40E_PF_ATQT, dev->atq.tail);
@@ -422,10 +602,10 @@ i40e_ac_set_promisc(struct i40e_device *dev)
     desc->param1 = 0;
     m64 = (uint64_t)dev->atq.pbufset + (idx * I40E_AQ_BUF);
     desc->addrh = m64 >> 32;
-    desc->addrh = m64;
+    desc->addrl = m64;
 
     /* Advance the tail pointer */
-    dev->atq.tail = dev->atq.tail < dev->atq.len ? dev->atq.tail + 1 : 0;
+    dev->atq.tail = dev->atq.tail + 1 < dev->atq.len ? dev->atq.tail + 1 : 0;
 
     /* Write the tail pointer to the NIC */
     wr32(dev->mmio, I40E_PF_ATQT, dev->atq.tail);
@@ -451,8 +631,13 @@ i40e_ac_set_promisc(struct i40e_device *dev)
         return -1;
     }
     /* Find out VSI */
+    dev->seid = 0;
     for ( i = 0; i < hdr->num_elem; i++ ) {
         if ( 0x13 == elem[i].elem_type ) {
+            if ( 0 == dev->seid ) {
+                /* Main VSI */
+                dev->seid = elem[i].seid;
+            }
             /* This is a VSI, then try to set promiscuous mode */
             ret = i40e_ac_set_promisc_vsi(dev, elem[i].seid);
         }
@@ -461,6 +646,278 @@ i40e_ac_set_promisc(struct i40e_device *dev)
     return 0;
 }
 
+/*
+ * Get the VSI parameters to resolve the queue set handle used by Tx queues
+ */
+static int
+_ac_get_vsi(struct i40e_device *dev, uint16_t seid)
+{
+    int idx;
+    int ret;
+    struct i40e_aq_desc *desc;
+    struct i40e_aq_vsi_properties *prop;
+    uint64_t m64;
+
+    /* Save the tail pointer */
+    idx = dev->atq.tail;
+
+    /* Get VSI parameters */
+    desc = &dev->atq.descs[idx];
+    desc->flags = I40E_AQ_FLAG_BUF;
+    desc->opcode = I40E_AQC_GET_VSI;
+    desc->len = sizeof(struct i40e_aq_vsi_properties);
+    desc->ret = 0;
+    desc->cookieh = 0x2345;
+    desc->cookiel = 0x6789;
+    desc->param0 = seid;
+    desc->param1 = 0;
+    m64 = (uint64_t)dev->atq.pbufset + (idx * I40E_AQ_BUF);
+    desc->addrh = m64 >> 32;
+    desc->addrl = m64;
+
+    /* Advance the tail pointer */
+    dev->atq.tail = dev->atq.tail + 1 < dev->atq.len ? dev->atq.tail + 1 : 0;
+
+    /* Write the tail pointer to the NIC */
+    wr32(dev->mmio, I40E_PF_ATQT, dev->atq.tail);
+
+    /* Wait until the response is received */
+    while ( !(dev->atq.descs[idx].flags & I40E_AQ_FLAG_DD) ) {
+    }
+
+    /* Get the return value */
+    ret = dev->atq.descs[idx].ret;
+    if ( 0 != ret ) {
+        return ret;
+    }
+
+    /* Queue set handle of the traffic class 0 */
+    prop = (struct i40e_aq_vsi_properties *)
+        (dev->atq.bufset + (idx * I40E_AQ_BUF));
+    dev->qs_handle = prop->qs_handle[0];
+
+    return 0;
+}
+
+/*
+ * Map the first nq (power of two) queues of the PF to the traffic class 0 of
+ * the VSI
+ */
+static int
+_ac_update_vsi_queues(struct i40e_device *dev, uint16_t seid, int nq)
+{
+    int idx;
+    int ret;
+    struct i40e_aq_desc *desc;
+    struct i40e_aq_vsi_properties *prop;
+    uint64_t m64;
+
+    /* Save the tail pointer */
+    idx = dev->atq.tail;
+
+    /* Build the queue mapping section only */
+    prop = (struct i40e_aq_vsi_properties *)
+        (dev->atq.bufset + (idx * I40E_AQ_BUF));
+    memset(prop, 0, sizeof(struct i40e_aq_vsi_properties));
+    prop->valid_sections = I40E_AQ_VSI_PROP_QUEUE_MAP_VALID;
+    prop->mapping_flags = 0;
+    prop->queue_mapping[0] = 0;
+    prop->tc_mapping[0] = (0 << 0)
+        | (__builtin_ctz(nq) << I40E_AQ_VSI_TC_QUE_NUMBER_SHIFT);
+
+    /* Update VSI parameters */
+    desc = &dev->atq.descs[idx];
+    desc->flags = I40E_AQ_FLAG_BUF | I40E_AQ_FLAG_RD;
+    desc->opcode = I40E_AQC_UPDATE_VSI;
+    desc->len = sizeof(struct i40e_aq_vsi_properties);
+    desc->ret = 0;
+    desc->cookieh = 0x3456;
+    desc->cookiel = 0x789a;
+    desc->param0 = seid;
+    desc->param1 = 0;
+    m64 = (uint64_t)dev->atq.pbufset + (idx * I40E_AQ_BUF);
+    desc->addrh = m64 >> 32;
+    desc->addrl = m64;
+
+    /* Advance the tail pointer */
+    dev->atq.tail = dev->atq.tail + 1 < dev->atq.len ? dev->atq.tail + 1 : 0;
+
+    /* Write the tail pointer to the NIC */
+    wr32(dev->mmio, I40E_PF_ATQT, dev->atq.tail);
+
+    /* Wait until the response is received */
+    while ( !(dev->atq.descs[idx].flags & I40E_AQ_FLAG_DD) ) {
+    }
+
+    /* Get the return value */
+    ret = dev->atq.descs[idx].ret;
+
+    return ret;
+}
+
+/*
+ * Setup Rx ring
+ */
+int
+i40e_setup_rx_ring(struct i40e_device *dev, struct i40e_rx_ring *rxring,
+                   int idx, void *m, uint64_t v2poff, uint16_t qlen)
+{
+    struct i40e_lan_rxq_ctx *ctx;
+    union i40e_rx_desc *rxdesc;
+    uint32_t m32;
+    uint64_t m64;
+    ssize_t i;
+
+    /* Check the queue index first */
+    if ( idx >= dev->nqueues ) {
+        return -1;
+    }
+
+    rxring->mmio = dev->mmio;
+    rxring->idx = idx;
+
+    rxring->tail = 0;
+    rxring->head = 0;
+    rxring->soft_head = 0;
+    rxring->len = qlen;
+
+    /* Allocate for descriptors */
+    rxring->descs = m;
+    m += sizeof(union i40e_rx_desc) * qlen;
+    rxring->bufs = m;
+
+    for ( i = 0; i < rxring->len; i++ ) {
+        rxdesc = &rxring->descs[i];
+        rxdesc->read.pkt_addr = 0;
+        rxdesc->read.hdr_addr = 0;
+    }
+
+    /* Program the LAN Rx queue context in the HMC */
+    ctx = dev->hmc + dev->hmc_rxbase + dev->hmc_rxobjsz * idx;
+    memset(ctx, 0, sizeof(struct i40e_lan_rxq_ctx));
+    m64 = (uint64_t)rxring->descs + v2poff;
+    ctx->head = 0;
+    ctx->base = m64 >> 7;
+    ctx->qlen = qlen;
+    ctx->dbuff = I40E_RX_BUFSZ >> 7;
+    ctx->hbuff = 0;
+    ctx->dtype = 0;             /* No header split */
+    ctx->dsize = 0;             /* 16-byte descriptors */
+    ctx->crcstrip = 1;
+    ctx->l2tsel = 1;
+    ctx->showiv = 0;
+    ctx->rxmax = I40E_MAX_FRAME;
+    ctx->prefena = 1;
+    __sync_synchronize();
+
+    wr32(rxring->mmio, I40E_QRX_TAIL(rxring->idx), 0);
+
+    /* Enable this queue */
+    m32 = rd32(rxring->mmio, I40E_QRX_ENA(rxring->idx));
+    wr32(rxring->mmio, I40E_QRX_ENA(rxring->idx), m32 | I40E_QENA_REQ);
+    for ( i = 0; i < 10; i++ ) {
+        busywait(1);
+        m32 = rd32(rxring->mmio, I40E_QRX_ENA(rxring->idx));
+        if ( m32 & I40E_QENA_STAT ) {
+            break;
+        }
+    }
+    if ( !(m32 & I40E_QENA_STAT) ) {
+        printf("Error on enabling an RX queue. (Q=%d)\n", rxring->idx);
+    }
+
+    /* Spread the flows over the enabled Rx queues */
+    if ( idx >= dev->nrxq ) {
+        dev->nrxq = idx + 1;
+        _setup_rss_lut(dev);
+    }
+
+    return 0;
+}
+
+/*
+ * Setup Tx ring
+ */
+int
+i40e_setup_tx_ring(struct i40e_device *dev, struct i40e_tx_ring *txring,
+                   int idx, void *m, uint64_t v2poff, uint16_t qlen)
+{
+    struct i40e_lan_txq_ctx *ctx;
+    union i40e_tx_desc *txdesc;
+    uint32_t m32;
+    uint64_t m64;
+    int absq;
+    ssize_t i;
+
+    /* Check the queue index first */
+    if ( idx >= dev->nqueues ) {
+        return -1;
+    }
+
+    txring->mmio = dev->mmio;
+    txring->idx = idx;
+
+    txring->tail = 0;
+    txring->head = 0;
+    txring->soft_head = 0;
+    txring->len = qlen;
+
+    /* Allocate for descriptors */
+    txring->descs = m;
+    m += sizeof(union i40e_tx_desc) * qlen;
+    txring->bufs = m;
+    m += sizeof(void *) * qlen;
+    txring->tdwba = m;
+
+    for ( i = 0; i < txring->len; i++ ) {
+        txdesc = &txring->descs[i];
+        memset(txdesc, 0, sizeof(union i40e_tx_desc));
+    }
+    *(txring->tdwba) = 0;
+
+    /* Clear the pre-disable flag of this queue */
+    absq = dev->base_queue + idx;
+    m32 = rd32(txring->mmio, I40E_GLLAN_TXPRE_QDIS(absq / 128));
+    m32 &= ~I40E_GLLAN_TXPRE_QDIS_QINDX_MASK;
+    m32 |= (absq % 128) | I40E_GLLAN_TXPRE_QDIS_CLEAR;
+    wr32(txring->mmio, I40E_GLLAN_TXPRE_QDIS(absq / 128), m32);
+
+    /* Program the LAN Tx queue context in the HMC */
+    ctx = dev->hmc + dev->hmc_txbase + dev->hmc_txobjsz * idx;
+    memset(ctx, 0, sizeof(struct i40e_lan_txq_ctx));
+    m64 = (uint64_t)txring->descs + v2poff;
+    ctx->head = 0;
+    ctx->newctx = 1;
+    ctx->base = m64 >> 7;
+    ctx->qlen = qlen;
+    /* Write-back */
+    ctx->head_wben = 1;
+    ctx->head_wbaddr = (uint64_t)txring->tdwba + v2poff;
+    ctx->rdylist = dev->qs_handle;
+    __sync_synchronize();
+
+    /* Associate this queue with the PF */
+    wr32(txring->mmio, I40E_QTX_CTL(txring->idx),
+         I40E_QTX_CTL_PF_QUEUE | (dev->pf << I40E_QTX_CTL_PF_INDX_SHIFT));
+    wr32(txring->mmio, I40E_QTX_TAIL(txring->idx), 0);
+
+    /* Enable this queue */
+    m32 = rd32(txring->mmio, I40E_QTX_ENA(txring->idx));
+    wr32(txring->mmio, I40E_QTX_ENA(txring->idx), m32 | I40E_QENA_REQ);
+    for ( i = 0; i < 10; i++ ) {
+        busywait(1);
+        m32 = rd32(txring->mmio, I40E_QTX_ENA(txring->idx));
+        if ( m32 & I40E_QENA_STAT ) {
+            break;
+        }
+    }
+    if ( !(m32 & I40E_QENA_STAT) ) {
+        printf("Error on enabling a TX queue. (Q=%d)\n", txring->idx);
+    }
+
+    return 0;
+}
+
 /*
  * Local variables:
  * tab-width: 4
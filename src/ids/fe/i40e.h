@@ -25,6 +25,7 @@
 #define _I40E_H
 
 #include <stdint.h>
+#include <sys/pix.h>
 #include <mki/driver.h>
 #include "pci.h"
 #include "common.h"
@@ -34,6 +35,8 @@
 
 #define I40E_MMIO_SIZE          0x200000
 #define I40E_PFLAN_QALLOC       0x001c0400  /* RO */
+#define I40E_PF_FUNC_RID        0x0009c000  /* RO */
+#define I40E_PFGEN_PORTNUM      0x001c0480  /* RO */
 
 #define I40E_GLLAN_TXPRE_QDIS(n) (0x000e6500 + 0x4 * (n))
 
@@ -45,11 +48,26 @@
 #define I40E_QRX_ENA(q)         (0x00120000 + 0x4 * (q))
 #define I40E_QRX_TAIL(q)        (0x00128000 + 0x4 * (q))
 
+/* QTX_ENA/QRX_ENA */
+#define I40E_QENA_REQ           (1 << 0)
+#define I40E_QENA_STAT          (1 << 2)
+/* QTX_CTL */
+#define I40E_QTX_CTL_PF_QUEUE   2
+#define I40E_QTX_CTL_PF_INDX_SHIFT      2
+/* GLLAN_TXPRE_QDIS */
+#define I40E_GLLAN_TXPRE_QDIS_QINDX_MASK 0x7ff
+#define I40E_GLLAN_TXPRE_QDIS_CLEAR     (1UL << 31)
+
 #define I40E_GLHMC_LANTXBASE(n) (0x000c6200 + 0x4 * (n)) /* [0:23] */
 #define I40E_GLHMC_LANTXCNT(n)  (0x000c6300 + 0x4 * (n)) /* [0:10] */
 #define I40E_GLHMC_LANRXBASE(n) (0x000c6400 + 0x4 * (n)) /* [0:23] */
 #define I40E_GLHMC_LANRXCNT(n)  (0x000c6500 + 0x4 * (n)) /* [0:10] */
 
+#define I40E_GLHMC_FCOEDDPBASE(n) (0x000c6600 + 0x4 * (n)) /* [0:23] */
+#define I40E_GLHMC_FCOEDDPCNT(n)  (0x000c6700 + 0x4 * (n)) /* [0:19] */
+#define I40E_GLHMC_FCOEFBASE(n)   (0x000c6800 + 0x4 * (n)) /* [0:23] */
+#define I40E_GLHMC_FCOEFCNT(n)    (0x000c6900 + 0x4 * (n)) /* [0:22] */
+
 #define I40E_GLHMC_LANTXOBJSZ   0x000c2004 /* [0:3] RO */
 #define I40E_GLHMC_LANRXOBJSZ   0x000c200c /* [0:3] RO */
 
@@ -59,6 +77,29 @@
 #define I40E_PFHMC_PDINV        0x000c0300
 #define I40E_GLHMC_SDPART(n)    (0x000c0800 + 0x04 * (n)) /* RO */
 
+#define I40E_PFHMC_SDCMD_WR             (1UL << 31)
+#define I40E_PFHMC_SDDATALOW_VALID      (1 << 0)
+#define I40E_PFHMC_SDDATALOW_DIRECT     (1 << 1)
+#define I40E_PFHMC_SDDATALOW_BPCOUNT_SHIFT      2
+
+/* HMC base registers are in 512-byte units */
+#define I40E_HMC_BASE_UNIT      512
+/* # of backing pages (4 KiB) of a direct segment descriptor (2 MiB) */
+#define I40E_HMC_BP_COUNT       512
+
+#define I40E_PFQF_HLUT(n)       (0x00240000 + 0x80 * (n)) /* n=0..127 */
+#define I40E_PFQF_HKEY(n)       (0x00244800 + 0x80 * (n)) /* n=0..12 */
+#define I40E_PFQF_HENA(n)       (0x00245900 + 0x80 * (n)) /* n=0..1 */
+#define I40E_PFQF_HLUT_SIZE     128
+#define I40E_PFQF_HKEY_SIZE     13
+/* Symmetric RSS hash key written to each HKEY register */
+#define I40E_RSS_KEY            0x6d5a6d5a
+/* Packet classifier types to be hashed: non-fragmented IPv4/IPv6
+   TCP/UDP/other, and fragmented IPv4/IPv6 */
+#define I40E_RSS_HENA           ((1ULL << 31) | (1ULL << 33) | (1ULL << 35) \
+                                 | (1ULL << 36) | (1ULL << 41) | (1ULL << 43) \
+                                 | (1ULL << 45) | (1ULL << 46))
+
 
 #define I40E_PRTPM_SAL(n)       (0x001e4440 + 0x20 * (n)) /* RO */
 #define I40E_PRTPM_SAH(n)       (0x001e44c0 + 0x20 * (n)) /* RO */
@@ -69,7 +110,17 @@
 
 #define I40E_GLLAN_RCTL_0       0x0012a500
 
+#define I40E_GLPRT_GORCL(n)     (0x00300000 + 0x8 * (n))
+#define I40E_GLPRT_CRCERRS(n)   (0x00300080 + 0x8 * (n))
+#define I40E_GLPRT_UPRCL(n)     (0x003005a0 + 0x8 * (n))
+#define I40E_GLPRT_MPRCL(n)     (0x003005c0 + 0x8 * (n))
+#define I40E_GLPRT_BPRCL(n)     (0x003005e0 + 0x8 * (n))
+#define I40E_GLPRT_RDPC(n)      (0x00300600 + 0x8 * (n))
 #define I40E_GLPRT_GOTC(n)      (0x00300680 + 0x8 * (n))
+#define I40E_GLPRT_UPTCL(n)     (0x003009c0 + 0x8 * (n))
+#define I40E_GLPRT_MPTCL(n)     (0x003009e0 + 0x8 * (n))
+#define I40E_GLPRT_BPTCL(n)     (0x00300a00 + 0x8 * (n))
+#define I40E_CNT48_MASK         0xffffffffffffULL
 
 #define I40E_PRTGL_SAL          0x001e2120
 #define I40E_PRTGL_SAH          0x001e2140
@@ -92,8 +143,42 @@
 
 #define I40E_AQ_LEN             128
 #define I40E_AQ_BUF             4096
-
-#define I40E_HMC_SIZE           (4 * 1024 * 1024)
+/* Memory size for the Tx and Rx admin queues and their buffers */
+#define I40E_AQ_MEMSIZE                                                 \
+    (2 * I40E_AQ_LEN * (sizeof(struct i40e_aq_desc) + I40E_AQ_BUF))
+
+/* Admin queue descriptor flags */
+#define I40E_AQ_FLAG_DD         (1 << 0)
+#define I40E_AQ_FLAG_LB         (1 << 9)
+#define I40E_AQ_FLAG_RD         (1 << 10)
+#define I40E_AQ_FLAG_BUF        (1 << 12)
+
+/* Admin commands */
+#define I40E_AQC_UPDATE_VSI     0x0211
+#define I40E_AQC_GET_VSI        0x0212
+/* VSI properties */
+#define I40E_AQ_VSI_PROP_QUEUE_MAP_VALID        0x0040
+#define I40E_AQ_VSI_TC_QUE_NUMBER_SHIFT         9
+
+/* One direct segment (2 MiB aligned) backs the LAN queue contexts */
+#define I40E_HMC_SIZE           (2 * 1024 * 1024)
+
+/* Max # of queue pairs used per PF (power of two) */
+#define I40E_MAX_QUEUES         64
+/* Rx buffer size (in 128-byte units on the context) and max frame size */
+#define I40E_RX_BUFSZ           9728
+#define I40E_MAX_FRAME          9728
+
+/* Rx descriptor write-back (qword 1) */
+#define I40E_RXD_DD             (1ULL << 0)
+#define I40E_RXD_LEN_SHIFT      38
+#define I40E_RXD_LEN_MASK       0x3fff
+/* Tx data descriptor command */
+#define I40E_TXD_CMD_EOP        (1 << 0)
+#define I40E_TXD_CMD_RS         (1 << 1)
+#define I40E_TXD_CMD_ICRC       (1 << 2)
+#define I40E_TXD_CMD_SHIFT      4
+#define I40E_TXD_BUFSZ_SHIFT    18
 
 /*
  * Receive descriptor
@@ -194,8 +279,89 @@ struct i40e_device {
 
     /* HMC */
     void *hmc;
+    uint64_t hmc_txbase;        /* Offset of LAN Tx queue contexts */
+    uint64_t hmc_rxbase;        /* Offset of LAN Rx queue contexts */
+    uint32_t hmc_txobjsz;
+    uint32_t hmc_rxobjsz;
+
+    /* Physical function */
+    int pf;
+    int port;
+    /* Absolute index of the first queue assigned to this PF */
+    int base_queue;
+    /* # of queue pairs mapped to the main VSI */
+    int nqueues;
+    /* # of enabled Rx queues the flows are spread over */
+    int nrxq;
+    /* Main VSI */
+    uint16_t seid;
+    uint16_t qs_handle;
+
+    /* Last values of the statistics counters (not cleared on read) */
+    struct pix_fe_hw_stats last;
+};
+
+/*
+ * Rx ring buffer
+ */
+struct i40e_rx_ring {
+    union i40e_rx_desc *descs;
+    void **bufs;
+    uint16_t tail;
+    uint16_t head;
+    uint16_t soft_head;
+    uint16_t len;
+    /* Queue information */
+    uint16_t idx;               /* Queue index */
+    void *mmio;                 /* MMIO */
+};
+
+/*
+ * Tx ring buffer
+ */
+struct i40e_tx_ring {
+    union i40e_tx_desc *descs;
+    void **bufs;
+    uint16_t tail;
+    uint16_t head;
+    uint16_t soft_head;
+    uint16_t len;
+    /* Head write-back */
+    volatile uint32_t *tdwba;
+    /* Queue information */
+    uint16_t idx;               /* Queue index */
+    void *mmio;                 /* MMIO */
 };
 
+/*
+ * VSI properties (a part of the admin command buffer)
+ */
+struct i40e_aq_vsi_properties {
+    uint16_t valid_sections;
+    uint16_t switch_id;
+    uint8_t sw_rsv[2];
+    uint8_t sec_flags;
+    uint8_t sec_rsv;
+    uint16_t pvid;
+    uint16_t fcoe_pvid;
+    uint8_t port_vlan_flags;
+    uint8_t pvlan_rsv[3];
+    uint32_t ingress_table;
+    uint32_t egress_table;
+    uint16_t cas_pv_tag;
+    uint8_t cas_pv_flags;
+    uint8_t cas_pv_rsv;
+    uint16_t mapping_flags;     /* 0: contiguous */
+    uint16_t queue_mapping[16];
+    uint16_t tc_mapping[8];
+    uint8_t queueing_opt_flags;
+    uint8_t queueing_opt_rsv[3];
+    uint16_t qs_handle[8];
+    uint32_t outer_up_table;
+    uint8_t cmd_rsv[8];
+    uint8_t resp_rsv[12];
+} __attribute__ ((packed));
+
 
 
 
@@ -234,7 +400,8 @@ struct i40e_lan_rxq_ctx {
     uint64_t tphhead:1;
     uint64_t rsv5:1;
     uint64_t lrxqtresh:3;
-    uint64_t rsv6:55;
+    uint64_t prefena:1;
+    uint64_t rsv6:54;
 } __attribute__ ((packed));
 
 /*
@@ -305,7 +472,280 @@ struct i40e_adm_get_switch_config_elem {
 } __attribute__ ((packed));
 
 /* Prototype declarations */
+struct i40e_device *
+i40e_init(uint16_t, uint16_t, uint16_t, uint16_t);
+int i40e_init_hw(struct i40e_device *);
 int i40e_read_mac_address(struct i40e_device *);
+int i40e_ac_get_ver(struct i40e_device *, int *, int *, int *, int *);
+int i40e_ac_clear_pxe(struct i40e_device *);
+int i40e_ac_disable_lldp(struct i40e_device *);
+int i40e_set_mac_config(struct i40e_device *, int);
+int i40e_ac_set_promisc_vsi(struct i40e_device *, uint16_t);
+int i40e_ac_set_promisc(struct i40e_device *);
+int i40e_setup_rx_ring(struct i40e_device *, struct i40e_rx_ring *, int,
+                       void *, uint64_t, uint16_t);
+int i40e_setup_tx_ring(struct i40e_device *, struct i40e_tx_ring *, int,
+                       void *, uint64_t, uint16_t);
+
+/*
+ * Check if the device is i40e
+ */
+static __inline__ int
+i40e_is_i40e(uint16_t vendor_id, uint16_t device_id)
+{
+    if ( 0x8086 != vendor_id ) {
+        return 0;
+    }
+    switch ( device_id ) {
+    case I40E_XL710QDA1:
+    case I40E_XL710QDA2:
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+/*
+ * The number of supported Tx queues
+ */
+static __inline__ int
+i40e_max_tx_queues(struct i40e_device *dev)
+{
+    return dev->nqueues;
+}
+
+/*
+ * The number of supported Rx queues (spread by RSS)
+ */
+static __inline__ int
+i40e_max_rx_queues(struct i40e_device *dev)
+{
+    return dev->nqueues;
+}
+
+/*
+ * RSS hash key (the low byte of each register first), and the size of the
+ * lookup table of the PF (128 entries unless enlarged in PFQF_CTL_0)
+ */
+static __inline__ int
+i40e_rss_key(struct i40e_device *dev, uint8_t *key, int len, int *lutsz)
+{
+    int i;
+
+    for ( i = 0; i < len && i < I40E_PFQF_HKEY_SIZE * 4; i++ ) {
+        key[i] = (I40E_RSS_KEY >> ((i & 3) * 8)) & 0xff;
+    }
+    *lutsz = I40E_PFQF_HLUT_SIZE;
+
+    return 0;
+}
+
+static __inline__ int
+i40e_rx_refill(struct i40e_rx_ring *rxring, void *pkt, void *hdr)
+{
+    union i40e_rx_desc *rxdesc;
+    uint16_t new_tail;
+
+    new_tail = rxring->tail + 1 < rxring->len ? rxring->tail + 1 : 0;
+    if ( new_tail == rxring->soft_head ) {
+        /* Buffer is full */
+        return 0;
+    }
+    rxdesc = &rxring->descs[rxring->tail];
+    rxdesc->read.pkt_addr = (uint64_t)pkt;
+    rxdesc->read.hdr_addr = 0;
+    rxring->bufs[rxring->tail] = hdr;
+    rxring->tail = new_tail;
+
+    return 1;
+}
+
+static __inline__ void
+i40e_rx_commit(struct i40e_rx_ring *rxring)
+{
+    __sync_synchronize();
+    wr32(rxring->mmio, I40E_QRX_TAIL(rxring->idx), rxring->tail);
+}
+
+/*
+ * Dequeue a received packet.  The head is not readable without the HMC, so
+ * the DD bit of the written-back descriptor is checked instead.
+ */
+static __inline__ int
+i40e_rx_dequeue(struct i40e_rx_ring *rxring, void **hdr)
+{
+    uint64_t qw1;
+    int len;
+
+    if ( rxring->soft_head == rxring->tail ) {
+        /* No buffer posted */
+        return -1;
+    }
+    qw1 = rxring->descs[rxring->soft_head].read.hdr_addr;
+    if ( !(qw1 & I40E_RXD_DD) ) {
+        return -1;
+    }
+    *hdr = rxring->bufs[rxring->soft_head];
+    len = (qw1 >> I40E_RXD_LEN_SHIFT) & I40E_RXD_LEN_MASK;
+    rxring->soft_head
+        = rxring->soft_head + 1 < rxring->len ? rxring->soft_head + 1 : 0;
+    rxring->head = rxring->soft_head;
+
+    return len;
+}
+
+/*
+ * Prefetch the descriptor k ahead of the head, and return its packet buffer if
+ * it has already been received
+ */
+static __inline__ void *
+i40e_rx_prefetch(struct i40e_rx_ring *rxring, int k)
+{
+    int posted;
+    int idx;
+
+    /* # of descriptors owned by the hardware */
+    posted = (int)rxring->tail - (int)rxring->soft_head;
+    if ( posted < 0 ) {
+        posted += rxring->len;
+    }
+    if ( k >= posted ) {
+        return NULL;
+    }
+    idx = rxring->soft_head + k;
+    if ( idx >= rxring->len ) {
+        idx -= rxring->len;
+    }
+    __builtin_prefetch(&rxring->descs[idx]);
+    if ( !(rxring->descs[idx].read.hdr_addr & I40E_RXD_DD) ) {
+        return NULL;
+    }
+
+    return rxring->bufs[idx];
+}
+
+/*
+ * Check if the next Rx descriptor has been written back (without MMIO)
+ */
+static __inline__ int
+i40e_rx_ready(struct i40e_rx_ring *rxring)
+{
+    if ( rxring->soft_head == rxring->tail ) {
+        return 0;
+    }
+
+    /* DD bit */
+    return rxring->descs[rxring->soft_head].read.hdr_addr & I40E_RXD_DD;
+}
+
+static __inline__ int
+i40e_tx_enqueue(struct i40e_tx_ring *txring, void *pkt, void *hdr,
+                size_t length)
+{
+    union i40e_tx_desc *txdesc;
+    uint16_t new_tail;
+
+    new_tail = txring->tail + 1 < txring->len ? txring->tail + 1 : 0;
+    if ( new_tail == txring->soft_head ) {
+        /* Buffer is full */
+        return 0;
+    }
+    txdesc = &txring->descs[txring->tail];
+    txdesc->data.pkt_addr = (uint64_t)pkt;
+    txdesc->data.rsv_cmd_dtyp
+        = (I40E_TXD_CMD_EOP | I40E_TXD_CMD_RS | I40E_TXD_CMD_ICRC)
+        << I40E_TXD_CMD_SHIFT;
+    txdesc->data.txbufsz_offset = (uint32_t)length << I40E_TXD_BUFSZ_SHIFT;
+    txdesc->data.l2tag = 0;
+    txring->bufs[txring->tail] = hdr;
+    txring->tail = new_tail;
+
+    return 1;
+}
+
+static __inline__ void
+i40e_tx_commit(struct i40e_tx_ring *txring)
+{
+    __sync_synchronize();
+    wr32(txring->mmio, I40E_QTX_TAIL(txring->idx), txring->tail);
+}
+
+static __inline__ int
+i40e_calc_rx_ring_memsize(struct i40e_rx_ring *rx, uint16_t qlen)
+{
+    (void)rx;
+    return (sizeof(union i40e_rx_desc) + sizeof(void *)) * qlen;
+}
+static __inline__ int
+i40e_calc_tx_ring_memsize(struct i40e_tx_ring *tx, uint16_t qlen)
+{
+    (void)tx;
+    return (sizeof(union i40e_tx_desc) + sizeof(void *)) * qlen + 128;
+}
+
+/*
+ * Collect up to n transmitted buffers using the head write-back
+ */
+static __inline__ int
+i40e_collect_buffers(struct i40e_tx_ring *txring, void **hdrs, int n)
+{
+    int i;
+
+    txring->head = *txring->tdwba;
+    for ( i = 0; i < n && txring->soft_head != txring->head; i++ ) {
+        hdrs[i] = txring->bufs[txring->soft_head];
+        txring->soft_head
+            = txring->soft_head + 1 < txring->len ? txring->soft_head + 1 : 0;
+    }
+
+    return i;
+}
+
+/*
+ * Read a 48-bit port statistics counter
+ */
+static __inline__ uint64_t
+i40e_rd48(void *mmio, uint64_t reg)
+{
+    uint64_t m64;
+
+    m64 = rd32(mmio, reg);
+    m64 |= (uint64_t)(rd32(mmio, reg + 4) & 0xffff) << 32;
+
+    return m64;
+}
+
+/*
+ * Accumulate the hardware statistics counters.  The port counters of i40e are
+ * not cleared on read, so the differences from the last values are added.
+ */
+static __inline__ void
+i40e_read_hw_stats(struct i40e_device *dev, struct pix_fe_hw_stats *st)
+{
+    struct pix_fe_hw_stats cur;
+    int p;
+
+    p = dev->port;
+    cur.rx_pkts = i40e_rd48(dev->mmio, I40E_GLPRT_UPRCL(p))
+        + i40e_rd48(dev->mmio, I40E_GLPRT_MPRCL(p))
+        + i40e_rd48(dev->mmio, I40E_GLPRT_BPRCL(p));
+    cur.rx_bytes = i40e_rd48(dev->mmio, I40E_GLPRT_GORCL(p));
+    cur.rx_missed = rd32(dev->mmio, I40E_GLPRT_RDPC(p));
+    cur.rx_crcerrs = rd32(dev->mmio, I40E_GLPRT_CRCERRS(p));
+    cur.tx_pkts = i40e_rd48(dev->mmio, I40E_GLPRT_UPTCL(p))
+        + i40e_rd48(dev->mmio, I40E_GLPRT_MPTCL(p))
+        + i40e_rd48(dev->mmio, I40E_GLPRT_BPTCL(p));
+    cur.tx_bytes = i40e_rd48(dev->mmio, I40E_GLPRT_GOTC(p));
+
+    /* 48-bit and 32-bit counters wrap around */
+    st->rx_pkts += (cur.rx_pkts - dev->last.rx_pkts) & I40E_CNT48_MASK;
+    st->rx_bytes += (cur.rx_bytes - dev->last.rx_bytes) & I40E_CNT48_MASK;
+    st->rx_missed += (uint32_t)(cur.rx_missed - dev->last.rx_missed);
+    st->rx_crcerrs += (uint32_t)(cur.rx_crcerrs - dev->last.rx_crcerrs);
+    st->tx_pkts += (cur.tx_pkts - dev->last.tx_pkts) & I40E_CNT48_MASK;
+    st->tx_bytes += (cur.tx_bytes - dev->last.tx_bytes) & I40E_CNT48_MASK;
+    dev->last = cur;
+}
 
 #endif /* _I40E_H */
 
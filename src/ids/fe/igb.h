@@ -28,9 +28,11 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <time.h>
+#include <sys/pix.h>
 #include <mki/driver.h>
 #include "pci.h"
 #include "common.h"
+#include "offload.h"
 
 #define IGB_I219LM      0x156f
 #define IGB_I211        0x1539
@@ -66,6 +68,9 @@
 
 #define IGB_REG_MTA(n)      (0x5200 + 4 * (n))
 
+#define IGB_REG_RXCSUM      0x5000
+#define IGB_REG_RETA(n)     (0x5c00 + 4 * (n))
+#define IGB_REG_RSSRK(n)    (0x5c80 + 4 * (n))
 #define IGB_REG_MRQC        0x5818
 
 #define IGB_REG_SWSM        0x5b50
@@ -94,6 +99,15 @@
 #define IGB_REG_TDWBAL(n)   (0xe038 + 0x40 * (n))
 #define IGB_REG_TDWBAH(n)   (0xe03c + 0x40 * (n))
 
+#define IGB_REG_CRCERRS     0x4000
+#define IGB_REG_MPC         0x4010
+#define IGB_REG_GPRC        0x4074
+#define IGB_REG_GPTC        0x4080
+#define IGB_REG_GORCL       0x4088
+#define IGB_REG_GORCH       0x408c
+#define IGB_REG_GOTCL       0x4090
+#define IGB_REG_GOTCH       0x4094
+
 
 #define IGB_CTRL_FD         0x1
 #define IGB_CTRL_GIO_MASTER_DISABLE     0x4
@@ -141,6 +155,18 @@
 
 #define IGB_RXDCTL_ENABLE   (1 << 25)
 
+/* MRQC: RSS only, and the hash fields */
+#define IGB_MRQC_RSS        0x2
+#define IGB_MRQC_TCPIPV4    (1 << 16)
+#define IGB_MRQC_IPV4       (1 << 17)
+#define IGB_MRQC_IPV6       (1 << 20)
+#define IGB_MRQC_TCPIPV6    (1 << 21)
+#define IGB_MRQC_UDPIPV4    (1 << 22)
+#define IGB_MRQC_UDPIPV6    (1 << 23)
+/* Report the RSS hash instead of the fragment checksum */
+#define IGB_RXCSUM_PCSD     (1 << 13)
+#define IGB_RSS_KEY         0x6d5a6d5a
+
 #define IGB_TXDCTL_ENABLE   (1 << 25)
 
 /*
@@ -216,6 +242,8 @@ struct igb_tx_ring {
     uint16_t len;
     /* Write-back */
     uint32_t *tdwba;
+    /* Offload context last written (0 if none) */
+    uint64_t ctx;
     /* Queue information */
     uint16_t idx;               /* Queue index */
     void *mmio;                 /* MMIO */
@@ -418,8 +446,19 @@ igb_setup_rx(struct igb_device *dev)
     wr32(dev->mmio, IGB_REG_RXPBSIZE,
          rd32(dev->mmio, IGB_REG_RXPBSIZE) | (1UL << 31));
 
-    /* Clear multi queue */
-    wr32(dev->mmio, IGB_REG_MRQC, 0);
+    /* RSS computes the hash reported in the Rx descriptors, but all the
+       entries of the redirection table point to the queue 0 */
+    for ( i = 0; i < 10; i++ ) {
+        wr32(dev->mmio, IGB_REG_RSSRK(i), IGB_RSS_KEY);
+    }
+    for ( i = 0; i < 32; i++ ) {
+        wr32(dev->mmio, IGB_REG_RETA(i), 0);
+    }
+    wr32(dev->mmio, IGB_REG_MRQC, IGB_MRQC_RSS | IGB_MRQC_TCPIPV4
+         | IGB_MRQC_IPV4 | IGB_MRQC_IPV6 | IGB_MRQC_TCPIPV6
+         | IGB_MRQC_UDPIPV4 | IGB_MRQC_UDPIPV6);
+    wr32(dev->mmio, IGB_REG_RXCSUM,
+         rd32(dev->mmio, IGB_REG_RXCSUM) | IGB_RXCSUM_PCSD);
 
     /* CRC strip */
     wr32(dev->mmio, IGB_REG_RCTL,
@@ -597,8 +636,9 @@ igb_rx_commit(struct igb_rx_ring *rxring)
 }
 
 static __inline__ int
-igb_rx_dequeue(struct igb_rx_ring *rxring, void **hdr)
+igb_rx_dequeue(struct igb_rx_ring *rxring, void **hdr, struct fe_offload *ol)
 {
+    struct igb_rx_desc_wb *wb;
     uint16_t head;
     int len;
 
@@ -611,12 +651,55 @@ igb_rx_dequeue(struct igb_rx_ring *rxring, void **hdr)
     }
     head = rxring->soft_head + 1 < rxring->len ? rxring->soft_head + 1 : 0;
     *hdr = rxring->bufs[rxring->soft_head];
-    len = rxring->descs[rxring->soft_head].wb.length;
+    wb = &rxring->descs[rxring->soft_head].wb;
+    len = wb->length;
+    fe_offload_rx_adv(ol, wb->info0, wb->info1, wb->staterr);
     rxring->soft_head = head;
 
     return len;
 }
 
+/*
+ * Prefetch the descriptor k ahead of the head, and return its packet buffer if
+ * it has already been received
+ */
+static __inline__ void *
+igb_rx_prefetch(struct igb_rx_ring *rxring, int k)
+{
+    int avail;
+    int idx;
+
+    /* # of received descriptors not dequeued yet */
+    avail = (int)rxring->head - (int)rxring->soft_head;
+    if ( avail < 0 ) {
+        avail += rxring->len;
+    }
+    if ( k >= avail ) {
+        return NULL;
+    }
+    idx = rxring->soft_head + k;
+    if ( idx >= rxring->len ) {
+        idx -= rxring->len;
+    }
+    __builtin_prefetch(&rxring->descs[idx]);
+
+    return rxring->bufs[idx];
+}
+
+/*
+ * Check if the next Rx descriptor has been written back (without MMIO)
+ */
+static __inline__ int
+igb_rx_ready(struct igb_rx_ring *rxring)
+{
+    if ( rxring->head != rxring->soft_head ) {
+        return 1;
+    }
+
+    /* DD bit */
+    return rxring->descs[rxring->soft_head].read.hdr_addr & 1;
+}
+
 /*
  * Setup Tx ring
  */
@@ -642,6 +725,7 @@ igb_setup_tx_ring(struct igb_device *dev, struct igb_tx_ring *txring, int idx,
     txring->head = 0;
     txring->soft_head = 0;
     txring->len = qlen;
+    txring->ctx = 0;
 
     /* Allocate for descriptors */
     txring->descs = m;
@@ -691,23 +775,51 @@ igb_setup_tx_ring(struct igb_device *dev, struct igb_tx_ring *txring, int idx,
     return 0;
 }
 
+/*
+ * Enqueue a packet, preceded by a context descriptor if the checksum offload
+ * requested differs from the context last written to the ring
+ */
 static __inline__ int
-igb_tx_enqueue(struct igb_tx_ring *txring, void *pkt, void *hdr, size_t length)
+igb_tx_enqueue(struct igb_tx_ring *txring, void *pkt, void *hdr, size_t length,
+               const struct fe_offload *ol)
 {
     union igb_tx_desc *txdesc;
     uint16_t new_tail;
+    uint16_t next;
+    uint32_t popts;
+    uint64_t ctx;
 
     new_tail = txring->tail + 1 < txring->len ? txring->tail + 1 : 0;
     if ( new_tail == txring->soft_head ) {
         /* Buffer is full */
         return 0;
     }
+    popts = 0;
+    if ( NULL != ol && (ol->flags & FE_OFFLOAD_TX_MASK) ) {
+        ctx = fe_offload_adv_ctx(ol);
+        if ( ctx != txring->ctx ) {
+            next = new_tail + 1 < txring->len ? new_tail + 1 : 0;
+            if ( next == txring->soft_head ) {
+                /* No room for the context descriptor */
+                return 0;
+            }
+            txdesc = &txring->descs[txring->tail];
+            txdesc->ctx.vlan_maclen_iplen = (uint32_t)ctx;
+            txdesc->ctx.launchtime = 0;
+            txdesc->ctx.other = ctx >> 32;
+            txring->bufs[txring->tail] = NULL;
+            txring->tail = new_tail;
+            txring->ctx = ctx;
+            new_tail = next;
+        }
+        popts = fe_offload_adv_popts(ol);
+    }
     txdesc = &txring->descs[txring->tail];
     txdesc->data.pkt_addr = (uint64_t)pkt;
     txdesc->data.length = length;
     txdesc->data.dtyp_mac = (3 << 4);
     txdesc->data.dcmd = (1 << 5) | (1 << 3) | (1 << 1) | 1; /* (1<<3): WB */
-    txdesc->data.paylen_popts_idx_sta = ((uint64_t)length << 14);
+    txdesc->data.paylen_popts_idx_sta = ((uint64_t)length << 14) | popts;
     txring->bufs[txring->tail] = hdr;
     txring->tail = new_tail;
 
@@ -734,20 +846,46 @@ igb_calc_tx_ring_memsize(struct igb_tx_ring *tx, uint16_t qlen)
     return (sizeof(union igb_tx_desc) + sizeof(void *)) * qlen + 128;
 }
 
+/*
+ * Collect up to n transmitted buffers using the head write-back (the slots of
+ * the context descriptors are skipped)
+ */
 static __inline__ int
-igb_collect_buffer(struct igb_tx_ring *txring, void **hdr)
+igb_collect_buffers(struct igb_tx_ring *txring, void **hdrs, int n)
 {
+    int i;
+
     txring->head = *txring->tdwba;
-    if ( txring->soft_head == txring->head ) {
-        return 0;
+    for ( i = 0; i < n && txring->soft_head != txring->head; ) {
+        hdrs[i] = txring->bufs[txring->soft_head];
+        if ( NULL != hdrs[i] ) {
+            i++;
+        }
+        txring->soft_head
+            = txring->soft_head + 1 < txring->len ? txring->soft_head + 1 : 0;
     }
 
-    *hdr = txring->bufs[txring->soft_head];
+    return i;
+}
 
-    txring->soft_head
-        = txring->soft_head + 1 < txring->len ? txring->soft_head + 1 : 0;
+/*
+ * Accumulate the hardware statistics counters (clear on read)
+ */
+static __inline__ void
+igb_read_hw_stats(struct igb_device *dev, struct pix_fe_hw_stats *st)
+{
+    uint64_t m64;
 
-    return 1;
+    st->rx_pkts += rd32(dev->mmio, IGB_REG_GPRC);
+    m64 = rd32(dev->mmio, IGB_REG_GORCL);
+    m64 |= (uint64_t)rd32(dev->mmio, IGB_REG_GORCH) << 32;
+    st->rx_bytes += m64;
+    st->rx_missed += rd32(dev->mmio, IGB_REG_MPC);
+    st->rx_crcerrs += rd32(dev->mmio, IGB_REG_CRCERRS);
+    st->tx_pkts += rd32(dev->mmio, IGB_REG_GPTC);
+    m64 = rd32(dev->mmio, IGB_REG_GOTCL);
+    m64 |= (uint64_t)rd32(dev->mmio, IGB_REG_GOTCH) << 32;
+    st->tx_bytes += m64;
 }
 
 #endif /* _IGB_H */
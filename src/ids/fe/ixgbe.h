@@ -28,9 +28,12 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <time.h>
+#include <sys/pix.h>
 #include <mki/driver.h>
 #include "pci.h"
 #include "common.h"
+#include "offload.h"
+#include "fdir.h"
 
 #define IXGBE_X520DA2           0x10fb
 #define IXGBE_X520QDA1          0x1558
@@ -97,18 +100,72 @@
 #define IXGBE_REG_SECRXCTRL     0x8d00
 #define IXGBE_REG_SECRXSTAT     0x8d04
 
+#define IXGBE_REG_FDIRCTRL      0xee00
+#define IXGBE_REG_FDIRIPSA      0xee18
+#define IXGBE_REG_FDIRIPDA      0xee1c
+#define IXGBE_REG_FDIRPORT      0xee20
+#define IXGBE_REG_FDIRVLAN      0xee24
 #define IXGBE_REG_FDIRCMD       0xee2c
 #define IXGBE_REG_FDIRFREE      0xee38
 #define IXGBE_REG_FDIRHASH      0xee28
+#define IXGBE_REG_FDIRSIP4M     0xee40
+#define IXGBE_REG_FDIRDIP4M     0xee44
+#define IXGBE_REG_FDIRUSTAT     0xee50
+#define IXGBE_REG_FDIRFSTAT     0xee54
+#define IXGBE_REG_FDIRMATCH     0xee58
+#define IXGBE_REG_FDIRMISS      0xee5c
+#define IXGBE_REG_FDIRHKEY      0xee68
+#define IXGBE_REG_FDIRSKEY      0xee6c
+#define IXGBE_REG_FDIRM         0xee70
+#define IXGBE_REG_FDIRTCPM      0xee78
+#define IXGBE_REG_FDIRUDPM      0xee7c
+#define IXGBE_REG_RXPBSIZE(n)   (0x3c00 + 4 * (n))
+
+/* Flow Director: 64 KB of the Rx packet buffer 0 for the filters */
+#define IXGBE_FDIRCTRL_PBALLOC_64K      1
+#define IXGBE_FDIRCTRL_INIT_DONE        (1 << 3)
+#define IXGBE_FDIRCTRL_PERFECT_MATCH    (1 << 4)
+#define IXGBE_FDIRCTRL_FLEX_SHIFT       16
+#define IXGBE_FDIRCTRL_MAX_LENGTH_SHIFT 24
+#define IXGBE_FDIRCTRL_FULL_THRESH_SHIFT    28
+#define IXGBE_FDIR_PBSIZE       ((512 - 64) << 10)
+#define IXGBE_FDIRCMD_ADD       0x1
+#define IXGBE_FDIRCMD_REMOVE    0x2
+#define IXGBE_FDIRCMD_QUERY     0x3
+#define IXGBE_FDIRCMD_CMD_MASK  0x3
+#define IXGBE_FDIRCMD_VALID     (1 << 2)
+#define IXGBE_FDIRCMD_UPDATE    (1 << 3)
+#define IXGBE_FDIRCMD_L4TYPE_SHIFT      5
+#define IXGBE_FDIRCMD_CLEARHT   (1 << 8)
+#define IXGBE_FDIRCMD_LAST      (1 << 11)
+#define IXGBE_FDIRCMD_QUEUE_EN  (1 << 15)
+#define IXGBE_FDIRCMD_QUEUE_SHIFT       16
+/* Mask the VLAN ID/priority, the pool, and the flexible bytes */
+#define IXGBE_FDIRM_PERFECT     0x17
 
 #define IXGBE_REG_MCSTCTRL      0x5090
 
 #define IXGBE_REG_VFTA(n)       (0xa000 + 0x4 * (n))
 
 /* RSS */
+#define IXGBE_REG_RXCSUM        0x05000
 #define IXGBE_REG_RETA(n)       (0x05c00 + 4 * (n))
+#define IXGBE_REG_RSSRK(n)      (0x05c80 + 4 * (n))
 #define IXGBE_REG_MRQC          0x05818
 /* [3:0] = 0001b for RSS: [17] = IPv4, [20] = IPv6 */
+#define IXGBE_MRQC_RSS          0x1
+#define IXGBE_MRQC_TCPIPV4      (1 << 16)
+#define IXGBE_MRQC_IPV4         (1 << 17)
+#define IXGBE_MRQC_IPV6         (1 << 20)
+#define IXGBE_MRQC_TCPIPV6      (1 << 21)
+#define IXGBE_MRQC_UDPIPV4      (1 << 22)
+#define IXGBE_MRQC_UDPIPV6      (1 << 23)
+/* Report the RSS hash instead of the fragment checksum */
+#define IXGBE_RXCSUM_PCSD       (1 << 13)
+#define IXGBE_RSS_KEY           0x6d5a6d5a
+/* RSS spreads over up to 16 queues (4-bit entries of 128 in RETA) */
+#define IXGBE_RSS_NQ            16
+#define IXGBE_RETA_SIZE         128
 
 /* DCA registers */
 #define IXGBE_REG_DCA_RXCTRL(n) ((n) < 64) \
@@ -116,9 +173,35 @@
 #define IXGBE_REG_DCA_TXCTRL(n) (0x600c + 0x40 * (n))
 #define IXGBE_REG_DCA_ID        0x11070
 #define IXGBE_REG_DCA_CTRL      0x11074
+/* DCA 1.0: the tag is the local APIC ID of the target CPU */
+#define IXGBE_DCA_CTRL_MODE_10          (1 << 1)
+#define IXGBE_DCA_CPUID_SHIFT           24
+#define IXGBE_DCA_CPUID_MASK            (0xffU << 24)
+#define IXGBE_DCA_RXCTRL_DESC_DCA_EN    (1 << 5)
+#define IXGBE_DCA_RXCTRL_HEAD_DCA_EN    (1 << 6)
+#define IXGBE_DCA_RXCTRL_DATA_DCA_EN    (1 << 7)
+#define IXGBE_DCA_TXCTRL_DESC_DCA_EN    (1 << 5)
+
+/* Packet split receive type (per pool; pool 0 without virtualization) */
+#define IXGBE_REG_PSRTYPE(n)    (0xea00 + 4 * (n))
+#define IXGBE_PSRTYPE_TCPHDR    (1 << 4)
+#define IXGBE_PSRTYPE_UDPHDR    (1 << 5)
+#define IXGBE_PSRTYPE_IPV4HDR   (1 << 8)
+#define IXGBE_PSRTYPE_IPV6HDR   (1 << 9)
+#define IXGBE_PSRTYPE_L2HDR     (1 << 12)
 
 #define IXGBE_REG_MAXFRS        0x04268
 
+/* Statistics registers (clear on read) */
+#define IXGBE_REG_CRCERRS       0x4000
+#define IXGBE_REG_MPC(n)        (0x3fa0 + 4 * (n))  /* x8 */
+#define IXGBE_REG_GPRC          0x4074
+#define IXGBE_REG_GPTC          0x4080
+#define IXGBE_REG_GORCL         0x4088
+#define IXGBE_REG_GORCH         0x408c
+#define IXGBE_REG_GOTCL         0x4090
+#define IXGBE_REG_GOTCH         0x4094
+
 #define IXGBE_CTRL_LRST (1<<3)  /* Link reset */
 #define IXGBE_CTRL_PCIE_MASTER_DISABLE  (uint32_t)(1<<2)
 #define IXGBE_CTRL_RST  (1<<26)
@@ -135,11 +218,23 @@
 #define IXGBE_SRRCTL_BSIZE_PKT8K        (8)
 #define IXGBE_SRRCTL_BSIZE_PKT10K       (10)
 #define IXGBE_SRRCTL_BSIZE_PKT16K       (16)
+#define IXGBE_SRRCTL_BSIZE_HDR128       (2<<8)
 #define IXGBE_SRRCTL_BSIZE_HDR256       (4<<8)
 #define IXGBE_SRRCTL_DESCTYPE_LEGACY    (0)
+#define IXGBE_SRRCTL_DESCTYPE_ADV       (1<<25)
+#define IXGBE_SRRCTL_DESCTYPE_HSPLIT    (2<<25)
+#define IXGBE_SRRCTL_DROP_EN            (1<<28)
+
+/* Header buffer of the header split (fits L2 + IPv4/IPv6 + TCP/UDP) */
+#define IXGBE_HSPLIT_HDRSZ      128
+/* Header length and split header flag in the write-back descriptor */
+#define IXGBE_RXDADV_HDRLEN(info0)      (((info0) >> 21) & 0x3ff)
+#define IXGBE_RXDADV_SPH                (1U << 31)
 
 #define IXGBE_RXDCTL_ENABLE     (1<<25)
 #define IXGBE_RXDCTL_VME        (1<<30)
+#define IXGBE_RXDCTL_WTHRESH(n) ((n) << 16)
+#define IXGBE_RXDCTL_WTHRESH_MASK       (0x7f << 16)
 #define IXGBE_RXCTL_RXEN        1
 #define IXGBE_TXDCTL_ENABLE     (1<<25)
 #define IXGBE_DMATXCTL_TE       1
@@ -211,6 +306,10 @@ struct ixgbe_rx_ring {
     uint16_t head;
     uint16_t soft_head;
     uint16_t len;
+    /* Header buffers of the header split (small and kept hot in cache) */
+    uint8_t *hbufs;
+    uint64_t hbufs_pa;
+    int hsplit;
     /* Queue information */
     uint16_t idx;               /* Queue index */
     void *mmio;                 /* MMIO */
@@ -228,6 +327,8 @@ struct ixgbe_tx_ring {
     uint16_t len;
     /* Write-back */
     uint32_t *tdwba;
+    /* Offload context last written (0 if none) */
+    uint64_t ctx;
     /* Queue information */
     uint16_t idx;               /* Queue index */
     void *mmio;                 /* MMIO */
@@ -240,6 +341,8 @@ struct ixgbe_device {
     void *mmio;
     uint8_t macaddr[6];
     uint16_t device_id;
+    /* # of Rx queues enabled (RSS is spread over them) */
+    int nrxq;
 };
 
 
@@ -284,6 +387,7 @@ ixgbe_init(uint16_t device_id, uint16_t bus, uint16_t slot, uint16_t func)
         return NULL;
     }
     dev->device_id = device_id;
+    dev->nrxq = 0;
 
     /* Read MMIO */
     pmmio = pci_read_mmio(bus, slot, func);
@@ -315,6 +419,56 @@ ixgbe_max_tx_queues(struct ixgbe_device *dev)
     return 128;
 }
 
+/*
+ * The number of Rx queues that RSS can spread over
+ */
+static __inline__ int
+ixgbe_max_rx_queues(struct ixgbe_device *dev)
+{
+    (void)dev;
+    return IXGBE_RSS_NQ;
+}
+
+/*
+ * RSS hash key (the low byte of each register first), and the size of the
+ * redirection table
+ */
+static __inline__ int
+ixgbe_rss_key(struct ixgbe_device *dev, uint8_t *key, int len, int *lutsz)
+{
+    int i;
+
+    (void)dev;
+    for ( i = 0; i < len && i < 40; i++ ) {
+        key[i] = (IXGBE_RSS_KEY >> ((i & 3) * 8)) & 0xff;
+    }
+    *lutsz = IXGBE_RETA_SIZE;
+
+    return 0;
+}
+
+/*
+ * Fill the redirection table with the enabled Rx queues in turn
+ */
+static __inline__ void
+ixgbe_setup_reta(struct ixgbe_device *dev)
+{
+    uint32_t m32;
+    int n;
+    int i;
+    int j;
+
+    n = dev->nrxq > 0 ? dev->nrxq : 1;
+    for ( i = 0; i < IXGBE_RETA_SIZE / 4; i++ ) {
+        /* Four entries per register */
+        m32 = 0;
+        for ( j = 0; j < 4; j++ ) {
+            m32 |= (uint32_t)((i * 4 + j) % n) << (j * 8);
+        }
+        wr32(dev->mmio, IXGBE_REG_RETA(i), m32);
+    }
+}
+
 /*
  * Get the device MAC address
  */
@@ -511,8 +665,30 @@ ixgbe_setup_rx(struct ixgbe_device *dev)
         wr32(dev->mmio, IXGBE_REG_RSCCTL(i), 0);
    }
 
-    /* Clear multi queue */
-    wr32(dev->mmio, IXGBE_REG_MRQC, 0);
+    /* RSS with a symmetric key, spread over the Rx queues enabled; the hash
+       is reported in the Rx descriptors */
+    for ( i = 0; i < 10; i++ ) {
+        wr32(dev->mmio, IXGBE_REG_RSSRK(i), IXGBE_RSS_KEY);
+    }
+    ixgbe_setup_reta(dev);
+    wr32(dev->mmio, IXGBE_REG_MRQC, IXGBE_MRQC_RSS | IXGBE_MRQC_TCPIPV4
+         | IXGBE_MRQC_IPV4 | IXGBE_MRQC_IPV6 | IXGBE_MRQC_TCPIPV6
+         | IXGBE_MRQC_UDPIPV4 | IXGBE_MRQC_UDPIPV6);
+    wr32(dev->mmio, IXGBE_REG_RXCSUM,
+         rd32(dev->mmio, IXGBE_REG_RXCSUM) | IXGBE_RXCSUM_PCSD);
+
+    /* Reserve the Rx packet buffer space of the Flow Director filters, which
+       are enabled on demand */
+    wr32(dev->mmio, IXGBE_REG_RXPBSIZE(0), IXGBE_FDIR_PBSIZE);
+    wr32(dev->mmio, IXGBE_REG_FDIRHKEY, FE_FDIR_BUCKET_KEY);
+    wr32(dev->mmio, IXGBE_REG_FDIRSKEY, FE_FDIR_SIG_KEY);
+    wr32(dev->mmio, IXGBE_REG_FDIRCTRL, 0);
+
+    /* DCA 1.0 and the headers split when enabled per queue */
+    wr32(dev->mmio, IXGBE_REG_DCA_CTRL, IXGBE_DCA_CTRL_MODE_10);
+    wr32(dev->mmio, IXGBE_REG_PSRTYPE(0), IXGBE_PSRTYPE_TCPHDR
+         | IXGBE_PSRTYPE_UDPHDR | IXGBE_PSRTYPE_IPV4HDR
+         | IXGBE_PSRTYPE_IPV6HDR | IXGBE_PSRTYPE_L2HDR);
 
     /* Clear multicast filter */
     wr32(dev->mmio, IXGBE_REG_MCSTCTRL, 0);
@@ -546,6 +722,21 @@ ixgbe_disable_rx(struct ixgbe_device *dev)
     return 0;
 }
 
+/*
+ * Split and replication Rx control of a queue
+ */
+static __inline__ uint32_t
+ixgbe_rx_srrctl(int hsplit)
+{
+    if ( hsplit ) {
+        return IXGBE_SRRCTL_BSIZE_PKT10K | IXGBE_SRRCTL_BSIZE_HDR128
+            | IXGBE_SRRCTL_DESCTYPE_HSPLIT | IXGBE_SRRCTL_DROP_EN;
+    }
+
+    return IXGBE_SRRCTL_BSIZE_PKT10K | IXGBE_SRRCTL_DESCTYPE_ADV
+        | IXGBE_SRRCTL_DROP_EN;
+}
+
 /*
  * Setup Rx ring
  */
@@ -559,14 +750,13 @@ ixgbe_setup_rx_ring(struct ixgbe_device *dev, struct ixgbe_rx_ring *rxring,
     uint64_t m64;
 
     /* Check the queue index first */
-    if ( 0 != idx ) {
+    if ( idx >= IXGBE_RSS_NQ ) {
         return -1;
     }
 
     /* Copy MMIO base address */
     rxring->mmio = dev->mmio;
 
-    /* Use queue #0 */
     rxring->idx = idx;
 
     rxring->tail = 0;
@@ -580,6 +770,12 @@ ixgbe_setup_rx_ring(struct ixgbe_device *dev, struct ixgbe_rx_ring *rxring,
     rxring->descs = m;
     m += sizeof(union ixgbe_rx_desc) * qlen;
     rxring->bufs = m;
+    m += sizeof(void *) * qlen;
+    /* Header buffers (cache line aligned) */
+    m = (void *)(((uint64_t)m + 127) & ~127ULL);
+    rxring->hbufs = m;
+    rxring->hbufs_pa = (uint64_t)m + v2poff;
+    rxring->hsplit = 0;
 
     for ( i = 0; i < rxring->len; i++ ) {
         rxdesc = &rxring->descs[i];
@@ -593,8 +789,7 @@ ixgbe_setup_rx_ring(struct ixgbe_device *dev, struct ixgbe_rx_ring *rxring,
     wr32(rxring->mmio, IXGBE_REG_RDLEN(rxring->idx),
          rxring->len * sizeof(union ixgbe_rx_desc));
 
-    wr32(rxring->mmio, IXGBE_REG_SRRCTL(rxring->idx),
-         IXGBE_SRRCTL_BSIZE_PKT10K | (1 << 25) | (1 << 28) | (0 << 22));
+    wr32(rxring->mmio, IXGBE_REG_SRRCTL(rxring->idx), ixgbe_rx_srrctl(0));
 
     /* Enable this queue */
     wr32(rxring->mmio, IXGBE_REG_RXDCTL(rxring->idx),
@@ -613,6 +808,12 @@ ixgbe_setup_rx_ring(struct ixgbe_device *dev, struct ixgbe_rx_ring *rxring,
     wr32(rxring->mmio, IXGBE_REG_RDH(rxring->idx), 0);
     wr32(rxring->mmio, IXGBE_REG_RDT(rxring->idx), 0);
 
+    /* Spread RSS over this queue too */
+    if ( idx >= dev->nrxq ) {
+        dev->nrxq = idx + 1;
+        ixgbe_setup_reta(dev);
+    }
+
     return 0;
 }
 
@@ -629,7 +830,12 @@ ixgbe_rx_refill(struct ixgbe_rx_ring *rxring, void *pkt, void *hdr)
     }
     rxdesc = &rxring->descs[rxring->tail];
     rxdesc->read.pkt_addr = (uint64_t)pkt;
-    rxdesc->read.hdr_addr = 0;
+    if ( rxring->hsplit ) {
+        rxdesc->read.hdr_addr = rxring->hbufs_pa
+            + (uint64_t)rxring->tail * IXGBE_HSPLIT_HDRSZ;
+    } else {
+        rxdesc->read.hdr_addr = 0;
+    }
     rxring->bufs[rxring->tail] = hdr;
     rxring->tail = new_tail;
 
@@ -643,9 +849,15 @@ ixgbe_rx_commit(struct ixgbe_rx_ring *rxring)
     wr32(rxring->mmio, IXGBE_REG_RDT(rxring->idx), rxring->tail);
 }
 
+/*
+ * Dequeue a packet, and return its length.  The header split into the header
+ * buffer (split and slen) is to be prepended to the payload by the caller.
+ */
 static __inline__ int
-ixgbe_rx_dequeue(struct ixgbe_rx_ring *rxring, void **hdr)
+ixgbe_rx_dequeue(struct ixgbe_rx_ring *rxring, void **hdr,
+                 struct fe_offload *ol, void **split, int *slen)
 {
+    struct ixgbe_rx_desc_wb *wb;
     uint16_t head;
     int len;
 
@@ -658,12 +870,180 @@ ixgbe_rx_dequeue(struct ixgbe_rx_ring *rxring, void **hdr)
     }
     head = rxring->soft_head + 1 < rxring->len ? rxring->soft_head + 1 : 0;
     *hdr = rxring->bufs[rxring->soft_head];
-    len = rxring->descs[rxring->soft_head].wb.length;
+    wb = &rxring->descs[rxring->soft_head].wb;
+    len = wb->length;
+    fe_offload_rx_adv(ol, wb->info0, wb->info1, wb->staterr);
+    *slen = 0;
+    if ( rxring->hsplit && (wb->info0 & IXGBE_RXDADV_SPH) ) {
+        *split = rxring->hbufs
+            + (size_t)rxring->soft_head * IXGBE_HSPLIT_HDRSZ;
+        *slen = IXGBE_RXDADV_HDRLEN(wb->info0);
+        if ( *slen > IXGBE_HSPLIT_HDRSZ ) {
+            *slen = IXGBE_HSPLIT_HDRSZ;
+        }
+        len += *slen;
+    }
     rxring->soft_head = head;
 
     return len;
 }
 
+/*
+ * Prefetch the descriptor k ahead of the head, and return its packet buffer if
+ * it has already been received
+ */
+static __inline__ void *
+ixgbe_rx_prefetch(struct ixgbe_rx_ring *rxring, int k)
+{
+    int avail;
+    int idx;
+
+    /* # of received descriptors not dequeued yet */
+    avail = (int)rxring->head - (int)rxring->soft_head;
+    if ( avail < 0 ) {
+        avail += rxring->len;
+    }
+    if ( k >= avail ) {
+        return NULL;
+    }
+    idx = rxring->soft_head + k;
+    if ( idx >= rxring->len ) {
+        idx -= rxring->len;
+    }
+    __builtin_prefetch(&rxring->descs[idx]);
+    if ( rxring->hsplit ) {
+        __builtin_prefetch(rxring->hbufs + (size_t)idx * IXGBE_HSPLIT_HDRSZ);
+    }
+
+    return rxring->bufs[idx];
+}
+
+/*
+ * Check if the next Rx descriptor has been written back (without MMIO)
+ */
+static __inline__ int
+ixgbe_rx_ready(struct ixgbe_rx_ring *rxring)
+{
+    if ( rxring->head != rxring->soft_head ) {
+        return 1;
+    }
+
+    /* DD bit */
+    return rxring->descs[rxring->soft_head].read.hdr_addr & 1;
+}
+
+/*
+ * Tag the Rx descriptors of a queue for DCA to a CPU, or untag them if cpu is
+ * negative.  The headers are tagged when they are split, and the packets are
+ * otherwise.
+ */
+static __inline__ void
+ixgbe_rx_dca(struct ixgbe_rx_ring *rxring, int cpu)
+{
+    uint32_t m32;
+
+    m32 = rd32(rxring->mmio, IXGBE_REG_DCA_RXCTRL(rxring->idx));
+    m32 &= ~(IXGBE_DCA_CPUID_MASK | IXGBE_DCA_RXCTRL_DESC_DCA_EN
+             | IXGBE_DCA_RXCTRL_HEAD_DCA_EN | IXGBE_DCA_RXCTRL_DATA_DCA_EN);
+    if ( cpu >= 0 ) {
+        m32 |= ((uint32_t)cpu << IXGBE_DCA_CPUID_SHIFT)
+            | IXGBE_DCA_RXCTRL_DESC_DCA_EN;
+        if ( rxring->hsplit ) {
+            m32 |= IXGBE_DCA_RXCTRL_HEAD_DCA_EN;
+        } else {
+            m32 |= IXGBE_DCA_RXCTRL_DATA_DCA_EN;
+        }
+    }
+    wr32(rxring->mmio, IXGBE_REG_DCA_RXCTRL(rxring->idx), m32);
+}
+
+/*
+ * Set the Rx descriptor write-back threshold of a queue (0 to write back each
+ * descriptor immediately)
+ */
+static __inline__ void
+ixgbe_rx_wthresh(struct ixgbe_rx_ring *rxring, int wthresh)
+{
+    uint32_t m32;
+
+    m32 = rd32(rxring->mmio, IXGBE_REG_RXDCTL(rxring->idx));
+    m32 &= ~IXGBE_RXDCTL_WTHRESH_MASK;
+    m32 |= IXGBE_RXDCTL_WTHRESH(wthresh) & IXGBE_RXDCTL_WTHRESH_MASK;
+    wr32(rxring->mmio, IXGBE_REG_RXDCTL(rxring->idx), m32);
+}
+
+/*
+ * Disable an Rx queue to reconfigure it
+ */
+static __inline__ int
+ixgbe_rx_stop(struct ixgbe_rx_ring *rxring)
+{
+    ssize_t i;
+
+    wr32(rxring->mmio, IXGBE_REG_RXDCTL(rxring->idx),
+         rd32(rxring->mmio, IXGBE_REG_RXDCTL(rxring->idx))
+         & ~IXGBE_RXDCTL_ENABLE);
+    for ( i = 0; i < 10; i++ ) {
+        busywait(1);
+        if ( !(rd32(rxring->mmio, IXGBE_REG_RXDCTL(rxring->idx))
+               & IXGBE_RXDCTL_ENABLE) ) {
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+/*
+ * Take out the buffers posted to a stopped Rx queue one by one
+ */
+static __inline__ void *
+ixgbe_rx_drain(struct ixgbe_rx_ring *rxring)
+{
+    void *hdr;
+
+    if ( rxring->soft_head == rxring->tail ) {
+        return NULL;
+    }
+    hdr = rxring->bufs[rxring->soft_head];
+    rxring->soft_head = rxring->soft_head + 1 < rxring->len
+        ? rxring->soft_head + 1 : 0;
+
+    return hdr;
+}
+
+/*
+ * Restart a drained Rx queue with or without the header split; the caller
+ * refills it
+ */
+static __inline__ int
+ixgbe_rx_start(struct ixgbe_rx_ring *rxring, int hsplit)
+{
+    ssize_t i;
+
+    rxring->hsplit = hsplit;
+    rxring->tail = 0;
+    rxring->head = 0;
+    rxring->soft_head = 0;
+    wr32(rxring->mmio, IXGBE_REG_SRRCTL(rxring->idx), ixgbe_rx_srrctl(hsplit));
+    wr32(rxring->mmio, IXGBE_REG_RDH(rxring->idx), 0);
+    wr32(rxring->mmio, IXGBE_REG_RDT(rxring->idx), 0);
+
+    wr32(rxring->mmio, IXGBE_REG_RXDCTL(rxring->idx),
+         rd32(rxring->mmio, IXGBE_REG_RXDCTL(rxring->idx))
+         | IXGBE_RXDCTL_ENABLE);
+    for ( i = 0; i < 10; i++ ) {
+        busywait(1);
+        if ( rd32(rxring->mmio, IXGBE_REG_RXDCTL(rxring->idx))
+             & IXGBE_RXDCTL_ENABLE ) {
+            return 0;
+        }
+    }
+    printf("Error on enabling an RX queue.\n");
+
+    return -1;
+}
+
 /*
  * Setup Tx port
  */
@@ -727,6 +1107,7 @@ ixgbe_setup_tx_ring(struct ixgbe_device *dev, struct ixgbe_tx_ring *txring,
     txring->head = 0;
     txring->soft_head = 0;
     txring->len = qlen;
+    txring->ctx = 0;
 
     /* Allocate for descriptors */
     txring->descs = m;
@@ -777,24 +1158,51 @@ ixgbe_setup_tx_ring(struct ixgbe_device *dev, struct ixgbe_tx_ring *txring,
     return 0;
 }
 
+/*
+ * Enqueue a packet, preceded by a context descriptor if the checksum offload
+ * requested differs from the context last written to the ring
+ */
 static __inline__ int
 ixgbe_tx_enqueue(struct ixgbe_tx_ring *txring, void *pkt, void *hdr,
-                 size_t length)
+                 size_t length, const struct fe_offload *ol)
 {
     union ixgbe_tx_desc *txdesc;
     uint16_t new_tail;
+    uint16_t next;
+    uint32_t popts;
+    uint64_t ctx;
 
     new_tail = txring->tail + 1 < txring->len ? txring->tail + 1 : 0;
     if ( new_tail == txring->soft_head ) {
         /* Buffer is full */
         return 0;
     }
+    popts = 0;
+    if ( NULL != ol && (ol->flags & FE_OFFLOAD_TX_MASK) ) {
+        ctx = fe_offload_adv_ctx(ol);
+        if ( ctx != txring->ctx ) {
+            next = new_tail + 1 < txring->len ? new_tail + 1 : 0;
+            if ( next == txring->soft_head ) {
+                /* No room for the context descriptor */
+                return 0;
+            }
+            txdesc = &txring->descs[txring->tail];
+            txdesc->ctx.vlan_maclen_iplen = (uint32_t)ctx;
+            txdesc->ctx.fcoef_ipsec_sa_idx = 0;
+            txdesc->ctx.other = ctx >> 32;
+            txring->bufs[txring->tail] = NULL;
+            txring->tail = new_tail;
+            txring->ctx = ctx;
+            new_tail = next;
+        }
+        popts = fe_offload_adv_popts(ol);
+    }
     txdesc = &txring->descs[txring->tail];
     txdesc->data.pkt_addr = (uint64_t)pkt;
     txdesc->data.length = length;
     txdesc->data.dtyp_mac = (3 << 4);
     txdesc->data.dcmd = (1 << 5) | (1 << 3) | (1 << 1) | 1; /* (1<<3): WB */
-    txdesc->data.paylen_popts_cc_idx_sta = ((uint64_t)length << 14);
+    txdesc->data.paylen_popts_cc_idx_sta = ((uint64_t)length << 14) | popts;
     txring->bufs[txring->tail] = hdr;
     txring->tail = new_tail;
 
@@ -812,7 +1220,8 @@ static __inline__ int
 ixgbe_calc_rx_ring_memsize(struct ixgbe_rx_ring *rx, uint16_t qlen)
 {
     (void)rx;
-    return (sizeof(union ixgbe_rx_desc) + sizeof(void *)) * qlen;
+    return (sizeof(union ixgbe_rx_desc) + sizeof(void *)) * qlen + 128
+        + IXGBE_HSPLIT_HDRSZ * qlen;
 }
 static __inline__ int
 ixgbe_calc_tx_ring_memsize(struct ixgbe_tx_ring *tx, uint16_t qlen)
@@ -821,22 +1230,228 @@ ixgbe_calc_tx_ring_memsize(struct ixgbe_tx_ring *tx, uint16_t qlen)
     return (sizeof(union ixgbe_tx_desc) + sizeof(void *)) * qlen + 128;
 }
 
+/*
+ * Tag the Tx descriptors (and the head write-back) of a queue for DCA to a
+ * CPU, or untag them if cpu is negative
+ */
+static __inline__ void
+ixgbe_tx_dca(struct ixgbe_tx_ring *txring, int cpu)
+{
+    uint32_t m32;
+
+    m32 = rd32(txring->mmio, IXGBE_REG_DCA_TXCTRL(txring->idx));
+    m32 &= ~(IXGBE_DCA_CPUID_MASK | IXGBE_DCA_TXCTRL_DESC_DCA_EN);
+    if ( cpu >= 0 ) {
+        m32 |= ((uint32_t)cpu << IXGBE_DCA_CPUID_SHIFT)
+            | IXGBE_DCA_TXCTRL_DESC_DCA_EN;
+    }
+    wr32(txring->mmio, IXGBE_REG_DCA_TXCTRL(txring->idx), m32);
+}
+
+/*
+ * Collect up to n transmitted buffers using the head write-back (the slots of
+ * the context descriptors are skipped)
+ */
 static __inline__ int
-ixgbe_collect_buffer(struct ixgbe_tx_ring *txring, void **hdr)
+ixgbe_collect_buffers(struct ixgbe_tx_ring *txring, void **hdrs, int n)
 {
+    int i;
+
     txring->head = *txring->tdwba;
-    if ( txring->soft_head == txring->head ) {
+    for ( i = 0; i < n && txring->soft_head != txring->head; ) {
+        hdrs[i] = txring->bufs[txring->soft_head];
+        if ( NULL != hdrs[i] ) {
+            i++;
+        }
+        txring->soft_head
+            = txring->soft_head + 1 < txring->len ? txring->soft_head + 1 : 0;
+    }
+
+    return i;
+}
+
+/*
+ * Accumulate the hardware statistics counters (clear on read)
+ */
+static __inline__ void
+ixgbe_read_hw_stats(struct ixgbe_device *dev, struct pix_fe_hw_stats *st)
+{
+    uint64_t m64;
+    uint32_t m32;
+    ssize_t i;
+
+    st->rx_pkts += rd32(dev->mmio, IXGBE_REG_GPRC);
+    m64 = rd32(dev->mmio, IXGBE_REG_GORCL);
+    m64 |= (uint64_t)rd32(dev->mmio, IXGBE_REG_GORCH) << 32;
+    st->rx_bytes += m64;
+    for ( i = 0; i < 8; i++ ) {
+        st->rx_missed += rd32(dev->mmio, IXGBE_REG_MPC(i));
+    }
+    st->rx_crcerrs += rd32(dev->mmio, IXGBE_REG_CRCERRS);
+    st->tx_pkts += rd32(dev->mmio, IXGBE_REG_GPTC);
+    m64 = rd32(dev->mmio, IXGBE_REG_GOTCL);
+    m64 |= (uint64_t)rd32(dev->mmio, IXGBE_REG_GOTCH) << 32;
+    st->tx_bytes += m64;
+
+    /* Flow Director */
+    m32 = rd32(dev->mmio, IXGBE_REG_FDIRFREE);
+    st->fdir_free = m32 & 0xffff;
+    st->fdir_colls = (m32 >> 16) & 0x3fff;
+    m32 = rd32(dev->mmio, IXGBE_REG_FDIRFSTAT);
+    st->fdir_add_fails += m32 & 0xff;
+    st->fdir_remove_fails += (m32 >> 8) & 0xff;
+    st->fdir_matches += rd32(dev->mmio, IXGBE_REG_FDIRMATCH);
+    st->fdir_misses += rd32(dev->mmio, IXGBE_REG_FDIRMISS);
+}
+
+/*
+ * Wait for the completion of a Flow Director command
+ */
+static __inline__ uint32_t
+ixgbe_fdir_wait(struct ixgbe_device *dev)
+{
+    uint32_t m32;
+    int i;
+
+    for ( i = 0; i < 10; i++ ) {
+        m32 = rd32(dev->mmio, IXGBE_REG_FDIRCMD);
+        if ( !(m32 & IXGBE_FDIRCMD_CMD_MASK) ) {
+            break;
+        }
+        busywait(10);
+    }
+
+    return m32;
+}
+
+/*
+ * (Re)initialize the Flow Director filter table in a mode, dropping all the
+ * filters; FE_FDIR_NONE disables it
+ */
+static __inline__ int
+ixgbe_fdir_init(struct ixgbe_device *dev, int mode)
+{
+    uint32_t ctrl;
+    int i;
+
+    ixgbe_fdir_wait(dev);
+    wr32(dev->mmio, IXGBE_REG_FDIRCMD,
+         rd32(dev->mmio, IXGBE_REG_FDIRCMD) | IXGBE_FDIRCMD_CLEARHT);
+    wr32(dev->mmio, IXGBE_REG_FDIRCMD,
+         rd32(dev->mmio, IXGBE_REG_FDIRCMD) & ~IXGBE_FDIRCMD_CLEARHT);
+    wr32(dev->mmio, IXGBE_REG_FDIRHASH, 0);
+    if ( FE_FDIR_NONE == mode ) {
+        wr32(dev->mmio, IXGBE_REG_FDIRCTRL, 0);
         return 0;
     }
 
-    *hdr = txring->bufs[txring->soft_head];
+    if ( FE_FDIR_PERFECT == mode ) {
+        /* Compare the addresses, the ports, and the L4 type */
+        wr32(dev->mmio, IXGBE_REG_FDIRM, IXGBE_FDIRM_PERFECT);
+    } else {
+        wr32(dev->mmio, IXGBE_REG_FDIRM, 0);
+    }
+    wr32(dev->mmio, IXGBE_REG_FDIRTCPM, 0);
+    wr32(dev->mmio, IXGBE_REG_FDIRUDPM, 0);
+    wr32(dev->mmio, IXGBE_REG_FDIRSIP4M, 0);
+    wr32(dev->mmio, IXGBE_REG_FDIRDIP4M, 0);
+
+    /* Flexible bytes at the EtherType (6th word) */
+    ctrl = IXGBE_FDIRCTRL_PBALLOC_64K
+        | (6 << IXGBE_FDIRCTRL_FLEX_SHIFT)
+        | (0xa << IXGBE_FDIRCTRL_MAX_LENGTH_SHIFT)
+        | (4 << IXGBE_FDIRCTRL_FULL_THRESH_SHIFT);
+    if ( FE_FDIR_PERFECT == mode ) {
+        ctrl |= IXGBE_FDIRCTRL_PERFECT_MATCH;
+    }
+    wr32(dev->mmio, IXGBE_REG_FDIRCTRL, ctrl);
+    for ( i = 0; i < 10; i++ ) {
+        if ( rd32(dev->mmio, IXGBE_REG_FDIRCTRL) & IXGBE_FDIRCTRL_INIT_DONE ) {
+            break;
+        }
+        busywait(1000);
+    }
+    if ( !(rd32(dev->mmio, IXGBE_REG_FDIRCTRL) & IXGBE_FDIRCTRL_INIT_DONE) ) {
+        return -1;
+    }
 
-    txring->soft_head
-        = txring->soft_head + 1 < txring->len ? txring->soft_head + 1 : 0;
+    /* Clear the statistics (clear on read) */
+    rd32(dev->mmio, IXGBE_REG_FDIRUSTAT);
+    rd32(dev->mmio, IXGBE_REG_FDIRFSTAT);
 
-    return 1;
+    return 0;
+}
+
+/*
+ * Write the tuple and the hash of a filter; the slot is the software index of
+ * a perfect-match filter
+ */
+static __inline__ void
+ixgbe_fdir_write(struct ixgbe_device *dev, int mode,
+                 const struct fe_fdir_filter *e, int slot)
+{
+    uint32_t hash;
+
+    wr32(dev->mmio, IXGBE_REG_FDIRIPSA, e->flow.sip);
+    wr32(dev->mmio, IXGBE_REG_FDIRIPDA, e->flow.dip);
+    wr32(dev->mmio, IXGBE_REG_FDIRPORT,
+         ((uint32_t)e->flow.dport << 16) | e->flow.sport);
+    wr32(dev->mmio, IXGBE_REG_FDIRVLAN, 0);
+    hash = e->hash;
+    if ( FE_FDIR_PERFECT == mode ) {
+        hash |= (uint32_t)slot << 16;
+    }
+    wr32(dev->mmio, IXGBE_REG_FDIRHASH, hash);
+}
+
+/*
+ * Install a filter steering a flow to an Rx queue
+ */
+static __inline__ int
+ixgbe_fdir_add(struct ixgbe_device *dev, int mode,
+               const struct fe_fdir_filter *e, int slot)
+{
+    uint32_t cmd;
+
+    ixgbe_fdir_wait(dev);
+    ixgbe_fdir_write(dev, mode, e, slot);
+    cmd = IXGBE_FDIRCMD_ADD | IXGBE_FDIRCMD_UPDATE | IXGBE_FDIRCMD_LAST
+        | IXGBE_FDIRCMD_QUEUE_EN
+        | ((uint32_t)fe_fdir_flow_type(e->flow.proto)
+           << IXGBE_FDIRCMD_L4TYPE_SHIFT)
+        | ((uint32_t)e->queue << IXGBE_FDIRCMD_QUEUE_SHIFT);
+    wr32(dev->mmio, IXGBE_REG_FDIRCMD, cmd);
+    cmd = ixgbe_fdir_wait(dev);
+
+    return (cmd & IXGBE_FDIRCMD_CMD_MASK) ? -1 : 0;
 }
 
+/*
+ * Remove a filter if it is in the table
+ */
+static __inline__ int
+ixgbe_fdir_remove(struct ixgbe_device *dev, int mode,
+                  const struct fe_fdir_filter *e, int slot)
+{
+    uint32_t cmd;
+
+    ixgbe_fdir_wait(dev);
+    ixgbe_fdir_write(dev, mode, e, slot);
+    wr32(dev->mmio, IXGBE_REG_FDIRCMD, IXGBE_FDIRCMD_QUERY
+         | ((uint32_t)fe_fdir_flow_type(e->flow.proto)
+            << IXGBE_FDIRCMD_L4TYPE_SHIFT));
+    cmd = ixgbe_fdir_wait(dev);
+    if ( !(cmd & IXGBE_FDIRCMD_VALID) ) {
+        return -1;
+    }
+    ixgbe_fdir_write(dev, mode, e, slot);
+    wr32(dev->mmio, IXGBE_REG_FDIRCMD, IXGBE_FDIRCMD_REMOVE
+         | ((uint32_t)fe_fdir_flow_type(e->flow.proto)
+            << IXGBE_FDIRCMD_L4TYPE_SHIFT));
+    ixgbe_fdir_wait(dev);
+
+    return 0;
+}
 
 #endif /* _IXGBE_H */
 
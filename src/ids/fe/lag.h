@@ -0,0 +1,402 @@
+/*_
+ * Copyright (c) 2017 Hirochika Asai <asai@jar.jp>
+ * All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#ifndef _LAG_H
+#define _LAG_H
+
+/*
+ * Link aggregation.  A group of member ports is seen by the pipeline as one
+ * logical port numbered after the physical ones: FDB entries point at the
+ * logical port, and the Tx stage picks a member from the flow hash through a
+ * table of buckets.  The tickful task runs LACP and rebuilds the buckets when
+ * the set of members distributing changes; the buckets of the members still
+ * up are kept so that only the flows of a failed member move.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+/* Logical ports (same as PIX_FE_LAG_MAX and PIX_FE_STATS_MAX_PORTS) */
+#define FE_LAG_MAX              8
+#define FE_LAG_NPORTS           64
+#define FE_LAG_PORT(g)          (FE_LAG_NPORTS + (g))
+#define FE_LAG_GROUP(p)         ((p) - FE_LAG_NPORTS)
+#define FE_LAG_IS_PORT(p)       ((p) >= FE_LAG_NPORTS)
+/* Hash buckets per group (power of two) */
+#define FE_LAG_BUCKETS          256
+
+/* Fields hashed (same as PIX_FE_LAG_HASH_*) */
+#define FE_LAG_HASH_L2          0       /* MAC addresses */
+#define FE_LAG_HASH_L3          1       /* IP addresses */
+#define FE_LAG_HASH_L4          2       /* IP addresses and TCP/UDP ports */
+
+/* LACP (IEEE 802.1AX) */
+#define FE_LACP_ETHERTYPE       0x8809
+#define FE_LACP_SUBTYPE         1
+#define FE_LACP_VERSION         1
+#define FE_LACP_PDU_LEN         124     /* Including the Ethernet header */
+/* Port state */
+#define FE_LACP_ACTIVITY        0x01
+#define FE_LACP_TIMEOUT         0x02    /* Short timeout */
+#define FE_LACP_AGGREGATION     0x04
+#define FE_LACP_SYNC            0x08
+#define FE_LACP_COLLECTING      0x10
+#define FE_LACP_DISTRIBUTING    0x20
+#define FE_LACP_DEFAULTED       0x40
+#define FE_LACP_EXPIRED         0x80
+/* Periodic transmission and timeout at the fast rate in milliseconds */
+#define FE_LACP_PERIOD_MS       1000
+#define FE_LACP_TIMEOUT_MS      3000
+
+/*
+ * Distribution table (copy published to the exclusive tasks)
+ */
+struct fe_lag_table {
+    /* Logical port of each physical port (itself if not a member) */
+    int lports[FE_LAG_NPORTS];
+    /* Bitmap of the ports receiving LACPDUs */
+    uint64_t lacp;
+    /* FE_LAG_HASH_* */
+    int hash;
+    /* Member per bucket, or -1 if no member is distributing */
+    int8_t buckets[FE_LAG_MAX][FE_LAG_BUCKETS];
+};
+
+/*
+ * LACP state of a member port (managed by the tickful task)
+ */
+struct fe_lacp_port {
+    /* Actor */
+    uint16_t key;
+    uint8_t state;
+    /* Aggregated with the other members of the group */
+    int selected;
+    /* Partner (the actor information in the LACPDUs received) */
+    int valid;
+    uint16_t psys_prio;
+    uint8_t psys[6];
+    uint16_t pkey;
+    uint16_t pport_prio;
+    uint16_t pport;
+    uint8_t pstate;
+    /* Time stamp counter of the last LACPDU received and sent */
+    uint64_t last_rx;
+    uint64_t last_tx;
+};
+
+static __inline__ uint32_t
+_lag_rd32(const uint8_t *p)
+{
+    uint32_t v;
+
+    memcpy(&v, p, 4);
+    return v;
+}
+
+static __inline__ uint32_t
+_lag_mix(uint32_t h, uint32_t v)
+{
+    h ^= v;
+    h *= 0x9e3779b1;
+
+    return h ^ (h >> 15);
+}
+
+/*
+ * Flow hash of a packet.  Non-IP packets are hashed by the MAC addresses in
+ * any mode, and the L4 ports are skipped for IPv4 fragments.
+ */
+static __inline__ uint32_t
+fe_lag_hash(const uint8_t *pkt, int len, int mode)
+{
+    uint16_t type;
+    uint32_t h;
+    int ihl;
+    int off;
+    int i;
+
+    if ( len < 14 ) {
+        return 0;
+    }
+    /* MAC addresses */
+    h = _lag_mix(0, _lag_rd32(pkt));
+    h = _lag_mix(h, _lag_rd32(pkt + 4));
+    h = _lag_mix(h, _lag_rd32(pkt + 8));
+    if ( FE_LAG_HASH_L2 == mode ) {
+        goto done;
+    }
+
+    type = ((uint16_t)pkt[12] << 8) | pkt[13];
+    off = 14;
+    if ( 0x8100 == type && len >= 18 ) {
+        /* 802.1Q */
+        type = ((uint16_t)pkt[16] << 8) | pkt[17];
+        off = 18;
+    }
+    if ( 0x0800 == type && len >= off + 20 ) {
+        h = _lag_mix(0, _lag_rd32(pkt + off + 12));
+        h = _lag_mix(h, _lag_rd32(pkt + off + 16));
+        ihl = (pkt[off] & 0xf) * 4;
+        if ( FE_LAG_HASH_L4 == mode && (6 == pkt[off + 9] || 17 == pkt[off + 9])
+             && 0 == (((pkt[off + 6] & 0x3f) << 8) | pkt[off + 7])
+             && ihl >= 20 && len >= off + ihl + 4 ) {
+            /* Ports of the first fragment */
+            h = _lag_mix(h, _lag_rd32(pkt + off + ihl));
+        }
+    } else if ( 0x86dd == type && len >= off + 40 ) {
+        h = 0;
+        for ( i = 8; i < 40; i += 4 ) {
+            h = _lag_mix(h, _lag_rd32(pkt + off + i));
+        }
+        if ( FE_LAG_HASH_L4 == mode && (6 == pkt[off + 6] || 17 == pkt[off + 6])
+             && len >= off + 44 ) {
+            h = _lag_mix(h, _lag_rd32(pkt + off + 40));
+        }
+    }
+
+done:
+    /* Finalize so that the low bits select the bucket */
+    h ^= h >> 16;
+    h *= 0x85ebca6b;
+    h ^= h >> 13;
+
+    return h;
+}
+
+/*
+ * Member port selected for a hash, or -1 if no member is distributing
+ */
+static __inline__ int
+fe_lag_select(const struct fe_lag_table *tbl, int lport, uint32_t hash)
+{
+    return tbl->buckets[FE_LAG_GROUP(lport)][hash & (FE_LAG_BUCKETS - 1)];
+}
+
+/*
+ * Assign the buckets of a group to the active members evenly.  The buckets of
+ * the members still active are kept up to the fair share of each member, and
+ * only the others are moved.
+ */
+static __inline__ void
+fe_lag_rebalance(int8_t *buckets, uint64_t active)
+{
+    int8_t members[FE_LAG_NPORTS];
+    int8_t idx[FE_LAG_NPORTS];
+    int quota[FE_LAG_NPORTS];
+    int cnt[FE_LAG_NPORTS];
+    int n;
+    int m;
+    int p;
+    int i;
+
+    n = 0;
+    for ( i = 0; i < FE_LAG_NPORTS; i++ ) {
+        if ( active & (1ULL << i) ) {
+            idx[i] = n;
+            members[n] = i;
+            n++;
+        }
+    }
+    if ( 0 == n ) {
+        memset(buckets, -1, FE_LAG_BUCKETS);
+        return;
+    }
+    for ( m = 0; m < n; m++ ) {
+        quota[m] = FE_LAG_BUCKETS / n + (m < FE_LAG_BUCKETS % n);
+        cnt[m] = 0;
+    }
+
+    /* Keep */
+    for ( i = 0; i < FE_LAG_BUCKETS; i++ ) {
+        p = buckets[i];
+        if ( p >= 0 && (active & (1ULL << p)) && cnt[idx[p]] < quota[idx[p]] ) {
+            cnt[idx[p]]++;
+        } else {
+            buckets[i] = -1;
+        }
+    }
+    /* Move the others to the members below their share */
+    m = 0;
+    for ( i = 0; i < FE_LAG_BUCKETS; i++ ) {
+        if ( buckets[i] < 0 ) {
+            while ( cnt[m] >= quota[m] ) {
+                m++;
+            }
+            buckets[i] = members[m];
+            cnt[m]++;
+        }
+    }
+}
+
+/*
+ * Check if a packet is a LACPDU
+ */
+static __inline__ int
+fe_lacp_is_pdu(const uint8_t *pkt, int len)
+{
+    return len >= 15 && 0x88 == pkt[12] && 0x09 == pkt[13]
+        && FE_LACP_SUBTYPE == pkt[14];
+}
+
+static __inline__ void
+_lacp_wr16(uint8_t *p, uint16_t v)
+{
+    p[0] = v >> 8;
+    p[1] = v & 0xff;
+}
+
+static __inline__ uint16_t
+_lacp_rd16(const uint8_t *p)
+{
+    return ((uint16_t)p[0] << 8) | p[1];
+}
+
+/*
+ * Build a LACPDU of a member port.  The port # is 1-origin in the PDU.
+ * Returns the length of the frame.
+ */
+static __inline__ int
+fe_lacp_build(uint8_t *buf, uint16_t prio, const uint8_t *sys, int port,
+              const struct fe_lacp_port *lp)
+{
+    static const uint8_t dst[6] = { 0x01, 0x80, 0xc2, 0x00, 0x00, 0x02 };
+
+    memset(buf, 0, FE_LACP_PDU_LEN);
+    memcpy(buf, dst, 6);
+    /* Locally unique source address derived from the system ID */
+    memcpy(buf + 6, sys, 6);
+    buf[11] ^= port + 1;
+    _lacp_wr16(buf + 12, FE_LACP_ETHERTYPE);
+    buf[14] = FE_LACP_SUBTYPE;
+    buf[15] = FE_LACP_VERSION;
+
+    /* Actor */
+    buf[16] = 1;
+    buf[17] = 20;
+    _lacp_wr16(buf + 18, prio);
+    memcpy(buf + 20, sys, 6);
+    _lacp_wr16(buf + 26, lp->key);
+    _lacp_wr16(buf + 28, 0x80);
+    _lacp_wr16(buf + 30, port + 1);
+    buf[32] = lp->state;
+
+    /* Partner */
+    buf[36] = 2;
+    buf[37] = 20;
+    if ( lp->valid ) {
+        _lacp_wr16(buf + 38, lp->psys_prio);
+        memcpy(buf + 40, lp->psys, 6);
+        _lacp_wr16(buf + 46, lp->pkey);
+        _lacp_wr16(buf + 48, lp->pport_prio);
+        _lacp_wr16(buf + 50, lp->pport);
+        buf[52] = lp->pstate;
+    }
+
+    /* Collector, then the terminator and the reserved octets */
+    buf[56] = 3;
+    buf[57] = 16;
+
+    return FE_LACP_PDU_LEN;
+}
+
+/*
+ * Record the partner information of a LACPDU received.  Returns 1 if the
+ * partner or its state changed, 0 if not, or -1 if the PDU is malformed.
+ */
+static __inline__ int
+fe_lacp_input(struct fe_lacp_port *lp, const uint8_t *pkt, int len,
+              uint64_t now)
+{
+    int changed;
+
+    if ( len < 56 || !fe_lacp_is_pdu(pkt, len) || 1 != pkt[16]
+         || 20 != pkt[17] || 2 != pkt[36] || 20 != pkt[37] ) {
+        return -1;
+    }
+    changed = !lp->valid || lp->psys_prio != _lacp_rd16(pkt + 18)
+        || 0 != memcmp(lp->psys, pkt + 20, 6)
+        || lp->pkey != _lacp_rd16(pkt + 26) || lp->pstate != pkt[32];
+    lp->psys_prio = _lacp_rd16(pkt + 18);
+    memcpy(lp->psys, pkt + 20, 6);
+    lp->pkey = _lacp_rd16(pkt + 26);
+    lp->pport_prio = _lacp_rd16(pkt + 28);
+    lp->pport = _lacp_rd16(pkt + 30);
+    lp->pstate = pkt[32];
+    lp->valid = 1;
+    lp->last_rx = now;
+
+    return changed;
+}
+
+/*
+ * Expire the partner information not refreshed within the timeout.  Returns 1
+ * if expired.
+ */
+static __inline__ int
+fe_lacp_expire(struct fe_lacp_port *lp, uint64_t now, uint64_t timeout)
+{
+    if ( lp->valid && now - lp->last_rx > timeout ) {
+        lp->valid = 0;
+        lp->pstate = 0;
+        return 1;
+    }
+
+    return 0;
+}
+
+/*
+ * Update the actor state from the selection, and check if the member can
+ * distribute: selected, and the partner is in sync and collecting
+ */
+static __inline__ int
+fe_lacp_update(struct fe_lacp_port *lp)
+{
+    lp->state = FE_LACP_ACTIVITY | FE_LACP_TIMEOUT | FE_LACP_AGGREGATION;
+    if ( !lp->valid ) {
+        lp->state |= FE_LACP_DEFAULTED;
+        return 0;
+    }
+    if ( !lp->selected ) {
+        return 0;
+    }
+    lp->state |= FE_LACP_SYNC | FE_LACP_COLLECTING;
+    if ( (lp->pstate & (FE_LACP_SYNC | FE_LACP_COLLECTING))
+         != (FE_LACP_SYNC | FE_LACP_COLLECTING) ) {
+        return 0;
+    }
+    lp->state |= FE_LACP_DISTRIBUTING;
+
+    return 1;
+}
+
+#endif /* _LAG_H */
+
+/*
+ * Local variables:
+ * tab-width: 4
+ * c-basic-offset: 4
+ * End:
+ * vim600: sw=4 ts=4 fdm=marker
+ * vim<600: sw=4 ts=4
+ */
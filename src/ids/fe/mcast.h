@@ -0,0 +1,397 @@
+/*_
+ * Copyright (c) 2017 Hirochika Asai <asai@jar.jp>
+ * All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#ifndef _MCAST_H
+#define _MCAST_H
+
+/*
+ * IGMP snooping.  The fast path parses the IGMP messages into commands to the
+ * tickful task, which keeps the members of each group and the multicast
+ * router ports, and publishes a table of the ports to replicate each group
+ * to.  The table is keyed by the low 23 bits of the MAC address, so the
+ * groups sharing a MAC address share the ports.  Link-local groups
+ * (224.0.0.0/24) are always flooded.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+/* Max # of groups (same as PIX_FE_MCAST_MAX) and slots of the table */
+#define FE_MCAST_MAX            256
+#define FE_MCAST_SLOTS_BITS     9
+#define FE_MCAST_SLOTS          (1 << FE_MCAST_SLOTS_BITS)
+#define FE_MCAST_NPORTS         64
+/* Max # of commands from a packet (IGMPv3 group records) */
+#define FE_MCAST_MAX_CMDS       8
+
+/* Commands */
+#define FE_MCAST_JOIN           1
+#define FE_MCAST_LEAVE          2
+#define FE_MCAST_QUERY          3
+#define FE_MCAST_CMD(type, group)       (((uint64_t)(type) << 32) | (group))
+#define FE_MCAST_CMD_TYPE(cmd)          ((int)((cmd) >> 32))
+#define FE_MCAST_CMD_GROUP(cmd)         ((uint32_t)(cmd))
+
+/*
+ * Replication table (copy published to the exclusive tasks)
+ */
+struct fe_mcast_table {
+    /* Key (the low 23 bits of the MAC address with bit 23 set), or 0 */
+    uint32_t keys[FE_MCAST_SLOTS];
+    /* Ports joining the group */
+    uint64_t ports[FE_MCAST_SLOTS];
+    /* Multicast router ports, to which every group is sent */
+    uint64_t mrouters;
+};
+
+/*
+ * Group (managed by the tickful task)
+ */
+struct fe_mcast_group {
+    /* IPv4 address in host byte order */
+    uint32_t addr;
+    uint64_t ports;
+    /* Time stamp counter of the last report per port */
+    uint64_t last[FE_MCAST_NPORTS];
+};
+
+/*
+ * Membership database (managed by the tickful task)
+ */
+struct fe_mcast_db {
+    int n;
+    struct fe_mcast_group groups[FE_MCAST_MAX];
+    /* Multicast router ports, and the last query received on each */
+    uint64_t mrouters;
+    uint64_t mrouter_last[FE_MCAST_NPORTS];
+};
+
+/*
+ * Check if a destination MAC address is of IPv4 multicast
+ */
+static __inline__ int
+fe_mcast_is_ipv4(const uint8_t *dst)
+{
+    return 0x01 == dst[0] && 0x00 == dst[1] && 0x5e == dst[2];
+}
+
+/*
+ * Check if a destination MAC address is of a link-local group (224.0.0.0/24)
+ */
+static __inline__ int
+fe_mcast_is_local(const uint8_t *dst)
+{
+    return 0 == dst[3] && 0 == dst[4];
+}
+
+static __inline__ uint32_t
+_mcast_key(uint32_t low23)
+{
+    return (low23 & 0x7fffff) | 0x800000;
+}
+
+static __inline__ int
+_mcast_slot(uint32_t key)
+{
+    return (key * 0x9e3779b1) >> (32 - FE_MCAST_SLOTS_BITS);
+}
+
+/*
+ * Lookup the slot of a group by the destination MAC address, or -1
+ */
+static __inline__ int
+fe_mcast_lookup(const struct fe_mcast_table *tbl, const uint8_t *dst)
+{
+    uint32_t key;
+    int i;
+    int n;
+
+    key = _mcast_key(((uint32_t)dst[3] << 16) | ((uint32_t)dst[4] << 8)
+                     | dst[5]);
+    i = _mcast_slot(key);
+    for ( n = 0; n < FE_MCAST_SLOTS; n++ ) {
+        if ( tbl->keys[i] == key ) {
+            return i;
+        }
+        if ( 0 == tbl->keys[i] ) {
+            break;
+        }
+        i = (i + 1) & (FE_MCAST_SLOTS - 1);
+    }
+
+    return -1;
+}
+
+/*
+ * Add the ports of a group to the table
+ */
+static __inline__ void
+fe_mcast_insert(struct fe_mcast_table *tbl, uint32_t addr, uint64_t ports)
+{
+    uint32_t key;
+    int i;
+
+    key = _mcast_key(addr);
+    i = _mcast_slot(key);
+    while ( 0 != tbl->keys[i] && tbl->keys[i] != key ) {
+        i = (i + 1) & (FE_MCAST_SLOTS - 1);
+    }
+    tbl->keys[i] = key;
+    tbl->ports[i] |= ports;
+}
+
+static __inline__ uint32_t
+_mcast_rd32(const uint8_t *p)
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16)
+        | ((uint32_t)p[2] << 8) | p[3];
+}
+
+/*
+ * Check if a group is snooped: a multicast address other than the link-local
+ * ones
+ */
+static __inline__ int
+_mcast_snooped(uint32_t addr)
+{
+    return 0xe == (addr >> 28) && 0xe0000000 != (addr & 0xffffff00);
+}
+
+/*
+ * Parse an IGMP message into commands.  Returns the # of commands.
+ */
+static __inline__ int
+fe_igmp_parse(const uint8_t *pkt, int len, uint64_t *cmds)
+{
+    uint32_t group;
+    int nrec;
+    int nsrc;
+    int type;
+    int off;
+    int ihl;
+    int n;
+    int i;
+
+    off = 14;
+    if ( len >= 18 && 0x81 == pkt[12] && 0x00 == pkt[13] ) {
+        /* 802.1Q */
+        off = 18;
+    }
+    if ( len < off + 20 || 0x08 != pkt[off - 2] || 0x00 != pkt[off - 1]
+         || 2 != pkt[off + 9] ) {
+        /* Not IGMP */
+        return 0;
+    }
+    ihl = (pkt[off] & 0xf) * 4;
+    off += ihl;
+    if ( ihl < 20 || len < off + 8 ) {
+        return 0;
+    }
+
+    n = 0;
+    group = _mcast_rd32(pkt + off + 4);
+    switch ( pkt[off] ) {
+    case 0x11:
+        /* Query */
+        cmds[n++] = FE_MCAST_CMD(FE_MCAST_QUERY, group);
+        break;
+    case 0x12:
+    case 0x16:
+        /* IGMPv1/v2 report */
+        if ( _mcast_snooped(group) ) {
+            cmds[n++] = FE_MCAST_CMD(FE_MCAST_JOIN, group);
+        }
+        break;
+    case 0x17:
+        /* IGMPv2 leave */
+        if ( _mcast_snooped(group) ) {
+            cmds[n++] = FE_MCAST_CMD(FE_MCAST_LEAVE, group);
+        }
+        break;
+    case 0x22:
+        /* IGMPv3 report */
+        nrec = ((int)pkt[off + 6] << 8) | pkt[off + 7];
+        off += 8;
+        for ( i = 0; i < nrec && n < FE_MCAST_MAX_CMDS; i++ ) {
+            if ( len < off + 8 ) {
+                break;
+            }
+            type = pkt[off];
+            nsrc = ((int)pkt[off + 2] << 8) | pkt[off + 3];
+            group = _mcast_rd32(pkt + off + 4);
+            if ( _mcast_snooped(group) ) {
+                if ( 2 == type || 4 == type
+                     || ((1 == type || 3 == type || 5 == type) && nsrc > 0) ) {
+                    /* Exclude mode, or include mode with sources */
+                    cmds[n++] = FE_MCAST_CMD(FE_MCAST_JOIN, group);
+                } else if ( (1 == type || 3 == type) && 0 == nsrc ) {
+                    /* Include mode without sources */
+                    cmds[n++] = FE_MCAST_CMD(FE_MCAST_LEAVE, group);
+                }
+            }
+            /* Next record */
+            off += 8 + nsrc * 4 + pkt[off + 1] * 4;
+        }
+        break;
+    default:
+        ;
+    }
+
+    return n;
+}
+
+/*
+ * Apply a command received on the ports (the members of a link aggregation
+ * group at once).  Returns 1 if the replication changed, 0 if not, or -1 if
+ * the database is full.
+ */
+static __inline__ int
+fe_mcast_db_input(struct fe_mcast_db *db, uint64_t cmd, uint64_t ports,
+                  uint64_t now)
+{
+    struct fe_mcast_group *g;
+    uint32_t addr;
+    int changed;
+    int i;
+
+    addr = FE_MCAST_CMD_GROUP(cmd);
+    if ( FE_MCAST_QUERY == FE_MCAST_CMD_TYPE(cmd) ) {
+        changed = (db->mrouters & ports) != ports;
+        db->mrouters |= ports;
+        for ( i = 0; i < FE_MCAST_NPORTS; i++ ) {
+            if ( ports & (1ULL << i) ) {
+                db->mrouter_last[i] = now;
+            }
+        }
+        return changed;
+    }
+
+    g = NULL;
+    for ( i = 0; i < db->n; i++ ) {
+        if ( db->groups[i].addr == addr ) {
+            g = &db->groups[i];
+            break;
+        }
+    }
+
+    if ( FE_MCAST_LEAVE == FE_MCAST_CMD_TYPE(cmd) ) {
+        /* Fast leave */
+        if ( NULL == g || 0 == (g->ports & ports) ) {
+            return 0;
+        }
+        g->ports &= ~ports;
+        if ( 0 == g->ports ) {
+            /* Remove the group */
+            db->n--;
+            memcpy(g, &db->groups[db->n], sizeof(struct fe_mcast_group));
+        }
+        return 1;
+    }
+
+    /* Join */
+    if ( NULL == g ) {
+        if ( db->n >= FE_MCAST_MAX ) {
+            return -1;
+        }
+        g = &db->groups[db->n];
+        db->n++;
+        memset(g, 0, sizeof(struct fe_mcast_group));
+        g->addr = addr;
+    }
+    changed = (g->ports & ports) != ports;
+    g->ports |= ports;
+    for ( i = 0; i < FE_MCAST_NPORTS; i++ ) {
+        if ( ports & (1ULL << i) ) {
+            g->last[i] = now;
+        }
+    }
+
+    return changed;
+}
+
+/*
+ * Remove the members and the multicast routers not refreshed within the
+ * timeout.  Returns 1 if the replication changed.
+ */
+static __inline__ int
+fe_mcast_db_age(struct fe_mcast_db *db, uint64_t now, uint64_t timeout)
+{
+    struct fe_mcast_group *g;
+    int changed;
+    int i;
+    int j;
+
+    changed = 0;
+    for ( j = 0; j < FE_MCAST_NPORTS; j++ ) {
+        if ( (db->mrouters & (1ULL << j))
+             && now - db->mrouter_last[j] > timeout ) {
+            db->mrouters &= ~(1ULL << j);
+            changed = 1;
+        }
+    }
+    i = 0;
+    while ( i < db->n ) {
+        g = &db->groups[i];
+        for ( j = 0; j < FE_MCAST_NPORTS; j++ ) {
+            if ( (g->ports & (1ULL << j)) && now - g->last[j] > timeout ) {
+                g->ports &= ~(1ULL << j);
+                changed = 1;
+            }
+        }
+        if ( 0 == g->ports ) {
+            db->n--;
+            memcpy(g, &db->groups[db->n], sizeof(struct fe_mcast_group));
+            continue;
+        }
+        i++;
+    }
+
+    return changed;
+}
+
+/*
+ * Build the replication table from the database
+ */
+static __inline__ void
+fe_mcast_db_build(const struct fe_mcast_db *db, struct fe_mcast_table *tbl)
+{
+    int i;
+
+    memset(tbl, 0, sizeof(struct fe_mcast_table));
+    for ( i = 0; i < db->n; i++ ) {
+        fe_mcast_insert(tbl, db->groups[i].addr, db->groups[i].ports);
+    }
+    tbl->mrouters = db->mrouters;
+}
+
+#endif /* _MCAST_H */
+
+/*
+ * Local variables:
+ * tab-width: 4
+ * c-basic-offset: 4
+ * End:
+ * vim600: sw=4 ts=4 fdm=marker
+ * vim<600: sw=4 ts=4
+ */
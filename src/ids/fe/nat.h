@@ -0,0 +1,1258 @@
+/*_
+ * Copyright (c) 2017 Hirochika Asai <asai@jar.jp>
+ * All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#ifndef _NAT_H
+#define _NAT_H
+
+/*
+ * Stateful NAT44 (NAPT) of TCP and UDP.  Each exclusive task owns a shard of
+ * the connection tracking table, so that the table is updated without locks:
+ * the Rx of the inside and the outside ports is spread by RSS with a
+ * symmetric key, and the external port of a new connection is chosen so that
+ * the RSS hash of the inbound packets selects the queue of the task that
+ * created it.  The external ports are allocated to the subscribers (inside
+ * addresses) in blocks, and the blocks are partitioned among the shards.
+ *
+ * The connections are found with bucketized cuckoo hashing on a signature of
+ * the key (both directions of a connection are inserted), and expired with a
+ * timer wheel of one-second slots; a refreshed connection is moved to its new
+ * slot only when its old slot is visited.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Max # of external addresses (same as PIX_FE_NAT_MAX_ADDRS) */
+#define FE_NAT_MAX_ADDRS        64
+/* External ports (the well-known ports are never allocated) */
+#define FE_NAT_PORT_MIN         1024
+#define FE_NAT_NPORTS           (65536 - FE_NAT_PORT_MIN)
+/* Ports per block */
+#define FE_NAT_BLOCK_MIN        64
+#define FE_NAT_BLOCK_MAX        4096
+#define FE_NAT_BLOCK_DEFAULT    512
+
+/* Connections per shard, and the buckets of the hash table (two keys per
+   connection in 8-slot buckets, i.e., half load when full) */
+#define FE_NAT_CONNS_BITS       18
+#define FE_NAT_CONNS            (1 << FE_NAT_CONNS_BITS)
+#define FE_NAT_BUCKET_SLOTS     8
+#define FE_NAT_BUCKETS          (FE_NAT_CONNS / 2)
+/* Max # of displacements to insert a key */
+#define FE_NAT_CUCKOO_DEPTH     8
+/* Subscribers per shard, and the max # of blocks of a subscriber */
+#define FE_NAT_SUBS_BITS        14
+#define FE_NAT_SUBS             (1 << FE_NAT_SUBS_BITS)
+#define FE_NAT_SUB_BLOCKS       8
+#define FE_NAT_BLOCKS_DEFAULT   4
+/* Timer wheel of one-second slots */
+#define FE_NAT_WHEEL            1024
+#define FE_NAT_NIL              0xffffffffU
+
+/* RSS hash key size */
+#define FE_NAT_RSS_KEY_SIZE     40
+
+/* Timeouts in seconds (same as PIX_FE_NAT_TO_*) */
+#define FE_NAT_TO_TCP_EST       0
+#define FE_NAT_TO_TCP_TRANS     1
+#define FE_NAT_TO_UDP           2
+#define FE_NAT_NTIMEOUTS        3
+#define FE_NAT_TCP_EST_TIMEOUT  7440
+#define FE_NAT_TCP_TRANS_TIMEOUT 240
+#define FE_NAT_UDP_TIMEOUT      300
+#define FE_NAT_RST_TIMEOUT      10
+
+/* TCP states */
+#define FE_NAT_TCP_SYN          0
+#define FE_NAT_TCP_EST          1
+#define FE_NAT_TCP_FIN          2
+#define FE_NAT_TCP_RST          3
+
+/* Results of the translation */
+#define FE_NAT_PASS             0   /* Not subject to the translation */
+#define FE_NAT_XLATE            1   /* Translated */
+#define FE_NAT_UNSUPPORTED      -1  /* Fragment or other than TCP/UDP */
+#define FE_NAT_MISS             -2  /* No connection */
+#define FE_NAT_NOPORT           -3  /* No external port for the subscriber */
+#define FE_NAT_FULL             -4  /* Connection or subscriber table full */
+
+/*
+ * Key of a packet (the addresses and the ports in network byte order)
+ */
+struct fe_nat_key {
+    uint32_t saddr;
+    uint32_t daddr;
+    uint16_t sport;
+    uint16_t dport;
+    uint8_t proto;
+    uint8_t pad[3];
+};
+
+/*
+ * Connection
+ */
+struct fe_nat_conn {
+    /* Keys of the outbound (inside to remote) and the inbound (remote to
+       external) packets */
+    struct fe_nat_key keys[2];
+    /* Expiry in seconds */
+    uint32_t expire;
+    /* Next connection in the slot of the timer wheel or in the free list */
+    uint32_t next;
+    /* Block of the external port (index in the shard) */
+    uint32_t block;
+    uint8_t state;
+} __attribute__ ((aligned(64)));
+
+/*
+ * Bucket of the hash table; each slot holds the signature of a key (0 for
+ * empty) and the connection (index << 1 | direction)
+ */
+struct fe_nat_bucket {
+    uint16_t sigs[FE_NAT_BUCKET_SLOTS];
+    uint32_t vals[FE_NAT_BUCKET_SLOTS];
+} __attribute__ ((aligned(64)));
+
+/*
+ * Subscriber
+ */
+struct fe_nat_sub {
+    /* Inside address (network byte order), or 0 for empty */
+    uint32_t addr;
+    /* # of connections */
+    uint32_t conns;
+    /* Blocks (index in the shard) */
+    int nblocks;
+    uint32_t blocks[FE_NAT_SUB_BLOCKS];
+    /* Next port to try (offset in the blocks) */
+    int cursor;
+};
+
+/*
+ * Parameters of the translation
+ */
+struct fe_nat_params {
+    /* First external address (host byte order) and the # of addresses */
+    uint32_t addr;
+    int naddrs;
+    /* Ports per block, and the max # of blocks per subscriber */
+    int block;
+    int blocks;
+    int timeouts[FE_NAT_NTIMEOUTS];
+};
+
+/*
+ * Steering of the inbound packets: the RSS of the outside port
+ */
+struct fe_nat_steer {
+    /* # of queues (1 for no steering), and the queue of the shard */
+    int nq;
+    int qid;
+    /* Size of the lookup table, filled with the queues in turn */
+    int lutsz;
+    /* Hash of each byte value at each position of the addresses and the
+       ports (the hash is linear in the input) */
+    uint32_t tbl[12][256];
+};
+
+/*
+ * Shard of the connection tracking table (owned by an exclusive task)
+ */
+struct fe_nat_shard {
+    /* Shard #, and the # of shards; the shard owns the blocks b such that
+       b % nshards == id */
+    int id;
+    int nshards;
+    struct fe_nat_params params;
+    struct fe_nat_steer steer;
+
+    /* Connections and the free list */
+    struct fe_nat_conn *conns;
+    uint32_t free;
+    uint32_t nconns;
+    struct fe_nat_bucket *buckets;
+
+    /* Timer wheel; the slots before now are visited, and the list being
+       visited */
+    uint32_t wheel[FE_NAT_WHEEL];
+    uint32_t now;
+    uint32_t pending;
+
+    /* Subscribers */
+    struct fe_nat_sub *subs;
+    int nsubs;
+
+    /* Blocks: # of blocks per address, the blocks owned, the stack of free
+       blocks, the # of connections, and the bitmap of the ports used */
+    int nper;
+    int nblocks;
+    uint32_t *free_blocks;
+    int nfree;
+    uint32_t *refs;
+    uint64_t *used;
+};
+
+/*
+ * Toeplitz hash of RSS
+ */
+static __inline__ uint32_t
+fe_nat_toeplitz(const uint8_t *key, const uint8_t *data, int len)
+{
+    uint32_t h;
+    uint32_t v;
+    int i;
+    int b;
+
+    h = 0;
+    v = ((uint32_t)key[0] << 24) | ((uint32_t)key[1] << 16)
+        | ((uint32_t)key[2] << 8) | key[3];
+    for ( i = 0; i < len; i++ ) {
+        for ( b = 7; b >= 0; b-- ) {
+            if ( (data[i] >> b) & 1 ) {
+                h ^= v;
+            }
+            v = (v << 1) | ((key[i + 4] >> b) & 1);
+        }
+    }
+
+    return h;
+}
+
+static __inline__ uint32_t
+_nat_rd32(const uint8_t *p)
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16)
+        | ((uint32_t)p[2] << 8) | p[3];
+}
+
+/*
+ * Address in network byte order from host byte order
+ */
+static __inline__ uint32_t
+_nat_addr(uint32_t a)
+{
+    uint8_t b[4];
+    uint32_t v;
+
+    b[0] = a >> 24;
+    b[1] = (a >> 16) & 0xff;
+    b[2] = (a >> 8) & 0xff;
+    b[3] = a & 0xff;
+    memcpy(&v, b, 4);
+
+    return v;
+}
+
+static __inline__ uint16_t
+_nat_port(int p)
+{
+    uint8_t b[2];
+    uint16_t v;
+
+    b[0] = p >> 8;
+    b[1] = p & 0xff;
+    memcpy(&v, b, 2);
+
+    return v;
+}
+
+/*
+ * Check if the inbound packets of a connection are received at the queue of
+ * the shard
+ */
+static __inline__ int
+_nat_steered(const struct fe_nat_shard *s, uint32_t raddr, uint16_t rport,
+             uint32_t eaddr, uint16_t eport)
+{
+    const struct fe_nat_steer *st;
+    uint8_t data[12];
+    uint32_t h;
+    int i;
+
+    st = &s->steer;
+    if ( st->nq <= 1 ) {
+        return 1;
+    }
+    /* Source and destination addresses, then the ports */
+    memcpy(data, &raddr, 4);
+    memcpy(data + 4, &eaddr, 4);
+    memcpy(data + 8, &rport, 2);
+    memcpy(data + 10, &eport, 2);
+    h = 0;
+    for ( i = 0; i < 12; i++ ) {
+        h ^= st->tbl[i][data[i]];
+    }
+
+    return (int)((h & (st->lutsz - 1)) % st->nq) == st->qid;
+}
+
+/*
+ * Steer the inbound packets to the queue qid of nq, by the RSS key and the
+ * size of the lookup table (a power of two) of the outside port
+ */
+static __inline__ void
+fe_nat_steer_set(struct fe_nat_shard *s, int nq, int qid, int lutsz,
+                 const uint8_t *key)
+{
+    uint8_t data[12];
+    int i;
+    int v;
+
+    s->steer.nq = nq;
+    s->steer.qid = qid;
+    s->steer.lutsz = lutsz;
+    if ( nq <= 1 ) {
+        return;
+    }
+    memset(data, 0, sizeof(data));
+    for ( i = 0; i < 12; i++ ) {
+        for ( v = 0; v < 256; v++ ) {
+            data[i] = v;
+            s->steer.tbl[i][v] = fe_nat_toeplitz(key, data, 12);
+        }
+        data[i] = 0;
+    }
+}
+
+/*
+ * Hash of a key
+ */
+static __inline__ uint64_t
+_nat_hash(const struct fe_nat_key *k)
+{
+    uint64_t a;
+    uint64_t b;
+
+    memcpy(&a, k, 8);
+    memcpy(&b, (const uint8_t *)k + 8, 8);
+    a ^= b * 0x9e3779b97f4a7c15ULL;
+    a ^= a >> 29;
+    a *= 0xbf58476d1ce4e5b9ULL;
+    a ^= a >> 32;
+
+    return a;
+}
+
+static __inline__ uint16_t
+_nat_sig(uint64_t h)
+{
+    uint16_t sig;
+
+    sig = h >> 48;
+
+    return 0 == sig ? 1 : sig;
+}
+
+/*
+ * The other bucket of a key, from a bucket and the signature
+ */
+static __inline__ uint32_t
+_nat_alt(uint32_t b, uint16_t sig)
+{
+    return (b ^ (sig * 0x5bd1e995U)) & (FE_NAT_BUCKETS - 1);
+}
+
+/*
+ * Lookup a key.  Returns the connection (index << 1 | direction) or
+ * FE_NAT_NIL.
+ */
+static __inline__ uint32_t
+fe_nat_lookup(const struct fe_nat_shard *s, const struct fe_nat_key *k)
+{
+    const struct fe_nat_bucket *bkt[2];
+    uint64_t h;
+    uint32_t b;
+    uint32_t v;
+    uint16_t sig;
+    int i;
+    int j;
+
+    h = _nat_hash(k);
+    sig = _nat_sig(h);
+    b = h & (FE_NAT_BUCKETS - 1);
+    bkt[0] = &s->buckets[b];
+    bkt[1] = &s->buckets[_nat_alt(b, sig)];
+    __builtin_prefetch(bkt[1]);
+    for ( j = 0; j < 2; j++ ) {
+        for ( i = 0; i < FE_NAT_BUCKET_SLOTS; i++ ) {
+            if ( bkt[j]->sigs[i] != sig ) {
+                continue;
+            }
+            v = bkt[j]->vals[i];
+            if ( 0 == memcmp(&s->conns[v >> 1].keys[v & 1], k,
+                             sizeof(struct fe_nat_key)) ) {
+                return v;
+            }
+        }
+    }
+
+    return FE_NAT_NIL;
+}
+
+static __inline__ int
+_nat_bucket_empty(const struct fe_nat_bucket *bkt)
+{
+    int i;
+
+    for ( i = 0; i < FE_NAT_BUCKET_SLOTS; i++ ) {
+        if ( 0 == bkt->sigs[i] ) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+/*
+ * Insert a key.  The keys on a path of displacements are moved from the end
+ * of the path, so that no key is lost if no path is found.
+ */
+static __inline__ int
+_nat_insert(struct fe_nat_shard *s, const struct fe_nat_key *k, uint32_t val)
+{
+    uint32_t path[FE_NAT_CUCKOO_DEPTH];
+    int slots[FE_NAT_CUCKOO_DEPTH];
+    struct fe_nat_bucket *src;
+    struct fe_nat_bucket *dst;
+    uint64_t h;
+    uint32_t b;
+    uint32_t nb;
+    uint16_t sig;
+    int slot;
+    int d;
+    int i;
+    int j;
+
+    h = _nat_hash(k);
+    sig = _nat_sig(h);
+    b = h & (FE_NAT_BUCKETS - 1);
+    nb = _nat_alt(b, sig);
+    for ( i = 0; i < 2; i++ ) {
+        slot = _nat_bucket_empty(&s->buckets[i ? nb : b]);
+        if ( slot >= 0 ) {
+            dst = &s->buckets[i ? nb : b];
+            dst->sigs[slot] = sig;
+            dst->vals[slot] = val;
+            return 0;
+        }
+    }
+
+    /* Search a path from either bucket */
+    if ( (h >> 32) & 1 ) {
+        b = nb;
+    }
+    for ( d = 0; d < FE_NAT_CUCKOO_DEPTH; d++ ) {
+        /* Choose a slot not on the path */
+        for ( i = 0; i < FE_NAT_BUCKET_SLOTS; i++ ) {
+            slot = (sig + d + i) & (FE_NAT_BUCKET_SLOTS - 1);
+            for ( j = 0; j < d; j++ ) {
+                if ( path[j] == b && slots[j] == slot ) {
+                    break;
+                }
+            }
+            if ( j >= d ) {
+                break;
+            }
+        }
+        if ( i >= FE_NAT_BUCKET_SLOTS ) {
+            return -1;
+        }
+        path[d] = b;
+        slots[d] = slot;
+        nb = _nat_alt(b, s->buckets[b].sigs[slot]);
+        slot = _nat_bucket_empty(&s->buckets[nb]);
+        if ( slot >= 0 ) {
+            /* Move the keys from the end of the path */
+            for ( i = d; i >= 0; i-- ) {
+                src = &s->buckets[path[i]];
+                dst = &s->buckets[nb];
+                dst->sigs[slot] = src->sigs[slots[i]];
+                dst->vals[slot] = src->vals[slots[i]];
+                nb = path[i];
+                slot = slots[i];
+            }
+            dst = &s->buckets[nb];
+            dst->sigs[slot] = sig;
+            dst->vals[slot] = val;
+            return 0;
+        }
+        b = nb;
+    }
+
+    return -1;
+}
+
+/*
+ * Delete a key
+ */
+static __inline__ void
+_nat_delete(struct fe_nat_shard *s, const struct fe_nat_key *k, uint32_t val)
+{
+    struct fe_nat_bucket *bkt;
+    uint64_t h;
+    uint32_t b;
+    uint16_t sig;
+    int i;
+    int j;
+
+    h = _nat_hash(k);
+    sig = _nat_sig(h);
+    b = h & (FE_NAT_BUCKETS - 1);
+    for ( j = 0; j < 2; j++ ) {
+        bkt = &s->buckets[b];
+        for ( i = 0; i < FE_NAT_BUCKET_SLOTS; i++ ) {
+            if ( bkt->sigs[i] == sig && bkt->vals[i] == val ) {
+                bkt->sigs[i] = 0;
+                return;
+            }
+        }
+        b = _nat_alt(b, sig);
+    }
+}
+
+static __inline__ int
+_nat_sub_home(uint32_t addr)
+{
+    return (addr * 0x9e3779b1U) >> (32 - FE_NAT_SUBS_BITS);
+}
+
+/*
+ * Find a subscriber, or add it if create is set
+ */
+static __inline__ struct fe_nat_sub *
+_nat_sub_find(struct fe_nat_shard *s, uint32_t addr, int create)
+{
+    struct fe_nat_sub *sub;
+    int i;
+
+    i = _nat_sub_home(addr);
+    for ( ;; ) {
+        sub = &s->subs[i];
+        if ( sub->addr == addr ) {
+            return sub;
+        }
+        if ( 0 == sub->addr ) {
+            break;
+        }
+        i = (i + 1) & (FE_NAT_SUBS - 1);
+    }
+    if ( !create || s->nsubs >= FE_NAT_SUBS * 3 / 4 ) {
+        return NULL;
+    }
+    memset(sub, 0, sizeof(struct fe_nat_sub));
+    sub->addr = addr;
+    s->nsubs++;
+
+    return sub;
+}
+
+/*
+ * Delete a subscriber by shifting the following entries back
+ */
+static __inline__ void
+_nat_sub_delete(struct fe_nat_shard *s, struct fe_nat_sub *sub)
+{
+    int i;
+    int j;
+    int k;
+
+    i = sub - s->subs;
+    j = i;
+    for ( ;; ) {
+        j = (j + 1) & (FE_NAT_SUBS - 1);
+        if ( 0 == s->subs[j].addr ) {
+            break;
+        }
+        k = _nat_sub_home(s->subs[j].addr);
+        if ( (j > i && (k <= i || k > j)) || (j < i && k <= i && k > j) ) {
+            memcpy(&s->subs[i], &s->subs[j], sizeof(struct fe_nat_sub));
+            i = j;
+        }
+    }
+    s->subs[i].addr = 0;
+    s->nsubs--;
+}
+
+/*
+ * External address (network byte order) and the first port of a block
+ */
+static __inline__ uint32_t
+_nat_block_addr(const struct fe_nat_shard *s, uint32_t l)
+{
+    uint32_t b;
+
+    b = l * s->nshards + s->id;
+
+    return _nat_addr(s->params.addr + b / s->nper);
+}
+
+static __inline__ int
+_nat_block_port(const struct fe_nat_shard *s, uint32_t l)
+{
+    uint32_t b;
+
+    b = l * s->nshards + s->id;
+
+    return FE_NAT_PORT_MIN + (b % s->nper) * s->params.block;
+}
+
+/*
+ * Find a free port of a block to which the inbound packets from a remote
+ * endpoint are steered to this shard.  Returns the offset in the block or -1.
+ */
+static __inline__ int
+_nat_block_alloc(struct fe_nat_shard *s, uint32_t l, int start,
+                 uint32_t raddr, uint16_t rport)
+{
+    uint64_t *used;
+    uint32_t eaddr;
+    int base;
+    int off;
+    int n;
+
+    used = &s->used[(size_t)l * (s->params.block / 64)];
+    eaddr = _nat_block_addr(s, l);
+    base = _nat_block_port(s, l);
+    off = start & (s->params.block - 1);
+    for ( n = 0; n < s->params.block; n++ ) {
+        if ( ~0ULL == used[off / 64] ) {
+            /* Skip the rest of the word */
+            n += 63 - (off & 63);
+            off = (off | 63) + 1;
+            off &= s->params.block - 1;
+            continue;
+        }
+        if ( !(used[off / 64] & (1ULL << (off & 63)))
+             && _nat_steered(s, raddr, rport, eaddr, _nat_port(base + off)) ) {
+            used[off / 64] |= 1ULL << (off & 63);
+            s->refs[l]++;
+            return off;
+        }
+        off = (off + 1) & (s->params.block - 1);
+    }
+
+    return -1;
+}
+
+/*
+ * Allocate an external port to a subscriber for a connection to a remote
+ * endpoint; a new block is allocated if the blocks of the subscriber have no
+ * port.  Returns the block, or FE_NAT_NIL.
+ */
+static __inline__ uint32_t
+_nat_port_alloc(struct fe_nat_shard *s, struct fe_nat_sub *sub,
+                uint32_t raddr, uint16_t rport, int *port)
+{
+    uint32_t l;
+    int off;
+    int i;
+    int j;
+
+    /* From the block of the cursor */
+    j = sub->cursor / s->params.block;
+    for ( i = 0; i < sub->nblocks; i++ ) {
+        l = sub->blocks[(j + i) % sub->nblocks];
+        off = _nat_block_alloc(s, l, i ? 0 : sub->cursor, raddr, rport);
+        if ( off >= 0 ) {
+            *port = _nat_block_port(s, l) + off;
+            sub->cursor = ((j + i) % sub->nblocks) * s->params.block + off
+                + 1;
+            return l;
+        }
+    }
+
+    /* New block */
+    if ( sub->nblocks >= s->params.blocks || s->nfree <= 0 ) {
+        return FE_NAT_NIL;
+    }
+    l = s->free_blocks[--s->nfree];
+    sub->blocks[sub->nblocks] = l;
+    off = _nat_block_alloc(s, l, 0, raddr, rport);
+    if ( off < 0 ) {
+        /* Not steerable */
+        s->free_blocks[s->nfree++] = l;
+        return FE_NAT_NIL;
+    }
+    *port = _nat_block_port(s, l) + off;
+    sub->cursor = sub->nblocks * s->params.block + off + 1;
+    sub->nblocks++;
+
+    return l;
+}
+
+/*
+ * Release the external port of a connection, and the block and the
+ * subscriber if no longer used
+ */
+static __inline__ void
+_nat_port_free(struct fe_nat_shard *s, struct fe_nat_conn *c)
+{
+    struct fe_nat_sub *sub;
+    const uint8_t *p;
+    uint32_t l;
+    int off;
+    int i;
+
+    l = c->block;
+    p = (const uint8_t *)&c->keys[1].dport;
+    off = ((((int)p[0] << 8) | p[1]) - FE_NAT_PORT_MIN)
+        & (s->params.block - 1);
+    s->used[(size_t)l * (s->params.block / 64) + off / 64]
+        &= ~(1ULL << (off & 63));
+    s->refs[l]--;
+
+    sub = _nat_sub_find(s, c->keys[0].saddr, 0);
+    if ( NULL == sub ) {
+        return;
+    }
+    if ( 0 == s->refs[l] ) {
+        /* Return the block */
+        for ( i = 0; i < sub->nblocks; i++ ) {
+            if ( sub->blocks[i] == l ) {
+                sub->nblocks--;
+                sub->blocks[i] = sub->blocks[sub->nblocks];
+                break;
+            }
+        }
+        sub->cursor = 0;
+        s->free_blocks[s->nfree++] = l;
+    }
+    sub->conns--;
+    if ( 0 == sub->conns ) {
+        _nat_sub_delete(s, sub);
+    }
+}
+
+/*
+ * Put a connection in the slot of its expiry
+ */
+static __inline__ void
+_nat_wheel_add(struct fe_nat_shard *s, uint32_t ci)
+{
+    uint32_t slot;
+
+    slot = s->conns[ci].expire & (FE_NAT_WHEEL - 1);
+    s->conns[ci].next = s->wheel[slot];
+    s->wheel[slot] = ci;
+}
+
+/*
+ * Update the state and the expiry of a connection with a TCP or UDP packet
+ */
+static __inline__ void
+_nat_refresh(struct fe_nat_shard *s, struct fe_nat_conn *c,
+             const uint8_t *l4, int dir, uint32_t now)
+{
+    const int *to;
+    uint8_t flags;
+    int timeout;
+
+    to = s->params.timeouts;
+    if ( 17 == c->keys[0].proto ) {
+        c->expire = now + to[FE_NAT_TO_UDP];
+        return;
+    }
+    flags = l4[13];
+    if ( flags & 0x04 ) {
+        /* RST */
+        c->state = FE_NAT_TCP_RST;
+    } else if ( flags & 0x01 ) {
+        /* FIN */
+        if ( FE_NAT_TCP_RST != c->state ) {
+            c->state = FE_NAT_TCP_FIN;
+        }
+    } else if ( dir && FE_NAT_TCP_SYN == c->state && (flags & 0x10) ) {
+        /* ACK from the remote */
+        c->state = FE_NAT_TCP_EST;
+    }
+    switch ( c->state ) {
+    case FE_NAT_TCP_EST:
+        timeout = to[FE_NAT_TO_TCP_EST];
+        break;
+    case FE_NAT_TCP_RST:
+        timeout = FE_NAT_RST_TIMEOUT;
+        break;
+    default:
+        timeout = to[FE_NAT_TO_TCP_TRANS];
+    }
+    c->expire = now + timeout;
+}
+
+/*
+ * Create a connection for an outbound key.  Returns the connection or a
+ * negative value (FE_NAT_NOPORT or FE_NAT_FULL).
+ */
+static __inline__ int64_t
+_nat_create(struct fe_nat_shard *s, const struct fe_nat_key *k)
+{
+    struct fe_nat_sub *sub;
+    struct fe_nat_conn *c;
+    uint32_t ci;
+    uint32_t l;
+    int port;
+
+    if ( FE_NAT_NIL == s->free ) {
+        return FE_NAT_FULL;
+    }
+    sub = _nat_sub_find(s, k->saddr, 1);
+    if ( NULL == sub ) {
+        return FE_NAT_FULL;
+    }
+    l = _nat_port_alloc(s, sub, k->daddr, k->dport, &port);
+    if ( FE_NAT_NIL == l ) {
+        if ( 0 == sub->conns ) {
+            _nat_sub_delete(s, sub);
+        }
+        return FE_NAT_NOPORT;
+    }
+    sub->conns++;
+
+    ci = s->free;
+    c = &s->conns[ci];
+    s->free = c->next;
+    memcpy(&c->keys[0], k, sizeof(struct fe_nat_key));
+    memset(&c->keys[1], 0, sizeof(struct fe_nat_key));
+    c->keys[1].saddr = k->daddr;
+    c->keys[1].daddr = _nat_block_addr(s, l);
+    c->keys[1].sport = k->dport;
+    c->keys[1].dport = _nat_port(port);
+    c->keys[1].proto = k->proto;
+    c->block = l;
+    c->state = FE_NAT_TCP_SYN;
+
+    if ( _nat_insert(s, &c->keys[0], ci << 1) < 0 ) {
+        _nat_port_free(s, c);
+        c->next = s->free;
+        s->free = ci;
+        return FE_NAT_FULL;
+    }
+    if ( _nat_insert(s, &c->keys[1], (ci << 1) | 1) < 0 ) {
+        _nat_delete(s, &c->keys[0], ci << 1);
+        _nat_port_free(s, c);
+        c->next = s->free;
+        s->free = ci;
+        return FE_NAT_FULL;
+    }
+    s->nconns++;
+
+    return ci;
+}
+
+/*
+ * Remove a connection
+ */
+static __inline__ void
+_nat_destroy(struct fe_nat_shard *s, uint32_t ci)
+{
+    struct fe_nat_conn *c;
+
+    c = &s->conns[ci];
+    _nat_delete(s, &c->keys[0], ci << 1);
+    _nat_delete(s, &c->keys[1], (ci << 1) | 1);
+    _nat_port_free(s, c);
+    c->next = s->free;
+    s->free = ci;
+    s->nconns--;
+}
+
+/*
+ * Visit the slots of the timer wheel up to now, and remove the connections
+ * expired; at most budget connections are visited.  Returns the # of
+ * connections removed.
+ */
+static __inline__ int
+fe_nat_expire(struct fe_nat_shard *s, uint32_t now, int budget)
+{
+    uint32_t ci;
+    int n;
+
+    n = 0;
+    while ( budget > 0 ) {
+        if ( FE_NAT_NIL == s->pending ) {
+            if ( (int32_t)(now - s->now) <= 0 ) {
+                break;
+            }
+            /* Take the list of the next slot */
+            s->pending = s->wheel[s->now & (FE_NAT_WHEEL - 1)];
+            s->wheel[s->now & (FE_NAT_WHEEL - 1)] = FE_NAT_NIL;
+            s->now++;
+            continue;
+        }
+        ci = s->pending;
+        s->pending = s->conns[ci].next;
+        if ( (int32_t)(s->conns[ci].expire - s->now) < 0 ) {
+            _nat_destroy(s, ci);
+            n++;
+        } else {
+            /* Refreshed */
+            _nat_wheel_add(s, ci);
+        }
+        budget--;
+    }
+
+    return n;
+}
+
+/*
+ * Locate the IPv4 header and the TCP/UDP header of a packet.  Returns the
+ * offset of the IPv4 header, or -1 if not IPv4.
+ */
+static __inline__ int
+_nat_parse(const uint8_t *pkt, int len, int *l4off)
+{
+    int off;
+    int ihl;
+
+    off = 14;
+    if ( len >= 18 && 0x81 == pkt[12] && 0x00 == pkt[13] ) {
+        /* 802.1Q */
+        off = 18;
+    }
+    if ( len < off + 20 || 0x08 != pkt[off - 2] || 0x00 != pkt[off - 1]
+         || 4 != (pkt[off] >> 4) ) {
+        return -1;
+    }
+    ihl = (pkt[off] & 0xf) * 4;
+    if ( ihl < 20 ) {
+        return -1;
+    }
+    *l4off = off + ihl;
+
+    return off;
+}
+
+/*
+ * Check the transport of a packet to translate; fragments and the protocols
+ * other than TCP and UDP are not supported
+ */
+static __inline__ int
+_nat_supported(const uint8_t *ip, int len, int l4off)
+{
+    if ( (ip[6] & 0x3f) || ip[7] ) {
+        /* Fragment */
+        return 0;
+    }
+    if ( 6 == ip[9] ) {
+        return len >= l4off + 20;
+    }
+    if ( 17 == ip[9] ) {
+        return len >= l4off + 8;
+    }
+
+    return 0;
+}
+
+/*
+ * Incremental update of a checksum (RFC 1624) for n 16-bit words
+ */
+static __inline__ uint16_t
+_nat_csum(uint16_t sum, const uint16_t *old, const uint16_t *new, int n)
+{
+    uint32_t s;
+    int i;
+
+    s = (uint16_t)~sum;
+    for ( i = 0; i < n; i++ ) {
+        s += (uint16_t)~old[i];
+        s += new[i];
+    }
+    s = (s & 0xffff) + (s >> 16);
+    s = (s & 0xffff) + (s >> 16);
+
+    return ~s;
+}
+
+/*
+ * Rewrite an address (at aoff of the IPv4 header) and a port (at poff of the
+ * TCP/UDP header) with the checksums updated
+ */
+static __inline__ void
+_nat_rewrite(uint8_t *ip, uint8_t *l4, int aoff, int poff, uint32_t addr,
+             uint16_t port)
+{
+    uint16_t old[3];
+    uint16_t new[3];
+    uint16_t sum;
+    int coff;
+
+    memcpy(old, ip + aoff, 4);
+    memcpy(old + 2, l4 + poff, 2);
+    memcpy(new, &addr, 4);
+    memcpy(new + 2, &port, 2);
+
+    /* IPv4 header */
+    memcpy(&sum, ip + 10, 2);
+    sum = _nat_csum(sum, old, new, 2);
+    memcpy(ip + 10, &sum, 2);
+
+    /* TCP/UDP (the pseudo header and the port) */
+    coff = 6 == ip[9] ? 16 : 6;
+    memcpy(&sum, l4 + coff, 2);
+    if ( 17 != ip[9] || 0 != sum ) {
+        sum = _nat_csum(sum, old, new, 3);
+        if ( 17 == ip[9] && 0 == sum ) {
+            sum = 0xffff;
+        }
+        memcpy(l4 + coff, &sum, 2);
+    }
+
+    memcpy(ip + aoff, &addr, 4);
+    memcpy(l4 + poff, &port, 2);
+}
+
+static __inline__ void
+_nat_key(struct fe_nat_key *k, const uint8_t *ip, const uint8_t *l4)
+{
+    memset(k, 0, sizeof(struct fe_nat_key));
+    memcpy(&k->saddr, ip + 12, 4);
+    memcpy(&k->daddr, ip + 16, 4);
+    memcpy(&k->sport, l4, 2);
+    memcpy(&k->dport, l4 + 2, 2);
+    k->proto = ip[9];
+}
+
+/*
+ * Translate a packet received on an inside port; a connection is created by
+ * a UDP packet or a TCP SYN.  Returns FE_NAT_XLATE, FE_NAT_PASS, or a
+ * negative value to drop it.
+ */
+static __inline__ int
+fe_nat_outbound(struct fe_nat_shard *s, uint8_t *pkt, int len, uint32_t now)
+{
+    struct fe_nat_key k;
+    struct fe_nat_conn *c;
+    uint8_t *ip;
+    uint8_t *l4;
+    uint32_t v;
+    int64_t ci;
+    int l4off;
+    int off;
+
+    off = _nat_parse(pkt, len, &l4off);
+    if ( off < 0 ) {
+        return FE_NAT_PASS;
+    }
+    ip = pkt + off;
+    if ( !_nat_supported(ip, len, l4off) ) {
+        return FE_NAT_UNSUPPORTED;
+    }
+    l4 = pkt + l4off;
+    _nat_key(&k, ip, l4);
+
+    v = fe_nat_lookup(s, &k);
+    if ( FE_NAT_NIL == v ) {
+        if ( 6 == k.proto && 0x02 != (l4[13] & 0x17) ) {
+            /* Not a SYN */
+            return FE_NAT_MISS;
+        }
+        ci = _nat_create(s, &k);
+        if ( ci < 0 ) {
+            return ci;
+        }
+        c = &s->conns[ci];
+        _nat_refresh(s, c, l4, 0, now);
+        _nat_wheel_add(s, ci);
+    } else if ( v & 1 ) {
+        /* Matched the inbound key of another connection */
+        return FE_NAT_MISS;
+    } else {
+        c = &s->conns[v >> 1];
+        _nat_refresh(s, c, l4, 0, now);
+    }
+
+    _nat_rewrite(ip, l4, 12, 0, c->keys[1].daddr, c->keys[1].dport);
+
+    return FE_NAT_XLATE;
+}
+
+/*
+ * Translate back a packet received on an outside port to an external
+ * address.  Returns FE_NAT_XLATE, FE_NAT_PASS, or a negative value to drop
+ * it.
+ */
+static __inline__ int
+fe_nat_inbound(struct fe_nat_shard *s, uint8_t *pkt, int len, uint32_t now)
+{
+    struct fe_nat_key k;
+    struct fe_nat_conn *c;
+    uint8_t *ip;
+    uint8_t *l4;
+    uint32_t v;
+    int l4off;
+    int off;
+
+    off = _nat_parse(pkt, len, &l4off);
+    if ( off < 0 ) {
+        return FE_NAT_PASS;
+    }
+    ip = pkt + off;
+    if ( _nat_rd32(ip + 16) - s->params.addr >= (uint32_t)s->params.naddrs ) {
+        /* Not to the external addresses */
+        return FE_NAT_PASS;
+    }
+    if ( !_nat_supported(ip, len, l4off) ) {
+        return FE_NAT_UNSUPPORTED;
+    }
+    l4 = pkt + l4off;
+    _nat_key(&k, ip, l4);
+
+    v = fe_nat_lookup(s, &k);
+    if ( FE_NAT_NIL == v || !(v & 1) ) {
+        return FE_NAT_MISS;
+    }
+    c = &s->conns[v >> 1];
+    _nat_refresh(s, c, l4, 1, now);
+
+    _nat_rewrite(ip, l4, 16, 2, c->keys[0].saddr, c->keys[0].sport);
+
+    return FE_NAT_XLATE;
+}
+
+/*
+ * Remove all the connections, and apply the parameters; the blocks owned are
+ * pushed to the stack so that the lowest is allocated first.
+ */
+static __inline__ void
+fe_nat_shard_reset(struct fe_nat_shard *s, const struct fe_nat_params *p)
+{
+    uint32_t i;
+
+    memcpy(&s->params, p, sizeof(struct fe_nat_params));
+    s->nper = FE_NAT_NPORTS / p->block;
+    s->nblocks = (p->naddrs * s->nper + s->nshards - 1 - s->id) / s->nshards;
+    s->nfree = 0;
+    for ( i = s->nblocks; i > 0; i-- ) {
+        s->free_blocks[s->nfree++] = i - 1;
+    }
+    memset(s->refs, 0, sizeof(uint32_t) * s->nblocks);
+    memset(s->used, 0, sizeof(uint64_t) * s->nblocks * (p->block / 64));
+
+    for ( i = 0; i < FE_NAT_CONNS; i++ ) {
+        s->conns[i].next = i + 1 < FE_NAT_CONNS ? i + 1 : FE_NAT_NIL;
+    }
+    s->free = 0;
+    s->nconns = 0;
+    memset(s->buckets, 0, sizeof(struct fe_nat_bucket) * FE_NAT_BUCKETS);
+    for ( i = 0; i < FE_NAT_WHEEL; i++ ) {
+        s->wheel[i] = FE_NAT_NIL;
+    }
+    s->pending = FE_NAT_NIL;
+    memset(s->subs, 0, sizeof(struct fe_nat_sub) * FE_NAT_SUBS);
+    s->nsubs = 0;
+}
+
+/*
+ * Check the parameters
+ */
+static __inline__ int
+fe_nat_params_valid(const struct fe_nat_params *p)
+{
+    int i;
+
+    if ( p->naddrs <= 0 || p->naddrs > FE_NAT_MAX_ADDRS
+         || p->block < FE_NAT_BLOCK_MIN || p->block > FE_NAT_BLOCK_MAX
+         || (p->block & (p->block - 1)) || p->blocks <= 0
+         || p->blocks > FE_NAT_SUB_BLOCKS ) {
+        return 0;
+    }
+    for ( i = 0; i < FE_NAT_NTIMEOUTS; i++ ) {
+        if ( p->timeouts[i] <= 0 ) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+/*
+ * Release a shard
+ */
+static __inline__ void
+fe_nat_shard_release(struct fe_nat_shard *s)
+{
+    free(s->conns);
+    free(s->buckets);
+    free(s->subs);
+    free(s->free_blocks);
+    free(s->refs);
+    free(s->used);
+    free(s);
+}
+
+/*
+ * Create the shard id of nshards at the time now (in seconds); no address is
+ * translated until the parameters are applied
+ */
+static __inline__ struct fe_nat_shard *
+fe_nat_shard_init(int id, int nshards, uint32_t now)
+{
+    struct fe_nat_shard *s;
+    size_t nblocks;
+    size_t nwords;
+
+    s = malloc(sizeof(struct fe_nat_shard));
+    if ( NULL == s ) {
+        return NULL;
+    }
+    memset(s, 0, sizeof(struct fe_nat_shard));
+    s->id = id;
+    s->nshards = nshards;
+    s->steer.nq = 1;
+    s->now = now;
+
+    /* For the smallest blocks */
+    nblocks = (FE_NAT_MAX_ADDRS * (FE_NAT_NPORTS / FE_NAT_BLOCK_MIN)
+               + nshards - 1) / nshards;
+    nwords = ((size_t)FE_NAT_MAX_ADDRS * FE_NAT_NPORTS / nshards
+              + FE_NAT_BLOCK_MAX) / 64;
+    s->conns = malloc(sizeof(struct fe_nat_conn) * FE_NAT_CONNS);
+    s->buckets = malloc(sizeof(struct fe_nat_bucket) * FE_NAT_BUCKETS);
+    s->subs = malloc(sizeof(struct fe_nat_sub) * FE_NAT_SUBS);
+    s->free_blocks = malloc(sizeof(uint32_t) * nblocks);
+    s->refs = malloc(sizeof(uint32_t) * nblocks);
+    s->used = malloc(sizeof(uint64_t) * nwords);
+    if ( NULL == s->conns || NULL == s->buckets || NULL == s->subs
+         || NULL == s->free_blocks || NULL == s->refs || NULL == s->used ) {
+        fe_nat_shard_release(s);
+        return NULL;
+    }
+
+    /* No address */
+    s->params.block = FE_NAT_BLOCK_DEFAULT;
+    fe_nat_shard_reset(s, &s->params);
+
+    return s;
+}
+
+#endif /* _NAT_H */
+
+/*
+ * Local variables:
+ * tab-width: 4
+ * c-basic-offset: 4
+ * End:
+ * vim600: sw=4 ts=4 fdm=marker
+ * vim<600: sw=4 ts=4
+ */
@@ -0,0 +1,343 @@
+/*_
+ * Copyright (c) 2017 Hirochika Asai <asai@jar.jp>
+ * All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#ifndef _OFFLOAD_H
+#define _OFFLOAD_H
+
+/*
+ * Per-packet offload metadata.  On Rx, the drivers of the NICs with advanced
+ * descriptors (igb and ixgbe) fill the checksum status, the RSS hash and the
+ * packet type from the write-back descriptor, and the others clear the flags.
+ * On Tx, a stage that builds IPv4 headers requests the checksum insertion
+ * with fe_offload_tx_request(); the driver turns it into a context
+ * descriptor, or fe_offload_tx_sw() computes the checksums for the NICs
+ * without the offload.
+ */
+
+#include <stdint.h>
+
+/* Rx: the hash is valid, and the checksums verified by the NIC */
+#define FE_OFFLOAD_RX_HASH          (1 << 0)
+#define FE_OFFLOAD_RX_IPCS_GOOD     (1 << 1)
+#define FE_OFFLOAD_RX_IPCS_BAD      (1 << 2)
+#define FE_OFFLOAD_RX_L4CS_GOOD     (1 << 3)
+#define FE_OFFLOAD_RX_L4CS_BAD      (1 << 4)
+#define FE_OFFLOAD_RX_MASK          0x00ff
+/* Tx: the checksums to be inserted */
+#define FE_OFFLOAD_TX_IPCS          (1 << 8)
+#define FE_OFFLOAD_TX_TCPCS         (1 << 9)
+#define FE_OFFLOAD_TX_UDPCS         (1 << 10)
+#define FE_OFFLOAD_TX_MASK          0xff00
+
+/* Packet type */
+#define FE_OFFLOAD_PTYPE_IPV4       (1 << 0)
+#define FE_OFFLOAD_PTYPE_IPV6       (1 << 1)
+#define FE_OFFLOAD_PTYPE_TCP        (1 << 2)
+#define FE_OFFLOAD_PTYPE_UDP        (1 << 3)
+
+/* Advanced Rx descriptors (igb and ixgbe): RSS type in info0 [3:0], packet
+   type in info0 [16:4], and status/error bits */
+#define FE_OFFLOAD_ADV_RSSTYPE      0xf
+#define FE_OFFLOAD_ADV_PT_IPV4      0x003
+#define FE_OFFLOAD_ADV_PT_IPV6      0x00c
+#define FE_OFFLOAD_ADV_PT_TCP       0x010
+#define FE_OFFLOAD_ADV_PT_UDP       0x020
+#define FE_OFFLOAD_ADV_PT_ETQF      0x800
+#define FE_OFFLOAD_ADV_L4CS         (1 << 5)
+#define FE_OFFLOAD_ADV_IPCS         (1 << 6)
+#define FE_OFFLOAD_ADV_TCPE         (1U << 30)
+#define FE_OFFLOAD_ADV_IPE          (1U << 31)
+/* Advanced Tx context (TUCMD/DTYP/DEXT) and data (POPTS/CC) descriptors */
+#define FE_OFFLOAD_ADV_TUCMD_IPV4   (1 << 10)
+#define FE_OFFLOAD_ADV_TUCMD_TCP    (1 << 11)
+#define FE_OFFLOAD_ADV_DTYP_CTX     (2 << 20)
+#define FE_OFFLOAD_ADV_DEXT         (1 << 29)
+#define FE_OFFLOAD_ADV_CC           (1 << 7)
+#define FE_OFFLOAD_ADV_IXSM         (1 << 8)
+#define FE_OFFLOAD_ADV_TXSM         (1 << 9)
+
+/*
+ * Offload metadata
+ */
+struct fe_offload {
+    uint32_t flags;
+    /* RSS hash (FE_OFFLOAD_RX_HASH) */
+    uint32_t hash;
+    /* FE_OFFLOAD_PTYPE_* */
+    uint16_t ptype;
+    /* Header lengths for the Tx checksum insertion */
+    uint8_t l2len;
+    uint8_t l3len;
+};
+
+/*
+ * One's complement sum of 16-bit words in network byte order
+ */
+static __inline__ uint32_t
+_offload_sum(const uint8_t *p, int len, uint32_t sum)
+{
+    int i;
+
+    for ( i = 0; i + 1 < len; i += 2 ) {
+        sum += ((uint32_t)p[i] << 8) | p[i + 1];
+    }
+    if ( len & 1 ) {
+        sum += (uint32_t)p[len - 1] << 8;
+    }
+
+    return sum;
+}
+
+/*
+ * Fold a sum into 16 bits
+ */
+static __inline__ uint16_t
+_offload_fold(uint32_t sum)
+{
+    sum = (sum & 0xffff) + (sum >> 16);
+    sum = (sum & 0xffff) + (sum >> 16);
+
+    return sum;
+}
+
+/*
+ * Check if the NIC has found a bad IPv4 or L4 checksum
+ */
+static __inline__ int
+fe_offload_rx_bad(const struct fe_offload *ol)
+{
+    return ol->flags & (FE_OFFLOAD_RX_IPCS_BAD | FE_OFFLOAD_RX_L4CS_BAD);
+}
+
+/*
+ * Decode the write-back of an advanced Rx descriptor (igb and ixgbe).  A TCP
+ * checksum error is not trusted for UDP since 82599 reports it for the UDP
+ * datagrams without the checksum.
+ */
+static __inline__ void
+fe_offload_rx_adv(struct fe_offload *ol, uint32_t info0, uint32_t info1,
+                  uint32_t staterr)
+{
+    uint32_t flags;
+    uint32_t pt;
+    uint16_t ptype;
+
+    flags = 0;
+    if ( info0 & FE_OFFLOAD_ADV_RSSTYPE ) {
+        flags |= FE_OFFLOAD_RX_HASH;
+    }
+    ptype = 0;
+    pt = info0 >> 4;
+    if ( !(pt & FE_OFFLOAD_ADV_PT_ETQF) ) {
+        if ( pt & FE_OFFLOAD_ADV_PT_IPV4 ) {
+            ptype |= FE_OFFLOAD_PTYPE_IPV4;
+        }
+        if ( pt & FE_OFFLOAD_ADV_PT_IPV6 ) {
+            ptype |= FE_OFFLOAD_PTYPE_IPV6;
+        }
+        if ( pt & FE_OFFLOAD_ADV_PT_TCP ) {
+            ptype |= FE_OFFLOAD_PTYPE_TCP;
+        }
+        if ( pt & FE_OFFLOAD_ADV_PT_UDP ) {
+            ptype |= FE_OFFLOAD_PTYPE_UDP;
+        }
+    }
+    if ( staterr & FE_OFFLOAD_ADV_IPCS ) {
+        flags |= (staterr & FE_OFFLOAD_ADV_IPE)
+            ? FE_OFFLOAD_RX_IPCS_BAD : FE_OFFLOAD_RX_IPCS_GOOD;
+    }
+    if ( staterr & FE_OFFLOAD_ADV_L4CS ) {
+        if ( !(staterr & FE_OFFLOAD_ADV_TCPE) ) {
+            flags |= FE_OFFLOAD_RX_L4CS_GOOD;
+        } else if ( !(ptype & FE_OFFLOAD_PTYPE_UDP) ) {
+            flags |= FE_OFFLOAD_RX_L4CS_BAD;
+        }
+    }
+    ol->flags = flags;
+    ol->hash = info1;
+    ol->ptype = ptype;
+}
+
+/*
+ * Context of an advanced Tx descriptor (igb and ixgbe): TUCMD, DTYP and DEXT
+ * in the upper 32 bits, and MACLEN and IPLEN in the lower
+ */
+static __inline__ uint64_t
+fe_offload_adv_ctx(const struct fe_offload *ol)
+{
+    uint32_t tucmd;
+
+    tucmd = FE_OFFLOAD_ADV_DEXT | FE_OFFLOAD_ADV_DTYP_CTX
+        | FE_OFFLOAD_ADV_TUCMD_IPV4;
+    if ( ol->flags & FE_OFFLOAD_TX_TCPCS ) {
+        tucmd |= FE_OFFLOAD_ADV_TUCMD_TCP;
+    }
+
+    return ((uint64_t)tucmd << 32) | ((uint32_t)ol->l2len << 9) | ol->l3len;
+}
+
+/*
+ * POPTS and CC of an advanced Tx data descriptor
+ */
+static __inline__ uint32_t
+fe_offload_adv_popts(const struct fe_offload *ol)
+{
+    uint32_t popts;
+
+    popts = FE_OFFLOAD_ADV_CC;
+    if ( ol->flags & FE_OFFLOAD_TX_IPCS ) {
+        popts |= FE_OFFLOAD_ADV_IXSM;
+    }
+    if ( ol->flags & (FE_OFFLOAD_TX_TCPCS | FE_OFFLOAD_TX_UDPCS) ) {
+        popts |= FE_OFFLOAD_ADV_TXSM;
+    }
+
+    return popts;
+}
+
+/*
+ * Request the checksum insertion of an IPv4 (optionally 802.1Q-tagged) frame.
+ * The IPv4 checksum is cleared, and the TCP/UDP checksum is seeded with the
+ * pseudo-header sum as the NICs expect.  Returns 0 on success, or -1 if the
+ * frame is not of the requested type, leaving it untouched.
+ */
+static __inline__ int
+fe_offload_tx_request(struct fe_offload *ol, uint8_t *pkt, int len,
+                      uint32_t flags)
+{
+    uint16_t type;
+    uint32_t sum;
+    int l2len;
+    int l3len;
+    int l4len;
+    int off;
+
+    if ( len < 14 ) {
+        return -1;
+    }
+    type = ((uint16_t)pkt[12] << 8) | pkt[13];
+    l2len = 14;
+    if ( 0x8100 == type && len >= 18 ) {
+        type = ((uint16_t)pkt[16] << 8) | pkt[17];
+        l2len = 18;
+    }
+    if ( 0x0800 != type || len < l2len + 20 ) {
+        return -1;
+    }
+    l3len = (pkt[l2len] & 0xf) * 4;
+    if ( 4 != (pkt[l2len] >> 4) || l3len < 20 || len < l2len + l3len ) {
+        return -1;
+    }
+    l4len = (((int)pkt[l2len + 2] << 8) | pkt[l2len + 3]) - l3len;
+    if ( l4len < 0 || len < l2len + l3len + l4len ) {
+        return -1;
+    }
+
+    off = -1;
+    if ( flags & FE_OFFLOAD_TX_TCPCS ) {
+        if ( 6 != pkt[l2len + 9] || l4len < 20 ) {
+            return -1;
+        }
+        off = l2len + l3len + 16;
+    } else if ( flags & FE_OFFLOAD_TX_UDPCS ) {
+        if ( 17 != pkt[l2len + 9] || l4len < 8 ) {
+            return -1;
+        }
+        off = l2len + l3len + 6;
+    }
+    if ( off >= 0 && (pkt[l2len + 6] & 0x3f || pkt[l2len + 7]) ) {
+        /* Fragment */
+        return -1;
+    }
+
+    if ( flags & FE_OFFLOAD_TX_IPCS ) {
+        pkt[l2len + 10] = 0;
+        pkt[l2len + 11] = 0;
+    }
+    if ( off >= 0 ) {
+        /* Pseudo header: addresses, protocol, and length */
+        sum = _offload_sum(pkt + l2len + 12, 8, 0);
+        sum += pkt[l2len + 9] + l4len;
+        sum = _offload_fold(sum);
+        pkt[off] = sum >> 8;
+        pkt[off + 1] = sum;
+    }
+    ol->flags = (ol->flags & ~FE_OFFLOAD_TX_MASK)
+        | (flags & FE_OFFLOAD_TX_MASK);
+    ol->l2len = l2len;
+    ol->l3len = l3len;
+
+    return 0;
+}
+
+/*
+ * Insert the requested checksums in software.  The request is cleared so that
+ * the copies of a flooded frame to the other ports are sent as they are.
+ */
+static __inline__ void
+fe_offload_tx_sw(struct fe_offload *ol, uint8_t *pkt, int len)
+{
+    uint16_t sum;
+    int l4len;
+    int off;
+    int ip;
+
+    ip = ol->l2len;
+    if ( ol->flags & FE_OFFLOAD_TX_IPCS ) {
+        sum = ~_offload_fold(_offload_sum(pkt + ip, ol->l3len, 0));
+        pkt[ip + 10] = sum >> 8;
+        pkt[ip + 11] = sum;
+    }
+    if ( ol->flags & (FE_OFFLOAD_TX_TCPCS | FE_OFFLOAD_TX_UDPCS) ) {
+        off = ip + ol->l3len;
+        l4len = (((int)pkt[ip + 2] << 8) | pkt[ip + 3]) - ol->l3len;
+        if ( off + l4len > len ) {
+            l4len = len - off;
+        }
+        /* The checksum field holds the pseudo-header sum */
+        sum = ~_offload_fold(_offload_sum(pkt + off, l4len, 0));
+        if ( ol->flags & FE_OFFLOAD_TX_UDPCS ) {
+            if ( 0 == sum ) {
+                sum = 0xffff;
+            }
+            off += 6;
+        } else {
+            off += 16;
+        }
+        pkt[off] = sum >> 8;
+        pkt[off + 1] = sum;
+    }
+    ol->flags &= ~FE_OFFLOAD_TX_MASK;
+}
+
+#endif /* _OFFLOAD_H */
+
+/*
+ * Local variables:
+ * tab-width: 4
+ * c-basic-offset: 4
+ * End:
+ * vim600: sw=4 ts=4 fdm=marker
+ * vim<600: sw=4 ts=4
+ */
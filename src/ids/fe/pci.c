@@ -22,22 +22,68 @@
  */
 
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <machine/sysarch.h>
+#include <mki/driver.h>
 #include "pci.h"
 
 #define PCI_CONFIG_ADDR 0xcf8
 #define PCI_CONFIG_DATA 0xcfc
 
+/* PCI device table enumerated by the kernel at boot */
+static struct sysdriver_pci_table pci_table;
+/* ECAM window of each bus, mapped on the first access */
+static volatile uint8_t *pci_ecam[256];
+
+/*
+ * Get the address of a configuration register in the ECAM window, or NULL if
+ * ECAM is not available for the bus
+ */
+static volatile uint8_t *
+_ecam_addr(uint16_t bus, uint16_t slot, uint16_t func, uint16_t offset)
+{
+    volatile uint8_t *base;
+
+    if ( 0 == pci_table.ecam_base || bus < pci_table.ecam_start_bus
+         || bus > pci_table.ecam_end_bus ) {
+        return NULL;
+    }
+    base = pci_ecam[bus];
+    if ( NULL == base ) {
+        base = driver_mmap((void *)(pci_table.ecam_base
+                                    + (uint64_t)bus * PCI_ECAM_BUS_SIZE),
+                           PCI_ECAM_BUS_SIZE);
+        if ( NULL == base ) {
+            return NULL;
+        }
+        pci_ecam[bus] = base;
+    }
+
+    return base + ((uint32_t)slot << 15) + ((uint32_t)func << 12)
+        + (offset & 0xfff);
+}
+
 /*
- * Read PCI configuration
+ * Read PCI configuration through ECAM if available, otherwise through the
+ * legacy I/O ports.  The extended configuration space (offset 0x100 or
+ * above) is reachable only through ECAM.
  */
 uint16_t
 pci_read_config(uint16_t bus, uint16_t slot, uint16_t func, uint16_t offset)
 {
     uint32_t addr;
     struct sysarch_io io;
+    volatile uint8_t *cfg;
+
+    cfg = _ecam_addr(bus, slot, func, offset & 0xffe);
+    if ( NULL != cfg ) {
+        return *(volatile uint16_t *)cfg;
+    }
+    if ( offset >= PCI_EXT_CONFIG_BASE ) {
+        return 0xffff;
+    }
 
     addr = ((uint32_t)bus << 16) | ((uint32_t)slot << 11)
         | ((uint32_t)func << 8) | ((uint32_t)offset & 0xfc);
@@ -62,6 +108,16 @@ pci_write_config(uint16_t bus, uint16_t slot, uint16_t func, uint16_t offset,
 {
     uint32_t addr;
     struct sysarch_io io;
+    volatile uint8_t *cfg;
+
+    cfg = _ecam_addr(bus, slot, func, offset & 0xffe);
+    if ( NULL != cfg ) {
+        *(volatile uint16_t *)cfg = data;
+        return;
+    }
+    if ( offset >= PCI_EXT_CONFIG_BASE ) {
+        return;
+    }
 
     addr = ((uint32_t)bus << 16) | ((uint32_t)slot << 11)
         | ((uint32_t)func << 8) | ((uint32_t)offset & 0xfc);
@@ -71,9 +127,10 @@ pci_write_config(uint16_t bus, uint16_t slot, uint16_t func, uint16_t offset,
     io.port = PCI_CONFIG_ADDR;
     io.data = addr;
     sysarch(SYSARCH_OUTL, &io);
-    io.port = PCI_CONFIG_DATA;
+    /* Word access not to overwrite the other half of the register */
+    io.port = PCI_CONFIG_DATA + (offset & 2);
     io.data = data;
-    sysarch(SYSARCH_OUTL, &io);
+    sysarch(SYSARCH_OUTW, &io);
 }
 
 /*
@@ -81,15 +138,34 @@ pci_write_config(uint16_t bus, uint16_t slot, uint16_t func, uint16_t offset,
  */
 uint64_t
 pci_read_mmio(uint8_t bus, uint8_t slot, uint8_t func)
+{
+    return pci_read_bar(bus, slot, func, 0);
+}
+
+/*
+ * Read memory mapped I/O (MMIO) base address from the specified BAR
+ */
+uint64_t
+pci_read_bar(uint8_t bus, uint8_t slot, uint8_t func, int idx)
 {
     uint64_t addr;
     uint32_t bar0;
     uint32_t bar1;
+    uint16_t off;
     uint8_t type;
     uint8_t prefetchable;
 
-    bar0 = pci_read_config(bus, slot, func, 0x10);
-    bar0 |= (uint32_t)pci_read_config(bus, slot, func, 0x12) << 16;
+    if ( idx < 0 || idx > 5 ) {
+        return 0;
+    }
+    off = 0x10 + 4 * idx;
+
+    bar0 = pci_read_config(bus, slot, func, off);
+    bar0 |= (uint32_t)pci_read_config(bus, slot, func, off + 2) << 16;
+    if ( bar0 & 0x1 ) {
+        /* I/O space */
+        return 0;
+    }
 
     type = (bar0 >> 1) & 0x3;
     prefetchable = (bar0 >> 3) & 0x1;
@@ -98,10 +174,10 @@ pci_read_mmio(uint8_t bus, uint8_t slot, uint8_t func)
 
     if ( 0x00 == type ) {
         /* 32bit */
-    } else if ( 0x02 == type ) {
+    } else if ( 0x02 == type && idx < 5 ) {
         /* 64bit */
-        bar1 = pci_read_config(bus, slot, func, 0x14);
-        bar1 |= (uint32_t)pci_read_config(bus, slot, func, 0x16) << 16;
+        bar1 = pci_read_config(bus, slot, func, off + 4);
+        bar1 |= (uint32_t)pci_read_config(bus, slot, func, off + 6) << 16;
         addr |= ((uint64_t)bar1) << 32;
     } else {
         return 0;
@@ -110,6 +186,213 @@ pci_read_mmio(uint8_t bus, uint8_t slot, uint8_t func)
     return addr;
 }
 
+/*
+ * Find the capability of the specified ID in the capability list.  The search
+ * starts from the head of the list if ptr is zero, or from the next of the
+ * capability at ptr otherwise.  Returns the offset of the capability, or zero
+ * if not found.
+ */
+uint8_t
+pci_find_capability(uint16_t bus, uint16_t slot, uint16_t func, uint8_t id,
+                    uint8_t ptr)
+{
+    uint16_t m16;
+    int ttl;
+
+    if ( 0 == ptr ) {
+        /* Capabilities list bit in the status register */
+        if ( !(pci_read_config(bus, slot, func, 0x06) & (1 << 4)) ) {
+            return 0;
+        }
+        ptr = pci_read_config(bus, slot, func, 0x34) & 0xfc;
+    } else {
+        ptr = (pci_read_config(bus, slot, func, ptr) >> 8) & 0xfc;
+    }
+
+    /* Bounded to avoid looping on a broken list */
+    for ( ttl = 48; ptr >= 0x40 && ttl > 0; ttl-- ) {
+        m16 = pci_read_config(bus, slot, func, ptr);
+        if ( (m16 & 0xff) == id ) {
+            return ptr;
+        }
+        ptr = (m16 >> 8) & 0xfc;
+    }
+
+    return 0;
+}
+
+/*
+ * Find an extended capability in the extended configuration space.  Returns
+ * the offset of the capability, or zero if not found or if the extended
+ * configuration space is not reachable.
+ */
+uint16_t
+pci_find_ext_capability(uint16_t bus, uint16_t slot, uint16_t func,
+                        uint16_t id)
+{
+    uint16_t ptr;
+    uint16_t hid;
+    uint16_t next;
+    int ttl;
+
+    ptr = PCI_EXT_CONFIG_BASE;
+    /* Bounded to avoid looping on a broken list */
+    for ( ttl = 480; ptr >= PCI_EXT_CONFIG_BASE && ttl > 0; ttl-- ) {
+        hid = pci_read_config(bus, slot, func, ptr);
+        next = pci_read_config(bus, slot, func, ptr + 2);
+        if ( 0xffff == hid || (0 == hid && 0 == next) ) {
+            break;
+        }
+        if ( hid == id ) {
+            return ptr;
+        }
+        ptr = (next >> 4) & 0xffc;
+    }
+
+    return 0;
+}
+
+/*
+ * Find the MSI-X capability of a function, and map its table.  All the
+ * vectors are masked until they are set up.  Returns -1 if not supported.
+ */
+int
+pci_msix_init(struct pci_msix *msix, uint16_t bus, uint16_t slot,
+              uint16_t func)
+{
+    uint64_t pa;
+    uint64_t base;
+    uint32_t m32;
+    uint16_t ctrl;
+    size_t len;
+    void *va;
+    int i;
+
+    msix->bus = bus;
+    msix->slot = slot;
+    msix->func = func;
+    msix->cap = pci_find_capability(bus, slot, func, PCI_CAP_ID_MSIX, 0);
+    if ( 0 == msix->cap ) {
+        return -1;
+    }
+    ctrl = pci_read_config(bus, slot, func, msix->cap + 2);
+    msix->nvec = PCI_MSIX_CTRL_NVEC(ctrl);
+
+    /* Table offset and BIR */
+    m32 = pci_read_config(bus, slot, func, msix->cap + 4);
+    m32 |= (uint32_t)pci_read_config(bus, slot, func, msix->cap + 6) << 16;
+    pa = pci_read_bar(bus, slot, func, m32 & 0x7);
+    if ( 0 == pa ) {
+        return -1;
+    }
+    pa += m32 & ~0x7U;
+
+    /* Map from the page boundary */
+    len = (size_t)msix->nvec * PCI_MSIX_ENTRY_SIZE;
+    base = pa & ~0xfffULL;
+    va = driver_mmap((void *)base, pa - base + len);
+    if ( NULL == va ) {
+        return -1;
+    }
+    msix->table = va + (pa - base);
+
+    for ( i = 0; i < msix->nvec; i++ ) {
+        pci_msix_mask(msix, i, 1);
+    }
+
+    return 0;
+}
+
+/*
+ * Program the message of an MSI-X table entry, and unmask it
+ */
+int
+pci_msix_set_vector(struct pci_msix *msix, int idx, uint64_t addr,
+                    uint32_t data)
+{
+    volatile uint32_t *e;
+
+    if ( idx < 0 || idx >= msix->nvec ) {
+        return -1;
+    }
+    e = msix->table + idx * PCI_MSIX_ENTRY_SIZE / 4;
+    e[3] |= PCI_MSIX_ENTRY_MASKED;
+    e[0] = addr & 0xffffffffULL;
+    e[1] = addr >> 32;
+    e[2] = data;
+    e[3] &= ~PCI_MSIX_ENTRY_MASKED;
+
+    return 0;
+}
+
+/*
+ * Mask or unmask an MSI-X table entry
+ */
+void
+pci_msix_mask(struct pci_msix *msix, int idx, int masked)
+{
+    volatile uint32_t *e;
+
+    if ( idx < 0 || idx >= msix->nvec ) {
+        return;
+    }
+    e = msix->table + idx * PCI_MSIX_ENTRY_SIZE / 4;
+    if ( masked ) {
+        e[3] |= PCI_MSIX_ENTRY_MASKED;
+    } else {
+        e[3] &= ~PCI_MSIX_ENTRY_MASKED;
+    }
+}
+
+/*
+ * Enable or disable MSI-X of a function; the legacy INTx is disabled while
+ * MSI-X is enabled
+ */
+void
+pci_msix_enable(struct pci_msix *msix, int enabled)
+{
+    uint16_t ctrl;
+    uint16_t cmd;
+
+    ctrl = pci_read_config(msix->bus, msix->slot, msix->func, msix->cap + 2);
+    cmd = pci_read_config(msix->bus, msix->slot, msix->func, 0x04);
+    if ( enabled ) {
+        ctrl = (ctrl | PCI_MSIX_CTRL_ENABLE) & ~PCI_MSIX_CTRL_MASKALL;
+        cmd |= (1 << 10);
+    } else {
+        ctrl &= ~PCI_MSIX_CTRL_ENABLE;
+        cmd &= ~(1 << 10);
+    }
+    pci_write_config(msix->bus, msix->slot, msix->func, 0x04, cmd);
+    pci_write_config(msix->bus, msix->slot, msix->func, msix->cap + 2, ctrl);
+}
+
+/*
+ * Allocate a vector delivered to the processor of the local APIC ID cpu for
+ * an MSI-X table entry, and register this process to be woken up by it.
+ * Returns the vector, or -1 on failure.
+ */
+int
+pci_msix_bind(struct pci_msix *msix, int idx, int cpu)
+{
+    uint64_t addr;
+    uint32_t data;
+    int vec;
+
+    if ( idx < 0 || idx >= msix->nvec ) {
+        return -1;
+    }
+    vec = driver_register_msi_handler(cpu, &addr, &data);
+    if ( vec < 0 ) {
+        return -1;
+    }
+    if ( pci_msix_set_vector(msix, idx, addr, data) < 0 ) {
+        return -1;
+    }
+
+    return vec;
+}
+
 /*
  * Read ROM BAR
  */
@@ -281,13 +564,65 @@ pci_check_all_buses(void)
     return pci;
 }
 
+/*
+ * Build the list of PCI devices from the table enumerated by the kernel
+ */
+static struct pci_dev *
+_pci_from_table(struct sysdriver_pci_table *tbl)
+{
+    struct pci_dev *pci;
+    struct pci_dev **tail;
+    struct pci_dev *dev;
+    struct pci_dev_conf *conf;
+    struct sysdriver_pci_dev *ent;
+    int i;
+
+    pci = NULL;
+    tail = &pci;
+    for ( i = 0; i < tbl->ndevs; i++ ) {
+        ent = &tbl->devs[i];
+        dev = malloc(sizeof(struct pci_dev));
+        if ( NULL == dev ) {
+            break;
+        }
+        conf = malloc(sizeof(struct pci_dev_conf));
+        if ( NULL == conf ) {
+            free(dev);
+            break;
+        }
+        conf->bus = ent->bus;
+        conf->slot = ent->slot;
+        conf->func = ent->func;
+        conf->vendor_id = ent->vendor_id;
+        conf->device_id = ent->device_id;
+        conf->intr_pin = ent->intr_pin;
+        conf->intr_line = ent->intr_line;
+        conf->class = ent->class;
+        conf->subclass = ent->subclass;
+        conf->progif = ent->progif;
+        conf->revision = ent->revision;
+        dev->device = conf;
+        dev->next = NULL;
+        *tail = dev;
+        tail = &dev->next;
+    }
+
+    return pci;
+}
+
 /*
  * Initialize PCI driver
  */
 struct pci_dev *
 pci_init(void)
 {
-    /* Search all PCI devices */
+    /* Use the device table enumerated by the kernel at boot */
+    if ( driver_pci_table(&pci_table) >= 0 && pci_table.ndevs > 0 ) {
+        return _pci_from_table(&pci_table);
+    }
+
+    /* Fall back to searching all PCI devices through the I/O ports */
+    memset(&pci_table, 0, sizeof(struct sysdriver_pci_table));
     return pci_check_all_buses();
 }
 
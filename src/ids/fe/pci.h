@@ -26,6 +26,29 @@
 
 #include <stdint.h>
 
+/* Capability IDs */
+#define PCI_CAP_ID_MSI          0x05    /* Message signaled interrupts */
+#define PCI_CAP_ID_VNDR         0x09    /* Vendor specific */
+#define PCI_CAP_ID_MSIX         0x11    /* MSI-X */
+
+/* Extended capability IDs */
+#define PCI_EXT_CAP_ID_AER      0x0001  /* Advanced error reporting */
+#define PCI_EXT_CAP_ID_ARI      0x000e  /* Alternative routing-ID */
+#define PCI_EXT_CAP_ID_SRIOV    0x0010  /* Single root I/O virtualization */
+
+/* Offset to the extended configuration space */
+#define PCI_EXT_CONFIG_BASE     0x100
+/* Size of the configuration space of a bus in the ECAM window */
+#define PCI_ECAM_BUS_SIZE       (1ULL << 20)
+
+/* MSI-X message control */
+#define PCI_MSIX_CTRL_ENABLE    (1 << 15)
+#define PCI_MSIX_CTRL_MASKALL   (1 << 14)
+#define PCI_MSIX_CTRL_NVEC(c)   (((c) & 0x7ff) + 1)
+/* MSI-X table entry (16 bytes) */
+#define PCI_MSIX_ENTRY_SIZE     16
+#define PCI_MSIX_ENTRY_MASKED   1
+
 /*
  * PCI configuration space
  */
@@ -43,6 +66,20 @@ struct pci_dev_conf {
     uint8_t revision;
 };
 
+/*
+ * MSI-X capability of a function, and its table mapped
+ */
+struct pci_msix {
+    uint16_t bus;
+    uint16_t slot;
+    uint16_t func;
+    /* Offset of the capability in the configuration space */
+    uint8_t cap;
+    /* Number of the table entries */
+    int nvec;
+    volatile uint32_t *table;
+};
+
 /*
  * PCI device
  */
@@ -54,6 +91,14 @@ struct pci_dev {
 uint16_t pci_read_config(uint16_t, uint16_t, uint16_t, uint16_t);
 void pci_write_config(uint16_t, uint16_t, uint16_t, uint16_t, uint16_t);
 uint64_t pci_read_mmio(uint8_t, uint8_t, uint8_t);
+uint64_t pci_read_bar(uint8_t, uint8_t, uint8_t, int);
+uint8_t pci_find_capability(uint16_t, uint16_t, uint16_t, uint8_t, uint8_t);
+uint16_t pci_find_ext_capability(uint16_t, uint16_t, uint16_t, uint16_t);
+int pci_msix_init(struct pci_msix *, uint16_t, uint16_t, uint16_t);
+int pci_msix_set_vector(struct pci_msix *, int, uint64_t, uint32_t);
+void pci_msix_mask(struct pci_msix *, int, int);
+void pci_msix_enable(struct pci_msix *, int);
+int pci_msix_bind(struct pci_msix *, int, int);
 uint32_t pci_read_rom_bar(uint8_t, uint8_t, uint8_t);
 uint8_t pci_get_header_type(uint16_t, uint16_t, uint16_t);
 struct pci_dev * pci_init(void);
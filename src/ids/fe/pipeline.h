@@ -0,0 +1,118 @@
+/*_
+ * Copyright (c) 2017 Hirochika Asai <asai@jar.jp>
+ * All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef _PIPELINE_H
+#define _PIPELINE_H
+
+#include <stdint.h>
+#include <sys/pix.h>
+
+struct fe_pkt_buf_hdr;
+
+/* Max # of packets in a vector (one Rx burst) */
+#define FE_PIPELINE_VECSZ       32
+
+/* Egress of a packet other than a port # */
+#define FE_PIPELINE_FLOOD       -1
+#define FE_PIPELINE_DROP        -2
+/* Ports of a multicast group in the slot of the replication table */
+#define FE_PIPELINE_MCAST(slot)         (-3 - (slot))
+#define FE_PIPELINE_IS_MCAST(out)       ((out) <= -3)
+#define FE_PIPELINE_MCAST_SLOT(out)     (-3 - (out))
+
+/*
+ * Stages.  A chain runs the filter, NAT, learning, tunnel, and lookup stages
+ * in this order, and always ends with Tx.
+ */
+#define FE_STAGE_FILTER         (1 << 0)    /* Run the packet filter */
+#define FE_STAGE_LEARN          (1 << 1)    /* Learn the source address */
+#define FE_STAGE_L2             (1 << 2)    /* Lookup the destination */
+#define FE_STAGE_NAT            (1 << 3)    /* Translate the addresses */
+#define FE_STAGE_TUNNEL         (1 << 4)    /* Encapsulate/decapsulate */
+
+/*
+ * Chains specialised at build time: FE_PIPELINE_CHAIN(id, stages).  Each
+ * chain is expanded into a straight-line sequence of the stages, and the
+ * chain of a vector is selected once per vector, not per packet.
+ */
+#define FE_PIPELINE_CHAINS                                              \
+    FE_PIPELINE_CHAIN(PIX_FE_CHAIN_BRIDGE, FE_STAGE_LEARN | FE_STAGE_L2) \
+    FE_PIPELINE_CHAIN(PIX_FE_CHAIN_STATIC, FE_STAGE_L2)                 \
+    FE_PIPELINE_CHAIN(PIX_FE_CHAIN_HUB, 0)                              \
+    FE_PIPELINE_CHAIN(PIX_FE_CHAIN_FILTER,                              \
+                      FE_STAGE_FILTER | FE_STAGE_LEARN | FE_STAGE_L2)    \
+    FE_PIPELINE_CHAIN(PIX_FE_CHAIN_NAT,                                 \
+                      FE_STAGE_NAT | FE_STAGE_LEARN | FE_STAGE_L2)      \
+    FE_PIPELINE_CHAIN(PIX_FE_CHAIN_TUNNEL,                              \
+                      FE_STAGE_LEARN | FE_STAGE_TUNNEL | FE_STAGE_L2)
+
+/*
+ * Vector of packets received from a port, and the metadata set by the stages
+ */
+struct fe_pipeline_vec {
+    /* Ingress port, and the logical port (link aggregation group) of it */
+    int port;
+    int lport;
+    /* # of packets */
+    int n;
+    struct fe_pkt_buf_hdr *hdrs[FE_PIPELINE_VECSZ];
+    void *pkts[FE_PIPELINE_VECSZ];
+    int lens[FE_PIPELINE_VECSZ];
+    /* Egress port, FE_PIPELINE_FLOOD, FE_PIPELINE_DROP, or
+       FE_PIPELINE_MCAST() */
+    int out[FE_PIPELINE_VECSZ];
+};
+
+/*
+ * Pipeline (copy of the configuration per task)
+ */
+struct fe_pipeline {
+    uint64_t gen;
+    /* Chain per ingress port */
+    int chains[PIX_FE_STATS_MAX_PORTS];
+};
+
+/*
+ * Append a packet to a vector
+ */
+static __inline__ void
+fe_pipeline_vec_add(struct fe_pipeline_vec *v, struct fe_pkt_buf_hdr *hdr,
+                    void *pkt, int len)
+{
+    v->hdrs[v->n] = hdr;
+    v->pkts[v->n] = pkt;
+    v->lens[v->n] = len;
+    v->out[v->n] = FE_PIPELINE_FLOOD;
+    v->n++;
+}
+
+#endif /* _PIPELINE_H */
+
+/*
+ * Local variables:
+ * tab-width: 4
+ * c-basic-offset: 4
+ * End:
+ * vim600: sw=4 ts=4 fdm=marker
+ * vim<600: sw=4 ts=4
+ */
@@ -0,0 +1,205 @@
+/*_
+ * Copyright (c) 2017 Hirochika Asai <asai@jar.jp>
+ * All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef _PKTGEN_H
+#define _PKTGEN_H
+
+#include <stdint.h>
+#include <string.h>
+#include <sys/endian.h>
+#include <sys/net/ethernet.h>
+#include <sys/net/ip.h>
+#include <sys/net/udp.h>
+#include "offload.h"
+
+#define FE_PKTGEN_MAGIC         0x70697867
+#define FE_PKTGEN_UDP_PORT      9
+#define FE_PKTGEN_MINLEN        (ETHER_MIN_LEN - ETHER_CRC_LEN)
+#define FE_PKTGEN_MAXLEN        (ETHER_MAX_LEN - ETHER_CRC_LEN)
+#define FE_PKTGEN_HDRLEN                                        \
+    (sizeof(struct ether_header) + sizeof(struct ip) + sizeof(struct udphdr))
+
+/* Max # of frames generated at once */
+#define FE_PKTGEN_BURST         32
+
+/*
+ * Payload of a generated frame
+ */
+struct fe_pktgen_payload {
+    uint32_t magic;
+    uint32_t seq;
+    uint64_t tsc;
+} __attribute__ ((packed));
+
+/*
+ * Packet generator (copy of the configuration and the state per task)
+ */
+struct fe_pktgen {
+    uint64_t gen;
+    /* Ports */
+    uint64_t txports;
+    uint64_t rxports;
+    int next_port;
+    /* Frame size */
+    int size;
+    /* Interval in cycles (0 for as fast as possible) */
+    uint64_t interval;
+    uint64_t next_tsc;
+    /* Sequence number */
+    uint64_t seq;
+    /* Addresses in host byte order */
+    uint64_t smac;
+    uint64_t dmac;
+    uint32_t smac_range;
+    uint32_t dmac_range;
+    uint32_t sip;
+    uint32_t dip;
+    uint32_t sip_range;
+    uint32_t dip_range;
+};
+
+/*
+ * Write a MAC address in host byte order to an Ethernet header field
+ */
+static __inline__ void
+fe_pktgen_write_mac(uint8_t *dst, uint64_t mac)
+{
+    int i;
+
+    for ( i = ETHER_ADDR_LEN - 1; i >= 0; i-- ) {
+        dst[i] = mac & 0xff;
+        mac >>= 8;
+    }
+}
+
+/*
+ * Build a UDP/IPv4 frame stamped with the time stamp counter.  The IPv4
+ * checksum is left to the Tx offload.
+ */
+static __inline__ void
+fe_pktgen_build(struct fe_pktgen *pg, void *pkt, uint64_t tsc,
+                struct fe_offload *ol)
+{
+    struct ether_header *eth;
+    struct ip *ip;
+    struct udphdr *udp;
+    struct fe_pktgen_payload *pl;
+    int len;
+
+    eth = (struct ether_header *)pkt;
+    ip = (struct ip *)(eth + 1);
+    udp = (struct udphdr *)(ip + 1);
+    pl = (struct fe_pktgen_payload *)(udp + 1);
+
+    /* Ethernet */
+    fe_pktgen_write_mac(eth->ether_dhost, pg->dmac + pg->seq % pg->dmac_range);
+    fe_pktgen_write_mac(eth->ether_shost, pg->smac + pg->seq % pg->smac_range);
+    eth->ether_type = htons(ETHERTYPE_IP);
+
+    /* IPv4 */
+    len = pg->size - sizeof(struct ether_header);
+    ip->ip_v = IPVERSION;
+    ip->ip_hl = sizeof(struct ip) >> 2;
+    ip->ip_tos = 0;
+    ip->ip_len = htons(len);
+    ip->ip_id = htons(pg->seq & 0xffff);
+    ip->ip_off = 0;
+    ip->ip_ttl = IP_DEFAULT_TTL;
+    ip->ip_p = IPPROTO_UDP;
+    ip->ip_sum = 0;
+    ip->ip_src = htonl(pg->sip + pg->seq % pg->sip_range);
+    ip->ip_dst = htonl(pg->dip + pg->seq % pg->dip_range);
+
+    /* UDP (without checksum) */
+    len -= sizeof(struct ip);
+    udp->uh_sport = htons(FE_PKTGEN_UDP_PORT);
+    udp->uh_dport = htons(FE_PKTGEN_UDP_PORT);
+    udp->uh_ulen = htons(len);
+    udp->uh_sum = 0;
+
+    /* Payload */
+    pl->magic = htonl(FE_PKTGEN_MAGIC);
+    pl->seq = pg->seq;
+    pl->tsc = tsc;
+    memset(pl + 1, 0, pg->size - FE_PKTGEN_HDRLEN
+           - sizeof(struct fe_pktgen_payload));
+
+    fe_offload_tx_request(ol, pkt, pg->size, FE_OFFLOAD_TX_IPCS);
+}
+
+/*
+ * Check if the frame is generated by the packet generator, and get the time
+ * stamp counter if so
+ */
+static __inline__ int
+fe_pktgen_parse(void *pkt, int len, uint64_t *tsc)
+{
+    struct ether_header *eth;
+    struct ip *ip;
+    struct udphdr *udp;
+    struct fe_pktgen_payload *pl;
+
+    if ( len < (int)(FE_PKTGEN_HDRLEN + sizeof(struct fe_pktgen_payload)) ) {
+        return 0;
+    }
+    eth = (struct ether_header *)pkt;
+    ip = (struct ip *)(eth + 1);
+    udp = (struct udphdr *)(ip + 1);
+    pl = (struct fe_pktgen_payload *)(udp + 1);
+    if ( eth->ether_type != htons(ETHERTYPE_IP)
+         || ip->ip_hl != sizeof(struct ip) >> 2 || ip->ip_p != IPPROTO_UDP
+         || udp->uh_dport != htons(FE_PKTGEN_UDP_PORT)
+         || pl->magic != htonl(FE_PKTGEN_MAGIC) ) {
+        return 0;
+    }
+    *tsc = pl->tsc;
+
+    return 1;
+}
+
+/*
+ * Histogram bin of the latency
+ */
+static __inline__ int
+fe_pktgen_hist_bin(uint64_t cycles, int nbins)
+{
+    int bin;
+
+    bin = 63 - __builtin_clzll(cycles | 1);
+    if ( bin >= nbins ) {
+        bin = nbins - 1;
+    }
+
+    return bin;
+}
+
+#endif /* _PKTGEN_H */
+
+/*
+ * Local variables:
+ * tab-width: 4
+ * c-basic-offset: 4
+ * End:
+ * vim600: sw=4 ts=4 fdm=marker
+ * vim<600: sw=4 ts=4
+ */
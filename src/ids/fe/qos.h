@@ -0,0 +1,447 @@
+/*_
+ * Copyright (c) 2017 Hirochika Asai <asai@jar.jp>
+ * All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#ifndef _QOS_H
+#define _QOS_H
+
+/*
+ * Hierarchical QoS scheduler of a Tx port: port -> class -> queue.  Classes
+ * are served by strict priority (lower index first) or by DRR with weights
+ * among the non-strict ones, and the queues of a class (selected by the flow
+ * hash) by DRR.  The port and each class are shaped by token buckets clocked
+ * by the time stamp counter.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+struct fe_pkt_buf_hdr;
+
+#define FE_QOS_NCLASSES         4
+#define FE_QOS_NQUEUES          4       /* Per class (power of two) */
+#define FE_QOS_QLEN             64      /* Per queue (power of two) */
+/* DRR quantum in bytes per weight */
+#define FE_QOS_QUANTUM          2048
+/* Max # of rounds for DRR to find a packet (a jumbo frame needs 6) */
+#define FE_QOS_DRR_ROUNDS       8
+/* Min bucket size in bytes (must hold a jumbo frame) */
+#define FE_QOS_MIN_BURST        16384
+#define FE_QOS_MAX_BURST        (1 << 24)
+/* Bucket size used if not specified */
+#define FE_QOS_DEFAULT_BURST    65536
+/* Tokens are in bytes in 32.32 fixed point */
+#define FE_QOS_TB_SHIFT         32
+
+/*
+ * Token bucket
+ */
+struct fe_qos_tb {
+    /* Bytes per cycle in fixed point, or 0 for unlimited */
+    uint64_t rate;
+    /* Bucket size and tokens in fixed point */
+    uint64_t burst;
+    uint64_t tokens;
+    /* Cycles to fill the bucket from empty */
+    uint64_t fill;
+    /* Time stamp counter at the last refill */
+    uint64_t last;
+};
+
+/*
+ * Packet queued
+ */
+struct fe_qos_pkt {
+    struct fe_pkt_buf_hdr *hdr;
+    void *pkt;
+    int len;
+    /* Time stamp counter when enqueued */
+    uint64_t tsc;
+};
+
+/*
+ * Queue (ring buffer with free-running indices)
+ */
+struct fe_qos_queue {
+    uint32_t head;
+    uint32_t tail;
+    int deficit;
+    struct fe_qos_pkt pkts[FE_QOS_QLEN];
+};
+
+/*
+ * Class
+ */
+struct fe_qos_class {
+    /* Strict priority or DRR */
+    int strict;
+    /* DRR quantum (weight * FE_QOS_QUANTUM) and deficit */
+    int quantum;
+    int deficit;
+    /* Queue in service */
+    int cur;
+    /* # of packets queued */
+    int backlog;
+    /* Shaper */
+    struct fe_qos_tb tb;
+    struct fe_qos_queue queues[FE_QOS_NQUEUES];
+};
+
+/*
+ * Scheduler of a port
+ */
+struct fe_qos_sched {
+    /* # of packets queued */
+    int backlog;
+    /* DRR class in service */
+    int cur;
+    /* Shaper */
+    struct fe_qos_tb tb;
+    struct fe_qos_class classes[FE_QOS_NCLASSES];
+};
+
+/*
+ * Classification: class per 802.1p priority and per DSCP
+ */
+struct fe_qos_map {
+    uint8_t pcp[8];
+    uint8_t dscp[64];
+};
+
+/*
+ * Configure a token bucket with the rate in bits per second and the bucket
+ * size in bytes.  The bucket starts full.
+ */
+static __inline__ void
+fe_qos_tb_set(struct fe_qos_tb *tb, uint64_t bps, uint64_t burst,
+              uint64_t hz, uint64_t now)
+{
+    uint64_t bytes;
+
+    if ( 0 == bps || 0 == hz ) {
+        tb->rate = 0;
+        return;
+    }
+    if ( burst < FE_QOS_MIN_BURST ) {
+        burst = FE_QOS_MIN_BURST;
+    } else if ( burst > FE_QOS_MAX_BURST ) {
+        burst = FE_QOS_MAX_BURST;
+    }
+
+    /* Bytes per cycle without overflowing 64 bits */
+    bytes = bps / 8;
+    tb->rate = ((bytes / hz) << FE_QOS_TB_SHIFT)
+        + ((bytes % hz) << FE_QOS_TB_SHIFT) / hz;
+    if ( 0 == tb->rate ) {
+        tb->rate = 1;
+    }
+    tb->burst = burst << FE_QOS_TB_SHIFT;
+    tb->tokens = tb->burst;
+    tb->fill = tb->burst / tb->rate + 1;
+    tb->last = now;
+}
+
+/*
+ * Add the tokens accumulated since the last refill
+ */
+static __inline__ void
+fe_qos_tb_refill(struct fe_qos_tb *tb, uint64_t now)
+{
+    uint64_t elapsed;
+
+    if ( 0 == tb->rate ) {
+        return;
+    }
+    elapsed = now - tb->last;
+    if ( elapsed > tb->fill ) {
+        /* Not to overflow */
+        elapsed = tb->fill;
+    }
+    tb->tokens += elapsed * tb->rate;
+    if ( tb->tokens > tb->burst ) {
+        tb->tokens = tb->burst;
+    }
+    tb->last = now;
+}
+
+/*
+ * Check if a packet conforms to the rate
+ */
+static __inline__ int
+fe_qos_tb_conform(struct fe_qos_tb *tb, int len)
+{
+    return 0 == tb->rate || tb->tokens >= ((uint64_t)len << FE_QOS_TB_SHIFT);
+}
+
+/*
+ * Consume the tokens of a packet
+ */
+static __inline__ void
+fe_qos_tb_consume(struct fe_qos_tb *tb, int len)
+{
+    if ( 0 != tb->rate ) {
+        tb->tokens -= (uint64_t)len << FE_QOS_TB_SHIFT;
+    }
+}
+
+/*
+ * Default classification: network control and expedited forwarding to the
+ * class 0, video/voice to 1, best effort to 2, and background to 3
+ */
+static __inline__ void
+fe_qos_map_default(struct fe_qos_map *map)
+{
+    static const uint8_t pcp[8] = { 2, 3, 3, 2, 1, 1, 0, 0 };
+    int i;
+
+    memcpy(map->pcp, pcp, sizeof(pcp));
+    for ( i = 0; i < 64; i++ ) {
+        /* Class selector (the precedence) */
+        map->dscp[i] = pcp[i >> 3];
+    }
+    /* EF */
+    map->dscp[46] = 0;
+}
+
+/*
+ * Classify a packet by the 802.1p priority if tagged, or by DSCP otherwise,
+ * and compute the flow hash to select a queue
+ */
+static __inline__ int
+fe_qos_classify(const struct fe_qos_map *map, const uint8_t *pkt, int len,
+                uint32_t *hash)
+{
+    uint16_t type;
+    uint32_t h;
+    int cls;
+    int off;
+    int i;
+
+    /* Source MAC address */
+    h = 0;
+    if ( len >= 14 ) {
+        h = ((uint32_t)pkt[8] << 24) | ((uint32_t)pkt[9] << 16)
+            | ((uint32_t)pkt[10] << 8) | pkt[11];
+    }
+    cls = map->pcp[0];
+    type = len >= 14 ? ((uint16_t)pkt[12] << 8) | pkt[13] : 0;
+    off = 14;
+    if ( 0x8100 == type && len >= 18 ) {
+        /* 802.1Q */
+        cls = map->pcp[pkt[14] >> 5];
+        type = ((uint16_t)pkt[16] << 8) | pkt[17];
+        off = 18;
+    } else if ( 0x0800 == type && len >= off + 20 ) {
+        cls = map->dscp[pkt[off + 1] >> 2];
+    } else if ( 0x86dd == type && len >= off + 40 ) {
+        cls = map->dscp[((pkt[off] & 0xf) << 2) | (pkt[off + 1] >> 6)];
+    }
+
+    /* Addresses */
+    if ( 0x0800 == type && len >= off + 20 ) {
+        h = 0;
+        for ( i = 12; i < 20; i++ ) {
+            h = (h << 8 | h >> 24) ^ pkt[off + i];
+        }
+    } else if ( 0x86dd == type && len >= off + 40 ) {
+        h = 0;
+        for ( i = 8; i < 40; i++ ) {
+            h = (h << 8 | h >> 24) ^ pkt[off + i];
+        }
+    }
+    *hash = h ^ (h >> 16);
+
+    return cls & (FE_QOS_NCLASSES - 1);
+}
+
+/*
+ * Enqueue a packet to a class.  Returns 0 on success, or -1 if the queue is
+ * full.
+ */
+static __inline__ int
+fe_qos_enqueue(struct fe_qos_sched *s, int cls, uint32_t hash,
+               struct fe_pkt_buf_hdr *hdr, void *pkt, int len, uint64_t now)
+{
+    struct fe_qos_class *c;
+    struct fe_qos_queue *q;
+    struct fe_qos_pkt *p;
+
+    c = &s->classes[cls];
+    q = &c->queues[hash & (FE_QOS_NQUEUES - 1)];
+    if ( q->tail - q->head >= FE_QOS_QLEN ) {
+        return -1;
+    }
+    p = &q->pkts[q->tail & (FE_QOS_QLEN - 1)];
+    p->hdr = hdr;
+    p->pkt = pkt;
+    p->len = len;
+    p->tsc = now;
+    q->tail++;
+    c->backlog++;
+    s->backlog++;
+
+    return 0;
+}
+
+/*
+ * Select the queue of a class to serve next by DRR
+ */
+static __inline__ struct fe_qos_pkt *
+fe_qos_class_peek(struct fe_qos_class *c)
+{
+    struct fe_qos_queue *q;
+    struct fe_qos_pkt *p;
+    int i;
+
+    for ( i = 0; i < FE_QOS_DRR_ROUNDS * FE_QOS_NQUEUES; i++ ) {
+        q = &c->queues[c->cur];
+        if ( q->head != q->tail ) {
+            p = &q->pkts[q->head & (FE_QOS_QLEN - 1)];
+            if ( q->deficit >= p->len ) {
+                return p;
+            }
+        } else {
+            q->deficit = 0;
+        }
+        /* Next queue */
+        c->cur = (c->cur + 1) & (FE_QOS_NQUEUES - 1);
+        q = &c->queues[c->cur];
+        if ( q->head != q->tail ) {
+            q->deficit += FE_QOS_QUANTUM;
+        }
+    }
+
+    return NULL;
+}
+
+/*
+ * Select the packet to transmit next, or NULL if nothing conforms to the
+ * shapers.  The packet stays queued until fe_qos_commit() is called.
+ */
+static __inline__ struct fe_qos_pkt *
+fe_qos_peek(struct fe_qos_sched *s, int *cls)
+{
+    struct fe_qos_class *c;
+    struct fe_qos_pkt *p;
+    int i;
+
+    if ( s->backlog <= 0 ) {
+        return NULL;
+    }
+
+    /* Strict priority */
+    for ( i = 0; i < FE_QOS_NCLASSES; i++ ) {
+        c = &s->classes[i];
+        if ( !c->strict || c->backlog <= 0 ) {
+            continue;
+        }
+        p = fe_qos_class_peek(c);
+        if ( NULL != p && fe_qos_tb_conform(&c->tb, p->len) ) {
+            if ( !fe_qos_tb_conform(&s->tb, p->len) ) {
+                /* Port rate exceeded */
+                return NULL;
+            }
+            *cls = i;
+            return p;
+        }
+    }
+
+    /* DRR among the other classes; shaped classes are skipped without
+       accumulating the deficit */
+    for ( i = 0; i < FE_QOS_DRR_ROUNDS * FE_QOS_NCLASSES; i++ ) {
+        c = &s->classes[s->cur];
+        if ( !c->strict && c->backlog > 0 ) {
+            p = fe_qos_class_peek(c);
+            if ( NULL != p && fe_qos_tb_conform(&c->tb, p->len)
+                 && c->deficit >= p->len ) {
+                if ( !fe_qos_tb_conform(&s->tb, p->len) ) {
+                    return NULL;
+                }
+                *cls = s->cur;
+                return p;
+            }
+        } else {
+            c->deficit = 0;
+        }
+        /* Next class */
+        s->cur = (s->cur + 1) & (FE_QOS_NCLASSES - 1);
+        c = &s->classes[s->cur];
+        if ( !c->strict && c->backlog > 0 ) {
+            p = fe_qos_class_peek(c);
+            if ( NULL != p && fe_qos_tb_conform(&c->tb, p->len) ) {
+                c->deficit += c->quantum;
+            }
+        }
+    }
+
+    return NULL;
+}
+
+/*
+ * Dequeue the packet selected by fe_qos_peek(), and charge it
+ */
+static __inline__ void
+fe_qos_commit(struct fe_qos_sched *s, int cls)
+{
+    struct fe_qos_class *c;
+    struct fe_qos_queue *q;
+    struct fe_qos_pkt *p;
+
+    c = &s->classes[cls];
+    q = &c->queues[c->cur];
+    p = &q->pkts[q->head & (FE_QOS_QLEN - 1)];
+    q->deficit -= p->len;
+    if ( !c->strict ) {
+        c->deficit -= p->len;
+    }
+    fe_qos_tb_consume(&c->tb, p->len);
+    fe_qos_tb_consume(&s->tb, p->len);
+    q->head++;
+    c->backlog--;
+    s->backlog--;
+}
+
+/*
+ * Refill the token buckets of a port and its classes
+ */
+static __inline__ void
+fe_qos_refill(struct fe_qos_sched *s, uint64_t now)
+{
+    int i;
+
+    fe_qos_tb_refill(&s->tb, now);
+    for ( i = 0; i < FE_QOS_NCLASSES; i++ ) {
+        fe_qos_tb_refill(&s->classes[i].tb, now);
+    }
+}
+
+#endif /* _QOS_H */
+
+/*
+ * Local variables:
+ * tab-width: 4
+ * c-basic-offset: 4
+ * End:
+ * vim600: sw=4 ts=4 fdm=marker
+ * vim<600: sw=4 ts=4
+ */
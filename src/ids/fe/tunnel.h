@@ -0,0 +1,535 @@
+/*_
+ * Copyright (c) 2017 Hirochika Asai <asai@jar.jp>
+ * All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#ifndef _TUNNEL_H
+#define _TUNNEL_H
+
+/*
+ * VXLAN (RFC 7348) and NVGRE (RFC 7637) tunnel endpoint.  Each VNI is bridged
+ * to an access port (and a VLAN of it); the frames received on the access
+ * port are encapsulated to the remote VTEP that the destination address was
+ * learned from, or replicated to all the remote VTEPs of the VNI if unknown.
+ * The outer headers are written into the headroom of the buffer in front of
+ * the frame, and stripped by moving the start of the frame, so that the
+ * payload is never copied except for the replicas.  The outer headers are
+ * built from a template per remote VTEP; the UDP source port (VXLAN) or the
+ * FlowID (NVGRE) is taken from the flow hash of the inner frame for the ECMP
+ * of the underlay.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+/* Types (same as PIX_FE_TUNNEL_*) */
+#define FE_TUNNEL_NONE          0
+#define FE_TUNNEL_VXLAN         1
+#define FE_TUNNEL_GRE           2
+
+/* Max # of VNIs and remote VTEPs (same as PIX_FE_TUNNEL_MAX_*) */
+#define FE_TUNNEL_MAX_VNIS      64
+#define FE_TUNNEL_MAX_VTEPS     64
+/* Slots of the hash tables of the VNIs and the VTEP addresses */
+#define FE_TUNNEL_SLOTS_BITS    8
+#define FE_TUNNEL_SLOTS         (1 << FE_TUNNEL_SLOTS_BITS)
+/* Access ports, including the logical ports of link aggregation */
+#define FE_TUNNEL_NPORTS        128
+
+/* Outer headers: Ethernet, IPv4, and UDP + VXLAN or GRE with the key */
+#define FE_TUNNEL_VXLAN_HDRLEN  (14 + 20 + 8 + 8)
+#define FE_TUNNEL_GRE_HDRLEN    (14 + 20 + 8)
+#define FE_TUNNEL_HDRLEN_MAX    FE_TUNNEL_VXLAN_HDRLEN
+#define FE_TUNNEL_VXLAN_PORT    4789
+#define FE_TUNNEL_TTL           64
+/* UDP source ports of the flows (the dynamic ports) */
+#define FE_TUNNEL_SPORT_BASE    0xc000
+#define FE_TUNNEL_SPORT_MASK    0x3fff
+
+/* Results of fe_tunnel_decap() */
+#define FE_TUNNEL_PASS          0       /* Not to this VTEP */
+#define FE_TUNNEL_DECAP         1       /* Decapsulated */
+#define FE_TUNNEL_ARP           2       /* ARP reply built in place */
+#define FE_TUNNEL_BAD           -1      /* Unknown VNI or VTEP, malformed */
+
+/*
+ * VNI bridged to an access port
+ */
+struct fe_tunnel_vni {
+    uint32_t vni;
+    /* Access port and the VLAN ID on it (0 for untagged) */
+    int port;
+    int vlan;
+    /* Remote VTEPs of the VNI (bitmap of the indices) */
+    uint64_t vteps;
+    /* Next VNI on the same access port, or -1 */
+    int next;
+};
+
+/*
+ * Remote VTEP
+ */
+struct fe_tunnel_vtep {
+    /* IPv4 address in host byte order */
+    uint32_t addr;
+    /* Sum of the 16-bit words of the outer IPv4 header except the length */
+    uint32_t sum;
+    /* Template of the outer headers */
+    uint8_t hdr[FE_TUNNEL_HDRLEN_MAX];
+};
+
+/*
+ * Tunnel endpoint (copy of the configuration per task)
+ */
+struct fe_tunnel {
+    int type;
+    /* Length of the outer headers */
+    int hdrlen;
+    /* Port (or logical port) to the underlay */
+    int uplink;
+    /* Local VTEP: IPv4 address in host byte order, and the MAC address */
+    uint32_t addr;
+    uint8_t mac[6];
+    /* UDP destination port (VXLAN) */
+    uint16_t dport;
+    int nvnis;
+    struct fe_tunnel_vni vnis[FE_TUNNEL_MAX_VNIS];
+    int nvteps;
+    struct fe_tunnel_vtep vteps[FE_TUNNEL_MAX_VTEPS];
+    /* First VNI of each access port, or -1 */
+    int8_t ports[FE_TUNNEL_NPORTS];
+    /* Index + 1 of the VNIs and the VTEPs by the hash, or 0 */
+    uint8_t vni_slots[FE_TUNNEL_SLOTS];
+    uint8_t vtep_slots[FE_TUNNEL_SLOTS];
+};
+
+static __inline__ uint32_t
+_tunnel_rd32(const uint8_t *p)
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16)
+        | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static __inline__ void
+_tunnel_wr16(uint8_t *p, uint16_t v)
+{
+    p[0] = v >> 8;
+    p[1] = v;
+}
+
+static __inline__ void
+_tunnel_wr32(uint8_t *p, uint32_t v)
+{
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+}
+
+static __inline__ int
+_tunnel_slot(uint32_t key)
+{
+    return (key * 0x9e3779b1) >> (32 - FE_TUNNEL_SLOTS_BITS);
+}
+
+/*
+ * Find the index of a VNI or a VTEP address in a hash table, or -1
+ */
+static __inline__ int
+_tunnel_find(const uint8_t *slots, const void *ents, size_t size,
+             uint32_t key)
+{
+    int i;
+    int n;
+    int idx;
+
+    i = _tunnel_slot(key);
+    for ( n = 0; n < FE_TUNNEL_SLOTS; n++ ) {
+        idx = slots[i] - 1;
+        if ( idx < 0 ) {
+            break;
+        }
+        /* The key is the first member of the entries */
+        if ( *(const uint32_t *)((const uint8_t *)ents + size * idx)
+             == key ) {
+            return idx;
+        }
+        i = (i + 1) & (FE_TUNNEL_SLOTS - 1);
+    }
+
+    return -1;
+}
+
+static __inline__ void
+_tunnel_slot_add(uint8_t *slots, uint32_t key, int idx)
+{
+    int i;
+
+    i = _tunnel_slot(key);
+    while ( 0 != slots[i] ) {
+        i = (i + 1) & (FE_TUNNEL_SLOTS - 1);
+    }
+    slots[i] = idx + 1;
+}
+
+static __inline__ int
+fe_tunnel_find_vni(const struct fe_tunnel *tun, uint32_t vni)
+{
+    return _tunnel_find(tun->vni_slots, tun->vnis,
+                        sizeof(struct fe_tunnel_vni), vni);
+}
+
+static __inline__ int
+fe_tunnel_find_vtep(const struct fe_tunnel *tun, uint32_t addr)
+{
+    return _tunnel_find(tun->vtep_slots, tun->vteps,
+                        sizeof(struct fe_tunnel_vtep), addr);
+}
+
+/*
+ * Initialize a tunnel endpoint without any VNI nor VTEP.  An unknown type
+ * disables the endpoint.
+ */
+static __inline__ void
+fe_tunnel_init(struct fe_tunnel *tun, int type, int uplink, uint32_t addr,
+               const uint8_t *mac, uint16_t dport)
+{
+    memset(tun, 0, sizeof(struct fe_tunnel));
+    switch ( type ) {
+    case FE_TUNNEL_VXLAN:
+        tun->hdrlen = FE_TUNNEL_VXLAN_HDRLEN;
+        break;
+    case FE_TUNNEL_GRE:
+        tun->hdrlen = FE_TUNNEL_GRE_HDRLEN;
+        break;
+    default:
+        type = FE_TUNNEL_NONE;
+    }
+    tun->type = type;
+    tun->uplink = uplink;
+    tun->addr = addr;
+    memcpy(tun->mac, mac, 6);
+    tun->dport = dport ? dport : FE_TUNNEL_VXLAN_PORT;
+    memset(tun->ports, -1, sizeof(tun->ports));
+}
+
+/*
+ * Add a remote VTEP reached through a next hop.  Returns the index, or -1.
+ */
+static __inline__ int
+fe_tunnel_add_vtep(struct fe_tunnel *tun, uint32_t addr,
+                   const uint8_t *nexthop)
+{
+    struct fe_tunnel_vtep *vt;
+    uint8_t *ip;
+    uint32_t sum;
+    int idx;
+    int i;
+
+    if ( 0 == addr || fe_tunnel_find_vtep(tun, addr) >= 0
+         || tun->nvteps >= FE_TUNNEL_MAX_VTEPS ) {
+        return -1;
+    }
+    idx = tun->nvteps;
+    vt = &tun->vteps[idx];
+    vt->addr = addr;
+
+    /* Ethernet */
+    memset(vt->hdr, 0, sizeof(vt->hdr));
+    memcpy(vt->hdr, nexthop, 6);
+    memcpy(vt->hdr + 6, tun->mac, 6);
+    _tunnel_wr16(vt->hdr + 12, 0x0800);
+    /* IPv4 without the length and the checksum; DF set */
+    ip = vt->hdr + 14;
+    ip[0] = 0x45;
+    _tunnel_wr16(ip + 6, 0x4000);
+    ip[8] = FE_TUNNEL_TTL;
+    ip[9] = FE_TUNNEL_VXLAN == tun->type ? 17 : 47;
+    _tunnel_wr32(ip + 12, tun->addr);
+    _tunnel_wr32(ip + 16, addr);
+    sum = 0;
+    for ( i = 0; i < 20; i += 2 ) {
+        sum += ((uint32_t)ip[i] << 8) | ip[i + 1];
+    }
+    vt->sum = sum;
+    if ( FE_TUNNEL_VXLAN == tun->type ) {
+        /* UDP without the source port and the length, and the checksum 0 */
+        _tunnel_wr16(ip + 22, tun->dport);
+        /* VXLAN with the I flag */
+        ip[28] = 0x08;
+    } else {
+        /* GRE with the K flag, transparent Ethernet bridging */
+        _tunnel_wr16(ip + 20, 0x2000);
+        _tunnel_wr16(ip + 22, 0x6558);
+    }
+
+    _tunnel_slot_add(tun->vtep_slots, addr, idx);
+    tun->nvteps++;
+
+    return idx;
+}
+
+/*
+ * Bridge a VNI to an access port (and a VLAN of it).  Returns the index, or
+ * -1.
+ */
+static __inline__ int
+fe_tunnel_add_vni(struct fe_tunnel *tun, uint32_t vni, int port, int vlan,
+                  uint64_t vteps)
+{
+    struct fe_tunnel_vni *v;
+    int idx;
+    int k;
+
+    if ( vni > 0xffffff || port < 0 || port >= FE_TUNNEL_NPORTS
+         || port == tun->uplink || vlan < 0 || vlan > 4094
+         || fe_tunnel_find_vni(tun, vni) >= 0
+         || tun->nvnis >= FE_TUNNEL_MAX_VNIS ) {
+        return -1;
+    }
+    for ( k = tun->ports[port]; k >= 0; k = tun->vnis[k].next ) {
+        if ( tun->vnis[k].vlan == vlan ) {
+            /* Already bridged to another VNI */
+            return -1;
+        }
+    }
+    if ( tun->nvteps < FE_TUNNEL_MAX_VTEPS ) {
+        vteps &= (1ULL << tun->nvteps) - 1;
+    }
+    idx = tun->nvnis;
+    v = &tun->vnis[idx];
+    v->vni = vni;
+    v->port = port;
+    v->vlan = vlan;
+    v->vteps = vteps;
+    v->next = tun->ports[port];
+    tun->ports[port] = idx;
+    _tunnel_slot_add(tun->vni_slots, vni, idx);
+    tun->nvnis++;
+
+    return idx;
+}
+
+/*
+ * Key of the remote VTEP database: the MAC address and the index of the VNI
+ */
+static __inline__ void
+fe_tunnel_fdb_key(uint8_t *key, const uint8_t *mac, int k)
+{
+    memcpy(key, mac, 6);
+    key[6] = k;
+    key[7] = 0;
+}
+
+/*
+ * Reply to an ARP request for the local VTEP address in place
+ */
+static __inline__ int
+_tunnel_arp(const struct fe_tunnel *tun, uint8_t *p, int len)
+{
+    if ( len < 42 || 0x0001 != (((int)p[14] << 8) | p[15])
+         || 0x0800 != (((int)p[16] << 8) | p[17]) || 6 != p[18]
+         || 4 != p[19] || 0x0001 != (((int)p[20] << 8) | p[21])
+         || _tunnel_rd32(p + 38) != tun->addr ) {
+        return FE_TUNNEL_PASS;
+    }
+    /* Ethernet */
+    memcpy(p, p + 6, 6);
+    memcpy(p + 6, tun->mac, 6);
+    /* Reply; the sender becomes the target */
+    p[21] = 2;
+    memcpy(p + 32, p + 22, 10);
+    memcpy(p + 22, tun->mac, 6);
+    _tunnel_wr32(p + 28, tun->addr);
+
+    return FE_TUNNEL_ARP;
+}
+
+/*
+ * Decapsulate a packet received from the underlay, by moving the start of the
+ * frame past the outer headers (and inserting the VLAN tag of the access port
+ * in front of the inner frame).  The index of the VNI and the remote VTEP are
+ * returned for learning.  The packets from a VTEP not of the VNI are rejected.
+ */
+static __inline__ int
+fe_tunnel_decap(const struct fe_tunnel *tun, uint8_t **pkt, int *len,
+                int *vni, int *vtep)
+{
+    const struct fe_tunnel_vni *v;
+    uint8_t *p;
+    uint16_t type;
+    uint32_t id;
+    int iplen;
+    int off;
+    int k;
+    int n;
+
+    p = *pkt;
+    if ( *len < 14 ) {
+        return FE_TUNNEL_PASS;
+    }
+    type = ((uint16_t)p[12] << 8) | p[13];
+    if ( 0x0806 == type ) {
+        return _tunnel_arp(tun, p, *len);
+    }
+    if ( 0x0800 != type || *len < 34 || _tunnel_rd32(p + 30) != tun->addr ) {
+        return FE_TUNNEL_PASS;
+    }
+
+    /* Addressed to this VTEP; no options nor fragments, and an inner
+       Ethernet header */
+    iplen = ((int)p[16] << 8) | p[17];
+    if ( 0x45 != p[14] || ((p[20] & 0x3f) | p[21]) || 14 + iplen > *len ) {
+        return FE_TUNNEL_BAD;
+    }
+    if ( FE_TUNNEL_VXLAN == tun->type ) {
+        off = FE_TUNNEL_VXLAN_HDRLEN;
+        if ( 17 != p[23] || iplen < off
+             || (((uint16_t)p[36] << 8) | p[37]) != tun->dport
+             || !(p[42] & 0x08) ) {
+            return FE_TUNNEL_BAD;
+        }
+        id = ((uint32_t)p[46] << 16) | ((uint32_t)p[47] << 8) | p[48];
+    } else {
+        off = FE_TUNNEL_GRE_HDRLEN;
+        if ( 47 != p[23] || iplen < off || 0x20 != p[34]
+             || 0x00 != p[35] || 0x65 != p[36] || 0x58 != p[37] ) {
+            return FE_TUNNEL_BAD;
+        }
+        id = ((uint32_t)p[38] << 16) | ((uint32_t)p[39] << 8) | p[40];
+    }
+    k = fe_tunnel_find_vni(tun, id);
+    if ( k < 0 ) {
+        return FE_TUNNEL_BAD;
+    }
+    v = &tun->vnis[k];
+    *vtep = fe_tunnel_find_vtep(tun, _tunnel_rd32(p + 26));
+    if ( *vtep < 0 || !((v->vteps >> *vtep) & 1) ) {
+        return FE_TUNNEL_BAD;
+    }
+
+    /* Strip the outer headers (and the padding of the underlay) */
+    n = 14 + iplen - off;
+    p += off;
+    if ( v->vlan ) {
+        p -= 4;
+        memmove(p, p + 4, 12);
+        _tunnel_wr16(p + 12, 0x8100);
+        _tunnel_wr16(p + 14, v->vlan);
+        n += 4;
+    }
+    *pkt = p;
+    *len = n;
+    *vni = k;
+
+    return FE_TUNNEL_DECAP;
+}
+
+/*
+ * Find the VNI of a frame received on an access port, and strip the VLAN tag
+ * of the VNI.  Returns the index of the VNI, or -1 if not bridged.
+ */
+static __inline__ int
+fe_tunnel_access(const struct fe_tunnel *tun, int port, uint8_t **pkt,
+                 int *len)
+{
+    uint8_t *p;
+    int vlan;
+    int k;
+
+    if ( port >= FE_TUNNEL_NPORTS ) {
+        return -1;
+    }
+    k = tun->ports[port];
+    p = *pkt;
+    if ( k < 0 || *len < 14 ) {
+        return -1;
+    }
+    vlan = 0;
+    if ( 0x81 == p[12] && 0x00 == p[13] && *len >= 18 ) {
+        vlan = (((int)p[14] << 8) | p[15]) & 0xfff;
+    }
+    for ( ; k >= 0; k = tun->vnis[k].next ) {
+        if ( tun->vnis[k].vlan == vlan ) {
+            break;
+        }
+    }
+    if ( k >= 0 && vlan ) {
+        memmove(p + 4, p, 12);
+        *pkt = p + 4;
+        *len -= 4;
+    }
+
+    return k;
+}
+
+/*
+ * Encapsulate a frame of a VNI to a remote VTEP, by writing the outer headers
+ * in front of it.  The flow hash of the inner frame selects the UDP source
+ * port or the FlowID.
+ */
+static __inline__ void
+fe_tunnel_encap(const struct fe_tunnel *tun, int k, int vtep, uint8_t **pkt,
+                int *len, uint32_t hash)
+{
+    const struct fe_tunnel_vtep *vt;
+    uint8_t *p;
+    uint32_t vni;
+    uint32_t sum;
+    int iplen;
+
+    vt = &tun->vteps[vtep];
+    p = *pkt - tun->hdrlen;
+    memcpy(p, vt->hdr, tun->hdrlen);
+    iplen = *len + tun->hdrlen - 14;
+    _tunnel_wr16(p + 16, iplen);
+    sum = vt->sum + iplen;
+    sum = (sum & 0xffff) + (sum >> 16);
+    sum = (sum & 0xffff) + (sum >> 16);
+    _tunnel_wr16(p + 24, ~sum);
+    vni = tun->vnis[k].vni;
+    if ( FE_TUNNEL_VXLAN == tun->type ) {
+        _tunnel_wr16(p + 34, FE_TUNNEL_SPORT_BASE
+                     | (hash & FE_TUNNEL_SPORT_MASK));
+        _tunnel_wr16(p + 38, iplen - 20);
+        _tunnel_wr32(p + 45, vni);
+        p[49] = 0;
+    } else {
+        p[38] = vni >> 16;
+        p[39] = vni >> 8;
+        p[40] = vni;
+        p[41] = hash;
+    }
+    *pkt = p;
+    *len += tun->hdrlen;
+}
+
+#endif /* _TUNNEL_H */
+
+/*
+ * Local variables:
+ * tab-width: 4
+ * c-basic-offset: 4
+ * End:
+ * vim600: sw=4 ts=4 fdm=marker
+ * vim<600: sw=4 ts=4
+ */
@@ -0,0 +1,535 @@
+/*_
+ * Copyright (c) 2017 Hirochika Asai <asai@jar.jp>
+ * All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <mki/driver.h>
+#include "virtio.h"
+
+/* Prototype declarations */
+unsigned long long syscall(int, ...);
+static uint8_t _cfg_read8(uint16_t, uint16_t, uint16_t, uint16_t);
+static uint32_t _cfg_read32(uint16_t, uint16_t, uint16_t, uint16_t);
+static void * _map_cap(uint16_t, uint16_t, uint16_t, int, uint32_t, uint32_t);
+static int _setup_vq(struct virtio_device *, struct virtio_vq *, int, void *,
+                     uint16_t);
+static int _ctrl_cmd(struct virtio_device *, uint8_t, uint8_t, void *, int);
+static int _setup_rss(struct virtio_device *);
+
+/*
+ * Initialize a virtio-net device
+ */
+struct virtio_device *
+virtio_init(uint16_t device_id, uint16_t bus, uint16_t slot, uint16_t func)
+{
+    struct virtio_device *dev;
+    uint8_t ptr;
+    uint8_t type;
+    uint8_t bar;
+    uint32_t off;
+    uint32_t len;
+    uint32_t m32;
+
+    /* Allocate a virtio device data structure */
+    dev = malloc(sizeof(struct virtio_device));
+    if ( NULL == dev ) {
+        return NULL;
+    }
+    memset(dev, 0, sizeof(struct virtio_device));
+    dev->device_id = device_id;
+
+    /* Locate the structures through the vendor specific capabilities */
+    ptr = 0;
+    while ( 0 != (ptr = pci_find_capability(bus, slot, func, PCI_CAP_ID_VNDR,
+                                            ptr)) ) {
+        type = _cfg_read8(bus, slot, func, ptr + 3);
+        bar = _cfg_read8(bus, slot, func, ptr + 4);
+        off = _cfg_read32(bus, slot, func, ptr + 8);
+        len = _cfg_read32(bus, slot, func, ptr + 12);
+        switch ( type ) {
+        case VIRTIO_PCI_CAP_COMMON_CFG:
+            if ( NULL == dev->common ) {
+                dev->common = _map_cap(bus, slot, func, bar, off, len);
+            }
+            break;
+        case VIRTIO_PCI_CAP_NOTIFY_CFG:
+            if ( NULL == dev->notify ) {
+                dev->notify = _map_cap(bus, slot, func, bar, off, len);
+                dev->notify_mul = _cfg_read32(bus, slot, func, ptr + 16);
+            }
+            break;
+        case VIRTIO_PCI_CAP_DEVICE_CFG:
+            if ( NULL == dev->devcfg ) {
+                dev->devcfg = _map_cap(bus, slot, func, bar, off, len);
+            }
+            break;
+        default:
+            ;
+        }
+    }
+    if ( NULL == dev->common || NULL == dev->notify || NULL == dev->devcfg ) {
+        /* Legacy only device is not supported */
+        free(dev);
+        return NULL;
+    }
+
+    /* Initialize the PCI configuration space */
+    m32 = pci_read_config(bus, slot, func, 0x4);
+    pci_write_config(bus, slot, func, 0x4, m32 | 0x7);
+
+    return dev;
+}
+
+/*
+ * Initialize the device: negotiate the features, and setup all the virtqueues
+ * before the driver gets ready
+ */
+int
+virtio_init_hw(struct virtio_device *dev)
+{
+    uint64_t features;
+    uint16_t maxpairs;
+    uint8_t promisc;
+    void *pa;
+    void *va;
+    int i;
+    int ret;
+
+    /* Reset the device */
+    wr8(dev->common, VIRTIO_REG_STATUS, 0);
+    for ( i = 0; i < 1000; i++ ) {
+        if ( 0 == rd8(dev->common, VIRTIO_REG_STATUS) ) {
+            break;
+        }
+        busywait(10);
+    }
+    wr8(dev->common, VIRTIO_REG_STATUS, VIRTIO_STATUS_ACK);
+    wr8(dev->common, VIRTIO_REG_STATUS,
+        VIRTIO_STATUS_ACK | VIRTIO_STATUS_DRIVER);
+
+    /* Device features */
+    wr32(dev->common, VIRTIO_REG_DFSELECT, 0);
+    features = rd32(dev->common, VIRTIO_REG_DF);
+    wr32(dev->common, VIRTIO_REG_DFSELECT, 1);
+    features |= (uint64_t)rd32(dev->common, VIRTIO_REG_DF) << 32;
+    if ( !(features & VIRTIO_F_VERSION_1) ) {
+        wr8(dev->common, VIRTIO_REG_STATUS, VIRTIO_STATUS_FAILED);
+        return -1;
+    }
+    features &= VIRTIO_F_VERSION_1 | VIRTIO_NET_F_MAC | VIRTIO_NET_F_CTRL_VQ
+        | VIRTIO_NET_F_CTRL_RX | VIRTIO_NET_F_MQ | VIRTIO_NET_F_RSS;
+    if ( !(features & VIRTIO_NET_F_CTRL_VQ) ) {
+        features &= ~(VIRTIO_NET_F_CTRL_RX | VIRTIO_NET_F_MQ
+                      | VIRTIO_NET_F_RSS);
+    }
+
+    /* Multiple queue pairs are used only if the Rx queues can be steered by
+       RSS; otherwise the device would deliver to the queues of the tasks not
+       polling this port */
+    maxpairs = 1;
+    dev->npairs = 1;
+    if ( (features & VIRTIO_NET_F_MQ) && (features & VIRTIO_NET_F_RSS)
+         && rd8(dev->devcfg, VIRTIO_NET_CFG_RSS_MAX_KEY)
+         >= VIRTIO_NET_RSS_KEY_SIZE
+         && rd16(dev->devcfg, VIRTIO_NET_CFG_RSS_MAX_RETA)
+         >= VIRTIO_NET_RSS_RETA_SIZE ) {
+        maxpairs = rd16(dev->devcfg, VIRTIO_NET_CFG_MAX_PAIRS);
+        dev->npairs = maxpairs < VIRTIO_MAX_QUEUE_PAIRS
+            ? maxpairs : VIRTIO_MAX_QUEUE_PAIRS;
+        dev->hash_types = rd32(dev->devcfg, VIRTIO_NET_CFG_HASH_TYPES)
+            & VIRTIO_NET_RSS_HASH_TYPES;
+    } else {
+        features &= ~(VIRTIO_NET_F_MQ | VIRTIO_NET_F_RSS);
+    }
+    dev->features = features;
+
+    wr32(dev->common, VIRTIO_REG_GFSELECT, 0);
+    wr32(dev->common, VIRTIO_REG_GF, (uint32_t)features);
+    wr32(dev->common, VIRTIO_REG_GFSELECT, 1);
+    wr32(dev->common, VIRTIO_REG_GF, (uint32_t)(features >> 32));
+    wr8(dev->common, VIRTIO_REG_STATUS, VIRTIO_STATUS_ACK
+        | VIRTIO_STATUS_DRIVER | VIRTIO_STATUS_FEATURES_OK);
+    if ( !(rd8(dev->common, VIRTIO_REG_STATUS) & VIRTIO_STATUS_FEATURES_OK) ) {
+        wr8(dev->common, VIRTIO_REG_STATUS, VIRTIO_STATUS_FAILED);
+        return -1;
+    }
+
+    /* Get the device MAC address */
+    if ( features & VIRTIO_NET_F_MAC ) {
+        for ( i = 0; i < 6; i++ ) {
+            dev->macaddr[i] = rd8(dev->devcfg, VIRTIO_NET_CFG_MAC + i);
+        }
+    }
+
+    /* Allocate physically contiguous memory for the virtqueues.  The queues
+       cannot be added once the driver gets ready, so all of them are setup
+       here and the rings are bound to them later. */
+    ret = syscall(SYS_pix_malloc, VIRTIO_MEMSIZE, &pa, &va);
+    if ( ret < 0 ) {
+        return -1;
+    }
+    memset(va, 0, VIRTIO_MEMSIZE);
+    dev->mem = va;
+    dev->v2poff = pa - va;
+
+    /* Rx queue 2n and Tx queue 2n+1 of the queue pair n */
+    for ( i = 0; i < 2 * dev->npairs; i++ ) {
+        ret = _setup_vq(dev, &dev->vqs[i], i, va + VIRTIO_VQ_STRIDE * i,
+                        VIRTIO_MAX_QLEN);
+        if ( ret < 0 ) {
+            wr8(dev->common, VIRTIO_REG_STATUS, VIRTIO_STATUS_FAILED);
+            return -1;
+        }
+    }
+
+    /* Control virtqueue follows the data queues of all the queue pairs */
+    if ( features & VIRTIO_NET_F_CTRL_VQ ) {
+        dev->ctrl = &dev->vqs[VIRTIO_MAX_VQS - 1];
+        dev->ctrl_idx = 2 * maxpairs;
+        ret = _setup_vq(dev, dev->ctrl, dev->ctrl_idx,
+                        va + VIRTIO_VQ_STRIDE * (VIRTIO_MAX_VQS - 1),
+                        VIRTIO_CTRL_QLEN);
+        if ( ret < 0 ) {
+            wr8(dev->common, VIRTIO_REG_STATUS, VIRTIO_STATUS_FAILED);
+            return -1;
+        }
+        dev->ctrl_buf = va + VIRTIO_VQ_STRIDE * VIRTIO_MAX_VQS;
+    }
+
+    /* No interrupt for the configuration change */
+    wr16(dev->common, VIRTIO_REG_MSIX_CONFIG, VIRTIO_MSI_NO_VECTOR);
+
+    /* Driver is ready */
+    wr8(dev->common, VIRTIO_REG_STATUS, VIRTIO_STATUS_ACK
+        | VIRTIO_STATUS_DRIVER | VIRTIO_STATUS_FEATURES_OK
+        | VIRTIO_STATUS_DRIVER_OK);
+
+    /* Promiscuous mode */
+    if ( features & VIRTIO_NET_F_CTRL_RX ) {
+        promisc = 1;
+        _ctrl_cmd(dev, VIRTIO_NET_CTRL_RX, VIRTIO_NET_CTRL_RX_PROMISC,
+                  &promisc, sizeof(promisc));
+    }
+
+    /* Enable all the queue pairs while the flows go to the Rx queue 0 */
+    if ( _setup_rss(dev) < 0 ) {
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * Read a byte from the PCI configuration space
+ */
+static uint8_t
+_cfg_read8(uint16_t bus, uint16_t slot, uint16_t func, uint16_t off)
+{
+    return (pci_read_config(bus, slot, func, off) >> ((off & 1) * 8)) & 0xff;
+}
+
+/*
+ * Read a double word from the PCI configuration space
+ */
+static uint32_t
+_cfg_read32(uint16_t bus, uint16_t slot, uint16_t func, uint16_t off)
+{
+    return (uint32_t)pci_read_config(bus, slot, func, off)
+        | ((uint32_t)pci_read_config(bus, slot, func, off + 2) << 16);
+}
+
+/*
+ * Map the structure pointed by a capability
+ */
+static void *
+_map_cap(uint16_t bus, uint16_t slot, uint16_t func, int bar, uint32_t off,
+         uint32_t len)
+{
+    uint64_t pa;
+    uint64_t base;
+    void *va;
+
+    pa = pci_read_bar(bus, slot, func, bar);
+    if ( 0 == pa ) {
+        return NULL;
+    }
+    pa += off;
+
+    /* Map from the page boundary */
+    base = pa & ~0xfffULL;
+    va = driver_mmap((void *)base, pa - base + len);
+    if ( NULL == va ) {
+        return NULL;
+    }
+
+    return va + (pa - base);
+}
+
+/*
+ * Setup a virtqueue on the specified memory
+ */
+static int
+_setup_vq(struct virtio_device *dev, struct virtio_vq *vq, int idx, void *m,
+          uint16_t qlen)
+{
+    uint16_t size;
+    uint16_t noff;
+    uint64_t m64;
+
+    wr16(dev->common, VIRTIO_REG_Q_SELECT, idx);
+    size = rd16(dev->common, VIRTIO_REG_Q_SIZE);
+    if ( 0 == size ) {
+        /* Not available */
+        return -1;
+    }
+
+    /* Power of two up to the queue size offered by the device */
+    vq->len = 1;
+    while ( vq->len * 2 <= size && vq->len * 2 <= qlen ) {
+        vq->len *= 2;
+    }
+    wr16(dev->common, VIRTIO_REG_Q_SIZE, vq->len);
+
+    /* Descriptors, the available ring, and the used ring (4-byte aligned) */
+    vq->descs = m;
+    m += sizeof(struct virtq_desc) * vq->len;
+    vq->avail = m;
+    m += sizeof(struct virtq_avail) + sizeof(uint16_t) * (vq->len + 1);
+    m = (void *)(((uint64_t)m + 63) & ~63ULL);
+    vq->used = m;
+
+    /* The fast path polls the used rings */
+    vq->avail->flags = VIRTQ_AVAIL_F_NO_INTERRUPT;
+    vq->avail->idx = 0;
+
+    m64 = (uint64_t)vq->descs + dev->v2poff;
+    wr32(dev->common, VIRTIO_REG_Q_DESCLO, m64 & 0xffffffffULL);
+    wr32(dev->common, VIRTIO_REG_Q_DESCHI, m64 >> 32);
+    m64 = (uint64_t)vq->avail + dev->v2poff;
+    wr32(dev->common, VIRTIO_REG_Q_AVAILLO, m64 & 0xffffffffULL);
+    wr32(dev->common, VIRTIO_REG_Q_AVAILHI, m64 >> 32);
+    m64 = (uint64_t)vq->used + dev->v2poff;
+    wr32(dev->common, VIRTIO_REG_Q_USEDLO, m64 & 0xffffffffULL);
+    wr32(dev->common, VIRTIO_REG_Q_USEDHI, m64 >> 32);
+    wr16(dev->common, VIRTIO_REG_Q_MSIX, VIRTIO_MSI_NO_VECTOR);
+
+    /* Notify address */
+    noff = rd16(dev->common, VIRTIO_REG_Q_NOFF);
+    vq->notify = dev->notify + (uint64_t)noff * dev->notify_mul;
+
+    /* Enable this queue */
+    wr16(dev->common, VIRTIO_REG_Q_ENABLE, 1);
+
+    return 0;
+}
+
+/*
+ * Execute a command through the control virtqueue
+ */
+static int
+_ctrl_cmd(struct virtio_device *dev, uint8_t class, uint8_t cmd, void *data,
+          int len)
+{
+    struct virtio_vq *vq;
+    struct virtio_net_ctrl_hdr *hdr;
+    volatile uint8_t *ack;
+    uint16_t tail;
+    uint16_t used;
+    int i;
+
+    vq = dev->ctrl;
+    if ( NULL == vq ) {
+        return -1;
+    }
+
+    /* Command header and the data (read), and the acknowledgment (write) */
+    hdr = dev->ctrl_buf;
+    hdr->class = class;
+    hdr->cmd = cmd;
+    memcpy((void *)hdr + sizeof(struct virtio_net_ctrl_hdr), data, len);
+    ack = (void *)hdr + sizeof(struct virtio_net_ctrl_hdr) + len;
+    *ack = 0xff;
+
+    vq->descs[0].addr = (uint64_t)hdr + dev->v2poff;
+    vq->descs[0].len = sizeof(struct virtio_net_ctrl_hdr) + len;
+    vq->descs[0].flags = VIRTQ_DESC_F_NEXT;
+    vq->descs[0].next = 1;
+    vq->descs[1].addr = (uint64_t)ack + dev->v2poff;
+    vq->descs[1].len = 1;
+    vq->descs[1].flags = VIRTQ_DESC_F_WRITE;
+    vq->descs[1].next = 0;
+
+    used = vq->used->idx;
+    tail = vq->avail->idx;
+    vq->avail->ring[tail & (vq->len - 1)] = 0;
+    virtio_notify(vq->avail, vq->used, vq->notify, dev->ctrl_idx, tail + 1);
+
+    /* Wait for the completion */
+    for ( i = 0; i < 10000; i++ ) {
+        if ( vq->used->idx != used ) {
+            break;
+        }
+        busywait(10);
+    }
+    if ( vq->used->idx == used ) {
+        return -1;
+    }
+
+    return VIRTIO_NET_OK == *ack ? 0 : -1;
+}
+
+/*
+ * Spread the flows over the enabled Rx queues, and enable all the Tx queues
+ */
+static int
+_setup_rss(struct virtio_device *dev)
+{
+    struct virtio_net_rss_config rss;
+    int n;
+    int i;
+
+    if ( !(dev->features & VIRTIO_NET_F_RSS) ) {
+        /* Single queue pair */
+        return 0;
+    }
+
+    n = dev->nrxq > 0 ? dev->nrxq : 1;
+    rss.hash_types = dev->hash_types;
+    rss.indirection_table_mask = VIRTIO_NET_RSS_RETA_SIZE - 1;
+    rss.unclassified_queue = 0;
+    for ( i = 0; i < VIRTIO_NET_RSS_RETA_SIZE; i++ ) {
+        rss.indirection_table[i] = i % n;
+    }
+    rss.max_tx_vq = dev->npairs;
+    rss.hash_key_length = VIRTIO_NET_RSS_KEY_SIZE;
+    for ( i = 0; i < VIRTIO_NET_RSS_KEY_SIZE; i++ ) {
+        rss.hash_key_data[i] = VIRTIO_NET_RSS_KEY(i);
+    }
+
+    return _ctrl_cmd(dev, VIRTIO_NET_CTRL_MQ, VIRTIO_NET_CTRL_MQ_RSS_CONFIG,
+                     &rss, sizeof(rss));
+}
+
+/*
+ * Setup Rx ring on the Rx queue of the queue pair idx
+ */
+int
+virtio_setup_rx_ring(struct virtio_device *dev, struct virtio_rx_ring *rxring,
+                     int idx, void *m, uint64_t v2poff, uint16_t qlen)
+{
+    struct virtio_vq *vq;
+    ssize_t i;
+
+    (void)v2poff;
+
+    /* Check the queue index first */
+    if ( idx >= dev->npairs ) {
+        return -1;
+    }
+    vq = &dev->vqs[2 * idx];
+    if ( vq->len > qlen ) {
+        return -1;
+    }
+
+    rxring->idx = idx;
+    rxring->descs = vq->descs;
+    rxring->avail = vq->avail;
+    rxring->used = vq->used;
+    rxring->notify = vq->notify;
+    rxring->len = vq->len;
+    rxring->tail = rxring->avail->idx;
+    rxring->head = rxring->used->idx;
+    rxring->soft_head = rxring->head;
+
+    /* Buffers and the free descriptor IDs */
+    rxring->bufs = m;
+    m += sizeof(void *) * qlen;
+    rxring->ids = m;
+    for ( i = 0; i < rxring->len; i++ ) {
+        rxring->ids[(rxring->tail + i) & (rxring->len - 1)] = i;
+    }
+
+    /* Update the indirection table with this queue */
+    if ( idx + 1 > dev->nrxq ) {
+        dev->nrxq = idx + 1;
+    }
+    if ( _setup_rss(dev) < 0 ) {
+        printf("Error on updating the RSS configuration.\n");
+    }
+
+    return 0;
+}
+
+/*
+ * Setup Tx ring on the Tx queue of the queue pair idx
+ */
+int
+virtio_setup_tx_ring(struct virtio_device *dev, struct virtio_tx_ring *txring,
+                     int idx, void *m, uint64_t v2poff, uint16_t qlen)
+{
+    struct virtio_vq *vq;
+    ssize_t i;
+
+    (void)v2poff;
+
+    /* Check the queue index first */
+    if ( idx >= dev->npairs ) {
+        return -1;
+    }
+    vq = &dev->vqs[2 * idx + 1];
+    if ( vq->len > qlen ) {
+        return -1;
+    }
+
+    txring->idx = idx;
+    txring->descs = vq->descs;
+    txring->avail = vq->avail;
+    txring->used = vq->used;
+    txring->notify = vq->notify;
+    txring->len = vq->len;
+    txring->tail = txring->avail->idx;
+    txring->head = txring->used->idx;
+    txring->soft_head = txring->head;
+
+    /* Buffers and the free descriptor IDs */
+    txring->bufs = m;
+    m += sizeof(void *) * qlen;
+    txring->ids = m;
+    for ( i = 0; i < txring->len; i++ ) {
+        txring->ids[(txring->tail + i) & (txring->len - 1)] = i;
+    }
+
+    return 0;
+}
+
+/*
+ * Local variables:
+ * tab-width: 4
+ * c-basic-offset: 4
+ * End:
+ * vim600: sw=4 ts=4 fdm=marker
+ * vim<600: sw=4 ts=4
+ */
@@ -0,0 +1,530 @@
+/*_
+ * Copyright (c) 2017 Hirochika Asai <asai@jar.jp>
+ * All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef _VIRTIO_H
+#define _VIRTIO_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/pix.h>
+#include <mki/driver.h>
+#include "pci.h"
+#include "common.h"
+
+#define VIRTIO_VENDOR_ID        0x1af4
+#define VIRTIO_NET_TRANSITIONAL 0x1000
+#define VIRTIO_NET_MODERN       0x1041
+
+/* Vendor specific capabilities (cfg_type) */
+#define VIRTIO_PCI_CAP_COMMON_CFG       1
+#define VIRTIO_PCI_CAP_NOTIFY_CFG       2
+#define VIRTIO_PCI_CAP_ISR_CFG          3
+#define VIRTIO_PCI_CAP_DEVICE_CFG       4
+
+/* Common configuration structure */
+#define VIRTIO_REG_DFSELECT     0x00    /* device_feature_select */
+#define VIRTIO_REG_DF           0x04    /* device_feature */
+#define VIRTIO_REG_GFSELECT     0x08    /* driver_feature_select */
+#define VIRTIO_REG_GF           0x0c    /* driver_feature */
+#define VIRTIO_REG_MSIX_CONFIG  0x10
+#define VIRTIO_REG_NUM_QUEUES   0x12
+#define VIRTIO_REG_STATUS       0x14
+#define VIRTIO_REG_CFGGEN       0x15
+#define VIRTIO_REG_Q_SELECT     0x16
+#define VIRTIO_REG_Q_SIZE       0x18
+#define VIRTIO_REG_Q_MSIX       0x1a
+#define VIRTIO_REG_Q_ENABLE     0x1c
+#define VIRTIO_REG_Q_NOFF       0x1e
+#define VIRTIO_REG_Q_DESCLO     0x20
+#define VIRTIO_REG_Q_DESCHI     0x24
+#define VIRTIO_REG_Q_AVAILLO    0x28
+#define VIRTIO_REG_Q_AVAILHI    0x2c
+#define VIRTIO_REG_Q_USEDLO     0x30
+#define VIRTIO_REG_Q_USEDHI     0x34
+
+#define VIRTIO_MSI_NO_VECTOR    0xffff
+
+/* Device status */
+#define VIRTIO_STATUS_ACK       (1 << 0)
+#define VIRTIO_STATUS_DRIVER    (1 << 1)
+#define VIRTIO_STATUS_DRIVER_OK (1 << 2)
+#define VIRTIO_STATUS_FEATURES_OK       (1 << 3)
+#define VIRTIO_STATUS_FAILED    (1 << 7)
+
+/* Feature bits */
+#define VIRTIO_NET_F_MAC        (1ULL << 5)
+#define VIRTIO_NET_F_CTRL_VQ    (1ULL << 17)
+#define VIRTIO_NET_F_CTRL_RX    (1ULL << 18)
+#define VIRTIO_NET_F_MQ         (1ULL << 22)
+#define VIRTIO_F_VERSION_1      (1ULL << 32)
+#define VIRTIO_NET_F_RSS        (1ULL << 60)
+
+/* Device-specific configuration */
+#define VIRTIO_NET_CFG_MAC              0x00
+#define VIRTIO_NET_CFG_MAX_PAIRS        0x08
+#define VIRTIO_NET_CFG_RSS_MAX_KEY      0x11
+#define VIRTIO_NET_CFG_RSS_MAX_RETA     0x12
+#define VIRTIO_NET_CFG_HASH_TYPES       0x14
+
+/* Control commands */
+#define VIRTIO_NET_CTRL_RX              0
+#define VIRTIO_NET_CTRL_RX_PROMISC      0
+#define VIRTIO_NET_CTRL_MQ              4
+#define VIRTIO_NET_CTRL_MQ_RSS_CONFIG   1
+#define VIRTIO_NET_OK                   0
+
+/* RSS hash types (IPv4/IPv6 and TCP/UDP over them) */
+#define VIRTIO_NET_RSS_HASH_TYPES       0x3f
+#define VIRTIO_NET_RSS_KEY_SIZE         40
+/* Symmetric hash key */
+#define VIRTIO_NET_RSS_KEY(i)           (((i) & 1) ? 0x5a : 0x6d)
+#define VIRTIO_NET_RSS_RETA_SIZE        128
+
+/* Descriptor flags */
+#define VIRTQ_DESC_F_NEXT       1
+#define VIRTQ_DESC_F_WRITE      2
+/* Ask the device not to interrupt (the fast path polls the used rings) */
+#define VIRTQ_AVAIL_F_NO_INTERRUPT      1
+/* Set by the device while it does not need to be notified */
+#define VIRTQ_USED_F_NO_NOTIFY  1
+
+/* Max # of queue pairs (power of two) and the max queue size */
+#define VIRTIO_MAX_QUEUE_PAIRS  16
+#define VIRTIO_MAX_VQS          (2 * VIRTIO_MAX_QUEUE_PAIRS + 1)
+#define VIRTIO_MAX_QLEN         512
+#define VIRTIO_CTRL_QLEN        16
+/* Memory for a virtqueue: descriptors, available and used rings */
+#define VIRTIO_VQ_STRIDE        (16 * 1024)
+/* Memory for all the virtqueues and the control buffer */
+#define VIRTIO_MEMSIZE          (2 * 1024 * 1024)
+
+/* Rx buffer size */
+#define VIRTIO_RX_BUFSZ         9728
+
+/*
+ * Split virtqueue
+ */
+struct virtq_desc {
+    uint64_t addr;
+    uint32_t len;
+    uint16_t flags;
+    uint16_t next;
+} __attribute__ ((packed));
+struct virtq_avail {
+    uint16_t flags;
+    volatile uint16_t idx;
+    uint16_t ring[];
+    /* uint16_t used_event; */
+} __attribute__ ((packed));
+struct virtq_used_elem {
+    uint32_t id;
+    uint32_t len;
+} __attribute__ ((packed));
+struct virtq_used {
+    volatile uint16_t flags;
+    volatile uint16_t idx;
+    struct virtq_used_elem ring[];
+    /* uint16_t avail_event; */
+} __attribute__ ((packed));
+
+/*
+ * Packet header prepended to each buffer (VIRTIO_F_VERSION_1)
+ */
+struct virtio_net_hdr {
+    uint8_t flags;
+    uint8_t gso_type;
+    uint16_t hdr_len;
+    uint16_t gso_size;
+    uint16_t csum_start;
+    uint16_t csum_offset;
+    uint16_t num_buffers;
+} __attribute__ ((packed));
+
+/*
+ * Control command
+ */
+struct virtio_net_ctrl_hdr {
+    uint8_t class;
+    uint8_t cmd;
+} __attribute__ ((packed));
+struct virtio_net_rss_config {
+    uint32_t hash_types;
+    uint16_t indirection_table_mask;
+    uint16_t unclassified_queue;
+    uint16_t indirection_table[VIRTIO_NET_RSS_RETA_SIZE];
+    uint16_t max_tx_vq;
+    uint8_t hash_key_length;
+    uint8_t hash_key_data[VIRTIO_NET_RSS_KEY_SIZE];
+} __attribute__ ((packed));
+
+/*
+ * Virtqueue
+ */
+struct virtio_vq {
+    struct virtq_desc *descs;
+    struct virtq_avail *avail;
+    struct virtq_used *used;
+    uint16_t len;
+    /* Queue notify address */
+    void *notify;
+};
+
+/*
+ * Rx ring buffer.  The tail and the soft head are free-running indices of the
+ * available and the used rings, respectively.  The descriptor IDs returned in
+ * the used ring are recycled in order through ids[].
+ */
+struct virtio_rx_ring {
+    struct virtq_desc *descs;
+    struct virtq_avail *avail;
+    struct virtq_used *used;
+    void **bufs;                /* Indexed by descriptor ID */
+    uint16_t *ids;
+    uint16_t tail;
+    uint16_t head;
+    uint16_t soft_head;
+    uint16_t len;
+    /* Queue information */
+    uint16_t idx;               /* Queue index */
+    void *notify;
+};
+
+/*
+ * Tx ring buffer
+ */
+struct virtio_tx_ring {
+    struct virtq_desc *descs;
+    struct virtq_avail *avail;
+    struct virtq_used *used;
+    void **bufs;                /* Indexed by descriptor ID */
+    uint16_t *ids;
+    uint16_t tail;
+    uint16_t head;
+    uint16_t soft_head;
+    uint16_t len;
+    /* Queue information */
+    uint16_t idx;               /* Queue index */
+    void *notify;
+};
+
+/*
+ * virtio-net device
+ */
+struct virtio_device {
+    uint8_t macaddr[6];
+    uint16_t device_id;
+
+    /* Mapped structures */
+    void *common;
+    void *notify;
+    void *devcfg;
+    uint32_t notify_mul;
+
+    /* Negotiated features */
+    uint64_t features;
+
+    /* Virtqueues */
+    void *mem;
+    uint64_t v2poff;
+    struct virtio_vq vqs[VIRTIO_MAX_VQS];
+
+    /* # of queue pairs */
+    int npairs;
+    /* # of enabled Rx queues the flows are spread over */
+    int nrxq;
+    /* RSS */
+    uint32_t hash_types;
+
+    /* Control virtqueue and its command buffer */
+    struct virtio_vq *ctrl;
+    uint16_t ctrl_idx;
+    void *ctrl_buf;
+};
+
+/* Prototype declarations */
+struct virtio_device *
+virtio_init(uint16_t, uint16_t, uint16_t, uint16_t);
+int virtio_init_hw(struct virtio_device *);
+int virtio_setup_rx_ring(struct virtio_device *, struct virtio_rx_ring *, int,
+                         void *, uint64_t, uint16_t);
+int virtio_setup_tx_ring(struct virtio_device *, struct virtio_tx_ring *, int,
+                         void *, uint64_t, uint16_t);
+
+/*
+ * Check if the device is virtio-net
+ */
+static __inline__ int
+virtio_is_virtio(uint16_t vendor_id, uint16_t device_id)
+{
+    if ( VIRTIO_VENDOR_ID != vendor_id ) {
+        return 0;
+    }
+    switch ( device_id ) {
+    case VIRTIO_NET_TRANSITIONAL:
+    case VIRTIO_NET_MODERN:
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+/*
+ * The number of supported Tx queues
+ */
+static __inline__ int
+virtio_max_tx_queues(struct virtio_device *dev)
+{
+    return dev->npairs;
+}
+
+/*
+ * The number of supported Rx queues (spread by RSS)
+ */
+static __inline__ int
+virtio_max_rx_queues(struct virtio_device *dev)
+{
+    return dev->npairs;
+}
+
+/*
+ * RSS hash key and the size of the indirection table, or -1 if the device
+ * does not spread the Rx by RSS
+ */
+static __inline__ int
+virtio_rss_key(struct virtio_device *dev, uint8_t *key, int len, int *lutsz)
+{
+    int i;
+
+    if ( !(dev->features & VIRTIO_NET_F_RSS) ) {
+        return -1;
+    }
+    for ( i = 0; i < len && i < VIRTIO_NET_RSS_KEY_SIZE; i++ ) {
+        key[i] = VIRTIO_NET_RSS_KEY(i);
+    }
+    *lutsz = VIRTIO_NET_RSS_RETA_SIZE;
+
+    return 0;
+}
+
+/*
+ * Notify the device of new available buffers unless it has suppressed the
+ * notification
+ */
+static __inline__ void
+virtio_notify(struct virtq_avail *avail, struct virtq_used *used,
+              void *notify, uint16_t idx, uint16_t tail)
+{
+    if ( avail->idx == tail ) {
+        /* Nothing new */
+        return;
+    }
+    __sync_synchronize();
+    avail->idx = tail;
+    /* The index must be visible before checking the flag */
+    __sync_synchronize();
+    if ( !(used->flags & VIRTQ_USED_F_NO_NOTIFY) ) {
+        wr16(notify, 0, idx);
+    }
+}
+
+static __inline__ int
+virtio_rx_refill(struct virtio_rx_ring *rxring, void *pkt, void *hdr)
+{
+    struct virtq_desc *desc;
+    uint16_t slot;
+    uint16_t id;
+
+    if ( (uint16_t)(rxring->tail - rxring->soft_head) >= rxring->len ) {
+        /* Buffer is full */
+        return 0;
+    }
+    slot = rxring->tail & (rxring->len - 1);
+    id = rxring->ids[slot];
+    /* The device writes the header just before the packet */
+    desc = &rxring->descs[id];
+    desc->addr = (uint64_t)pkt - sizeof(struct virtio_net_hdr);
+    desc->len = VIRTIO_RX_BUFSZ + sizeof(struct virtio_net_hdr);
+    desc->flags = VIRTQ_DESC_F_WRITE;
+    desc->next = 0;
+    rxring->avail->ring[slot] = id;
+    rxring->bufs[id] = hdr;
+    rxring->tail++;
+
+    return 1;
+}
+
+static __inline__ void
+virtio_rx_commit(struct virtio_rx_ring *rxring)
+{
+    virtio_notify(rxring->avail, rxring->used, rxring->notify,
+                  2 * rxring->idx, rxring->tail);
+}
+
+static __inline__ int
+virtio_rx_dequeue(struct virtio_rx_ring *rxring, void **hdr)
+{
+    struct virtq_used_elem *elem;
+    uint16_t slot;
+    int len;
+
+    if ( rxring->head == rxring->soft_head ) {
+        /* Update the head */
+        rxring->head = rxring->used->idx;
+        if ( rxring->head == rxring->soft_head ) {
+            return -1;
+        }
+        __sync_synchronize();
+    }
+    slot = rxring->soft_head & (rxring->len - 1);
+    elem = &rxring->used->ring[slot];
+    *hdr = rxring->bufs[elem->id];
+    len = elem->len - sizeof(struct virtio_net_hdr);
+    /* Recycle the descriptor */
+    rxring->ids[slot] = elem->id;
+    rxring->soft_head++;
+
+    return len;
+}
+
+/*
+ * Prefetch the used element k ahead of the head, and return its packet buffer
+ * if it has already been received
+ */
+static __inline__ void *
+virtio_rx_prefetch(struct virtio_rx_ring *rxring, int k)
+{
+    struct virtq_used_elem *elem;
+
+    if ( k >= (uint16_t)(rxring->head - rxring->soft_head) ) {
+        return NULL;
+    }
+    elem = &rxring->used->ring[(rxring->soft_head + k) & (rxring->len - 1)];
+    __builtin_prefetch(elem);
+
+    return rxring->bufs[elem->id];
+}
+
+/*
+ * Check if a packet has been received (the used ring is in the host memory)
+ */
+static __inline__ int
+virtio_rx_ready(struct virtio_rx_ring *rxring)
+{
+    if ( rxring->head != rxring->soft_head ) {
+        return 1;
+    }
+
+    return rxring->used->idx != rxring->soft_head;
+}
+
+/*
+ * Enqueue a packet.  The zeroed header (no offload) is written in the
+ * headroom of the packet buffer so that a packet takes one descriptor.
+ */
+static __inline__ int
+virtio_tx_enqueue(struct virtio_tx_ring *txring, void *pkt, void *vpkt,
+                  void *hdr, size_t length)
+{
+    struct virtq_desc *desc;
+    uint16_t slot;
+    uint16_t id;
+
+    if ( (uint16_t)(txring->tail - txring->soft_head) >= txring->len ) {
+        /* Buffer is full */
+        return 0;
+    }
+    memset(vpkt - sizeof(struct virtio_net_hdr), 0,
+           sizeof(struct virtio_net_hdr));
+    slot = txring->tail & (txring->len - 1);
+    id = txring->ids[slot];
+    desc = &txring->descs[id];
+    desc->addr = (uint64_t)pkt - sizeof(struct virtio_net_hdr);
+    desc->len = length + sizeof(struct virtio_net_hdr);
+    desc->flags = 0;
+    desc->next = 0;
+    txring->avail->ring[slot] = id;
+    txring->bufs[id] = hdr;
+    txring->tail++;
+
+    return 1;
+}
+
+/*
+ * Publish the enqueued packets, and notify the device once per burst
+ */
+static __inline__ void
+virtio_tx_commit(struct virtio_tx_ring *txring)
+{
+    virtio_notify(txring->avail, txring->used, txring->notify,
+                  2 * txring->idx + 1, txring->tail);
+}
+
+static __inline__ int
+virtio_calc_rx_ring_memsize(struct virtio_rx_ring *rx, uint16_t qlen)
+{
+    (void)rx;
+    /* The virtqueue itself is allocated by the device initialization */
+    return (sizeof(void *) + sizeof(uint16_t)) * qlen;
+}
+static __inline__ int
+virtio_calc_tx_ring_memsize(struct virtio_tx_ring *tx, uint16_t qlen)
+{
+    (void)tx;
+    return (sizeof(void *) + sizeof(uint16_t)) * qlen;
+}
+
+/*
+ * Collect up to n transmitted buffers from the used ring
+ */
+static __inline__ int
+virtio_collect_buffers(struct virtio_tx_ring *txring, void **hdrs, int n)
+{
+    struct virtq_used_elem *elem;
+    uint16_t slot;
+    int i;
+
+    txring->head = txring->used->idx;
+    __sync_synchronize();
+    for ( i = 0; i < n && txring->soft_head != txring->head; i++ ) {
+        slot = txring->soft_head & (txring->len - 1);
+        elem = &txring->used->ring[slot];
+        hdrs[i] = txring->bufs[elem->id];
+        txring->ids[slot] = elem->id;
+        txring->soft_head++;
+    }
+
+    return i;
+}
+
+#endif /* _VIRTIO_H */
+
+/*
+ * Local variables:
+ * tab-width: 4
+ * c-basic-offset: 4
+ * End:
+ * vim600: sw=4 ts=4 fdm=marker
+ * vim<600: sw=4 ts=4
+ */
@@ -37,6 +37,11 @@
 #define SYSARCH_SETCR0  35
 #define SYSARCH_GETCR4  36
 #define SYSARCH_SETCR4  37
+#define SYSARCH_SWITCHBENCH 40
+#define SYSARCH_LOCKSTAT    41
+#define SYSARCH_LOCKSTAT_CLR    42
+
+#define SYSARCH_LOCKSTAT_MAX    32
 
 struct sysarch_io {
     long long port;
@@ -49,6 +54,30 @@ struct sysarch_msr {
     unsigned long long key;
     unsigned long long value;
 };
+struct sysarch_switch_bench {
+    /* Buffer touched after each switch, and the number of its pages */
+    void *buf;
+    long long npages;
+    /* Number of round trips */
+    long long iters;
+    /* Cycles per round trip with and without flushing the TLB */
+    unsigned long long flush_cycles;
+    unsigned long long noflush_cycles;
+    /* PCID of the address space (0: untagged) */
+    int pcid;
+};
+struct sysarch_lock_stat {
+    char name[32];
+    unsigned long long acquisitions;
+    unsigned long long contentions;
+    unsigned long long spins;
+    /* Longest wait in TSC cycles */
+    unsigned long long max_wait;
+};
+struct sysarch_lock_stats {
+    int nr;
+    struct sysarch_lock_stat locks[SYSARCH_LOCKSTAT_MAX];
+};
 
 int sysarch(int, void *);
 
@@ -31,12 +31,17 @@
 #define SYSDRIVER_UNREG_IRQ     2
 #define SYSDRIVER_REG_DEV       3
 #define SYSDRIVER_UNREG_DEV     4
+#define SYSDRIVER_REG_MSI       5
 
 #define SYSDRIVER_MMAP          11
 #define SYSDRIVER_MUNMAP        12
 
 #define SYSDRIVER_INTERRUPT     20
 
+#define SYSDRIVER_PCI_TABLE     30
+
+#define SYSDRIVER_PCI_MAX_DEVS  256
+
 #define SYSDRIVER_DEV_BUFSIZE   8192
 
 struct sysdriver_handler {
@@ -44,6 +49,61 @@ struct sysdriver_handler {
     void *handler;
 };
 
+struct sysdriver_msi {
+    /* Arguments: the local APIC ID of the target processor */
+    int cpu;
+    /* Return value(s): the vector allocated, and the message to be written to
+       the MSI capability or an MSI-X table entry */
+    int vec;
+    uint64_t addr;
+    uint32_t data;
+};
+
+/*
+ * PCI function enumerated by the kernel at boot
+ */
+struct sysdriver_pci_dev {
+    uint8_t bus;
+    uint8_t slot;
+    uint8_t func;
+    uint8_t hdr_type;
+    uint16_t vendor_id;
+    uint16_t device_id;
+    uint8_t class;
+    uint8_t subclass;
+    uint8_t progif;
+    uint8_t revision;
+    uint8_t intr_pin;
+    uint8_t intr_line;
+    /* Offsets of the MSI and MSI-X capabilities (0 if not supported) */
+    uint8_t msi_cap;
+    uint8_t msix_cap;
+    /* Offsets of the extended capabilities (0 if not supported or the
+       extended configuration space is not reachable) */
+    uint16_t sriov_cap;
+    uint16_t aer_cap;
+    uint16_t ari_cap;
+};
+
+/*
+ * Cached PCI device table
+ */
+struct sysdriver_pci_table {
+    /* ECAM (MMCONFIG) window of the PCI segment group 0 from the ACPI MCFG;
+       0 if not available */
+    uint64_t ecam_base;
+    uint8_t ecam_start_bus;
+    uint8_t ecam_end_bus;
+    /* Non-zero if the table was enumerated through ECAM, otherwise through
+       the legacy I/O ports */
+    uint8_t ecam;
+    /* Boot-time enumeration latency in TSC cycles and in microseconds */
+    uint64_t enum_cycles;
+    uint64_t enum_usec;
+    int ndevs;
+    struct sysdriver_pci_dev devs[SYSDRIVER_PCI_MAX_DEVS];
+};
+
 struct sysdriver_devfs {
     /* Arguments */
     const char *name;
@@ -91,9 +151,11 @@ struct driver_mapped_device {
 };
 
 int driver_register_irq_handler(int, void *);
+int driver_register_msi_handler(int, uint64_t *, uint32_t *);
 struct driver_mapped_device * driver_register_device(const char *, int);
 void * driver_mmap(void *, size_t);
 void driver_interrupt(struct driver_mapped_device *);
+int driver_pci_table(struct sysdriver_pci_table *);
 
 /*
  * Put one character to the input buffer
@@ -0,0 +1,64 @@
+/*_
+ * Copyright (c) 2017 Hirochika Asai <asai@jar.jp>
+ * All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef _SYS_ENDIAN_H
+#define _SYS_ENDIAN_H
+
+#include <stdint.h>
+
+/*
+ * Byte swap
+ */
+static __inline__ uint16_t
+bswap16(uint16_t x)
+{
+    return (uint16_t)((x >> 8) | (x << 8));
+}
+static __inline__ uint32_t
+bswap32(uint32_t x)
+{
+    return ((x >> 24) & 0xff) | ((x >> 8) & 0xff00) | ((x << 8) & 0xff0000)
+        | ((x << 24) & 0xff000000);
+}
+static __inline__ uint64_t
+bswap64(uint64_t x)
+{
+    return ((uint64_t)bswap32(x) << 32) | bswap32(x >> 32);
+}
+
+/* Host (little endian) to/from network byte order */
+#define htons(x)        bswap16(x)
+#define ntohs(x)        bswap16(x)
+#define htonl(x)        bswap32(x)
+#define ntohl(x)        bswap32(x)
+
+#endif /* _SYS_ENDIAN_H */
+
+/*
+ * Local variables:
+ * tab-width: 4
+ * c-basic-offset: 4
+ * End:
+ * vim600: sw=4 ts=4 fdm=marker
+ * vim<600: sw=4 ts=4
+ */
@@ -34,6 +34,11 @@
 
 #define ETHER_VLAN_ENCAP_LEN    4
 
+/* EtherTypes */
+#define ETHERTYPE_IP            0x0800
+#define ETHERTYPE_ARP           0x0806
+#define ETHERTYPE_VLAN          0x8100
+
 #include <stdint.h>
 
 /*
@@ -40,6 +40,106 @@
 #define SYSPIX_CPU_TICKFUL      1
 #define SYSPIX_CPU_EXCLUSIVE    2
 
+#define SYSPIX_SHM_CREATE       1
+#define SYSPIX_SHM_ATTACH       2
+
+#define PIX_SHM_NAMELEN         32
+
+/* Statistics of the forwarding engine exported through shared memory */
+#define PIX_FE_STATS_SHM        "fe.stats"
+#define PIX_FE_STATS_MAX_PORTS  64
+
+/* Packet capture control of the forwarding engine */
+#define PIX_FE_CAPTURE_SHM      "fe.capture"
+#define PIX_FE_CAPTURE_DEVLEN   32
+
+/* Packet generator of the forwarding engine */
+#define PIX_FE_PKTGEN_SHM       "fe.pktgen"
+#define PIX_FE_PKTGEN_HIST      32
+
+/* Polling mode of the forwarding engine */
+#define PIX_FE_POLL_SHM         "fe.poll"
+#define PIX_FE_POLL_BUSY        0
+#define PIX_FE_POLL_ADAPTIVE    1
+/* Cache placement of the Rx rings: DCA and header split (ORed) */
+#define PIX_FE_POLL_PLACE_DCA           1
+#define PIX_FE_POLL_PLACE_HSPLIT        2
+#define PIX_FE_POLL_NPLACES             4
+#define PIX_FE_POLL_MAX_WTHRESH         16
+
+/* Processing pipeline of the forwarding engine */
+#define PIX_FE_PIPELINE_SHM     "fe.pipeline"
+/* Chains of stages specialised at build time */
+#define PIX_FE_CHAIN_BRIDGE     0       /* Learning bridge */
+#define PIX_FE_CHAIN_STATIC     1       /* Bridge without learning */
+#define PIX_FE_CHAIN_HUB        2       /* Flood everything */
+#define PIX_FE_CHAIN_FILTER     3       /* Learning bridge with the filter */
+#define PIX_FE_CHAIN_NAT        4       /* Learning bridge with NAT44 */
+#define PIX_FE_CHAIN_TUNNEL     5       /* Learning bridge with VTEP */
+#define PIX_FE_NCHAINS          6
+
+/* Packet filter of the forwarding engine */
+#define PIX_FE_FILTER_SHM       "fe.filter"
+#define PIX_FE_FILTER_MAX_INSNS 256
+#define PIX_FE_FILTER_COUNTERS  16
+/* Status of the filter loaded */
+#define PIX_FE_FILTER_NONE      0       /* Not loaded */
+#define PIX_FE_FILTER_INTERP    1       /* Loaded and interpreted */
+#define PIX_FE_FILTER_JIT       2       /* Loaded and JIT-compiled */
+#define PIX_FE_FILTER_INVALID   -1      /* Rejected by the verifier */
+
+/* QoS scheduler of the forwarding engine */
+#define PIX_FE_QOS_SHM          "fe.qos"
+#define PIX_FE_QOS_NCLASSES     4
+#define PIX_FE_QOS_HIST         32
+
+/* Link aggregation of the forwarding engine */
+#define PIX_FE_LAG_SHM          "fe.lag"
+#define PIX_FE_LAG_MAX          8
+/* Fields hashed to distribute the flows over the members */
+#define PIX_FE_LAG_HASH_L2      0       /* MAC addresses */
+#define PIX_FE_LAG_HASH_L3      1       /* IP addresses */
+#define PIX_FE_LAG_HASH_L4      2       /* IP addresses and TCP/UDP ports */
+
+/* Storm control of the forwarding engine */
+#define PIX_FE_STORM_SHM        "fe.storm"
+#define PIX_FE_STORM_BCAST      0       /* Broadcast */
+#define PIX_FE_STORM_MCAST      1       /* Multicast */
+#define PIX_FE_STORM_UNKNOWN    2       /* Unknown unicast */
+#define PIX_FE_STORM_NCLASSES   3
+
+/* IGMP snooping of the forwarding engine */
+#define PIX_FE_MCAST_SHM        "fe.mcast"
+#define PIX_FE_MCAST_MAX        256
+
+/* NAT44 of the forwarding engine */
+#define PIX_FE_NAT_SHM          "fe.nat"
+#define PIX_FE_NAT_MAX_ADDRS    64
+/* Timeouts */
+#define PIX_FE_NAT_TO_TCP_EST   0       /* TCP established */
+#define PIX_FE_NAT_TO_TCP_TRANS 1       /* TCP opening or closing */
+#define PIX_FE_NAT_TO_UDP       2       /* UDP */
+#define PIX_FE_NAT_NTIMEOUTS    3
+
+/* Overlay tunnel endpoint (VTEP) of the forwarding engine */
+#define PIX_FE_TUNNEL_SHM       "fe.tunnel"
+#define PIX_FE_TUNNEL_MAX_VNIS  64
+#define PIX_FE_TUNNEL_MAX_VTEPS 64
+#define PIX_FE_TUNNEL_NONE      0       /* Disabled */
+#define PIX_FE_TUNNEL_VXLAN     1       /* VXLAN */
+#define PIX_FE_TUNNEL_GRE       2       /* NVGRE */
+
+/* Flow Director filters steering flows to the exclusive tasks */
+#define PIX_FE_FDIR_SHM         "fe.fdir"
+#define PIX_FE_FDIR_MAX_RULES   256
+#define PIX_FE_FDIR_NONE        0       /* Disabled */
+#define PIX_FE_FDIR_PERFECT     1       /* Perfect-match filters */
+#define PIX_FE_FDIR_SIGNATURE   2       /* Signature filters */
+/* Status of a rule */
+#define PIX_FE_FDIR_PENDING     0
+#define PIX_FE_FDIR_INSTALLED   1
+#define PIX_FE_FDIR_REJECTED    -1
+
 /*
  * Packet buffer header
  */
@@ -80,10 +180,592 @@ struct syspix_cpu_table {
     struct syspix_cpu_config cpus[PIX_MAX_CPU];
 };
 
+/*
+ * Shared memory request
+ */
+struct syspix_shm {
+    /* Arguments */
+    const char *name;
+    size_t len;
+    /* Return value(s) */
+    void *vaddr;
+};
+
+/*
+ * Per-port software counters of a forwarding engine task
+ */
+struct pix_fe_port_stats {
+    uint64_t rx_pkts;
+    uint64_t rx_bytes;
+    uint64_t rx_drops;
+    uint64_t tx_pkts;
+    uint64_t tx_bytes;
+    uint64_t tx_drops;
+} __attribute__ ((aligned(64)));
+
+/*
+ * Drop counters per reason
+ */
+struct pix_fe_drop_stats {
+    /* No packet buffer available in the buffer pool */
+    uint64_t no_buffer;
+    /* Tx ring buffer is full */
+    uint64_t ring_full;
+    /* No more FDB entry available */
+    uint64_t fdb_full;
+} __attribute__ ((aligned(64)));
+
+/*
+ * Learning counters
+ */
+struct pix_fe_fdb_stats {
+    /* Learning requests sent to the tickful task */
+    uint64_t learns;
+    /* Learning requests dropped because the ring is full */
+    uint64_t learn_drops;
+} __attribute__ ((aligned(64)));
+
+/*
+ * Packet capture counters
+ */
+struct pix_fe_capture_stats {
+    /* Packets captured (or written for the tickful task) */
+    uint64_t pkts;
+    /* Packets not captured because the capture ring is full */
+    uint64_t drops;
+    /* Cycles spent by the fast path to capture packets */
+    uint64_t cycles;
+} __attribute__ ((aligned(64)));
+
+/*
+ * Packet generator counters
+ */
+struct pix_fe_pktgen_stats {
+    /* Generated */
+    uint64_t tx_pkts;
+    uint64_t tx_bytes;
+    /* Received (terminated) */
+    uint64_t rx_pkts;
+    uint64_t rx_bytes;
+    /* Time stamp counters of the start and the last reception */
+    uint64_t start_tsc;
+    uint64_t last_tsc;
+    /* Latency in cycles */
+    uint64_t latency_sum;
+    uint64_t latency_min;
+    uint64_t latency_max;
+    /* Histogram of the latency; the i-th bin counts [2^i, 2^(i+1)) cycles */
+    uint64_t hist[PIX_FE_PKTGEN_HIST];
+} __attribute__ ((aligned(64)));
+
+/*
+ * Adaptive polling counters
+ */
+struct pix_fe_poll_stats {
+    /* # of times the task went to sleep */
+    uint64_t sleeps;
+    /* # of wake-ups by the doorbell */
+    uint64_t wakeups;
+    /* Cycles from ringing the doorbell to resuming the poll */
+    uint64_t wakeup_cycles;
+    uint64_t wakeup_max;
+    /* Cycles slept */
+    uint64_t sleep_cycles;
+    /* Cycles and packets of the Rx bursts per cache placement of the rings,
+       to compare the cycles/packet */
+    uint64_t rx_cycles[PIX_FE_POLL_NPLACES];
+    uint64_t rx_pkts[PIX_FE_POLL_NPLACES];
+} __attribute__ ((aligned(64)));
+
+/*
+ * Packet filter counters
+ */
+struct pix_fe_filter_stats {
+    /* # of packets passed, dropped, and redirected by the filter */
+    uint64_t pass;
+    uint64_t drops;
+    uint64_t redirects;
+    /* Counters incremented by the filter program */
+    uint64_t counters[PIX_FE_FILTER_COUNTERS];
+} __attribute__ ((aligned(64)));
+
+/*
+ * QoS scheduler counters per class
+ */
+struct pix_fe_qos_stats {
+    uint64_t tx_pkts[PIX_FE_QOS_NCLASSES];
+    uint64_t tx_bytes[PIX_FE_QOS_NCLASSES];
+    /* Queue full */
+    uint64_t drops[PIX_FE_QOS_NCLASSES];
+    /* Max and histogram of the queueing delay; the i-th bin counts
+       [2^i, 2^(i+1)) cycles */
+    uint64_t delay_max[PIX_FE_QOS_NCLASSES];
+    uint64_t hist[PIX_FE_QOS_NCLASSES][PIX_FE_QOS_HIST];
+} __attribute__ ((aligned(64)));
+
+/*
+ * Link aggregation counters
+ */
+struct pix_fe_lag_stats {
+    /* LACPDUs passed to the tickful task by the exclusive tasks */
+    uint64_t punts;
+    /* LACPDUs received, sent, and malformed (tickful task) */
+    uint64_t lacp_rx;
+    uint64_t lacp_tx;
+    uint64_t lacp_errors;
+    /* Changes of the members distributing (tickful task) */
+    uint64_t changes;
+    /* Packets to a group without any member distributing */
+    uint64_t drops;
+} __attribute__ ((aligned(64)));
+
+/*
+ * Storm control and IGMP snooping counters
+ */
+struct pix_fe_storm_stats {
+    /* Packets dropped over the rate per class (PIX_FE_STORM_*) */
+    uint64_t drops[PIX_FE_STORM_NCLASSES];
+    /* IGMP messages parsed (exclusive tasks) */
+    uint64_t joins;
+    uint64_t leaves;
+    uint64_t queries;
+    /* IGMP messages not passed to the tickful task (ring full) */
+    uint64_t igmp_drops;
+    /* Packets replicated to the ports of a group instead of flooded */
+    uint64_t mcast_pkts;
+    /* Groups not added (database full, tickful task) */
+    uint64_t groups_full;
+} __attribute__ ((aligned(64)));
+
+/*
+ * NAT44 counters
+ */
+struct pix_fe_nat_stats {
+    /* Packets translated */
+    uint64_t out_pkts;
+    uint64_t in_pkts;
+    /* Connections created and expired, and the connections in the table */
+    uint64_t created;
+    uint64_t expired;
+    uint64_t conns;
+    /* Packets dropped: no connection, fragments or protocols other than
+       TCP/UDP, no external port for the subscriber, table full, and checksum
+       errors reported by the NIC */
+    uint64_t misses;
+    uint64_t unsupported;
+    uint64_t no_ports;
+    uint64_t full;
+    uint64_t bad_csum;
+} __attribute__ ((aligned(64)));
+
+/*
+ * Tunnel endpoint counters
+ */
+struct pix_fe_tunnel_stats {
+    /* Frames encapsulated and decapsulated */
+    uint64_t encap_pkts;
+    uint64_t decap_pkts;
+    /* Copies of the flooded frames to the second and later remote VTEPs */
+    uint64_t replicas;
+    /* Remote VTEPs learned, and the requests not passed to the tickful
+       task (ring full) */
+    uint64_t learns;
+    uint64_t learn_drops;
+    /* ARP requests for the local VTEP answered */
+    uint64_t arps;
+    /* Packets dropped: unknown VNI or VTEP, or malformed, and no remote
+       VTEP of the VNI */
+    uint64_t bad;
+    uint64_t no_vteps;
+} __attribute__ ((aligned(64)));
+
+/*
+ * Counters of a forwarding engine task.  Each task is the only writer of its
+ * own counters, so readers aggregate them without any lock.
+ */
+struct pix_fe_task_stats {
+    /* CPU ID (for exclusive processor), or -1 for kernel */
+    int cpuid;
+    /* Drops */
+    struct pix_fe_drop_stats drops;
+    /* Learning */
+    struct pix_fe_fdb_stats fdb;
+    /* Capture */
+    struct pix_fe_capture_stats capture;
+    /* Packet generator */
+    struct pix_fe_pktgen_stats pktgen;
+    /* Adaptive polling */
+    struct pix_fe_poll_stats poll;
+    /* Packet filter */
+    struct pix_fe_filter_stats filter;
+    /* QoS scheduler */
+    struct pix_fe_qos_stats qos;
+    /* Link aggregation */
+    struct pix_fe_lag_stats lag;
+    /* Storm control and IGMP snooping */
+    struct pix_fe_storm_stats storm;
+    /* NAT44 */
+    struct pix_fe_nat_stats nat;
+    /* Tunnel endpoint */
+    struct pix_fe_tunnel_stats tunnel;
+    /* Ports */
+    struct pix_fe_port_stats ports[PIX_FE_STATS_MAX_PORTS];
+} __attribute__ ((aligned(128)));
+
+/*
+ * Hardware MAC counters (accumulated by the tickful task)
+ */
+struct pix_fe_hw_stats {
+    uint64_t rx_pkts;
+    uint64_t rx_bytes;
+    uint64_t rx_missed;
+    uint64_t rx_crcerrs;
+    uint64_t tx_pkts;
+    uint64_t tx_bytes;
+    /* Flow Director: filters installed, free entries and collisions of the
+       table, failed commands, and packets matched or missed */
+    uint64_t fdir_filters;
+    uint64_t fdir_free;
+    uint64_t fdir_colls;
+    uint64_t fdir_add_fails;
+    uint64_t fdir_remove_fails;
+    uint64_t fdir_matches;
+    uint64_t fdir_misses;
+} __attribute__ ((aligned(64)));
+
+/*
+ * Statistics of the forwarding engine
+ */
+struct pix_fe_stats {
+    /* # of tasks; the first one is the tickful task */
+    int ntasks;
+    /* # of ports */
+    int nports;
+    /* Frequency of the time stamp counter */
+    uint64_t tsc_hz;
+    /* Time stamp counter when the hardware counters were last updated */
+    volatile uint64_t hw_tsc;
+    /* Hardware counters */
+    struct pix_fe_hw_stats hw[PIX_FE_STATS_MAX_PORTS];
+    /* Software counters per task */
+    struct pix_fe_task_stats tasks[0];
+} __attribute__ ((aligned(128)));
+
+/*
+ * Capture configuration; the writer updates the fields then increments gen so
+ * that each task reloads them.
+ */
+struct pix_fe_capture_conf {
+    /* Generation */
+    volatile uint64_t gen;
+    /* Enabled or not */
+    volatile int enabled;
+    /* Snap length */
+    volatile int snaplen;
+    /* Capture one in every sampling packets */
+    volatile int sampling;
+    /* EtherType to match, or 0 for any */
+    volatile uint16_t ethertype;
+    /* Bitmap of the ingress ports to capture */
+    volatile uint64_t ports;
+    /* Device to write pcap output to */
+    char dev[PIX_FE_CAPTURE_DEVLEN];
+};
+
+/*
+ * Packet generator configuration; updated in the same way as the capture
+ * configuration.
+ */
+struct pix_fe_pktgen_conf {
+    /* Generation */
+    volatile uint64_t gen;
+    /* Enabled or not */
+    volatile int enabled;
+    /* Frame size without FCS */
+    volatile int size;
+    /* Packets per second per task, or 0 for as fast as possible */
+    volatile uint64_t rate;
+    /* Bitmap of the ports to transmit the generated frames */
+    volatile uint64_t txports;
+    /* Bitmap of the ports to receive (terminate) the generated frames */
+    volatile uint64_t rxports;
+    /* Base addresses and the number of addresses to iterate over */
+    uint8_t smac[6];
+    uint8_t dmac[6];
+    volatile uint32_t smac_range;
+    volatile uint32_t dmac_range;
+    volatile uint32_t sip;
+    volatile uint32_t dip;
+    volatile uint32_t sip_range;
+    volatile uint32_t dip_range;
+};
+
+/*
+ * Polling configuration
+ */
+struct pix_fe_poll_conf {
+    /* Generation */
+    volatile uint64_t gen;
+    /* PIX_FE_POLL_BUSY or PIX_FE_POLL_ADAPTIVE */
+    volatile int mode;
+    /* # of consecutive empty polls before sleeping */
+    volatile int idle_polls;
+    /* Prefetch distance (in descriptors) in the Rx path, or 0 to disable */
+    volatile int prefetch;
+    /* Ports whose rings are tagged for DCA to the CPU of the polling task */
+    volatile uint64_t dca;
+    /* Ports whose Rx rings split the headers into the header buffers */
+    volatile uint64_t hsplit;
+    /* Rx descriptor write-back threshold per port (0 for each descriptor) */
+    volatile uint8_t wthresh[PIX_FE_STATS_MAX_PORTS];
+};
+
+/*
+ * Pipeline configuration.  The writer fills the inactive bank, flips active,
+ * then increments gen so that each task swaps all the chains at once between
+ * two bursts.
+ */
+struct pix_fe_pipeline_conf {
+    /* Generation */
+    volatile uint64_t gen;
+    /* Bank in use */
+    volatile int active;
+    /* Chain (PIX_FE_CHAIN_*) per ingress port */
+    volatile int chains[2][PIX_FE_STATS_MAX_PORTS];
+};
+
+/*
+ * Packet filter instruction (classic BPF encoding)
+ */
+struct pix_fe_filter_insn {
+    uint16_t code;
+    uint8_t jt;
+    uint8_t jf;
+    uint32_t k;
+};
+
+/*
+ * Packet filter configuration.  The writer sets the program then increments
+ * gen; the tickful task verifies and compiles it, then sets status.
+ */
+struct pix_fe_filter_conf {
+    /* Generation */
+    volatile uint64_t gen;
+    /* JIT-compile the program or not */
+    volatile int jit;
+    /* # of instructions, or 0 to unload */
+    volatile int ninsns;
+    struct pix_fe_filter_insn insns[PIX_FE_FILTER_MAX_INSNS];
+    /* PIX_FE_FILTER_* */
+    volatile int status;
+};
+
+/*
+ * QoS class configuration
+ */
+struct pix_fe_qos_class_conf {
+    /* Strict priority, or DRR with the weight */
+    volatile int strict;
+    volatile int weight;
+    /* Shaping rate in bits per second (0 for unlimited) and bucket size in
+       bytes */
+    volatile uint64_t rate;
+    volatile uint64_t burst;
+};
+
+/*
+ * QoS configuration.  Rates are enforced by each exclusive task on its own Tx
+ * queues.
+ */
+struct pix_fe_qos_conf {
+    /* Generation */
+    volatile uint64_t gen;
+    /* Bitmap of the ports scheduled */
+    volatile uint64_t ports;
+    /* Shaping rate of each port in bits per second (0 for unlimited) and the
+       bucket size in bytes */
+    volatile uint64_t rates[PIX_FE_STATS_MAX_PORTS];
+    volatile uint64_t burst;
+    /* Classes (0 is served first among the strict priority classes) */
+    struct pix_fe_qos_class_conf classes[PIX_FE_QOS_NCLASSES];
+    /* Class per 802.1p priority and per DSCP */
+    volatile uint8_t pcp[8];
+    volatile uint8_t dscp[64];
+};
+
+/*
+ * Link aggregation group
+ */
+struct pix_fe_lag_group_conf {
+    /* Bitmap of the member ports, or 0 if not configured */
+    volatile uint64_t members;
+    /* Negotiated by LACP, or static */
+    volatile int lacp;
+    /* Bitmap of the members distributing (set by the tickful task) */
+    volatile uint64_t active;
+};
+
+/*
+ * Link aggregation configuration.  The writer sets the groups then increments
+ * gen; a port belongs to the first group including it.  Group i is seen as
+ * port PIX_FE_STATS_MAX_PORTS + i by the pipeline.
+ */
+struct pix_fe_lag_conf {
+    /* Generation */
+    volatile uint64_t gen;
+    /* PIX_FE_LAG_HASH_* */
+    volatile int hash;
+    /* LACP system priority and ID */
+    volatile uint16_t prio;
+    volatile uint8_t system[6];
+    struct pix_fe_lag_group_conf groups[PIX_FE_LAG_MAX];
+    /* LACP actor and partner state of each port (set by the tickful task) */
+    volatile uint8_t actor[PIX_FE_STATS_MAX_PORTS];
+    volatile uint8_t partner[PIX_FE_STATS_MAX_PORTS];
+};
+
+/*
+ * Storm control configuration.  The rates are enforced on the packets
+ * received, before they are flooded or replicated, by each exclusive task on
+ * its own Rx queues.
+ */
+struct pix_fe_storm_conf {
+    /* Generation */
+    volatile uint64_t gen;
+    /* Bitmap of the ports controlled */
+    volatile uint64_t ports;
+    /* Rate of each class in bits per second (0 for unlimited) per port, and
+       the bucket size in bytes */
+    volatile uint64_t rates[PIX_FE_STATS_MAX_PORTS][PIX_FE_STORM_NCLASSES];
+    volatile uint64_t burst;
+};
+
+/*
+ * Multicast group snooped
+ */
+struct pix_fe_mcast_group {
+    /* IPv4 address in host byte order */
+    volatile uint32_t addr;
+    volatile uint64_t ports;
+};
+
+/*
+ * IGMP snooping configuration.  The writer sets enabled then increments gen;
+ * the tickful task exports the groups.
+ */
+struct pix_fe_mcast_conf {
+    /* Generation */
+    volatile uint64_t gen;
+    volatile int enabled;
+    /* Membership timeout in seconds */
+    volatile int timeout;
+    /* Groups and multicast router ports (set by the tickful task) */
+    volatile int ngroups;
+    struct pix_fe_mcast_group groups[PIX_FE_MCAST_MAX];
+    volatile uint64_t mrouters;
+};
+
+/*
+ * NAT44 configuration.  The packets received on the inside ports are
+ * translated to the external addresses, and the packets received on the
+ * outside ports to the external addresses are translated back; the ports
+ * also need the NAT chain.  Changing the addresses, the blocks, or the
+ * outside ports flushes the connections.
+ */
+struct pix_fe_nat_conf {
+    /* Generation */
+    volatile uint64_t gen;
+    /* Bitmaps of the inside and the outside ports (0 to disable) */
+    volatile uint64_t inside;
+    volatile uint64_t outside;
+    /* First external address in host byte order, and the # of addresses */
+    volatile uint32_t addr;
+    volatile int naddrs;
+    /* Ports per block (a power of two), and the max # of blocks of a
+       subscriber per exclusive task */
+    volatile int block;
+    volatile int blocks;
+    /* Timeouts in seconds (PIX_FE_NAT_TO_*) */
+    volatile int timeouts[PIX_FE_NAT_NTIMEOUTS];
+};
+
+/*
+ * VNI of the tunnel endpoint bridged to an access port
+ */
+struct pix_fe_tunnel_vni {
+    volatile uint32_t vni;
+    /* Access port, and the VLAN ID on it (0 for untagged) */
+    volatile int port;
+    volatile int vlan;
+    /* Remote VTEPs flooded to (bitmap of the indices of vteps) */
+    volatile uint64_t vteps;
+};
+
+/*
+ * Tunnel endpoint configuration.  The frames received on the access ports
+ * are encapsulated to the uplink, and the packets to the local address
+ * received on the uplink are decapsulated; the ports also need the tunnel
+ * chain.  Changing the configuration flushes the remote VTEPs learned.
+ */
+struct pix_fe_tunnel_conf {
+    /* Generation */
+    volatile uint64_t gen;
+    /* PIX_FE_TUNNEL_* */
+    volatile int type;
+    /* Port (or logical port) to the underlay */
+    volatile int uplink;
+    /* Local address in host byte order, the MAC address, and the MAC
+       address of the next hop in the underlay */
+    volatile uint32_t addr;
+    volatile uint8_t mac[6];
+    volatile uint8_t gw[6];
+    /* UDP destination port (VXLAN) */
+    volatile uint16_t dport;
+    volatile int nvnis;
+    struct pix_fe_tunnel_vni vnis[PIX_FE_TUNNEL_MAX_VNIS];
+    /* Remote VTEP addresses in host byte order */
+    volatile int nvteps;
+    volatile uint32_t vteps[PIX_FE_TUNNEL_MAX_VTEPS];
+};
+
+/*
+ * Flow Director rule: an IPv4 flow (addresses and ports in host byte order;
+ * the ports are zero for the protocols other than TCP/UDP/SCTP) received on a
+ * port steered to the Rx queue of an exclusive task.  The status is written
+ * back by the forwarding engine.
+ */
+struct pix_fe_fdir_rule {
+    volatile int port;
+    volatile int task;
+    volatile uint8_t proto;
+    volatile uint32_t sip;
+    volatile uint32_t dip;
+    volatile uint16_t sport;
+    volatile uint16_t dport;
+    /* PIX_FE_FDIR_PENDING, INSTALLED, or REJECTED */
+    volatile int status;
+};
+
+/*
+ * Flow Director configuration.  Each port runs in one mode, and changing the
+ * mode reinstalls the rules of the port.  The ports need to be spread over
+ * the exclusive tasks (multi-queue).
+ */
+struct pix_fe_fdir_conf {
+    /* Generation */
+    volatile uint64_t gen;
+    /* PIX_FE_FDIR_* per port */
+    volatile uint8_t modes[PIX_FE_STATS_MAX_PORTS];
+    volatile int nrules;
+    struct pix_fe_fdir_rule rules[PIX_FE_FDIR_MAX_RULES];
+};
+
 /* Prototype declarations */
 int pix_ldcpuconf(struct syspix_cpu_table *);
 struct pix_buffer_pool * pix_create_buffer_pool(size_t);
 void *pix_malloc(size_t);
+void * pix_shm_create(const char *, size_t);
+void * pix_shm_attach(const char *, size_t *);
 
 #endif /* _SYS_PIX_H */
 
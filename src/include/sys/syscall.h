@@ -81,7 +81,9 @@
 #define SYS_pix_cpu_table   801
 #define SYS_pix_create_job  802
 #define SYS_pix_malloc      803
+#define SYS_pix_shm         804
 
+#define SYS_xpwait          1019
 #define SYS_xpsleep         1020
 #define SYS_debug           1021
 #define SYS_driver          1022
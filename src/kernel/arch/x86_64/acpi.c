@@ -142,11 +142,32 @@ acpi_busy_usleep(struct acpi *acpi, u64 usec)
     }
 }
 
+/*
+ * Record an enabled local (x2)APIC ID in the MADT
+ */
+static void
+_add_lapic(struct acpi *acpi, u32 apicid, u32 flags)
+{
+    if ( !(flags & 1) ) {
+        /* Disabled */
+        return;
+    }
+    if ( apicid >= MAX_PROCESSORS ) {
+        acpi->acpi_nlapic_over++;
+        return;
+    }
+    if ( !(acpi->acpi_lapic_map[apicid / 64] & (1ULL << (apicid % 64))) ) {
+        acpi->acpi_lapic_map[apicid / 64] |= 1ULL << (apicid % 64);
+        acpi->acpi_nlapic++;
+    }
+}
+
 /*
  * APIC
  *   0: Processor Local APIC
  *   1: I/O APIC
  *   2: Interrupt Source Override
+ *   9: Processor Local x2APIC
  */
 static int
 _parse_apic(struct acpi *acpi, struct acpi_sdt_hdr *sdt)
@@ -155,6 +176,7 @@ _parse_apic(struct acpi *acpi, struct acpi_sdt_hdr *sdt)
     struct acpi_sdt_apic *apic;
     struct acpi_sdt_apic_hdr *hdr;
     struct acpi_sdt_apic_lapic *lapic;
+    struct acpi_sdt_apic_x2apic *x2apic;
     struct acpi_sdt_apic_ioapic *ioapic;
     u32 len;
 
@@ -175,7 +197,7 @@ _parse_apic(struct acpi *acpi, struct acpi_sdt_hdr *sdt)
         case 0:
             /* Local APIC */
             lapic = (struct acpi_sdt_apic_lapic *)hdr;
-            (void)lapic;
+            _add_lapic(acpi, lapic->apic_id, lapic->flags);
             break;
         case 1:
             /* I/O APIC */
@@ -188,6 +210,11 @@ _parse_apic(struct acpi *acpi, struct acpi_sdt_hdr *sdt)
         case 2:
             /* Interrupt Source Override */
             break;
+        case 9:
+            /* Local x2APIC */
+            x2apic = (struct acpi_sdt_apic_x2apic *)hdr;
+            _add_lapic(acpi, x2apic->x2apic_id, x2apic->flags);
+            break;
         default:
             /* Other */
             ;
@@ -422,6 +449,38 @@ _parse_srat(struct acpi *acpi, struct acpi_sdt_hdr *sdt)
     return 1;
 }
 
+/*
+ * Parse PCI Express memory mapped configuration space base address
+ * description table (MCFG)
+ */
+static int
+_parse_mcfg(struct acpi *acpi, struct acpi_sdt_hdr *sdt)
+{
+    u64 addr;
+    struct acpi_sdt_mcfg_alloc *alloc;
+    u32 len;
+
+    len = 0;
+    addr = (u64)sdt;
+    len += sizeof(struct acpi_sdt_hdr) + sizeof(struct acpi_sdt_mcfg_hdr);
+
+    while ( len + sizeof(struct acpi_sdt_mcfg_alloc) <= sdt->length ) {
+        alloc = (struct acpi_sdt_mcfg_alloc *)(addr + len);
+        if ( 0 == alloc->segment && !acpi->acpi_mcfg_base
+             && alloc->start_bus <= alloc->end_bus ) {
+            /* Use the first entry of the segment group 0 */
+            acpi->acpi_mcfg_base = alloc->base;
+            acpi->acpi_mcfg_start_bus = alloc->start_bus;
+            acpi->acpi_mcfg_end_bus = alloc->end_bus;
+        }
+
+        /* Next entry */
+        len += sizeof(struct acpi_sdt_mcfg_alloc);
+    }
+
+    return 1;
+}
+
 /*
  * Parse Root System Description Table (RSDT/XSDT) in RSDP
  */
@@ -476,6 +535,11 @@ _parse_rsdt(struct acpi *acpi, struct acpi_rsdp *rsdp)
             if ( !_parse_srat(acpi, tmp) ) {
                 return 0;
             }
+        } else if ( 0 == kmemcmp((u8 *)tmp->signature, (u8 *)"MCFG", 4) ) {
+            /* MCFG */
+            if ( !_parse_mcfg(acpi, tmp) ) {
+                return 0;
+            }
         }
     }
 
@@ -561,6 +625,7 @@ acpi_lapic_prox_domain(struct acpi *acpi, int apicid)
     u64 addr;
     struct acpi_sdt_srat_common *srat;
     struct acpi_sdt_srat_lapic *srat_lapic;
+    struct acpi_sdt_srat_lapicx2 *srat_lapicx2;
     u32 len;
 
     /* Check the pointer to the SRAT */
@@ -589,6 +654,13 @@ acpi_lapic_prox_domain(struct acpi *acpi, int apicid)
                     | ((u32)srat_lapic->proximity_domain2[2] << 8);
             }
             break;
+        case 2:
+            /* Local x2APIC */
+            srat_lapicx2 = (struct acpi_sdt_srat_lapicx2 *)srat;
+            if ( srat_lapicx2->x2apic_id == (u32)apicid ) {
+                return srat_lapicx2->proximity_domain;
+            }
+            break;
         default:
             /* Other or unknown */
             ;
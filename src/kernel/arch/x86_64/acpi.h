@@ -74,7 +74,7 @@ struct acpi_sdt_apic {
  * APIC header
  */
 struct acpi_sdt_apic_hdr {
-    u8 type; /* 0 = local APIC, 1 = I/O APIC */
+    u8 type; /* 0 = local APIC, 1 = I/O APIC, 9 = local x2APIC */
     u8 length;
 } __attribute__ ((packed));
 
@@ -88,6 +88,17 @@ struct acpi_sdt_apic_lapic {
     u32 flags;
 } __attribute__ ((packed));
 
+/*
+ * Local x2APIC
+ */
+struct acpi_sdt_apic_x2apic {
+    struct acpi_sdt_apic_hdr hdr;
+    u16 reserved;
+    u32 x2apic_id;
+    u32 flags;
+    u32 acpi_uid;
+} __attribute__ ((packed));
+
 /*
  * I/O APIC
  */
@@ -238,11 +249,35 @@ struct acpi_sdt_srat_hdr {
     /* acpi_sdt_srat_*[n] */
 } __attribute__ ((packed));
 
+/*
+ * MCFG (PCI Express memory mapped configuration space)
+ * - acpi_sdt_hdr
+ * - reserved[8]
+ * - Configuration space base address allocation structure[n]
+ */
+struct acpi_sdt_mcfg_hdr {
+    /* acpi_sdt_hdr */
+    u8 reserved[8];
+    /* acpi_sdt_mcfg_alloc[n] */
+} __attribute__ ((packed));
+struct acpi_sdt_mcfg_alloc {
+    u64 base;                   /* ECAM base address (for bus 0) */
+    u16 segment;                /* PCI segment group number */
+    u8 start_bus;
+    u8 end_bus;
+    u32 reserved;
+} __attribute__ ((packed));
+
 /*
  * ACPI configuration
  */
 struct acpi {
     u64 acpi_ioapic_base;
+    /* Enabled local (x2)APIC IDs in the MADT that fit in the processor data
+       spaces, and the number of those that do not */
+    u64 acpi_lapic_map[MAX_PROCESSORS / 64];
+    int acpi_nlapic;
+    int acpi_nlapic_over;
     //u64 acpi_pm_tmr_port;
     u8 acpi_pm_tmr_ext;
     //u32 acpi_pm1a_ctrl_block;
@@ -252,6 +287,10 @@ struct acpi {
     u8 acpi_cmos_century;
     /* SRAT */
     struct acpi_sdt_hdr *srat;
+    /* ECAM window of the PCI segment group 0 (0 if not available) */
+    u64 acpi_mcfg_base;
+    u8 acpi_mcfg_start_bus;
+    u8 acpi_mcfg_end_bus;
 };
 
 int acpi_load(struct acpi *);
@@ -40,6 +40,71 @@
 #define ICR_DEST_ALL_INC_SELF   0x00080000
 #define ICR_DEST_ALL_EX_SELF    0x000c0000
 
+/* Non-zero if the local APICs are switched to x2APIC mode */
+static int lapic_x2apic;
+
+/*
+ * Get the base address for the register access: the MMIO base in xAPIC mode
+ * or zero in x2APIC mode
+ */
+static __inline__ u64
+_lapic_base(void)
+{
+    if ( lapic_x2apic ) {
+        return 0;
+    }
+
+    return lapic_base_addr();
+}
+
+/*
+ * Read a local APIC register
+ */
+static __inline__ u32
+_lapic_read(u64 apic_base, u32 reg)
+{
+    if ( lapic_x2apic ) {
+        return rdmsr(X2APIC_MSR(reg));
+    }
+
+    return mfread32(apic_base + reg);
+}
+
+/*
+ * Write a local APIC register
+ */
+static __inline__ void
+_lapic_write(u64 apic_base, u32 reg, u32 val)
+{
+    if ( lapic_x2apic ) {
+        wrmsr(X2APIC_MSR(reg), val);
+        return;
+    }
+
+    mfwrite32(apic_base + reg, val);
+}
+
+/*
+ * Write the interrupt command register.  In x2APIC mode, the ICR is a single
+ * 64-bit MSR with a 32-bit destination, and there is no delivery status to
+ * wait for.
+ */
+static __inline__ void
+_lapic_write_icr(u64 apic_base, u32 dst, u32 icrl)
+{
+    u32 icrh;
+
+    if ( lapic_x2apic ) {
+        wrmsr(X2APIC_MSR(APIC_ICR_LOW), ((u64)dst << 32) | icrl);
+        return;
+    }
+
+    icrh = mfread32(apic_base + APIC_ICR_HIGH);
+    icrh = (icrh & 0x000fffff) | (dst << 24);
+    mfwrite32(apic_base + APIC_ICR_HIGH, icrh);
+    mfwrite32(apic_base + APIC_ICR_LOW, icrl);
+}
+
 /*
  * Return the APIC_BASE address
  */
@@ -62,6 +127,51 @@ lapic_base_addr(void)
     return apic_base;
 }
 
+/*
+ * Switch this local APIC to x2APIC mode if the processor supports it.  The
+ * bootstrap processor decides the mode, and the application processors
+ * follow it.  Returns 1 if x2APIC mode is enabled, or 0 otherwise.
+ */
+int
+lapic_x2apic_enable(void)
+{
+    u64 rbx;
+    u64 rcx;
+    u64 rdx;
+    u64 msr;
+
+    /* CPUID.01H:ECX[21] */
+    cpuid(0x01, &rbx, &rcx, &rdx);
+    if ( !(rcx & (1 << 21)) ) {
+        return 0;
+    }
+
+    /* xAPIC must be enabled before switching to x2APIC mode */
+    msr = rdmsr(APIC_MSR);
+    if ( !(msr & APIC_MSR_EXTD) ) {
+        msr |= APIC_MSR_EN;
+        wrmsr(APIC_MSR, msr);
+        msr |= APIC_MSR_EXTD;
+        wrmsr(APIC_MSR, msr);
+    }
+
+    /* APIC Software Enable at the spurious interrupt vector register */
+    wrmsr(X2APIC_MSR(APIC_SIVR), rdmsr(X2APIC_MSR(APIC_SIVR)) | 0x100);
+
+    lapic_x2apic = 1;
+
+    return 1;
+}
+
+/*
+ * Test if the local APICs are in x2APIC mode
+ */
+int
+lapic_x2apic_mode(void)
+{
+    return lapic_x2apic;
+}
+
 /*
  * Send INIT IPI
  */
@@ -69,19 +179,19 @@ void
 lapic_send_init_ipi(void)
 {
     u32 icrl;
-    u32 icrh;
     u64 apic_base;
 
-    apic_base = lapic_base_addr();
+    apic_base = _lapic_base();
 
-    icrl = mfread32(apic_base + APIC_ICR_LOW);
-    icrh = mfread32(apic_base + APIC_ICR_HIGH);
-
-    icrl = (icrl & ~0x000cdfff) | ICR_INIT | ICR_DEST_ALL_EX_SELF;
-    icrh = (icrh & 0x000fffff);
+    if ( lapic_x2apic ) {
+        icrl = 0;
+    } else {
+        icrl = mfread32(apic_base + APIC_ICR_LOW);
+    }
+    icrl = (icrl & ~0x000cdfff) | ICR_INIT | ICR_LEVEL_ASSERT
+        | ICR_DEST_ALL_EX_SELF;
 
-    mfwrite32(apic_base + APIC_ICR_HIGH, icrh);
-    mfwrite32(apic_base + APIC_ICR_LOW, icrl);
+    _lapic_write_icr(apic_base, 0, icrl);
 }
 
 /*
@@ -91,22 +201,70 @@ void
 lapic_send_startup_ipi(u8 vector)
 {
     u32 icrl;
-    u32 icrh;
     u64 apic_base;
 
-    apic_base = lapic_base_addr();
-
-    do {
-        icrl = mfread32(apic_base + APIC_ICR_LOW);
-        icrh = mfread32(apic_base + APIC_ICR_HIGH);
-        /* Wait until it's idle */
-    } while ( icrl & (ICR_SEND_PENDING) );
+    apic_base = _lapic_base();
 
+    if ( lapic_x2apic ) {
+        icrl = 0;
+    } else {
+        do {
+            icrl = mfread32(apic_base + APIC_ICR_LOW);
+            /* Wait until it's idle */
+        } while ( icrl & (ICR_SEND_PENDING) );
+    }
     icrl = (icrl & ~0x000cdfff) | ICR_STARTUP | ICR_DEST_ALL_EX_SELF | vector;
-    icrh = (icrh & 0x000fffff);
 
-    mfwrite32(apic_base + APIC_ICR_HIGH, icrh);
-    mfwrite32(apic_base + APIC_ICR_LOW, icrl);
+    _lapic_write_icr(apic_base, 0, icrl);
+}
+
+/*
+ * Send INIT IPI to the specified destination
+ */
+void
+lapic_send_init_ipi_to(int dst)
+{
+    u32 icrl;
+    u64 apic_base;
+
+    apic_base = _lapic_base();
+
+    if ( lapic_x2apic ) {
+        icrl = 0;
+    } else {
+        do {
+            icrl = mfread32(apic_base + APIC_ICR_LOW);
+            /* Wait until it's idle */
+        } while ( icrl & (ICR_SEND_PENDING) );
+    }
+    icrl = (icrl & ~0x000cdfff) | ICR_INIT | ICR_LEVEL_ASSERT
+        | ICR_DEST_NOSHORTHAND;
+
+    _lapic_write_icr(apic_base, dst, icrl);
+}
+
+/*
+ * Send Start Up IPI to the specified destination
+ */
+void
+lapic_send_startup_ipi_to(int dst, u8 vector)
+{
+    u32 icrl;
+    u64 apic_base;
+
+    apic_base = _lapic_base();
+
+    if ( lapic_x2apic ) {
+        icrl = 0;
+    } else {
+        do {
+            icrl = mfread32(apic_base + APIC_ICR_LOW);
+            /* Wait until it's idle */
+        } while ( icrl & (ICR_SEND_PENDING) );
+    }
+    icrl = (icrl & ~0x000cdfff) | ICR_STARTUP | ICR_DEST_NOSHORTHAND | vector;
+
+    _lapic_write_icr(apic_base, dst, icrl);
 }
 
 /*
@@ -116,19 +274,18 @@ void
 lapic_bcast_fixed_ipi(u8 vector)
 {
     u32 icrl;
-    u32 icrh;
     u64 apic_base;
 
-    apic_base = lapic_base_addr();
-
-    icrl = mfread32(apic_base + APIC_ICR_LOW);
-    icrh = mfread32(apic_base + APIC_ICR_HIGH);
+    apic_base = _lapic_base();
 
+    if ( lapic_x2apic ) {
+        icrl = 0;
+    } else {
+        icrl = mfread32(apic_base + APIC_ICR_LOW);
+    }
     icrl = (icrl & ~0x000cdfff) | ICR_FIXED | ICR_DEST_ALL_EX_SELF | vector;
-    icrh = (icrh & 0x000fffff);
 
-    mfwrite32(apic_base + APIC_ICR_HIGH, icrh);
-    mfwrite32(apic_base + APIC_ICR_LOW, icrl);
+    _lapic_write_icr(apic_base, 0, icrl);
 }
 
 /*
@@ -138,23 +295,22 @@ void
 lapic_send_fixed_ipi(int dst, u8 vector)
 {
     u32 icrl;
-    u32 icrh;
     u64 apic_base;
 
-    apic_base = lapic_base_addr();
-
-    icrl = mfread32(apic_base + APIC_ICR_LOW);
-    icrh = mfread32(apic_base + APIC_ICR_HIGH);
+    apic_base = _lapic_base();
 
+    if ( lapic_x2apic ) {
+        icrl = 0;
+    } else {
+        icrl = mfread32(apic_base + APIC_ICR_LOW);
+    }
     icrl = (icrl & ~0x000cdfff) | ICR_FIXED | ICR_DEST_NOSHORTHAND | vector;
-    icrh = (icrh & 0x000fffff) | ((u32)dst << 24);
 
-    mfwrite32(apic_base + APIC_ICR_HIGH, icrh);
-    mfwrite32(apic_base + APIC_ICR_LOW, icrl);
+    _lapic_write_icr(apic_base, dst, icrl);
 }
 
 /*
- * Return this local APIC ID
+ * Return this local APIC ID (32 bits in x2APIC mode, 8 bits in xAPIC mode)
  */
 int
 lapic_id(void)
@@ -162,6 +318,10 @@ lapic_id(void)
     u32 reg;
     u64 apic_base;
 
+    if ( lapic_x2apic ) {
+        return rdmsr(X2APIC_MSR(APIC_LAPIC_ID));
+    }
+
     apic_base = lapic_base_addr();
     reg = *(u32 *)(apic_base + APIC_LAPIC_ID);
 
@@ -180,32 +340,32 @@ lapic_estimate_freq(void)
     u64 ret;
     u64 apic_base;
 
-    apic_base = lapic_base_addr();
+    apic_base = _lapic_base();
 
     /* Set probe timer */
     probe = APIC_FREQ_PROBE;
 
     /* Disable timer */
-    mfwrite32(apic_base + APIC_LVT_TMR, APIC_LVT_DISABLE);
+    _lapic_write(apic_base, APIC_LVT_TMR, APIC_LVT_DISABLE);
 
     /* Set divide configuration */
-    mfwrite32(apic_base + APIC_TMRDIV, APIC_TMRDIV_X16);
+    _lapic_write(apic_base, APIC_TMRDIV, APIC_TMRDIV_X16);
 
     /* Vector: lvt[18:17] = 00 : oneshot */
-    mfwrite32(apic_base + APIC_LVT_TMR, 0x0);
+    _lapic_write(apic_base, APIC_LVT_TMR, 0x0);
 
     /* Set initial counter */
     t0 = 0xffffffff;
-    mfwrite32(apic_base + APIC_INITTMR, t0);
+    _lapic_write(apic_base, APIC_INITTMR, t0);
 
     /* Sleep probing time */
     acpi_busy_usleep(&arch_acpi, probe);
 
     /* Disable current timer */
-    mfwrite32(apic_base + APIC_LVT_TMR, APIC_LVT_DISABLE);
+    _lapic_write(apic_base, APIC_LVT_TMR, APIC_LVT_DISABLE);
 
     /* Read current timer */
-    t1 = mfread32(apic_base + APIC_CURTMR);
+    t1 = _lapic_read(apic_base, APIC_CURTMR);
 
     /* Calculate the APIC bus frequency */
     ret = (u64)(t0 - t1) << 4;
@@ -224,16 +384,16 @@ lapic_oneshot_timer(u64 msec, u8 vec)
     struct cpu_data *pdata;
     u64 apic_base;
 
-    apic_base = lapic_base_addr();
+    apic_base = _lapic_base();
 
     /* Get CPU frequency to this CPU data area */
     pdata = this_cpu();
     busfreq = pdata->freq;
 
     /* Set counter */
-    mfwrite32(apic_base + APIC_LVT_TMR, APIC_LVT_ONESHOT | (u32)vec);
-    mfwrite32(apic_base + APIC_TMRDIV, APIC_TMRDIV_X16);
-    mfwrite32(apic_base + APIC_INITTMR, msec * (busfreq >> 4) / 1000);
+    _lapic_write(apic_base, APIC_LVT_TMR, APIC_LVT_ONESHOT | (u32)vec);
+    _lapic_write(apic_base, APIC_TMRDIV, APIC_TMRDIV_X16);
+    _lapic_write(apic_base, APIC_INITTMR, msec * (busfreq >> 4) / 1000);
 }
 
 /*
@@ -246,16 +406,16 @@ lapic_start_timer(u64 freq, u8 vec)
     struct cpu_data *pdata;
     u64 apic_base;
 
-    apic_base = lapic_base_addr();
+    apic_base = _lapic_base();
 
     /* Get CPU frequency to this CPU data area */
     pdata = this_cpu();
     busfreq = pdata->freq;
 
     /* Set counter */
-    mfwrite32(apic_base + APIC_LVT_TMR, APIC_LVT_PERIODIC | (u32)vec);
-    mfwrite32(apic_base + APIC_TMRDIV, APIC_TMRDIV_X16);
-    mfwrite32(apic_base + APIC_INITTMR, (busfreq >> 4) / freq);
+    _lapic_write(apic_base, APIC_LVT_TMR, APIC_LVT_PERIODIC | (u32)vec);
+    _lapic_write(apic_base, APIC_TMRDIV, APIC_TMRDIV_X16);
+    _lapic_write(apic_base, APIC_INITTMR, (busfreq >> 4) / freq);
 }
 
 /*
@@ -266,10 +426,10 @@ lapic_stop_timer(void)
 {
     u64 apic_base;
 
-    apic_base = lapic_base_addr();
+    apic_base = _lapic_base();
 
     /* Disable timer */
-    mfwrite32(apic_base + APIC_LVT_TMR, APIC_LVT_DISABLE);
+    _lapic_write(apic_base, APIC_LVT_TMR, APIC_LVT_DISABLE);
 }
 
 /*
@@ -27,6 +27,11 @@
 #include <aos/const.h>
 
 #define APIC_MSR                0x1b
+#define APIC_MSR_EXTD           (1 << 10)   /* x2APIC mode */
+#define APIC_MSR_EN             (1 << 11)   /* xAPIC global enable */
+/* x2APIC registers are MSRs at 0x800 + (the xAPIC MMIO offset >> 4) */
+#define X2APIC_MSR_BASE         0x800
+#define X2APIC_MSR(reg)         (X2APIC_MSR_BASE + ((reg) >> 4))
 #define APIC_LAPIC_ID           0x020
 #define APIC_SIVR               0x0f0
 #define APIC_ICR_LOW            0x300
@@ -55,8 +60,12 @@
 #define APIC_FREQ_PROBE         100000
 
 u64 lapic_base_addr(void);
+int lapic_x2apic_enable(void);
+int lapic_x2apic_mode(void);
 void lapic_send_init_ipi(void);
 void lapic_send_startup_ipi(u8);
+void lapic_send_init_ipi_to(int);
+void lapic_send_startup_ipi_to(int, u8);
 void lapic_bcast_fixed_ipi(u8);
 void lapic_send_fixed_ipi(int, u8);
 int lapic_id(void);
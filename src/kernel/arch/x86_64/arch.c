@@ -31,17 +31,27 @@
 #include "apic.h"
 #include "cmos.h"
 #include "memory.h"
+#include "pci.h"
 
 /* Prototype declarations */
 static int load_trampoline(void);
 static void cpu_init(void);
+static void ap_ipi(int);
+static void ap_wakeup(void);
 
 /* ACPI structure */
 struct acpi arch_acpi;
 
+/* PCI device table enumerated at boot */
+static struct sysdriver_pci_table arch_pci;
+
 /* Multiprocessor enabled */
 int mp_enabled;
 
+/* Registered lock contention statistics */
+static struct spinlock_stat *arch_lock_stat_list;
+static spinlock_t arch_lock_stat_lock;
+
 
 /*
  * Relocate the trampoline code to a 4 KiB page alined space
@@ -83,6 +93,73 @@ cpu_init(void)
     }
 }
 
+/*
+ * Send an IPI to each application processor listed in the MADT
+ */
+static void
+ap_ipi(int init)
+{
+    int self;
+    int i;
+
+    self = lapic_id();
+    for ( i = 0; i < MAX_PROCESSORS; i++ ) {
+        if ( i == self
+             || !(arch_acpi.acpi_lapic_map[i / 64] & (1ULL << (i % 64))) ) {
+            continue;
+        }
+        if ( init ) {
+            lapic_send_init_ipi_to(i);
+        } else {
+            lapic_send_startup_ipi_to(i, TRAMPOLINE_VEC & 0xff);
+        }
+    }
+}
+
+/*
+ * Wake up the application processors by INIT-SIPI-SIPI.  The IPIs are
+ * broadcast unless the MADT lists processors whose (x2)APIC IDs exceed the
+ * processor data spaces; then they are sent only to the listed processors
+ * that fit.
+ */
+static void
+ap_wakeup(void)
+{
+    int targeted;
+
+    targeted = arch_acpi.acpi_nlapic_over > 0;
+
+    /* Send INIT IPI */
+    if ( targeted ) {
+        ap_ipi(1);
+    } else {
+        lapic_send_init_ipi();
+    }
+
+    /* Wait 10 ms */
+    acpi_busy_usleep(&arch_acpi, 10000);
+
+    /* Send a Start Up IPI */
+    if ( targeted ) {
+        ap_ipi(0);
+    } else {
+        lapic_send_startup_ipi(TRAMPOLINE_VEC & 0xff);
+    }
+
+    /* Wait 200 us */
+    acpi_busy_usleep(&arch_acpi, 200);
+
+    /* Send another Start Up IPI */
+    if ( targeted ) {
+        ap_ipi(0);
+    } else {
+        lapic_send_startup_ipi(TRAMPOLINE_VEC & 0xff);
+    }
+
+    /* Wait 200 us */
+    acpi_busy_usleep(&arch_acpi, 200);
+}
+
 /*
  * Set up the exception/interrupt handlers
  */
@@ -326,8 +403,15 @@ bsp_init(void)
     kmemset(&arch_acpi, 0, sizeof(struct acpi));
     acpi_load(&arch_acpi);
 
+    /* Enumerate PCI devices through ECAM while the ECAM window is still
+       identity-mapped by the boot strap page table */
+    pci_enumerate(&arch_acpi, &arch_pci);
+
     /* ToDo: Prepare the virtual pages for ACPI etc. */
 
+    /* Switch the local APIC to x2APIC mode if supported */
+    lapic_x2apic_enable();
+
     /* Initialize I/O APIC */
     ioapic_init();
 
@@ -352,6 +436,15 @@ bsp_init(void)
         return;
     }
 
+    /* Tag the TLB entries with the process-context identifiers */
+    pcid_init();
+
+    /* Size the extended states saved on task switches */
+    if ( xsave_init() < 0 ) {
+        panic("Fatal: XSAVE is not supported.");
+        return;
+    }
+
     /* Load LDT */
     lldt(0);
 
@@ -441,23 +534,8 @@ bsp_init(void)
 
     sti();
 
-    /* Send INIT IPI */
-    lapic_send_init_ipi();
-
-    /* Wait 10 ms */
-    acpi_busy_usleep(&arch_acpi, 10000);
-
-    /* Send a Start Up IPI */
-    lapic_send_startup_ipi(TRAMPOLINE_VEC & 0xff);
-
-    /* Wait 200 us */
-    acpi_busy_usleep(&arch_acpi, 200);
-
-    /* Send another Start Up IPI */
-    lapic_send_startup_ipi(TRAMPOLINE_VEC & 0xff);
-
-    /* Wait 200 us */
-    acpi_busy_usleep(&arch_acpi, 200);
+    /* Wake up the application processors */
+    ap_wakeup();
 
     /* Initialize local APIC counter */
     lapic_start_timer(HZ, IV_LOC_TMR);
@@ -495,6 +573,11 @@ ap_init(void)
     u64 tsc0;
     u64 tsc;
 
+    /* Follow the local APIC mode of the bootstrap processor */
+    if ( lapic_x2apic_mode() ) {
+        lapic_x2apic_enable();
+    }
+
     /* Load global descriptor table */
     gdt_load();
 
@@ -510,6 +593,13 @@ ap_init(void)
     set_cr3(((struct arch_kmem_space *)g_kmem->space->arch)->cr3);
     /* Enable the global page feature */
     set_cr4(get_cr4() | CR4_PGE);
+    /* Tag the TLB entries with the process-context identifiers */
+    pcid_init();
+    /* Enable the extended states saved on task switches */
+    if ( xsave_init() < 0 ) {
+        panic("Fatal: XSAVE is not supported.");
+        return;
+    }
 
     /* Enable this processor */
     pdata = this_cpu();
@@ -769,6 +859,128 @@ arch_store_cpu_table(struct syspix_cpu_table *cputable)
     return -1;
 }
 
+/*
+ * Compose the MSI message delivering a vector to the processor of the local
+ * APIC ID (fixed delivery, edge-triggered, physical destination)
+ */
+int
+arch_msi_message(int cpu, int vec, u64 *addr, u32 *data)
+{
+    struct cpu_data *pdata;
+
+    /* 8-bit destination of xAPIC */
+    if ( cpu < 0 || cpu >= MAX_PROCESSORS || cpu > 0xff ) {
+        return -1;
+    }
+    pdata = (struct cpu_data *)((u64)CPU_DATA_BASE + CPU_DATA_SIZE * cpu);
+    if ( !(pdata->flags & 1) ) {
+        /* Not present */
+        return -1;
+    }
+    *addr = 0xfee00000ULL | ((u64)cpu << 12);
+    *data = vec & 0xff;
+
+    return 0;
+}
+
+/*
+ * Copy the PCI device table enumerated at boot
+ */
+int
+arch_pci_table(struct sysdriver_pci_table *tbl)
+{
+    kmemcpy(tbl, &arch_pci, sizeof(struct sysdriver_pci_table));
+
+    return 0;
+}
+
+/*
+ * Acquire a lock and account the wait to its contention statistics; the
+ * counters are updated while holding the lock
+ */
+void
+spin_lock_stat(spinlock_t *lock, struct spinlock_stat *st)
+{
+    u64 tsc;
+    u64 spins;
+
+    /* Fast path: not contended */
+    if ( spin_trylock(lock) ) {
+        st->acquisitions++;
+        return;
+    }
+
+    tsc = rdtsc();
+    spins = spin_lock(lock);
+    tsc = rdtsc() - tsc;
+
+    st->acquisitions++;
+    st->contentions++;
+    st->spins += spins;
+    if ( tsc > st->max_wait ) {
+        st->max_wait = tsc;
+    }
+}
+
+/*
+ * Register lock contention statistics to be dumped
+ */
+void
+spin_lock_stat_register(struct spinlock_stat *st, const char *name)
+{
+    spin_lock(&arch_lock_stat_lock);
+    st->name = name;
+    st->next = arch_lock_stat_list;
+    arch_lock_stat_list = st;
+    spin_unlock(&arch_lock_stat_lock);
+}
+
+/*
+ * Copy the registered lock contention statistics
+ */
+int
+arch_lock_stats(struct sysarch_lock_stats *stats)
+{
+    struct spinlock_stat *st;
+    struct sysarch_lock_stat *out;
+    int n;
+
+    n = 0;
+    spin_lock(&arch_lock_stat_lock);
+    for ( st = arch_lock_stat_list; NULL != st && n < SYSARCH_LOCKSTAT_MAX;
+          st = st->next ) {
+        out = &stats->locks[n];
+        kstrlcpy(out->name, st->name, sizeof(out->name));
+        out->acquisitions = st->acquisitions;
+        out->contentions = st->contentions;
+        out->spins = st->spins;
+        out->max_wait = st->max_wait;
+        n++;
+    }
+    spin_unlock(&arch_lock_stat_lock);
+    stats->nr = n;
+
+    return 0;
+}
+
+/*
+ * Reset the registered lock contention statistics
+ */
+void
+arch_lock_stats_clear(void)
+{
+    struct spinlock_stat *st;
+
+    spin_lock(&arch_lock_stat_lock);
+    for ( st = arch_lock_stat_list; NULL != st; st = st->next ) {
+        st->acquisitions = 0;
+        st->contentions = 0;
+        st->spins = 0;
+        st->max_wait = 0;
+    }
+    spin_unlock(&arch_lock_stat_lock);
+}
+
 /*
  * A routine called when task is switched
  * Note that this is in the interrupt handler and DO NOT change the interrupt
@@ -777,6 +989,8 @@ arch_store_cpu_table(struct syspix_cpu_table *cputable)
 void
 arch_task_switched(struct arch_task *prev, struct arch_task *next)
 {
+    /* Flush the TLB entries invalidated while the next task was away */
+    pcid_switch(next);
 }
 
 void
@@ -790,7 +1004,7 @@ arch_switch_page_table(struct vmem_space *vmem)
     } else {
         cr3 = get_cr3();
         avmem = (struct arch_vmem_space *)vmem->arch;
-        set_cr3(avmem->pgt);
+        set_cr3(arch_vmem_cr3(avmem));
     }
 }
 
@@ -831,6 +1045,35 @@ void set_next_idle(void)
     this_cpu()->next_task = this_cpu()->idle_task;
 }
 
+/*
+ * Wait on this exclusive processor until the 64-bit value at addr is changed
+ * from val or an interrupt arrives, using monitor/mwait
+ */
+int
+arch_xpwait(volatile u64 *addr, u64 val)
+{
+    static int supported = -1;
+    u64 rbx;
+    u64 rcx;
+    u64 rdx;
+
+    if ( supported < 0 ) {
+        /* CPUID.01H:ECX.MONITOR[bit 3] */
+        cpuid(0x01, &rbx, &rcx, &rdx);
+        supported = (rcx & (1 << 3)) ? 1 : 0;
+    }
+    if ( !supported ) {
+        return -1;
+    }
+
+    monitor(addr);
+    if ( *addr == val ) {
+        mwait();
+    }
+
+    return 0;
+}
+
 /*
  * Idle task
  */
@@ -873,6 +1116,25 @@ arch_isr(u64 vec)
         /* IRQs */
         kirq_handler(vec);
         break;
+    case IV_MSI(0):
+    case IV_MSI(1):
+    case IV_MSI(2):
+    case IV_MSI(3):
+    case IV_MSI(4):
+    case IV_MSI(5):
+    case IV_MSI(6):
+    case IV_MSI(7):
+    case IV_MSI(8):
+    case IV_MSI(9):
+    case IV_MSI(10):
+    case IV_MSI(11):
+    case IV_MSI(12):
+    case IV_MSI(13):
+    case IV_MSI(14):
+    case IV_MSI(15):
+        /* MSI/MSI-X */
+        kirq_handler(vec);
+        break;
     default:
         kintr_isr(vec);;
     }
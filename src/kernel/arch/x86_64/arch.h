@@ -101,6 +101,21 @@
 #define CR4_OSXSAVE             (1ULL << 18)
 #define CR4_SMEP                (1ULL << 20)
 
+/* XCR0: state components saved by XSAVE */
+#define XCR0_X87                (1ULL << 0)
+#define XCR0_SSE                (1ULL << 1)
+#define XCR0_AVX                (1ULL << 2)
+/* XCOMP_BV[63]: compacted format of the XSAVE area */
+#define XCOMP_BV_COMPACT        (1ULL << 63)
+
+/* CR3 with CR4.PCIDE: [11:0] PCID, [63] not to flush the PCID on load */
+#define CR3_PCID_MASK           0xfffULL
+#define CR3_NOFLUSH             (1ULL << 63)
+#define PCID_NR                 4096
+
+/* INVPCID types */
+#define INVPCID_ADDR            0   /* Individual-address invalidation */
+#define INVPCID_CTX             1   /* Single-context invalidation */
 
 #define MSR_PLATFORM_INFO       0xce
 
@@ -309,6 +324,11 @@ struct arch_vmem_space {
     u64 **array;
     /* Leaves for virtual memory */
     u64 **vls;
+    /* Process-context identifier tagging the TLB entries (0: untagged) */
+    u16 pcid;
+    /* Processors that may hold stale TLB entries tagged with the PCID; each
+       flushes them at the next switch to this space */
+    volatile u64 tlb_stale[CPU_DATA_NR / 64];
 
 #if 0
     struct {
@@ -360,7 +380,9 @@ struct cpu_data {
     u64 tsc_offset;     /* TSC-offset to the BSP */
     u64 tsc_freq;
     u32 prox_domain;
-    u32 reserved[3];
+    /* Instruction to save the extended states (CPU_XSAVE_OFFSET) */
+    u32 xsave;
+    u32 reserved[2];
     u64 stats[IDT_NR];  /* Interrupt counter */
     /* CPU_TSS_OFFSET */
     struct tss tss;
@@ -465,6 +487,8 @@ void intr_crash(void);
 void task_restart(void);
 void task_replace(void *);
 void pause(void);
+void monitor(volatile void *);
+void mwait(void);
 u8 inb(u16);
 u16 inw(u16);
 u32 inl(u16);
@@ -474,6 +498,7 @@ void outl(u16, u32);
 u32 mfread32(u64);
 void mfwrite32(u64, u32);
 u64 cpuid(u64, u64 *,u64 *, u64 *);
+u64 cpuid_subleaf(u64, u64, u64 *,u64 *, u64 *);
 u64 rdmsr(u64);
 void wrmsr(u64, u64);
 u64 get_cr0(void);
@@ -483,6 +508,8 @@ void set_cr3(void *);
 u64 get_cr4(void);
 void set_cr4(u64);
 void invlpg(void *);
+void invpcid(u64, u64, void *);
+void xsetbv(u32, u64);
 int vmxon(void *);
 int vmclear(void *);
 int vmptrld(void *);
@@ -490,8 +517,10 @@ int vmwrite(u64, u64);
 u64 vmread(u64);
 int vmlaunch(void);
 int vmresume(void);
-void spin_lock_intr(u32 *);
+u64 spin_lock_intr(u32 *);
 void spin_unlock_intr(u32 *);
+void atomic_or64(volatile u64 *, u64);
+int atomic_test_and_clear_bit(volatile u64 *, int);
 
 void sys_task_switch(void);
 
@@ -502,7 +531,14 @@ void trampoline_end(void);
 /* in cpuid.c */
 int cpuid_parse(void);
 
+/* in memory.c */
+int pcid_init(void);
+int pcid_enabled(void);
+void * arch_vmem_cr3(struct arch_vmem_space *);
+void pcid_switch(struct arch_task *);
+
 /* in task.c */
+int xsave_init(void);
 struct arch_task * task_create_idle(void);
 int proc_create(const char *, const char *, pid_t);
 
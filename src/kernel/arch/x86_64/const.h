@@ -56,7 +56,9 @@
 /* Per-processor information (flags, cpuinfo, stats, tss, task, stack) */
 #define CPU_DATA_BASE           0xc1000000
 #define CPU_DATA_SIZE           0x10000
+#define CPU_DATA_NR             256     /* Must be equal to MAX_PROCESSORS */
 #define CPU_STACK_GUARD         0x10
+#define CPU_XSAVE_OFFSET        0x24    /* xsave (struct cpu_data) */
 #define CPU_TSS_SIZE            104 /* sizeof(struct tss) */
 #define CPU_TSS_OFFSET          (0x30 + IDT_NR * 8) /* struct tss */
 #define CPU_CUR_TASK_OFFSET     (CPU_TSS_OFFSET + CPU_TSS_SIZE) /* cur_task */
@@ -69,6 +71,10 @@
 #define TASK_XREGS  24
 /* TSS */
 #define TSS_SP0     4
+/* Instructions to save the extended states (CPU_XSAVE_OFFSET) */
+#define XSAVE_XSAVE     0
+#define XSAVE_XSAVEOPT  1
+#define XSAVE_XSAVES    2
 
 
 /* Trampoline: 0x70 (0x70000) */
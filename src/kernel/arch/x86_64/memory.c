@@ -22,7 +22,9 @@
  */
 
 #include <aos/const.h>
+#include <machine/sysarch.h>
 #include "arch.h"
+#include "apic.h"
 #include "memory.h"
 #include "../../kernel.h"
 
@@ -38,6 +40,10 @@
 #define VMEM_PT(a)              (u64 *)((a) & 0x7ffffffffffff000ULL)
 #define VMEM_PDPG(a)            (void *)((a) & 0x7fffffffffe00000ULL)
 
+/* Limits of the context-switch benchmark */
+#define SWITCH_BENCH_MAX_PAGES  1024
+#define SWITCH_BENCH_MAX_ITERS  1000000
+
 /* Type of memory area */
 #define BSE_USABLE              1
 #define BSE_RESERVED            2
@@ -68,6 +74,19 @@ static void * _find_pmem_region(struct bootinfo *, u64 );
 static __inline__ int _pmem_page_zone(void *, int);
 static void _enable_page_global(void);
 static void _disable_page_global(void);
+static void _vmem_invalidate(struct arch_vmem_space *, void *);
+static u16 _pcid_alloc(void);
+
+/*
+ * Process-context identifiers: PCID 0 is used by the kernel and by the
+ * address spaces created after the identifiers are exhausted, so that a CR3
+ * load without the no-flush bit keeps flushing them.
+ */
+static int pcid_on;
+static int pcid_invpcid;
+static u16 pcid_next = 1;
+static spinlock_t pcid_lock;
+static struct spinlock_stat pcid_lock_stat;
 
 
 /*
@@ -114,6 +133,8 @@ arch_memory_init(struct bootinfo *bi, struct acpi *acpi)
     if ( NULL == g_kmem ) {
         return -1;
     }
+    spin_lock_stat_register(&g_kmem->slab_lock_stat, "kmem.slab");
+    spin_lock_stat_register(&pcid_lock_stat, "pcid");
 
     /* Initialize the physical pages */
     ret = _pmem_init_stage2(g_kmem);
@@ -1135,7 +1156,7 @@ arch_vmem_map(struct vmem_space *space, void *vaddr, void *paddr, int flags)
         }
 
         /* Invalidate the page */
-        invlpg((void *)vaddr);
+        _vmem_invalidate(avmem, vaddr);
     } else {
         /* Page */
         /* Check the physical address argument */
@@ -1173,7 +1194,7 @@ arch_vmem_map(struct vmem_space *space, void *vaddr, void *paddr, int flags)
         }
 
         /* Invalidate the page */
-        invlpg((void *)vaddr);
+        _vmem_invalidate(avmem, vaddr);
     }
 
     return 0;
@@ -1327,6 +1348,8 @@ arch_vmem_init(struct vmem_space *space)
         return -1;
     }
     avmem->nr = VMEM_NPD;
+    avmem->pcid = _pcid_alloc();
+    kmemset((void *)avmem->tlb_stale, 0, sizeof(avmem->tlb_stale));
 
     kmemset(avmem->array, 0, sizeof(u64 *) * (VMEM_NENT(VMEM_NPD) + VMEM_NPD));
     kmemset(avmem->vls, 0, sizeof(u64 *) * VMEM_NPD);
@@ -1389,6 +1412,215 @@ arch_vmem_init(struct vmem_space *space)
     return 0;
 }
 
+/*
+ * Enable the process-context identifiers on this processor if supported; this
+ * must be called with the kernel page table (PCID 0) loaded
+ */
+int
+pcid_init(void)
+{
+    u64 rbx;
+    u64 rcx;
+    u64 rdx;
+
+    /* CPUID.01H:ECX[bit 17]: PCID */
+    cpuid(1, &rbx, &rcx, &rdx);
+    if ( !(rcx & (1ULL << 17)) ) {
+        return -1;
+    }
+    /* CPUID.(EAX=07H,ECX=0):EBX[bit 10]: INVPCID */
+    cpuid_subleaf(7, 0, &rbx, &rcx, &rdx);
+    pcid_invpcid = (rbx & (1ULL << 10)) ? 1 : 0;
+
+    set_cr4(get_cr4() | CR4_PCIDE);
+    pcid_on = 1;
+
+    return 0;
+}
+
+/*
+ * Return whether the process-context identifiers are enabled
+ */
+int
+pcid_enabled(void)
+{
+    return pcid_on;
+}
+
+/*
+ * Allocate a process-context identifier; identifiers are not recycled, and
+ * PCID 0 (untagged) is returned once they are exhausted.
+ */
+static u16
+_pcid_alloc(void)
+{
+    u16 pcid;
+
+    spin_lock_stat(&pcid_lock, &pcid_lock_stat);
+    if ( pcid_next < PCID_NR ) {
+        pcid = pcid_next++;
+    } else {
+        pcid = 0;
+    }
+    spin_unlock(&pcid_lock);
+
+    return pcid;
+}
+
+/*
+ * Get the CR3 value to switch to the virtual memory space; the TLB entries
+ * tagged with its PCID are preserved across the switch.
+ */
+void *
+arch_vmem_cr3(struct arch_vmem_space *avmem)
+{
+    if ( !pcid_on || 0 == avmem->pcid ) {
+        return avmem->pgt;
+    }
+
+    return (void *)((u64)avmem->pgt | avmem->pcid | CR3_NOFLUSH);
+}
+
+/*
+ * Invalidate a page of the virtual memory space.  The TLB entries on this
+ * processor are invalidated immediately if possible, and the other processors
+ * are marked to flush the PCID at their next switch to this space.
+ */
+static void
+_vmem_invalidate(struct arch_vmem_space *avmem, void *vaddr)
+{
+    int self;
+    u64 mask;
+    int i;
+
+    if ( !pcid_on || 0 == avmem->pcid ) {
+        /* Untagged: the entries are flushed at the next CR3 load */
+        invlpg(vaddr);
+        return;
+    }
+
+    self = lapic_id();
+    for ( i = 0; i < CPU_DATA_NR / 64; i++ ) {
+        mask = ~0ULL;
+        if ( i == self / 64 ) {
+            mask &= ~(1ULL << (self % 64));
+        }
+        atomic_or64(&avmem->tlb_stale[i], mask);
+    }
+
+    if ( pcid_invpcid ) {
+        invpcid(INVPCID_ADDR, avmem->pcid, vaddr);
+    } else if ( ((u64)get_cr3() & CR3_PCID_MASK) == avmem->pcid ) {
+        invlpg(vaddr);
+    } else {
+        atomic_or64(&avmem->tlb_stale[self / 64], 1ULL << (self % 64));
+    }
+}
+
+/*
+ * Flush the stale TLB entries of the virtual memory space of the next task on
+ * this processor; called before the CR3 of the task is loaded
+ */
+void
+pcid_switch(struct arch_task *t)
+{
+    struct arch_vmem_space *avmem;
+    int self;
+
+    if ( !pcid_on || NULL == t || NULL == t->ktask
+         || NULL == t->ktask->proc || NULL == t->ktask->proc->vmem ) {
+        return;
+    }
+    avmem = (struct arch_vmem_space *)t->ktask->proc->vmem->arch;
+    if ( NULL == avmem || 0 == avmem->pcid ) {
+        return;
+    }
+
+    self = lapic_id();
+    if ( !atomic_test_and_clear_bit(&avmem->tlb_stale[self / 64],
+                                    self % 64) ) {
+        return;
+    }
+    if ( pcid_invpcid ) {
+        invpcid(INVPCID_CTX, avmem->pcid, NULL);
+    } else {
+        /* Load the CR3 without the no-flush bit to flush the PCID */
+        set_cr3((u64)avmem->pgt | avmem->pcid);
+    }
+}
+
+/*
+ * Ping-pong the CR3 between the kernel and the current process and touch the
+ * pages of the buffer after each switch, with and without flushing the TLB
+ */
+int
+arch_switch_bench(struct sysarch_switch_bench *bench)
+{
+    struct arch_task *t;
+    struct vmem_space *vmem;
+    struct arch_vmem_space *avmem;
+    u64 kcr3;
+    u64 ucr3;
+    u64 tsc;
+    long long i;
+    long long j;
+    volatile u8 *p;
+
+    if ( bench->npages <= 0 || bench->npages > SWITCH_BENCH_MAX_PAGES
+         || bench->iters <= 0 || bench->iters > SWITCH_BENCH_MAX_ITERS ) {
+        return -1;
+    }
+    t = this_cpu()->cur_task;
+    if ( NULL == t || NULL == t->ktask->proc ) {
+        return -1;
+    }
+    vmem = t->ktask->proc->vmem;
+    avmem = (struct arch_vmem_space *)vmem->arch;
+
+    /* All the pages must be mapped to the current process */
+    p = bench->buf;
+    for ( j = 0; j < bench->npages; j++ ) {
+        if ( NULL == arch_vmem_addr_v2p(vmem, (void *)(p + j * PAGESIZE)) ) {
+            return -1;
+        }
+    }
+
+    kcr3 = (u64)((struct arch_kmem_space *)g_kmem->space->arch)->cr3;
+    ucr3 = (u64)avmem->pgt | (pcid_on ? avmem->pcid : 0);
+
+    /* Flush on every switch */
+    tsc = rdtsc();
+    for ( i = 0; i < bench->iters; i++ ) {
+        set_cr3(kcr3);
+        set_cr3(ucr3);
+        for ( j = 0; j < bench->npages; j++ ) {
+            (void)p[j * PAGESIZE];
+        }
+    }
+    bench->flush_cycles = (rdtsc() - tsc) / bench->iters;
+
+    /* Preserve the TLB entries tagged with the PCID of the process; the
+       kernel pages are global and survive the loads of the kernel CR3 */
+    if ( pcid_on && 0 != avmem->pcid ) {
+        ucr3 |= CR3_NOFLUSH;
+    }
+    tsc = rdtsc();
+    for ( i = 0; i < bench->iters; i++ ) {
+        set_cr3(kcr3);
+        set_cr3(ucr3);
+        for ( j = 0; j < bench->npages; j++ ) {
+            (void)p[j * PAGESIZE];
+        }
+    }
+    bench->noflush_cycles = (rdtsc() - tsc) / bench->iters;
+    bench->pcid = pcid_on ? avmem->pcid : 0;
+
+    /* Restore the CR3 of the current task */
+    set_cr3(t->cr3);
+
+    return 0;
+}
+
 /*
  * Local variables:
  * tab-width: 4
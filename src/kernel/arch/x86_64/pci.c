@@ -0,0 +1,258 @@
+/*_
+ * Copyright (c) 2017 Hirochika Asai <asai@jar.jp>
+ * All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include <aos/const.h>
+#include "arch.h"
+#include "acpi.h"
+#include "pci.h"
+
+/*
+ * Check if the ECAM window is reachable through the boot strap page table,
+ * i.e., identity-mapped below 4 GiB and not overlapping with the region the
+ * kernel is relocated to.
+ */
+static int
+_ecam_reachable(u64 base, int start, int end)
+{
+    u64 lo;
+    u64 hi;
+
+    if ( !base ) {
+        return 0;
+    }
+    lo = base + (u64)start * PCI_ECAM_BUS_SIZE;
+    hi = base + (u64)(end + 1) * PCI_ECAM_BUS_SIZE;
+    if ( hi > 0x100000000ULL ) {
+        return 0;
+    }
+    if ( lo < KERNEL_BASE + PMEM_LBOUND && hi > KERNEL_BASE ) {
+        return 0;
+    }
+
+    return 1;
+}
+
+/*
+ * Read a 32-bit register in the configuration space through ECAM if
+ * available, otherwise through the legacy I/O ports
+ */
+static u32
+_read_config(struct sysdriver_pci_table *tbl, int bus, int slot, int func,
+             int off)
+{
+    u64 addr;
+
+    if ( tbl->ecam ) {
+        addr = tbl->ecam_base + (u64)bus * PCI_ECAM_BUS_SIZE
+            + ((u64)slot << 15) + ((u64)func << 12) + (off & 0xffc);
+        return *(volatile u32 *)addr;
+    }
+    if ( off >= PCI_EXT_CONFIG_BASE ) {
+        /* The extended configuration space is not reachable. */
+        return 0xffffffff;
+    }
+    outl(PCI_CONFIG_ADDR, 0x80000000 | ((u32)bus << 16) | ((u32)slot << 11)
+         | ((u32)func << 8) | (off & 0xfc));
+
+    return inl(PCI_CONFIG_DATA);
+}
+
+/*
+ * Find a capability in the capability list
+ */
+static int
+_find_cap(struct sysdriver_pci_table *tbl, int bus, int slot, int func,
+          int id)
+{
+    u32 reg;
+    int ptr;
+    int i;
+
+    /* Check the capabilities list bit in the status register */
+    reg = _read_config(tbl, bus, slot, func, 0x04);
+    if ( !((reg >> 16) & 0x10) ) {
+        return 0;
+    }
+    ptr = _read_config(tbl, bus, slot, func, 0x34) & 0xfc;
+    /* Bound the number of entries not to loop on a broken list */
+    for ( i = 0; i < 48 && ptr >= 0x40; i++ ) {
+        reg = _read_config(tbl, bus, slot, func, ptr);
+        if ( (int)(reg & 0xff) == id ) {
+            return ptr;
+        }
+        ptr = (reg >> 8) & 0xfc;
+    }
+
+    return 0;
+}
+
+/*
+ * Find an extended capability in the extended configuration space
+ */
+static int
+_find_ext_cap(struct sysdriver_pci_table *tbl, int bus, int slot, int func,
+              int id)
+{
+    u32 reg;
+    int ptr;
+    int i;
+
+    if ( !tbl->ecam ) {
+        return 0;
+    }
+    ptr = PCI_EXT_CONFIG_BASE;
+    for ( i = 0; i < 480 && ptr >= PCI_EXT_CONFIG_BASE; i++ ) {
+        reg = _read_config(tbl, bus, slot, func, ptr);
+        if ( 0 == reg || 0xffffffff == reg ) {
+            break;
+        }
+        if ( (int)(reg & 0xffff) == id ) {
+            return ptr;
+        }
+        ptr = (reg >> 20) & 0xffc;
+    }
+
+    return 0;
+}
+
+/*
+ * Add a function to the table
+ */
+static void
+_add_function(struct sysdriver_pci_table *tbl, int bus, int slot, int func)
+{
+    struct sysdriver_pci_dev *dev;
+    u32 reg;
+
+    if ( tbl->ndevs >= SYSDRIVER_PCI_MAX_DEVS ) {
+        /* Table is full */
+        return;
+    }
+    dev = &tbl->devs[tbl->ndevs];
+
+    dev->bus = bus;
+    dev->slot = slot;
+    dev->func = func;
+    reg = _read_config(tbl, bus, slot, func, 0x00);
+    dev->vendor_id = reg & 0xffff;
+    dev->device_id = reg >> 16;
+    reg = _read_config(tbl, bus, slot, func, 0x08);
+    dev->revision = reg & 0xff;
+    dev->progif = (reg >> 8) & 0xff;
+    dev->subclass = (reg >> 16) & 0xff;
+    dev->class = reg >> 24;
+    reg = _read_config(tbl, bus, slot, func, 0x0c);
+    dev->hdr_type = (reg >> 16) & 0xff;
+    reg = _read_config(tbl, bus, slot, func, 0x3c);
+    dev->intr_line = reg & 0xff;
+    dev->intr_pin = (reg >> 8) & 0xff;
+
+    /* Capabilities */
+    dev->msi_cap = _find_cap(tbl, bus, slot, func, PCI_CAP_ID_MSI);
+    dev->msix_cap = _find_cap(tbl, bus, slot, func, PCI_CAP_ID_MSIX);
+    dev->sriov_cap = _find_ext_cap(tbl, bus, slot, func, PCI_EXT_CAP_ID_SRIOV);
+    dev->aer_cap = _find_ext_cap(tbl, bus, slot, func, PCI_EXT_CAP_ID_AER);
+    dev->ari_cap = _find_ext_cap(tbl, bus, slot, func, PCI_EXT_CAP_ID_ARI);
+
+    tbl->ndevs++;
+}
+
+/*
+ * Enumerate all PCI functions once at boot and store them into the table.
+ * This must be called while the boot strap page table is active because the
+ * ECAM window is accessed through the identity mapping.
+ */
+int
+pci_enumerate(struct acpi *acpi, struct sysdriver_pci_table *tbl)
+{
+    int bus;
+    int slot;
+    int func;
+    int start;
+    int end;
+    int nfunc;
+    u32 reg;
+    u64 tsc;
+    u64 tmr0;
+    u64 tmr1;
+    int tmr;
+
+    kmemset(tbl, 0, sizeof(struct sysdriver_pci_table));
+    tbl->ecam_base = acpi->acpi_mcfg_base;
+    tbl->ecam_start_bus = acpi->acpi_mcfg_start_bus;
+    tbl->ecam_end_bus = acpi->acpi_mcfg_end_bus;
+    if ( _ecam_reachable(tbl->ecam_base, tbl->ecam_start_bus,
+                         tbl->ecam_end_bus) ) {
+        tbl->ecam = 1;
+        start = tbl->ecam_start_bus;
+        end = tbl->ecam_end_bus;
+    } else {
+        start = 0;
+        end = 255;
+    }
+
+    tmr = (0 == acpi_timer_available(acpi));
+    tmr0 = tmr ? acpi_get_timer(acpi) : 0;
+    tsc = rdtsc();
+
+    for ( bus = start; bus <= end; bus++ ) {
+        for ( slot = 0; slot < 32; slot++ ) {
+            reg = _read_config(tbl, bus, slot, 0, 0x00);
+            if ( 0xffff == (reg & 0xffff) ) {
+                continue;
+            }
+            /* Multi-function device? */
+            reg = _read_config(tbl, bus, slot, 0, 0x0c);
+            nfunc = (reg & (0x80 << 16)) ? 8 : 1;
+            for ( func = 0; func < nfunc; func++ ) {
+                reg = _read_config(tbl, bus, slot, func, 0x00);
+                if ( 0xffff != (reg & 0xffff) ) {
+                    _add_function(tbl, bus, slot, func);
+                }
+            }
+        }
+    }
+
+    /* Boot-time enumeration latency */
+    tbl->enum_cycles = rdtsc() - tsc;
+    if ( tmr ) {
+        tmr1 = acpi_get_timer(acpi);
+        if ( tmr1 < tmr0 ) {
+            /* Overflow */
+            tmr1 += acpi_get_timer_period(acpi);
+        }
+        tbl->enum_usec = (tmr1 - tmr0) * 1000000 / acpi_get_timer_hz();
+    }
+
+    return tbl->ndevs;
+}
+
+/*
+ * Local variables:
+ * tab-width: 4
+ * c-basic-offset: 4
+ * End:
+ * vim600: sw=4 ts=4 fdm=marker
+ * vim<600: sw=4 ts=4
+ */
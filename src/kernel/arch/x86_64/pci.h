@@ -0,0 +1,61 @@
+/*_
+ * Copyright (c) 2017 Hirochika Asai <asai@jar.jp>
+ * All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#ifndef _KERNEL_PCI_H
+#define _KERNEL_PCI_H
+
+#include <aos/const.h>
+#include <aos/types.h>
+#include <mki/driver.h>
+#include "const.h"
+#include "acpi.h"
+
+#define PCI_CONFIG_ADDR         0xcf8
+#define PCI_CONFIG_DATA         0xcfc
+
+/* Capability IDs */
+#define PCI_CAP_ID_MSI          0x05
+#define PCI_CAP_ID_MSIX         0x11
+/* Extended capability IDs */
+#define PCI_EXT_CAP_ID_AER      0x0001
+#define PCI_EXT_CAP_ID_ARI      0x000e
+#define PCI_EXT_CAP_ID_SRIOV    0x0010
+
+/* Offset to the extended configuration space */
+#define PCI_EXT_CONFIG_BASE     0x100
+/* Size of the configuration space of a bus in the ECAM window */
+#define PCI_ECAM_BUS_SIZE       (1ULL << 20)
+
+int pci_enumerate(struct acpi *, struct sysdriver_pci_table *);
+
+#endif /* _KERNEL_PCI_H */
+
+/*
+ * Local variables:
+ * tab-width: 4
+ * c-basic-offset: 4
+ * End:
+ * vim600: sw=4 ts=4 fdm=marker
+ * vim<600: sw=4 ts=4
+ */
@@ -26,11 +26,77 @@
 #include "arch.h"
 #include "memory.h"
 
-#define XSAVE_SIZE  4096
+/* Size of the XSAVE area; sized from CPUID by xsave_init() */
+static u64 xsave_size = 4096;
+/* State components enabled in XCR0 */
+static u64 xsave_xcr0 = XCR0_X87;
+
+static void _xsave_area_init(void *);
 
 /* Kernel memory */
 //extern struct kmem *g_kmem;
 
+/*
+ * Enable the extended states on this processor and select the instruction to
+ * save them on task switches: XSAVES or XSAVEOPT skip the components in their
+ * initial state and those not modified since the last restore.
+ */
+int
+xsave_init(void)
+{
+    u64 rax;
+    u64 rbx;
+    u64 rcx;
+    u64 rdx;
+    u64 xcr0;
+    struct cpu_data *pdata;
+
+    /* CPUID.01H:ECX[bit 26]: XSAVE */
+    cpuid(1, &rbx, &rcx, &rdx);
+    if ( !(rcx & (1ULL << 26)) ) {
+        return -1;
+    }
+    set_cr4(get_cr4() | CR4_OSXSAVE);
+
+    /* Enable x87, SSE and AVX states if supported */
+    rax = cpuid_subleaf(0xd, 0, &rbx, &rcx, &rdx);
+    xcr0 = rax & (XCR0_X87 | XCR0_SSE | XCR0_AVX);
+    xsetbv(0, xcr0);
+    xsave_xcr0 = xcr0;
+
+    /* CPUID.(EAX=0DH,ECX=0):EBX: Size for the components enabled in XCR0 */
+    rax = cpuid_subleaf(0xd, 0, &rbx, &rcx, &rdx);
+    xsave_size = rbx;
+
+    pdata = this_cpu();
+    pdata->xsave = XSAVE_XSAVE;
+    /* CPUID.(EAX=0DH,ECX=1):EAX[bit 0]: XSAVEOPT; [bit 3]: XSAVES */
+    rax = cpuid_subleaf(0xd, 1, &rbx, &rcx, &rdx);
+    if ( rax & (1ULL << 3) ) {
+        /* Compacted format; EBX: Size for the components in XCR0 | XSS */
+        pdata->xsave = XSAVE_XSAVES;
+        xsave_size = rbx;
+    } else if ( rax & (1ULL << 0) ) {
+        pdata->xsave = XSAVE_XSAVEOPT;
+    }
+
+    return 0;
+}
+
+/*
+ * Initialize an XSAVE area so that restoring it puts all the components in
+ * their initial state
+ */
+static void
+_xsave_area_init(void *xregs)
+{
+    kmemset(xregs, 0, xsave_size);
+    if ( XSAVE_XSAVES == this_cpu()->xsave ) {
+        /* XCOMP_BV in the XSAVE header must be valid for XRSTORS */
+        *(u64 *)((u64)xregs + 520) = XCOMP_BV_COMPACT | xsave_xcr0;
+    }
+}
+
 /*
  * Create a new task
  */
@@ -45,13 +111,12 @@ task_new(void)
         return NULL;
     }
     /* Create a space for FPU/SSE registers */
-    t->xregs = kmalloc(XSAVE_SIZE);
+    t->xregs = kmalloc(xsave_size);
     if ( NULL == t->xregs ) {
         kfree(t);
         return NULL;
     }
-    kmemset(t->xregs, 0, XSAVE_SIZE);
-    //xsave(t->xregs, 5, 0);
+    _xsave_area_init(t->xregs);
     /* Allocate the kernel task structure of a new task */
     t->kstack = kmalloc(KSTACK_SIZE);
     if ( NULL == t->kstack ) {
@@ -114,12 +179,12 @@ task_create(struct proc *proc, void *(*restart_point)(void *), void *args)
         return NULL;
     }
     /* Create a space for FPU/SSE registers */
-    t->xregs = kmalloc(XSAVE_SIZE);
+    t->xregs = kmalloc(xsave_size);
     if ( NULL == t->xregs ) {
         kfree(t);
         return NULL;
     }
-    kmemset(t->xregs, 0, XSAVE_SIZE);
+    _xsave_area_init(t->xregs);
     /* Allocate the kernel task structure of a new task */
     t->kstack = kmalloc(KSTACK_SIZE);
     if ( NULL == t->kstack ) {
@@ -187,7 +252,7 @@ task_create(struct proc *proc, void *(*restart_point)(void *), void *args)
     t->rp->ip = (u64)restart_point;
     t->rp->flags = 0x3202;
 
-    t->cr3 = ((struct arch_vmem_space *)proc->vmem->arch)->pgt;
+    t->cr3 = arch_vmem_cr3((struct arch_vmem_space *)proc->vmem->arch);
     t->sp0 = (u64)t->kstack + KSTACK_SIZE - 16;
 
     /* Return */
@@ -236,14 +301,13 @@ proc_fork(struct proc *op, struct ktask *ot, struct ktask **ntp)
         return NULL;
     }
     /* Create a space for FPU/SSE registers */
-    t->xregs = kmalloc(XSAVE_SIZE);
+    t->xregs = kmalloc(xsave_size);
     if ( NULL == t->xregs ) {
         kfree(t);
         kfree(np);
         return NULL;
     }
-    kmemset(t->xregs, 0, XSAVE_SIZE);
-    kmemcpy(t->xregs, ((struct arch_task *)ot->arch)->xregs, XSAVE_SIZE);
+    kmemcpy(t->xregs, ((struct arch_task *)ot->arch)->xregs, xsave_size);
     /* Allocate the kernel task structure of a new task */
     t->kstack = kmalloc(KSTACK_SIZE);
     if ( NULL == t->kstack ) {
@@ -380,7 +444,7 @@ proc_fork(struct proc *op, struct ktask *ot, struct ktask **ntp)
     }
     kmemcpy(ustack2copy, ((struct arch_task *)ot->arch)->ustack, USTACK_SIZE);
 
-    set_cr3(((struct arch_vmem_space *)np->vmem->arch)->pgt);
+    set_cr3(arch_vmem_cr3((struct arch_vmem_space *)np->vmem->arch));
 
     /* Copy the program memory */
     kmemcpy((void *)CODE_INIT, exec, size);
@@ -396,7 +460,7 @@ proc_fork(struct proc *op, struct ktask *ot, struct ktask **ntp)
     /* Free the temporary buffers */
     kfree(exec);
 
-    t->cr3 = ((struct arch_vmem_space *)np->vmem->arch)->pgt;
+    t->cr3 = arch_vmem_cr3((struct arch_vmem_space *)np->vmem->arch);
     t->sp0 = (u64)t->kstack + KSTACK_SIZE - 16;
 
     /* Return */
@@ -423,13 +487,12 @@ task_create_idle(void)
     t->cr3 = ((struct arch_kmem_space *)g_kmem->space->arch)->cr3;
 
     /* Create a space for FPU/SSE registers */
-    t->xregs = kmalloc(XSAVE_SIZE);
+    t->xregs = kmalloc(xsave_size);
     if ( NULL == t->xregs ) {
         kfree(t);
         return NULL;
     }
-    kmemset(t->xregs, 0, XSAVE_SIZE);
-    //xsave(t->xregs, 5, 0);
+    _xsave_area_init(t->xregs);
 
     /* Kernel stack */
     t->kstack = kmalloc(KSTACK_SIZE);
@@ -563,12 +626,11 @@ proc_create(const char *path, const char *name, pid_t pid)
     kmemset(t, 0, sizeof(struct arch_task));
 
     /* Create a space for FPU/SSE registers */
-    t->xregs = kmalloc(XSAVE_SIZE);
+    t->xregs = kmalloc(xsave_size);
     if ( NULL == t->xregs ) {
         goto error_task;
     }
-    kmemset(t->xregs, 0, XSAVE_SIZE);
-    //xsave(t->xregs, 5, 0);
+    _xsave_area_init(t->xregs);
 
     /* Create a task */
     t->ktask = kmalloc(sizeof(struct ktask));
@@ -631,7 +693,7 @@ proc_create(const char *path, const char *name, pid_t pid)
     /* Temporary set the page table to the user's one to copy the exec file from
        kernel to the user space */
     saved_cr3 = get_cr3();
-    set_cr3(((struct arch_vmem_space *)proc->vmem->arch)->pgt);
+    set_cr3(arch_vmem_cr3((struct arch_vmem_space *)proc->vmem->arch));
 
     /* Copy the program from the initramfs to user space */
     (void)kmemcpy(exec, (void *)(KMEM_P2V(INITRAMFS_BASE) + offset), size);
@@ -687,7 +749,7 @@ proc_create(const char *path, const char *name, pid_t pid)
     t->rp->cs = cs;
     t->rp->ip = CODE_INIT;
     t->rp->flags = flags;
-    t->cr3 = ((struct arch_vmem_space *)proc->vmem->arch)->pgt;
+    t->cr3 = arch_vmem_cr3((struct arch_vmem_space *)proc->vmem->arch);
 
     return 0;
 
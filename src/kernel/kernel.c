@@ -50,6 +50,9 @@ kinit(void)
     /* Initialize devfs */
     g_devfs.head = NULL;
 
+    /* Initialize named shared memory */
+    g_pixshm = NULL;
+
     /* Setup system calls */
     for ( i = 0; i < SYS_MAXSYSCALL; i++ ) {
         g_syscall_table[i] = NULL;
@@ -78,8 +81,10 @@ kinit(void)
     g_syscall_table[SYS_pix_cpu_table] = sys_pix_cpu_table;
     g_syscall_table[SYS_pix_create_job] = sys_pix_create_job;
     g_syscall_table[SYS_pix_malloc] = sys_pix_malloc;
+    g_syscall_table[SYS_pix_shm] = sys_pix_shm;
     /* Others */
     g_syscall_table[SYS_xpsleep] = sys_xpsleep;
+    g_syscall_table[SYS_xpwait] = sys_xpwait;
     g_syscall_table[SYS_debug] = sys_debug;
     g_syscall_table[SYS_driver] = sys_driver;
     g_syscall_table[SYS_sysarch] = sys_sysarch;
@@ -33,6 +33,7 @@
 #include <time.h>
 #include <sys/pix.h>
 #include <mki/driver.h>
+#include <machine/sysarch.h>
 #include <signal.h>
 
 /* Architecture-specific configuration */
@@ -61,6 +62,7 @@
 #define g_devfs         g_kvar->devfs
 #define g_boottime      g_kvar->boottime
 #define g_timesync      g_kvar->timesync
+#define g_pixshm        g_kvar->pixshm
 
 #define FLOOR(val, base)        (((val) / (base)) * (base))
 #define CEIL(val, base)         ((((val) - 1) / (base) + 1) * (base))
@@ -176,6 +178,9 @@
 #define IV_CRASH                0xfe
 #define NR_IV                   0x100
 #define IV_IRQ(n)               (0x20 + (n))
+/* Vectors allocated to MSI/MSI-X (from those for driver use) */
+#define IV_MSI(n)               (0x50 + (n))
+#define NR_IV_MSI               16
 
 
 #define ENOENT                  2
@@ -447,6 +452,21 @@ struct pmem_proto {
     void (*free_pages)(void *page);
 };
 
+/*
+ * Contention statistics of a spinlock
+ */
+struct spinlock_stat {
+    const char *name;
+    /* The number of acquisitions, and those that had to wait */
+    u64 acquisitions;
+    u64 contentions;
+    /* The number of spins and the longest wait (in TSC cycles) */
+    u64 spins;
+    u64 max_wait;
+    /* Next registered statistics */
+    struct spinlock_stat *next;
+};
+
 /*
  * Physical memory
  */
@@ -527,6 +547,7 @@ struct kmem {
     /* Lock */
     spinlock_t lock;
     spinlock_t slab_lock;
+    struct spinlock_stat slab_lock_stat;
 
     /* Slab allocator */
     struct kmem_slab_root slab;
@@ -696,6 +717,19 @@ struct devfs {
     //struct vfs_interface vif;
 };
 
+/*
+ * Named shared memory
+ */
+struct pix_shm {
+    /* Name of the shared memory */
+    char name[PIX_SHM_NAMELEN];
+    /* Physical address and length */
+    void *paddr;
+    size_t len;
+    /* Pointer to the next entry */
+    struct pix_shm *next;
+};
+
 /*
  * Kernel timer
  */
@@ -794,6 +828,8 @@ struct kernel_variables {
     struct clock_devices *clkdevs;
     /* devfs */
     struct devfs devfs;
+    /* Named shared memory */
+    struct pix_shm *pixshm;
 };
 
 
@@ -902,8 +938,10 @@ int sys_gettimeofday(struct timeval *__restrict__, void *__restrict__);
 int sys_pix_cpu_table(int, struct syspix_cpu_table *);
 int sys_pix_create_job(int, void *(*)(void *), void *);
 int sys_pix_malloc(size_t, void **, void **);
+int sys_pix_shm(int, struct syspix_shm *);
 /* Others */
 void sys_xpsleep(void);
+int sys_xpwait(volatile u64 *, u64);
 void sys_debug(int);
 int sys_driver(int, void *);
 int sys_sysarch(int, void *);
@@ -927,8 +965,11 @@ struct ktask *task_create(struct proc *, void *(*)(void *), void *);
 struct proc * proc_fork(struct proc *, struct ktask *, struct ktask **);
 void task_set_return(struct ktask *, unsigned long long);
 pid_t sys_fork(void);
-void spin_lock(u32 *);
+u64 spin_lock(u32 *);
+int spin_trylock(u32 *);
 void spin_unlock(u32 *);
+void spin_lock_stat(spinlock_t *, struct spinlock_stat *);
+void spin_lock_stat_register(struct spinlock_stat *, const char *);
 int arch_vmem_map(struct vmem_space *, void *, void *, int);
 int arch_kmem_map(struct kmem *, void *, void *, int);
 int arch_kmem_unmap(struct kmem *, void *);
@@ -941,6 +982,12 @@ void arch_switch_page_table(struct vmem_space *);
 
 int arch_load_cpu_table(struct syspix_cpu_table *);
 int arch_store_cpu_table(struct syspix_cpu_table *);
+int arch_msi_message(int, int, u64 *, u32 *);
+int arch_pci_table(struct sysdriver_pci_table *);
+int arch_switch_bench(struct sysarch_switch_bench *);
+int arch_lock_stats(struct sysarch_lock_stats *);
+void arch_lock_stats_clear(void);
+int arch_xpwait(volatile u64 *, u64);
 
 /* in clock.c */
 u64 clock_usec(void);
@@ -115,7 +115,7 @@ _kmalloc_slab(struct kmem *kmem, size_t o, int zone)
     }
 
     /* Lock */
-    spin_lock(&kmem->slab_lock);
+    spin_lock_stat(&kmem->slab_lock, &kmem->slab_lock_stat);
 
     /* Small object: Slab allocator */
     if ( NULL != kmem->slab.gslabs[zone][o].partial ) {
@@ -300,7 +300,7 @@ _kmalloc_pages(struct kmem *kmem, size_t size, int zone)
     void *ptr;
 
     /* Lock */
-    spin_lock(&kmem->slab_lock);
+    spin_lock_stat(&kmem->slab_lock, &kmem->slab_lock_stat);
 
     /* Large object: Page allocator */
     ptr = kmem_prim_alloc_superpages(kmem, DIV_CEIL(size, SUPERPAGESIZE), zone);
@@ -335,7 +335,7 @@ kfree(void *ptr)
     int idx;
 
     /* Lock */
-    spin_lock(&g_kmem->slab_lock);
+    spin_lock_stat(&g_kmem->slab_lock, &g_kmem->slab_lock_stat);
 
     if ( 0 == ((u64)ptr % SUPERPAGESIZE) ) {
         /* Free pages */
@@ -1059,6 +1059,30 @@ sys_xpsleep(void)
     __asm__ __volatile__ ("sti;hlt");
 }
 
+/*
+ * Wait on this exclusive processor until the value at addr is changed from val
+ *
+ * SYNOPSIS
+ *      int
+ *      sys_xpwait(volatile u64 *addr, u64 val);
+ *
+ * DESCRIPTION
+ *      The sys_xpwait() function puts this exclusive processor in the
+ *      monitor/mwait state until the cache line of addr is written or an
+ *      interrupt arrives.  It returns immediately if the value at addr is not
+ *      equal to val.  Spurious wake-ups may occur, so that the caller needs to
+ *      check the condition again.
+ *
+ * RETURN VALUES
+ *      If success, sys_xpwait() returns 0.  It returns -1 if the processor
+ *      does not support monitor/mwait.
+ */
+int
+sys_xpwait(volatile u64 *addr, u64 val)
+{
+    return arch_xpwait(addr, val);
+}
+
 /*
  * Print out debug information
  */
@@ -1264,6 +1288,13 @@ sys_sysarch(int number, void *args)
     case SYSARCH_SETCR4:
         set_cr4((u64)args);
         return 0;
+    case SYSARCH_SWITCHBENCH:
+        return arch_switch_bench((struct sysarch_switch_bench *)args);
+    case SYSARCH_LOCKSTAT:
+        return arch_lock_stats((struct sysarch_lock_stats *)args);
+    case SYSARCH_LOCKSTAT_CLR:
+        arch_lock_stats_clear();
+        return 0;
     default:
         ;
     }
@@ -29,10 +29,12 @@
 #include <mki/driver.h>
 #include "kernel.h"
 
+/*
+ * Register the process to be woken up by the interrupt vector
+ */
 static int
-_sysdriver_reg_irq(struct ktask *t, struct proc *proc, void *args)
+_sysdriver_reg_vec(struct proc *proc, int vec)
 {
-    struct sysdriver_handler *s;
     struct interrupt_handler_list *e;
 
     /* Allocate for this interrupt handler */
@@ -41,10 +43,58 @@ _sysdriver_reg_irq(struct ktask *t, struct proc *proc, void *args)
         return -1;
     }
 
-    s = (struct sysdriver_handler *)args;
     e->proc = proc;
-    e->next = g_intr_table->ivt[IV_IRQ(s->nr)].handlers;
-    g_intr_table->ivt[IV_IRQ(s->nr)].handlers = e;
+    e->next = g_intr_table->ivt[vec].handlers;
+    g_intr_table->ivt[vec].handlers = e;
+
+    return 0;
+}
+
+static int
+_sysdriver_reg_irq(struct ktask *t, struct proc *proc, void *args)
+{
+    struct sysdriver_handler *s;
+
+    s = (struct sysdriver_handler *)args;
+
+    return _sysdriver_reg_vec(proc, IV_IRQ(s->nr));
+}
+
+/*
+ * Allocate a vector for MSI/MSI-X targeting a processor, and register the
+ * process for it.  Each vector is owned by one process.
+ */
+static int
+_sysdriver_reg_msi(struct ktask *t, struct proc *proc, void *args)
+{
+    struct sysdriver_msi *msi;
+    u64 addr;
+    u32 data;
+    int vec;
+    int i;
+
+    msi = (struct sysdriver_msi *)args;
+
+    /* Find a free vector */
+    vec = -1;
+    for ( i = 0; i < NR_IV_MSI; i++ ) {
+        if ( NULL == g_intr_table->ivt[IV_MSI(i)].handlers ) {
+            vec = IV_MSI(i);
+            break;
+        }
+    }
+    if ( vec < 0 ) {
+        return -1;
+    }
+    if ( arch_msi_message(msi->cpu, vec, &addr, &data) < 0 ) {
+        return -1;
+    }
+    if ( _sysdriver_reg_vec(proc, vec) < 0 ) {
+        return -1;
+    }
+    msi->vec = vec;
+    msi->addr = addr;
+    msi->data = data;
 
     return 0;
 }
@@ -207,6 +257,10 @@ sys_driver(int number, void *args)
         /* Register an IRQ handler */
         return _sysdriver_reg_irq(t, proc, args);
 
+    case SYSDRIVER_REG_MSI:
+        /* Register an MSI/MSI-X vector */
+        return _sysdriver_reg_msi(t, proc, args);
+
     case SYSDRIVER_MMAP:
         return _sysdriver_mmap(t, proc, args);
 
@@ -216,6 +270,10 @@ sys_driver(int number, void *args)
     case SYSDRIVER_INTERRUPT:
         return _sysdriver_interrupt(t, proc, args);
 
+    case SYSDRIVER_PCI_TABLE:
+        /* Copy the cached PCI device table */
+        return arch_pci_table(args);
+
     default:
         ;
     }
@@ -133,6 +133,158 @@ sys_pix_create_job(int cpuid, void *(*start_routine)(void *), void *args)
     return 0;
 }
 
+/*
+ * Search a named shared memory
+ */
+static struct pix_shm *
+_pix_shm_search(const char *name)
+{
+    struct pix_shm *e;
+
+    e = g_pixshm;
+    while ( NULL != e ) {
+        if ( 0 == kstrncmp(e->name, name, PIX_SHM_NAMELEN) ) {
+            return e;
+        }
+        e = e->next;
+    }
+
+    return NULL;
+}
+
+/*
+ * Map a named shared memory to the virtual memory of the process
+ */
+static void *
+_pix_shm_map(struct proc *proc, struct pix_shm *e)
+{
+    void *vaddr;
+    ssize_t i;
+    int order;
+    int ret;
+
+    /* Allocate virtual memory */
+    order = bitwidth(DIV_CEIL(e->len, SUPERPAGESIZE));
+    vaddr = vmem_buddy_alloc_superpages(proc->vmem, order);
+    if ( NULL == vaddr ) {
+        return NULL;
+    }
+
+    for ( i = 0; i < (ssize_t)DIV_CEIL(e->len, SUPERPAGESIZE); i++ ) {
+        ret = arch_vmem_map(proc->vmem,
+                            (void *)(vaddr + SUPERPAGESIZE * i),
+                            e->paddr + SUPERPAGESIZE * i,
+                            VMEM_USABLE | VMEM_USED | VMEM_SUPERPAGE);
+        if ( ret < 0 ) {
+            vmem_free_pages(proc->vmem, vaddr);
+            return NULL;
+        }
+    }
+
+    return vaddr;
+}
+
+/*
+ * Create a named shared memory
+ */
+static int
+_pix_shm_create(struct proc *proc, struct syspix_shm *shm)
+{
+    struct pix_shm *e;
+    int order;
+
+    if ( NULL == shm->name || 0 == shm->len ) {
+        return -1;
+    }
+    /* Check the duplicate */
+    if ( NULL != _pix_shm_search(shm->name) ) {
+        return -1;
+    }
+
+    /* Allocate an entry */
+    e = kmalloc(sizeof(struct pix_shm));
+    if ( NULL == e ) {
+        return -1;
+    }
+    kstrlcpy(e->name, shm->name, PIX_SHM_NAMELEN);
+    e->len = shm->len;
+
+    /* Allocate physical memory */
+    order = bitwidth(DIV_CEIL(shm->len, SUPERPAGESIZE));
+    e->paddr = pmem_prim_alloc_superpages(PMEM_ZONE_LOWMEM, order);
+    if ( NULL == e->paddr ) {
+        kfree(e);
+        return -1;
+    }
+
+    /* Map it to the creator */
+    shm->vaddr = _pix_shm_map(proc, e);
+    if ( NULL == shm->vaddr ) {
+        pmem_prim_free_pages(e->paddr);
+        kfree(e);
+        return -1;
+    }
+
+    /* Prepend this entry */
+    e->next = g_pixshm;
+    g_pixshm = e;
+
+    return 0;
+}
+
+/*
+ * Attach a named shared memory
+ */
+static int
+_pix_shm_attach(struct proc *proc, struct syspix_shm *shm)
+{
+    struct pix_shm *e;
+
+    if ( NULL == shm->name ) {
+        return -1;
+    }
+    e = _pix_shm_search(shm->name);
+    if ( NULL == e ) {
+        return -1;
+    }
+
+    shm->vaddr = _pix_shm_map(proc, e);
+    if ( NULL == shm->vaddr ) {
+        return -1;
+    }
+    shm->len = e->len;
+
+    return 0;
+}
+
+/*
+ * Create/attach a named shared memory, e.g., for statistics
+ */
+int
+sys_pix_shm(int req, struct syspix_shm *shm)
+{
+    struct ktask *t;
+    struct proc *proc;
+
+    /* Get the current process */
+    t = this_ktask();
+    if ( NULL == t || NULL == t->proc ) {
+        return -1;
+    }
+    proc = t->proc;
+
+    switch ( req ) {
+    case SYSPIX_SHM_CREATE:
+        return _pix_shm_create(proc, shm);
+    case SYSPIX_SHM_ATTACH:
+        return _pix_shm_attach(proc, shm);
+    default:
+        ;
+    }
+
+    return -1;
+}
+
 /*
  * Local variables:
  * tab-width: 4
@@ -43,6 +43,28 @@ driver_register_irq_handler(int irq, void *func)
     return syscall(SYS_driver, SYSDRIVER_REG_IRQ, &handler);
 }
 
+/*
+ * Allocate an MSI/MSI-X vector delivered to the processor of the local APIC ID
+ * cpu, and register the process to be woken up by it.  Returns the vector and
+ * the message, or -1 on failure.
+ */
+int
+driver_register_msi_handler(int cpu, uint64_t *addr, uint32_t *data)
+{
+    struct sysdriver_msi msi;
+    int ret;
+
+    msi.cpu = cpu;
+    ret = syscall(SYS_driver, SYSDRIVER_REG_MSI, &msi);
+    if ( ret < 0 ) {
+        return -1;
+    }
+    *addr = msi.addr;
+    *data = msi.data;
+
+    return msi.vec;
+}
+
 /*
  * Register a device to devfs
  */
@@ -92,6 +114,15 @@ driver_interrupt(struct driver_mapped_device *dev)
     syscall(SYS_driver, SYSDRIVER_INTERRUPT, dev);
 }
 
+/*
+ * Copy the PCI device table that the kernel has enumerated at boot
+ */
+int
+driver_pci_table(struct sysdriver_pci_table *tbl)
+{
+    return syscall(SYS_driver, SYSDRIVER_PCI_TABLE, tbl);
+}
+
 /*
  * Local variables:
  * tab-width: 4
@@ -105,6 +105,49 @@ pix_malloc(size_t sz)
     return NULL;
 }
 
+/*
+ * Create a named shared memory
+ */
+void *
+pix_shm_create(const char *name, size_t len)
+{
+    struct syspix_shm shm;
+    int ret;
+
+    shm.name = name;
+    shm.len = len;
+    shm.vaddr = NULL;
+    ret = syscall(SYS_pix_shm, SYSPIX_SHM_CREATE, &shm);
+    if ( ret < 0 ) {
+        return NULL;
+    }
+
+    return shm.vaddr;
+}
+
+/*
+ * Attach a named shared memory created by another process
+ */
+void *
+pix_shm_attach(const char *name, size_t *len)
+{
+    struct syspix_shm shm;
+    int ret;
+
+    shm.name = name;
+    shm.len = 0;
+    shm.vaddr = NULL;
+    ret = syscall(SYS_pix_shm, SYSPIX_SHM_ATTACH, &shm);
+    if ( ret < 0 ) {
+        return NULL;
+    }
+    if ( NULL != len ) {
+        *len = shm.len;
+    }
+
+    return shm.vaddr;
+}
+
 /*
  * Local variables:
  * tab-width: 4
@@ -0,0 +1,231 @@
+/*_
+ * Copyright (c) 2017 Hirochika Asai <asai@jar.jp>
+ * All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../ids/fe/fdb.h"
+
+#define TEST_HOSTS      64
+#define TEST_ROUNDS     1000
+
+/*
+ * Build the FDB key of a host
+ */
+static void
+_host_key(uint8_t *key, int host)
+{
+    memset(key, 0, FDB_KEY_SIZE);
+    key[0] = 0x02;
+    key[4] = (host >> 8) & 0xff;
+    key[5] = host & 0xff;
+}
+
+/*
+ * Receive a packet from a host on a fast-path task, and return 1 if a
+ * learning request is sent.  The tickful task processes the request
+ * immediately.
+ */
+static int
+_receive(struct fdb *fdb, int host, int port)
+{
+    uint8_t key[FDB_KEY_SIZE];
+
+    _host_key(key, host);
+    if ( fdb_learn_required(fdb, key, port) ) {
+        fdb_update(fdb, key, port);
+        return 1;
+    }
+
+    return 0;
+}
+
+/*
+ * Test that the learning rate collapses to zero under steady traffic
+ */
+int
+test_learn(void)
+{
+    struct fdb *fdb;
+    int i;
+    int j;
+    int learns;
+
+    fdb = fdb_init();
+    if ( NULL == fdb ) {
+        return -1;
+    }
+
+    /* The first round learns all hosts */
+    learns = 0;
+    for ( j = 0; j < TEST_HOSTS; j++ ) {
+        learns += _receive(fdb, j, j % 4);
+    }
+    if ( TEST_HOSTS != learns ) {
+        return -1;
+    }
+
+    /* Steady traffic; no learning request at all */
+    learns = 0;
+    for ( i = 1; i < TEST_ROUNDS; i++ ) {
+        for ( j = 0; j < TEST_HOSTS; j++ ) {
+            learns += _receive(fdb, j, j % 4);
+        }
+    }
+    printf("%d requests for %d packets, ", learns,
+           (TEST_ROUNDS - 1) * TEST_HOSTS);
+    if ( 0 != learns ) {
+        return -1;
+    }
+
+    fdb_release(fdb);
+
+    return 0;
+}
+
+/*
+ * Test that a moved host is learned again
+ */
+int
+test_move(void)
+{
+    struct fdb *fdb;
+    struct fdb_entry *e;
+    uint8_t key[FDB_KEY_SIZE];
+
+    fdb = fdb_init();
+    if ( NULL == fdb ) {
+        return -1;
+    }
+
+    if ( 1 != _receive(fdb, 1, 0) || 0 != _receive(fdb, 1, 0) ) {
+        return -1;
+    }
+    /* Move to port 1 */
+    if ( 1 != _receive(fdb, 1, 1) || 0 != _receive(fdb, 1, 1) ) {
+        return -1;
+    }
+    _host_key(key, 1);
+    e = fdb_lookup(fdb, key);
+    if ( NULL == e || 1 != e->port ) {
+        return -1;
+    }
+
+    fdb_release(fdb);
+
+    return 0;
+}
+
+/*
+ * Test that only the entries hit since the last sweep survive the aging
+ */
+int
+test_aging(void)
+{
+    struct fdb *fdb;
+    struct fdb_entry *e;
+    uint8_t key[FDB_KEY_SIZE];
+    int i;
+
+    fdb = fdb_init();
+    if ( NULL == fdb ) {
+        return -1;
+    }
+
+    for ( i = 0; i < TEST_HOSTS; i++ ) {
+        _receive(fdb, i, 0);
+    }
+    /* Expire all the entries, and hit the even hosts */
+    for ( e = fdb->entries; NULL != e; e = e->next ) {
+        e->aging -= FDB_AGING_TSC + 1;
+    }
+    for ( i = 0; i < TEST_HOSTS; i += 2 ) {
+        if ( 0 != _receive(fdb, i, 0) ) {
+            return -1;
+        }
+    }
+    fdb_gc(fdb);
+
+    for ( i = 0; i < TEST_HOSTS; i++ ) {
+        _host_key(key, i);
+        e = fdb_lookup(fdb, key);
+        if ( (i & 1) ? NULL != e : NULL == e ) {
+            return -1;
+        }
+        if ( NULL != e && e->hit ) {
+            /* The hit bit must be cleared by the sweep */
+            return -1;
+        }
+    }
+
+    /* The survivors expire without being hit */
+    for ( e = fdb->entries; NULL != e; e = e->next ) {
+        e->aging -= FDB_AGING_TSC + 1;
+    }
+    fdb_gc(fdb);
+    if ( NULL != fdb->entries ) {
+        return -1;
+    }
+
+    fdb_release(fdb);
+
+    return 0;
+}
+
+/* Macro for testing */
+#define TEST_FUNC(str, func, ret)               \
+    do {                                        \
+        printf("%s: ", str);                    \
+        if ( 0 == func() ) {                    \
+            printf("passed");                   \
+        } else {                                \
+            printf("failed");                   \
+            ret = -1;                           \
+        }                                       \
+        printf("\n");                           \
+    } while ( 0 )
+
+/*
+ * Main routine
+ */
+int
+main(int argc, const char *const argv[])
+{
+    int ret;
+
+    ret = 0;
+    TEST_FUNC("learn", test_learn, ret);
+    TEST_FUNC("move", test_move, ret);
+    TEST_FUNC("aging", test_aging, ret);
+
+    return ret;
+}
+
+/*
+ * Local variables:
+ * tab-width: 4
+ * c-basic-offset: 4
+ * End:
+ * vim600: sw=4 ts=4 fdm=marker
+ * vim<600: sw=4 ts=4
+ */
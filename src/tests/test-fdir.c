@@ -0,0 +1,200 @@
+/*_
+ * Copyright (c) 2017 Hirochika Asai <asai@jar.jp>
+ * All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../ids/fe/fdir.h"
+
+/*
+ * Build the i-th test flow
+ */
+static void
+_flow(struct fe_fdir_flow *f, int i)
+{
+    f->sip = 0x0a000001 + i;
+    f->dip = 0xc0a80001;
+    f->sport = 1024 + i;
+    f->dport = 80;
+    f->proto = 6;
+}
+
+/*
+ * Add, find, and delete filters
+ */
+static int
+test_table(void)
+{
+    struct fe_fdir_table tbl;
+    struct fe_fdir_flow f;
+    int i;
+
+    /* Disabled */
+    fe_fdir_table_reset(&tbl, FE_FDIR_NONE);
+    _flow(&f, 0);
+    if ( fe_fdir_table_add(&tbl, &f, 0) >= 0 ) {
+        return -1;
+    }
+
+    fe_fdir_table_reset(&tbl, FE_FDIR_PERFECT);
+    for ( i = 0; i < FE_FDIR_MAX; i++ ) {
+        _flow(&f, i);
+        if ( i != fe_fdir_table_add(&tbl, &f, i & 3) ) {
+            return -1;
+        }
+    }
+    if ( FE_FDIR_MAX != tbl.n ) {
+        return -1;
+    }
+    /* Full */
+    _flow(&f, FE_FDIR_MAX);
+    if ( fe_fdir_table_add(&tbl, &f, 0) >= 0 ) {
+        return -1;
+    }
+    for ( i = 0; i < FE_FDIR_MAX; i++ ) {
+        _flow(&f, i);
+        if ( i != fe_fdir_table_find(&tbl, &f)
+             || (i & 3) != tbl.filters[i].queue ) {
+            return -1;
+        }
+    }
+
+    /* The slot freed is reused */
+    fe_fdir_table_del(&tbl, 17);
+    _flow(&f, 17);
+    if ( fe_fdir_table_find(&tbl, &f) >= 0 || FE_FDIR_MAX - 1 != tbl.n ) {
+        return -1;
+    }
+    _flow(&f, FE_FDIR_MAX);
+    if ( 17 != fe_fdir_table_add(&tbl, &f, 1)
+         || 17 != fe_fdir_table_find(&tbl, &f) ) {
+        return -1;
+    }
+
+    /* Protocol is a part of the flow */
+    fe_fdir_table_reset(&tbl, FE_FDIR_SIGNATURE);
+    _flow(&f, 0);
+    fe_fdir_table_add(&tbl, &f, 0);
+    f.proto = 17;
+    if ( fe_fdir_table_find(&tbl, &f) >= 0 ) {
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * Range and dependency on the flow of the hash values
+ */
+static int
+test_hash(void)
+{
+    struct fe_fdir_table tbl;
+    struct fe_fdir_flow f;
+    struct fe_fdir_flow g;
+    uint32_t h;
+    int diff;
+    int i;
+
+    diff = 0;
+    for ( i = 0; i < 1024; i++ ) {
+        _flow(&f, i);
+        h = fe_fdir_perfect_hash(&f);
+        if ( h > 0x1fff || h != fe_fdir_perfect_hash(&f) ) {
+            return -1;
+        }
+        h = fe_fdir_signature_hash(&f);
+        if ( h & 0x80008000 ) {
+            return -1;
+        }
+        /* The flow type changes the hash */
+        memcpy(&g, &f, sizeof(struct fe_fdir_flow));
+        g.proto = 17;
+        if ( fe_fdir_perfect_hash(&f) != fe_fdir_perfect_hash(&g) ) {
+            diff++;
+        }
+        /* Any other protocol is plain IPv4 */
+        f.proto = 47;
+        g.proto = 0;
+        if ( fe_fdir_signature_hash(&f) != fe_fdir_signature_hash(&g)
+             || fe_fdir_perfect_hash(&f) != fe_fdir_perfect_hash(&g) ) {
+            return -1;
+        }
+    }
+    if ( diff < 1000 ) {
+        return -1;
+    }
+
+    /* The hash of the mode is stored */
+    _flow(&f, 3);
+    fe_fdir_table_reset(&tbl, FE_FDIR_PERFECT);
+    fe_fdir_table_add(&tbl, &f, 0);
+    if ( tbl.filters[0].hash != fe_fdir_perfect_hash(&f) ) {
+        return -1;
+    }
+    fe_fdir_table_reset(&tbl, FE_FDIR_SIGNATURE);
+    fe_fdir_table_add(&tbl, &f, 0);
+    if ( tbl.filters[0].hash != fe_fdir_signature_hash(&f) ) {
+        return -1;
+    }
+
+    return 0;
+}
+
+/* Macro for testing */
+#define TEST_FUNC(str, func, ret)               \
+    do {                                        \
+        printf("%s: ", str);                    \
+        if ( 0 == func() ) {                    \
+            printf("passed");                   \
+        } else {                                \
+            printf("failed");                   \
+            ret = -1;                           \
+        }                                       \
+        printf("\n");                           \
+    } while ( 0 )
+
+/*
+ * Main routine
+ */
+int
+main(int argc, const char *const argv[])
+{
+    int ret;
+
+    ret = 0;
+    TEST_FUNC("table", test_table, ret);
+    TEST_FUNC("hash", test_hash, ret);
+
+    return ret;
+}
+
+/*
+ * Local variables:
+ * tab-width: 4
+ * c-basic-offset: 4
+ * End:
+ * vim600: sw=4 ts=4 fdm=marker
+ * vim<600: sw=4 ts=4
+ */
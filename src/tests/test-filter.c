@@ -0,0 +1,387 @@
+/*_
+ * Copyright (c) 2017 Hirochika Asai <asai@jar.jp>
+ * All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../ids/fe/filter.h"
+
+#define TEST_PKTS       256
+#define TEST_PKTLEN     128
+#define TEST_HOSTS      16
+#define TEST_ROUNDS     10000
+
+/* tcpdump -dd "ip and tcp dst port 80" */
+static const struct fe_filter_insn prog_tcp80[] = {
+    { 0x28, 0, 0, 0x0000000c },
+    { 0x15, 0, 8, 0x00000800 },
+    { 0x30, 0, 0, 0x00000017 },
+    { 0x15, 0, 6, 0x00000006 },
+    { 0x28, 0, 0, 0x00000014 },
+    { 0x45, 4, 0, 0x00001fff },
+    { 0xb1, 0, 0, 0x0000000e },
+    { 0x48, 0, 0, 0x00000010 },
+    { 0x15, 0, 1, 0x00000050 },
+    { 0x06, 0, 0, 0x00040000 },
+    { 0x06, 0, 0, 0x00000000 },
+};
+
+/* Arithmetic, the scratch memory, and the X register */
+static const struct fe_filter_insn prog_alu[] = {
+    { 0x80, 0, 0, 0 },          /* ld len */
+    { 0x02, 0, 0, 0 },          /* st M[0] */
+    { 0x01, 0, 0, 3 },          /* ldx #3 */
+    { 0x2c, 0, 0, 0 },          /* mul x */
+    { 0x04, 0, 0, 7 },          /* add #7 */
+    { 0x34, 0, 0, 5 },          /* div #5 */
+    { 0x9c, 0, 0, 0 },          /* mod x */
+    { 0x07, 0, 0, 0 },          /* tax */
+    { 0x40, 0, 0, 10 },         /* ld [x + 10] */
+    { 0x74, 0, 0, 3 },          /* rsh #3 */
+    { 0xa4, 0, 0, 0x5a5a5a5a }, /* xor #0x5a5a5a5a */
+    { 0x6c, 0, 0, 0 },          /* lsh x */
+    { 0x84, 0, 0, 0 },          /* neg */
+    { 0x61, 0, 0, 0 },          /* ldx M[0] */
+    { 0x3d, 1, 0, 0 },          /* jge x, 16, 15 */
+    { 0x14, 0, 0, 1 },          /* sub #1 */
+    { 0x4d, 0, 1, 0 },          /* jset x, 17, 18 */
+    { 0x54, 0, 0, 0xffff },     /* and #0xffff */
+    { 0x44, 0, 0, 0x100 },      /* or #0x100 */
+    { 0x02, 0, 0, 1 },          /* st M[1] */
+    { 0x48, 0, 0, 3 },          /* ldh [x + 3] */
+    { 0x0c, 0, 0, 0 },          /* add x */
+    { 0x03, 0, 0, 2 },          /* stx M[2] */
+    { 0x64, 0, 0, 4 },          /* lsh #4 */
+    { 0x1c, 0, 0, 0 },          /* sub x */
+    { 0x25, 0, 1, 0x1000 },     /* jgt #0x1000, 26, 27 */
+    { 0x16, 0, 0, 0 },          /* ret a */
+    { 0x60, 0, 0, 5 },          /* ld M[5] */
+    { 0x4c, 0, 0, 0 },          /* or x */
+    { 0x35, 0, 1, 0x10 },       /* jge #0x10, 30, 31 */
+    { 0x16, 0, 0, 0 },          /* ret a */
+    { 0x06, 0, 0, 1 },          /* ret #1 */
+};
+
+/* Helpers: forward to the FDB port, or count per ingress port */
+static const struct fe_filter_insn prog_fdb[] = {
+    { 0x47, 0, 0, FE_FILTER_FN_FDB_DST },       /* call fdb_dst */
+    { 0x15, 4, 0, FE_FILTER_NOTFOUND },         /* jeq #-1, 6, 2 */
+    { 0x07, 0, 0, 0 },                          /* tax */
+    { 0x47, 0, 0, FE_FILTER_FN_COUNT },         /* call count */
+    { 0x44, 0, 0, FE_FILTER_FWD(0) },           /* or #0x80000000 */
+    { 0x16, 0, 0, 0 },                          /* ret a */
+    { 0x47, 0, 0, FE_FILTER_FN_PORT },          /* call port */
+    { 0x94, 0, 0, 4 },                          /* mod #4 */
+    { 0x07, 0, 0, 0 },                          /* tax */
+    { 0x47, 0, 0, FE_FILTER_FN_COUNT },         /* call count */
+    { 0xb1, 0, 0, 14 },                         /* ldxb 4 * ([14] & 0xf) */
+    { 0x50, 0, 0, 14 },                         /* ldb [x + 14] */
+    { 0x3c, 0, 0, 0 },                          /* div x */
+    { 0x16, 0, 0, 0 },                          /* ret a */
+};
+
+/* Overflow of an indirect offset */
+static const struct fe_filter_insn prog_ind[] = {
+    { 0x01, 0, 0, 0xfffffff0 },                 /* ldx #0xfffffff0 */
+    { 0x05, 0, 0, 1 },                          /* ja 3 */
+    { 0x06, 0, 0, 7 },                          /* ret #7 */
+    { 0x40, 0, 0, 0x20 },                       /* ld [x + 0x20] */
+    { 0x06, 0, 0, 5 },                          /* ret #5 */
+};
+
+/* Invalid programs */
+static const struct fe_filter_insn prog_backward[] = {
+    { 0x15, 0, 2, 0 },                          /* Out of the program */
+    { 0x06, 0, 0, 0 },
+};
+static const struct fe_filter_insn prog_divzero[] = {
+    { 0x34, 0, 0, 0 },
+    { 0x06, 0, 0, 0 },
+};
+static const struct fe_filter_insn prog_mem[] = {
+    { 0x02, 0, 0, FE_FILTER_MEMWORDS },
+    { 0x06, 0, 0, 0 },
+};
+static const struct fe_filter_insn prog_noret[] = {
+    { 0x06, 0, 0, 0 },
+    { 0x00, 0, 0, 0 },
+};
+static const struct fe_filter_insn prog_unknown[] = {
+    { 0xff, 0, 0, 0 },
+    { 0x06, 0, 0, 0 },
+};
+static const struct fe_filter_insn prog_helper[] = {
+    { 0x47, 0, 0, FE_FILTER_NFN },
+    { 0x06, 0, 0, 0 },
+};
+
+#define NINSNS(p)       ((int)(sizeof(p) / sizeof(struct fe_filter_insn)))
+
+static uint8_t pkts[TEST_PKTS][TEST_PKTLEN];
+static uint32_t lens[TEST_PKTS];
+static uint8_t *code;
+
+/*
+ * Generate packets; some of them are TCP to port 80, to a host in the FDB,
+ * or truncated
+ */
+static void
+_gen_pkts(void)
+{
+    uint32_t r;
+    int i;
+    int j;
+
+    r = 12345;
+    for ( i = 0; i < TEST_PKTS; i++ ) {
+        for ( j = 0; j < TEST_PKTLEN; j++ ) {
+            r = r * 1103515245 + 12345;
+            pkts[i][j] = (r >> 16) & 0xff;
+        }
+        if ( i & 1 ) {
+            /* IPv4/TCP */
+            pkts[i][12] = 0x08;
+            pkts[i][13] = 0x00;
+            pkts[i][14] = 0x45;
+            pkts[i][20] = 0x00;
+            pkts[i][21] = 0x00;
+            pkts[i][23] = 0x06;
+            if ( i & 2 ) {
+                pkts[i][36] = 0x00;
+                pkts[i][37] = 80;
+            }
+        }
+        if ( i & 4 ) {
+            /* Known host */
+            memset(pkts[i], 0, 6);
+            pkts[i][0] = 0x02;
+            pkts[i][5] = i % TEST_HOSTS;
+        }
+        lens[i] = (i % 8) ? 64 + (i % (TEST_PKTLEN - 64)) : i % 40;
+    }
+}
+
+/*
+ * Compare the JIT-compiled code with the interpreter on all the packets
+ */
+static int
+_compare(const struct fe_filter_insn *insns, int n, struct fe_filter_ctx *ctx)
+{
+    fe_filter_func_t func;
+    uint64_t c0[FE_FILTER_NCOUNTERS];
+    uint64_t c1[FE_FILTER_NCOUNTERS];
+    uint32_t r0;
+    uint32_t r1;
+    int i;
+
+    if ( 0 != fe_filter_verify(insns, n) ) {
+        return -1;
+    }
+    if ( fe_filter_jit_compile(insns, n, code, FE_FILTER_JIT_SIZE) < 0 ) {
+        return -1;
+    }
+    func = (fe_filter_func_t)code;
+
+    memset(c0, 0, sizeof(c0));
+    memset(c1, 0, sizeof(c1));
+    for ( i = 0; i < TEST_PKTS; i++ ) {
+        ctx->port = i;
+        ctx->counters = c0;
+        r0 = fe_filter_run(insns, ctx, pkts[i], lens[i]);
+        ctx->counters = c1;
+        r1 = func(ctx, pkts[i], lens[i]);
+        if ( r0 != r1 ) {
+            printf("packet %d: %x != %x, ", i, r0, r1);
+            return -1;
+        }
+    }
+    if ( 0 != memcmp(c0, c1, sizeof(c0)) ) {
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * Test the verifier
+ */
+int
+test_verify(void)
+{
+    if ( 0 != fe_filter_verify(prog_tcp80, NINSNS(prog_tcp80))
+         || 0 != fe_filter_verify(prog_alu, NINSNS(prog_alu))
+         || 0 != fe_filter_verify(prog_fdb, NINSNS(prog_fdb))
+         || 0 != fe_filter_verify(prog_ind, NINSNS(prog_ind)) ) {
+        return -1;
+    }
+    if ( 0 == fe_filter_verify(prog_backward, NINSNS(prog_backward))
+         || 0 == fe_filter_verify(prog_divzero, NINSNS(prog_divzero))
+         || 0 == fe_filter_verify(prog_mem, NINSNS(prog_mem))
+         || 0 == fe_filter_verify(prog_noret, NINSNS(prog_noret))
+         || 0 == fe_filter_verify(prog_unknown, NINSNS(prog_unknown))
+         || 0 == fe_filter_verify(prog_helper, NINSNS(prog_helper))
+         || 0 == fe_filter_verify(prog_tcp80, 0) ) {
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * Test that the JIT-compiled code returns the same as the interpreter
+ */
+int
+test_jit(void)
+{
+    struct fe_filter_ctx ctx;
+    uint8_t key[FDB_KEY_SIZE];
+    int i;
+
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.fdb = fdb_init();
+    if ( NULL == ctx.fdb ) {
+        return -1;
+    }
+    for ( i = 0; i < TEST_HOSTS; i += 2 ) {
+        memset(key, 0, FDB_KEY_SIZE);
+        key[0] = 0x02;
+        key[5] = i;
+        fdb_update(ctx.fdb, key, i % 4);
+    }
+
+    if ( 0 != _compare(prog_tcp80, NINSNS(prog_tcp80), &ctx)
+         || 0 != _compare(prog_alu, NINSNS(prog_alu), &ctx)
+         || 0 != _compare(prog_fdb, NINSNS(prog_fdb), &ctx)
+         || 0 != _compare(prog_ind, NINSNS(prog_ind), &ctx) ) {
+        return -1;
+    }
+    /* The overflowed offset must not be loaded */
+    if ( 0 != fe_filter_run(prog_ind, &ctx, pkts[1], lens[1]) ) {
+        return -1;
+    }
+
+    fdb_release(ctx.fdb);
+
+    return 0;
+}
+
+/*
+ * Measure the cycles per packet of the interpreter and the JIT-compiled code
+ */
+int
+test_bench(void)
+{
+    struct fe_filter_prog prog;
+    struct fe_filter_ctx ctx;
+    uint64_t t0;
+    uint64_t t1;
+    uint64_t interp;
+    uint64_t jit;
+    uint32_t sum;
+    int i;
+    int j;
+
+    memset(&ctx, 0, sizeof(ctx));
+    prog.ninsns = NINSNS(prog_tcp80);
+    memcpy(prog.insns, prog_tcp80, sizeof(prog_tcp80));
+    if ( fe_filter_jit_compile(prog.insns, prog.ninsns, code,
+                               FE_FILTER_JIT_SIZE) < 0 ) {
+        return -1;
+    }
+
+    sum = 0;
+    prog.func = NULL;
+    t0 = fdb_rdtsc();
+    for ( i = 0; i < TEST_ROUNDS; i++ ) {
+        for ( j = 0; j < TEST_PKTS; j++ ) {
+            sum += fe_filter_exec(&prog, &ctx, pkts[j], lens[j]);
+        }
+    }
+    t1 = fdb_rdtsc();
+    interp = t1 - t0;
+
+    prog.func = (fe_filter_func_t)code;
+    t0 = fdb_rdtsc();
+    for ( i = 0; i < TEST_ROUNDS; i++ ) {
+        for ( j = 0; j < TEST_PKTS; j++ ) {
+            sum -= fe_filter_exec(&prog, &ctx, pkts[j], lens[j]);
+        }
+    }
+    t1 = fdb_rdtsc();
+    jit = t1 - t0;
+
+    printf("interpreter %.1f, JIT %.1f cycles/packet, ",
+           (double)interp / (TEST_ROUNDS * TEST_PKTS),
+           (double)jit / (TEST_ROUNDS * TEST_PKTS));
+    if ( 0 != sum ) {
+        return -1;
+    }
+
+    return 0;
+}
+
+/* Macro for testing */
+#define TEST_FUNC(str, func, ret)               \
+    do {                                        \
+        printf("%s: ", str);                    \
+        if ( 0 == func() ) {                    \
+            printf("passed");                   \
+        } else {                                \
+            printf("failed");                   \
+            ret = -1;                           \
+        }                                       \
+        printf("\n");                           \
+    } while ( 0 )
+
+/*
+ * Main routine
+ */
+int
+main(int argc, const char *const argv[])
+{
+    int ret;
+
+    code = fe_filter_jit_alloc(FE_FILTER_JIT_SIZE);
+    if ( NULL == code ) {
+        printf("cannot allocate executable memory\n");
+        return -1;
+    }
+    _gen_pkts();
+
+    ret = 0;
+    TEST_FUNC("verify", test_verify, ret);
+    TEST_FUNC("jit", test_jit, ret);
+    TEST_FUNC("bench", test_bench, ret);
+
+    return ret;
+}
+
+/*
+ * Local variables:
+ * tab-width: 4
+ * c-basic-offset: 4
+ * End:
+ * vim600: sw=4 ts=4 fdm=marker
+ * vim<600: sw=4 ts=4
+ */
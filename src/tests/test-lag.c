@@ -0,0 +1,297 @@
+/*_
+ * Copyright (c) 2017 Hirochika Asai <asai@jar.jp>
+ * All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../ids/fe/lag.h"
+
+#define TEST_NFLOWS     65536
+
+/*
+ * Build a UDP/IPv4 packet of a flow
+ */
+static void
+_build_udp(uint8_t *pkt, uint32_t flow)
+{
+    memset(pkt, 0, 64);
+    pkt[5] = 1;
+    pkt[11] = 2;
+    pkt[12] = 0x08;
+    pkt[14] = 0x45;
+    pkt[23] = 17;
+    /* 10.0.0.1 -> 10.1.x.x */
+    pkt[26] = 10;
+    pkt[29] = 1;
+    pkt[30] = 10;
+    pkt[31] = 1;
+    pkt[32] = (flow >> 8) & 0xff;
+    pkt[33] = flow & 0xff;
+    /* Source port */
+    pkt[34] = (flow >> 16) & 0xff;
+    pkt[35] = 53;
+    pkt[37] = 53;
+}
+
+/*
+ * Count the flows per member of a group
+ */
+static void
+_count(const struct fe_lag_table *tbl, int mode, int *cnt)
+{
+    uint8_t pkt[64];
+    uint32_t h;
+    int p;
+    int i;
+
+    memset(cnt, 0, sizeof(int) * FE_LAG_NPORTS);
+    for ( i = 0; i < TEST_NFLOWS; i++ ) {
+        _build_udp(pkt, i);
+        h = fe_lag_hash(pkt, sizeof(pkt), mode);
+        p = fe_lag_select(tbl, FE_LAG_PORT(0), h);
+        if ( p >= 0 ) {
+            cnt[p]++;
+        }
+    }
+}
+
+/*
+ * Flows evenly distributed over the members
+ */
+static int
+test_distribution(void)
+{
+    struct fe_lag_table tbl;
+    int cnt[FE_LAG_NPORTS];
+    uint8_t pkt[64];
+    uint32_t h;
+    int i;
+
+    memset(tbl.buckets, -1, sizeof(tbl.buckets));
+    fe_lag_rebalance(tbl.buckets[0], (1ULL << 1) | (1ULL << 2) | (1ULL << 5));
+    _count(&tbl, FE_LAG_HASH_L3, cnt);
+    printf("%d:%d:%d flows, ", cnt[1], cnt[2], cnt[5]);
+    for ( i = 0; i < FE_LAG_NPORTS; i++ ) {
+        if ( 1 != i && 2 != i && 5 != i && cnt[i] > 0 ) {
+            return -1;
+        }
+    }
+    if ( cnt[1] < TEST_NFLOWS / 4 || cnt[2] < TEST_NFLOWS / 4
+         || cnt[5] < TEST_NFLOWS / 4 ) {
+        return -1;
+    }
+
+    /* The L2 hash puts all the flows between two hosts on a member */
+    h = 0;
+    for ( i = 0; i < 64; i++ ) {
+        _build_udp(pkt, i);
+        if ( 0 == i ) {
+            h = fe_lag_hash(pkt, sizeof(pkt), FE_LAG_HASH_L2);
+        } else if ( fe_lag_hash(pkt, sizeof(pkt), FE_LAG_HASH_L2) != h ) {
+            return -1;
+        }
+    }
+    /* The L4 hash differs by ports */
+    _build_udp(pkt, 0);
+    h = fe_lag_hash(pkt, sizeof(pkt), FE_LAG_HASH_L4);
+    _build_udp(pkt, 1 << 16);
+    if ( fe_lag_hash(pkt, sizeof(pkt), FE_LAG_HASH_L4) == h ) {
+        return -1;
+    }
+    /* but not for non-first fragments */
+    pkt[21] = 1;
+    h = fe_lag_hash(pkt, sizeof(pkt), FE_LAG_HASH_L4);
+    _build_udp(pkt, 2 << 16);
+    pkt[21] = 1;
+    if ( fe_lag_hash(pkt, sizeof(pkt), FE_LAG_HASH_L4) != h ) {
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * Only the flows of a failed member move, and a member joining takes its
+ * share
+ */
+static int
+test_failover(void)
+{
+    struct fe_lag_table tbl;
+    int8_t prev[FE_LAG_BUCKETS];
+    int moved;
+    int cnt[FE_LAG_NPORTS];
+    int i;
+
+    memset(tbl.buckets, -1, sizeof(tbl.buckets));
+    fe_lag_rebalance(tbl.buckets[0], 0xf);
+    memcpy(prev, tbl.buckets[0], FE_LAG_BUCKETS);
+
+    /* Port 2 down */
+    fe_lag_rebalance(tbl.buckets[0], 0xb);
+    moved = 0;
+    for ( i = 0; i < FE_LAG_BUCKETS; i++ ) {
+        if ( 2 == tbl.buckets[0][i] ) {
+            return -1;
+        }
+        if ( prev[i] != tbl.buckets[0][i] ) {
+            if ( 2 != prev[i] ) {
+                /* Flow of a member alive moved */
+                return -1;
+            }
+            moved++;
+        }
+    }
+    printf("%d buckets moved, ", moved);
+    if ( FE_LAG_BUCKETS / 4 != moved ) {
+        return -1;
+    }
+
+    /* Port 2 up again */
+    memcpy(prev, tbl.buckets[0], FE_LAG_BUCKETS);
+    fe_lag_rebalance(tbl.buckets[0], 0xf);
+    memset(cnt, 0, sizeof(cnt));
+    for ( i = 0; i < FE_LAG_BUCKETS; i++ ) {
+        cnt[(int)tbl.buckets[0][i]]++;
+        if ( prev[i] != tbl.buckets[0][i] && 2 != tbl.buckets[0][i] ) {
+            return -1;
+        }
+    }
+    for ( i = 0; i < 4; i++ ) {
+        if ( FE_LAG_BUCKETS / 4 != cnt[i] ) {
+            return -1;
+        }
+    }
+
+    /* All down */
+    fe_lag_rebalance(tbl.buckets[0], 0);
+    for ( i = 0; i < FE_LAG_BUCKETS; i++ ) {
+        if ( tbl.buckets[0][i] >= 0 ) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Two systems negotiating a group: in sync after exchanging LACPDUs, and the
+ * partner expired after the timeout
+ */
+static int
+test_lacp(void)
+{
+    static const uint8_t sys_a[6] = { 0x02, 0, 0, 0, 0, 0xa };
+    static const uint8_t sys_b[6] = { 0x02, 0, 0, 0, 0, 0xb };
+    struct fe_lacp_port a;
+    struct fe_lacp_port b;
+    uint8_t pdu[FE_LACP_PDU_LEN];
+    int len;
+    int i;
+
+    memset(&a, 0, sizeof(a));
+    memset(&b, 0, sizeof(b));
+    a.key = 1;
+    b.key = 7;
+    fe_lacp_update(&a);
+    fe_lacp_update(&b);
+    if ( !(a.state & FE_LACP_DEFAULTED) ) {
+        return -1;
+    }
+    for ( i = 0; i < 3; i++ ) {
+        len = fe_lacp_build(pdu, 0x8000, sys_a, 0, &a);
+        if ( !fe_lacp_is_pdu(pdu, len)
+             || fe_lacp_input(&b, pdu, len, 100 + i) < 0 ) {
+            return -1;
+        }
+        b.selected = 1;
+        fe_lacp_update(&b);
+        len = fe_lacp_build(pdu, 0x8000, sys_b, 3, &b);
+        if ( fe_lacp_input(&a, pdu, len, 100 + i) < 0 ) {
+            return -1;
+        }
+        a.selected = 1;
+        fe_lacp_update(&a);
+    }
+    if ( !fe_lacp_update(&a) || !fe_lacp_update(&b) ) {
+        return -1;
+    }
+    if ( 7 != a.pkey || 4 != a.pport || 0 != memcmp(a.psys, sys_b, 6) ) {
+        return -1;
+    }
+
+    /* Malformed */
+    pdu[17] = 19;
+    if ( fe_lacp_input(&a, pdu, len, 200) >= 0 ) {
+        return -1;
+    }
+
+    /* Timeout */
+    if ( fe_lacp_expire(&a, 1000, 3000) || !fe_lacp_expire(&a, 4000, 3000) ) {
+        return -1;
+    }
+    if ( fe_lacp_update(&a) ) {
+        return -1;
+    }
+
+    return 0;
+}
+
+/* Macro for testing */
+#define TEST_FUNC(str, func, ret)               \
+    do {                                        \
+        printf("%s: ", str);                    \
+        if ( 0 == func() ) {                    \
+            printf("passed");                   \
+        } else {                                \
+            printf("failed");                   \
+            ret = -1;                           \
+        }                                       \
+        printf("\n");                           \
+    } while ( 0 )
+
+/*
+ * Main routine
+ */
+int
+main(int argc, const char *const argv[])
+{
+    int ret;
+
+    ret = 0;
+    TEST_FUNC("distribution", test_distribution, ret);
+    TEST_FUNC("failover", test_failover, ret);
+    TEST_FUNC("lacp", test_lacp, ret);
+
+    return ret;
+}
+
+/*
+ * Local variables:
+ * tab-width: 4
+ * c-basic-offset: 4
+ * End:
+ * vim600: sw=4 ts=4 fdm=marker
+ * vim<600: sw=4 ts=4
+ */
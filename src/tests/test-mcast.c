@@ -0,0 +1,256 @@
+/*_
+ * Copyright (c) 2017 Hirochika Asai <asai@jar.jp>
+ * All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../ids/fe/mcast.h"
+
+/*
+ * Build an IGMP packet to a group (the IGMP message starts at 34)
+ */
+static int
+_build_igmp(uint8_t *pkt, uint32_t dst, int type, uint32_t group)
+{
+    memset(pkt, 0, 128);
+    pkt[0] = 0x01;
+    pkt[2] = 0x5e;
+    pkt[3] = (dst >> 16) & 0x7f;
+    pkt[4] = (dst >> 8) & 0xff;
+    pkt[5] = dst & 0xff;
+    pkt[12] = 0x08;
+    pkt[14] = 0x45;
+    pkt[22] = 1;
+    pkt[23] = 2;
+    pkt[30] = dst >> 24;
+    pkt[31] = (dst >> 16) & 0xff;
+    pkt[32] = (dst >> 8) & 0xff;
+    pkt[33] = dst & 0xff;
+    pkt[34] = type;
+    pkt[38] = group >> 24;
+    pkt[39] = (group >> 16) & 0xff;
+    pkt[40] = (group >> 8) & 0xff;
+    pkt[41] = group & 0xff;
+
+    return 42;
+}
+
+/*
+ * Append an IGMPv3 group record
+ */
+static int
+_add_record(uint8_t *pkt, int len, int type, int nsrc, uint32_t group)
+{
+    pkt[len] = type;
+    pkt[len + 3] = nsrc;
+    pkt[len + 4] = group >> 24;
+    pkt[len + 5] = (group >> 16) & 0xff;
+    pkt[len + 6] = (group >> 8) & 0xff;
+    pkt[len + 7] = group & 0xff;
+    /* # of records */
+    pkt[41]++;
+
+    return len + 8 + nsrc * 4;
+}
+
+/*
+ * Parse the IGMP messages
+ */
+static int
+test_parse(void)
+{
+    uint64_t cmds[FE_MCAST_MAX_CMDS];
+    uint8_t pkt[128];
+    int len;
+
+    /* IGMPv2 report and leave */
+    len = _build_igmp(pkt, 0xe1010101, 0x16, 0xe1010101);
+    if ( 1 != fe_igmp_parse(pkt, len, cmds)
+         || FE_MCAST_CMD(FE_MCAST_JOIN, 0xe1010101) != cmds[0] ) {
+        return -1;
+    }
+    len = _build_igmp(pkt, 0xe0000002, 0x17, 0xe1010101);
+    if ( 1 != fe_igmp_parse(pkt, len, cmds)
+         || FE_MCAST_CMD(FE_MCAST_LEAVE, 0xe1010101) != cmds[0] ) {
+        return -1;
+    }
+    /* Query */
+    len = _build_igmp(pkt, 0xe0000001, 0x11, 0);
+    if ( 1 != fe_igmp_parse(pkt, len, cmds)
+         || FE_MCAST_QUERY != FE_MCAST_CMD_TYPE(cmds[0]) ) {
+        return -1;
+    }
+    /* Report of a link-local group */
+    len = _build_igmp(pkt, 0xe00000fb, 0x16, 0xe00000fb);
+    if ( 0 != fe_igmp_parse(pkt, len, cmds) ) {
+        return -1;
+    }
+    /* Not IGMP */
+    len = _build_igmp(pkt, 0xe1010101, 0x16, 0xe1010101);
+    pkt[23] = 17;
+    if ( 0 != fe_igmp_parse(pkt, len, cmds) ) {
+        return -1;
+    }
+
+    /* IGMPv3: exclude {} (join), include {} (leave), and include {S} */
+    len = _build_igmp(pkt, 0xe0000016, 0x22, 0);
+    len = _add_record(pkt, len, 4, 0, 0xe2000001);
+    len = _add_record(pkt, len, 3, 0, 0xe2000002);
+    len = _add_record(pkt, len, 1, 2, 0xe2000003);
+    if ( 3 != fe_igmp_parse(pkt, len, cmds)
+         || FE_MCAST_CMD(FE_MCAST_JOIN, 0xe2000001) != cmds[0]
+         || FE_MCAST_CMD(FE_MCAST_LEAVE, 0xe2000002) != cmds[1]
+         || FE_MCAST_CMD(FE_MCAST_JOIN, 0xe2000003) != cmds[2] ) {
+        return -1;
+    }
+    /* Truncated in the header of the last record */
+    if ( 2 != fe_igmp_parse(pkt, len - 9, cmds) ) {
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * Replication table built from joins, leaves, queries, and aging
+ */
+static int
+test_table(void)
+{
+    struct fe_mcast_db *db;
+    struct fe_mcast_table tbl;
+    uint8_t mac[6] = { 0x01, 0x00, 0x5e, 0x01, 0x01, 0x01 };
+    int slot;
+    int i;
+
+    db = malloc(sizeof(struct fe_mcast_db));
+    if ( NULL == db ) {
+        return -1;
+    }
+    memset(db, 0, sizeof(struct fe_mcast_db));
+
+    /* Ports 1 and 3 join 225.1.1.1, and 239.129.1.1 shares the MAC */
+    if ( 1 != fe_mcast_db_input(db, FE_MCAST_CMD(FE_MCAST_JOIN, 0xe1010101),
+                                1 << 1, 100)
+         || 1 != fe_mcast_db_input(db, FE_MCAST_CMD(FE_MCAST_JOIN, 0xe1010101),
+                                   1 << 3, 200)
+         || 0 != fe_mcast_db_input(db, FE_MCAST_CMD(FE_MCAST_JOIN, 0xe1010101),
+                                   1 << 3, 300)
+         || 1 != fe_mcast_db_input(db, FE_MCAST_CMD(FE_MCAST_JOIN, 0xef810101),
+                                   1 << 4, 300)
+         || 1 != fe_mcast_db_input(db, FE_MCAST_CMD(FE_MCAST_QUERY, 0),
+                                   1 << 0, 300) ) {
+        return -1;
+    }
+    fe_mcast_db_build(db, &tbl);
+    slot = fe_mcast_lookup(&tbl, mac);
+    if ( slot < 0 || 0x1a != tbl.ports[slot] || 0x1 != tbl.mrouters ) {
+        return -1;
+    }
+    mac[5] = 2;
+    if ( fe_mcast_lookup(&tbl, mac) >= 0 ) {
+        return -1;
+    }
+    mac[5] = 1;
+
+    /* Port 1 leaves, port 4 reports again, then port 3 and the router time
+       out */
+    if ( 1 != fe_mcast_db_input(db, FE_MCAST_CMD(FE_MCAST_LEAVE, 0xe1010101),
+                                1 << 1, 400)
+         || 0 != fe_mcast_db_age(db, 500, 1000)
+         || 0 != fe_mcast_db_input(db, FE_MCAST_CMD(FE_MCAST_JOIN, 0xef810101),
+                                   1 << 4, 1000)
+         || 1 != fe_mcast_db_age(db, 1301, 1000) ) {
+        return -1;
+    }
+    fe_mcast_db_build(db, &tbl);
+    slot = fe_mcast_lookup(&tbl, mac);
+    if ( 1 != db->n || slot < 0 || 0x10 != tbl.ports[slot]
+         || 0 != tbl.mrouters ) {
+        return -1;
+    }
+
+    /* Full */
+    for ( i = 1; i < FE_MCAST_MAX; i++ ) {
+        if ( 1 != fe_mcast_db_input(db, FE_MCAST_CMD(FE_MCAST_JOIN,
+                                                     0xe3000000 + i),
+                                    1, 1400) ) {
+            return -1;
+        }
+    }
+    if ( -1 != fe_mcast_db_input(db, FE_MCAST_CMD(FE_MCAST_JOIN, 0xe4000000),
+                                 1, 1400) ) {
+        return -1;
+    }
+    fe_mcast_db_build(db, &tbl);
+    for ( i = 1; i < FE_MCAST_MAX; i++ ) {
+        mac[3] = 0;
+        mac[4] = (i >> 8) & 0xff;
+        mac[5] = i & 0xff;
+        slot = fe_mcast_lookup(&tbl, mac);
+        if ( slot < 0 || 1 != tbl.ports[slot] ) {
+            return -1;
+        }
+    }
+    free(db);
+
+    return 0;
+}
+
+/* Macro for testing */
+#define TEST_FUNC(str, func, ret)               \
+    do {                                        \
+        printf("%s: ", str);                    \
+        if ( 0 == func() ) {                    \
+            printf("passed");                   \
+        } else {                                \
+            printf("failed");                   \
+            ret = -1;                           \
+        }                                       \
+        printf("\n");                           \
+    } while ( 0 )
+
+/*
+ * Main routine
+ */
+int
+main(int argc, const char *const argv[])
+{
+    int ret;
+
+    ret = 0;
+    TEST_FUNC("parse", test_parse, ret);
+    TEST_FUNC("table", test_table, ret);
+
+    return ret;
+}
+
+/*
+ * Local variables:
+ * tab-width: 4
+ * c-basic-offset: 4
+ * End:
+ * vim600: sw=4 ts=4 fdm=marker
+ * vim<600: sw=4 ts=4
+ */
@@ -0,0 +1,527 @@
+/*_
+ * Copyright (c) 2017 Hirochika Asai <asai@jar.jp>
+ * All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../ids/fe/fdb.h"
+#include "../ids/fe/nat.h"
+
+/* 198.51.100.1 */
+#define TEST_EXT_ADDR   0xc6336401
+#define TEST_PKTLEN     64
+#define TEST_SUBS       256
+#define TEST_FLOWS      512
+#define TEST_ROUNDS     16
+#define TEST_BATCH      256
+
+/*
+ * Build a TCP or UDP packet
+ */
+static int
+_build_pkt(uint8_t *pkt, int proto, uint32_t saddr, int sport, uint32_t daddr,
+           int dport, uint8_t flags)
+{
+    memset(pkt, 0, TEST_PKTLEN);
+    pkt[12] = 0x08;
+    pkt[14] = 0x45;
+    pkt[16] = 0;
+    pkt[17] = TEST_PKTLEN - 14;
+    pkt[22] = 64;
+    pkt[23] = proto;
+    pkt[26] = saddr >> 24;
+    pkt[27] = (saddr >> 16) & 0xff;
+    pkt[28] = (saddr >> 8) & 0xff;
+    pkt[29] = saddr & 0xff;
+    pkt[30] = daddr >> 24;
+    pkt[31] = (daddr >> 16) & 0xff;
+    pkt[32] = (daddr >> 8) & 0xff;
+    pkt[33] = daddr & 0xff;
+    pkt[34] = sport >> 8;
+    pkt[35] = sport & 0xff;
+    pkt[36] = dport >> 8;
+    pkt[37] = dport & 0xff;
+    if ( 6 == proto ) {
+        /* Data offset and flags */
+        pkt[46] = 0x50;
+        pkt[47] = flags;
+    } else {
+        pkt[39] = TEST_PKTLEN - 34;
+    }
+
+    return TEST_PKTLEN;
+}
+
+/*
+ * Ones' complement sum of 16-bit words in network byte order
+ */
+static uint32_t
+_sum(const uint8_t *p, int len, uint32_t s)
+{
+    int i;
+
+    for ( i = 0; i + 1 < len; i += 2 ) {
+        s += ((uint32_t)p[i] << 8) | p[i + 1];
+    }
+    if ( len & 1 ) {
+        s += (uint32_t)p[len - 1] << 8;
+    }
+
+    return s;
+}
+
+static uint16_t
+_fold(uint32_t s)
+{
+    while ( s >> 16 ) {
+        s = (s & 0xffff) + (s >> 16);
+    }
+
+    return ~s & 0xffff;
+}
+
+/*
+ * Fill the checksums of a packet
+ */
+static void
+_fill_csum(uint8_t *pkt)
+{
+    uint32_t s;
+    int coff;
+
+    pkt[24] = pkt[25] = 0;
+    s = _fold(_sum(pkt + 14, 20, 0));
+    pkt[24] = s >> 8;
+    pkt[25] = s & 0xff;
+
+    coff = 6 == pkt[23] ? 34 + 16 : 34 + 6;
+    pkt[coff] = pkt[coff + 1] = 0;
+    s = _sum(pkt + 26, 8, pkt[23] + TEST_PKTLEN - 34);
+    s = _fold(_sum(pkt + 34, TEST_PKTLEN - 34, s));
+    pkt[coff] = s >> 8;
+    pkt[coff + 1] = s & 0xff;
+}
+
+/*
+ * Verify the checksums of a packet
+ */
+static int
+_verify_csum(const uint8_t *pkt)
+{
+    uint32_t s;
+
+    if ( 0 != _fold(_sum(pkt + 14, 20, 0)) ) {
+        return -1;
+    }
+    s = _sum(pkt + 26, 8, pkt[23] + TEST_PKTLEN - 34);
+    if ( 0 != _fold(_sum(pkt + 34, TEST_PKTLEN - 34, s)) ) {
+        return -1;
+    }
+
+    return 0;
+}
+
+static uint32_t
+_rd32(const uint8_t *p)
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16)
+        | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static int
+_rd16(const uint8_t *p)
+{
+    return ((int)p[0] << 8) | p[1];
+}
+
+/*
+ * Shard with the external addresses
+ */
+static struct fe_nat_shard *
+_init_shard(int id, int nshards, int naddrs, int block, int blocks)
+{
+    struct fe_nat_shard *s;
+    struct fe_nat_params p;
+
+    s = fe_nat_shard_init(id, nshards, 0);
+    if ( NULL == s ) {
+        return NULL;
+    }
+    p.addr = TEST_EXT_ADDR;
+    p.naddrs = naddrs;
+    p.block = block;
+    p.blocks = blocks;
+    p.timeouts[FE_NAT_TO_TCP_EST] = FE_NAT_TCP_EST_TIMEOUT;
+    p.timeouts[FE_NAT_TO_TCP_TRANS] = FE_NAT_TCP_TRANS_TIMEOUT;
+    p.timeouts[FE_NAT_TO_UDP] = FE_NAT_UDP_TIMEOUT;
+    if ( !fe_nat_params_valid(&p) ) {
+        fe_nat_shard_release(s);
+        return NULL;
+    }
+    fe_nat_shard_reset(s, &p);
+
+    return s;
+}
+
+/*
+ * Translate a TCP connection in both directions
+ */
+static int
+test_xlate(void)
+{
+    struct fe_nat_shard *s;
+    uint8_t pkt[TEST_PKTLEN];
+    int eport;
+    int len;
+
+    s = _init_shard(0, 1, 1, 64, 2);
+    if ( NULL == s ) {
+        return -1;
+    }
+
+    /* SYN from 10.0.0.1:1234 to 203.0.113.5:80 */
+    len = _build_pkt(pkt, 6, 0x0a000001, 1234, 0xcb007105, 80, 0x02);
+    _fill_csum(pkt);
+    if ( FE_NAT_XLATE != fe_nat_outbound(s, pkt, len, 0)
+         || TEST_EXT_ADDR != _rd32(pkt + 26) || 0 != _verify_csum(pkt) ) {
+        return -1;
+    }
+    eport = _rd16(pkt + 34);
+    if ( eport < FE_NAT_PORT_MIN || eport >= FE_NAT_PORT_MIN + 64 ) {
+        return -1;
+    }
+
+    /* SYN-ACK back */
+    len = _build_pkt(pkt, 6, 0xcb007105, 80, TEST_EXT_ADDR, eport, 0x12);
+    _fill_csum(pkt);
+    if ( FE_NAT_XLATE != fe_nat_inbound(s, pkt, len, 1)
+         || 0x0a000001 != _rd32(pkt + 30) || 1234 != _rd16(pkt + 36)
+         || 0 != _verify_csum(pkt) || FE_NAT_TCP_EST != s->conns[0].state ) {
+        return -1;
+    }
+
+    /* ACK of the same connection */
+    len = _build_pkt(pkt, 6, 0x0a000001, 1234, 0xcb007105, 80, 0x10);
+    _fill_csum(pkt);
+    if ( FE_NAT_XLATE != fe_nat_outbound(s, pkt, len, 2)
+         || eport != _rd16(pkt + 34) || 1 != s->nconns ) {
+        return -1;
+    }
+
+    /* ACK without a connection, and to another port */
+    len = _build_pkt(pkt, 6, 0x0a000001, 1235, 0xcb007105, 80, 0x10);
+    if ( FE_NAT_MISS != fe_nat_outbound(s, pkt, len, 2) ) {
+        return -1;
+    }
+    len = _build_pkt(pkt, 6, 0xcb007105, 80, TEST_EXT_ADDR, eport + 1, 0x10);
+    if ( FE_NAT_MISS != fe_nat_inbound(s, pkt, len, 2) ) {
+        return -1;
+    }
+    /* Not to the external address */
+    len = _build_pkt(pkt, 6, 0xcb007105, 80, TEST_EXT_ADDR + 1, eport, 0x10);
+    if ( FE_NAT_PASS != fe_nat_inbound(s, pkt, len, 2) ) {
+        return -1;
+    }
+    /* ICMP and fragments */
+    len = _build_pkt(pkt, 1, 0x0a000001, 0, 0xcb007105, 0, 0);
+    if ( FE_NAT_UNSUPPORTED != fe_nat_outbound(s, pkt, len, 2) ) {
+        return -1;
+    }
+    len = _build_pkt(pkt, 17, 0x0a000001, 53, 0xcb007105, 53, 0);
+    pkt[20] = 0x20;
+    if ( FE_NAT_UNSUPPORTED != fe_nat_outbound(s, pkt, len, 2) ) {
+        return -1;
+    }
+
+    /* UDP without the checksum */
+    len = _build_pkt(pkt, 17, 0x0a000001, 53, 0xcb007105, 53, 0);
+    if ( FE_NAT_XLATE != fe_nat_outbound(s, pkt, len, 2)
+         || 0 != pkt[40] || 0 != pkt[41] || 2 != s->nconns ) {
+        return -1;
+    }
+    fe_nat_shard_release(s);
+
+    return 0;
+}
+
+/*
+ * Allocate the ports in blocks per subscriber, and release them on expiry
+ */
+static int
+test_blocks(void)
+{
+    struct fe_nat_shard *s;
+    uint8_t pkt[TEST_PKTLEN];
+    int nfree;
+    int len;
+    int i;
+
+    s = _init_shard(0, 1, 1, 64, 2);
+    if ( NULL == s ) {
+        return -1;
+    }
+    nfree = s->nfree;
+    if ( FE_NAT_NPORTS / 64 != nfree ) {
+        return -1;
+    }
+
+    /* Two blocks for a subscriber */
+    for ( i = 0; i < 128; i++ ) {
+        len = _build_pkt(pkt, 17, 0x0a000001, 10000 + i, 0xcb007105, 53, 0);
+        if ( FE_NAT_XLATE != fe_nat_outbound(s, pkt, len, 10) ) {
+            return -1;
+        }
+    }
+    len = _build_pkt(pkt, 17, 0x0a000001, 10128, 0xcb007105, 53, 0);
+    if ( FE_NAT_NOPORT != fe_nat_outbound(s, pkt, len, 10)
+         || nfree - 2 != s->nfree || 1 != s->nsubs ) {
+        return -1;
+    }
+    /* Another subscriber has the next block */
+    len = _build_pkt(pkt, 17, 0x0a000002, 10000, 0xcb007105, 53, 0);
+    if ( FE_NAT_XLATE != fe_nat_outbound(s, pkt, len, 100)
+         || FE_NAT_PORT_MIN + 128 != _rd16(pkt + 34) ) {
+        return -1;
+    }
+
+    /* The first subscriber is refreshed at 200 */
+    len = _build_pkt(pkt, 17, 0x0a000001, 10000, 0xcb007105, 53, 0);
+    if ( FE_NAT_XLATE != fe_nat_outbound(s, pkt, len, 200) ) {
+        return -1;
+    }
+    if ( 0 != fe_nat_expire(s, 310, 1024)
+         || 127 != fe_nat_expire(s, 311, 1024) || 2 != s->nconns ) {
+        return -1;
+    }
+    if ( 1 != fe_nat_expire(s, 401, 1024) || 1 != fe_nat_expire(s, 501, 1)
+         || 0 != s->nconns || 0 != s->nsubs || nfree != s->nfree ) {
+        return -1;
+    }
+    for ( i = 0; i < FE_NAT_BUCKETS; i++ ) {
+        if ( 0 != s->buckets[i].sigs[0] ) {
+            return -1;
+        }
+    }
+    fe_nat_shard_release(s);
+
+    return 0;
+}
+
+/*
+ * Steer the inbound packets to the queue of the shard that created the
+ * connection
+ */
+static int
+test_steer(void)
+{
+    struct fe_nat_shard *s[4];
+    uint8_t pkt[TEST_PKTLEN];
+    uint8_t key[FE_NAT_RSS_KEY_SIZE];
+    uint8_t data[12];
+    uint32_t h;
+    int len;
+    int i;
+    int j;
+
+    /* Symmetric key */
+    for ( i = 0; i < FE_NAT_RSS_KEY_SIZE; i++ ) {
+        key[i] = (i & 1) ? 0x5a : 0x6d;
+    }
+    for ( i = 0; i < 4; i++ ) {
+        s[i] = _init_shard(i, 4, 4, 256, 4);
+        if ( NULL == s[i] ) {
+            return -1;
+        }
+        fe_nat_steer_set(s[i], 4, i, 128, key);
+    }
+
+    for ( i = 0; i < 4; i++ ) {
+        for ( j = 0; j < 64; j++ ) {
+            len = _build_pkt(pkt, 6, 0x0a000001 + j, 40000 + j,
+                             0xcb007100 + j, 443, 0x02);
+            if ( FE_NAT_XLATE != fe_nat_outbound(s[i], pkt, len, 0) ) {
+                return -1;
+            }
+            /* The hash of the inbound packet, and of the reverse (the key is
+               symmetric) */
+            memcpy(data, pkt + 30, 4);
+            memcpy(data + 4, pkt + 26, 4);
+            memcpy(data + 8, pkt + 36, 2);
+            memcpy(data + 10, pkt + 34, 2);
+            h = fe_nat_toeplitz(key, data, 12);
+            if ( (int)((h & 127) % 4) != i
+                 || h != fe_nat_toeplitz(key, pkt + 26, 12) ) {
+                return -1;
+            }
+            /* Blocks of the shard */
+            if ( ((_rd32(pkt + 26) - TEST_EXT_ADDR) * (FE_NAT_NPORTS / 256)
+                  + (_rd16(pkt + 34) - FE_NAT_PORT_MIN) / 256) % 4 != i ) {
+                return -1;
+            }
+        }
+    }
+    for ( i = 0; i < 4; i++ ) {
+        fe_nat_shard_release(s[i]);
+    }
+
+    return 0;
+}
+
+/*
+ * Measure the cycles per new connection steered to one of four queues, and
+ * per packet of the connections established (copies of the packets are
+ * translated in batches)
+ */
+static int
+test_bench(void)
+{
+    struct fe_nat_shard *s;
+    uint8_t (*pkts[2])[TEST_PKTLEN];
+    uint8_t (*batch)[TEST_PKTLEN];
+    uint8_t key[FE_NAT_RSS_KEY_SIZE];
+    uint64_t t0;
+    uint64_t t1;
+    uint64_t create;
+    uint64_t xlate;
+    int n;
+    int i;
+    int j;
+    int r;
+
+    s = _init_shard(0, 1, FE_NAT_MAX_ADDRS, 512, 8);
+    if ( NULL == s ) {
+        return -1;
+    }
+    for ( i = 0; i < FE_NAT_RSS_KEY_SIZE; i++ ) {
+        key[i] = (i & 1) ? 0x5a : 0x6d;
+    }
+    fe_nat_steer_set(s, 4, 0, 128, key);
+    n = TEST_SUBS * TEST_FLOWS;
+    pkts[0] = malloc(sizeof(*pkts[0]) * n);
+    pkts[1] = malloc(sizeof(*pkts[1]) * n);
+    batch = malloc(sizeof(*batch) * TEST_BATCH);
+    if ( NULL == pkts[0] || NULL == pkts[1] || NULL == batch ) {
+        return -1;
+    }
+    for ( i = 0; i < TEST_SUBS; i++ ) {
+        for ( j = 0; j < TEST_FLOWS; j++ ) {
+            _build_pkt(pkts[0][i * TEST_FLOWS + j], 17, 0x0a000000 + i,
+                       10000 + j, 0xcb007100 + (j & 0xff), 53, 0);
+        }
+    }
+    memcpy(pkts[1], pkts[0], sizeof(*pkts[0]) * n);
+
+    /* New connections */
+    t0 = fdb_rdtsc();
+    for ( i = 0; i < n; i++ ) {
+        if ( FE_NAT_XLATE != fe_nat_outbound(s, pkts[1][i], TEST_PKTLEN, 0) ) {
+            return -1;
+        }
+    }
+    t1 = fdb_rdtsc();
+    create = t1 - t0;
+    if ( (uint32_t)n != s->nconns ) {
+        return -1;
+    }
+    /* Inbound packets */
+    for ( i = 0; i < n; i++ ) {
+        memcpy(pkts[1][i] + 26, &s->conns[i].keys[1].saddr, 4);
+        memcpy(pkts[1][i] + 30, &s->conns[i].keys[1].daddr, 4);
+        memcpy(pkts[1][i] + 34, &s->conns[i].keys[1].sport, 2);
+        memcpy(pkts[1][i] + 36, &s->conns[i].keys[1].dport, 2);
+    }
+
+    /* Outbound and inbound in turn */
+    xlate = 0;
+    for ( r = 0; r < TEST_ROUNDS; r++ ) {
+        for ( i = 0; i < n; i += TEST_BATCH ) {
+            memcpy(batch, pkts[r & 1][i], sizeof(*batch) * TEST_BATCH);
+            t0 = fdb_rdtsc();
+            for ( j = 0; j < TEST_BATCH; j++ ) {
+                if ( r & 1 ) {
+                    if ( FE_NAT_XLATE
+                         != fe_nat_inbound(s, batch[j], TEST_PKTLEN, 1) ) {
+                        return -1;
+                    }
+                } else {
+                    if ( FE_NAT_XLATE
+                         != fe_nat_outbound(s, batch[j], TEST_PKTLEN, 1) ) {
+                        return -1;
+                    }
+                }
+            }
+            t1 = fdb_rdtsc();
+            xlate += t1 - t0;
+        }
+    }
+
+    printf("%d connections, new %.1f cycles/conn, established %.1f "
+           "cycles/packet, ", n, (double)create / n,
+           (double)xlate / ((uint64_t)n * TEST_ROUNDS));
+    free(pkts[0]);
+    free(pkts[1]);
+    free(batch);
+    fe_nat_shard_release(s);
+
+    return 0;
+}
+
+/* Macro for testing */
+#define TEST_FUNC(str, func, ret)               \
+    do {                                        \
+        printf("%s: ", str);                    \
+        if ( 0 == func() ) {                    \
+            printf("passed");                   \
+        } else {                                \
+            printf("failed");                   \
+            ret = -1;                           \
+        }                                       \
+        printf("\n");                           \
+    } while ( 0 )
+
+/*
+ * Main routine
+ */
+int
+main(int argc, const char *const argv[])
+{
+    int ret;
+
+    ret = 0;
+    TEST_FUNC("xlate", test_xlate, ret);
+    TEST_FUNC("blocks", test_blocks, ret);
+    TEST_FUNC("steer", test_steer, ret);
+    TEST_FUNC("bench", test_bench, ret);
+
+    return ret;
+}
+
+/*
+ * Local variables:
+ * tab-width: 4
+ * c-basic-offset: 4
+ * End:
+ * vim600: sw=4 ts=4 fdm=marker
+ * vim<600: sw=4 ts=4
+ */
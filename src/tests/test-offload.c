@@ -0,0 +1,293 @@
+/*_
+ * Copyright (c) 2017 Hirochika Asai <asai@jar.jp>
+ * All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../ids/fe/offload.h"
+
+/*
+ * Reference checksum of a buffer
+ */
+static uint16_t
+_cksum(const uint8_t *p, int len, uint32_t sum)
+{
+    int i;
+
+    for ( i = 0; i < len; i++ ) {
+        sum += (i & 1) ? p[i] : ((uint32_t)p[i] << 8);
+    }
+    while ( sum >> 16 ) {
+        sum = (sum & 0xffff) + (sum >> 16);
+    }
+
+    return ~sum & 0xffff;
+}
+
+/*
+ * Verify the IPv4 and the TCP/UDP checksums of a frame
+ */
+static int
+_verify(const uint8_t *pkt, int l2len)
+{
+    uint32_t sum;
+    int l3len;
+    int l4len;
+    int i;
+
+    l3len = (pkt[l2len] & 0xf) * 4;
+    l4len = (((int)pkt[l2len + 2] << 8) | pkt[l2len + 3]) - l3len;
+    if ( 0 != _cksum(pkt + l2len, l3len, 0) ) {
+        return -1;
+    }
+    sum = pkt[l2len + 9] + l4len;
+    for ( i = 12; i < 20; i += 2 ) {
+        sum += ((uint32_t)pkt[l2len + i] << 8) | pkt[l2len + i + 1];
+    }
+
+    return 0 == _cksum(pkt + l2len + l3len, l4len, sum) ? 0 : -1;
+}
+
+/*
+ * Build a TCP or UDP/IPv4 frame with the payload of n bytes
+ */
+static int
+_build(uint8_t *pkt, int proto, int vlan, int n)
+{
+    int l2len;
+    int l4len;
+    int i;
+
+    memset(pkt, 0, 128);
+    l2len = 14;
+    if ( vlan ) {
+        pkt[12] = 0x81;
+        pkt[15] = 10;
+        l2len = 18;
+    }
+    pkt[l2len - 2] = 0x08;
+    pkt[l2len] = 0x45;
+    pkt[l2len + 8] = 64;
+    pkt[l2len + 9] = proto;
+    pkt[l2len + 12] = 192;
+    pkt[l2len + 13] = 168;
+    pkt[l2len + 15] = 1;
+    pkt[l2len + 16] = 10;
+    pkt[l2len + 19] = 0xfe;
+    l4len = (6 == proto ? 20 : 8) + n;
+    pkt[l2len + 2] = (20 + l4len) >> 8;
+    pkt[l2len + 3] = 20 + l4len;
+    pkt[l2len + 20] = 0x30;
+    pkt[l2len + 21] = 0x39;
+    pkt[l2len + 23] = 80;
+    if ( 6 == proto ) {
+        pkt[l2len + 32] = 0x50;
+    } else {
+        pkt[l2len + 24] = l4len >> 8;
+        pkt[l2len + 25] = l4len;
+    }
+    for ( i = l2len + 20 + l4len - n; i < l2len + 20 + l4len; i++ ) {
+        pkt[i] = i * 7;
+    }
+    /* Garbage in the checksum fields */
+    pkt[l2len + 10] = 0xde;
+    pkt[l2len + 11] = 0xad;
+
+    return l2len + 20 + l4len;
+}
+
+/*
+ * Tx checksum insertion in software
+ */
+static int
+test_tx_sw(void)
+{
+    struct fe_offload ol;
+    uint8_t pkt[128];
+    int len;
+    int n;
+
+    for ( n = 0; n < 32; n++ ) {
+        /* TCP with an odd payload length */
+        len = _build(pkt, 6, n & 1, n);
+        ol.flags = 0;
+        if ( fe_offload_tx_request(&ol, pkt, len, FE_OFFLOAD_TX_IPCS
+                                   | FE_OFFLOAD_TX_TCPCS) < 0 ) {
+            return -1;
+        }
+        if ( ol.l2len != ((n & 1) ? 18 : 14) || 20 != ol.l3len ) {
+            return -1;
+        }
+        fe_offload_tx_sw(&ol, pkt, len);
+        if ( (ol.flags & FE_OFFLOAD_TX_MASK) || _verify(pkt, ol.l2len) ) {
+            return -1;
+        }
+
+        /* UDP */
+        len = _build(pkt, 17, n & 1, n);
+        ol.flags = FE_OFFLOAD_RX_HASH;
+        if ( fe_offload_tx_request(&ol, pkt, len, FE_OFFLOAD_TX_IPCS
+                                   | FE_OFFLOAD_TX_UDPCS) < 0 ) {
+            return -1;
+        }
+        fe_offload_tx_sw(&ol, pkt, len);
+        if ( FE_OFFLOAD_RX_HASH != ol.flags || _verify(pkt, ol.l2len) ) {
+            return -1;
+        }
+    }
+
+    /* Type mismatch and fragments are refused */
+    len = _build(pkt, 17, 0, 8);
+    if ( fe_offload_tx_request(&ol, pkt, len, FE_OFFLOAD_TX_TCPCS) >= 0 ) {
+        return -1;
+    }
+    pkt[14 + 6] = 0x20;
+    if ( fe_offload_tx_request(&ol, pkt, len, FE_OFFLOAD_TX_UDPCS) >= 0 ) {
+        return -1;
+    }
+    /* but the IPv4 checksum is inserted for a fragment */
+    if ( fe_offload_tx_request(&ol, pkt, len, FE_OFFLOAD_TX_IPCS) < 0 ) {
+        return -1;
+    }
+    fe_offload_tx_sw(&ol, pkt, len);
+    if ( 0 != _cksum(pkt + 14, 20, 0) ) {
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * Context and data descriptor fields of the Tx offload
+ */
+static int
+test_tx_adv(void)
+{
+    struct fe_offload ol;
+    uint8_t pkt[128];
+    uint64_t ctx;
+    int len;
+
+    len = _build(pkt, 6, 1, 0);
+    ol.flags = 0;
+    fe_offload_tx_request(&ol, pkt, len, FE_OFFLOAD_TX_IPCS
+                          | FE_OFFLOAD_TX_TCPCS);
+    ctx = fe_offload_adv_ctx(&ol);
+    if ( (18 << 9 | 20) != (uint32_t)ctx
+         || 0x20200c00 != (uint32_t)(ctx >> 32) ) {
+        return -1;
+    }
+    if ( 0x380 != fe_offload_adv_popts(&ol) ) {
+        return -1;
+    }
+    len = _build(pkt, 17, 0, 0);
+    fe_offload_tx_request(&ol, pkt, len, FE_OFFLOAD_TX_UDPCS);
+    ctx = fe_offload_adv_ctx(&ol);
+    if ( (14 << 9 | 20) != (uint32_t)ctx
+         || 0x20200400 != (uint32_t)(ctx >> 32) ) {
+        return -1;
+    }
+    if ( 0x280 != fe_offload_adv_popts(&ol) ) {
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * Rx write-back decoding
+ */
+static int
+test_rx_adv(void)
+{
+    struct fe_offload ol;
+
+    /* TCP/IPv4 with the hash, the checksums good */
+    fe_offload_rx_adv(&ol, (0x11 << 4) | 1, 0x12345678, 0x63);
+    if ( (FE_OFFLOAD_RX_HASH | FE_OFFLOAD_RX_IPCS_GOOD
+          | FE_OFFLOAD_RX_L4CS_GOOD) != ol.flags || 0x12345678 != ol.hash
+         || (FE_OFFLOAD_PTYPE_IPV4 | FE_OFFLOAD_PTYPE_TCP) != ol.ptype ) {
+        return -1;
+    }
+    if ( fe_offload_rx_bad(&ol) ) {
+        return -1;
+    }
+    /* Bad IPv4 and TCP checksums */
+    fe_offload_rx_adv(&ol, (0x11 << 4) | 1, 0, 0xc0000063);
+    if ( (FE_OFFLOAD_RX_HASH | FE_OFFLOAD_RX_IPCS_BAD
+          | FE_OFFLOAD_RX_L4CS_BAD) != ol.flags || !fe_offload_rx_bad(&ol) ) {
+        return -1;
+    }
+    /* The L4 error is not trusted for UDP */
+    fe_offload_rx_adv(&ol, 0x21 << 4, 0, 0x40000073);
+    if ( FE_OFFLOAD_RX_IPCS_GOOD != ol.flags
+         || (FE_OFFLOAD_PTYPE_IPV4 | FE_OFFLOAD_PTYPE_UDP) != ol.ptype ) {
+        return -1;
+    }
+    /* Non-IP (EtherType filter) */
+    fe_offload_rx_adv(&ol, 0x811 << 4, 0, 0x03);
+    if ( 0 != ol.flags || 0 != ol.ptype ) {
+        return -1;
+    }
+
+    return 0;
+}
+
+/* Macro for testing */
+#define TEST_FUNC(str, func, ret)               \
+    do {                                        \
+        printf("%s: ", str);                    \
+        if ( 0 == func() ) {                    \
+            printf("passed");                   \
+        } else {                                \
+            printf("failed");                   \
+            ret = -1;                           \
+        }                                       \
+        printf("\n");                           \
+    } while ( 0 )
+
+/*
+ * Main routine
+ */
+int
+main(int argc, const char *const argv[])
+{
+    int ret;
+
+    ret = 0;
+    TEST_FUNC("tx_sw", test_tx_sw, ret);
+    TEST_FUNC("tx_adv", test_tx_adv, ret);
+    TEST_FUNC("rx_adv", test_rx_adv, ret);
+
+    return ret;
+}
+
+/*
+ * Local variables:
+ * tab-width: 4
+ * c-basic-offset: 4
+ * End:
+ * vim600: sw=4 ts=4 fdm=marker
+ * vim<600: sw=4 ts=4
+ */
@@ -0,0 +1,312 @@
+/*_
+ * Copyright (c) 2017 Hirochika Asai <asai@jar.jp>
+ * All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../ids/fe/qos.h"
+
+/* Simulated clock: 1 cycle per nanosecond */
+#define TEST_HZ         1000000000ULL
+#define TEST_STEP       1000            /* 1 us */
+#define TEST_DURATION   10000000        /* 10 ms */
+#define TEST_MAXPKTS    100000
+/* Line rate of the simulated link (faster than the shaped rate) */
+#define TEST_LINK_BPS   1250000000ULL
+
+/*
+ * Initialize a scheduler
+ */
+static void
+_init_sched(struct fe_qos_sched *s, uint64_t bps)
+{
+    int i;
+
+    memset(s, 0, sizeof(struct fe_qos_sched));
+    fe_qos_tb_set(&s->tb, bps, FE_QOS_DEFAULT_BURST, TEST_HZ, 0);
+    for ( i = 0; i < FE_QOS_NCLASSES; i++ ) {
+        s->classes[i].quantum = FE_QOS_QUANTUM;
+    }
+}
+
+/*
+ * Dequeue the packets conforming to the shapers while the link is idle, and
+ * record the latency of each packet per class
+ */
+static uint64_t
+_drain(struct fe_qos_sched *s, uint64_t now, uint64_t *link, uint64_t **lat,
+       int *nlat)
+{
+    struct fe_qos_pkt *p;
+    uint64_t bytes;
+    int cls;
+
+    fe_qos_refill(s, now);
+    bytes = 0;
+    while ( *link <= now && NULL != (p = fe_qos_peek(s, &cls)) ) {
+        /* Serialization */
+        *link = now + (uint64_t)p->len * 8 * TEST_HZ / TEST_LINK_BPS;
+        bytes += p->len;
+        if ( NULL != lat && nlat[cls] < TEST_MAXPKTS ) {
+            lat[cls][nlat[cls]++] = now - p->tsc;
+        }
+        fe_qos_commit(s, cls);
+    }
+
+    return bytes;
+}
+
+static int
+_cmp(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+/*
+ * 99th percentile
+ */
+static uint64_t
+_p99(uint64_t *v, int n)
+{
+    if ( n <= 0 ) {
+        return 0;
+    }
+    qsort(v, n, sizeof(uint64_t), _cmp);
+
+    return v[n * 99 / 100];
+}
+
+/*
+ * Test that the port is shaped to the rate
+ */
+int
+test_shaping(void)
+{
+    struct fe_qos_sched s;
+    uint64_t now;
+    uint64_t next;
+    uint64_t link;
+    uint64_t bytes;
+    uint64_t expected;
+
+    _init_sched(&s, 1000000000ULL);
+
+    /* 1500-byte packets at 2 Gbps */
+    bytes = 0;
+    next = 0;
+    link = 0;
+    for ( now = 0; now < TEST_DURATION; now += TEST_STEP ) {
+        for ( ; next <= now; next += 6000 ) {
+            fe_qos_enqueue(&s, 2, next / 6000, NULL, NULL, 1500, now);
+        }
+        bytes += _drain(&s, now, &link, NULL, NULL);
+    }
+    expected = 1000000000ULL / 8 * TEST_DURATION / TEST_HZ;
+    printf("%lld bytes for %lld bytes, ", (long long)bytes,
+           (long long)expected);
+    if ( bytes < expected - 1500
+         || bytes > expected + FE_QOS_DEFAULT_BURST + 1500 ) {
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * Test the latency of the strict priority class under congestion
+ */
+int
+test_priority(void)
+{
+    struct fe_qos_sched s;
+    uint64_t *lat[FE_QOS_NCLASSES];
+    int nlat[FE_QOS_NCLASSES];
+    uint64_t now;
+    uint64_t next;
+    uint64_t link;
+    uint64_t hp;
+    uint64_t bulk;
+    int i;
+    int ret;
+
+    _init_sched(&s, 1000000000ULL);
+    s.classes[0].strict = 1;
+    fe_qos_tb_set(&s.classes[0].tb, 100000000ULL, FE_QOS_MIN_BURST, TEST_HZ,
+                  0);
+    for ( i = 0; i < FE_QOS_NCLASSES; i++ ) {
+        lat[i] = malloc(sizeof(uint64_t) * TEST_MAXPKTS);
+        if ( NULL == lat[i] ) {
+            return -1;
+        }
+        nlat[i] = 0;
+    }
+
+    /* Bulk: 1500-byte packets of 16 flows at 2 Gbps; high priority: 64-byte
+       packets every 100 us */
+    next = 0;
+    link = 0;
+    for ( now = 0; now < TEST_DURATION; now += TEST_STEP ) {
+        for ( ; next <= now; next += 6000 ) {
+            fe_qos_enqueue(&s, 2, next / 6000, NULL, NULL, 1500, now);
+        }
+        if ( 0 == now % 100000 ) {
+            fe_qos_enqueue(&s, 0, 0, NULL, NULL, 64, now);
+        }
+        _drain(&s, now, &link, lat, nlat);
+    }
+
+    hp = _p99(lat[0], nlat[0]);
+    bulk = _p99(lat[2], nlat[2]);
+    printf("p99 latency: high %lld ns (%d pkts), bulk %lld ns (%d pkts), ",
+           (long long)hp, nlat[0], (long long)bulk, nlat[2]);
+    /* Within a bulk packet time plus the step */
+    ret = (nlat[0] > 0 && hp <= 12000 + TEST_STEP && bulk > hp) ? 0 : -1;
+
+    for ( i = 0; i < FE_QOS_NCLASSES; i++ ) {
+        free(lat[i]);
+    }
+
+    return ret;
+}
+
+/*
+ * Test the share of the DRR classes by the weights
+ */
+int
+test_drr(void)
+{
+    struct fe_qos_sched s;
+    struct fe_qos_pkt *p;
+    uint64_t bytes[FE_QOS_NCLASSES];
+    int cls;
+    int i;
+
+    _init_sched(&s, 0);
+    s.classes[1].quantum = 4 * FE_QOS_QUANTUM;
+    s.classes[2].quantum = FE_QOS_QUANTUM;
+    memset(bytes, 0, sizeof(bytes));
+    for ( i = 0; i < 10000; i++ ) {
+        /* Keep both backlogged */
+        while ( 0 == fe_qos_enqueue(&s, 1, i, NULL, NULL, 1000, 0) ) {
+        }
+        while ( 0 == fe_qos_enqueue(&s, 2, i, NULL, NULL, 300, 0) ) {
+        }
+        p = fe_qos_peek(&s, &cls);
+        if ( NULL == p ) {
+            return -1;
+        }
+        bytes[cls] += p->len;
+        fe_qos_commit(&s, cls);
+    }
+    printf("%lld:%lld bytes, ", (long long)bytes[1], (long long)bytes[2]);
+    if ( bytes[1] < bytes[2] * 35 / 10 || bytes[1] > bytes[2] * 45 / 10 ) {
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * Test the classification
+ */
+int
+test_classify(void)
+{
+    struct fe_qos_map map;
+    uint8_t pkt[64];
+    uint32_t h;
+
+    fe_qos_map_default(&map);
+
+    /* IPv4 EF */
+    memset(pkt, 0, sizeof(pkt));
+    pkt[12] = 0x08;
+    pkt[14] = 0x45;
+    pkt[15] = 46 << 2;
+    if ( 0 != fe_qos_classify(&map, pkt, sizeof(pkt), &h) ) {
+        return -1;
+    }
+    /* IPv4 best effort */
+    pkt[15] = 0;
+    if ( 2 != fe_qos_classify(&map, pkt, sizeof(pkt), &h) ) {
+        return -1;
+    }
+    /* 802.1Q priority 5 over IPv4 best effort */
+    memset(pkt, 0, sizeof(pkt));
+    pkt[12] = 0x81;
+    pkt[14] = 5 << 5;
+    pkt[16] = 0x08;
+    pkt[18] = 0x45;
+    if ( 1 != fe_qos_classify(&map, pkt, sizeof(pkt), &h) ) {
+        return -1;
+    }
+    /* Truncated */
+    if ( 2 != fe_qos_classify(&map, pkt, 10, &h) ) {
+        return -1;
+    }
+
+    return 0;
+}
+
+/* Macro for testing */
+#define TEST_FUNC(str, func, ret)               \
+    do {                                        \
+        printf("%s: ", str);                    \
+        if ( 0 == func() ) {                    \
+            printf("passed");                   \
+        } else {                                \
+            printf("failed");                   \
+            ret = -1;                           \
+        }                                       \
+        printf("\n");                           \
+    } while ( 0 )
+
+/*
+ * Main routine
+ */
+int
+main(int argc, const char *const argv[])
+{
+    int ret;
+
+    ret = 0;
+    TEST_FUNC("shaping", test_shaping, ret);
+    TEST_FUNC("priority", test_priority, ret);
+    TEST_FUNC("drr", test_drr, ret);
+    TEST_FUNC("classify", test_classify, ret);
+
+    return ret;
+}
+
+/*
+ * Local variables:
+ * tab-width: 4
+ * c-basic-offset: 4
+ * End:
+ * vim600: sw=4 ts=4 fdm=marker
+ * vim<600: sw=4 ts=4
+ */
@@ -0,0 +1,485 @@
+/*_
+ * Copyright (c) 2017 Hirochika Asai <asai@jar.jp>
+ * All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../ids/fe/fdb.h"
+#include "../ids/fe/lag.h"
+#include "../ids/fe/tunnel.h"
+
+/* 192.0.2.1 and 192.0.2.2, 192.0.2.3 */
+#define TEST_LOCAL      0xc0000201
+#define TEST_REMOTE     0xc0000202
+#define TEST_REMOTE2    0xc0000203
+#define TEST_PKTLEN     64
+#define TEST_HDROFF     512
+#define TEST_BUFSZ      2048
+#define TEST_NBUFS      256
+#define TEST_ROUNDS     256
+
+static const uint8_t test_mac[6] = { 0x02, 0x00, 0x00, 0x00, 0x00, 0x01 };
+static const uint8_t test_gw[6] = { 0x02, 0x00, 0x00, 0x00, 0x00, 0xfe };
+
+/*
+ * Build an untagged IPv4/UDP frame (or a tagged one if vlan is not 0)
+ */
+static int
+_build_frame(uint8_t *pkt, int src, int dst, int vlan)
+{
+    int off;
+    int i;
+
+    memset(pkt, 0, TEST_PKTLEN);
+    pkt[0] = 0x02;
+    pkt[4] = dst >> 8;
+    pkt[5] = dst;
+    pkt[6] = 0x02;
+    pkt[10] = src >> 8;
+    pkt[11] = src;
+    off = 12;
+    if ( vlan ) {
+        pkt[12] = 0x81;
+        pkt[14] = vlan >> 8;
+        pkt[15] = vlan;
+        off = 16;
+    }
+    pkt[off] = 0x08;
+    pkt[off + 2] = 0x45;
+    pkt[off + 11] = 17;
+    pkt[off + 14] = 10;
+    pkt[off + 15] = src;
+    pkt[off + 18] = 10;
+    pkt[off + 19] = dst;
+    pkt[off + 22] = src >> 8;
+    pkt[off + 23] = src;
+    pkt[off + 24] = 0;
+    pkt[off + 25] = 53;
+    for ( i = off + 30; i < TEST_PKTLEN; i++ ) {
+        pkt[i] = i;
+    }
+
+    return TEST_PKTLEN;
+}
+
+/*
+ * Check the outer IPv4 header checksum
+ */
+static int
+_verify_csum(const uint8_t *pkt)
+{
+    uint32_t s;
+    int i;
+
+    s = 0;
+    for ( i = 14; i < 34; i += 2 ) {
+        s += ((uint32_t)pkt[i] << 8) | pkt[i + 1];
+    }
+    while ( s >> 16 ) {
+        s = (s & 0xffff) + (s >> 16);
+    }
+
+    return 0xffff == s;
+}
+
+/*
+ * Set up the local endpoint and its peer: VNI 100 on port 1 (untagged) and
+ * VNI 200 on port 2 (VLAN 10) locally, and VNI 100 on port 5 and VNI 200 on
+ * port 6 (VLAN 20) at the peer
+ */
+static void
+_init_pair(struct fe_tunnel *local, struct fe_tunnel *peer, int type)
+{
+    fe_tunnel_init(local, type, 0, TEST_LOCAL, test_mac, 0);
+    fe_tunnel_add_vtep(local, TEST_REMOTE, test_gw);
+    fe_tunnel_add_vtep(local, TEST_REMOTE2, test_gw);
+    fe_tunnel_add_vni(local, 100, 1, 0, 3);
+    fe_tunnel_add_vni(local, 200, 2, 10, 1);
+
+    fe_tunnel_init(peer, type, 4, TEST_REMOTE, test_gw, 0);
+    fe_tunnel_add_vtep(peer, TEST_LOCAL, test_mac);
+    fe_tunnel_add_vni(peer, 100, 5, 0, 1);
+    fe_tunnel_add_vni(peer, 200, 6, 20, 1);
+}
+
+/*
+ * Encapsulate and decapsulate a frame through a pair of endpoints
+ */
+static int
+_test_roundtrip(int type)
+{
+    struct fe_tunnel *local;
+    struct fe_tunnel *peer;
+    uint8_t buf[TEST_BUFSZ];
+    uint8_t orig[TEST_PKTLEN];
+    uint8_t *pkt;
+    uint8_t *p;
+    uint32_t vni;
+    int len;
+    int vtep;
+    int k;
+
+    local = malloc(sizeof(struct fe_tunnel));
+    peer = malloc(sizeof(struct fe_tunnel));
+    if ( NULL == local || NULL == peer ) {
+        return -1;
+    }
+    _init_pair(local, peer, type);
+
+    /* Untagged, VNI 100 */
+    pkt = buf + TEST_HDROFF;
+    len = _build_frame(pkt, 1, 2, 0);
+    memcpy(orig, pkt, len);
+    if ( fe_tunnel_access(local, 3, &pkt, &len) >= 0 ) {
+        return -1;
+    }
+    k = fe_tunnel_access(local, 1, &pkt, &len);
+    if ( 0 != k || pkt != buf + TEST_HDROFF ) {
+        return -1;
+    }
+    fe_tunnel_encap(local, k, 1, &pkt, &len, 0x12345);
+    if ( pkt != buf + TEST_HDROFF - local->hdrlen
+         || len != TEST_PKTLEN + local->hdrlen ) {
+        return -1;
+    }
+    if ( 0 != memcmp(pkt, test_gw, 6) || 0 != memcmp(pkt + 6, test_mac, 6)
+         || 0x08 != pkt[12] || 0x00 != pkt[13] || !_verify_csum(pkt)
+         || ((pkt[16] << 8) | pkt[17]) != len - 14 || 0x40 != pkt[20]
+         || 0xc0 != pkt[30] || 0x03 != pkt[33] ) {
+        return -1;
+    }
+    if ( FE_TUNNEL_VXLAN == type ) {
+        vni = (pkt[46] << 16) | (pkt[47] << 8) | pkt[48];
+        if ( 17 != pkt[23] || 0xe3 != pkt[34] || 0x45 != pkt[35]
+             || 0x12 != pkt[36] || 0xb5 != pkt[37]
+             || ((pkt[38] << 8) | pkt[39]) != len - 34 || 0x08 != pkt[42]
+             || 100 != vni ) {
+            return -1;
+        }
+    } else {
+        vni = (pkt[38] << 16) | (pkt[39] << 8) | pkt[40];
+        if ( 47 != pkt[23] || 0x20 != pkt[34] || 0x65 != pkt[36]
+             || 0x58 != pkt[37] || 100 != vni || 0x45 != pkt[41] ) {
+            return -1;
+        }
+    }
+
+    /* To 192.0.2.2 */
+    pkt = buf + TEST_HDROFF;
+    len = TEST_PKTLEN;
+    fe_tunnel_encap(local, 0, 0, &pkt, &len, 0);
+    if ( FE_TUNNEL_PASS != fe_tunnel_decap(local, &pkt, &len, &k, &vtep) ) {
+        return -1;
+    }
+    if ( FE_TUNNEL_DECAP != fe_tunnel_decap(peer, &pkt, &len, &k, &vtep)
+         || 0 != k || 0 != vtep || pkt != buf + TEST_HDROFF
+         || TEST_PKTLEN != len || 0 != memcmp(pkt, orig, TEST_PKTLEN) ) {
+        return -1;
+    }
+
+    /* VLAN 10, VNI 200 to VLAN 20 */
+    pkt = buf + TEST_HDROFF;
+    len = _build_frame(pkt, 1, 2, 10);
+    memcpy(orig, pkt, len);
+    p = pkt;
+    k = fe_tunnel_access(local, 2, &pkt, &len);
+    if ( 1 != k || pkt != p + 4 || TEST_PKTLEN - 4 != len
+         || 0 != memcmp(pkt, orig, 12) || 0x08 != pkt[12] ) {
+        return -1;
+    }
+    fe_tunnel_encap(local, k, 0, &pkt, &len, 0);
+    if ( FE_TUNNEL_DECAP != fe_tunnel_decap(peer, &pkt, &len, &k, &vtep)
+         || 1 != k || pkt != p || TEST_PKTLEN != len
+         || 0 != memcmp(pkt, orig, 12) || 0x81 != pkt[12] || 0 != pkt[13]
+         || 0 != pkt[14] || 20 != pkt[15]
+         || 0 != memcmp(pkt + 16, orig + 16, TEST_PKTLEN - 16) ) {
+        return -1;
+    }
+    /* VLAN not bridged */
+    pkt = buf + TEST_HDROFF;
+    len = _build_frame(pkt, 1, 2, 11);
+    if ( fe_tunnel_access(local, 2, &pkt, &len) >= 0 ) {
+        return -1;
+    }
+
+    /* Unknown VTEP, unknown VNI, fragment, and truncated */
+    pkt = buf + TEST_HDROFF;
+    len = _build_frame(pkt, 1, 2, 0);
+    fe_tunnel_encap(local, 0, 0, &pkt, &len, 0);
+    p = pkt;
+    p[29] = 0x03;
+    if ( FE_TUNNEL_BAD != fe_tunnel_decap(peer, &p, &len, &k, &vtep) ) {
+        return -1;
+    }
+    p[29] = 0x01;
+    if ( FE_TUNNEL_VXLAN == type ) {
+        p[48] = 99;
+    } else {
+        p[40] = 99;
+    }
+    if ( FE_TUNNEL_BAD != fe_tunnel_decap(peer, &p, &len, &k, &vtep) ) {
+        return -1;
+    }
+    if ( FE_TUNNEL_VXLAN == type ) {
+        p[48] = 100;
+    } else {
+        p[40] = 100;
+    }
+    p[20] = 0x20;
+    if ( FE_TUNNEL_BAD != fe_tunnel_decap(peer, &p, &len, &k, &vtep) ) {
+        return -1;
+    }
+    p[20] = 0x40;
+    len--;
+    if ( FE_TUNNEL_BAD != fe_tunnel_decap(peer, &p, &len, &k, &vtep) ) {
+        return -1;
+    }
+    len++;
+    if ( FE_TUNNEL_DECAP != fe_tunnel_decap(peer, &p, &len, &k, &vtep) ) {
+        return -1;
+    }
+
+    free(local);
+    free(peer);
+
+    return 0;
+}
+
+static int
+test_vxlan(void)
+{
+    return _test_roundtrip(FE_TUNNEL_VXLAN);
+}
+
+static int
+test_gre(void)
+{
+    return _test_roundtrip(FE_TUNNEL_GRE);
+}
+
+/*
+ * ARP for the local VTEP
+ */
+static int
+test_arp(void)
+{
+    struct fe_tunnel *tun;
+    uint8_t buf[TEST_PKTLEN];
+    uint8_t *pkt;
+    int len;
+    int vtep;
+    int k;
+
+    tun = malloc(sizeof(struct fe_tunnel));
+    if ( NULL == tun ) {
+        return -1;
+    }
+    fe_tunnel_init(tun, FE_TUNNEL_VXLAN, 0, TEST_LOCAL, test_mac, 0);
+
+    memset(buf, 0, sizeof(buf));
+    memset(buf, 0xff, 6);
+    memcpy(buf + 6, test_gw, 6);
+    buf[12] = 0x08;
+    buf[13] = 0x06;
+    buf[15] = 1;
+    buf[16] = 0x08;
+    buf[18] = 6;
+    buf[19] = 4;
+    buf[21] = 1;
+    memcpy(buf + 22, test_gw, 6);
+    buf[28] = 0xc0;
+    buf[31] = 0xfe;
+    buf[38] = 0xc0;
+    buf[40] = 0x02;
+    buf[41] = 0x09;
+    pkt = buf;
+    len = 60;
+    if ( FE_TUNNEL_PASS != fe_tunnel_decap(tun, &pkt, &len, &k, &vtep) ) {
+        return -1;
+    }
+    buf[41] = 0x01;
+    if ( FE_TUNNEL_ARP != fe_tunnel_decap(tun, &pkt, &len, &k, &vtep)
+         || pkt != buf || 60 != len ) {
+        return -1;
+    }
+    if ( 0 != memcmp(buf, test_gw, 6) || 0 != memcmp(buf + 6, test_mac, 6)
+         || 2 != buf[21] || 0 != memcmp(buf + 22, test_mac, 6)
+         || 0xc0 != buf[28] || 0x01 != buf[31]
+         || 0 != memcmp(buf + 32, test_gw, 6) || 0xc0 != buf[38]
+         || 0xfe != buf[41] ) {
+        return -1;
+    }
+    free(tun);
+
+    return 0;
+}
+
+/*
+ * Cycles per packet of the lookup of the destination (plain switching), and
+ * of the encapsulation and the decapsulation including the lookup or the
+ * learning check of the remote VTEP and the flow hash
+ */
+static int
+test_bench(void)
+{
+    struct fe_tunnel *local;
+    struct fe_tunnel *peer;
+    struct fdb *fdb;
+    struct fdb *vteps;
+    struct fdb_entry *e;
+    uint8_t key[FDB_KEY_SIZE];
+    uint8_t *bufs;
+    uint8_t *pkt;
+    uint8_t *encs[TEST_NBUFS];
+    uint32_t hash;
+    uint64_t t0;
+    uint64_t sw;
+    uint64_t enc;
+    uint64_t dec;
+    int len;
+    int vtep;
+    int k;
+    int i;
+    int r;
+
+    local = malloc(sizeof(struct fe_tunnel));
+    peer = malloc(sizeof(struct fe_tunnel));
+    bufs = malloc(TEST_BUFSZ * TEST_NBUFS);
+    fdb = fdb_init();
+    vteps = fdb_init();
+    if ( NULL == local || NULL == peer || NULL == bufs || NULL == fdb
+         || NULL == vteps ) {
+        return -1;
+    }
+    _init_pair(local, peer, FE_TUNNEL_VXLAN);
+    for ( i = 0; i < TEST_NBUFS; i++ ) {
+        pkt = bufs + TEST_BUFSZ * i + TEST_HDROFF;
+        _build_frame(pkt, i, i + TEST_NBUFS, 0);
+        /* The destinations are learned in both of the databases */
+        memcpy(key, pkt, 6);
+        memset(key + 6, 0, 2);
+        fdb_update(fdb, key, 1);
+        fe_tunnel_fdb_key(key, pkt, 0);
+        fdb_update(vteps, key, 1);
+    }
+
+    sw = 0;
+    enc = 0;
+    dec = 0;
+    for ( r = 0; r < TEST_ROUNDS; r++ ) {
+        /* Switching */
+        t0 = fdb_rdtsc();
+        for ( i = 0; i < TEST_NBUFS; i++ ) {
+            pkt = bufs + TEST_BUFSZ * i + TEST_HDROFF;
+            memcpy(key, pkt, 6);
+            memset(key + 6, 0, 2);
+            e = fdb_lookup(fdb, key);
+            if ( NULL == e || 1 != e->port ) {
+                return -1;
+            }
+        }
+        sw += fdb_rdtsc() - t0;
+
+        /* Encapsulation */
+        t0 = fdb_rdtsc();
+        for ( i = 0; i < TEST_NBUFS; i++ ) {
+            pkt = bufs + TEST_BUFSZ * i + TEST_HDROFF;
+            len = TEST_PKTLEN;
+            k = fe_tunnel_access(local, 1, &pkt, &len);
+            fe_tunnel_fdb_key(key, pkt, k);
+            e = fdb_lookup(vteps, key);
+            if ( NULL == e ) {
+                return -1;
+            }
+            hash = fe_lag_hash(pkt, len, FE_LAG_HASH_L4);
+            fe_tunnel_encap(local, k, 0, &pkt, &len, hash);
+            encs[i] = pkt;
+        }
+        enc += fdb_rdtsc() - t0;
+
+        /* Decapsulation */
+        t0 = fdb_rdtsc();
+        for ( i = 0; i < TEST_NBUFS; i++ ) {
+            pkt = encs[i];
+            len = TEST_PKTLEN + FE_TUNNEL_VXLAN_HDRLEN;
+            if ( FE_TUNNEL_DECAP
+                 != fe_tunnel_decap(peer, &pkt, &len, &k, &vtep) ) {
+                return -1;
+            }
+            fe_tunnel_fdb_key(key, pkt + 6, k);
+            fdb_learn_required(vteps, key, vtep);
+        }
+        dec += fdb_rdtsc() - t0;
+    }
+
+    printf("switch %.1f, encap %.1f, decap %.1f cycles/packet, ",
+           (double)sw / (TEST_NBUFS * TEST_ROUNDS),
+           (double)enc / (TEST_NBUFS * TEST_ROUNDS),
+           (double)dec / (TEST_NBUFS * TEST_ROUNDS));
+    free(local);
+    free(peer);
+    free(bufs);
+
+    return 0;
+}
+
+/* Macro for testing */
+#define TEST_FUNC(str, func, ret)               \
+    do {                                        \
+        printf("%s: ", str);                    \
+        if ( 0 == func() ) {                    \
+            printf("passed");                   \
+        } else {                                \
+            printf("failed");                   \
+            ret = -1;                           \
+        }                                       \
+        printf("\n");                           \
+    } while ( 0 )
+
+/*
+ * Main routine
+ */
+int
+main(int argc, const char *const argv[])
+{
+    int ret;
+
+    ret = 0;
+    TEST_FUNC("vxlan", test_vxlan, ret);
+    TEST_FUNC("gre", test_gre, ret);
+    TEST_FUNC("arp", test_arp, ret);
+    TEST_FUNC("bench", test_bench, ret);
+
+    return ret;
+}
+
+/*
+ * Local variables:
+ * tab-width: 4
+ * c-basic-offset: 4
+ * End:
+ * vim600: sw=4 ts=4 fdm=marker
+ * vim<600: sw=4 ts=4
+ */